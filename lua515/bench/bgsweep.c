@@ -0,0 +1,81 @@
+/* Cost of collector steps with and without the background sweeper
+ * (LUA_GCBGSWEEP).
+ *
+ * Each round drops a heap of small tables and strings, then drives
+ * the collection to its end with lua_gc(LUA_GCSTEP, 0) and times every
+ * step, as a host would between requests. Reported: the total time of
+ * the steps and the slowest one, in milliseconds.
+ *
+ * Build (from lua515/bench, with lua515/src built):
+ *   cc -O2 -DLUA_USE_PTHREADS -I../src -o bgsweep bgsweep.c \
+ *      ../src/liblua.a -lpthread -lm
+ * Usage: ./bgsweep [objects [rounds]]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/time.h>
+
+#include <lua.h>
+#include <lauxlib.h>
+#include <lualib.h>
+
+static const char *churn =
+    "local n = ...\n"
+    "local t = {}\n"
+    "for i = 1, n do t[i] = {i, 'k' .. i, x = i} end\n"
+    "return #t\n";
+
+static double now(void)
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+static void measure(int bg, int objects, int rounds)
+{
+    lua_State *L = luaL_newstate();
+    double total = 0, worst = 0;
+    int r, steps = 0;
+
+    luaL_openlibs(L);
+    lua_gc(L, LUA_GCBGSWEEP, bg);
+    lua_gc(L, LUA_GCSTOP, 0);
+    for (r = 0; r < rounds; r++) {
+        if (luaL_loadstring(L, churn)) {
+            fprintf(stderr, "%s\n", lua_tostring(L, -1));
+            exit(1);
+        }
+        lua_pushinteger(L, objects);
+        lua_call(L, 1, 0);  /* all garbage once it returns */
+        for (;;) {
+            double t0 = now(), dt;
+            int done = lua_gc(L, LUA_GCSTEP, 0);
+
+            dt = now() - t0;
+            total += dt;
+            if (dt > worst) worst = dt;
+            steps++;
+            if (done) break;
+        }
+    }
+    printf("%-12s %8d %12.2f %12.3f\n", bg ? "background" : "inline",
+           steps, total * 1e3, worst * 1e3);
+    lua_close(L);
+}
+
+int main(int argc, char **argv)
+{
+    int objects = argc > 1 ? atoi(argv[1]) : 200000;
+    int rounds = argc > 2 ? atoi(argv[2]) : 10;
+
+    if (objects < 1 || rounds < 1)
+        return 1;
+    printf("%-12s %8s %12s %12s\n", "sweep", "steps", "total(ms)",
+           "worst(ms)");
+    measure(0, objects, rounds);
+    measure(1, objects, rounds);
+    return 0;
+}
@@ -0,0 +1,98 @@
+-- bit operations: checksums and varint decoding with the bit library
+-- against the same loops written with arithmetic
+-- usage: lua bitops.lua [scale]
+
+local scale = tonumber(arg and arg[1]) or 1
+local clock = os.clock
+local floor = math.floor
+local band, bxor, bor = bit.band, bit.bxor, bit.bor
+local lshift, rshift = bit.lshift, bit.rshift
+
+local N = math.floor(200000 * scale)
+
+-- bytes to work on: varints of 1 to 4 bytes
+local data = {}
+do
+  local x = 1
+  while #data < N do
+    x = (x * 1103515245 + 12345) % 2147483648
+    local v = x % 2 ^ (7 * (x % 4 + 1))
+    while v >= 128 do
+      data[#data + 1] = v % 128 + 128
+      v = floor(v / 128)
+    end
+    data[#data + 1] = v
+  end
+end
+
+-- xor of two numbers under 2^32, one bit at a time
+local function axor(a, b)
+  local r, p = 0, 1
+  while a > 0 or b > 0 do
+    local x, y = a % 2, b % 2
+    if x ~= y then r = r + p end
+    a, b, p = (a - x) / 2, (b - y) / 2, p * 2
+  end
+  return r
+end
+
+local cases = {
+  { "crc32 arith", function ()
+      local crc = 4294967295
+      for i = 1, #data do
+        crc = axor(crc, data[i])
+        for _ = 1, 8 do
+          local low = crc % 2
+          crc = (crc - low) / 2
+          if low == 1 then crc = axor(crc, 3988292384) end
+        end
+      end
+      return axor(crc, 4294967295)
+    end },
+  { "crc32 bit", function ()
+      local crc = -1
+      for i = 1, #data do
+        crc = bxor(crc, data[i])
+        for _ = 1, 8 do
+          crc = bxor(rshift(crc, 1), band(-band(crc, 1), 0xedb88320))
+        end
+      end
+      return bxor(crc, -1) % 2 ^ 32
+    end },
+  { "varint arith", function ()
+      local s, i, n = 0, 1, #data
+      while i <= n do
+        local v, m = 0, 1
+        repeat
+          local b = data[i]
+          i = i + 1
+          v = v + (b % 128) * m
+          m = m * 128
+        until b < 128
+        s = (s + v) % 4294967296
+      end
+      return s
+    end },
+  { "varint bit", function ()
+      local s, i, n = 0, 1, #data
+      while i <= n do
+        local v, sh = 0, 0
+        repeat
+          local b = data[i]
+          i = i + 1
+          v = bor(v, lshift(band(b, 127), sh))
+          sh = sh + 7
+        until b < 128
+        s = (s + v) % 4294967296
+      end
+      return s
+    end },
+}
+
+print(string.format("%-14s %10s %12s", "case", "ms", "result"))
+for _, c in ipairs(cases) do
+  collectgarbage()
+  local t0 = clock()
+  local res = c[2]()
+  print(string.format("%-14s %10.1f %12.0f", c[1], (clock() - t0) * 1e3, res))
+end
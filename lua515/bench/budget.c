@@ -0,0 +1,165 @@
+/* Bounding untrusted scripts: a count hook (lua_sethook with
+ * LUA_MASKCOUNT) against the instruction budget (lua_setbudget).
+ *
+ * The same loop-and-call workload runs with no limit, under a count
+ * hook that only counts, under a budget whose callback only counts, and
+ * as coroutines preempted by the budget in a round-robin scheduler.
+ * Last, a runaway script must be stopped by an error from the callback.
+ *
+ * Build (from lua515/bench, with lua515/src built):
+ *   cc -O2 -I../src -o budget budget.c ../src/liblua.a -lm
+ * Usage: ./budget [scale [budget]]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/time.h>
+
+#include <lua.h>
+#include <lauxlib.h>
+#include <lualib.h>
+
+static const char *work =
+    "local n = ...\n"
+    "local function f(x) return x + 1 end\n"
+    "local s = 0\n"
+    "for i = 1, n do\n"
+    "  s = f(s)\n"
+    "  local j = 0\n"
+    "  while j < 4 do j = j + 1 end\n"
+    "end\n"
+    "return s\n";
+
+static const char *runaway = "while true do end\n";
+
+static long events;
+
+static double now(void)
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+static void counthook(lua_State *L, lua_Debug *ar)
+{
+    (void)L;
+    (void)ar;
+    events++;
+}
+
+static int countbudget(lua_State *L, void *ud)
+{
+    (void)L;
+    (void)ud;
+    events++;
+    return 0;  /* go on */
+}
+
+static int stopbudget(lua_State *L, void *ud)
+{
+    if (++*(int *)ud >= 10)
+        luaL_error(L, "script ran too long");
+    return 0;
+}
+
+static void load(lua_State *L, const char *code)
+{
+    if (luaL_loadstring(L, code)) {
+        fprintf(stderr, "%s\n", lua_tostring(L, -1));
+        exit(1);
+    }
+}
+
+static void report(const char *name, double t0)
+{
+    printf("%-12s %10.1f %12ld\n", name, (now() - t0) * 1e3, events);
+}
+
+static void runone(const char *name, int n, int mode, int budget)
+{
+    lua_State *L = luaL_newstate();
+    double t0;
+
+    luaL_openlibs(L);
+    events = 0;
+    if (mode == 1)
+        lua_sethook(L, counthook, LUA_MASKCOUNT, budget);
+    else if (mode == 2)
+        lua_setbudget(L, budget, countbudget, NULL);
+    load(L, work);
+    lua_pushinteger(L, n);
+    t0 = now();
+    if (lua_pcall(L, 1, 1, 0)) {
+        fprintf(stderr, "%s: %s\n", name, lua_tostring(L, -1));
+        exit(1);
+    }
+    report(name, t0);
+    lua_close(L);
+}
+
+/* `tasks' coroutines sharing `n' iterations, switched by the budget */
+static void scheduler(int n, int budget, int tasks)
+{
+    lua_State *L = luaL_newstate();
+    lua_State **co = malloc(tasks * sizeof(lua_State *));
+    int i, live = tasks;
+    double t0;
+
+    luaL_openlibs(L);
+    events = 0;
+    for (i = 0; i < tasks; i++) {
+        co[i] = lua_newthread(L);
+        lua_setbudget(co[i], budget, NULL, NULL);  /* yield */
+        load(co[i], work);
+        lua_pushinteger(co[i], n / tasks);
+    }
+    t0 = now();
+    for (i = 0; live > 0; i = (i + 1) % tasks) {
+        int status;
+        if (co[i] == NULL)
+            continue;
+        status = lua_resume(co[i], (events < tasks) ? 1 : 0);
+        events++;
+        if (status != LUA_YIELD) {
+            if (status != 0) {
+                fprintf(stderr, "task %d: %s\n", i, lua_tostring(co[i], -1));
+                exit(1);
+            }
+            co[i] = NULL;
+            live--;
+        }
+    }
+    report("scheduler", t0);
+    free(co);
+    lua_close(L);
+}
+
+int main(int argc, char **argv)
+{
+    double scale = argc > 1 ? atof(argv[1]) : 1;
+    int budget = argc > 2 ? atoi(argv[2]) : 10000;
+    int n = (int)(2000000 * scale);
+    int calls = 0, status;
+    lua_State *L;
+
+    if (n < 1 || budget < 1)
+        return 1;
+    printf("%-12s %10s %12s\n", "mode", "ms", "events");
+    runone("none", n, 0, budget);
+    runone("count hook", n, 1, budget);
+    runone("budget", n, 2, budget);
+    scheduler(n, budget, 4);
+
+    L = luaL_newstate();
+    luaL_openlibs(L);
+    lua_setbudget(L, budget, stopbudget, &calls);
+    load(L, runaway);
+    status = lua_pcall(L, 0, 0, 0);
+    printf("runaway: %s (%s) after %d rounds\n",
+           status == LUA_ERRRUN ? "stopped" : "unexpected status",
+           lua_tostring(L, -1), calls);
+    lua_close(L);
+    return 0;
+}
@@ -0,0 +1,152 @@
+/* Messages between states on different threads: the chan library.
+ *
+ * Producer threads, each with a state of its own, send to one named
+ * channel that consumer threads (with their own states) drain. Each
+ * case sends the same number of messages:
+ *   number      ch:send(i) / ch:recv()
+ *   batch       ch:send_many(t) / ch:recv_many() of 64 numbers
+ *   table       ch:send({ id = i, name = "..." }) / ch:recv()
+ *   json        the table through cjson.encode and decode, as before
+ *               (only if cjson can be loaded)
+ *
+ * Build (from lua515/bench, with lua515/src built first):
+ *   cc -O2 -DLUA_USE_PTHREADS -I../src -o chan chan.c \
+ *      ../src/liblua.a -lpthread -lm -ldl
+ * Usage: ./chan [messages [producers [consumers]]]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <sys/time.h>
+
+#include <lua.h>
+#include <lauxlib.h>
+#include <lualib.h>
+
+static const char *producer[] = {
+    "local ch, n = chan.open('bench'), ...\n"
+    "for i = 1, n do while not ch:send(i) do end end\n",
+
+    "local ch, n = chan.open('bench'), ...\n"
+    "local t = {}\n"
+    "for i = 1, 64 do t[i] = i end\n"
+    "local i = 1\n"
+    "while i <= n do i = i + ch:send_many(t, 1, math.min(64, n - i + 1)) end\n",
+
+    "local ch, n = chan.open('bench'), ...\n"
+    "for i = 1, n do\n"
+    "  local m = { id = i, name = 'request', path = '/a/b/c' }\n"
+    "  while not ch:send(m) do end\n"
+    "end\n",
+
+    "local ch, n = chan.open('bench'), ...\n"
+    "local json = require 'cjson'\n"
+    "for i = 1, n do\n"
+    "  local m = json.encode({ id = i, name = 'request', path = '/a/b/c' })\n"
+    "  while not ch:send(m) do end\n"
+    "end\n",
+};
+
+static const char *consumer[] = {
+    "local ch, n = chan.open('bench'), ...\n"
+    "local got = 0\n"
+    "while got < n do if ch:recv() then got = got + 1 end end\n",
+
+    "local ch, n = chan.open('bench'), ...\n"
+    "local got, t = 0, {}\n"
+    "while got < n do\n"
+    "  local _, k = ch:recv_many(math.min(64, n - got), t)\n"
+    "  got = got + k\n"
+    "end\n",
+
+    "local ch, n = chan.open('bench'), ...\n"
+    "local got = 0\n"
+    "while got < n do local m = ch:recv() if m and m.id then got = got + 1 end end\n",
+
+    "local ch, n = chan.open('bench'), ...\n"
+    "local json = require 'cjson'\n"
+    "local got = 0\n"
+    "while got < n do\n"
+    "  local m = ch:recv()\n"
+    "  if m and json.decode(m).id then got = got + 1 end\n"
+    "end\n",
+};
+
+static const char *names[] = { "number", "batch", "table", "json" };
+
+typedef struct job_t {
+    const char *code;
+    int n, failed;
+} job_t;
+
+static void *run(void *arg)
+{
+    job_t *job = arg;
+    lua_State *L = luaL_newstate();
+
+    luaL_openlibs(L);
+    if (luaL_loadstring(L, job->code) == 0) {
+        lua_pushinteger(L, job->n);
+        if (lua_pcall(L, 1, 0, 0) == 0) {
+            lua_close(L);
+            return NULL;
+        }
+    }
+    fprintf(stderr, "%s\n", lua_tostring(L, -1));
+    job->failed = 1;
+    lua_close(L);
+    return NULL;
+}
+
+static double now(void)
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+int main(int argc, char **argv)
+{
+    int n = argc > 1 ? atoi(argv[1]) : 1000000;
+    int np = argc > 2 ? atoi(argv[2]) : 1;
+    int nc = argc > 3 ? atoi(argv[3]) : 1;
+    pthread_t tid[128];
+    job_t job[128];
+    lua_State *L = luaL_newstate();
+    int c, i;
+
+    if (np < 1 || nc < 1 || np + nc > 128)
+        return 1;
+    n -= n % (np * nc);
+    luaL_openlibs(L);  /* keeps the channel while the threads come and go */
+    luaL_dostring(L, "keep = chan.open('bench', 4096)");
+    printf("%-8s %10s %12s\n", "case", "time(s)", "Mmsg/s");
+    for (c = 0; c < 4; c++) {
+        double t0;
+        int failed = 0;
+
+        if (c == 3 && luaL_dostring(L, "require 'cjson'")) {
+            printf("%-8s %10s\n", names[c], "-");  /* no cjson */
+            continue;
+        }
+        t0 = now();
+        for (i = 0; i < np + nc; i++) {
+            job[i].code = i < np ? producer[c] : consumer[c];
+            job[i].n = i < np ? n / np : n / nc;
+            job[i].failed = 0;
+            pthread_create(&tid[i], NULL, run, &job[i]);
+        }
+        for (i = 0; i < np + nc; i++) {
+            pthread_join(tid[i], NULL);
+            failed |= job[i].failed;
+        }
+        if (failed)
+            return 1;
+        t0 = now() - t0;
+        printf("%-8s %10.3f %12.2f\n", names[c], t0, n / 1e6 / t0);
+    }
+    lua_close(L);
+    return 0;
+}
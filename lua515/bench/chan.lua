@@ -0,0 +1,52 @@
+-- cost of a message through a channel (chan library), in one state
+-- usage: lua chan.lua [scale]
+--
+-- Sends and receives in turns of 64 messages, so the ring stays warm;
+-- see chan.c for producers and consumers on separate threads.
+
+local scale = tonumber(arg and arg[1]) or 1
+local clock = os.clock
+
+local N = math.floor(1000000 * scale)
+local ch = chan.new(64)
+local batch = {}
+for i = 1, 64 do batch[i] = i end
+local msg = { id = 1, name = "request", path = "/a/b/c" }
+
+local cases = {
+  { "number", function ()
+      for r = 1, N / 64 do
+        for i = 1, 64 do ch:send(i) end
+        for i = 1, 64 do ch:recv() end
+      end
+    end },
+  { "batch", function ()
+      local t = {}
+      for r = 1, N / 64 do
+        ch:send_many(batch)
+        ch:recv_many(64, t)
+      end
+    end },
+  { "string", function ()
+      local s = string.rep("x", 100)
+      for r = 1, N / 64 do
+        for i = 1, 64 do ch:send(s) end
+        for i = 1, 64 do ch:recv() end
+      end
+    end },
+  { "table", function ()
+      for r = 1, N / 64 do
+        for i = 1, 64 do ch:send(msg) end
+        for i = 1, 64 do ch:recv() end
+      end
+    end },
+}
+
+print(string.format("%-12s %10s %12s", "case", "time(s)", "Mmsg/s"))
+for _, c in ipairs(cases) do
+  collectgarbage()
+  local t0 = clock()
+  c[2]()
+  local dt = clock() - t0
+  print(string.format("%-12s %10.3f %12.2f", c[1], dt, N / 1e6 / dt))
+end
@@ -0,0 +1,132 @@
+/* Startup time of worker states: built from scratch or cloned.
+ *
+ * A template state opens the libraries and runs a generated "framework"
+ * of many functions, which it keeps in a global table. Workers are then
+ * either built the same way (fresh) or copied from the template with
+ * lua_clonestate (clone); with a third argument the template is frozen
+ * first, so the clones also share its code and strings. Each worker
+ * calls the framework once to check it.
+ *
+ * Build (from lua515/bench, with lua515/src built first):
+ *   cc -O2 -DLUA_USE_PTHREADS -I../src -o clone clone.c \
+ *      ../src/liblua.a -lpthread -lm
+ * With lua515/src built with LUA_USE_LOCK, add -DLUA_USE_LOCK: every
+ * clone must come back unlocked, as the `__clone' hooks of the io
+ * library run in it.
+ * Usage: ./clone [workers [functions [frozen]]]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include <lua.h>
+#include <lauxlib.h>
+#include <lualib.h>
+
+static char *framework;  /* source of the framework */
+static int nfuncs;
+
+static char *makeframework(int n)
+{
+    size_t size = 200 + (size_t)n * 200;
+    char *s = malloc(size), *p = s;
+    int i;
+
+    if (s == NULL)
+        return NULL;
+    p += sprintf(p, "M = { names = {} }\n");
+    for (i = 1; i <= n; i++)
+        p += sprintf(p, "M.names[%d] = 'field%d'\n"
+                        "function M.f%d(a, b)\n"
+                        "  return a + b + #M.names[%d]\n"
+                        "end\n", i, i % 97, i, i);
+    return s;
+}
+
+/* calls the framework once: M.f1(1, 2) + ... + M.fn(1, 2) */
+static const char *check =
+    "local n = ...\n"
+    "local s = 0\n"
+    "for i = 1, n do s = s + M['f' .. i](1, 2) end\n"
+    "return s\n";
+
+static lua_State *fresh(void)
+{
+    lua_State *L = luaL_newstate();
+
+    luaL_openlibs(L);
+    if (luaL_dostring(L, framework)) {
+        fprintf(stderr, "%s\n", lua_tostring(L, -1));
+        lua_close(L);
+        return NULL;
+    }
+    return L;
+}
+
+static double now(void)
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+int main(int argc, char **argv)
+{
+    int workers = argc > 1 ? atoi(argv[1]) : 64;
+    int frozen = argc > 3 && atoi(argv[3]);
+    lua_State *T;
+    double expect = 0;
+    int mode, i;
+
+    nfuncs = argc > 2 ? atoi(argv[2]) : 2000;
+    framework = makeframework(nfuncs);
+    if (!framework || workers < 1 || (T = fresh()) == NULL)
+        return 1;
+    if (frozen) {
+        lua_Heap *heap = lua_freeze(T, 0);
+
+        if (heap == NULL)
+            return 1;
+        lua_releaseheap(heap);  /* the template keeps it */
+    }
+
+    /* f<i>(1, 2) is 3 + #'field<i % 97>' */
+    for (i = 1; i <= nfuncs; i++)
+        expect += 3 + 5 + (i % 97 >= 10 ? 2 : 1);
+
+    printf("%-8s %8s %10s %14s %12s\n", "mode", "workers", "wall(s)",
+           "us/worker", "KB/worker");
+    for (mode = 0; mode <= 1; mode++) {
+        double t0 = now(), wall, kb = 0;
+
+        for (i = 0; i < workers; i++) {
+            lua_State *L = mode ? luaL_clonestate(T) : fresh();
+
+            if (L == NULL)
+                return 1;
+            if (luaL_loadstring(L, check) ||
+                (lua_pushinteger(L, nfuncs), lua_pcall(L, 1, 1, 0))) {
+                fprintf(stderr, "%s\n", lua_tostring(L, -1));
+                return 1;
+            }
+            if (lua_tonumber(L, -1) != expect) {
+                fprintf(stderr, "wrong result: %.0f, expected %.0f\n",
+                        lua_tonumber(L, -1), expect);
+                return 1;
+            }
+            kb += lua_gc(L, LUA_GCCOUNT, 0) +
+                  lua_gc(L, LUA_GCCOUNTB, 0) / 1024.0;
+            lua_close(L);
+        }
+        wall = now() - t0;
+        printf("%-8s %8d %10.3f %14.1f %12.1f\n", mode ? "clone" : "fresh",
+               workers, wall, wall * 1e6 / workers, kb / workers);
+    }
+
+    lua_close(T);
+    free(framework);
+    return 0;
+}
@@ -0,0 +1,79 @@
+-- function expressions evaluated in loops: sort comparators, gsub and
+-- iterator callbacks, which escape and so allocate each time, against a
+-- local helper that is only called, which LUAI_CLOSURECACHE (luaconf.h)
+-- reuses, and closures over fresh locals; with the memory churned
+-- usage: lua closures.lua [scale] [generational]
+
+local scale = tonumber(arg and arg[1]) or 1
+local clock = os.clock
+local sort, gsub = table.sort, string.gsub
+
+if arg and arg[2] == "generational" then collectgarbage("generational") end
+
+local N = math.floor(200000 * scale)
+
+local data = {}
+for i = 1, 8 do data[i] = (i * 37) % 11 end
+local text = "the quick brown fox"
+
+local function each(t, f)
+  for i = 1, #t do f(t[i]) end
+end
+
+local cases = {
+  { "sort callback", function ()
+      local t = {}
+      for r = 1, N do
+        for i = 1, 8 do t[i] = data[i] end
+        sort(t, function (a, b) return a > b end)
+      end
+      return t[1]
+    end },
+  { "gsub callback", function ()
+      local n = 0
+      for r = 1, N / 4 do
+        gsub(text, "%a+", function (w) n = n + #w end)
+      end
+      return n
+    end },
+  { "each upvalue", function ()
+      local s = 0
+      for r = 1, N do
+        each(data, function (v) s = s + v end)
+      end
+      return s
+    end },
+  { "local helper", function ()
+      local s = 0
+      for r = 1, N do
+        local add = function (v) s = s + v end
+        for i = 1, #data do add(data[i]) end
+      end
+      return s
+    end },
+  { "fresh local", function ()
+      -- `acc' is a new local each round: a new closure every time
+      local s = 0
+      for r = 1, N do
+        local acc = 0
+        each(data, function (v) acc = acc + v end)
+        s = s + acc
+      end
+      return s
+    end },
+}
+
+print(string.format("%-14s %10s %10s %12s", "case", "ms", "kb", "result"))
+for _, c in ipairs(cases) do
+  collectgarbage()
+  collectgarbage("stop")  -- first run: what it allocates
+  local k0 = collectgarbage("count")
+  c[2]()
+  local kb = collectgarbage("count") - k0
+  collectgarbage("restart")
+  collectgarbage()
+  local t0 = clock()  -- second run: time, collector included
+  local res = c[2]()
+  local ms = (clock() - t0) * 1e3
+  print(string.format("%-14s %10.1f %10.0f %12.0f", c[1], ms, kb, res))
+end
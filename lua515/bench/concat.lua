@@ -0,0 +1,33 @@
+-- table.concat on large sequences (ltablib.c, lvm.c)
+-- usage: lua concat.lua [scale]
+--
+-- Run it against two builds to compare them; MB/s is the size of the
+-- result.
+
+local scale = tonumber(arg and arg[1]) or 1
+local clock = os.clock
+
+local N = 10000
+local rounds = math.floor(200 * scale)
+
+local function fill(f) local t = {} for i = 1, N do t[i] = f(i) end return t end
+
+local cases = {
+  { "words", fill(function (i) return "field" .. i end), "," },
+  { "integers", fill(function (i) return i * 7 end), "," },
+  { "floats", fill(function (i) return i / 7 end), "," },
+  { "csv row", fill(function (i) return i % 2 == 0 and i or "v" .. i end), "," },
+  { "headers", fill(function (i) return "X-Header-" .. i .. ": value" end), "\r\n" },
+  { "chars", fill(function (i) return string.char(97 + i % 26) end), "" },
+}
+
+print(string.format("%-10s %10s %10s", "case", "time(s)", "MB/s"))
+for _, c in ipairs(cases) do
+  local name, t, sep = c[1], c[2], c[3]
+  local len = #table.concat(t, sep)
+  collectgarbage()
+  local t0 = clock()
+  for r = 1, rounds do table.concat(t, sep) end
+  local dt = clock() - t0
+  print(string.format("%-10s %10.3f %10.1f", name, dt, len * rounds / 1048576 / dt))
+end
@@ -0,0 +1,43 @@
+-- creating and finishing coroutines: luaE_newthread and luaE_freethread
+-- usage: lua coroutines.lua [scale]
+--
+-- Run it against two builds to compare them; each case creates N
+-- coroutines, most of which die young as in a per-request pattern.
+
+local scale = tonumber(arg and arg[1]) or 1
+local clock = os.clock
+
+local N = math.floor(1000000 * scale)
+local create, resume, yield, wrap =
+  coroutine.create, coroutine.resume, coroutine.yield, coroutine.wrap
+
+local function handler(a, b) return a + b end
+local function deep(n) if n == 0 then return 0 end return 1 + deep(n - 1) end
+
+local cases = {
+  { "create", N, function ()
+      for i = 1, N do create(handler) end
+    end },
+  { "run", N, function ()
+      for i = 1, N do resume(create(handler), i, 1) end
+    end },
+  { "yield", N, function ()
+      for i = 1, N do
+        local co = wrap(function (x) yield(x) return x end)
+        co(i) co()
+      end
+    end },
+  -- bodies that grow their stacks a little
+  { "deep", N / 10, function ()
+      for i = 1, N / 10 do resume(create(deep), 50) end
+    end },
+}
+
+print(string.format("%-12s %10s %12s", "case", "time(s)", "Mops/s"))
+for _, c in ipairs(cases) do
+  collectgarbage()
+  local t0 = clock()
+  c[3]()
+  local dt = clock() - t0
+  print(string.format("%-12s %10.3f %12.2f", c[1], dt, c[2] / 1e6 / dt))
+end
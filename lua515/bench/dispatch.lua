@@ -0,0 +1,91 @@
+-- opcode-mix microbenchmark for the dispatch loop of luaV_execute
+-- usage: lua dispatch.lua [scale]
+--
+-- Each kernel exercises a different mix of opcodes.  To see the gain of
+-- the computed-goto dispatch, run it against the default build and
+-- against a build with LUA_USE_JUMPTABLE undefined in src/luaconf.h.
+
+local scale = tonumber(arg and arg[1]) or 1
+local clock = os.clock
+
+-- MOVE, LOADK, ADD, SUB, MUL, FORLOOP
+local function arith(n)
+  local a, b, c = 1, 2, 3
+  for i = 1, n do
+    a = b + c
+    b = a - i
+    c = b * 2
+    a, b = b, a
+  end
+  return a + b + c
+end
+
+-- GETTABLE, SETTABLE, SELF, CALL, RETURN
+local function tables(n)
+  local t = { x = 1, y = 2 }
+  function t:get() return self.x end
+  local s = 0
+  for i = 1, n do
+    t.x = t.y + i
+    t[1] = t.x
+    s = s + t:get()
+  end
+  return s
+end
+
+-- EQ, LT, LE, TEST, TESTSET, NOT, JMP
+local function branches(n)
+  local c = 0
+  for i = 1, n do
+    local a = i % 7
+    if a == 3 then c = c + 1
+    elseif a < 2 then c = c - 1
+    elseif a <= 5 and not (a == 4) then c = c + 2 end
+    local x = (a > 2 and a) or 0
+    c = c + x
+  end
+  return c
+end
+
+-- GETUPVAL, SETUPVAL, GETGLOBAL, CLOSURE, TAILCALL, VARARG
+counter = 0
+local function calls(n)
+  local up = 0
+  local function inc(...) up = up + select('#', ...); return up end
+  local function tail(x) return inc(x, x) end
+  for i = 1, n do
+    tail(i)
+    counter = counter + 1
+  end
+  return up
+end
+
+local kernels = {
+  { "arith", arith, 4000000 },
+  { "tables", tables, 1500000 },
+  { "branches", branches, 2000000 },
+  { "calls", calls, 1000000 },
+}
+
+-- count dispatched instructions (a fused pair counts once, see
+-- superinstr.lua) with a count hook on a small run
+local function count(f, n)
+  local steps = 0
+  debug.sethook(function () steps = steps + 1 end, "", 100)
+  f(n)
+  debug.sethook()
+  return steps * 100
+end
+
+local total = 0
+print(string.format("%-10s %10s %12s %10s", "kernel", "time(s)", "instr", "ns/instr"))
+for _, k in ipairs(kernels) do
+  local name, f, n = k[1], k[2], math.floor(k[3] * scale)
+  local instr = count(f, math.floor(n / 100)) * 100
+  local t0 = clock()
+  f(n)
+  local t = clock() - t0
+  total = total + t
+  print(string.format("%-10s %10.3f %12d %10.2f", name, t, instr, t * 1e9 / instr))
+end
+print(string.format("%-10s %10.3f", "total", total))
@@ -0,0 +1,69 @@
+-- weak-keyed caches: full collections and what survives them
+-- usage: lua ephemeron.lua [scale]
+--
+-- "cache" keeps N objects alive and maps each one to metadata that
+-- points back to its key (object -> {owner = object}); every round drops
+-- 1% of the objects and collects. "leak" drops all its keys: with
+-- ephemerons nothing is left, before them every entry stayed. Times are
+-- per full collection; "atomic(ms)" comes from collectgarbage "stats"
+-- when the build has it.
+
+local scale = tonumber(arg and arg[1]) or 1
+local clock = os.clock
+
+local N = math.floor(200000 * scale)
+local ROUNDS = 20
+
+local function count(t)
+  local n = 0
+  for _ in pairs(t) do n = n + 1 end
+  return n
+end
+
+local function atomic()
+  local ok, s = pcall(collectgarbage, "stats")
+  return ok and type(s) == "table" and s.atomic or 0
+end
+
+local cases = {
+  { "cache", function ()
+      local cache = setmetatable({}, {__mode = "k"})
+      local live = {}
+      for i = 1, N do
+        local o = {}
+        live[i] = o
+        cache[o] = {owner = o, n = i}
+      end
+      for r = 1, ROUNDS do
+        for i = r, N, 100 do
+          local o = {}
+          live[i] = o
+          cache[o] = {owner = o, n = i}
+        end
+        collectgarbage()
+      end
+      return count(cache)
+    end },
+  { "leak", function ()
+      local cache = setmetatable({}, {__mode = "k"})
+      for r = 1, ROUNDS do
+        for i = 1, N / ROUNDS do
+          local o = {}
+          cache[o] = {owner = o}
+        end
+        collectgarbage()
+      end
+      return count(cache)
+    end },
+}
+
+print(string.format("%-8s %10s %12s %10s", "case", "ms/collect", "atomic(ms)",
+  "entries"))
+for _, c in ipairs(cases) do
+  collectgarbage()
+  local a0, t0 = atomic(), clock()
+  local left = c[2]()
+  local dt, da = clock() - t0, atomic() - a0
+  print(string.format("%-8s %10.2f %12.2f %10d", c[1], dt * 1e3 / ROUNDS,
+    da * 1e3 / ROUNDS, left))
+end
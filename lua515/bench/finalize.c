@@ -0,0 +1,134 @@
+/* Cost of finalizing userdata that own a file descriptor: a `__gc'
+ * metamethod, a native finalizer (lua_setfinalizer) and a thread-safe
+ * native finalizer run by the background sweeper (LUA_GCBGSWEEP).
+ *
+ * Each round opens /dev/null once per userdata, drops them all and
+ * drives the collection to its end with lua_gc(LUA_GCSTEP, 0), timing
+ * every step. Reported: the total time of the steps and the slowest
+ * one, in milliseconds. (With `__gc' the blocks themselves are only
+ * freed by the next cycle.) `objects' must stay under the limit of
+ * open files.
+ *
+ * Build (from lua515/bench, with lua515/src built):
+ *   cc -O2 -DLUA_USE_PTHREADS -I../src -o finalize finalize.c \
+ *      ../src/liblua.a -lpthread -lm
+ * Usage: ./finalize [objects [rounds]]
+ */
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include <lua.h>
+#include <lauxlib.h>
+#include <lualib.h>
+
+enum { GCMETHOD, NATIVE, BACKGROUND };
+
+static const char *names[] = {"__gc", "native", "background"};
+
+static const char *churn =
+    "local n, new = ...\n"
+    "local t = {}\n"
+    "for i = 1, n do t[i] = new() end\n"
+    "return #t\n";
+
+static int mode;
+
+
+static int fd_gc (lua_State *L)
+{
+    int *fd = (int *)lua_touserdata(L, 1);
+
+    if (*fd >= 0) close(*fd);
+    *fd = -1;
+    return 0;
+}
+
+
+static void fd_fin (void *p, size_t sz, lua_Alloc f, void *ud)
+{
+    (void)sz; (void)f; (void)ud;
+    if (*(int *)p >= 0) close(*(int *)p);
+}
+
+
+static int fd_new (lua_State *L)
+{
+    int *fd = (int *)lua_newuserdata(L, sizeof(int));
+
+    *fd = open("/dev/null", O_RDONLY);
+    if (mode == GCMETHOD) {
+        lua_pushvalue(L, lua_upvalueindex(1));
+        lua_setmetatable(L, -2);
+    }
+    else
+        lua_setfinalizer(L, -1, fd_fin,
+                         mode == BACKGROUND ? LUA_FINTHREADSAFE : 0);
+    return 1;
+}
+
+
+static double now(void)
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+
+static void measure(int objects, int rounds)
+{
+    lua_State *L = luaL_newstate();
+    double total = 0, worst = 0;
+    int r, steps = 0;
+
+    luaL_openlibs(L);
+    lua_gc(L, LUA_GCBGSWEEP, mode == BACKGROUND);
+    lua_gc(L, LUA_GCSTOP, 0);
+    lua_createtable(L, 0, 1);  /* metatable for GCMETHOD */
+    lua_pushcfunction(L, fd_gc);
+    lua_setfield(L, -2, "__gc");
+    lua_pushcclosure(L, fd_new, 1);
+    lua_setglobal(L, "new");
+    for (r = 0; r < rounds; r++) {
+        if (luaL_loadstring(L, churn)) {
+            fprintf(stderr, "%s\n", lua_tostring(L, -1));
+            exit(1);
+        }
+        lua_pushinteger(L, objects);
+        lua_getglobal(L, "new");
+        lua_call(L, 2, 0);  /* all garbage once it returns */
+        for (;;) {
+            double t0 = now(), dt;
+            int done = lua_gc(L, LUA_GCSTEP, 0);
+
+            dt = now() - t0;
+            total += dt;
+            if (dt > worst) worst = dt;
+            steps++;
+            if (done) break;
+        }
+    }
+    printf("%-12s %8d %12.2f %12.3f\n", names[mode], steps, total * 1e3,
+           worst * 1e3);
+    lua_close(L);
+}
+
+
+int main(int argc, char **argv)
+{
+    int objects = argc > 1 ? atoi(argv[1]) : 800;
+    int rounds = argc > 2 ? atoi(argv[2]) : 200;
+
+    if (objects < 1 || rounds < 1)
+        return 1;
+    printf("%-12s %8s %12s %12s\n", "finalizer", "steps", "total(ms)",
+           "worst(ms)");
+    for (mode = GCMETHOD; mode <= BACKGROUND; mode++)
+        measure(objects, rounds);
+    return 0;
+}
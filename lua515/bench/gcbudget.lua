@@ -0,0 +1,64 @@
+-- budgeted collector steps (setbudget) against the default pacing
+-- usage: lua gcbudget.lua [scale]
+--
+-- Each case runs the same churn and reads the step histogram of
+-- collectgarbage "stats" (hist[i] counts steps under 2^(i-1) us) to
+-- give the 99th percentile and the slowest step, plus the peak heap.
+-- The "idle" case gives the collector 100us after every batch of
+-- allocations, as an event loop would between requests.
+
+local scale = tonumber(arg and arg[1]) or 1
+local clock = os.clock
+
+local N = math.floor(2000000 * scale)
+local BATCH = 1000
+
+local function churn(idle)
+  local live, peak = {}, 0
+  for i = 1, N do
+    live[i % 20000] = {i, "k" .. (i % 100), {x = i}}
+    if i % BATCH == 0 then
+      if idle then collectgarbage("idle", idle) end
+      local kb = collectgarbage("count")
+      if kb > peak then peak = kb end
+    end
+  end
+  return peak
+end
+
+local function percentile(h0, h1, p)
+  local d, total, seen, top = {}, 0, 0, 0
+  for i = 1, #h1 do
+    d[i] = h1[i] - h0[i]
+    total = total + d[i]
+    if d[i] > 0 then top = i end
+  end
+  for i = 1, #d do
+    seen = seen + d[i]
+    if seen >= total * p then return 2 ^ (i - 1), 2 ^ (top - 1), total end
+  end
+  return 0, 2 ^ (top - 1), total
+end
+
+local cases = {
+  { "stepmul", 0 },
+  { "budget20", 20 },
+  { "budget100", 100 },
+  { "budget500", 500 },
+  { "idle", 100, 100 },
+}
+
+print(string.format("%-10s %8s %8s %9s %10s %10s", "case", "time(s)",
+  "steps", "p99(us)", "worst(us)", "peak(KB)"))
+for _, c in ipairs(cases) do
+  collectgarbage("setbudget", c[2])
+  collectgarbage()
+  local h0 = collectgarbage("stats").hist
+  local t0 = clock()
+  local peak = churn(c[3])
+  local dt = clock() - t0
+  local p99, worst, steps = percentile(h0, collectgarbage("stats").hist, 0.99)
+  print(string.format("%-10s %8.3f %8d %9d %10d %10.0f",
+    c[1], dt, steps, p99, worst, peak))
+end
+collectgarbage("setbudget", 0)
@@ -0,0 +1,70 @@
+-- collector telemetry (collectgarbage "stats") under a few settings
+-- usage: lua gcstats.lua [scale]
+--
+-- Runs the same churn with several setpause/setstepmul pairs and in
+-- generational mode, in a fresh cycle each time, and prints the phase
+-- times, the number of steps, the longest pause so far (maxpause is
+-- never reset) and the median step taken from the histogram (hist[i]
+-- counts steps under 2^(i-1) us).
+
+local scale = tonumber(arg and arg[1]) or 1
+local clock = os.clock
+
+local N = math.floor(2000000 * scale)
+
+local function churn()
+  local live = {}
+  for i = 1, N do
+    live[i % 5000] = {i, "k" .. (i % 100), {x = i}}
+  end
+end
+
+local function diff(a, b)
+  local d = {hist = {}}
+  for k, v in pairs(b) do
+    if k ~= "hist" then d[k] = v - (a[k] or 0) end
+  end
+  for i = 1, #b.hist do d.hist[i] = b.hist[i] - a.hist[i] end
+  return d
+end
+
+local function median(hist)
+  local total, seen = 0, 0
+  for i = 1, #hist do total = total + hist[i] end
+  for i = 1, #hist do
+    seen = seen + hist[i]
+    if seen * 2 >= total then return 2 ^ (i - 1) end
+  end
+  return 0
+end
+
+local cases = {
+  { "default", 200, 200 },
+  { "pause100", 100, 200 },
+  { "pause300", 300, 200 },
+  { "stepmul400", 200, 400 },
+  { "generational" },
+}
+
+print(string.format("%-13s %7s %7s %7s %7s %7s %8s %9s %8s",
+  "case", "time(s)", "prop", "atomic", "sweep", "final", "steps",
+  "maxp(ms)", "med(us)"))
+for _, c in ipairs(cases) do
+  if c[2] then
+    collectgarbage("incremental")
+    collectgarbage("setpause", c[2])
+    collectgarbage("setstepmul", c[3])
+  else
+    collectgarbage("generational")
+  end
+  collectgarbage()
+  local s0 = collectgarbage("stats")
+  local t0 = clock()
+  churn()
+  local dt = clock() - t0
+  local s = diff(s0, collectgarbage("stats"))
+  print(string.format("%-13s %7.3f %7.3f %7.3f %7.3f %7.3f %8d %9.3f %8d",
+    c[1], dt, s.propagate, s.atomic, s.sweepstring + s.sweep, s.finalize,
+    s.steps, collectgarbage("stats").maxpause * 1e3, median(s.hist)))
+end
+collectgarbage("incremental")
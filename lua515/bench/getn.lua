@@ -0,0 +1,54 @@
+-- the length operator on sequences: luaH_getn in ltable.c
+-- usage: lua getn.lua [scale]
+--
+-- Run it against two builds to compare them; each case appends to or
+-- measures sequences of N elements.
+
+local scale = tonumber(arg and arg[1]) or 1
+local clock = os.clock
+
+local N = math.floor(1000000 * scale)
+local insert = table.insert
+
+local full = {}
+for i = 1, 2^20 do full[i] = i end  -- array part exactly full
+
+local cases = {
+  { "t[#t+1]=v", function ()
+      local t = {}
+      for i = 1, N do t[#t + 1] = i end
+    end },
+  { "insert", function ()
+      local t = {}
+      for i = 1, N do insert(t, i) end
+    end },
+  -- many short sequences: the growth steps dominate
+  { "short", function ()
+      for r = 1, N / 16 do
+        local t = {}
+        for i = 1, 16 do t[#t + 1] = i end
+      end
+    end },
+  { "#full", function ()
+      local n = 0
+      for i = 1, N do n = n + #full end
+      return n
+    end },
+  -- stack use: push and pop at the end
+  { "push/pop", function ()
+      local t = {}
+      for i = 1, N do
+        t[#t + 1] = i
+        if i % 3 == 0 then t[#t] = nil end
+      end
+    end },
+}
+
+print(string.format("%-12s %10s %12s", "case", "time(s)", "Mops/s"))
+for _, c in ipairs(cases) do
+  collectgarbage()
+  local t0 = clock()
+  c[2]()
+  local dt = clock() - t0
+  print(string.format("%-12s %10.3f %12.2f", c[1], dt, N / 1e6 / dt))
+end
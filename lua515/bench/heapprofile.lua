@@ -0,0 +1,50 @@
+-- cost of the heap profiler on an allocation-heavy workload, off and at
+-- a few sampling rates, with the live bytes of its samples (unscaled)
+-- and the number of sites
+-- usage: lua heapprofile.lua [scale [file]]
+--
+-- Given a file, the last profile is written there; read it with
+-- `pprof --text lua file' (gperftools), which scales the sampled
+-- counts back up to estimates of the real ones.
+
+local scale = tonumber(arg and arg[1]) or 1
+local out = arg and arg[2]
+local clock = os.clock
+
+local N = math.floor(200000 * scale)
+
+local keep = {}
+
+local function work ()
+  for i = 1, N do
+    local t = {id = i, name = "item" .. i}
+    if i % 10 == 0 then keep[#keep + 1] = t end
+    local a = {}
+    for j = 1, 8 do a[j] = j end
+  end
+end
+
+print(string.format("%-10s %10s %10s %8s", "rate", "ms", "KB", "sites"))
+local profile
+for _, rate in ipairs{0, 1048576, 524288, 65536, 4096} do
+  keep = {}
+  collectgarbage()
+  collectgarbage("heapsample", rate)
+  local t0 = clock()
+  work()
+  local ms = (clock() - t0) * 1e3
+  profile = collectgarbage("heapprofile")
+  local live, sites = 0, 0
+  for n, b in profile:gmatch("\n(%d+): (%d+) %[") do
+    live, sites = live + b, sites + 1
+  end
+  print(string.format("%-10s %10.1f %10.0f %8d",
+                      rate == 0 and "off" or rate, ms, live / 1024, sites))
+  collectgarbage("heapsample", 0)
+end
+
+if out then
+  local f = assert(io.open(out, "w"))
+  f:write(profile)
+  f:close()
+end
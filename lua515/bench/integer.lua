@@ -0,0 +1,56 @@
+-- integer work: numeric for loops, array indexing, int arithmetic
+-- usage: lua integer.lua [scale]
+--
+-- Run it on a build with and one without LUAI_INTSUBTYPE (luaconf.h)
+-- and compare; the results must be the same in both.
+
+local scale = tonumber(arg and arg[1]) or 1
+local clock = os.clock
+
+local N = math.floor(2000000 * scale)
+
+local cases = {
+  { "forsum", function ()
+      local s = 0
+      for i = 1, N * 4 do s = s + i % 7 end
+      return s
+    end },
+  { "array", function ()
+      local a = {}
+      for i = 1, N do a[i] = i end
+      local s = 0
+      for r = 1, 3 do
+        for i = 1, #a do s = s + a[i] end
+      end
+      return s
+    end },
+  { "lcg", function ()
+      local x, s = 1, 0
+      for i = 1, N do
+        x = (x * 1103 + 12345) % 65536
+        s = s + x
+      end
+      return s
+    end },
+  { "sieve", function ()
+      local n = N
+      local composite = {}
+      for i = 1, n do composite[i] = false end
+      local count = 0
+      for i = 2, n do
+        if not composite[i] then
+          count = count + 1
+          for j = i * 2, n, i do composite[j] = true end
+        end
+      end
+      return count
+    end },
+}
+
+print(string.format("%-8s %10s %16s", "case", "ms", "result"))
+for _, c in ipairs(cases) do
+  collectgarbage()
+  local t0 = clock()
+  local res = c[2]()
+  print(string.format("%-8s %10.1f %16.0f", c[1], (clock() - t0) * 1e3, res))
+end
@@ -0,0 +1,47 @@
+-- throughput of the bulk read paths of liolib.c
+-- usage: lua ioread.lua [MB]
+--
+-- Writes a scratch file of text lines, then reads it back each way.  Run
+-- it against two builds to compare them.
+
+local size = (tonumber(arg and arg[1]) or 64) * 1024 * 1024
+local clock = os.clock
+local name = os.tmpname()
+
+local line = ("0123456789abcdef"):rep(4) .. "\n"
+local f = assert(io.open(name, "w"))
+f:setvbuf("full", 1024 * 1024)
+for i = 1, size / #line do f:write(line) end
+f:close()
+
+local cases = {
+  -- single fread sized with fstat
+  { "read *a", function (f) return #f:read("*a") end },
+  { "read n", function (f) return #f:read(size) end },
+  { "lines", function (f)
+      local n = 0
+      for l in f:lines() do n = n + 1 end
+      return n
+    end },
+  { "readlines", function (f)
+      local n = 0
+      while true do
+        local t = f:readlines(1024)
+        if not t then return n end
+        n = n + #t
+      end
+    end },
+}
+
+print(string.format("%-12s %10s %10s", "case", "time(s)", "MB/s"))
+for _, c in ipairs(cases) do
+  local f = assert(io.open(name))
+  f:setvbuf("full", 256 * 1024)
+  collectgarbage()
+  local t0 = clock()
+  c[2](f)
+  local t = clock() - t0
+  f:close()
+  print(string.format("%-12s %10.3f %10.1f", c[1], t, size / 1024 / 1024 / t))
+end
+os.remove(name)
@@ -0,0 +1,68 @@
+-- generic `for' over tables: pairs on array and hash parts, ipairs, and
+-- `next' written out, against a numeric `for' doing the same reads
+-- usage: lua iterate.lua [scale]
+
+local scale = tonumber(arg and arg[1]) or 1
+local clock = os.clock
+
+local N = 1000
+local ROUNDS = math.floor(2000 * scale)
+
+local arr, hash = {}, {}
+for i = 1, N do
+  arr[i] = i
+  hash["k" .. i] = i
+end
+
+local cases = {
+  { "numeric for", function ()
+      local s = 0
+      for r = 1, ROUNDS do
+        for i = 1, #arr do s = s + arr[i] end
+      end
+      return s
+    end },
+  { "ipairs", function ()
+      local s = 0
+      for r = 1, ROUNDS do
+        for _, v in ipairs(arr) do s = s + v end
+      end
+      return s
+    end },
+  { "pairs array", function ()
+      local s = 0
+      for r = 1, ROUNDS do
+        for _, v in pairs(arr) do s = s + v end
+      end
+      return s
+    end },
+  { "pairs hash", function ()
+      local s = 0
+      for r = 1, ROUNDS do
+        for _, v in pairs(hash) do s = s + v end
+      end
+      return s
+    end },
+  { "next hash", function ()
+      local s = 0
+      for r = 1, ROUNDS do
+        for _, v in next, hash do s = s + v end
+      end
+      return s
+    end },
+  { "pairs keys", function ()
+      local s = 0
+      for r = 1, ROUNDS do
+        for k in pairs(hash) do s = s + 1 end
+      end
+      return s
+    end },
+}
+
+print(string.format("%-14s %10s %14s", "case", "ms", "result"))
+for _, c in ipairs(cases) do
+  collectgarbage()
+  local t0 = clock()
+  local res = c[2]()
+  print(string.format("%-14s %10.1f %14.0f", c[1], (clock() - t0) * 1e3, res))
+end
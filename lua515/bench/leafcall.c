@@ -0,0 +1,129 @@
+/* Cost of calling tiny C functions from Lua: getters and a setter on a
+ * userdata, pushed with lua_pushcfunction and as leaves (lua_pushleaf),
+ * which run without a CallInfo of their own.
+ *
+ * Each case calls its function `calls' times from a Lua loop. Reported:
+ * nanoseconds per call, with the cost of the empty loop taken out.
+ *
+ * Build (from lua515/bench, with lua515/src built):
+ *   cc -O2 -I../src -o leafcall leafcall.c ../src/liblua.a -lm
+ * Usage: ./leafcall [calls]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/time.h>
+
+#include <lua.h>
+#include <lauxlib.h>
+#include <lualib.h>
+
+typedef struct Point {
+  double x, y;
+} Point;
+
+static const char *loops[][2] = {
+  {"empty",
+   "local n, f, p = ...\n"
+   "for i = 1, n do end\n"},
+  {"getx(p)",
+   "local n, f, p = ...\n"
+   "local s = 0\n"
+   "for i = 1, n do s = s + f(p) end\n"
+   "return s\n"},
+  {"setx(p, i)",
+   "local n, f, p = ...\n"
+   "for i = 1, n do f(p, i) end\n"},
+  {"now()",
+   "local n, f, p = ...\n"
+   "local s = 0\n"
+   "for i = 1, n do s = s + f() end\n"
+   "return s\n"},
+};
+
+#define NLOOPS	(sizeof(loops) / sizeof(loops[0]))
+
+
+static int getx (lua_State *L)
+{
+  lua_pushnumber(L, ((Point *)lua_touserdata(L, 1))->x);
+  return 1;
+}
+
+
+static int setx (lua_State *L)
+{
+  ((Point *)lua_touserdata(L, 1))->x = lua_tonumber(L, 2);
+  return 0;
+}
+
+
+static int counter;
+
+static int now (lua_State *L)
+{
+  lua_pushinteger(L, ++counter);
+  return 1;
+}
+
+
+static lua_CFunction funcs[] = {NULL, getx, setx, now};
+static int nargs[] = {0, 1, 2, 0};
+
+
+static double clock_now (void)
+{
+  struct timeval tv;
+
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+
+static double run (lua_State *L, size_t k, int leaf, int n)
+{
+  double t0;
+  Point *p;
+
+  if (luaL_loadstring(L, loops[k][1])) {
+    fprintf(stderr, "%s\n", lua_tostring(L, -1));
+    exit(1);
+  }
+  lua_pushinteger(L, n);
+  if (funcs[k] == NULL)
+    lua_pushnil(L);
+  else if (leaf)
+    lua_pushleaf(L, funcs[k], nargs[k]);
+  else
+    lua_pushcfunction(L, funcs[k]);
+  p = (Point *)lua_newuserdata(L, sizeof(Point));
+  p->x = 1;
+  p->y = 2;
+  t0 = clock_now();
+  lua_call(L, 3, 0);
+  return clock_now() - t0;
+}
+
+
+int main (int argc, char **argv)
+{
+  int n = argc > 1 ? atoi(argv[1]) : 10000000;
+  lua_State *L = luaL_newstate();
+  double empty;
+  size_t k;
+
+  if (n < 1)
+    return 1;
+  luaL_openlibs(L);
+  empty = run(L, 0, 0, n);
+  printf("%-12s %14s %14s\n", "call", "cfunction(ns)", "leaf(ns)");
+  for (k = 1; k < NLOOPS; k++) {
+    double plain = run(L, k, 0, n) - empty;
+    double leaf = run(L, k, 1, n) - empty;
+
+    printf("%-12s %14.1f %14.1f\n", loops[k][0], plain * 1e9 / n,
+           leaf * 1e9 / n);
+  }
+  lua_close(L);
+  return 0;
+}
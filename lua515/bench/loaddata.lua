@@ -0,0 +1,49 @@
+-- a large data file loaded as code (loadstring, then run once) and as a
+-- data chunk (loaddata, which builds the tables while parsing)
+-- usage: lua loaddata.lua [scale]
+--
+-- Records are split over functions of 1000 for the loadstring case, to
+-- stay below its constant limit; loaddata reads the whole list as one
+-- constructor.  Reported: ms and the memory in use right after the load.
+
+local scale = tonumber(arg and arg[1]) or 1
+local clock = os.clock
+
+local N = math.floor(100000 * scale)
+
+local function record (i)
+  return ('{id=%d, name="item%d", value=%d.25, tags={"a","b"}, ok=true},\n')
+         :format(i, i, i)
+end
+
+local code = {"local t = {}\n"}
+for i = 1, N, 1000 do
+  code[#code + 1] = ";(function () for _, v in ipairs{\n"
+  for j = i, math.min(i + 999, N) do code[#code + 1] = record(j) end
+  code[#code + 1] = "} do t[#t+1] = v end end)()\n"
+end
+code[#code + 1] = "return t\n"
+code = table.concat(code)
+
+local data = {"return {\n"}
+for i = 1, N do data[#data + 1] = record(i) end
+data[#data + 1] = "}\n"
+data = table.concat(data)
+
+local cases = {
+  { "loadstring", function () return assert(loadstring(code))() end },
+  { "loaddata", function () return assert(loaddata(data)) end },
+}
+
+print(string.format("%-12s %10s %10s %8s", "case", "ms", "KB", "items"))
+for _, c in ipairs(cases) do
+  collectgarbage()
+  collectgarbage()
+  local m0 = collectgarbage("count")
+  local t0 = clock()
+  local t = c[2]()
+  local ms = (clock() - t0) * 1e3
+  local kb = collectgarbage("count") - m0
+  print(string.format("%-12s %10.1f %10.0f %8d", c[1], ms, kb, #t))
+  t = nil
+end
@@ -0,0 +1,33 @@
+-- cost of luaL_loadfile on a file that does not change
+-- usage: lua loadfile.lua [functions [loads]]
+--
+-- The first load compiles the file; the next ones come from the chunk
+-- cache of lauxlib.c (LUAL_CHUNKCACHE), which skips the parser and the
+-- bytecode check.  Run it against two builds to compare them.
+
+local nf = tonumber(arg and arg[1]) or 2000
+local nl = tonumber(arg and arg[2]) or 100
+local clock = os.clock
+local name = os.tmpname()
+
+local src = {}
+for i = 1, nf do
+  src[#src + 1] = ("function f%d(a, b) local x = a + b * %d " ..
+                   "if x > 3 then return {a, b, x, 's%d'} end return x end")
+                  :format(i, i, i)
+end
+local f = assert(io.open(name, "w"))
+f:write(table.concat(src, "\n"))
+f:close()
+
+local t0 = clock()
+assert(loadfile(name))
+local first = clock() - t0
+t0 = clock()
+for i = 1, nl do assert(loadfile(name)) end
+local t = (clock() - t0) / nl
+os.remove(name)
+
+print(string.format("%-12s %12s", "load", "time(ms)"))
+print(string.format("%-12s %12.3f", "first", first * 1000))
+print(string.format("%-12s %12.3f", "again", t * 1000))
@@ -0,0 +1,131 @@
+/* Contention on one state shared by OS threads (LUA_USE_LOCK).
+ *
+ * Each OS thread runs its own coroutine (lua_newthread) of one state
+ * and calls a handler that mixes Lua code, C functions and updates of
+ * a shared table. The same work is then run with one separate state
+ * per thread, the upper bound that needs no lock at all. Rates are in
+ * handler calls per second.
+ *
+ * Build (from lua515/bench, with lua515/src built with LUA_USE_LOCK):
+ *   cc -O2 -DLUA_USE_PTHREADS -DLUA_USE_LOCK -I../src -o lock lock.c \
+ *      ../src/liblua.a -lpthread -lm
+ * Usage: ./lock [calls [maxthreads]]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <sys/time.h>
+
+#include <lua.h>
+#include <lauxlib.h>
+#include <lualib.h>
+
+static const char *handler =
+    "counts = counts or {}\n"
+    "function handle(id, i)\n"
+    "  local s = 0\n"
+    "  for k = 1, 50 do s = s + k * i end\n"
+    "  local key = 'k' .. (i % 64)\n"
+    "  counts[key] = (counts[key] or 0) + 1\n"
+    "  return s + #string.format('%d:%d', id, i) + math.floor(s / 7)\n"
+    "end\n";
+
+typedef struct job_t {
+    lua_State *L;  /* a coroutine of the shared state, or its own state */
+    int id, calls, failed;
+} job_t;
+
+static void *run(void *arg)
+{
+    job_t *job = arg;
+    lua_State *L = job->L;
+    int i;
+
+    for (i = 0; i < job->calls; i++) {
+        lua_getglobal(L, "handle");
+        lua_pushinteger(L, job->id);
+        lua_pushinteger(L, i);
+        if (lua_pcall(L, 2, 1, 0)) {
+            fprintf(stderr, "%s\n", lua_tostring(L, -1));
+            job->failed = 1;
+            break;
+        }
+        lua_pop(L, 1);
+    }
+    return NULL;
+}
+
+static lua_State *newworld(void)
+{
+    lua_State *L = luaL_newstate();
+
+    luaL_openlibs(L);
+    if (luaL_dostring(L, handler)) {
+        fprintf(stderr, "%s\n", lua_tostring(L, -1));
+        exit(1);
+    }
+    return L;
+}
+
+static double now(void)
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+/* runs `n' threads; shared: coroutines of `S', else a state each */
+static double measure(lua_State *S, int n, int calls)
+{
+    pthread_t tid[64];
+    job_t job[64];
+    double t0;
+    int i, failed = 0;
+
+    for (i = 0; i < n; i++) {
+        if (S != NULL) {
+            job[i].L = lua_newthread(S);
+            luaL_ref(S, LUA_REGISTRYINDEX);  /* anchor it */
+        } else
+            job[i].L = newworld();
+        job[i].id = i;
+        job[i].calls = calls;
+        job[i].failed = 0;
+    }
+    t0 = now();
+    for (i = 0; i < n; i++)
+        pthread_create(&tid[i], NULL, run, &job[i]);
+    for (i = 0; i < n; i++) {
+        pthread_join(tid[i], NULL);
+        failed |= job[i].failed;
+    }
+    t0 = now() - t0;
+    if (S == NULL)
+        for (i = 0; i < n; i++)
+            lua_close(job[i].L);
+    if (failed)
+        exit(1);
+    return (double)n * calls / t0;
+}
+
+int main(int argc, char **argv)
+{
+    int calls = argc > 1 ? atoi(argv[1]) : 100000;
+    int maxthreads = argc > 2 ? atoi(argv[2]) : 8;
+    int n;
+
+    if (calls < 1 || maxthreads < 1 || maxthreads > 64)
+        return 1;
+    printf("%-8s %14s %14s\n", "threads", "shared(c/s)", "separate(c/s)");
+    for (n = 1; n <= maxthreads; n *= 2) {
+        lua_State *S = newworld();
+        double shared = measure(S, n, calls);
+        double separate = measure(NULL, n, calls);
+
+        lua_close(S);
+        printf("%-8d %14.0f %14.0f\n", n, shared, separate);
+    }
+    return 0;
+}
@@ -0,0 +1,125 @@
+/* Stress test of the state lock (LUA_USE_LOCK): a running thread gives
+ * up the lock at backward jumps and in C functions, and meanwhile the
+ * collector runs on other threads and traverses its stack, which once
+ * reallocated (shrank) it under the loop.
+ *
+ * One OS thread grows its coroutine's stack with a deep recursion, then
+ * runs numeric, generic and repeat loops; the others churn tables on
+ * coroutines of the same state, so that the collector runs while the
+ * first one is parked in a loop. Meant for a build with AddressSanitizer
+ * or ThreadSanitizer, which report any use of a moved stack; exits 1 on
+ * a Lua error or a wrong result.
+ *
+ * Build (from lua515/bench, with lua515/src built with LUA_USE_LOCK and
+ * -fsanitize=address, or thread, in both MYCFLAGS and MYLDFLAGS):
+ *   cc -g -fsanitize=address -DLUA_USE_PTHREADS -DLUA_USE_LOCK -I../src \
+ *      -o lockstress lockstress.c ../src/liblua.a -lpthread -lm
+ * Usage: ./lockstress [rounds [churners]]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+
+#include <lua.h>
+#include <lauxlib.h>
+#include <lualib.h>
+
+static const char *code =
+    "local function deep(n)\n"
+    "  if n == 0 then return 0 end\n"
+    "  return 1 + deep(n - 1)\n"
+    "end\n"
+    "function looper()\n"
+    "  assert(deep(6000) == 6000)\n"
+    "  local s = 0\n"
+    "  for i = 1, 200000 do s = s + i end\n"
+    "  for i = 0.5, 20000.5 do s = s + i end\n"
+    "  local t = {}\n"
+    "  for i = 1, 2000 do t[i] = i end\n"
+    "  for _, v in ipairs(t) do s = s + v end\n"
+    "  local j = 0\n"
+    "  repeat j = j + 1 until j >= 20000\n"
+    "  return s + j\n"
+    "end\n"
+    "function churn()\n"
+    "  local t = {}\n"
+    "  for i = 1, 200 do t[i] = {i, tostring(i)} end\n"
+    "  return #t\n"
+    "end\n";
+
+/* what looper() returns */
+#define EXPECTED (200000.0 * 200001 / 2 + 20001.0 * 20001 / 2 \
+                  + 2000.0 * 2001 / 2 + 20000)
+
+typedef struct job_t {
+    lua_State *L;  /* a coroutine of the shared state */
+    const char *func;
+    int rounds, failed;
+    int *stop;  /* set by main once the looper is done */
+} job_t;
+
+static void *run(void *arg)
+{
+    job_t *job = arg;
+    lua_State *L = job->L;
+    int i;
+
+    for (i = 0; job->rounds ? i < job->rounds :
+                 !__atomic_load_n(job->stop, __ATOMIC_RELAXED); i++) {
+        lua_getglobal(L, job->func);
+        if (lua_pcall(L, 0, 1, 0)) {
+            fprintf(stderr, "%s\n", lua_tostring(L, -1));
+            job->failed = 1;
+            break;
+        }
+        if (job->rounds && lua_tonumber(L, -1) != EXPECTED) {
+            fprintf(stderr, "%s: wrong result %.14g\n", job->func,
+                    lua_tonumber(L, -1));
+            job->failed = 1;
+            break;
+        }
+        lua_pop(L, 1);
+    }
+    return NULL;
+}
+
+int main(int argc, char **argv)
+{
+    int rounds = argc > 1 ? atoi(argv[1]) : 20;
+    int churners = argc > 2 ? atoi(argv[2]) : 2;
+    int stop = 0;
+    pthread_t tid[16];
+    job_t job[16];
+    lua_State *S;
+    int i, failed = 0;
+
+    if (rounds < 1 || churners < 1 || churners > 15)
+        return 1;
+    S = luaL_newstate();
+    luaL_openlibs(S);
+    if (luaL_dostring(S, code)) {
+        fprintf(stderr, "%s\n", lua_tostring(S, -1));
+        return 1;
+    }
+    for (i = 0; i <= churners; i++) {
+        job[i].L = lua_newthread(S);
+        luaL_ref(S, LUA_REGISTRYINDEX);  /* anchor it */
+        job[i].func = i == 0 ? "looper" : "churn";
+        job[i].rounds = i == 0 ? rounds : 0;
+        job[i].failed = 0;
+        job[i].stop = &stop;
+    }
+    for (i = 0; i <= churners; i++)
+        pthread_create(&tid[i], NULL, run, &job[i]);
+    pthread_join(tid[0], NULL);
+    __atomic_store_n(&stop, 1, __ATOMIC_RELAXED);
+    for (i = 1; i <= churners; i++)
+        pthread_join(tid[i], NULL);
+    for (i = 0; i <= churners; i++)
+        failed |= job[i].failed;
+    lua_close(S);
+    printf("%d rounds, %d churners: %s\n", rounds, churners,
+           failed ? "FAILED" : "ok");
+    return failed;
+}
@@ -0,0 +1,141 @@
+/* Per-state memory limits (lua_setmemlimit, lua_setmemsoft) on a host
+ * that packs many small states.
+ *
+ * Every tenant churns through garbage while keeping a bounded live set;
+ * with a limit, the collector does full collections near it instead of
+ * letting the heap grow to the pause threshold.  Reported per setting:
+ * the time, the highest peak over the tenants (as seen by the
+ * allocator), collector cycles and soft-limit calls.  Last, a runaway
+ * tenant must stop with LUA_ERRMEM and stay usable.
+ *
+ * Build (from lua515/bench, with lua515/src built):
+ *   cc -O2 -I../src -o memlimit memlimit.c ../src/liblua.a -lm
+ * Usage: ./memlimit [tenants [limitKB]]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/time.h>
+
+#include <lua.h>
+#include <lauxlib.h>
+#include <lualib.h>
+
+static const char *churn =
+    "local live = {}\n"
+    "for i = 1, 200000 do\n"
+    "  live[i % 500] = {i, 'item' .. i, {x = i}}\n"
+    "end\n";
+
+static const char *runaway =
+    "local t = {}\n"
+    "for i = 1, 1e9 do t[i] = 'leak' .. i end\n";
+
+typedef struct Tenant {
+    size_t inuse, peak;
+    int softcalls;
+} Tenant;
+
+static double now(void)
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+static void *tenantalloc(void *ud, void *ptr, size_t osize, size_t nsize)
+{
+    Tenant *t = (Tenant *)ud;
+
+    t->inuse += nsize - osize;
+    if (t->inuse > t->peak) t->peak = t->inuse;
+    if (nsize == 0) {
+        free(ptr);
+        return NULL;
+    }
+    return realloc(ptr, nsize);
+}
+
+static void soft(lua_State *L, void *ud, size_t used)
+{
+    (void)L;
+    (void)used;
+    ((Tenant *)ud)->softcalls++;
+}
+
+static int run(lua_State *L, const char *code)
+{
+    int status = luaL_loadstring(L, code);
+
+    return status ? status : lua_pcall(L, 0, 0, 0);
+}
+
+static lua_State *newtenant(Tenant *t, size_t limit)
+{
+    lua_State *L;
+
+    t->inuse = t->peak = 0;
+    t->softcalls = 0;
+    L = lua_newstate(tenantalloc, t);
+    luaL_openlibs(L);
+    if (limit > 0) {
+        lua_setmemlimit(L, limit);
+        lua_setmemsoft(L, limit / 2, soft, t);
+    }
+    return L;
+}
+
+static void measure(int tenants, size_t limit)
+{
+    double t0 = now();
+    size_t peak = 0;
+    int i, soft = 0;
+    double cycles = 0;
+
+    for (i = 0; i < tenants; i++) {
+        Tenant t;
+        lua_GCStats st;
+        lua_State *L = newtenant(&t, limit);
+
+        if (run(L, churn)) {
+            fprintf(stderr, "tenant %d: %s\n", i, lua_tostring(L, -1));
+            exit(1);
+        }
+        lua_gcstats(L, &st);
+        cycles += (double)st.cycles;
+        lua_close(L);
+        if (t.peak > peak) peak = t.peak;
+        soft += t.softcalls;
+    }
+    printf("%-10s %10.1f %10lu %10.0f %10d\n",
+           limit ? "limit" : "none", (now() - t0) * 1e3,
+           (unsigned long)(peak >> 10), cycles / tenants, soft);
+}
+
+int main(int argc, char **argv)
+{
+    int tenants = argc > 1 ? atoi(argv[1]) : 20;
+    size_t limit = (argc > 2 ? atoi(argv[2]) : 512) * (size_t)1024;
+    Tenant t;
+    lua_State *L;
+    int status;
+
+    if (tenants < 1 || limit == 0)
+        return 1;
+    printf("%-10s %10s %10s %10s %10s\n", "setting", "ms", "peak(KB)",
+           "cycles", "soft");
+    measure(tenants, 0);
+    measure(tenants, limit);
+
+    L = newtenant(&t, limit);
+    status = run(L, runaway);
+    printf("runaway: %s (%s), peak %lu KB\n",
+           status == LUA_ERRMEM ? "LUA_ERRMEM" : "unexpected status",
+           lua_tostring(L, -1), (unsigned long)(t.peak >> 10));
+    lua_settop(L, 0);
+    status = run(L, churn);  /* the state is still usable */
+    printf("after it: %s\n", status == 0 ? "ok" : lua_tostring(L, -1));
+    lua_close(L);
+    return 0;
+}
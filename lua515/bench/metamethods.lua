@@ -0,0 +1,91 @@
+-- metamethod dispatch: OOP-style __index/__newindex handlers, arithmetic,
+-- comparison, concatenation and calls on tables and userdata, and the
+-- lookup of events a metatable does not define
+-- usage: lua metamethods.lua [scale]
+
+local scale = tonumber(arg and arg[1]) or 1
+local clock = os.clock
+
+local N = math.floor(2000000 * scale)
+
+-- a class whose fields live in a proxy, reached through functions
+local store = {}
+local Obj = {}
+Obj.__index = function (o, k) return store[k] end
+Obj.__newindex = function (o, k, v) store[k] = v end
+
+local V = {}
+V.__index = V
+V.__add = function (a, b) return setmetatable({ x = a.x + b.x }, V) end
+V.__lt = function (a, b) return a.x < b.x end
+V.__concat = function (a, b) return a end
+V.__call = function (self, d) return self.x + d end
+V.__eq = function (a, b) return a.x == b.x end
+local function vec(x) return setmetatable({ x = x }, V) end
+
+-- userdata with a metatable of its own: methods plus __call and __len
+local u = newproxy(true)
+local U = getmetatable(u)
+U.__index = { get = function (self) return 1 end }
+U.__call = function (self, d) return d end
+U.__len = function () return 1 end
+
+local cases = {
+  { "__index fn", function ()
+      local o, s = setmetatable({}, Obj), 0
+      store.v = 1
+      for i = 1, N do s = s + o.v end
+      return s
+    end },
+  { "__newindex fn", function ()
+      local o = setmetatable({}, Obj)
+      for i = 1, N do o.v = i end
+      return store.v
+    end },
+  { "__add", function ()
+      local a, b = vec(0), vec(1)
+      for i = 1, N / 4 do a = a + b end
+      return a.x
+    end },
+  { "__lt", function ()
+      local a, b, s = vec(0), vec(1), 0
+      for i = 1, N do if a < b then s = s + 1 end end
+      return s
+    end },
+  { "__concat", function ()
+      local a, b = vec(0), vec(1)
+      for i = 1, N do a = a .. b end
+      return a.x
+    end },
+  { "__call table", function ()
+      local a, s = vec(1), 0
+      for i = 1, N do s = s + a(i) end
+      return s
+    end },
+  { "__call udata", function ()
+      local s = 0
+      for i = 1, N do s = s + u(1) end
+      return s
+    end },
+  { "method udata", function ()
+      local s = 0
+      for i = 1, N do s = s + u:get() end
+      return s
+    end },
+  { "absent event", function ()
+      -- __unm is not defined: every try looks it up and fails
+      local s = 0
+      for i = 1, N / 4 do
+        if pcall(function () return -u end) then s = s + 1 end
+      end
+      return s
+    end },
+}
+
+print(string.format("%-14s %10s %14s", "case", "ms", "result"))
+for _, c in ipairs(cases) do
+  collectgarbage()
+  local t0 = clock()
+  local res = c[2]()
+  print(string.format("%-14s %10.1f %14.0f", c[1], (clock() - t0) * 1e3, res))
+end
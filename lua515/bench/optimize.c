@@ -0,0 +1,122 @@
+/* Code from the plain compiler against the optimizing pass (lua_optimize,
+ * luac -O) on a few kernels written the way scripts often are: named
+ * constants in locals, string pieces joined with `..' and `if's on
+ * flags that never change.
+ *
+ * Each kernel is loaded twice, without and with the pass. Reported: the
+ * time of a run and the instructions it dispatched (from a count hook,
+ * in a separate run), for both.
+ *
+ * Build (from lua515/bench, with lua515/src built):
+ *   cc -O2 -I../src -o optimize optimize.c ../src/liblua.a -lm
+ * Usage: ./optimize [iterations]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/time.h>
+
+#include <lua.h>
+#include <lauxlib.h>
+#include <lualib.h>
+
+static const char *kernels[][2] = {
+  {"constants",
+   "local n = ...\n"
+   "local WIDTH, HEIGHT, SCALE = 640, 480, 2\n"
+   "local s = 0\n"
+   "for i = 1, n do\n"
+   "  s = s + (WIDTH * SCALE) % 7 + HEIGHT / SCALE - i % WIDTH\n"
+   "end\n"
+   "return s\n"},
+  {"flags",
+   "local n = ...\n"
+   "local DEBUG, TRACE = false, nil\n"
+   "local s = 0\n"
+   "for i = 1, n do\n"
+   "  if DEBUG then s = s - 1 end\n"
+   "  if not TRACE then s = s + 1 end\n"
+   "  if DEBUG and i > 3 then s = 0 end\n"
+   "end\n"
+   "return s\n"},
+  {"concat",
+   "local n = ...\n"
+   "local SEP = '/'\n"
+   "local t\n"
+   "for i = 1, n do\n"
+   "  t = 'usr' .. SEP .. 'local' .. SEP .. 'lib'\n"
+   "end\n"
+   "return #t\n"},
+};
+
+#define NKERNELS	(sizeof(kernels) / sizeof(kernels[0]))
+
+static long dispatched;
+
+
+static void count (lua_State *L, lua_Debug *ar)
+{
+  (void)L; (void)ar;
+  dispatched++;
+}
+
+
+static double now (void)
+{
+  struct timeval tv;
+
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+
+static void run (lua_State *L, int k, int optimize, int n, int hook,
+                 double *dt, long *ops)
+{
+  double t0;
+
+  lua_optimize(L, optimize);
+  if (luaL_loadstring(L, kernels[k][1])) {
+    fprintf(stderr, "%s\n", lua_tostring(L, -1));
+    exit(1);
+  }
+  lua_pushinteger(L, n);
+  dispatched = 0;
+  if (hook) lua_sethook(L, count, LUA_MASKCOUNT, 1);
+  t0 = now();
+  lua_call(L, 1, 0);
+  *dt = now() - t0;
+  lua_sethook(L, NULL, 0, 0);
+  *ops = dispatched;
+}
+
+
+int main (int argc, char **argv)
+{
+  int n = argc > 1 ? atoi(argv[1]) : 2000000;
+  lua_State *L = luaL_newstate();
+  size_t k;
+
+  if (n < 1)
+    return 1;
+  luaL_openlibs(L);
+  printf("%-10s %10s %10s %12s %12s\n", "kernel", "plain(ms)", "-O(ms)",
+         "plain(ops)", "-O(ops)");
+  for (k = 0; k < NKERNELS; k++) {
+    double t[2];
+    long ops[2];
+    int o;
+
+    for (o = 0; o < 2; o++) {
+      double unused;
+      long none;
+
+      run(L, k, o, n, 1, &unused, &ops[o]);
+      run(L, k, o, n, 0, &t[o], &none);
+    }
+    printf("%-10s %10.1f %10.1f %12ld %12ld\n", kernels[k][0], t[0] * 1e3,
+           t[1] * 1e3, ops[0], ops[1]);
+  }
+  lua_close(L);
+  return 0;
+}
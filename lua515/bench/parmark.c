@@ -0,0 +1,74 @@
+/* Full collections of a big heap marked by 1, 2, 4... threads.
+ *
+ * The heap holds a tree of tables, closures, strings and a few weak
+ * tables; each round runs lua_gc(LUA_GCCOLLECT) after setting the
+ * number of mark threads with LUA_GCMARKTHREADS. Times are wall-clock
+ * milliseconds per full collection (mark and sweep; only the mark is
+ * parallel).
+ *
+ * Build (from lua515/bench, with lua515/src built):
+ *   cc -O2 -DLUA_USE_PTHREADS -I../src -o parmark parmark.c \
+ *      ../src/liblua.a -lpthread -lm
+ * Usage: ./parmark [nodes [maxthreads [rounds]]]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/time.h>
+
+#include <lua.h>
+#include <lauxlib.h>
+#include <lualib.h>
+
+static const char *build =
+    "local n = ...\n"
+    "local weak = setmetatable({}, {__mode = 'k'})\n"
+    "local root = {}\n"
+    "for i = 1, n do\n"
+    "  local t = {i, 'v' .. i % 1000, {x = i, y = i * 2}}\n"
+    "  t.f = function () return t[1] end\n"
+    "  root[i] = t\n"
+    "  if i % 10 == 0 then weak[t] = i end\n"
+    "end\n"
+    "heap = {root, weak}\n";
+
+static double now(void)
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+int main(int argc, char **argv)
+{
+    int nodes = argc > 1 ? atoi(argv[1]) : 1000000;
+    int maxthreads = argc > 2 ? atoi(argv[2]) : 8;
+    int rounds = argc > 3 ? atoi(argv[3]) : 5;
+    lua_State *L = luaL_newstate();
+    int n, i;
+
+    if (nodes < 1 || maxthreads < 1 || rounds < 1)
+        return 1;
+    luaL_openlibs(L);
+    if (luaL_loadstring(L, build)) {
+        fprintf(stderr, "%s\n", lua_tostring(L, -1));
+        return 1;
+    }
+    lua_pushinteger(L, nodes);
+    lua_call(L, 1, 0);
+    lua_gc(L, LUA_GCCOLLECT, 0);
+    printf("heap: %d KB\n", lua_gc(L, LUA_GCCOUNT, 0));
+    printf("%-8s %14s\n", "threads", "ms/collect");
+    for (n = 1; n <= maxthreads; n *= 2) {
+        double t0;
+
+        lua_gc(L, LUA_GCMARKTHREADS, n);
+        t0 = now();
+        for (i = 0; i < rounds; i++)
+            lua_gc(L, LUA_GCCOLLECT, 0);
+        printf("%-8d %14.2f\n", n, (now() - t0) * 1e3 / rounds);
+    }
+    lua_close(L);
+    return 0;
+}
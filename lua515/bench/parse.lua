@@ -0,0 +1,61 @@
+-- parse throughput: a data file of table constructors (names, short
+-- strings, numbers, comments) compiled from one string, from 4 KB
+-- reader blocks, and from a file
+-- usage: lua parse.lua [scale]
+--
+-- Only the first loadfile of the file is timed: later ones would come
+-- from the chunk cache of lauxlib.c and skip the lexer.
+
+local scale = tonumber(arg and arg[1]) or 1
+local clock = os.clock
+
+local LINES = math.floor(200000 * scale)
+local ROUNDS = 3
+local BLOCK = 4096
+
+-- rows go in functions of 1000, to stay below the constant limit
+local src = {"-- generated data\nlocal t = {}\n;(function ()\n"}
+for i = 1, LINES do
+  src[#src + 1] = ('t[#t+1] = {id=%d, name="item%d", value=%d.25, ' ..
+                   'tags={"a","b"}, ok=true}  -- row %d\n'):format(i, i, i, i)
+  if i % 1000 == 0 then
+    src[#src + 1] = "end)()\n;(function ()\n"
+  end
+end
+src[#src + 1] = "end)()\nreturn t\n"
+src = table.concat(src)
+local mb = #src / 2^20
+
+local function blocks ()
+  local pos = 1
+  return function ()
+    local s = src:sub(pos, pos + BLOCK - 1)
+    pos = pos + BLOCK
+    return s ~= "" and s or nil
+  end
+end
+
+local name = os.tmpname()
+local f = assert(io.open(name, "w"))
+f:write(src)
+f:close()
+
+local cases = {
+  { "loadstring", function () return loadstring(src) end },
+  { "load 4KB", function () return load(blocks()) end },
+  { "loadfile", function () return loadfile(name) end, 1 },
+}
+
+print(string.format("%-12s %10s %10s", "case", "ms", "MB/s"))
+for _, c in ipairs(cases) do
+  local best = math.huge
+  for r = 1, c[3] or ROUNDS do
+    collectgarbage()
+    local t0 = clock()
+    assert(c[2]())
+    best = math.min(best, clock() - t0)
+  end
+  print(string.format("%-12s %10.1f %10.1f", c[1], best * 1e3,
+                      mb / math.max(best, 1e-6)))
+end
+os.remove(name)
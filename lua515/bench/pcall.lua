@@ -0,0 +1,52 @@
+-- cost of protected calls: a plain call next to pcall and xpcall of a
+-- Lua function that returns, and of one that raises an error
+-- usage: lua pcall.lua [scale]
+--
+-- pcall of a Lua function from Lua runs in the VM (luaD_vmpcall), with
+-- no handler of its own; xpcall and a pcall of a C function still go
+-- through lua_pcall.
+
+local scale = tonumber(arg and arg[1]) or 1
+local clock = os.clock
+
+local N = math.floor(2000000 * scale)
+
+local function ok (x) return x end
+local function fail (x) error(x, 0) end
+local function handler (m) return m end
+
+local cases = {
+  { "call", function ()
+      for i = 1, N do ok(i) end
+    end },
+  { "pcall", function ()
+      for i = 1, N do pcall(ok, i) end
+    end },
+  { "pcall C", function ()
+      local abs = math.abs
+      for i = 1, N do pcall(abs, i) end
+    end },
+  { "xpcall", function ()
+      for i = 1, N do xpcall(ok, handler) end
+    end },
+  { "pcall error", function ()
+      for i = 1, N / 10 do pcall(fail, "e") end
+    end, 10 },
+  { "xpcall error", function ()
+      for i = 1, N / 10 do xpcall(fail, handler) end
+    end, 10 },
+  { "nested", function ()
+      local function inner () return pcall(ok, 1) end
+      for i = 1, N / 2 do pcall(inner) end
+    end, 2 },
+}
+
+print(string.format("%-14s %10s %10s", "case", "ms", "ns/call"))
+for _, c in ipairs(cases) do
+  collectgarbage()
+  local t0 = clock()
+  c[2]()
+  local t = clock() - t0
+  print(string.format("%-14s %10.1f %10.1f", c[1], t * 1e3,
+                      t * 1e9 / (N / (c[3] or 1))))
+end
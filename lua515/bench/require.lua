@@ -0,0 +1,70 @@
+-- cost of finding modules: require through a long package.path whose
+-- templates mostly miss, with no cache (an fopen per candidate), with a
+-- cold package.dircache (emptied every round: one listing per directory),
+-- with a warm one (each search result is kept, and checked with a stat
+-- of each directory it looked at), and from a package.manifest
+-- usage: lua require.lua [scale]
+--
+-- builds a scratch tree with os.execute (mkdir, rm) under os.tmpname()
+
+local scale = tonumber(arg and arg[1]) or 1
+local clock = os.clock
+
+local DIRS = 16         -- templates in package.path; modules in the last
+local MODS = 50
+local ROUNDS = math.max(1, math.floor(40 * scale))
+
+local root = os.tmpname()
+os.remove(root)
+assert(os.execute("mkdir -p " .. root .. "/d" .. DIRS) == 0)
+for d = 1, DIRS - 1 do os.execute("mkdir " .. root .. "/d" .. d) end
+
+local names, path = {}, {}
+for d = 1, DIRS do path[d] = root .. "/d" .. d .. "/?.lua" end
+for i = 1, MODS do
+  names[i] = "bench_mod" .. i
+  local f = assert(io.open(root .. "/d" .. DIRS .. "/" .. names[i] .. ".lua", "w"))
+  f:write("return ", i, "\n")
+  f:close()
+end
+package.path = table.concat(path, ";")
+-- snapshots of directories changed within the last second are not
+-- trusted (see package.dircache in loadlib.c): let the new tree age
+os.execute("sleep 2")
+
+local function unload ()
+  for _, n in ipairs(names) do package.loaded[n] = nil end
+end
+
+local function run (setup)
+  local s = 0
+  for r = 1, ROUNDS do
+    unload()
+    setup()
+    for _, n in ipairs(names) do s = s + require(n) end
+  end
+  assert(s == ROUNDS * MODS * (MODS + 1) / 2)
+end
+
+local manifest = {}
+for _, n in ipairs(names) do manifest[n] = package.searchpath(n, package.path) end
+
+local cases = {
+  { "no cache", function () package.dircache = false end },
+  { "cold cache", function () package.dircache = {} end },
+  { "warm cache", function () end },
+  { "manifest", function () package.manifest = manifest end },
+}
+
+print(string.format("%-12s %10s %12s", "case", "ms", "us/require"))
+for _, c in ipairs(cases) do
+  package.dircache, package.manifest = {}, nil
+  collectgarbage()
+  local t0 = clock()
+  run(c[2])
+  local t = clock() - t0
+  print(string.format("%-12s %10.1f %12.2f", c[1], t * 1e3,
+                      t * 1e6 / (ROUNDS * MODS)))
+end
+
+os.execute("rm -rf " .. root)
@@ -0,0 +1,397 @@
+-- benchmark suite: fixed workloads over the VM and the libraries, with
+-- the results printed as JSON, to compare builds and catch regressions
+-- usage: lua run.lua [scale [baseline.json]]
+--        make bench [BENCHARGS="scale baseline.json"]   (in src or above)
+--
+-- Each case runs ROUNDS times and keeps the fastest round.  Given a
+-- baseline (an earlier output of this script) every case is compared
+-- with it on stderr, and the exit status is 1 if one of them is more
+-- than SLOWER slower.
+--
+-- JSON goes through cjson (../../luacJson) and the file case scans a
+-- directory with lfs.scandir (../../luafs) when those modules load (see
+-- package.cpath). Otherwise the plain-Lua codec below and reads of files
+-- the case writes stand in; the "json" and "fs" fields of the output say
+-- which ran, as their timings do not compare.
+
+local scale = tonumber(arg and arg[1]) or 1
+local basefile = arg and arg[2]
+local clock = os.clock
+
+local ROUNDS = 3
+local SLOWER = 0.10
+
+
+--[[ JSON, in plain Lua when there is no cjson ]]
+
+local json = {}
+
+local escapes = {
+  ['"'] = '\\"', ["\\"] = "\\\\", ["\b"] = "\\b", ["\f"] = "\\f",
+  ["\n"] = "\\n", ["\r"] = "\\r", ["\t"] = "\\t",
+}
+
+local function escape (c)
+  local e = escapes[c]
+  if e == nil then
+    e = string.format("\\u%04x", c:byte())
+  end
+  return e
+end
+
+local function isarray (t)
+  local n = #t
+  for k in pairs(t) do
+    if type(k) ~= "number" or k < 1 or k > n or k % 1 ~= 0 then
+      return false
+    end
+  end
+  return n > 0 or next(t) == nil
+end
+
+local function encode (v, out)
+  local tv = type(v)
+  if tv == "string" then
+    out[#out + 1] = '"' .. v:gsub('[%c"\\]', escape) .. '"'
+  elseif tv == "number" then
+    if v ~= v or v == math.huge or v == -math.huge then
+      out[#out + 1] = "null"
+    else
+      out[#out + 1] = string.format("%.14g", v)
+    end
+  elseif tv == "boolean" then
+    out[#out + 1] = tostring(v)
+  elseif tv == "table" then
+    if isarray(v) then
+      out[#out + 1] = "["
+      for i = 1, #v do
+        if i > 1 then out[#out + 1] = "," end
+        encode(v[i], out)
+      end
+      out[#out + 1] = "]"
+    else
+      local keys = {}
+      for k in pairs(v) do keys[#keys + 1] = tostring(k) end
+      table.sort(keys)  -- same input, same text
+      out[#out + 1] = "{"
+      for i, k in ipairs(keys) do
+        if i > 1 then out[#out + 1] = "," end
+        encode(k, out)
+        out[#out + 1] = ":"
+        local x = v[k]
+        if x == nil then x = v[tonumber(k)] end
+        encode(x, out)
+      end
+      out[#out + 1] = "}"
+    end
+  else
+    out[#out + 1] = "null"
+  end
+end
+
+function json.encode (v)
+  local out = {}
+  encode(v, out)
+  return table.concat(out)
+end
+
+
+local unescapes = {
+  b = "\b", f = "\f", n = "\n", r = "\r", t = "\t",
+}
+
+local function utf8 (c)
+  if c < 0x80 then return string.char(c)
+  elseif c < 0x800 then
+    return string.char(0xC0 + math.floor(c / 0x40), 0x80 + c % 0x40)
+  else
+    return string.char(0xE0 + math.floor(c / 0x1000),
+                       0x80 + math.floor(c / 0x40) % 0x40, 0x80 + c % 0x40)
+  end
+end
+
+local decode
+
+local function jerror (s, i, what)
+  error(string.format("json: %s at position %d", what, i), 0)
+end
+
+local function skip (s, i)
+  return (s:find("[^ \t\r\n]", i)) or #s + 1
+end
+
+local function decodestring (s, i)
+  local parts = {}
+  i = i + 1
+  while true do
+    local j = s:find('["\\]', i)
+    if not j then jerror(s, i, "unfinished string") end
+    parts[#parts + 1] = s:sub(i, j - 1)
+    if s:sub(j, j) == '"' then
+      return table.concat(parts), j + 1
+    end
+    local c = s:sub(j + 1, j + 1)
+    if c == "u" then
+      local h = tonumber(s:sub(j + 2, j + 5), 16)
+      if not h then jerror(s, j, "bad escape") end
+      parts[#parts + 1] = utf8(h)
+      i = j + 6
+    else
+      parts[#parts + 1] = unescapes[c] or c
+      i = j + 2
+    end
+  end
+end
+
+function decode (s, i)
+  i = skip(s, i)
+  local c = s:sub(i, i)
+  if c == "{" then
+    local t = {}
+    i = skip(s, i + 1)
+    if s:sub(i, i) == "}" then return t, i + 1 end
+    while true do
+      local k
+      if s:sub(i, i) ~= '"' then jerror(s, i, "key expected") end
+      k, i = decodestring(s, i)
+      i = skip(s, i)
+      if s:sub(i, i) ~= ":" then jerror(s, i, "':' expected") end
+      t[k], i = decode(s, i + 1)
+      i = skip(s, i)
+      c = s:sub(i, i)
+      if c == "}" then return t, i + 1 end
+      if c ~= "," then jerror(s, i, "',' or '}' expected") end
+      i = skip(s, i + 1)
+    end
+  elseif c == "[" then
+    local t = {}
+    i = skip(s, i + 1)
+    if s:sub(i, i) == "]" then return t, i + 1 end
+    while true do
+      t[#t + 1], i = decode(s, i)
+      i = skip(s, i)
+      c = s:sub(i, i)
+      if c == "]" then return t, i + 1 end
+      if c ~= "," then jerror(s, i, "',' or ']' expected") end
+      i = i + 1
+    end
+  elseif c == '"' then
+    return decodestring(s, i)
+  elseif s:find("^true", i) then return true, i + 4
+  elseif s:find("^false", i) then return false, i + 5
+  elseif s:find("^null", i) then return nil, i + 4
+  else
+    local num = s:match("^-?%d+%.?%d*[eE]?[-+]?%d*", i)
+    if not num or not tonumber(num) then jerror(s, i, "value expected") end
+    return tonumber(num), i + #num
+  end
+end
+
+function json.decode (s)
+  local v, i = decode(s, 1)
+  if skip(s, i) <= #s then jerror(s, i, "end of text expected") end
+  return v
+end
+
+
+local hascjson, cjson = pcall(require, "cjson")
+if hascjson then json = cjson end
+local haslfs, lfs = pcall(require, "lfs")
+
+
+--[[ workloads: each returns the number of operations it did ]]
+
+local function n (base)
+  return math.max(1, math.floor(base * scale))
+end
+
+local cases = {}
+
+cases[#cases + 1] = { "vm_dispatch", function ()
+  local N = n(5000000)
+  local a, b = 0, 1
+  for i = 1, N do
+    local c = a + b * 2
+    if c % 3 == 0 then a = a - 1 else a = a + 1 end
+    b = (b + i) % 7
+  end
+  return N
+end }
+
+cases[#cases + 1] = { "table_array", function ()
+  local N, M = n(40), 50000
+  local t = {}
+  for r = 1, N do
+    for i = 1, M do t[i] = i end
+    local s = 0
+    for i = 1, M do s = s + t[i] end
+  end
+  return N * M * 2
+end }
+
+cases[#cases + 1] = { "table_hash", function ()
+  local N, M = n(40), 5000
+  local keys = {}
+  for i = 1, M do keys[i] = "key" .. i end
+  local t = {}
+  for r = 1, N do
+    for i = 1, M do t[keys[i]] = i end
+    local s = 0
+    for i = 1, M do s = s + t[keys[i]] end
+  end
+  return N * M * 2
+end }
+
+cases[#cases + 1] = { "string_intern", function ()
+  local N = n(500000)
+  local t = {}
+  for i = 1, N do
+    t[i % 1000 + 1] = "s" .. i  -- a new short string each time
+  end
+  return N
+end }
+
+cases[#cases + 1] = { "pattern_match", function ()
+  local N = n(2000)
+  local line = "2026-10-15 12:34:56 [info] user=alice id=4711 took 23ms"
+  local c = 0
+  for r = 1, N do
+    for k, v in line:gmatch("(%w+)=(%w+)") do c = c + 1 end
+    local y, m, d = line:match("^(%d+)-(%d+)-(%d+)")
+    if line:find("took %d+ms") then c = c + 1 end
+    c = c + select(2, line:gsub("%d", "#"))
+  end
+  return N * 4
+end }
+
+cases[#cases + 1] = { "gc_churn", function ()
+  local N = n(500000)
+  local live = {}
+  for i = 1, N do
+    live[i % 2000] = {i, {x = i}}
+  end
+  return N
+end }
+
+cases[#cases + 1] = { "coroutine_switch", function ()
+  local N = n(500000)
+  local co = coroutine.wrap(function ()
+    local yield = coroutine.yield
+    while true do yield() end
+  end)
+  for i = 1, N do co() end
+  return N * 2
+end }
+
+local doc = {}
+for i = 1, 200 do
+  doc[i] = {id = i, name = "item " .. i, price = i * 1.25, ok = i % 2 == 0,
+            tags = {"a", "b\t\"c\""}, dims = {w = i, h = i / 4}}
+end
+local doctext = json.encode(doc)
+
+cases[#cases + 1] = { "json_encode", function ()
+  local N = n(50)
+  for i = 1, N do json.encode(doc) end
+  return N * #doc
+end, "json" }
+
+cases[#cases + 1] = { "json_decode", function ()
+  local N = n(50)
+  for i = 1, N do json.decode(doctext) end
+  return N * #doc
+end, "json" }
+
+local function lfsscan ()
+  local N, FILES = n(200), 200
+  local dir = os.tmpname()
+  os.remove(dir)
+  assert(lfs.mkdir(dir))
+  for i = 1, FILES do
+    local f = assert(io.open(dir .. "/f" .. i, "w"))
+    f:write(string.rep("x", i))
+    f:close()
+  end
+  local entries = 0
+  for r = 1, N do
+    for b in lfs.scandir(dir, {"mode", "size"}) do
+      for i = 1, b.n do
+        if b.mode[i] == "file" and b.size[i] > 0 then entries = entries + 1 end
+      end
+    end
+  end
+  for i = 1, FILES do os.remove(dir .. "/f" .. i) end
+  lfs.rmdir(dir)
+  return entries
+end
+
+local function ioscan ()
+  local N, FILES = n(20), 20
+  local names = {}
+  for i = 1, FILES do
+    names[i] = os.tmpname()
+    local f = assert(io.open(names[i], "w"))
+    for l = 1, 500 do f:write("line ", l, " of file ", i, "\n") end
+    f:close()
+  end
+  local lines = 0
+  for r = 1, N do
+    for i = 1, FILES do
+      for l in io.lines(names[i]) do lines = lines + 1 end
+    end
+  end
+  for i = 1, FILES do os.remove(names[i]) end
+  return lines
+end
+
+cases[#cases + 1] = { "file_scan", haslfs and lfsscan or ioscan, "fs" }
+
+
+--[[ run ]]
+
+local impl = {
+  json = hascjson and "cjson" or "lua", fs = haslfs and "lfs" or "io",
+}
+local results, group = {}, {}
+for _, c in ipairs(cases) do
+  group[c[1]] = c[3]
+  local best, ops = math.huge
+  local s0 = collectgarbage("stats")
+  for r = 1, ROUNDS do
+    collectgarbage()
+    local t0 = clock()
+    ops = c[2]()
+    best = math.min(best, clock() - t0)
+  end
+  local s1 = collectgarbage("stats")
+  results[#results + 1] = {
+    name = c[1], ms = best * 1e3, ops = ops,
+    ns_op = best * 1e9 / ops,
+    gc_steps = math.floor((s1.steps - s0.steps) / ROUNDS),
+  }
+end
+
+print(json.encode{
+  version = _VERSION, scale = scale, rounds = ROUNDS, cases = results,
+  json = impl.json, fs = impl.fs,
+})
+
+if basefile then
+  local f = assert(io.open(basefile))
+  local base = json.decode(f:read("*a"))
+  f:close()
+  local old, worse = {}, 0
+  for _, r in ipairs(base.cases) do old[r.name] = r end
+  for _, r in ipairs(results) do
+    local o = old[r.name]
+    local g = group[r.name]
+    if o and (g == nil or base[g] == impl[g]) then  -- same implementation
+      local ratio = r.ns_op / o.ns_op
+      local mark = ""
+      if ratio > 1 + SLOWER then mark, worse = "  SLOWER", worse + 1 end
+      io.stderr:write(string.format("%-18s %10.1f %10.1f  x%.2f%s\n",
+        r.name, o.ns_op, r.ns_op, ratio, mark))
+    end
+  end
+  if worse > 0 then os.exit(1) end
+end
@@ -0,0 +1,170 @@
+/* Startup time and memory of worker states, with and without a shared heap.
+ *
+ * A template state compiles a generated "framework" of many functions
+ * and is frozen with lua_freeze; workers then either compile the
+ * framework themselves (plain) or take it from the heap (shared). Each
+ * worker runs the framework once to check it. KB/worker is what the
+ * collector of the worker counts; the heap itself is paid for once.
+ *
+ * Build (from lua515/bench, with lua515/src built first):
+ *   cc -O2 -DLUA_USE_PTHREADS -I../src -o shared shared.c \
+ *      ../src/liblua.a -lpthread -lm
+ * Usage: ./shared [workers [functions [threads]]]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sys/time.h>
+
+#include <lua.h>
+#include <lauxlib.h>
+#include <lualib.h>
+
+static char *framework;  /* source of the framework */
+static lua_Heap *heap;
+static int nfuncs;
+
+static char *makeframework(int n)
+{
+    size_t size = 200 + (size_t)n * 200;
+    char *s = malloc(size), *p = s;
+    int i;
+
+    if (s == NULL)
+        return NULL;
+    p += sprintf(p, "local M = {}\n");
+    for (i = 1; i <= n; i++)
+        p += sprintf(p, "function M.f%d(a, b)\n"
+                        "  local t = { x = a, y = b, name = 'field%d' }\n"
+                        "  return t.x + t.y + #t.name\n"
+                        "end\n", i, i % 97);
+    p += sprintf(p, "return M\n");
+    return s;
+}
+
+/* runs the framework once: M.f1(1, 2) + ... + M.fn(1, 2) */
+static const char *check =
+    "local M, n = ...\n"
+    "local s = 0\n"
+    "for i = 1, n do s = s + M['f' .. i](1, 2) end\n"
+    "return s\n";
+
+typedef struct {
+    int shared;
+    int count;  /* workers to start */
+    double kb;  /* memory of the workers, summed */
+    double sum;  /* result of the check, summed */
+    int failed;
+} job_t;
+
+static void *run(void *arg)
+{
+    job_t *job = arg;
+    int i;
+
+    for (i = 0; i < job->count; i++) {
+        lua_State *L = job->shared ? luaL_newsharedstate(heap)
+                                   : luaL_newstate();
+        int bad;
+
+        luaL_openlibs(L);
+        if (job->shared)
+            bad = !lua_loadshared(L, 1);
+        else
+            bad = luaL_loadstring(L, framework) != 0;
+        bad = bad || lua_pcall(L, 0, 1, 0) ||
+              luaL_loadstring(L, check) ||
+              (lua_insert(L, -2), lua_pushinteger(L, nfuncs),
+               lua_pcall(L, 2, 1, 0));
+        if (bad) {
+            fprintf(stderr, "%s\n", lua_tostring(L, -1));
+            job->failed = 1;
+        } else {
+            job->sum += lua_tonumber(L, -1);
+            job->kb += lua_gc(L, LUA_GCCOUNT, 0) +
+                       lua_gc(L, LUA_GCCOUNTB, 0) / 1024.0;
+        }
+        lua_close(L);
+    }
+    return NULL;
+}
+
+static double now(void)
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+int main(int argc, char **argv)
+{
+    int workers = argc > 1 ? atoi(argv[1]) : 64;
+    int nthreads = argc > 3 ? atoi(argv[3]) : 1;
+    pthread_t *tid;
+    job_t *job;
+    lua_State *T;
+    double expect = 0;
+    int mode, i;
+
+    nfuncs = argc > 2 ? atoi(argv[2]) : 2000;
+    framework = makeframework(nfuncs);
+    tid = malloc(nthreads * sizeof(*tid));
+    job = malloc(nthreads * sizeof(*job));
+    if (!framework || !tid || !job || workers < 1 || nthreads < 1)
+        return 1;
+    workers -= workers % nthreads;
+
+    /* the template: libraries and the framework, then frozen */
+    T = luaL_newstate();
+    luaL_openlibs(T);
+    if (luaL_loadstring(T, framework)) {
+        fprintf(stderr, "%s\n", lua_tostring(T, -1));
+        return 1;
+    }
+    heap = lua_freeze(T, 1);
+    if (heap == NULL)
+        return 1;
+    lua_close(T);  /* the heap stays until it is released */
+
+    /* f<i>(1, 2) is 3 + #'field<i % 97>' */
+    for (i = 1; i <= nfuncs; i++)
+        expect += 3 + 5 + (i % 97 >= 10 ? 2 : 1);
+    expect *= workers;
+
+    printf("%-8s %8s %10s %14s %12s\n", "mode", "workers", "wall(s)",
+           "us/worker", "KB/worker");
+    for (mode = 0; mode <= 1; mode++) {
+        double t0 = now(), wall, kb = 0, sum = 0;
+
+        for (i = 0; i < nthreads; i++) {
+            job[i].shared = mode;
+            job[i].count = workers / nthreads;
+            job[i].kb = job[i].sum = 0;
+            job[i].failed = 0;
+            pthread_create(&tid[i], NULL, run, &job[i]);
+        }
+        for (i = 0; i < nthreads; i++) {
+            pthread_join(tid[i], NULL);
+            if (job[i].failed)
+                return 1;
+            kb += job[i].kb;
+            sum += job[i].sum;
+        }
+        wall = now() - t0;
+        if (sum != expect) {
+            fprintf(stderr, "wrong result: %.0f, expected %.0f\n", sum, expect);
+            return 1;
+        }
+        printf("%-8s %8d %10.3f %14.1f %12.1f\n", mode ? "shared" : "plain",
+               workers, wall, wall * 1e6 / workers, kb / workers);
+    }
+
+    lua_releaseheap(heap);
+    free(framework);
+    free(tid);
+    free(job);
+    return 0;
+}
@@ -0,0 +1,52 @@
+-- table.sort and table.stablesort (ltablib.c, ltable.c)
+-- usage: lua sort.lua [scale]
+--
+-- Run it against two builds to compare them. Without a comparator,
+-- arrays of numbers or of strings take the in-place path; the other
+-- cases go through the Lua stack.
+
+local scale = tonumber(arg and arg[1]) or 1
+local clock = os.clock
+
+local N = math.floor(200000 * scale)
+math.randomseed(42)
+
+local function numbers(n, f) local t = {} for i = 1, n do t[i] = f(i) end return t end
+
+local inputs = {
+  random = numbers(N, function () return math.random() end),
+  sorted = numbers(N, function (i) return i end),
+  reverse = numbers(N, function (i) return N - i end),
+  few = numbers(N, function () return math.random(8) end),
+  strings = numbers(N, function () return "k" .. math.random(N) end),
+}
+
+local function greater(a, b) return a > b end
+local function byk(a, b) return a.k < b.k end
+local records = numbers(N / 4, function () return { k = math.random(100) } end)
+
+local cases = {
+  { "random", "random" }, { "sorted", "sorted" }, { "reverse", "reverse" },
+  { "few", "few" }, { "strings", "strings" },
+  { "random >", "random", greater },
+  { "records", records, byk },
+}
+
+local stable = table.stablesort
+print(string.format("%-10s %8s %10s %10s", "case", "n", "sort(s)",
+                    stable and "stable(s)" or ""))
+for _, c in ipairs(cases) do
+  local name, src, comp = c[1], c[2], c[3]
+  if type(src) == "string" then src = inputs[src] end
+  local function run(f)
+    local t = {}
+    for i = 1, #src do t[i] = src[i] end
+    collectgarbage()
+    local t0 = clock()
+    f(t, comp)
+    return clock() - t0
+  end
+  local ts = run(table.sort)
+  print(string.format("%-10s %8d %10.3f %10s", name, #src, ts,
+                      stable and string.format("%.3f", run(stable)) or ""))
+end
@@ -0,0 +1,62 @@
+-- hot-path counters (debug.stats) over a few workloads, next to their
+-- times; needs a build with LUAI_STATS (see luaconf.h)
+-- usage: lua stats.lua [scale]
+--
+-- The cost of the counters themselves is the difference in run.lua
+-- between a build with LUAI_STATS and one without.
+
+local scale = tonumber(arg and arg[1]) or 1
+local clock = os.clock
+
+if not debug.stats() then
+  print("built without LUAI_STATS")
+  return
+end
+
+local N = math.floor(200000 * scale)
+
+local cases = {
+  { "intern", function ()
+      local t = {}
+      for i = 1, N do t[i % 100] = "k" .. (i % 5000) end
+    end },
+  { "tables", function ()
+      for i = 1, N / 100 do
+        local t = {}
+        for j = 1, 100 do t[j] = j; t["x" .. (j % 10)] = j end
+      end
+    end },
+  { "recursion", function ()
+      local function rec(n) if n > 0 then return 1 + rec(n - 1) end return 0 end
+      for i = 1, N / 20000 + 1 do coroutine.wrap(rec)(2000) end
+    end },
+  { "metamethods", function ()
+      local base = {x = 1}
+      local p = setmetatable({}, {__index = base, __newindex = function () end})
+      local s = 0
+      for i = 1, N do s = s + p.x; p[i] = i end
+    end },
+  { "concat", function ()
+      local s = ""
+      for i = 1, N / 100 do s = s .. "line " .. i .. "\n" end
+    end },
+}
+
+local fields = {"strhits", "strmisses", "rehashes", "rehashslots",
+  "stackgrows", "cigrows", "indexmeta", "newindexmeta", "concats",
+  "concatbytes"}
+
+io.write(string.format("%-12s %8s", "case", "ms"))
+for _, f in ipairs(fields) do io.write(string.format(" %12s", f)) end
+io.write("\n")
+for _, c in ipairs(cases) do
+  collectgarbage()
+  debug.stats(true)
+  local t0 = clock()
+  c[2]()
+  local ms = (clock() - t0) * 1e3
+  local s = debug.stats()
+  io.write(string.format("%-12s %8.1f", c[1], ms))
+  for _, f in ipairs(fields) do io.write(string.format(" %12.0f", s[f])) end
+  io.write("\n")
+end
@@ -0,0 +1,84 @@
+-- tables with string keys: the hash part of ltable.c
+-- usage: lua strkeys.lua [scale]
+--
+-- Build the interpreter with and without LUA_USE_LINEARHASH (luaconf.h)
+-- and run it with both to compare the two layouts of the hash part.
+
+local scale = tonumber(arg and arg[1]) or 1
+local clock = os.clock
+
+local N = math.floor(200000 * scale)
+local keys, misses = {}, {}
+for i = 1, N do
+  keys[i] = "key" .. i
+  misses[i] = "miss" .. i
+end
+
+-- records with a dozen fields, read through local variables so the
+-- lookups are not served by the inline caches of constant keys
+local fields = { "id", "name", "kind", "x", "y", "z", "w", "h",
+                 "color", "parent", "next", "flags" }
+local records = {}
+for i = 1, 1000 do
+  local r = {}
+  for j, f in ipairs(fields) do r[f] = i + j end
+  records[i] = r
+end
+
+local big = {}
+
+local cases = {
+  -- fill a dictionary from empty: rehashes included
+  { "insert", N, function ()
+      local t = {}
+      for i = 1, N do t[keys[i]] = i end
+      big = t
+    end },
+  { "get hit", N, function ()
+      local t, s = big, 0
+      for i = 1, N do s = s + t[keys[i]] end
+      return s
+    end },
+  { "get miss", N, function ()
+      local t, n = big, 0
+      for i = 1, N do if t[misses[i]] then n = n + 1 end end
+      return n
+    end },
+  -- small tables: a dozen fields, the common object case
+  { "record get", N * 4, function ()
+      local s, nf = 0, #fields
+      for i = 1, N * 4 do
+        local r = records[i % 1000 + 1]
+        s = s + r[fields[i % nf + 1]]
+      end
+      return s
+    end },
+  { "record set", N * 4, function ()
+      local nf = #fields
+      for i = 1, N * 4 do
+        records[i % 1000 + 1][fields[i % nf + 1]] = i
+      end
+    end },
+  -- remove and add keys without growing the table
+  { "churn", N, function ()
+      local t = big
+      for i = 1, N, 2 do t[keys[i]] = nil end
+      for i = 1, N, 2 do t[misses[i]] = i end
+      for i = 1, N, 2 do t[misses[i]] = nil; t[keys[i]] = i end
+    end },
+  { "pairs", N * 4, function ()
+      local n = 0
+      for r = 1, 4 do for k, v in pairs(big) do n = n + 1 end end
+      return n
+    end },
+}
+
+print(string.format("%-12s %10s %12s", "case", "time(s)", "Mops/s"))
+for _, c in ipairs(cases) do
+  local name, ops, f = c[1], c[2], c[3]
+  collectgarbage()
+  local t0 = clock()
+  f()
+  local dt = clock() - t0
+  print(string.format("%-12s %10.3f %12.2f", name, dt, ops / 1e6 / dt))
+end
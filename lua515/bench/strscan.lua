@@ -0,0 +1,41 @@
+-- throughput of the string scanning paths of lstrlib.c
+-- usage: lua strscan.lua [scale]
+--
+-- Each case names the path it exercises.  Run it against two builds to
+-- compare them; the MB/s column is the subject size times repetitions.
+
+local scale = tonumber(arg and arg[1]) or 1
+local clock = os.clock
+
+local MB = 1024 * 1024
+local text = ("lorem ipsum dolor sit amet, consectetur adipiscing elit "):rep(MB / 56)
+local spaces = (" "):rep(MB) .. "x"
+local digits = ("0123456789"):rep(MB / 10) .. "x"
+local csv = ("a"):rep(MB) .. ","
+
+local cases = {
+  -- memchr on a rare 1st char
+  { "find rare", #text, function () return text:find("zebra", 1, true) end },
+  -- 1st char everywhere: Horspool after too many false hits
+  { "find common", #text, function () return text:find("elit lorem X", 1, true) end },
+  -- run of a %x class, tested with the precomputed set
+  { "%s*", #spaces, function () return spaces:match("^%s*") end },
+  { "%d+", #digits, function () return digits:match("%d+") end },
+  -- [^c]*: memchr for `c'
+  { "[^,]*", #csv, function () return csv:match("^[^,]*") end },
+  -- .*: no test at all
+  { ".*", #text, function () return text:match(".*") end },
+  { "byte", 4000, function () return text:byte(1, 4000) end },
+  -- doubling memcpy
+  { "rep", 8 * MB, function () return ("abcdefgh"):rep(MB) end },
+}
+
+print(string.format("%-12s %10s %10s", "case", "time(s)", "MB/s"))
+for _, c in ipairs(cases) do
+  local name, size, f = c[1], c[2], c[3]
+  local n = math.max(1, math.floor(20 * scale))
+  local t0 = clock()
+  for i = 1, n do f() end
+  local t = clock() - t0
+  print(string.format("%-12s %10.3f %10.1f", name, t, size * n / MB / t))
+end
@@ -0,0 +1,69 @@
+-- dispatch count of the superinstructions OP_GGETCALL and OP_GETTABLE2
+-- usage: lua superinstr.lua [scale]
+--
+-- The count hook counts dispatches, so a fused pair counts once.  With a
+-- line hook on as well the VM does not fuse, which gives the count of
+-- instructions for the same run.  Times are taken without any hook.
+
+local scale = tonumber(arg and arg[1]) or 1
+local clock = os.clock
+
+-- GGETCALL: calls of globals without arguments
+function tick() return 1 end
+local function globals(n)
+  local s = 0
+  for i = 1, n do
+    s = s + tick() + tick()
+  end
+  return s
+end
+
+-- GETTABLE2: field chains and runs of constant field reads
+local function fields(n)
+  local cfg = { win = { size = { w = 3, h = 4 } } }
+  local p = { x = 1, y = 2 }
+  local s = 0
+  for i = 1, n do
+    local x, y = p.x, p.y
+    s = s + cfg.win.size.w + x + y
+  end
+  return s
+end
+
+-- nothing to fuse, for reference
+local function plain(n)
+  local a, b = 1, 2
+  for i = 1, n do
+    if a < b then a = a + i else b = b + i end
+  end
+  return a + b
+end
+
+local kernels = {
+  { "globals", globals, 2000000 },
+  { "fields", fields, 2000000 },
+  { "plain", plain, 4000000 },
+}
+
+local function count(f, n, mask)
+  local steps = 0
+  debug.sethook(function (ev) if ev == "count" then steps = steps + 1 end end,
+                mask, 1)
+  f(n)
+  debug.sethook()
+  return steps
+end
+
+print(string.format("%-10s %10s %12s %12s %8s", "kernel", "time(s)",
+                    "instr", "dispatch", "saved"))
+for _, k in ipairs(kernels) do
+  local name, f, n = k[1], k[2], math.floor(k[3] * scale)
+  local small = math.floor(n / 100)
+  local instr = count(f, small, "l") * 100
+  local disp = count(f, small, "") * 100
+  local t0 = clock()
+  f(n)
+  local t = clock() - t0
+  print(string.format("%-10s %10.3f %12d %12d %7.1f%%", name, t, instr, disp,
+                      (instr - disp) * 100 / instr))
+end
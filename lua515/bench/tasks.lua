@@ -0,0 +1,60 @@
+-- tasks of the io library: io.spawn, io.run, io.sleep and file:aread
+-- usage: lua tasks.lua [scale]
+--
+-- Build the interpreter with LUA_USE_EPOLL (or LUA_USE_KQUEUE) and
+-- without to compare the poller with plain poll.
+
+local scale = tonumber(arg and arg[1]) or 1
+local clock = os.clock
+
+local N = math.floor(100000 * scale)
+local P = math.floor(32 * scale)
+
+local cases = {
+  { "spawn", N, function ()
+      local n = 0
+      for i = 1, N do io.spawn(function () n = n + 1 end) end
+      io.run()
+      return n
+    end },
+  -- switches between tasks that yield to each other
+  { "yield", N * 10, function ()
+      for i = 1, N / 100 do
+        io.spawn(function () for r = 1, 1000 do coroutine.yield() end end)
+      end
+      io.run()
+    end },
+  -- timers: many short sleeps at once
+  { "sleep", N, function ()
+      for i = 1, N do io.spawn(function () io.sleep((i % 10) / 1000) end) end
+      io.run()
+    end },
+  -- pipes read at the same time, 4 MB each; an op is a KB (and the time
+  -- is that of this process only)
+  { "pipes", P * 4096, function ()
+      local total = 0
+      for i = 1, P do
+        io.spawn(function ()
+          local f = io.popen("head -c 4194304 /dev/zero")
+          while true do
+            local s = f:aread(65536)
+            if s == nil then break end
+            total = total + #s
+          end
+          f:close()
+        end)
+      end
+      io.run()
+      assert(total == P * 4194304)
+    end },
+}
+
+print(string.format("%-8s %10s %12s", "case", "time(s)", "Kops/s"))
+for _, c in ipairs(cases) do
+  local name, ops, f = c[1], c[2], c[3]
+  collectgarbage()
+  local t0 = clock()
+  f()
+  local dt = clock() - t0
+  print(string.format("%-8s %10.3f %12.1f", name, dt, ops / 1e3 / dt))
+end
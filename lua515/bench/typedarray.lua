@@ -0,0 +1,73 @@
+-- typed arrays against tables of numbers: element loops, the bulk
+-- kernels and the cost of a full collection with the data alive
+-- usage: lua typedarray.lua [scale]
+
+local scale = tonumber(arg and arg[1]) or 1
+local clock = os.clock
+
+local N = math.floor(1000000 * scale)
+local ROUNDS = 10
+
+local function time(f)
+  collectgarbage()
+  local t0 = clock()
+  local res = f()
+  return (clock() - t0) * 1e3, res
+end
+
+local function cases(new)
+  local a, b
+  return {
+    { "fill", function ()
+        a, b = new(N), new(N)
+        for i = 1, N do a[i] = i * 0.5; b[i] = 2 end
+        return #a
+      end },
+    { "loop sum", function ()
+        local s = 0
+        for r = 1, ROUNDS do
+          for i = 1, N do s = s + a[i] end
+        end
+        return s
+      end },
+    { "loop dot", function ()
+        local s = 0
+        for r = 1, ROUNDS do
+          for i = 1, N do s = s + a[i] * b[i] end
+        end
+        return s
+      end },
+    { "kernel sum", function ()
+        if not a.sum then return nil end
+        local s = 0
+        for r = 1, ROUNDS do s = s + a:sum() end
+        return s
+      end },
+    { "kernel dot", function ()
+        if not a.dot then return nil end
+        local s = 0
+        for r = 1, ROUNDS do s = s + a:dot(b) end
+        return s
+      end },
+    { "full gc", function ()
+        for r = 1, ROUNDS do collectgarbage() end
+        return collectgarbage("count")
+      end },
+  }
+end
+
+local kinds = {
+  { "table", function (n) return {} end },
+  { "float64", function (n) return array.new("float64", n) end },
+  { "float32", function (n) return array.new("float32", n) end },
+}
+
+print(string.format("%-12s %-8s %10s %16s", "case", "kind", "ms", "result"))
+for _, k in ipairs(kinds) do
+  for _, c in ipairs(cases(k[2])) do
+    local ms, res = time(c[2])
+    if res then
+      print(string.format("%-12s %-8s %10.1f %16.0f", c[1], k[1], ms, res))
+    end
+  end
+end
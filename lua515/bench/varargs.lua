@@ -0,0 +1,65 @@
+-- vararg forwarding and tail calls: a five-layer middleware chain passing
+-- `...' through, handlers that ignore their extra arguments, and
+-- tail-recursive loops and state machines with large frames
+-- usage: lua varargs.lua [scale]
+
+local scale = tonumber(arg and arg[1]) or 1
+local clock = os.clock
+local select = select
+
+local N = math.floor(1000000 * scale)
+
+local function chain(n, last)
+  local f = last
+  for i = 1, n do
+    local nxt = f
+    f = function (req, ...) return nxt(req, ...) end
+  end
+  return f
+end
+
+local function handler(req, a, b, c) return req + a + b + c end
+
+local cases = {
+  { "chain 5", function ()
+      local f, s = chain(5, handler), 0
+      for i = 1, N do s = s + f(i, 1, 2, 3) end
+      return s
+    end },
+  { "chain 5 count", function ()
+      local f = chain(5, function (req, ...) return select('#', ...) end)
+      local s = 0
+      for i = 1, N do s = s + f(i, 1, 2, 3) end
+      return s
+    end },
+  { "ignored ...", function ()
+      -- `...' is never read: no `arg' table is built for it
+      local on = function (ev, ...) return ev end
+      local s = 0
+      for i = 1, N do s = s + on(1, i, i) end
+      return s
+    end },
+  { "tail loop", function ()
+      local function loop(n, acc)
+        if n == 0 then return acc end
+        local a, b, c, d, e, f, g, h = n, n, n, n, n, n, n, n
+        return loop(n - 1, acc + a)
+      end
+      return loop(N, 0)
+    end },
+  { "tail states", function ()
+      local s1, s2, s3
+      function s1(n, k) if n == 0 then return k end return s2(n - 1, k + 1) end
+      function s2(n, k) if n == 0 then return k end return s3(n - 1, k + 2) end
+      function s3(n, k) if n == 0 then return k end return s1(n - 1, k + 3) end
+      return s1(N, 0)
+    end },
+}
+
+print(string.format("%-14s %10s %14s", "case", "ms", "result"))
+for _, c in ipairs(cases) do
+  collectgarbage()
+  local t0 = clock()
+  local res = c[2]()
+  print(string.format("%-14s %10.1f %14.0f", c[1], (clock() - t0) * 1e3, res))
+end
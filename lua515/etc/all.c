@@ -24,8 +24,11 @@
 #include "lvm.c"
 #include "lzio.c"
 
+#include "larraylib.c"
 #include "lauxlib.c"
 #include "lbaselib.c"
+#include "lbitlib.c"
+#include "lchanlib.c"
 #include "ldblib.c"
 #include "liolib.c"
 #include "linit.c"
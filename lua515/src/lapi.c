@@ -342,7 +342,9 @@ LUA_API lua_Number lua_tonumber (lua_State *L, int idx) {
 LUA_API lua_Integer lua_tointeger (lua_State *L, int idx) {
   TValue n;
   const TValue *o = index2adr(L, idx);
-  if (tonumber(o, &n)) {
+  if (ttisint(o))
+    return ivalue(o);
+  else if (tonumber(o, &n)) {
     lua_Integer res;
     lua_Number num = nvalue(o);
     lua_number2integer(res, num);
@@ -457,7 +459,10 @@ LUA_API void lua_pushnumber (lua_State *L, lua_Number n) {
 
 LUA_API void lua_pushinteger (lua_State *L, lua_Integer n) {
   lua_lock(L);
-  setnvalue(L->top, cast_num(n));
+  if (cast(lua_Integer, cast_int(n)) == n)
+    setivalue(L->top, cast_int(n))
+  else
+    setnvalue(L->top, cast_num(n));
   api_incr_top(L);
   lua_unlock(L);
 }
@@ -606,6 +611,54 @@ LUA_API void lua_createtable (lua_State *L, int narray, int nrec) {
   lua_unlock(L);
 }
 
+
+/* 清空idx处的表，但保留其array及node区的内存 */
+LUA_API void lua_cleartable (lua_State *L, int idx) {
+  StkId t;
+  lua_lock(L);
+  t = index2adr(L, idx);
+  api_check(L, ttistable(t));
+  luaH_clear(hvalue(t));
+  lua_unlock(L);
+}
+
+
+/*
+** 若idx处的表的t[1..n]全在array区且全为number(非NaN)或全为string, 则直接在
+** array中按`<'排序(stable非0时为稳定排序)并返回1; 否则不做任何事并返回0
+*/
+LUA_API int lua_sortarray (lua_State *L, int idx, int n, int stable) {
+  StkId t;
+  int res;
+  lua_lock(L);
+  t = index2adr(L, idx);
+  api_check(L, ttistable(t));
+  res = luaH_sortarray(L, hvalue(t), n, stable);
+  lua_unlock(L);
+  return res;
+}
+
+/*
+** 若idx处的表的t[i..j]全在array区且全为string或number, 则将其以sep连接后的
+** 结果压栈并返回1(top++); 否则不做任何事并返回0
+*/
+LUA_API int lua_concatarray (lua_State *L, int idx, const char *sep,
+                             size_t lsep, int i, int j) {
+  StkId t;
+  TString *ts;
+  lua_lock(L);
+  luaC_checkGC(L);
+  t = index2adr(L, idx);
+  api_check(L, ttistable(t));
+  ts = luaV_concatarray(L, hvalue(t), sep, lsep, i, j);
+  if (ts != NULL) {
+    setsvalue2s(L, L->top, ts);
+    api_incr_top(L);
+  }
+  lua_unlock(L);
+  return ts != NULL;
+}
+
 /* 若idx.mt存在则 top = idx.mt, top++ */
 LUA_API int lua_getmetatable (lua_State *L, int objindex) {
   const TValue *obj;
@@ -731,6 +784,7 @@ LUA_API int lua_setmetatable (lua_State *L, int objindex) {
   else {
     api_check(L, ttistable(L->top - 1));
     mt = hvalue(L->top - 1);
+    luaT_newcache(L, mt);
   }
   
   switch (ttype(obj)) {
@@ -890,20 +944,108 @@ LUA_API int lua_cpcall (lua_State *L, lua_CFunction func, void *ud) {
 }
 
 /* data: LoadF for lua_Reader */
-LUA_API int lua_load (lua_State *L, lua_Reader reader, void *data,
-                      const char *chunkname) {
+static int aux_load (lua_State *L, lua_Reader reader, void *data,
+                     const char *chunkname, int mode) {
   ZIO z;
   int status;
   lua_lock(L);
   if (!chunkname) 
   	chunkname = "?";	/* 默认名 */
   luaZ_init(L, &z, reader, data);
-  status = luaD_protectedparser(L, &z, chunkname);
+  status = luaD_protectedparser(L, &z, chunkname, mode);
+  lua_unlock(L);
+  return status;
+}
+
+
+LUA_API int lua_load (lua_State *L, lua_Reader reader, void *data,
+                      const char *chunkname) {
+  return aux_load(L, reader, data, chunkname, 0);
+}
+
+
+/*
+** like lua_load, but a binary chunk skips the bytecode check: only for
+** images this process made with lua_dump (see luaL_loadfile's cache)
+*/
+LUA_API int lua_loadtrusted (lua_State *L, lua_Reader reader, void *data,
+                             const char *chunkname) {
+  return aux_load(L, reader, data, chunkname, LUAU_TRUSTED);
+}
+
+
+/*
+** loads a data chunk (`[return] value', the value made of constants and
+** table constructors): pushes the value itself, built with no code
+*/
+LUA_API int lua_loaddata (lua_State *L, lua_Reader reader, void *data,
+                          const char *chunkname) {
+  ZIO z;
+  int status;
+  lua_lock(L);
+  if (!chunkname) chunkname = "?";
+  luaZ_init(L, &z, reader, data);
+  status = luaD_protectedparsedata(L, &z, chunkname);
   lua_unlock(L);
   return status;
 }
 
 
+typedef struct LoadImg {
+  const char *p;
+  size_t size;
+} LoadImg;
+
+
+static const char *getimage (lua_State *L, void *ud, size_t *size) {
+  LoadImg *li = (LoadImg *)ud;
+  (void)L;
+  if (li->size == 0) return NULL;
+  *size = li->size;
+  li->size = 0;
+  return li->p;
+}
+
+
+/*
+** loads a chunk from memory that stays valid and unchanged for the life
+** of the state (static data, or a mapping that is never unmapped): the
+** code and line info of an image (luac -i) are used in place
+*/
+LUA_API int lua_loadimage (lua_State *L, const char *image, size_t size,
+                           const char *chunkname) {
+  LoadImg li;
+  li.p = image;
+  li.size = size;
+  return aux_load(L, getimage, &li, chunkname, LUAU_INPLACE);
+}
+
+
+/*
+** pushes a closure of function `i' of the shared heap of the state, as
+** `lua_load' would push it after compiling; returns 0 if there is none
+*/
+LUA_API int lua_loadshared (lua_State *L, int i) {
+  lua_Heap *h = G(L)->shared;
+  Proto *tf;
+  Closure *cl;
+  int j;
+  if (h == NULL || i < 1 || i > h->nfn)
+    return 0;
+  lua_lock(L);
+  luaC_checkGC(L);
+  tf = h->fn[i - 1];
+  cl = luaF_newLclosure(L, tf->nups, hvalue(gt(L)));
+  cl->l.p = tf;
+  for (j = 0; j < tf->nups; j++)  /* initialize eventual upvalues */
+    cl->l.upvals[j] = luaF_newupval(L);
+  setclvalue(L, L->top, cl);
+  api_incr_top(L);
+  lua_unlock(L);
+  return 1;
+}
+
+
 LUA_API int lua_dump (lua_State *L, lua_Writer writer, void *data) {
   int status;
   TValue *o;
@@ -911,7 +1053,7 @@ LUA_API int lua_dump (lua_State *L, lua_Writer writer, void *data) {
   api_checknelems(L, 1);
   o = L->top - 1;
   if (isLfunction(o))
-    status = luaU_dump(L, clvalue(o)->l.p, writer, data, 0);
+    status = luaU_dump(L, clvalue(o)->l.p, writer, data, 0, 0);
   else
     status = 1;
   lua_unlock(L);
@@ -944,6 +1086,7 @@ LUA_API int lua_gc (lua_State *L, int what, int data) {
     }
     case LUA_GCCOLLECT: {
       luaC_fullgc(L);
+      luaE_freecache(L);
       break;
     }
     case LUA_GCCOUNT: {
@@ -963,7 +1106,7 @@ LUA_API int lua_gc (lua_State *L, int what, int data) {
         g->GCthreshold = 0;
       while (g->GCthreshold <= g->totalbytes) {
         luaC_step(L);
-        if (g->gcstate == GCSpause) {  /* end of cycle? */
+        if (g->gcstate == GCSpause || isgenerational(g)) {  /* end of cycle? */
           res = 1;  /* signal it */
           break;
         }
@@ -980,6 +1123,45 @@ LUA_API int lua_gc (lua_State *L, int what, int data) {
       g->gcstepmul = data;
       break;
     }
+    case LUA_GCGEN: {
+      res = isgenerational(g) ? LUA_GCGEN : LUA_GCINC;  /* previous mode */
+      if (data > 0) g->gcmajorinc = data;
+      luaC_changemode(L, KGC_GEN);
+      break;
+    }
+    case LUA_GCINC: {
+      res = isgenerational(g) ? LUA_GCGEN : LUA_GCINC;  /* previous mode */
+      luaC_changemode(L, KGC_NORMAL);
+      break;
+    }
+    case LUA_GCMARKTHREADS: {
+      res = g->gcmarkthreads;
+      if (data > 0) g->gcmarkthreads = data;
+      break;
+    }
+    case LUA_GCBGSWEEP: {  /* host only: the allocator must be thread safe */
+      res = luaC_bgsweep(L, data);
+      break;
+    }
+    case LUA_GCSETBUDGET: {
+      res = g->gcbudget;
+      if (data >= 0) g->gcbudget = data;
+      break;
+    }
+    case LUA_GCSETGROWTH: {
+      res = g->gcgrowth;
+      if (data > 0) g->gcgrowth = data;
+      break;
+    }
+    case LUA_GCIDLE: {
+      res = luaC_idle(L, data);
+      break;
+    }
+    case LUA_GCHEAPSAMPLE: {  /* mean bytes between samples; 0: stop */
+      res = cast_int(data >= 0 ? luaM_heaprate(L, cast(size_t, data))
+                               : g->heap.rate);
+      break;
+    }
     default: res = -1;  /* invalid option */
   }
   lua_unlock(L);
@@ -987,6 +1169,78 @@ LUA_API int lua_gc (lua_State *L, int what, int data) {
 }
 
 
+/*
+** hard memory limit: allocations that would take the heap past `limit'
+** bytes fail with LUA_ERRMEM, after the collector did a full collection
+** near the limit (0: no limit); returns the previous limit
+*/
+LUA_API size_t lua_setmemlimit (lua_State *L, size_t limit) {
+  global_State *g;
+  size_t old;
+  lua_lock(L);
+  g = G(L);
+  old = (g->memlimit == MAX_LUMEM) ? 0 : cast(size_t, g->memlimit);
+  g->memlimit = (limit == 0) ? MAX_LUMEM : cast(lu_mem, limit);
+  luaC_setmemlimits(L);
+  lua_unlock(L);
+  return old;
+}
+
+
+/*
+** soft memory limit: `f' is called, from a collector step, once each
+** time the heap passes `limit' bytes (0 or a NULL `f': none). It must
+** not call the API; it can tell the host to shed load.  Returns the
+** previous limit
+*/
+LUA_API size_t lua_setmemsoft (lua_State *L, size_t limit, lua_MemHook f,
+                               void *ud) {
+  global_State *g;
+  size_t old;
+  lua_lock(L);
+  g = G(L);
+  old = (g->memsoft == MAX_LUMEM) ? 0 : cast(size_t, g->memsoft);
+  if (limit == 0 || f == NULL) {
+    g->memsoft = MAX_LUMEM;
+    f = NULL;
+    ud = NULL;
+  }
+  else
+    g->memsoft = cast(lu_mem, limit);
+  g->memsofthook = f;
+  g->memsoftud = ud;
+  luaC_setmemlimits(L);
+  lua_unlock(L);
+  return old;
+}
+
+
+LUA_API void lua_gcstats (lua_State *L, lua_GCStats *st) {
+  lua_lock(L);
+  *st = G(L)->gcstats;
+  lua_unlock(L);
+}
+
+
+/*
+** copies the hot-path counters to `st' (if not NULL) and zeroes them
+** if `reset'; returns 0, with `st' zeroed, in a build without LUAI_STATS
+*/
+LUA_API int lua_stats (lua_State *L, lua_Stats *st, int reset) {
+#if defined(LUAI_STATS)
+  lua_lock(L);
+  if (st) *st = G(L)->stats;
+  if (reset) memset(&G(L)->stats, 0, sizeof(G(L)->stats));
+  lua_unlock(L);
+  return 1;
+#else
+  (void)L; (void)reset;
+  if (st) memset(st, 0, sizeof(*st));
+  return 0;
+#endif
+}
+
+
 
 /*
 ** miscellaneous functions
@@ -1048,11 +1302,143 @@ LUA_API lua_Alloc lua_getallocf (lua_State *L, void **ud) {
 
 LUA_API void lua_setallocf (lua_State *L, lua_Alloc f, void *ud) {
   lua_lock(L);
+  luaC_syncsweep(L);  /* blocks of the old allocator go back to it */
   G(L)->ud = ud;
   G(L)->frealloc = f;
   lua_unlock(L);
 }
 
+
+/*
+** gives the userdata at `idx' a native finalizer (NULL removes it). It
+** runs when the collector frees the block, after any `__gc', without
+** calling into Lua; with LUA_FINTHREADSAFE it may run on the background
+** sweeper (see LUA_GCBGSWEEP)
+*/
+LUA_API void lua_setfinalizer (lua_State *L, int idx, lua_Finalizer f,
+                               int flags) {
+  StkId o;
+  lua_lock(L);
+  o = index2adr(L, idx);
+  api_check(L, ttisuserdata(o));
+  rawuvalue(o)->uv.fin = f;
+  rawuvalue(o)->uv.finsafe = (f != NULL && (flags & LUA_FINTHREADSAFE));
+  lua_unlock(L);
+}
+
+
+/*
+** sets the string hash mode (LUA_HASHSAMPLE or LUA_HASHFULL) and returns
+** the previous one. Changing it rehashes every string and table, so it
+** is best done right after the state is created.
+*/
+LUA_API int lua_hashmode (lua_State *L, int mode) {
+  int res;
+  lua_lock(L);
+  res = G(L)->hashfull ? LUA_HASHFULL : LUA_HASHSAMPLE;
+  luaS_sethashmode(L, mode == LUA_HASHFULL);
+  lua_unlock(L);
+  return res;
+}
+
+/*
+** turns the optimizing pass of the compiler (see luaK_optimize) on or
+** off for the chunks loaded from source from now on (a negative `on'
+** leaves it as it is); returns the previous setting
+*/
+LUA_API int lua_optimize (lua_State *L, int on) {
+  int res;
+  lua_lock(L);
+  res = G(L)->optimize;
+  if (on >= 0) G(L)->optimize = cast_byte(on != 0);
+  lua_unlock(L);
+  return res;
+}
+
+
+/*
+** replace the `n' numbers at the top of the stack by the result of the
+** bit operation `op' on them
+*/
+LUA_API void lua_bitop (lua_State *L, int op, int n) {
+  int r;
+  lua_lock(L);
+  api_check(L, LUA_OPTOBIT <= op && op <= LUA_OPROR);
+  api_check(L, n >= (op >= LUA_OPLSHIFT ? 2 : 1));
+  api_checknelems(L, n);
+  r = luaV_bitop(op, L->top - n, n);
+  L->top -= n;
+  setivalue(L->top, r);
+  api_incr_top(L);
+  lua_unlock(L);
+}
+
+
+/*
+** make the C function at `idx' stand for the bit operation `op': the VM
+** then runs `op' itself when the function is called with numbers
+*/
+LUA_API void lua_setbitop (lua_State *L, int idx, int op) {
+  StkId o;
+  lua_lock(L);
+  o = index2adr(L, idx);
+  api_check(L, iscfunction(o));
+  api_check(L, LUA_OPTOBIT <= op && op <= LUA_OPROR);
+  clvalue(o)->c.bitop = cast_byte(op);
+  lua_unlock(L);
+}
+
+
+/*
+** makes the C function at `idx' a leaf taking `nargs' arguments: a Lua
+** function calling it with exactly that many, with no call or return
+** hooks set, runs it without a CallInfo of its own (luaD_leafcall). A
+** leaf may use the stack, call functions and raise errors, but it has
+** no upvalues nor environment of its own (LUA_ENVIRONINDEX is the
+** caller's), cannot yield, and its errors name the caller.
+*/
+LUA_API void lua_setleaf (lua_State *L, int idx, int nargs) {
+  StkId o;
+  lua_lock(L);
+  o = index2adr(L, idx);
+  api_check(L, iscfunction(o) && clvalue(o)->c.nupvalues == 0);
+  api_check(L, 0 <= nargs && nargs < 255);
+  clvalue(o)->c.leaf = cast_byte(nargs + 1);
+  lua_unlock(L);
+}
+
+
+/*
+** makes the C function at `idx' stand for the iterator `kind': a generic
+** `for' over it and a table then steps through the table itself, with
+** no calls
+*/
+LUA_API void lua_setiter (lua_State *L, int idx, int kind) {
+  StkId o;
+  lua_lock(L);
+  o = index2adr(L, idx);
+  api_check(L, iscfunction(o));
+  api_check(L, kind == LUA_ITERNEXT || kind == LUA_ITERIPAIRS);
+  clvalue(o)->c.iter = cast_byte(kind);
+  lua_unlock(L);
+}
+
+
+/*
+** makes the C function at `idx' stand for pcall: a Lua function calling
+** it with a Lua function to call, with no hooks set, has the VM run the
+** protected call itself (luaD_vmpcall), without entering the C function
+*/
+LUA_API void lua_setpcall (lua_State *L, int idx) {
+  StkId o;
+  lua_lock(L);
+  o = index2adr(L, idx);
+  api_check(L, iscfunction(o));
+  clvalue(o)->c.pcall = 1;
+  lua_unlock(L);
+}
+
+
 /* 按照给出的内存尺寸要求构建一个userdata，将其压入栈，返回load地址 */
 LUA_API void *lua_newuserdata (lua_State *L, size_t size) {
   Udata *u;
@@ -1066,9 +1452,48 @@ LUA_API void *lua_newuserdata (lua_State *L, size_t size) {
 }
 
 
+/*
+** pushes a typed array of `n' elements of type `kind' (LUA_AINT8...),
+** all zero, and returns its elements; it is a userdata whose elements
+** are read and written by the VM (t[i], 1 <= i <= n) before any
+** metamethod is tried
+*/
+LUA_API void *lua_newarray (lua_State *L, int kind, size_t n) {
+  Udata *u;
+  lua_lock(L);
+  api_check(L, LUA_AINT8 <= kind && kind <= LUA_AFLOAT64);
+  if (n > (MAX_SIZET - sizeof(Udata)) >> luaO_ashift[kind])
+    luaM_toobig(L);
+  luaC_checkGC(L);
+  u = luaS_newudata(L, n << luaO_ashift[kind], getcurrenv(L));
+  u->uv.akind = cast_byte(kind);
+  memset(u + 1, 0, u->uv.len);
+  setuvalue(L, L->top, u);
+  api_incr_top(L);
+  lua_unlock(L);
+  return u + 1;
+}
+
+
+/*
+** elements of the typed array at `idx', with their type and number in
+** `kind' and `n' (when not NULL); NULL if the value is not a typed array
+*/
+LUA_API void *lua_toarray (lua_State *L, int idx, int *kind, size_t *n) {
+  StkId o = index2adr(L, idx);
+  Udata *u;
+  if (!ttisarray(o)) return NULL;
+  u = rawuvalue(o);
+  if (kind) *kind = u->uv.akind;
+  if (n) *n = u->uv.len >> luaO_ashift[u->uv.akind];
+  return u + 1;
+}
+
+
 
 /* 获取fi指定的func的object的第N个upvalue，将其存放在val上 */
-static const char *aux_upvalue (StkId fi, int n, TValue **val) {
+static const char *aux_upvalue (lua_State *L, StkId fi, int n,
+                                TValue **val) {
   Closure *f;
   
   /* 作为api层，这里还是要判断下，毕竟不知道调用者传了个什么值过来 */
@@ -1083,6 +1508,7 @@ static const char *aux_upvalue (StkId fi, int n, TValue **val) {
   }
   else {
     Proto *p = f->l.p;
+    luaG_needdebug(L, p);
     if (!(1 <= n && n <= p->sizeupvalues)) return NULL;
     *val = f->l.upvals[n-1]->v;
     return getstr(p->upvalues[n-1]);
@@ -1097,7 +1523,7 @@ LUA_API const char *lua_getupvalue (lua_State *L, int funcindex, int n) {
   const char *name;
   TValue *val;
   lua_lock(L);
-  name = aux_upvalue(index2adr(L, funcindex), n, &val);
+  name = aux_upvalue(L, index2adr(L, funcindex), n, &val);
   if (name) {
     setobj2s(L, L->top, val);
     api_incr_top(L);
@@ -1114,7 +1540,7 @@ LUA_API const char *lua_setupvalue (lua_State *L, int funcindex, int n) {
   lua_lock(L);
   fi = index2adr(L, funcindex);
   api_checknelems(L, 1);
-  name = aux_upvalue(fi, n, &val);
+  name = aux_upvalue(L, fi, n, &val);
   if (name) {
     L->top--;
     setobj(L, val, L->top);
@@ -0,0 +1,295 @@
+/*
+** $Id: larraylib.c $
+** Typed arrays: packed numbers in one block
+** See Copyright Notice in lua.h
+*/
+
+
+#include <math.h>
+#include <string.h>
+
+#define larraylib_c
+#define LUA_LIB
+
+#include "lua.h"
+
+#include "lauxlib.h"
+#include "lualib.h"
+
+
+/*
+** A typed array (lua_newarray) keeps its elements packed, in a userdata
+** that the collector never scans. The VM reads and writes a[i] itself;
+** the metamethods here only see the accesses it refuses: method names,
+** indices out of range and values that are not numbers. Integer
+** elements wrap around like the bit library; float32 elements are
+** rounded.
+**
+** The kernels below are plain loops over the element type, written so
+** that the compiler can vectorize them (sums keep four partial results,
+** as floating-point addition cannot be reordered).
+*/
+
+
+static const char *const kindnames[] = {
+  "int8", "uint8", "int16", "uint16", "int32", "uint32", "float32",
+  "float64", NULL
+};
+
+
+/* expands `k' once per element type, as `k(T)' */
+#define forkind(kind,k) \
+  switch (kind) { \
+    case LUA_AINT8: k(signed char); break; \
+    case LUA_AUINT8: k(unsigned char); break; \
+    case LUA_AINT16: k(short); break; \
+    case LUA_AUINT16: k(unsigned short); break; \
+    case LUA_AINT32: k(int); break; \
+    case LUA_AUINT32: k(unsigned int); break; \
+    case LUA_AFLOAT32: k(float); break; \
+    default: k(double); break; \
+  }
+
+
+static void *checkarray (lua_State *L, int arg, int *kind, size_t *n) {
+  void *p = lua_toarray(L, arg, kind, n);
+  if (p == NULL) luaL_typerror(L, arg, "array");
+  return p;
+}
+
+
+/* optional 1-based range [i, j] at `arg', as the 0-based [*i, *j) */
+static void checkrange (lua_State *L, int arg, size_t n, size_t *i,
+                        size_t *j) {
+  lua_Integer a = luaL_optinteger(L, arg, 1);
+  lua_Integer b = luaL_optinteger(L, arg + 1, (lua_Integer)n);
+  luaL_argcheck(L, a >= 1, arg, "index out of range");
+  luaL_argcheck(L, b <= (lua_Integer)n, arg + 1, "index out of range");
+  *i = (size_t)(a - 1);
+  *j = a <= b ? (size_t)b : *i;
+}
+
+
+static int arr_new (lua_State *L) {
+  int kind = luaL_checkoption(L, 1, NULL, kindnames) + 1;
+  size_t n, k;
+  if (lua_istable(L, 2)) {
+    n = lua_objlen(L, 2);
+    lua_newarray(L, kind, n);
+    luaL_getmetatable(L, LUA_ARRAYHANDLE);
+    lua_setmetatable(L, -2);
+    for (k = 1; k <= n; k++) {
+      lua_pushinteger(L, (lua_Integer)k);
+      lua_rawgeti(L, 2, (int)k);
+      lua_settable(L, -3);
+    }
+  }
+  else {
+    lua_Integer sz = luaL_checkinteger(L, 2);
+    luaL_argcheck(L, sz >= 0, 2, "invalid size");
+    lua_newarray(L, kind, (size_t)sz);
+    luaL_getmetatable(L, LUA_ARRAYHANDLE);
+    lua_setmetatable(L, -2);
+  }
+  return 1;
+}
+
+
+static int arr_kind (lua_State *L) {
+  int kind;
+  checkarray(L, 1, &kind, NULL);
+  lua_pushstring(L, kindnames[kind - 1]);
+  return 1;
+}
+
+
+static int arr_len (lua_State *L) {
+  size_t n;
+  checkarray(L, 1, NULL, &n);
+  lua_pushinteger(L, (lua_Integer)n);
+  return 1;
+}
+
+
+/* a[i] = v that the VM refused: bad index or value; or a string number */
+static int arr_newindex (lua_State *L) {
+  size_t n;
+  lua_Number i;
+  checkarray(L, 1, NULL, &n);
+  i = lua_tonumber(L, 2);
+  luaL_argcheck(L, lua_type(L, 2) == LUA_TNUMBER && i == floor(i) &&
+                   1 <= i && i <= (lua_Number)n, 2, "index out of range");
+  lua_pushvalue(L, 2);
+  lua_pushnumber(L, luaL_checknumber(L, 3));
+  lua_settable(L, 1);
+  return 0;
+}
+
+
+/* fill(a, v [, i [, j]]) */
+static int arr_fill (lua_State *L) {
+  int kind;
+  size_t n, i, j, k;
+  void *p = checkarray(L, 1, &kind, &n);
+  lua_Number v = luaL_checknumber(L, 2);
+  unsigned int bits = 0;
+  checkrange(L, 3, n, &i, &j);
+  if (kind < LUA_AFLOAT32) {  /* wrap around as a[i] = v does */
+    lua_pushnumber(L, v);
+    lua_bitop(L, LUA_OPTOBIT, 1);
+    bits = (unsigned int)lua_tointeger(L, -1);
+  }
+#define FILL(T) { \
+    T *e = (T *)p, x = kind < LUA_AFLOAT32 ? (T)bits : (T)v; \
+    for (k = i; k < j; k++) e[k] = x; }
+  forkind(kind, FILL)
+#undef FILL
+  lua_settop(L, 1);
+  return 1;
+}
+
+
+/* copy(a, src [, i]): src (an array or a table) into a from a[i] on */
+static int arr_copy (lua_State *L) {
+  int kind, skind;
+  size_t n, sn, k;
+  char *p = (char *)checkarray(L, 1, &kind, &n);
+  void *s = lua_toarray(L, 2, &skind, &sn);
+  lua_Integer i = luaL_optinteger(L, 3, 1);
+  if (s == NULL) {
+    luaL_checktype(L, 2, LUA_TTABLE);
+    sn = lua_objlen(L, 2);
+  }
+  luaL_argcheck(L, i >= 1 && (size_t)(i - 1) <= n &&
+                   sn <= n - (size_t)(i - 1), 3, "index out of range");
+  if (s != NULL && skind == kind) {
+    size_t w;
+#define WIDTH(T)	w = sizeof(T)
+    forkind(kind, WIDTH)
+#undef WIDTH
+    memmove(p + (size_t)(i - 1) * w, s, sn * w);
+  }
+  else {  /* convert each element, as a[i] = v does */
+    for (k = 1; k <= sn; k++) {
+      lua_pushinteger(L, i + (lua_Integer)k - 1);
+      if (s != NULL) {
+        lua_pushinteger(L, (lua_Integer)k);
+        lua_gettable(L, 2);
+      }
+      else
+        lua_rawgeti(L, 2, (int)k);
+      lua_settable(L, 1);
+    }
+  }
+  lua_settop(L, 1);
+  return 1;
+}
+
+
+/* sum(a [, i [, j]]) */
+static int arr_sum (lua_State *L) {
+  int kind;
+  size_t n, i, j, k;
+  void *p = checkarray(L, 1, &kind, &n);
+  lua_Number s0 = 0, s1 = 0, s2 = 0, s3 = 0;
+  checkrange(L, 2, n, &i, &j);
+#define SUM(T) { \
+    const T *e = (const T *)p; \
+    for (k = i; k + 4 <= j; k += 4) { \
+      s0 += e[k]; s1 += e[k + 1]; s2 += e[k + 2]; s3 += e[k + 3]; \
+    } \
+    for (; k < j; k++) s0 += e[k]; }
+  forkind(kind, SUM)
+#undef SUM
+  lua_pushnumber(L, (s0 + s1) + (s2 + s3));
+  return 1;
+}
+
+
+/* dot(a, b): arrays of the same type and length */
+static int arr_dot (lua_State *L) {
+  int kind, bkind;
+  size_t n, bn, k;
+  void *p = checkarray(L, 1, &kind, &n);
+  void *q = checkarray(L, 2, &bkind, &bn);
+  lua_Number s0 = 0, s1 = 0, s2 = 0, s3 = 0;
+  luaL_argcheck(L, bkind == kind && bn == n, 2,
+                "array of the same type and length expected");
+#define DOT(T) { \
+    const T *a = (const T *)p, *b = (const T *)q; \
+    for (k = 0; k + 4 <= n; k += 4) { \
+      s0 += (lua_Number)a[k] * b[k]; \
+      s1 += (lua_Number)a[k + 1] * b[k + 1]; \
+      s2 += (lua_Number)a[k + 2] * b[k + 2]; \
+      s3 += (lua_Number)a[k + 3] * b[k + 3]; \
+    } \
+    for (; k < n; k++) s0 += (lua_Number)a[k] * b[k]; }
+  forkind(kind, DOT)
+#undef DOT
+  lua_pushnumber(L, (s0 + s1) + (s2 + s3));
+  return 1;
+}
+
+
+/* totable(a [, i [, j]]) */
+static int arr_totable (lua_State *L) {
+  size_t n, i, j, k;
+  checkarray(L, 1, NULL, &n);
+  checkrange(L, 2, n, &i, &j);
+  lua_createtable(L, (int)(j - i), 0);
+  for (k = i; k < j; k++) {
+    lua_pushinteger(L, (lua_Integer)k + 1);
+    lua_gettable(L, 1);
+    lua_rawseti(L, -2, (int)(k - i + 1));
+  }
+  return 1;
+}
+
+
+static int arr_tostring (lua_State *L) {
+  int kind;
+  size_t n;
+  void *p = checkarray(L, 1, &kind, &n);
+  lua_pushfstring(L, "%s[%d]: %p", kindnames[kind - 1], (int)n, p);
+  return 1;
+}
+
+
+static const luaL_Reg arraylib[] = {
+  {"copy",    arr_copy},
+  {"dot",     arr_dot},
+  {"fill",    arr_fill},
+  {"kind",    arr_kind},
+  {"new",     arr_new},
+  {"sum",     arr_sum},
+  {"totable", arr_totable},
+  {NULL, NULL}
+};
+
+
+static const luaL_Reg arraymeta[] = {
+  {"__len",      arr_len},
+  {"__newindex", arr_newindex},
+  {"__tostring", arr_tostring},
+  {"copy",       arr_copy},
+  {"dot",        arr_dot},
+  {"fill",       arr_fill},
+  {"kind",       arr_kind},
+  {"sum",        arr_sum},
+  {"totable",    arr_totable},
+  {NULL, NULL}
+};
+
+
+/*
+** Open array library
+*/
+LUALIB_API int luaopen_array (lua_State *L) {
+  luaL_newmetatable(L, LUA_ARRAYHANDLE);
+  luaL_register(L, NULL, arraymeta);
+  lua_pushvalue(L, -1);
+  lua_setfield(L, -2, "__index");  /* methods are in the metatable */
+  lua_pop(L, 1);  /* pop metatable */
+  luaL_register(L, LUA_ARRAYLIBNAME, arraylib);
+  return 1;
+}
@@ -24,6 +24,17 @@
 
 #include "lauxlib.h"
 
+#if defined(LUA_USE_POSIX) && LUAL_CHUNKCACHE > 0
+#define LUA_CHUNKCACHE
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#if defined(LUA_USE_PTHREADS)
+#include <pthread.h>
+#endif
+#endif
+
 
 #define FREELIST_REF	0	/* free list of references */
 
@@ -477,8 +488,25 @@ LUALIB_API char *luaL_prepbuffer (luaL_Buffer *B) {
 
 
 LUALIB_API void luaL_addlstring (luaL_Buffer *B, const char *s, size_t l) {
-  while (l--)
-    luaL_addchar(B, *s++);
+  if (l >= LUAL_BUFFERSIZE) {  /* too long for the buffer: push it apart */
+    emptybuffer(B);
+    lua_pushlstring(B->L, s, l);
+    B->lvl++;
+    adjuststack(B);
+    return;
+  }
+  while (l > 0) {  /* copy in blocks, not char by char */
+    size_t n = bufffree(B);
+    if (n == 0) {
+      luaL_prepbuffer(B);
+      n = LUAL_BUFFERSIZE;
+    }
+    if (n > l) n = l;
+    memcpy(B->p, s, n);
+    B->p += n;
+    s += n;
+    l -= n;
+  }
 }
 
 
@@ -521,6 +549,51 @@ LUALIB_API void luaL_buffinit (lua_State *L, luaL_Buffer *B) {
 /* }====================================================== */
 
 
+/*
+** {======================================================
+** String slices
+** =======================================================
+*/
+
+
+/* the slice at `idx', or NULL if it is not one */
+LUALIB_API luaL_Slice *luaL_toslice (lua_State *L, int idx) {
+  luaL_Slice *sl = NULL;
+  if (lua_type(L, idx) == LUA_TUSERDATA && lua_getmetatable(L, idx)) {
+    lua_getfield(L, LUA_REGISTRYINDEX, LUAL_SLICE);
+    if (lua_rawequal(L, -1, -2))
+      sl = (luaL_Slice *)lua_touserdata(L, idx);
+    lua_pop(L, 2);
+  }
+  return sl;
+}
+
+
+/*
+** push the slice [s, s+l) of the value at `anchor' (a positive or a
+** pseudo index), which must own those bytes: a string, a slice, or any
+** userdata that keeps them valid while it lives; uses 3 stack slots
+*/
+LUALIB_API void luaL_pushslice (lua_State *L, int anchor, const char *s,
+                                size_t l) {
+  luaL_Slice *sl = (luaL_Slice *)lua_newuserdata(L, sizeof(luaL_Slice));
+  sl->s = s;
+  sl->l = l;
+  if (luaL_toslice(L, anchor))
+    lua_getfenv(L, anchor);  /* share the anchor of the parent */
+  else {
+    lua_createtable(L, 1, 0);
+    lua_pushvalue(L, anchor);
+    lua_rawseti(L, -2, 1);
+  }
+  lua_setfenv(L, -2);
+  luaL_getmetatable(L, LUAL_SLICE);
+  lua_setmetatable(L, -2);
+}
+
+/* }====================================================== */
+
+
 LUALIB_API int luaL_ref (lua_State *L, int t) {
   int ref;
   t = abs_index(L, t);
@@ -593,11 +666,303 @@ static int errfile (lua_State *L, const char *what, int fnameindex) {
 }
 
 
+typedef struct LoadS {
+  const char *s;
+  size_t size;
+} LoadS;
+
+
+static const char *getS (lua_State *L, void *ud, size_t *size) {
+  LoadS *ls = (LoadS *)ud;
+  (void)L;
+  if (ls->size == 0) return NULL;
+  *size = ls->size;
+  ls->size = 0;
+  return ls->s;
+}
+
+
+/*
+** {======================================================
+** Process-wide cache of compiled files: `luaL_loadfile' keeps the
+** lua_dump image of each file it compiles, keyed by its path and stat
+** data, and loads a file that did not change from there without the
+** parser or the bytecode check. Images are read-only once in the list;
+** an entry that is replaced or evicted while a state reads it is freed
+** by the last reader.
+** Images (luac -i) are mapped instead, and their code and line info are
+** used in place by every state (and process) that loads them; so those
+** mappings stay for the life of the process. Replace such a file with
+** rename(2), never by writing into it.
+** =======================================================
+*/
+
+#if defined(LUA_CHUNKCACHE)
+
+typedef struct ChunkKey {
+  dev_t dev;
+  ino_t ino;
+  off_t size;
+  time_t mtime;
+  time_t ctime;  /* also changes with chmod or rename */
+  long mtimens;  /* for two writes within a second, where known */
+  int optimize;  /* compiled with the optimizing pass (lua_optimize)? */
+} ChunkKey;
+
+typedef struct Chunk {
+  struct Chunk *next;
+  ChunkKey key;
+  char *image;
+  size_t size;
+  int refs;  /* states reading the image */
+  int stale;  /* out of the list: free it with the last reader */
+  char path[1];  /* variable length */
+} Chunk;
+
+static Chunk *chunks = NULL;  /* most recent first */
+static int nchunks = 0;
+
+#if defined(LUA_USE_PTHREADS)
+static pthread_mutex_t chunklock = PTHREAD_MUTEX_INITIALIZER;
+#define lockchunks()	pthread_mutex_lock(&chunklock)
+#define unlockchunks()	pthread_mutex_unlock(&chunklock)
+#else
+#define lockchunks()	((void)0)
+#define unlockchunks()	((void)0)
+#endif
+
+
+static int chunkkey (const char *path, ChunkKey *k) {
+  struct stat st;
+  if (stat(path, &st) != 0 || !S_ISREG(st.st_mode))
+    return 0;
+  memset(k, 0, sizeof(*k));  /* no padding garbage for memcmp */
+  k->dev = st.st_dev;
+  k->ino = st.st_ino;
+  k->size = st.st_size;
+  k->mtime = st.st_mtime;
+  k->ctime = st.st_ctime;
+#if defined(LUA_USE_LINUX)
+  k->mtimens = (long)st.st_mtim.tv_nsec;
+#endif
+  return 1;
+}
+
+
+static void freechunk (Chunk *c) {
+  free(c->image);
+  free(c);
+}
+
+
+/* takes `c' out of the list; call with the lock held */
+static void unlinkchunk (Chunk **pc) {
+  Chunk *c = *pc;
+  *pc = c->next;
+  nchunks--;
+  if (c->refs > 0)
+    c->stale = 1;
+  else
+    freechunk(c);
+}
+
+
+typedef struct DumpB {
+  char *b;
+  size_t n, size;
+} DumpB;
+
+
+static int writeD (lua_State *L, const void *p, size_t sz, void *ud) {
+  DumpB *d = (DumpB *)ud;
+  (void)L;
+  if (d->n + sz > d->size) {
+    size_t nsize = (d->size == 0) ? LUAL_BUFFERSIZE : 2 * d->size;
+    char *nb;
+    while (nsize < d->n + sz) nsize *= 2;
+    nb = (char *)realloc(d->b, nsize);
+    if (nb == NULL) return 1;
+    d->b = nb;
+    d->size = nsize;
+  }
+  memcpy(d->b + d->n, p, sz);
+  d->n += sz;
+  return 0;
+}
+
+
+/* adds the function on the top (just compiled from `path') */
+static void storechunk (lua_State *L, const char *path, const ChunkKey *k) {
+  DumpB d;
+  Chunk *c;
+  Chunk **pc;
+  size_t l = strlen(path);
+  d.b = NULL;
+  d.n = d.size = 0;
+  if (lua_dump(L, writeD, &d) != 0 ||
+      (c = (Chunk *)malloc(sizeof(Chunk) + l)) == NULL) {
+    free(d.b);
+    return;  /* the cache is only an optimization */
+  }
+  memcpy(c->path, path, l + 1);
+  c->key = *k;
+  c->image = d.b;
+  c->size = d.n;
+  c->refs = 0;
+  c->stale = 0;
+  lockchunks();
+  for (pc = &chunks; *pc != NULL; pc = &(*pc)->next) {
+    if (strcmp((*pc)->path, path) == 0 &&
+        (*pc)->key.optimize == k->optimize) {  /* older version? */
+      unlinkchunk(pc);
+      break;
+    }
+  }
+  c->next = chunks;
+  chunks = c;
+  nchunks++;
+  if (nchunks > LUAL_CHUNKCACHE) {  /* drop the least recent one */
+    for (pc = &chunks; (*pc)->next != NULL; pc = &(*pc)->next) ;
+    unlinkchunk(pc);
+  }
+  unlockchunks();
+}
+
+
+/* loads `path' from the cache; returns 0 if it is not there */
+static int loadchunk (lua_State *L, const char *path, const ChunkKey *k,
+                      const char *chunkname) {
+  Chunk *c;
+  Chunk **pc;
+  LoadS ls;
+  int status;
+  lockchunks();
+  for (pc = &chunks; *pc != NULL; pc = &(*pc)->next) {
+    c = *pc;
+    if (memcmp(&c->key, k, sizeof(*k)) == 0 && strcmp(c->path, path) == 0)
+      break;
+  }
+  if (*pc == NULL) {
+    unlockchunks();
+    return 0;
+  }
+  if (pc != &chunks) {  /* move it to the front */
+    *pc = c->next;
+    c->next = chunks;
+    chunks = c;
+  }
+  c->refs++;
+  unlockchunks();
+  ls.s = c->image;
+  ls.size = c->size;
+  status = lua_loadtrusted(L, getS, &ls, chunkname);
+  lockchunks();
+  if (--c->refs == 0 && c->stale)
+    freechunk(c);
+  unlockchunks();
+  if (status != 0) {  /* (a memory error) go the long way */
+    lua_pop(L, 1);
+    return 0;
+  }
+  return 1;
+}
+
+
+
+typedef struct Image {
+  struct Image *next;
+  ChunkKey key;
+  const char *p;
+  size_t size;
+  char path[1];  /* variable length */
+} Image;
+
+static Image *images = NULL;
+
+
+static const char *findimage (const char *path, const ChunkKey *k,
+                              size_t *size) {
+  Image *im;
+  for (im = images; im != NULL; im = im->next) {
+    if (memcmp(&im->key, k, sizeof(*k)) == 0 && strcmp(im->path, path) == 0) {
+      *size = im->size;
+      return im->p;
+    }
+  }
+  return NULL;
+}
+
+
+/* maps `path' if it is an image; NULL if not (or on any failure) */
+static const char *mapimage (const char *path, const ChunkKey *k,
+                             size_t *size) {
+  const char *p;
+  void *m;
+  Image *im;
+  size_t l = strlen(path);
+  int fd;
+  if (k->size < LUAL_IMAGEMIN)  /* no header, or too small to matter */
+    return NULL;
+  fd = open(path, O_RDONLY);
+  if (fd < 0) return NULL;
+  m = mmap(NULL, (size_t)k->size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (m == MAP_FAILED) return NULL;
+  p = (const char *)m;
+  if (memcmp(p, LUA_SIGNATURE, sizeof(LUA_SIGNATURE) - 1) != 0 ||
+      !(p[sizeof(LUA_SIGNATURE)] & LUA_IMAGEFORMAT) ||
+      (im = (Image *)malloc(sizeof(Image) + l)) == NULL) {
+    munmap(m, (size_t)k->size);
+    return NULL;
+  }
+  im->key = *k;
+  im->p = p;
+  im->size = (size_t)k->size;
+  memcpy(im->path, path, l + 1);
+  lockchunks();
+  if ((p = findimage(path, k, size)) != NULL) {  /* another thread won? */
+    munmap(m, im->size);
+    free(im);
+  }
+  else {
+    im->next = images;
+    images = im;
+    p = im->p;
+    *size = im->size;
+  }
+  unlockchunks();
+  return p;
+}
+
+
+/* loads `path' in place if it is an image; returns 0 if it is not */
+static int loadimage (lua_State *L, const char *path, const ChunkKey *k,
+                      const char *chunkname, int *status) {
+  size_t size;
+  const char *p;
+  lockchunks();
+  p = findimage(path, k, &size);
+  unlockchunks();
+  if (p == NULL && (p = mapimage(path, k, &size)) == NULL)
+    return 0;
+  *status = lua_loadimage(L, p, size, chunkname);
+  return 1;
+}
+
+#endif
+
+/* }====================================================== */
+
+
 LUALIB_API int luaL_loadfile (lua_State *L, const char *filename) {
   LoadF lf;
   int status, readstatus;
   int c;
   int fnameindex = lua_gettop(L) + 1;  /* index of filename on the stack */
+#if defined(LUA_CHUNKCACHE)
+  ChunkKey key;
+  int cached = 0;
+#endif
   lf.extraline = 0;
   if (filename == NULL) {
     lua_pushliteral(L, "=stdin");
@@ -605,6 +970,18 @@ LUALIB_API int luaL_loadfile (lua_State *L, const char *filename) {
   }
   else {
     lua_pushfstring(L, "@%s", filename);
+#if defined(LUA_CHUNKCACHE)
+    cached = chunkkey(filename, &key);
+    if (cached && loadimage(L, filename, &key, lua_tostring(L, -1), &status)) {
+      lua_remove(L, fnameindex);
+      return status;
+    }
+    key.optimize = lua_optimize(L, -1);  /* the code depends on it */
+    if (cached && loadchunk(L, filename, &key, lua_tostring(L, -1))) {
+      lua_remove(L, fnameindex);
+      return 0;
+    }
+#endif
     lf.f = fopen(filename, "r");
     if (lf.f == NULL) return errfile(L, "open", fnameindex);
   }
@@ -629,27 +1006,15 @@ LUALIB_API int luaL_loadfile (lua_State *L, const char *filename) {
     lua_settop(L, fnameindex);  /* ignore results from `lua_load' */
     return errfile(L, "read", fnameindex);
   }
+#if defined(LUA_CHUNKCACHE)
+  if (status == 0 && cached)
+    storechunk(L, filename, &key);
+#endif
   lua_remove(L, fnameindex);
   return status;
 }
 
 
-typedef struct LoadS {
-  const char *s;
-  size_t size;
-} LoadS;
-
-
-static const char *getS (lua_State *L, void *ud, size_t *size) {
-  LoadS *ls = (LoadS *)ud;
-  (void)L;
-  if (ls->size == 0) return NULL;
-  *size = ls->size;
-  ls->size = 0;
-  return ls->s;
-}
-
-
 LUALIB_API int luaL_loadbuffer (lua_State *L, const char *buff, size_t size,
                                 const char *name) {
   LoadS ls;
@@ -664,6 +1029,15 @@ LUALIB_API int (luaL_loadstring) (lua_State *L, const char *s) {
 }
 
 
+LUALIB_API int luaL_loaddata (lua_State *L, const char *buff, size_t size,
+                              const char *name) {
+  LoadS ls;
+  ls.s = buff;
+  ls.size = size;
+  return lua_loaddata(L, getS, &ls, name);
+}
+
+
 
 /* }====================================================== */
 
@@ -694,3 +1068,187 @@ LUALIB_API lua_State *luaL_newstate (void) {
   return L;
 }
 
+
+/* a copy of `L', in memory of its own */
+LUALIB_API lua_State *luaL_clonestate (lua_State *L) {
+  return lua_clonestate(L, l_alloc, NULL);
+}
+
+
+/* a state that uses the strings and functions frozen in `h' */
+LUALIB_API lua_State *luaL_newsharedstate (lua_Heap *h) {
+  lua_State *L = lua_newsharedstate(h, l_alloc, NULL);
+  if (L) lua_atpanic(L, &panic);
+  return L;
+}
+
+
+/*
+** {======================================================
+** Pool allocator: small blocks are served from per-class free lists
+** carved out of slabs; Lua always passes the old size of a block, so
+** the class of a block being freed is known in O(1). It is not
+** thread safe: do not use it with LUA_GCBGSWEEP
+** =======================================================
+*/
+
+#define POOLSTEP	8
+#define NPOOLCLASS	(LUAL_POOLMAX / POOLSTEP)
+
+/* class of a block of `s' (> 0) bytes */
+#define sizeclass(s)	(((s) + POOLSTEP - 1) / POOLSTEP - 1)
+
+
+typedef struct PoolBlock {
+  struct PoolBlock *next;
+} PoolBlock;
+
+
+typedef union PoolSlab {
+  union PoolSlab *next;
+  double u; void *s; long l;  /* ensures maximum alignment for blocks */
+} PoolSlab;
+
+
+typedef struct Pool {
+  size_t nblocks;  /* live blocks (pooled or not) */
+  PoolSlab *slabs;  /* list of all slabs */
+  PoolBlock *freelist[NPOOLCLASS];
+  luaL_PoolStats stats[NPOOLCLASS];
+} Pool;
+
+
+static int newslab (Pool *p, int c) {
+  size_t bsize = p->stats[c].size;
+  size_t n = LUAL_POOLSLAB / bsize;
+  char *b;
+  PoolSlab *slab = (PoolSlab *)malloc(sizeof(PoolSlab) + n * bsize);
+  if (slab == NULL) return 0;
+  slab->next = p->slabs;
+  p->slabs = slab;
+  b = (char *)(slab + 1);
+  while (n--) {  /* chain its blocks into the free list */
+    PoolBlock *blk = (PoolBlock *)(b + n * bsize);
+    blk->next = p->freelist[c];
+    p->freelist[c] = blk;
+    p->stats[c].nfree++;
+  }
+  p->stats[c].nslab++;
+  return 1;
+}
+
+
+static void *poolget (Pool *p, size_t size) {
+  int c;
+  PoolBlock *blk;
+  if (size > LUAL_POOLMAX)
+    return malloc(size);
+  c = sizeclass(size);
+  if (p->freelist[c] == NULL && !newslab(p, c))
+    return NULL;
+  blk = p->freelist[c];
+  p->freelist[c] = blk->next;
+  p->stats[c].nfree--;
+  p->stats[c].inuse++;
+  p->stats[c].nalloc++;
+  return blk;
+}
+
+
+static void poolput (Pool *p, void *ptr, size_t size) {
+  int c;
+  PoolBlock *blk = (PoolBlock *)ptr;
+  if (size > LUAL_POOLMAX) {
+    free(ptr);
+    return;
+  }
+  c = sizeclass(size);
+  blk->next = p->freelist[c];
+  p->freelist[c] = blk;
+  p->stats[c].nfree++;
+  p->stats[c].inuse--;
+}
+
+
+/* the pool goes away together with its last block (the state itself) */
+static void pooldestroy (Pool *p) {
+  while (p->slabs) {
+    PoolSlab *next = p->slabs->next;
+    free(p->slabs);
+    p->slabs = next;
+  }
+  free(p);
+}
+
+
+static void *pool_alloc (void *ud, void *ptr, size_t osize, size_t nsize) {
+  Pool *p = (Pool *)ud;
+  void *nptr;
+  if (nsize == 0) {
+    if (ptr != NULL) {
+      poolput(p, ptr, osize);
+      if (--p->nblocks == 0)
+        pooldestroy(p);
+    }
+    return NULL;
+  }
+  if (ptr != NULL) {
+    if (osize > LUAL_POOLMAX && nsize > LUAL_POOLMAX)
+      return realloc(ptr, nsize);
+    if (osize <= LUAL_POOLMAX && nsize <= LUAL_POOLMAX &&
+        sizeclass(osize) == sizeclass(nsize))
+      return ptr;  /* block is already large enough */
+  }
+  nptr = poolget(p, nsize);
+  if (nptr == NULL) {
+    if (p->nblocks == 0)  /* could not even allocate the state? */
+      pooldestroy(p);
+    return NULL;  /* old block (if any) is left untouched */
+  }
+  if (ptr != NULL) {  /* move block to another class */
+    memcpy(nptr, ptr, (osize < nsize) ? osize : nsize);
+    poolput(p, ptr, osize);
+  }
+  else
+    p->nblocks++;
+  return nptr;
+}
+
+
+LUALIB_API lua_State *luaL_newpoolstate (void) {
+  int i;
+  lua_State *L;
+  Pool *p = (Pool *)malloc(sizeof(Pool));
+  if (p == NULL) return NULL;
+  p->nblocks = 0;
+  p->slabs = NULL;
+  for (i = 0; i < NPOOLCLASS; i++) {
+    p->freelist[i] = NULL;
+    memset(&p->stats[i], 0, sizeof(luaL_PoolStats));
+    p->stats[i].size = (i + 1) * POOLSTEP;
+  }
+  L = lua_newstate(pool_alloc, p);  /* on failure the pool is already gone */
+  if (L) lua_atpanic(L, &panic);
+  return L;
+}
+
+
+/*
+** copies the statistics of (at most) `n' size classes into `st' and
+** returns the number of classes, or 0 if `L' does not use the pool
+** allocator
+*/
+LUALIB_API int luaL_poolstats (lua_State *L, luaL_PoolStats *st, int n) {
+  void *ud;
+  Pool *p;
+  int i;
+  if (lua_getallocf(L, &ud) != pool_alloc)
+    return 0;
+  p = (Pool *)ud;
+  for (i = 0; i < n && i < NPOOLCLASS; i++)
+    st[i] = p->stats[i];
+  return NPOOLCLASS;
+}
+
+/* }====================================================== */
+
@@ -78,8 +78,13 @@ LUALIB_API int (luaL_loadfile) (lua_State *L, const char *filename);
 LUALIB_API int (luaL_loadbuffer) (lua_State *L, const char *buff, size_t sz,
                                   const char *name);
 LUALIB_API int (luaL_loadstring) (lua_State *L, const char *s);
+LUALIB_API int (luaL_loaddata) (lua_State *L, const char *buff, size_t sz,
+                                const char *name);
 
 LUALIB_API lua_State *(luaL_newstate) (void);
+LUALIB_API lua_State *(luaL_newsharedstate) (lua_Heap *h);
+LUALIB_API lua_State *(luaL_clonestate) (lua_State *L);
+LUALIB_API lua_State *(luaL_newpoolstate) (void);
 
 
 LUALIB_API const char *(luaL_gsub) (lua_State *L, const char *s, const char *p,
@@ -155,6 +160,45 @@ LUALIB_API void (luaL_pushresult) (luaL_Buffer *B);
 /* }====================================================== */
 
 
+/*
+** {======================================================
+** String slices (see lstrlib.c)
+** =======================================================
+*/
+
+#define LUAL_SLICE	"STRSLICE"
+
+typedef struct luaL_Slice {
+  const char *s;  /* points into the anchored value */
+  size_t l;
+} luaL_Slice;
+
+LUALIB_API luaL_Slice *(luaL_toslice) (lua_State *L, int idx);
+LUALIB_API void (luaL_pushslice) (lua_State *L, int anchor, const char *s,
+                                  size_t l);
+
+/* }====================================================== */
+
+
+/*
+** {======================================================
+** Pool allocator statistics (see `luaL_newpoolstate')
+** =======================================================
+*/
+
+typedef struct luaL_PoolStats {
+  size_t size;  /* block size of this class */
+  size_t inuse;  /* blocks currently handed out */
+  size_t nfree;  /* blocks waiting in the free list */
+  size_t nalloc;  /* total number of allocations served */
+  size_t nslab;  /* slabs allocated for this class */
+} luaL_PoolStats;
+
+LUALIB_API int (luaL_poolstats) (lua_State *L, luaL_PoolStats *st, int n);
+
+/* }====================================================== */
+
+
 /* compatibility with ref system */
 
 /* pre-defined references */
@@ -191,24 +191,160 @@ static int luaB_gcinfo (lua_State *L) {
 }
 
 
+/* collectgarbage("stats"): a table with the fields of lua_GCStats */
+static int gcstats (lua_State *L) {
+  static const char *const phases[LUA_GCPHASES] = {"propagate", "atomic",
+    "sweepstring", "sweep", "finalize"};
+  lua_GCStats st;
+  int i;
+  lua_gcstats(L, &st);
+  lua_createtable(L, 0, 13);
+  for (i = 0; i < LUA_GCPHASES; i++) {
+    lua_pushnumber(L, st.phasetime[i]);
+    lua_setfield(L, -2, phases[i]);
+  }
+  lua_pushnumber(L, st.maxpause);
+  lua_setfield(L, -2, "maxpause");
+  lua_pushnumber(L, (lua_Number)st.steps);
+  lua_setfield(L, -2, "steps");
+  lua_pushnumber(L, (lua_Number)st.cycles);
+  lua_setfield(L, -2, "cycles");
+  lua_pushnumber(L, (lua_Number)st.allocated);
+  lua_setfield(L, -2, "allocated");
+  lua_pushnumber(L, (lua_Number)st.freed);
+  lua_setfield(L, -2, "freed");
+  lua_pushnumber(L, (lua_Number)st.cyclealloc);
+  lua_setfield(L, -2, "cyclealloc");
+  lua_pushnumber(L, (lua_Number)st.cyclefreed);
+  lua_setfield(L, -2, "cyclefreed");
+  lua_createtable(L, LUA_GCHISTSIZE, 0);  /* hist[i]: steps under 2^(i-1) us */
+  for (i = 0; i < LUA_GCHISTSIZE; i++) {
+    lua_pushnumber(L, (lua_Number)st.hist[i]);
+    lua_rawseti(L, -2, i + 1);
+  }
+  lua_setfield(L, -2, "hist");
+  return 1;
+}
+
+
+/* push the name of frame `level' of heap site `i' (-1: the type) */
+static void pushheapframe (lua_State *L, const lua_HeapSite *hs, int i,
+                           int level) {
+  lua_Debug ar;
+  if (level < 0)
+    lua_pushfstring(L, "<%s>", hs->type == LUA_TNONE ? "block" :
+                               lua_typename(L, hs->type));
+  else if (lua_heapframe(L, i, level, &ar) && ar.currentline >= 0)
+    lua_pushfstring(L, "%s:%d", ar.short_src, ar.currentline);
+  else
+    lua_pushliteral(L, "[C]");
+}
+
+
+/*
+** collectgarbage("heapprofile"): the sampled blocks by site, as a
+** symbolized pprof heap profile.  Frames get made-up addresses, listed
+** in the symbol section; the leaf frame is the type of the objects.
+** pprof takes one from the addresses of callers, hence the +1 on them.
+*/
+static int heapprofile (lua_State *L) {
+  lua_HeapSite *hs, dummy;
+  luaL_Buffer b;
+  lua_Number tot[4] = {0, 0, 0, 0};
+  int n, i, level, nsym = 0;
+  char addr[32];
+  lua_settop(L, 0);
+  for (n = 0; lua_heapsite(L, n, &dummy); n++) ;
+  hs = (lua_HeapSite *)lua_newuserdata(L, n * sizeof(lua_HeapSite));  /* 1 */
+  lua_newtable(L);  /* 2: address of each frame name */
+  lua_newtable(L);  /* 3: frame names by address */
+  for (i = 0; i < n; i++) {
+    if (!lua_heapsite(L, i, &hs[i])) {  /* sites are never removed */
+      n = i; break;
+    }
+    tot[0] += (lua_Number)hs[i].inuse;
+    tot[1] += (lua_Number)hs[i].inusebytes;
+    tot[2] += (lua_Number)hs[i].allocs;
+    tot[3] += (lua_Number)hs[i].allocbytes;
+    for (level = -1; level < hs[i].depth; level++) {
+      pushheapframe(L, &hs[i], i, level);
+      lua_pushvalue(L, -1);
+      lua_rawget(L, 2);
+      if (lua_isnil(L, -1)) {
+        lua_pushvalue(L, -2);
+        lua_pushinteger(L, ++nsym);
+        lua_rawset(L, 2);
+        lua_pushvalue(L, -2);
+        lua_rawseti(L, 3, nsym);
+      }
+      lua_pop(L, 2);
+    }
+  }
+  luaL_buffinit(L, &b);
+  luaL_addstring(&b, "--- symbol\nbinary=lua\n");
+  for (i = 1; i <= nsym; i++) {
+    sprintf(addr, "0x%08x ", i * 16);
+    luaL_addstring(&b, addr);
+    lua_rawgeti(L, 3, i);
+    luaL_addvalue(&b);
+    luaL_addchar(&b, '\n');
+  }
+  luaL_addstring(&b, "---\n--- profile\n");
+  lua_pushfstring(L, "heap profile: %f: %f [%f: %f] @ heap_v2/%d\n",
+                  tot[0], tot[1], tot[2], tot[3],
+                  lua_gc(L, LUA_GCHEAPSAMPLE, -1));
+  luaL_addvalue(&b);
+  for (i = 0; i < n; i++) {
+    lua_pushfstring(L, "%f: %f [%f: %f] @",
+                    (lua_Number)hs[i].inuse, (lua_Number)hs[i].inusebytes,
+                    (lua_Number)hs[i].allocs, (lua_Number)hs[i].allocbytes);
+    luaL_addvalue(&b);
+    for (level = -1; level < hs[i].depth; level++) {
+      int a;
+      pushheapframe(L, &hs[i], i, level);
+      lua_rawget(L, 2);
+      a = (int)lua_tointeger(L, -1) * 16 + (level >= 0);
+      lua_pop(L, 1);
+      sprintf(addr, " 0x%08x", a);
+      luaL_addstring(&b, addr);
+    }
+    luaL_addchar(&b, '\n');
+  }
+  luaL_pushresult(&b);
+  return 1;
+}
+
+
 static int luaB_collectgarbage (lua_State *L) {
   static const char *const opts[] = {"stop", "restart", "collect",
-    "count", "step", "setpause", "setstepmul", NULL};
+    "count", "step", "setpause", "setstepmul", "generational", "incremental",
+    "markthreads", "setbudget", "setgrowth", "idle",
+    "stats", "heapsample", "heapprofile", NULL};
   static const int optsnum[] = {LUA_GCSTOP, LUA_GCRESTART, LUA_GCCOLLECT,
-    LUA_GCCOUNT, LUA_GCSTEP, LUA_GCSETPAUSE, LUA_GCSETSTEPMUL};
+    LUA_GCCOUNT, LUA_GCSTEP, LUA_GCSETPAUSE, LUA_GCSETSTEPMUL, LUA_GCGEN,
+    LUA_GCINC, LUA_GCMARKTHREADS,
+    LUA_GCSETBUDGET, LUA_GCSETGROWTH, LUA_GCIDLE, -1,
+    LUA_GCHEAPSAMPLE, -2};
   int o = luaL_checkoption(L, 1, "collect", opts);
   int ex = luaL_optint(L, 2, 0);
-  int res = lua_gc(L, optsnum[o], ex);
+  int res;
+  if (optsnum[o] == -1) return gcstats(L);
+  if (optsnum[o] == -2) return heapprofile(L);
+  res = lua_gc(L, optsnum[o], ex);
   switch (optsnum[o]) {
     case LUA_GCCOUNT: {
       int b = lua_gc(L, LUA_GCCOUNTB, 0);
       lua_pushnumber(L, res + ((lua_Number)b/1024));
       return 1;
     }
-    case LUA_GCSTEP: {
+    case LUA_GCSTEP: case LUA_GCIDLE: {
       lua_pushboolean(L, res);
       return 1;
     }
+    case LUA_GCGEN: case LUA_GCINC: {
+      lua_pushstring(L, (res == LUA_GCGEN) ? "generational" : "incremental");
+      return 1;
+    }
     default: {
       lua_pushnumber(L, res);
       return 1;
@@ -283,6 +419,15 @@ static int luaB_loadstring (lua_State *L) {
 }
 
 
+/* loaddata(s [, chunkname]): the value of a data chunk, or nil and a message */
+static int luaB_loaddata (lua_State *L) {
+  size_t l;
+  const char *s = luaL_checklstring(L, 1, &l);
+  const char *chunkname = luaL_optstring(L, 2, s);
+  return load_aux(L, luaL_loaddata(L, s, l, chunkname));
+}
+
+
 static int luaB_loadfile (lua_State *L) {
   const char *fname = luaL_optstring(L, 1, NULL);
   return load_aux(L, luaL_loadfile(L, fname));
@@ -453,6 +598,7 @@ static const luaL_Reg base_funcs[] = {
   {"gcinfo", luaB_gcinfo},
   {"getfenv", luaB_getfenv},
   {"getmetatable", luaB_getmetatable},
+  {"loaddata", luaB_loaddata},
   {"loadfile", luaB_loadfile},
   {"load", luaB_load},
   {"loadstring", luaB_loadstring},
@@ -627,8 +773,9 @@ static const luaL_Reg co_funcs[] = {
 
 
 static void auxopen (lua_State *L, const char *name,
-                     lua_CFunction f, lua_CFunction u) {
+                     lua_CFunction f, lua_CFunction u, int iter) {
   lua_pushcfunction(L, u);
+  lua_setiter(L, -1, iter);  /* the VM runs it in generic `for's */
   lua_pushcclosure(L, f, 1);	// 1个upvalues就是上面的u
   lua_setfield(L, -2, name);
 }
@@ -645,10 +792,16 @@ static void base_open (lua_State *L) {
   
   lua_pushliteral(L, LUA_VERSION);
   lua_setglobal(L, "_VERSION");  /* set global _VERSION */
+  lua_getfield(L, -1, "next");
+  lua_setiter(L, -1, LUA_ITERNEXT);  /* `for k, v in next, t' */
+  lua_pop(L, 1);
+  lua_getfield(L, -1, "pcall");
+  lua_setpcall(L, -1);  /* `pcall(f, ...)' from Lua, with a Lua `f' */
+  lua_pop(L, 1);
   
   /* `ipairs' and `pairs' need auxiliary functions as upvalues */
-  auxopen(L, "ipairs", luaB_ipairs, ipairsaux);	/* G[ipairs] = CLoure(luaB_ipairs).upvalues(ipairsaux), G_G还留在了栈顶 */
-  auxopen(L, "pairs", luaB_pairs, luaB_next);
+  auxopen(L, "ipairs", luaB_ipairs, ipairsaux, LUA_ITERIPAIRS);	/* G[ipairs] = CLoure(luaB_ipairs).upvalues(ipairsaux), G_G还留在了栈顶 */
+  auxopen(L, "pairs", luaB_pairs, luaB_next, LUA_ITERNEXT);
   /* `newproxy' needs a weaktable as upvalue */
   lua_createtable(L, 0, 1);  /* new table `w' */
   lua_pushvalue(L, -1);  /* `w' will be its own metatable */
@@ -0,0 +1,119 @@
+/*
+** $Id: lbitlib.c $
+** Bit operations on 32 bits
+** See Copyright Notice in lua.h
+*/
+
+
+#define lbitlib_c
+#define LUA_LIB
+
+#include "lua.h"
+
+#include "lauxlib.h"
+#include "lualib.h"
+
+
+/*
+** Numbers are taken modulo 2^32 (fractions dropped) and results are
+** signed: bit.tobit(0xffffffff) == -1. Each function but `tohex' is
+** tagged with its operation (lua_setbitop), so that the VM runs it
+** without a call when the arguments are numbers; the functions
+** themselves only run for other arguments, to convert them or to raise
+** the error.
+*/
+
+
+static int bitop (lua_State *L, int op, int n) {
+  int i;
+  for (i = 1; i <= n; i++) {
+    if (lua_type(L, i) != LUA_TNUMBER) {
+      lua_pushnumber(L, luaL_checknumber(L, i));
+      lua_replace(L, i);
+    }
+  }
+  lua_settop(L, n);
+  lua_bitop(L, op, n);
+  return 1;
+}
+
+
+static int nargs (lua_State *L) {
+  int n = lua_gettop(L);
+  return n > 0 ? n : 1;  /* 1 to complain about a missing argument */
+}
+
+
+static int bit_tobit (lua_State *L) { return bitop(L, LUA_OPTOBIT, 1); }
+static int bit_bnot (lua_State *L) { return bitop(L, LUA_OPBNOT, 1); }
+static int bit_bswap (lua_State *L) { return bitop(L, LUA_OPBSWAP, 1); }
+static int bit_band (lua_State *L) { return bitop(L, LUA_OPBAND, nargs(L)); }
+static int bit_bor (lua_State *L) { return bitop(L, LUA_OPBOR, nargs(L)); }
+static int bit_bxor (lua_State *L) { return bitop(L, LUA_OPBXOR, nargs(L)); }
+static int bit_lshift (lua_State *L) { return bitop(L, LUA_OPLSHIFT, 2); }
+static int bit_rshift (lua_State *L) { return bitop(L, LUA_OPRSHIFT, 2); }
+static int bit_arshift (lua_State *L) { return bitop(L, LUA_OPARSHIFT, 2); }
+static int bit_rol (lua_State *L) { return bitop(L, LUA_OPROL, 2); }
+static int bit_ror (lua_State *L) { return bitop(L, LUA_OPROR, 2); }
+
+
+/* tohex(x [, n]): the low `n' hex digits of x (8); upper case if n < 0 */
+static int bit_tohex (lua_State *L) {
+  const char *digits = "0123456789abcdef";
+  char buf[8];
+  unsigned int x;
+  int i, n = luaL_optint(L, 2, 8);
+  lua_settop(L, 1);
+  bitop(L, LUA_OPTOBIT, 1);
+  x = (unsigned int)lua_tointeger(L, -1);
+  if (n < 0) {
+    n = -n;
+    digits = "0123456789ABCDEF";
+  }
+  if (n > 8) n = 8;
+  for (i = n - 1; i >= 0; i--) {
+    buf[i] = digits[x & 15];
+    x >>= 4;
+  }
+  lua_pushlstring(L, buf, n);
+  return 1;
+}
+
+
+static const luaL_Reg bitlib[] = {
+  {"arshift", bit_arshift},
+  {"band",    bit_band},
+  {"bnot",    bit_bnot},
+  {"bor",     bit_bor},
+  {"bswap",   bit_bswap},
+  {"bxor",    bit_bxor},
+  {"lshift",  bit_lshift},
+  {"rol",     bit_rol},
+  {"ror",     bit_ror},
+  {"rshift",  bit_rshift},
+  {"tobit",   bit_tobit},
+  {"tohex",   bit_tohex},
+  {NULL, NULL}
+};
+
+
+/* names of the operations, by number */
+static const char *const opnames[] = {
+  NULL, "tobit", "bnot", "bswap", "band", "bor", "bxor",
+  "lshift", "rshift", "arshift", "rol", "ror"
+};
+
+
+/*
+** Open bit library
+*/
+LUALIB_API int luaopen_bit (lua_State *L) {
+  int op;
+  luaL_register(L, LUA_BITLIBNAME, bitlib);
+  for (op = LUA_OPTOBIT; op <= LUA_OPROR; op++) {
+    lua_getfield(L, -1, opnames[op]);
+    lua_setbitop(L, -1, op);
+    lua_pop(L, 1);
+  }
+  return 1;
+}
@@ -0,0 +1,866 @@
+/*
+** $Id: lchanlib.c $
+** Channels: message queues between independent states
+** See Copyright Notice in lua.h
+*/
+
+
+#include <stdlib.h>
+#include <string.h>
+
+#define lchanlib_c
+#define LUA_LIB
+
+#include "lua.h"
+
+#if defined(LUA_USE_PTHREADS)
+#include <pthread.h>
+#endif
+
+#include "lauxlib.h"
+#include "lualib.h"
+
+
+/*
+** A channel is a bounded multi-producer multi-consumer ring of messages
+** that lives outside of every state, so that states running on other
+** threads can share it. Each cell has a sequence number that tells who
+** may use it next: a sender when it equals the sender's ticket, a
+** receiver when it equals that ticket plus one. Tickets come from two
+** counters taken with compare-and-swap, so no lock is held while
+** sending or receiving; a batch takes several tickets with one swap.
+**
+** A message is a copy of a Lua value. Numbers, booleans and short
+** strings fit in the cell; anything else is encoded in a block that the
+** receiver decodes into its own heap (strings must be interned there,
+** so they are copied once into the block and once out of it).
+*/
+
+
+/* longest string kept in a cell */
+#define CHAN_INLINE	16
+
+/* deepest table nesting a message may have */
+#define CHAN_MAXDEPTH	200
+
+/* messages moved by one swap of a counter */
+#define CHAN_BATCH	64
+
+#define CHAN_DEFSIZE	1024
+
+
+#if defined(__GNUC__)
+#define loadacq(p)	__atomic_load_n(p, __ATOMIC_ACQUIRE)
+#define loadrlx(p)	__atomic_load_n(p, __ATOMIC_RELAXED)
+#define storerel(p,v)	__atomic_store_n(p, v, __ATOMIC_RELEASE)
+#define cas(p,o,n)	__atomic_compare_exchange_n(p, &(o), n, 1, \
+			  __ATOMIC_RELAXED, __ATOMIC_RELAXED)
+#else  /* no atomics: channels of a single thread */
+#define loadacq(p)	(*(p))
+#define loadrlx(p)	(*(p))
+#define storerel(p,v)	(*(p) = (v))
+#define cas(p,o,n)	(*(p) == (o) ? (*(p) = (n), 1) : ((o) = *(p), 0))
+#endif
+
+
+/* kinds of messages */
+enum { M_NONE, M_FALSE, M_TRUE, M_NUMBER, M_LIGHT, M_STRING, M_BLOCK };
+
+typedef struct Message {
+  unsigned char kind;
+  unsigned char len;  /* of an M_STRING */
+  union {
+    lua_Number n;
+    void *p;  /* M_LIGHT; M_BLOCK: the encoded value */
+    char s[CHAN_INLINE];
+  } u;
+} Message;
+
+typedef struct Cell {
+  size_t seq;
+  Message m;
+} Cell;
+
+
+typedef struct Channel {
+  size_t head;  /* next ticket of a sender */
+  char pad1[64 - sizeof(size_t)];  /* keep the counters on their own lines */
+  size_t tail;  /* next ticket of a receiver */
+  char pad2[64 - sizeof(size_t)];
+  size_t mask;  /* capacity - 1 */
+  int nref;  /* handles and messages that refer to it (under `chanlock') */
+  struct Channel *next;  /* in the list of named channels */
+  char *name;  /* or NULL */
+  Cell cell[1];
+} Channel;
+
+
+#if defined(LUA_USE_PTHREADS)
+static pthread_mutex_t chanlock = PTHREAD_MUTEX_INITIALIZER;
+#define lockchans()	pthread_mutex_lock(&chanlock)
+#define unlockchans()	pthread_mutex_unlock(&chanlock)
+#else
+#define lockchans()	((void)0)
+#define unlockchans()	((void)0)
+#endif
+
+static Channel *named = NULL;  /* channels with names (under `chanlock') */
+
+
+static void releasechannel (Channel *c);
+
+
+
+/*
+** {======================================================
+** Encoding of values
+** =======================================================
+*/
+
+/* tags in a block */
+enum { B_FALSE, B_TRUE, B_NUMBER, B_LIGHT, B_STRING, B_TABLE, B_REF,
+       B_CHANNEL, B_END };
+
+
+/*
+** per-state scratch space (an upvalue of the methods): the block
+** being encoded and the messages between a channel and the state. A
+** call that fails leaves them to the next call (or to __gc) to free.
+*/
+typedef struct Scratch {
+  char *b;  /* block being encoded; starts with its length */
+  size_t n, size;
+  int busy;  /* is `b' an unfinished block? */
+  Message *m;
+  int first, last;  /* messages not yet handed over */
+  int size_m;
+  int nseen;  /* tables in SEEN */
+} Scratch;
+
+
+#define getscratch(L)	((Scratch *)lua_touserdata(L, lua_upvalueindex(1)))
+
+/*
+** tables met by the value being encoded or decoded: SEEN[i] is the i-th,
+** and when encoding SEEN[t] is the order of t. It is kept between calls
+** so that a message needs no new table.
+*/
+#define SEEN	lua_upvalueindex(2)
+
+
+/*
+** releases the channels held by a block of `n' bytes (which may be a
+** block left unfinished by an error)
+*/
+static void dropblock (const char *b, size_t n) {
+  const char *p = b + sizeof(size_t);
+  while (p < b + n) {
+    switch (*p++) {
+      case B_NUMBER: p += sizeof(lua_Number); break;
+      case B_LIGHT: p += sizeof(void *); break;
+      case B_STRING: {
+        size_t l;
+        if (p + sizeof(l) > b + n) return;
+        memcpy(&l, p, sizeof(l));
+        p += sizeof(l) + l;
+        break;
+      }
+      case B_REF: p += sizeof(int); break;
+      case B_CHANNEL: {
+        Channel *c;
+        memcpy(&c, p, sizeof(c));
+        p += sizeof(c);
+        releasechannel(c);
+        break;
+      }
+      default: break;  /* no payload */
+    }
+  }
+}
+
+
+static void freemessage (Message *m) {
+  if (m->kind == M_BLOCK) {
+    size_t n;
+    memcpy(&n, m->u.p, sizeof(n));
+    dropblock((char *)m->u.p, n);
+    free(m->u.p);
+  }
+  m->kind = M_NONE;
+}
+
+
+/* empties SEEN, leaving its parts allocated */
+static void clearseen (lua_State *L, Scratch *s) {
+  int i;
+  for (i = 1; i <= s->nseen; i++) {
+    lua_rawgeti(L, SEEN, i);
+    lua_pushvalue(L, -1);
+    lua_rawget(L, SEEN);
+    if (!lua_isnil(L, -1)) {
+      lua_pop(L, 1);
+      lua_pushnil(L);
+      lua_rawset(L, SEEN);
+    }
+    else
+      lua_pop(L, 2);
+    lua_pushnil(L);
+    lua_rawseti(L, SEEN, i);
+  }
+  s->nseen = 0;
+}
+
+
+/* frees what a failed call left */
+static void cleanup (lua_State *L, Scratch *s) {
+  if (s->nseen > 0)
+    clearseen(L, s);
+  if (s->busy) {
+    dropblock(s->b, s->n);
+    s->busy = 0;
+  }
+  for (; s->first < s->last; s->first++)
+    freemessage(&s->m[s->first]);
+  s->first = s->last = 0;
+}
+
+
+static void addbytes (lua_State *L, Scratch *s, const void *p, size_t l) {
+  if (s->size - s->n < l) {
+    size_t size = (s->size > 0) ? s->size : 256;
+    char *nb;
+    while (size - s->n < l)
+      size *= 2;
+    nb = (char *)realloc(s->b, size);
+    if (nb == NULL)
+      luaL_error(L, "not enough memory");
+    s->b = nb;
+    s->size = size;
+  }
+  memcpy(s->b + s->n, p, l);
+  s->n += l;
+}
+
+
+#define addtag(L,s,t)	{ char c_ = (char)(t); addbytes(L, s, &c_, 1); }
+
+
+static Channel *tohandle (lua_State *L, int idx) {
+  Channel *c = NULL;
+  if (lua_getmetatable(L, idx)) {
+    luaL_getmetatable(L, LUA_CHANHANDLE);
+    if (lua_rawequal(L, -1, -2))
+      c = *(Channel **)lua_touserdata(L, idx);
+    lua_pop(L, 2);
+  }
+  return c;
+}
+
+
+static void encode (lua_State *L, Scratch *s, int idx, int depth);
+
+/*
+** a table is encoded once; the tables met again (shared parts and
+** cycles) come out as references to their order in SEEN
+*/
+static void encodetable (lua_State *L, Scratch *s, int idx, int depth) {
+  int n;
+  lua_pushvalue(L, idx);
+  lua_rawget(L, SEEN);
+  n = (int)lua_tointeger(L, -1);
+  lua_pop(L, 1);
+  if (n > 0) {
+    addtag(L, s, B_REF);
+    addbytes(L, s, &n, sizeof(n));
+    return;
+  }
+  if (depth > CHAN_MAXDEPTH)
+    luaL_error(L, "table too deep to send");
+  n = s->nseen + 1;
+  lua_pushvalue(L, idx);
+  lua_rawseti(L, SEEN, n);
+  s->nseen = n;
+  lua_pushvalue(L, idx);
+  lua_pushinteger(L, n);
+  lua_rawset(L, SEEN);
+  addtag(L, s, B_TABLE);
+  lua_pushnil(L);
+  while (lua_next(L, idx)) {
+    int top = lua_gettop(L);
+    encode(L, s, top - 1, depth + 1);
+    encode(L, s, top, depth + 1);
+    lua_pop(L, 1);
+  }
+  addtag(L, s, B_END);
+}
+
+
+static void encode (lua_State *L, Scratch *s, int idx, int depth) {
+  luaL_checkstack(L, 4, "table too deep to send");
+  switch (lua_type(L, idx)) {
+    case LUA_TBOOLEAN: {
+      addtag(L, s, lua_toboolean(L, idx) ? B_TRUE : B_FALSE);
+      break;
+    }
+    case LUA_TNUMBER: {
+      lua_Number n = lua_tonumber(L, idx);
+      addtag(L, s, B_NUMBER);
+      addbytes(L, s, &n, sizeof(n));
+      break;
+    }
+    case LUA_TLIGHTUSERDATA: {
+      void *p = lua_touserdata(L, idx);
+      addtag(L, s, B_LIGHT);
+      addbytes(L, s, &p, sizeof(p));
+      break;
+    }
+    case LUA_TSTRING: {
+      size_t l;
+      const char *str = lua_tolstring(L, idx, &l);
+      addtag(L, s, B_STRING);
+      addbytes(L, s, &l, sizeof(l));
+      addbytes(L, s, str, l);
+      break;
+    }
+    case LUA_TTABLE: {
+      encodetable(L, s, idx, depth);
+      break;
+    }
+    case LUA_TUSERDATA: {
+      Channel *c = tohandle(L, idx);
+      luaL_Slice *sl;
+      if (c != NULL) {
+        char buff[1 + sizeof(Channel *)];
+        buff[0] = B_CHANNEL;
+        memcpy(buff + 1, &c, sizeof(c));
+        addbytes(L, s, buff, sizeof(buff));  /* all or nothing */
+        lockchans();
+        c->nref++;  /* the block holds it until it is decoded */
+        unlockchans();
+        break;
+      }
+      else if ((sl = luaL_toslice(L, idx)) != NULL) {  /* goes as a string */
+        addtag(L, s, B_STRING);
+        addbytes(L, s, &sl->l, sizeof(sl->l));
+        addbytes(L, s, sl->s, sl->l);
+        break;
+      }
+    }  /* else go through */
+    default:
+      luaL_error(L, "cannot send a %s", luaL_typename(L, idx));
+  }
+}
+
+
+/* encodes the value at `idx' into the next free message of `s' */
+static void tomessage (lua_State *L, Scratch *s, int idx) {
+  Message *m;
+  if (s->last == s->size_m) {
+    int size = (s->size_m > 0) ? 2*s->size_m : CHAN_BATCH;
+    Message *nm = (Message *)realloc(s->m, size * sizeof(Message));
+    if (nm == NULL)
+      luaL_error(L, "not enough memory");
+    s->m = nm;
+    s->size_m = size;
+  }
+  m = &s->m[s->last];
+  switch (lua_type(L, idx)) {
+    case LUA_TNIL:
+      luaL_error(L, "cannot send nil");
+      break;
+    case LUA_TBOOLEAN:
+      m->kind = lua_toboolean(L, idx) ? M_TRUE : M_FALSE;
+      break;
+    case LUA_TNUMBER:
+      m->kind = M_NUMBER;
+      m->u.n = lua_tonumber(L, idx);
+      break;
+    case LUA_TLIGHTUSERDATA:
+      m->kind = M_LIGHT;
+      m->u.p = lua_touserdata(L, idx);
+      break;
+    case LUA_TSTRING: {
+      size_t l;
+      const char *str = lua_tolstring(L, idx, &l);
+      if (l <= CHAN_INLINE) {
+        m->kind = M_STRING;
+        m->len = (unsigned char)l;
+        memcpy(m->u.s, str, l);
+        break;
+      }
+    }  /* else go through */
+    default: {
+      char *b;
+      s->n = 0;
+      addbytes(L, s, &s->n, sizeof(s->n));  /* room for the length */
+      s->busy = 1;
+      encode(L, s, idx, 0);
+      clearseen(L, s);
+      b = (char *)malloc(s->n);
+      if (b == NULL)
+        luaL_error(L, "not enough memory");
+      memcpy(s->b, &s->n, sizeof(s->n));
+      memcpy(b, s->b, s->n);
+      s->busy = 0;
+      m->kind = M_BLOCK;
+      m->u.p = b;
+      break;
+    }
+  }
+  s->last++;
+}
+
+
+static void pushhandle (lua_State *L, Channel *c);
+
+#define getbytes(p,v)	(memcpy(&(v), p, sizeof(v)), (p) += sizeof(v))
+
+/* pushes the value at `p' */
+static const char *decode (lua_State *L, Scratch *s, const char *p) {
+  luaL_checkstack(L, 4, "table too deep to receive");
+  switch (*p++) {
+    case B_FALSE: lua_pushboolean(L, 0); break;
+    case B_TRUE: lua_pushboolean(L, 1); break;
+    case B_NUMBER: {
+      lua_Number n;
+      getbytes(p, n);
+      lua_pushnumber(L, n);
+      break;
+    }
+    case B_LIGHT: {
+      void *u;
+      getbytes(p, u);
+      lua_pushlightuserdata(L, u);
+      break;
+    }
+    case B_STRING: {
+      size_t l;
+      getbytes(p, l);
+      lua_pushlstring(L, p, l);
+      p += l;
+      break;
+    }
+    case B_TABLE: {
+      lua_newtable(L);
+      lua_pushvalue(L, -1);
+      lua_rawseti(L, SEEN, ++s->nseen);
+      while (*p != B_END) {
+        p = decode(L, s, p);  /* key */
+        p = decode(L, s, p);  /* value */
+        lua_rawset(L, -3);
+      }
+      p++;
+      break;
+    }
+    case B_REF: {
+      int n;
+      getbytes(p, n);
+      lua_rawgeti(L, SEEN, n);
+      break;
+    }
+    case B_CHANNEL: {
+      Channel *c;
+      getbytes(p, c);
+      lockchans();
+      c->nref++;  /* the handle's own; the block's goes with the block */
+      unlockchans();
+      pushhandle(L, c);
+      break;
+    }
+    default: lua_assert(0);
+  }
+  return p;
+}
+
+
+/* pushes the value of a message and frees the message */
+static void pushmessage (lua_State *L, Scratch *s, Message *m) {
+  switch (m->kind) {
+    case M_FALSE: lua_pushboolean(L, 0); break;
+    case M_TRUE: lua_pushboolean(L, 1); break;
+    case M_NUMBER: lua_pushnumber(L, m->u.n); break;
+    case M_LIGHT: lua_pushlightuserdata(L, m->u.p); break;
+    case M_STRING: lua_pushlstring(L, m->u.s, m->len); break;
+    case M_BLOCK: {
+      decode(L, s, (char *)m->u.p + sizeof(size_t));
+      clearseen(L, s);
+      break;
+    }
+    default: lua_assert(0);
+  }
+  freemessage(m);
+}
+
+/* }====================================================== */
+
+
+
+/*
+** {======================================================
+** Channels
+** =======================================================
+*/
+
+static Channel *newchannel (size_t cap, const char *name) {
+  size_t size = 1, i;
+  Channel *c;
+  while (size < cap) size *= 2;
+  c = (Channel *)malloc(sizeof(Channel) + (size - 1) * sizeof(Cell));
+  if (c == NULL)
+    return NULL;
+  c->name = NULL;
+  if (name != NULL && (c->name = (char *)malloc(strlen(name) + 1)) == NULL) {
+    free(c);
+    return NULL;
+  }
+  if (name != NULL) strcpy(c->name, name);
+  for (i = 0; i < size; i++) {
+    c->cell[i].seq = i;
+    c->cell[i].m.kind = M_NONE;
+  }
+  c->head = c->tail = 0;
+  c->mask = size - 1;
+  c->nref = 1;
+  c->next = NULL;
+  return c;
+}
+
+
+static void releasechannel (Channel *c) {
+  int last;
+  lockchans();
+  last = (--c->nref == 0);
+  if (last && c->name != NULL) {  /* unlink it */
+    Channel **p = &named;
+    while (*p != c) p = &(*p)->next;
+    *p = c->next;
+  }
+  unlockchans();
+  if (last) {
+    size_t t;
+    for (t = c->tail; t != c->head; t++)  /* messages never received */
+      freemessage(&c->cell[t & c->mask].m);
+    free(c->name);
+    free(c);
+  }
+}
+
+
+/* takes the tickets of up to `n' free cells; returns how many */
+static int reserve (size_t *counter, Channel *c, int n, size_t lag,
+                    size_t *first) {
+  size_t pos = loadrlx(counter);
+  for (;;) {
+    int k = 0;
+    while (k < n && loadacq(&c->cell[(pos + k) & c->mask].seq) == pos + k + lag)
+      k++;
+    if (k == 0) {
+      size_t seq = loadacq(&c->cell[pos & c->mask].seq);
+      if ((ptrdiff_t)(seq - (pos + lag)) < 0)
+        return 0;  /* full (or empty) */
+      pos = loadrlx(counter);  /* someone else took it */
+    }
+    else if (cas(counter, pos, pos + k)) {
+      *first = pos;
+      return k;
+    }
+  }
+}
+
+
+/* sends messages first..last-1 of `s' that fit; returns how many */
+static int put (Channel *c, Scratch *s) {
+  int sent = 0;
+  while (s->first < s->last) {
+    size_t t;
+    int i, k = s->last - s->first;
+    k = reserve(&c->head, c, (k < CHAN_BATCH) ? k : CHAN_BATCH, 0, &t);
+    if (k == 0) break;
+    for (i = 0; i < k; i++) {
+      Cell *cl = &c->cell[(t + i) & c->mask];
+      cl->m = s->m[s->first++];
+      storerel(&cl->seq, t + i + 1);
+    }
+    sent += k;
+  }
+  return sent;
+}
+
+
+/* moves up to `n' messages of `c' to `s' */
+static int take (lua_State *L, Channel *c, Scratch *s, int n) {
+  int need = ((size_t)n <= c->mask) ? n : (int)(c->mask + 1);
+  lua_assert(s->first == 0 && s->last == 0);
+  if (s->size_m < need) {
+    Message *nm = (Message *)realloc(s->m, need * sizeof(Message));
+    if (nm == NULL)
+      luaL_error(L, "not enough memory");
+    s->m = nm;
+    s->size_m = need;
+  }
+  while (s->last < need) {
+    size_t t;
+    int i, k = need - s->last;
+    k = reserve(&c->tail, c, (k < CHAN_BATCH) ? k : CHAN_BATCH, 1, &t);
+    if (k == 0) break;
+    for (i = 0; i < k; i++) {
+      Cell *cl = &c->cell[(t + i) & c->mask];
+      s->m[s->last++] = cl->m;
+      storerel(&cl->seq, t + i + c->mask + 1);
+    }
+  }
+  return s->last;
+}
+
+
+static void pushhandle (lua_State *L, Channel *c) {
+  Channel **pc = (Channel **)lua_newuserdata(L, sizeof(Channel *));
+  *pc = c;
+  luaL_getmetatable(L, LUA_CHANHANDLE);
+  lua_setmetatable(L, -2);
+}
+
+
+static Channel *tochannel (lua_State *L) {
+  Channel **pc = (Channel **)luaL_checkudata(L, 1, LUA_CHANHANDLE);
+  if (*pc == NULL)
+    luaL_error(L, "attempt to use a closed channel");
+  return *pc;
+}
+
+
+static size_t checkcapacity (lua_State *L, int narg) {
+  lua_Integer n = luaL_optinteger(L, narg, CHAN_DEFSIZE);
+  luaL_argcheck(L, n >= 1 && n <= (1 << 24), narg, "capacity out of range");
+  return (size_t)n;
+}
+
+
+/* chan.new ([capacity]) */
+static int chan_new (lua_State *L) {
+  Channel *c = newchannel(checkcapacity(L, 1), NULL);
+  if (c == NULL)
+    return luaL_error(L, "not enough memory");
+  pushhandle(L, c);
+  return 1;
+}
+
+
+/* chan.open (name [, capacity]): the channel of that name in the process */
+static int chan_open (lua_State *L) {
+  const char *name = luaL_checkstring(L, 1);
+  size_t cap = checkcapacity(L, 2);
+  Channel *c;
+  lockchans();
+  for (c = named; c != NULL; c = c->next) {
+    if (strcmp(c->name, name) == 0) {
+      c->nref++;
+      break;
+    }
+  }
+  if (c == NULL && (c = newchannel(cap, name)) != NULL) {
+    c->next = named;
+    named = c;
+  }
+  unlockchans();
+  if (c == NULL)
+    return luaL_error(L, "not enough memory");
+  pushhandle(L, c);
+  return 1;
+}
+
+
+/* ch:send (v) -> true, or false if the channel is full */
+static int chan_send (lua_State *L) {
+  Channel *c = tochannel(L);
+  Scratch *s = getscratch(L);
+  luaL_checkany(L, 2);
+  cleanup(L, s);
+  tomessage(L, s, 2);
+  lua_pushboolean(L, put(c, s));
+  cleanup(L, s);  /* a message that did not fit */
+  return 1;
+}
+
+
+/* ch:send_many (t [, i [, j]]) -> number of values of t[i..j] sent */
+static int chan_sendmany (lua_State *L) {
+  Channel *c = tochannel(L);
+  Scratch *s = getscratch(L);
+  int i, j, n, k, sent;
+  size_t room;
+  luaL_checktype(L, 2, LUA_TTABLE);
+  i = luaL_optint(L, 3, 1);
+  j = luaL_opt(L, luaL_checkint, 4, (int)lua_objlen(L, 2));
+  /* j - i + 1 must fit an int (INT_MAX + i does not overflow if i <= 0) */
+  luaL_argcheck(L, i > j || i > 0 || j < INT_MAX + i, 4, "range too large");
+  n = (i <= j) ? j - i + 1 : 0;
+  cleanup(L, s);
+  room = c->mask + 1 - (loadrlx(&c->head) - loadrlx(&c->tail));
+  if ((size_t)n > room)  /* encode only what may fit */
+    n = (int)room;
+  for (k = 0; k < n; k++) {
+    lua_rawgeti(L, 2, i + k);
+    tomessage(L, s, lua_gettop(L));
+    lua_pop(L, 1);
+  }
+  sent = put(c, s);
+  cleanup(L, s);
+  lua_pushinteger(L, sent);
+  return 1;
+}
+
+
+/* ch:recv () -> the next value, or nil if there is none */
+static int chan_recv (lua_State *L) {
+  Channel *c = tochannel(L);
+  Scratch *s = getscratch(L);
+  cleanup(L, s);
+  if (take(L, c, s, 1) == 0)
+    return 0;
+  pushmessage(L, s, &s->m[s->first]);
+  s->first++;
+  return 1;
+}
+
+
+/* ch:recv_many ([n [, t]]) -> t (or a new table) with up to n values, count */
+static int chan_recvmany (lua_State *L) {
+  Channel *c = tochannel(L);
+  Scratch *s = getscratch(L);
+  int n = luaL_optint(L, 2, (int)(c->mask + 1));
+  int i, got;
+  luaL_argcheck(L, n >= 0, 2, "count must be non-negative");
+  cleanup(L, s);
+  got = take(L, c, s, n);
+  if (lua_istable(L, 3))
+    lua_settop(L, 3);
+  else {
+    lua_settop(L, 2);
+    lua_createtable(L, got, 0);
+  }
+  for (i = 1; i <= got; i++) {
+    pushmessage(L, s, &s->m[s->first]);
+    s->first++;
+    lua_rawseti(L, 3, i);
+  }
+  lua_pushinteger(L, got);
+  return 2;
+}
+
+
+/* ch:count () -> messages waiting (a snapshot) */
+static int chan_count (lua_State *L) {
+  Channel *c = tochannel(L);
+  lua_pushinteger(L, (lua_Integer)(loadrlx(&c->head) - loadrlx(&c->tail)));
+  return 1;
+}
+
+
+static int chan_capacity (lua_State *L) {
+  lua_pushinteger(L, (lua_Integer)(tochannel(L)->mask + 1));
+  return 1;
+}
+
+
+/* ch:close (): this handle lets go of the channel */
+static int chan_close (lua_State *L) {
+  Channel **pc = (Channel **)luaL_checkudata(L, 1, LUA_CHANHANDLE);
+  if (*pc != NULL) {
+    releasechannel(*pc);
+    *pc = NULL;
+  }
+  return 0;
+}
+
+
+/* __clone (see lua_clonestate): the copy is one more handle */
+static int chan_clone (lua_State *L) {
+  Channel **pc = (Channel **)luaL_checkudata(L, 1, LUA_CHANHANDLE);
+  if (*pc != NULL) {
+    lockchans();
+    (*pc)->nref++;
+    unlockchans();
+  }
+  return 0;
+}
+
+
+static int chan_tostring (lua_State *L) {
+  Channel **pc = (Channel **)luaL_checkudata(L, 1, LUA_CHANHANDLE);
+  if (*pc == NULL)
+    lua_pushliteral(L, "channel (closed)");
+  else if ((*pc)->name != NULL)
+    lua_pushfstring(L, "channel (%s)", (*pc)->name);
+  else
+    lua_pushfstring(L, "channel (%p)", (void *)*pc);
+  return 1;
+}
+
+
+static int scratch_gc (lua_State *L) {
+  Scratch *s = (Scratch *)lua_touserdata(L, 1);
+  s->nseen = 0;  /* SEEN goes with the state */
+  cleanup(L, s);
+  free(s->b);
+  free(s->m);
+  s->b = NULL;
+  s->m = NULL;
+  s->n = s->size = 0;
+  s->size_m = 0;
+  return 0;
+}
+
+
+/* __clone: a cloned state starts with an empty scratch */
+static int scratch_clone (lua_State *L) {
+  Scratch *s = (Scratch *)lua_touserdata(L, 1);
+  memset(s, 0, sizeof(Scratch));
+  return 0;
+}
+
+
+static const luaL_Reg chan_funcs[] = {
+  {"new", chan_new},
+  {"open", chan_open},
+  {NULL, NULL}
+};
+
+
+static const luaL_Reg chan_methods[] = {
+  {"capacity", chan_capacity},
+  {"close", chan_close},
+  {"count", chan_count},
+  {"recv", chan_recv},
+  {"recv_many", chan_recvmany},
+  {"send", chan_send},
+  {"send_many", chan_sendmany},
+  {"__clone", chan_clone},
+  {"__gc", chan_close},
+  {"__tostring", chan_tostring},
+  {NULL, NULL}
+};
+
+/* }====================================================== */
+
+
+LUALIB_API int luaopen_chan (lua_State *L) {
+  Scratch *s = (Scratch *)lua_newuserdata(L, sizeof(Scratch));
+  memset(s, 0, sizeof(Scratch));
+  lua_createtable(L, 0, 2);  /* its metatable */
+  lua_pushcfunction(L, scratch_gc);
+  lua_setfield(L, -2, "__gc");
+  lua_pushcfunction(L, scratch_clone);
+  lua_setfield(L, -2, "__clone");
+  lua_setmetatable(L, -2);
+  luaL_newmetatable(L, LUA_CHANHANDLE);
+  lua_pushvalue(L, -2);  /* scratch */
+  lua_newtable(L);  /* SEEN */
+  luaL_openlib(L, NULL, chan_methods, 2);
+  lua_pushvalue(L, -1);
+  lua_setfield(L, -2, "__index");
+  lua_pop(L, 1);
+  luaI_openlib(L, LUA_CHANLIBNAME, chan_funcs, 0);
+  lua_remove(L, -2);  /* scratch */
+  return 1;
+}
@@ -6,6 +6,7 @@
 
 
 #include <stdlib.h>
+#include <string.h>
 
 #include <stdio.h>
 
@@ -23,7 +24,9 @@
 #include "lobject.h"
 #include "lopcodes.h"
 #include "lparser.h"
+#include "lstring.h"
 #include "ltable.h"
+#include "lvm.h"
 
 /* 这个判断条件有意哈 */
 #define hasjumps(e)	((e)->t != (e)->f)
@@ -340,7 +343,7 @@ int luaK_stringK (FuncState *fs, TString *s) {
 
 int luaK_numberK (FuncState *fs, lua_Number r) {
   TValue o;
-  setnvalue(&o, r);
+  setnumvalue(&o, r);
   return addk(fs, &o, &o);
 }
 
@@ -1007,15 +1010,10 @@ void luaK_indexed (FuncState *fs, expdesc *t, expdesc *k) {
   t->k = VINDEXED;
 }
 
-/* 尝试合并二元操作符以及左右两边的表达式(编译优化) */
-static int constfolding (OpCode op, expdesc *e1, expdesc *e2) {
-  lua_Number v1, v2, r;
-  
-  /* 两个操作数都得是numeral */
-  if (!isnumeral(e1) || !isnumeral(e2)) return 0;
-  
-  v1 = e1->u.nval;
-  v2 = e2->u.nval;
+/* computes `v1 op v2' at compile time; 0 if it must be left to run time */
+static int foldarith (OpCode op, lua_Number v1, lua_Number v2,
+                      lua_Number *res) {
+  lua_Number r;
   switch (op) {
     case OP_ADD: r = luai_numadd(v1, v2); break;
     case OP_SUB: r = luai_numsub(v1, v2); break;
@@ -1032,10 +1030,17 @@ static int constfolding (OpCode op, expdesc *e1, expdesc *e2) {
     default: lua_assert(0); r = 0; break;
   }
   if (luai_numisnan(r)) return 0;  /* do not attempt to produce NaN */
-  e1->u.nval = r;
+  *res = r;
   return 1;
 }
 
+/* 尝试合并二元操作符以及左右两边的表达式(编译优化) */
+static int constfolding (OpCode op, expdesc *e1, expdesc *e2) {
+  /* 两个操作数都得是numeral */
+  if (!isnumeral(e1) || !isnumeral(e2)) return 0;
+  return foldarith(op, e1->u.nval, e2->u.nval, &e1->u.nval);
+}
+
 /* 
 ** local a = b + c 
 ** 表达式运行完毕后，b,c占用的临时的reg就可以被释放了，故而这一行编译完成后b,c占用的reg也可以释放了
@@ -1056,6 +1061,10 @@ static void codearith (FuncState *fs, OpCode op, expdesc *e1, expdesc *e2) {
       freeexp(fs, e2);
       freeexp(fs, e1);
     }
+    /* register op number-constant: only R(B) needs a type check at run time */
+    if (op >= OP_ADD && op <= OP_MOD && !ISK(o1) && ISK(o2) &&
+        ttisnumber(&fs->f->k[INDEXK(o2)]))
+      op = cast(OpCode, op - OP_ADD + OP_ADDK);  /* ORDER OP */
 	/* 这里R(A)的值尚未确定，e->=VRELOCABLE:表示表达式已求值，尚未写入到目的寄存器中 */
     e1->u.s.info = luaK_codeABC(fs, op, 0, o1, o2);
     e1->k = VRELOCABLE;
@@ -1264,3 +1273,676 @@ void luaK_setlist (FuncState *fs, int base, int nelems, int tostore) {
   fs->freereg = base + 1;  /* free registers with list values */
 }
 
+
+
+/*
+** {======================================================
+** Optimizing pass (lua_optimize, `luac -O'): runs in close_func on the
+** finished code of each function, before luaK_fuse. Locals that keep
+** the constant they were initialized with are propagated into RK
+** operands and folded; the constant tail of a concatenation is joined;
+** jumps are threaded; a value computed into a temporary only to be
+** moved into a local is computed in place; unreachable code and jumps
+** to the next instruction are removed.
+** =======================================================
+*/
+
+/* flags of an instruction during the pass */
+#define OJUMPED		1	/* target of a JMP, FORLOOP or FORPREP */
+#define OSKIPTO		2	/* where a test or LOADBOOL lands when it skips */
+#define OSKIPPED	4	/* the jump a test may skip: stays in place */
+#define OPSEUDO		8	/* upvalue of a CLOSURE or count of a SETLIST */
+#define ODEAD		16	/* removed: does nothing */
+#define OREACH		32	/* reachable from the entry */
+
+#define ISTARGET	(OJUMPED | OSKIPTO)
+
+/* how far `deadfrom' looks for the next use of a register */
+#define MAXSCAN		32
+
+
+static void markflow (FuncState *fs, lu_byte *fl) {
+  Proto *f = fs->f;
+  int pc;
+  for (pc = 0; pc < fs->pc; pc++) fl[pc] = 0;
+  for (pc = 0; pc < fs->pc; pc++) {
+    Instruction i = f->code[pc];
+    OpCode op = GET_OPCODE(i);
+    if (fl[pc] & OPSEUDO) continue;
+    switch (op) {
+      case OP_JMP: case OP_FORLOOP: case OP_FORPREP: {
+        fl[pc+1+GETARG_sBx(i)] |= OJUMPED;
+        break;
+      }
+      case OP_LOADBOOL: {
+        if (GETARG_C(i)) {
+          fl[pc+1] |= OSKIPPED;
+          fl[pc+2] |= OSKIPTO;
+        }
+        break;
+      }
+      case OP_CLOSURE: {
+        int j, nup = f->p[GETARG_Bx(i)]->nups;
+        for (j = 1; j <= nup; j++) fl[pc+j] |= OPSEUDO;
+        break;
+      }
+      case OP_SETLIST: {
+        if (GETARG_C(i) == 0) fl[pc+1] |= OPSEUDO;
+        break;
+      }
+      default: {
+        if (testTMode(op)) {
+          fl[pc+1] |= OSKIPPED;
+          fl[pc+2] |= OSKIPTO;
+        }
+        break;
+      }
+    }
+  }
+}
+
+
+/* may instruction `i' change register `r'? */
+static int setsreg (Instruction i, int r) {
+  OpCode op = GET_OPCODE(i);
+  int a = GETARG_A(i);
+  switch (op) {
+    case OP_LOADNIL: return (a <= r && r <= GETARG_B(i));
+    case OP_SELF: return (r == a || r == a+1);
+    case OP_CONCAT: return (r == a || (GETARG_B(i) <= r && r <= GETARG_C(i)));
+    case OP_FORLOOP: return (r == a || r == a+3);
+    case OP_TFORLOOP: return (r >= a+2);
+    case OP_CALL: case OP_TAILCALL: case OP_VARARG: return (r >= a);
+    case OP_TEST: return 0;
+    default: return (testAMode(op) && r == a);
+  }
+}
+
+
+/* does instruction `i' always overwrite register `r' (on its way on)? */
+static int killsreg (Instruction i, int r) {
+  OpCode op = GET_OPCODE(i);
+  int a = GETARG_A(i), b = GETARG_B(i), c = GETARG_C(i);
+  switch (op) {
+    case OP_LOADNIL: return (a <= r && r <= b);
+    case OP_SELF: return (r == a || r == a+1);
+    case OP_CALL: return (c != 0 && a <= r && r <= a+c-2);
+    case OP_VARARG: return (b != 0 && a <= r && r <= a+b-2);
+    case OP_TEST: case OP_TESTSET: case OP_TFORLOOP: case OP_FORLOOP:
+    case OP_FORPREP: case OP_TAILCALL: return 0;
+    default: return (testAMode(op) && r == a);
+  }
+}
+
+
+/* may instruction `i' read register `r'? (RK constants never match) */
+static int readsreg (Instruction i, int r) {
+  int a = GETARG_A(i), b = GETARG_B(i), c = GETARG_C(i);
+  switch (GET_OPCODE(i)) {
+    case OP_LOADK: case OP_LOADBOOL: case OP_LOADNIL: case OP_GETUPVAL:
+    case OP_GETGLOBAL: case OP_NEWTABLE: case OP_JMP: case OP_VARARG:
+      return 0;
+    case OP_MOVE: case OP_UNM: case OP_NOT: case OP_LEN: case OP_TESTSET:
+    case OP_ADDK: case OP_SUBK: case OP_MULK: case OP_DIVK: case OP_MODK:
+      return (b == r);
+    case OP_GETTABLE: case OP_SELF: case OP_ADD: case OP_SUB: case OP_MUL:
+    case OP_DIV: case OP_MOD: case OP_POW: case OP_EQ: case OP_LT: case OP_LE:
+      return (b == r || c == r);
+    case OP_SETTABLE: return (a == r || b == r || c == r);
+    case OP_SETGLOBAL: case OP_SETUPVAL: case OP_TEST: return (a == r);
+    case OP_CONCAT: return (b <= r && r <= c);
+    case OP_CALL: case OP_TAILCALL: return (r >= a && (b == 0 || r < a+b));
+    case OP_RETURN: return (r >= a && (b == 0 || r < a+b-1));
+    case OP_FORLOOP: case OP_FORPREP:
+      return (a <= r && r <= a+2);
+    case OP_TFORLOOP: return ((a <= r && r <= a+2) || (b && r == a+2+c));
+    case OP_SETLIST: return (r >= a && (b == 0 || r <= a+b));
+    default: return 1;  /* OP_CLOSE, OP_CLOSURE: upvalues */
+  }
+}
+
+
+/*
+** is the value of register `r' never read from `pc' on? Follows the
+** straight-line code (and plain jumps) for a few instructions only.
+*/
+static int deadfrom (FuncState *fs, const lu_byte *fl, int pc, int r) {
+  const Instruction *code = fs->f->code;
+  int n;
+  for (n = 0; n < MAXSCAN && pc < fs->pc; n++) {
+    Instruction i = code[pc];
+    OpCode op = GET_OPCODE(i);
+    if (fl[pc] & ODEAD) { pc++; continue; }
+    if (readsreg(i, r)) return 0;
+    switch (op) {
+      case OP_JMP: pc += 1 + GETARG_sBx(i); continue;
+      case OP_RETURN: case OP_TAILCALL: return 1;
+      case OP_LOADBOOL: if (GETARG_C(i)) return 0; break;
+      case OP_FORLOOP: case OP_FORPREP: case OP_CLOSURE: case OP_SETLIST:
+        return 0;
+      default: if (testTMode(op)) return 0; break;
+    }
+    if (killsreg(i, r)) return 1;
+    pc++;
+  }
+  return 0;
+}
+
+
+/* register of local variable `v' (as in luaF_getlocalname) */
+static int localreg (Proto *f, int v) {
+  int pc = f->locvars[v].startpc;
+  int j, r = 0;
+  for (j = 0; j < v; j++)
+    if (f->locvars[j].startpc <= pc && pc < f->locvars[j].endpc) r++;
+  return r;
+}
+
+
+/*
+** constant given to register `r' by the straight-line code right before
+** `pc' (LOADK, LOADBOOL or LOADNIL), as an index in `k'; -1 if none
+*/
+static int initconst (FuncState *fs, const lu_byte *fl, int pc, int r) {
+  const Instruction *code = fs->f->code;
+  int p;
+  for (p = pc - 1; p >= 0 && p >= pc - 8; p--) {
+    Instruction i = code[p];
+    if (fl[p+1] & ISTARGET) return -1;  /* another path gets there */
+    if (fl[p] & (OPSEUDO | OSKIPPED)) return -1;
+    if (fl[p] & ODEAD) continue;
+    switch (GET_OPCODE(i)) {
+      case OP_LOADK:
+        if (GETARG_A(i) == r) return GETARG_Bx(i);
+        break;
+      case OP_LOADBOOL:
+        if (GETARG_C(i)) return -1;
+        if (GETARG_A(i) == r) return boolK(fs, GETARG_B(i));
+        break;
+      case OP_LOADNIL:
+        if (GETARG_A(i) <= r && r <= GETARG_B(i)) return nilK(fs);
+        break;
+      case OP_MOVE: case OP_GETUPVAL: case OP_GETGLOBAL: case OP_GETTABLE:
+      case OP_NEWTABLE: case OP_ADD: case OP_SUB: case OP_MUL: case OP_DIV:
+      case OP_MOD: case OP_POW: case OP_UNM: case OP_NOT: case OP_LEN:
+      case OP_ADDK: case OP_SUBK: case OP_MULK: case OP_DIVK: case OP_MODK:
+        if (GETARG_A(i) == r) return -1;
+        break;
+      default: return -1;
+    }
+  }
+  return -1;
+}
+
+
+/* is register `r' left alone in [from, to) (and by inner functions)? */
+static int keepsreg (FuncState *fs, const lu_byte *fl, int from, int to,
+                     int r) {
+  const Instruction *code = fs->f->code;
+  int pc;
+  for (pc = from; pc < to; pc++) {
+    Instruction i = code[pc];
+    if (fl[pc] & ODEAD) continue;
+    if (fl[pc] & OPSEUDO) {
+      if (GET_OPCODE(i) == OP_MOVE && GETARG_B(i) == r)
+        return 0;  /* an upvalue: any call may change it */
+    }
+    else if (setsreg(i, r)) return 0;
+  }
+  return 1;
+}
+
+
+/* turns the test at `pc' into a jump over (skip) or onto (!skip) the next */
+static void fixtest (Instruction *pi, int skip) {
+  *pi = CREATE_ABx(OP_JMP, 0, (skip ? 1 : 0) + MAXARG_sBx);
+}
+
+
+/* folds instruction `pc' when its operands are constants */
+static void foldconst (FuncState *fs, int pc) {
+  Proto *f = fs->f;
+  Instruction *pi = &f->code[pc];
+  OpCode op = GET_OPCODE(*pi);
+  int a = GETARG_A(*pi), b = GETARG_B(*pi), c = GETARG_C(*pi);
+  const TValue *kb = ISK(b) ? &f->k[INDEXK(b)] : NULL;
+  const TValue *kc = ISK(c) ? &f->k[INDEXK(c)] : NULL;
+  lua_Number r;
+  switch (op) {
+    case OP_ADD: case OP_SUB: case OP_MUL: case OP_DIV: case OP_MOD:
+    case OP_POW: {
+      if (kb && kc && ttisnumber(kb) && ttisnumber(kc) &&
+          foldarith(op, nvalue(kb), nvalue(kc), &r) && r != 0)  /* -0? */
+        *pi = CREATE_ABx(OP_LOADK, a, luaK_numberK(fs, r));
+      else if (!kb && kc && ttisnumber(kc) && op != OP_POW)  /* see codearith */
+        SET_OPCODE(*pi, cast(OpCode, op - OP_ADD + OP_ADDK));  /* ORDER OP */
+      break;
+    }
+    case OP_EQ: {
+      if (kb && kc)  /* `addk' keeps one entry per value */
+        fixtest(pi, (INDEXK(b) == INDEXK(c)) != a);
+      break;
+    }
+    case OP_LT: case OP_LE: {
+      if (kb && kc && ttisnumber(kb) && ttisnumber(kc)) {
+        int res = (op == OP_LT) ? luai_numlt(nvalue(kb), nvalue(kc))
+                                : luai_numle(nvalue(kb), nvalue(kc));
+        fixtest(pi, res != a);
+      }
+      break;
+    }
+    default: break;
+  }
+}
+
+
+/* uses constant `k' for register `r' in instruction `pc' */
+static void useconst (FuncState *fs, int pc, int r, int k) {
+  Proto *f = fs->f;
+  Instruction *pi = &f->code[pc];
+  OpCode op = GET_OPCODE(*pi);
+  const TValue *v = &f->k[k];
+  lua_Number n;
+  switch (op) {
+    case OP_MOVE: {
+      if (GETARG_B(*pi) == r) *pi = CREATE_ABx(OP_LOADK, GETARG_A(*pi), k);
+      return;
+    }
+    case OP_UNM: {
+      if (GETARG_B(*pi) == r && ttisnumber(v) && nvalue(v) != 0)
+        *pi = CREATE_ABx(OP_LOADK, GETARG_A(*pi),
+                         luaK_numberK(fs, luai_numunm(nvalue(v))));
+      return;
+    }
+    case OP_NOT: {
+      if (GETARG_B(*pi) == r)
+        *pi = CREATE_ABC(OP_LOADBOOL, GETARG_A(*pi), l_isfalse(v), 0);
+      return;
+    }
+    case OP_LEN: {  /* no metamethod for strings */
+      if (GETARG_B(*pi) == r && ttisstring(v))
+        *pi = CREATE_ABx(OP_LOADK, GETARG_A(*pi),
+                         luaK_numberK(fs, cast_num(tsvalue(v)->len)));
+      return;
+    }
+    case OP_ADDK: case OP_SUBK: case OP_MULK: case OP_DIVK: case OP_MODK: {
+      if (GETARG_B(*pi) == r && ttisnumber(v) &&
+          foldarith(cast(OpCode, op - OP_ADDK + OP_ADD), nvalue(v),
+                    nvalue(&f->k[INDEXK(GETARG_C(*pi))]), &n) && n != 0)
+        *pi = CREATE_ABx(OP_LOADK, GETARG_A(*pi), luaK_numberK(fs, n));
+      return;
+    }
+    case OP_TEST: {  /* if not (R(A) <=> C) then pc++ */
+      if (GETARG_A(*pi) == r)
+        fixtest(pi, (!l_isfalse(v)) != GETARG_C(*pi));
+      return;
+    }
+    case OP_TESTSET: {  /* if (R(B) <=> C) then R(A) := R(B) else pc++ */
+      if (GETARG_B(*pi) == r) {
+        if ((!l_isfalse(v)) == GETARG_C(*pi))
+          *pi = CREATE_ABx(OP_LOADK, GETARG_A(*pi), k);
+        else
+          fixtest(pi, 1);
+      }
+      return;
+    }
+    default: break;
+  }
+  if (getOpMode(op) != iABC || k > MAXINDEXRK) return;
+  if (getBMode(op) == OpArgK && GETARG_B(*pi) == r)
+    SETARG_B(*pi, RKASK(k));
+  if (getCMode(op) == OpArgK && GETARG_C(*pi) == r)
+    SETARG_C(*pi, RKASK(k));
+  foldconst(fs, pc);
+}
+
+
+/* propagates the locals that never change their initial constant */
+static void propagate (FuncState *fs, lu_byte *fl) {
+  Proto *f = fs->f;
+  int v, pc;
+  for (v = 0; v < fs->nlocvars; v++) {
+    int from = f->locvars[v].startpc, to = f->locvars[v].endpc;
+    int r = localreg(f, v);
+    int k;
+    if (from >= to || !keepsreg(fs, fl, from, to, r)) continue;
+    k = initconst(fs, fl, from, r);
+    if (k < 0) continue;
+    for (pc = from; pc < to; pc++)
+      if (!(fl[pc] & (OPSEUDO | ODEAD))) useconst(fs, pc, r, k);
+  }
+  for (pc = 1; pc < fs->pc; pc++) {  /* constants in temporaries */
+    Instruction i = f->code[pc], l;
+    int p = pc - 1, r, k;
+    if (fl[pc] & (OPSEUDO | ODEAD | ISTARGET)) continue;
+    while (p > 0 && (fl[p] & ODEAD) && !(fl[p] & ISTARGET)) p--;
+    l = f->code[p];
+    if (fl[p] & (OPSEUDO | ODEAD | OSKIPPED)) continue;
+    r = GETARG_A(l);
+    if (GET_OPCODE(l) == OP_LOADK) k = GETARG_Bx(l);
+    else if (GET_OPCODE(l) == OP_LOADBOOL && !GETARG_C(l))
+      k = boolK(fs, GETARG_B(l));
+    else continue;
+    if (!readsreg(i, r)) continue;
+    useconst(fs, pc, r, k);
+    if (!readsreg(f->code[pc], r) && deadfrom(fs, fl, pc, r))
+      fl[p] |= ODEAD;  /* `LOADK t; ADD t t k' -> `LOADK t' */
+  }
+}
+
+
+/*
+** joins the constants loaded right before a CONCAT into one: "a".."b"
+** (also once propagated from locals) becomes a single LOADK
+*/
+static void foldconcat (FuncState *fs, lu_byte *fl) {
+  lua_State *L = fs->L;
+  Proto *f = fs->f;
+  int pc;
+  for (pc = 0; pc < fs->pc; pc++) {
+    Instruction i = f->code[pc];
+    int b = GETARG_B(i), c = GETARG_C(i);
+    int n = 0, j, first;
+    size_t tl = 0;
+    char *buff;
+    if (GET_OPCODE(i) != OP_CONCAT || (fl[pc] & (OPSEUDO | ODEAD))) continue;
+    while (c - n >= b && pc - 1 - n >= 0) {  /* count constant operands */
+      int p = pc - 1 - n;
+      Instruction l = f->code[p];
+      const TValue *o;
+      if ((fl[p] & (OPSEUDO | OSKIPPED | ODEAD)) || (fl[p+1] & ISTARGET))
+        break;
+      if (GET_OPCODE(l) != OP_LOADK || GETARG_A(l) != c - n) break;
+      o = &f->k[GETARG_Bx(l)];
+      if (!ttisstring(o) && !ttisnumber(o)) break;
+      n++;
+    }
+    if (n < 2) continue;
+    first = pc - n;
+    for (j = first; j < pc; j++) {  /* converted as luaV_concat would */
+      TValue o;
+      setobj(L, &o, &f->k[GETARG_Bx(f->code[j])]);
+      luaV_tostring(L, &o);
+      tl += tsvalue(&o)->len;
+    }
+    buff = luaZ_openspace(L, fs->ls->buff, tl);
+    tl = 0;
+    for (j = first; j < pc; j++) {
+      TValue o;
+      setobj(L, &o, &f->k[GETARG_Bx(f->code[j])]);
+      luaV_tostring(L, &o);
+      memcpy(buff + tl, getstr(tsvalue(&o)), tsvalue(&o)->len);
+      tl += tsvalue(&o)->len;
+      if (j > first) fl[j] |= ODEAD;
+    }
+    j = luaK_stringK(fs, luaS_newlstr(L, buff, tl));
+    if (c - n + 1 == b) {  /* all of them: no CONCAT left */
+      f->code[first] = CREATE_ABx(OP_LOADK, GETARG_A(i), j);
+      fl[pc] |= ODEAD;
+    }
+    else {
+      f->code[first] = CREATE_ABx(OP_LOADK, c - n + 1, j);
+      SETARG_C(f->code[pc], c - n + 1);
+    }
+  }
+}
+
+
+/* where a jump to `dest' ends up, through other jumps */
+static int finaldest (FuncState *fs, const lu_byte *fl, int dest) {
+  const Instruction *code = fs->f->code;
+  int hops;
+  for (hops = 0; hops < 100; hops++) {  /* (a loop of jumps never ends) */
+    while (fl[dest] & ODEAD) dest++;  /* the final RETURN is never dead */
+    if (GET_OPCODE(code[dest]) != OP_JMP || (fl[dest] & OPSEUDO)) break;
+    dest += 1 + GETARG_sBx(code[dest]);
+  }
+  return dest;
+}
+
+
+/* first live instruction after `pc' */
+static int nextlive (const lu_byte *fl, int pc) {
+  do pc++; while (fl[pc] & ODEAD);
+  return pc;
+}
+
+
+static void threadjumps (FuncState *fs, lu_byte *fl) {
+  Instruction *code = fs->f->code;
+  int pc;
+  for (pc = 0; pc < fs->pc; pc++) {
+    Instruction i = code[pc];
+    OpCode op = GET_OPCODE(i);
+    if (fl[pc] & (OPSEUDO | ODEAD)) continue;
+    if (op == OP_JMP) {
+      int dest = finaldest(fs, fl, pc + 1 + GETARG_sBx(i));
+      if (fl[pc] & OSKIPPED)
+        SETARG_sBx(code[pc], dest - (pc+1));
+      else if (dest == nextlive(fl, pc))
+        fl[pc] |= ODEAD;  /* jump to the next instruction */
+      else if (GET_OPCODE(code[dest]) == OP_RETURN && GETARG_B(code[dest]) != 0)
+        code[pc] = code[dest];  /* no jump to a return */
+      else
+        SETARG_sBx(code[pc], dest - (pc+1));
+    }
+    else if ((op == OP_EQ || op == OP_LT || op == OP_LE || op == OP_TEST) &&
+             pc + 3 < fs->pc && !(fl[pc+1] & OJUMPED) &&
+             !(fl[pc+2] & (OJUMPED | ODEAD)) &&
+             GET_OPCODE(code[pc+1]) == OP_JMP &&
+             GETARG_sBx(code[pc+1]) == 1 &&
+             GET_OPCODE(code[pc+2]) == OP_JMP) {
+      /* `T; JMP +1; JMP x' -> `not T; JMP x' */
+      int dest = pc + 3 + GETARG_sBx(code[pc+2]);
+      if (op == OP_TEST) SETARG_C(code[pc], !GETARG_C(i));
+      else SETARG_A(code[pc], !GETARG_A(i));
+      SETARG_sBx(code[pc+1], dest - (pc+2));
+      fl[pc+2] |= ODEAD;
+    }
+  }
+}
+
+
+/* a temporary moved into a local right after it is computed? */
+static void elimmoves (FuncState *fs, lu_byte *fl, const lu_byte *captured) {
+  Instruction *code = fs->f->code;
+  int pc;
+  for (pc = 0; pc + 1 < fs->pc; pc++) {
+    Instruction i = code[pc], m = code[pc+1];
+    int r = GETARG_A(i), l = GETARG_A(m);
+    if ((fl[pc] & (OPSEUDO | ODEAD | OSKIPPED)) ||
+        (fl[pc+1] & (OPSEUDO | ODEAD | OSKIPPED | ISTARGET)) ||
+        GET_OPCODE(m) != OP_MOVE || GETARG_B(m) != r || l == r ||
+        captured[r])
+      continue;
+    switch (GET_OPCODE(i)) {
+      case OP_LOADBOOL:
+        if (GETARG_C(i)) continue;
+        break;
+      case OP_CONCAT:
+        if (GETARG_B(i) <= l && l <= GETARG_C(i)) continue;
+        break;
+      case OP_MOVE: case OP_LOADK: case OP_GETUPVAL: case OP_GETGLOBAL:
+      case OP_GETTABLE: case OP_NEWTABLE: case OP_ADD: case OP_SUB:
+      case OP_MUL: case OP_DIV: case OP_MOD: case OP_POW: case OP_UNM:
+      case OP_NOT: case OP_LEN: case OP_ADDK: case OP_SUBK: case OP_MULK:
+      case OP_DIVK: case OP_MODK:
+        break;
+      default: continue;
+    }
+    if (deadfrom(fs, fl, pc + 2, r)) {
+      SETARG_A(code[pc], l);
+      fl[pc+1] |= ODEAD;
+    }
+  }
+}
+
+
+/* drops dead and unreachable instructions, fixing jumps and debug info */
+static void compact (FuncState *fs, lu_byte *fl) {
+  lua_State *L = fs->L;
+  Proto *f = fs->f;
+  Instruction *code = f->code;
+  int n = fs->pc;
+  int *newpc = luaM_newvector(L, n + 1, int);
+  int *work = newpc;  /* first used as the work list of the walk */
+  int top = 0, pc, np;
+  work[top++] = 0;
+  fl[0] |= OREACH;
+  while (top > 0) {
+    int s[3], ns = 0, j;
+    Instruction i;
+    pc = work[--top];
+    i = code[pc];
+    if (fl[pc] & ODEAD) s[ns++] = pc + 1;
+    else switch (GET_OPCODE(i)) {
+      case OP_RETURN: break;
+      case OP_JMP: case OP_FORPREP: {
+        s[ns++] = pc + 1 + GETARG_sBx(i);
+        break;
+      }
+      case OP_FORLOOP: {
+        s[ns++] = pc + 1 + GETARG_sBx(i);
+        s[ns++] = pc + 1;
+        break;
+      }
+      case OP_CLOSURE: {
+        int nup = f->p[GETARG_Bx(i)]->nups;
+        for (j = 1; j <= nup; j++) fl[pc+j] |= OREACH;
+        s[ns++] = pc + 1 + nup;
+        break;
+      }
+      case OP_SETLIST: {
+        if (GETARG_C(i) == 0) fl[++pc] |= OREACH;
+        s[ns++] = pc + 1;
+        break;
+      }
+      case OP_LOADBOOL: {  /* a skipped instruction stays in place */
+        s[ns++] = pc + 1;
+        if (GETARG_C(i)) s[ns++] = pc + 2;
+        break;
+      }
+      default: {
+        s[ns++] = pc + 1;
+        if (testTMode(GET_OPCODE(i))) s[ns++] = pc + 2;
+        break;
+      }
+    }
+    for (j = 0; j < ns; j++) {
+      if (s[j] < n && !(fl[s[j]] & OREACH)) {
+        fl[s[j]] |= OREACH;
+        work[top++] = s[j];
+      }
+    }
+  }
+  fl[n-1] |= OREACH;  /* the final return stays last */
+  for (np = 0, pc = 0; pc < n; pc++) {
+    newpc[pc] = np;
+    if ((fl[pc] & (OREACH | ODEAD)) == OREACH) np++;
+  }
+  newpc[n] = np;
+  for (pc = 0; pc < n; pc++) {
+    Instruction i = code[pc];
+    if ((fl[pc] & (OREACH | ODEAD)) != OREACH) continue;
+    switch (GET_OPCODE(i)) {
+      case OP_JMP: case OP_FORLOOP: case OP_FORPREP: {
+        if (!(fl[pc] & OPSEUDO))
+          SETARG_sBx(i, newpc[pc + 1 + GETARG_sBx(i)] - (newpc[pc] + 1));
+        break;
+      }
+      default: break;
+    }
+    code[newpc[pc]] = i;
+    f->lineinfo[newpc[pc]] = f->lineinfo[pc];
+  }
+  for (pc = 0; pc < fs->nlocvars; pc++) {
+    f->locvars[pc].startpc = newpc[f->locvars[pc].startpc];
+    f->locvars[pc].endpc = newpc[f->locvars[pc].endpc];
+  }
+  fs->pc = np;
+  luaM_freearray(L, newpc, n + 1, int);
+}
+
+
+void luaK_optimize (FuncState *fs) {
+  lua_State *L = fs->L;
+  Proto *f = fs->f;
+  int n = fs->pc;
+  lu_byte captured[MAXSTACK];
+  lu_byte *fl = luaM_newvector(L, n, lu_byte);
+  int pc;
+  markflow(fs, fl);
+  memset(captured, 0, sizeof(captured));
+  for (pc = 0; pc < n; pc++)  /* registers that inner functions may change */
+    if ((fl[pc] & OPSEUDO) && GET_OPCODE(f->code[pc]) == OP_MOVE)
+      captured[GETARG_B(f->code[pc])] = 1;
+  propagate(fs, fl);
+  foldconcat(fs, fl);
+  threadjumps(fs, fl);
+  elimmoves(fs, fl, captured);
+  compact(fs, fl);
+  for (;;) {  /* folded tests leave jumps to the next instruction */
+    int found = 0;
+    markflow(fs, fl);
+    for (pc = 0; pc < fs->pc; pc++) {
+      Instruction i = f->code[pc];
+      if (GET_OPCODE(i) == OP_JMP && GETARG_sBx(i) == 0 &&
+          !(fl[pc] & (OPSEUDO | OSKIPPED))) {
+        fl[pc] |= ODEAD;
+        found = 1;
+      }
+    }
+    if (!found) break;
+    compact(fs, fl);
+  }
+  luaM_freearray(L, fl, n, lu_byte);
+}
+
+/* }====================================================== */
+
+
+/* is RK index `x' a string constant? */
+#define isKstr(f,x)	(ISK(x) && ttisstring(&(f)->k[INDEXK(x)]))
+
+/*
+** superinstructions: rewrite the first instruction of some frequent
+** pairs so that luaV_execute runs the second one without dispatching
+** it. The second instruction is left untouched, so jump targets, line
+** info and the debug interface see the same code as before. Runs on
+** finished functions only (close_func and the undumper), when no later
+** patch (e.g. CALL to TAILCALL) can change the pair any more.
+*/
+void luaK_fuse (Proto *f) {
+  int pc;
+  for (pc = 0; pc + 1 < f->sizecode; pc++) {
+    Instruction i = f->code[pc];
+    Instruction n = f->code[pc+1];
+    switch (GET_OPCODE(i)) {
+      case OP_GETGLOBAL: {	/* f() 和 f(const...) 之外的调用,参数求值会插在中间 */
+        if (GET_OPCODE(n) == OP_CALL && GETARG_A(n) == GETARG_A(i)) {
+          SET_OPCODE(f->code[pc], OP_GGETCALL);
+          pc++;  /* fused pairs never overlap */
+        }
+        break;
+      }
+      case OP_GETTABLE: {	/* a.b.c, p.x, p.y */
+        if (isKstr(f, GETARG_C(i)) && GET_OPCODE(n) == OP_GETTABLE &&
+            isKstr(f, GETARG_C(n))) {
+          SET_OPCODE(f->code[pc], OP_GETTABLE2);
+          pc++;
+        }
+        break;
+      }
+      case OP_GGETCALL:
+      case OP_GETTABLE2: {  /* already fused (undumped code) */
+        pc++;
+        break;
+      }
+      case OP_SETLIST: {
+        if (GETARG_C(i) == 0) pc++;  /* skip the count, it is not an instruction */
+        break;
+      }
+      default: break;
+    }
+  }
+}
@@ -85,6 +85,8 @@ LUAI_FUNC void luaK_ret (FuncState *fs, int first, int nret);
 LUAI_FUNC void luaK_concat (FuncState *fs, int *l1, int l2);
 LUAI_FUNC int luaK_getlabel (FuncState *fs);
 LUAI_FUNC void luaK_setoneret (FuncState *fs, expdesc *e);
+LUAI_FUNC void luaK_optimize (FuncState *fs);
+LUAI_FUNC void luaK_fuse (Proto *f);
 
 
 #endif
@@ -17,6 +17,11 @@
 #include "lauxlib.h"
 #include "lualib.h"
 
+#if defined(LUA_USE_POSIX)
+#include <signal.h>
+#include <sys/time.h>
+#endif
+
 
 /* 提取注册表 */
 static int db_getregistry (lua_State *L) {
@@ -305,6 +310,21 @@ static int db_gethook (lua_State *L) {
 }
 
 
+/*
+** debug.setbudget ([thread,] [n]): the thread yields, with no values,
+** after `n' calls and backward jumps (see lua_setbudget); none turns it
+** off. Returns the previous `n'
+*/
+static int db_setbudget (lua_State *L) {
+  int arg;
+  lua_State *L1 = getthread(L, &arg);
+  int n = luaL_optint(L, arg+1, 0);
+  luaL_argcheck(L, n >= 0, arg+1, "negative budget");
+  lua_pushinteger(L, lua_setbudget(L1, n, NULL, NULL));
+  return 1;
+}
+
+
 static int db_debug (lua_State *L) {
   for (;;) {
     char buffer[250];
@@ -385,6 +405,189 @@ static int db_errorfb (lua_State *L) {
 }
 
 
+/*
+** {======================================================
+** Sampling profiler: a C hook takes the samples (see lua_profsample),
+** either every `period' instructions or, with mode "time", at the first
+** instruction after each SIGPROF (`period' microseconds of CPU time).
+** The profiler replaces any hook set on the profiled thread.
+** =======================================================
+*/
+
+#define PROFSIZE	4096	/* default number of samples in the ring */
+
+static void profhook (lua_State *L, lua_Debug *ar) {
+  (void)ar;  /* not used */
+  lua_profsample(L);
+}
+
+
+#if defined(LUA_USE_POSIX)
+
+static lua_State *profL = NULL;  /* thread sampled by the timer */
+
+
+/* one sample, then wait for the next SIGPROF */
+static void proftick (lua_State *L, lua_Debug *ar) {
+  (void)ar;  /* not used */
+  lua_sethook(L, NULL, 0, 0);
+  lua_profsample(L);
+}
+
+
+static void profsignal (int i) {
+  (void)i;  /* not used */
+  lua_sethook(profL, proftick, LUA_MASKCOUNT, 1);  /* (signal safe) */
+}
+
+
+static int proftimer (long usec) {
+  struct itimerval it;
+  it.it_interval.tv_sec = usec / 1000000;
+  it.it_interval.tv_usec = usec % 1000000;
+  it.it_value = it.it_interval;
+  return setitimer(ITIMER_PROF, &it, NULL) == 0;
+}
+
+#endif
+
+
+/* debug.profile_start ([period [, mode [, size]]]) */
+static int db_profstart (lua_State *L) {
+  static const char *const opts[] = {"count", "time", NULL};
+  int period = luaL_optint(L, 1, 1000);
+  int mode = luaL_checkoption(L, 2, "count", opts);
+  int size = luaL_optint(L, 3, PROFSIZE);
+  luaL_argcheck(L, period > 0, 1, "period must be positive");
+  luaL_argcheck(L, size > 0, 3, "size must be positive");
+  lua_profbuffer(L, size);
+  if (mode == 0)
+    lua_sethook(L, profhook, LUA_MASKCOUNT, period);
+  else {
+#if defined(LUA_USE_POSIX)
+    lua_sethook(L, NULL, 0, 0);
+    profL = L;
+    signal(SIGPROF, profsignal);
+    if (!proftimer(period)) {
+      signal(SIGPROF, SIG_DFL);
+      lua_profbuffer(L, 0);
+      return luaL_error(L, "cannot start the profiling timer");
+    }
+#else
+    lua_profbuffer(L, 0);
+    return luaL_error(L, "time sampling not supported");
+#endif
+  }
+  return 0;
+}
+
+
+/* push the frame name used in the folded stacks */
+static void profname (lua_State *L, lua_Debug *ar) {
+  if (*ar->what == 'C')
+    lua_pushliteral(L, "[C]");
+  else if (*ar->what == 'm')  /* main? */
+    lua_pushstring(L, ar->short_src);
+  else
+    lua_pushfstring(L, "%s:%d", ar->short_src, ar->linedefined);
+}
+
+
+/*
+** debug.profile_stop () -> folded stacks, number of samples
+** Each line of the result is `root;...;leaf count', the input format of
+** flame graph tools.
+*/
+static int db_profstop (lua_State *L) {
+  lua_Debug ar;
+  luaL_Buffer b;
+  int i, nlines = 0;
+  int n = lua_profsamples(L);
+  lua_Hook hook = lua_gethook(L);
+#if defined(LUA_USE_POSIX)
+  if (profL == L) {
+    proftimer(0);
+    signal(SIGPROF, SIG_DFL);
+    profL = NULL;
+  }
+  if (hook == proftick) lua_sethook(L, NULL, 0, 0);
+#endif
+  if (hook == profhook) lua_sethook(L, NULL, 0, 0);
+  lua_newtable(L);  /* stack -> count */
+  for (i = 0; i < n; i++) {
+    int level = 0;
+    while (lua_profframe(L, i, level, &ar)) level++;
+    luaL_buffinit(L, &b);
+    while (level-- > 0) {  /* root first */
+      lua_profframe(L, i, level, &ar);
+      profname(L, &ar);
+      luaL_addvalue(&b);
+      if (level > 0) luaL_addchar(&b, ';');
+    }
+    luaL_pushresult(&b);
+    lua_pushvalue(L, -1);
+    lua_rawget(L, -3);
+    lua_pushinteger(L, lua_tointeger(L, -1) + 1);
+    lua_remove(L, -2);
+    lua_rawset(L, -3);
+  }
+  lua_profbuffer(L, 0);
+  lua_newtable(L);  /* lines */
+  lua_pushnil(L);
+  while (lua_next(L, -3)) {
+    lua_pushfstring(L, "%s %d\n", lua_tostring(L, -2),
+                       (int)lua_tointeger(L, -1));
+    lua_rawseti(L, -4, ++nlines);
+    lua_pop(L, 1);
+  }
+  luaL_buffinit(L, &b);
+  for (i = 1; i <= nlines; i++) {
+    lua_rawgeti(L, -1, i);
+    luaL_addvalue(&b);
+  }
+  luaL_pushresult(&b);
+  lua_pushinteger(L, n);
+  return 2;
+}
+
+/* }====================================================== */
+
+
+/*
+** debug.stats ([reset]) -> table of the hot-path counters (lua_Stats),
+** or nil in a build without LUAI_STATS
+*/
+static int db_stats (lua_State *L) {
+  lua_Stats st;
+  if (!lua_stats(L, &st, lua_toboolean(L, 1))) {
+    lua_pushnil(L);
+    return 1;
+  }
+  lua_createtable(L, 0, 10);
+  lua_pushnumber(L, (lua_Number)st.strhits);
+  lua_setfield(L, -2, "strhits");
+  lua_pushnumber(L, (lua_Number)st.strmisses);
+  lua_setfield(L, -2, "strmisses");
+  lua_pushnumber(L, (lua_Number)st.rehashes);
+  lua_setfield(L, -2, "rehashes");
+  lua_pushnumber(L, (lua_Number)st.rehashslots);
+  lua_setfield(L, -2, "rehashslots");
+  lua_pushnumber(L, (lua_Number)st.stackgrows);
+  lua_setfield(L, -2, "stackgrows");
+  lua_pushnumber(L, (lua_Number)st.cigrows);
+  lua_setfield(L, -2, "cigrows");
+  lua_pushnumber(L, (lua_Number)st.indexmeta);
+  lua_setfield(L, -2, "indexmeta");
+  lua_pushnumber(L, (lua_Number)st.newindexmeta);
+  lua_setfield(L, -2, "newindexmeta");
+  lua_pushnumber(L, (lua_Number)st.concats);
+  lua_setfield(L, -2, "concats");
+  lua_pushnumber(L, (lua_Number)st.concatbytes);
+  lua_setfield(L, -2, "concatbytes");
+  return 1;
+}
+
+
 static const luaL_Reg dblib[] = {
   {"debug", db_debug},
   {"getfenv", db_getfenv},
@@ -394,11 +597,15 @@ static const luaL_Reg dblib[] = {
   {"getregistry", db_getregistry},
   {"getmetatable", db_getmetatable},
   {"getupvalue", db_getupvalue},
+  {"profile_start", db_profstart},
+  {"profile_stop", db_profstop},
+  {"setbudget", db_setbudget},
   {"setfenv", db_setfenv},
   {"sethook", db_sethook},
   {"setlocal", db_setlocal},
   {"setmetatable", db_setmetatable},
   {"setupvalue", db_setupvalue},
+  {"stats", db_stats},
   {"traceback", db_errorfb},
   {NULL, NULL}
 };
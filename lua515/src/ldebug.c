@@ -21,6 +21,8 @@
 #include "ldebug.h"
 #include "ldo.h"
 #include "lfunc.h"
+#include "lgc.h"
+#include "lmem.h"
 #include "lobject.h"
 #include "lopcodes.h"
 #include "lstate.h"
@@ -32,6 +34,7 @@
 
 
 static const char *getfuncname (lua_State *L, CallInfo *ci, const char **name);
+static const char *calleename (lua_State *L, CallInfo *ci, const char **name);
 
 /* 计算存档的savedpc在code数组中的索引 */
 static int currentpc (lua_State *L, CallInfo *ci) {
@@ -47,8 +50,11 @@ static int currentline (lua_State *L, CallInfo *ci) {
   int pc = currentpc(L, ci);
   if (pc < 0)
     return -1;  /* only active lua functions have current-line information */
-  else
-    return getline(ci_func(ci)->l.p, pc);
+  else {
+    Proto *p = ci_func(ci)->l.p;
+    luaG_needdebug(L, p);
+    return getline(p, pc);
+  }
 }
 
 
@@ -63,7 +69,7 @@ LUA_API int lua_sethook (lua_State *L, lua_Hook func, int mask, int count) {
   L->hook = func;
   L->basehookcount = count;
   resethookcount(L);
-  L->hookmask = cast_byte(mask);
+  L->hookmask = cast_byte(mask | (L->hookmask & MASKBUDGET));
   return 1;
 }
 
@@ -74,7 +80,7 @@ LUA_API lua_Hook lua_gethook (lua_State *L) {
 
 
 LUA_API int lua_gethookmask (lua_State *L) {
-  return L->hookmask;
+  return L->hookmask & ~MASKBUDGET;
 }
 
 
@@ -82,6 +88,37 @@ LUA_API int lua_gethookcount (lua_State *L) {
   return L->basehookcount;
 }
 
+
+/*
+** instruction budget of thread `L', without hooks: every `budget' calls
+** and backward jumps in Lua functions (0: no budget), `f' is called
+** between two instructions; if it returns nonzero, or with no `f', the
+** thread yields with no values if it can (a coroutine not under a C
+** call), or else gets an error. `f' may raise errors and set a new
+** budget. Threads created later by `L' get the same setting. Returns
+** the previous budget
+*/
+LUA_API int lua_setbudget (lua_State *L, int budget, lua_Budget f, void *ud) {
+  int old = L->basebudget;
+  if (budget <= 0) {  /* turn it off? */
+    budget = 0;
+    f = NULL;
+    ud = NULL;
+  }
+  L->basebudget = budget;
+  L->budgetf = f;
+  L->budgetud = ud;
+  L->hookmask &= ~MASKBUDGET;
+  resetbudget(L);
+  return old;
+}
+
+
+/* calls and backward jumps left before the budget runs out (0: none) */
+LUA_API int lua_getbudget (lua_State *L) {
+  return (L->basebudget > 0) ? L->budget : 0;
+}
+
 /* 按照传入的level尝试确定ar->i_ci（want的调用层值）的值 
 ** level:0:本层调用，1：往前退一层，2：往前退2层，N：退n层
 ** RETURNS: status:1:能找到指定的层(不包含L->base_ci)，0：找不到指定的层（level为负数除外)
@@ -95,6 +132,14 @@ LUA_API int lua_getstack (lua_State *L, int level, lua_Debug *ar) {
     level--;
     if (f_isLua(ci))  /* Lua function? */
       level -= ci->tailcalls;  /* skip lost tail calls */
+    if ((ci - 1)->pcall && level >= 0) {  /* pcall run by the VM below? */
+      if (level == 0) {  /* it has a level of its own, as a C function */
+        ar->i_ci = -cast_int((ci - 1) - L->base_ci);
+        lua_unlock(L);
+        return 1;
+      }
+      level--;
+    }
   }
   /* 传入level=0或者level>0,回滚后可以确定到指定的level'call */
   if (level == 0 && ci > L->base_ci) {  /* level found? */
@@ -119,6 +164,7 @@ static Proto *getluaproto (CallInfo *ci) {
 static const char *findlocal (lua_State *L, CallInfo *ci, int n) {
   const char *name;
   Proto *fp = getluaproto(ci);	/* lua还是C函数 ？ */
+  if (fp) luaG_needdebug(L, fp);
   if (fp && (name = luaF_getlocalname(fp, n, currentpc(L, ci))) != NULL)
     return name;  /* is a local variable in a Lua function */
   else {
@@ -136,7 +182,7 @@ static const char *findlocal (lua_State *L, CallInfo *ci, int n) {
 */
 LUA_API const char *lua_getlocal (lua_State *L, const lua_Debug *ar, int n) {
   CallInfo *ci = L->base_ci + ar->i_ci;	/* 重定位调用层 */
-  const char *name = findlocal(L, ci, n);	/* 查找该调用层的指定localVal */
+  const char *name = (ar->i_ci < 0) ? NULL : findlocal(L, ci, n);	/* 查找该调用层的指定localVal */
   lua_lock(L);
   if (name)
       luaA_pushobject(L, ci->base + (n - 1));
@@ -147,7 +193,7 @@ LUA_API const char *lua_getlocal (lua_State *L, const lua_Debug *ar, int n) {
 
 LUA_API const char *lua_setlocal (lua_State *L, const lua_Debug *ar, int n) {
   CallInfo *ci = L->base_ci + ar->i_ci;
-  const char *name = findlocal(L, ci, n);
+  const char *name = (ar->i_ci < 0) ? NULL : findlocal(L, ci, n);
   lua_lock(L);
   if (name)
       setobjs2s(L, ci->base + (n - 1), L->top - 1);
@@ -157,23 +203,29 @@ LUA_API const char *lua_setlocal (lua_State *L, const lua_Debug *ar, int n) {
 }
 
 
-static void funcinfo (lua_Debug *ar, Closure *cl) {
-  if (cl->c.isC) {
+/* `p' is NULL for a C function */
+static void protoinfo (lua_Debug *ar, Proto *p) {
+  if (p == NULL) {
     ar->source = "=[C]";
     ar->linedefined = -1;
     ar->lastlinedefined = -1;
     ar->what = "C";
   }
   else {
-    ar->source = getstr(cl->l.p->source);
-    ar->linedefined = cl->l.p->linedefined;
-    ar->lastlinedefined = cl->l.p->lastlinedefined;
+    ar->source = getstr(p->source);
+    ar->linedefined = p->linedefined;
+    ar->lastlinedefined = p->lastlinedefined;
     ar->what = (ar->linedefined == 0) ? "main" : "Lua";
   }
   luaO_chunkid(ar->short_src, ar->source, LUA_IDSIZE);
 }
 
 
+static void funcinfo (lua_Debug *ar, Closure *cl) {
+  protoinfo(ar, cl->c.isC ? NULL : cl->l.p);
+}
+
+
 static void info_tailcall (lua_Debug *ar) {
   ar->name = ar->namewhat = "";
   ar->what = "tail";
@@ -189,9 +241,12 @@ static void collectvalidlines (lua_State *L, Closure *f) {
     setnilvalue(L->top);
   }
   else {
-    Table *t = luaH_new(L, 0, 0);
-    int *lineinfo = f->l.p->lineinfo;
+    Table *t;
+    int *lineinfo;
     int i;
+    luaG_needdebug(L, f->l.p);
+    t = luaH_new(L, 0, 0);
+    lineinfo = f->l.p->lineinfo;
     for (i=0; i<f->l.p->sizelineinfo; i++)
       setbvalue(luaH_setnum(L, t, lineinfo[i]), 1);
     sethvalue(L, L->top, t); 
@@ -243,6 +298,7 @@ LUA_API int lua_getinfo (lua_State *L, const char *what, lua_Debug *ar) {
   int status;
   Closure *f = NULL;
   CallInfo *ci = NULL;
+  CallInfo *pci = NULL;
   lua_lock(L);
   if (*what == '>') {
     StkId func = L->top - 1;
@@ -251,12 +307,21 @@ LUA_API int lua_getinfo (lua_State *L, const char *what, lua_Debug *ar) {
     f = clvalue(func);
     L->top--;  /* pop function */
   }
+  else if (ar->i_ci < 0) {  /* pcall run by the VM (see lua_getstack)? */
+    pci = L->base_ci - ar->i_ci;
+    f = clvalue(vmpcallfunc(pci));
+  }
   else if (ar->i_ci != 0) {  /* no tail call? */
     ci = L->base_ci + ar->i_ci;
     lua_assert(ttisfunction(ci->func));
     f = clvalue(ci->func);
   }
   status = auxgetinfo(L, what, ar, f, ci);
+  if (pci && strchr(what, 'n') &&
+      (ar->namewhat = calleename(L, pci, &ar->name)) == NULL) {
+    ar->namewhat = "";  /* not found */
+    ar->name = NULL;
+  }
   if (strchr(what, 'f')) {
     if (f == NULL) setnilvalue(L->top);
     else setclvalue(L, L->top, f);
@@ -269,6 +334,286 @@ LUA_API int lua_getinfo (lua_State *L, const char *what, lua_Debug *ar) {
 }
 
 
+/*
+** {======================================================
+** Sampling profiler: `lua_profsample' (meant to be called from a C hook)
+** copies the Proto+pc of the active frames into a preallocated ring,
+** so taking a sample allocates nothing. The collector keeps the sampled
+** Protos alive until the ring is freed (see markprofile in lgc.c).
+** =======================================================
+*/
+
+/* allocate a ring of `size' samples, dropping the old one (0: just free) */
+LUA_API void lua_profbuffer (lua_State *L, int size) {
+  Profile *pr = &G(L)->prof;
+  lua_lock(L);
+  luaM_freearray(L, pr->buf, pr->size, ProfSample);
+  pr->buf = NULL;
+  pr->size = pr->next = pr->n = 0;
+  if (size > 0) {
+    pr->buf = luaM_newvector(L, size, ProfSample);
+    pr->size = size;
+  }
+  lua_unlock(L);
+}
+
+
+/* copy the Proto+pc of the active frames of `L' to `s' */
+void luaG_stacksample (lua_State *L, ProfSample *s) {
+  CallInfo *ci;
+  int n = 0;
+  for (ci = L->ci; ci > L->base_ci && n < LUAI_PROFDEPTH; ci--, n++) {
+    Proto *p = getluaproto(ci);
+    s->f[n].p = p;
+    s->f[n].pc = p ? currentpc(L, ci) : -1;
+  }
+  s->depth = n;
+}
+
+
+LUA_API void lua_profsample (lua_State *L) {
+  Profile *pr = &G(L)->prof;
+  if (pr->size == 0) return;  /* profiler off */
+  lua_lock(L);
+  luaG_stacksample(L, &pr->buf[pr->next]);
+  pr->next = (pr->next + 1) % pr->size;  /* overwrite the oldest when full */
+  if (pr->n < pr->size) pr->n++;
+  lua_unlock(L);
+}
+
+
+LUA_API int lua_profsamples (lua_State *L) {
+  return G(L)->prof.n;
+}
+
+
+/* "S" and "l" fields of `ar' for Proto `p' (NULL: a C function) at `pc' */
+static void frameinfo (lua_State *L, Proto *p, int pc, lua_Debug *ar) {
+  protoinfo(ar, p);
+  if (p) luaG_needdebug(L, p);
+  ar->currentline = p ? getline(p, pc) : -1;
+}
+
+
+/*
+** fill `ar' ("S" and "l" fields) for frame `level' (0 is the innermost)
+** of sample `sample' (0 is the oldest); return 0 if there is no such frame
+*/
+LUA_API int lua_profframe (lua_State *L, int sample, int level,
+                           lua_Debug *ar) {
+  Profile *pr = &G(L)->prof;
+  ProfFrame *f;
+  int status = 0;
+  lua_lock(L);
+  if (0 <= sample && sample < pr->n) {
+    ProfSample *s = &pr->buf[(pr->next - pr->n + sample + pr->size) % pr->size];
+    if (0 <= level && level < s->depth) {
+      f = &s->f[level];
+      frameinfo(L, f->p, f->pc, ar);
+      status = 1;
+    }
+  }
+  lua_unlock(L);
+  return status;
+}
+
+
+/*
+** Heap profiler (see lmem.c): copy site `site' (0-based) to `hs';
+** return 0 if there is no such site
+*/
+LUA_API int lua_heapsite (lua_State *L, int site, lua_HeapSite *hs) {
+  HeapProfile *hp = &G(L)->heap;
+  int status = 0;
+  lua_lock(L);
+  luaM_heaptype(L, LUA_TNONE);  /* settle the pending sample */
+  if (0 <= site && site < hp->nsites) {
+    HeapSite *s = &hp->sites[site];
+    hs->type = s->tt;
+    hs->depth = s->stack.depth;
+    hs->inuse = s->inuse;
+    hs->inusebytes = s->inusebytes;
+    hs->allocs = s->allocs;
+    hs->allocbytes = s->allocbytes;
+    status = 1;
+  }
+  lua_unlock(L);
+  return status;
+}
+
+
+/* as lua_profframe, for the stack of heap site `site' */
+LUA_API int lua_heapframe (lua_State *L, int site, int level,
+                           lua_Debug *ar) {
+  HeapProfile *hp = &G(L)->heap;
+  int status = 0;
+  lua_lock(L);
+  if (0 <= site && site < hp->nsites &&
+      0 <= level && level < hp->sites[site].stack.depth) {
+    ProfFrame f = hp->sites[site].stack.f[level];  /* decoding may sample */
+    frameinfo(L, f.p, f.pc, ar);
+    status = 1;
+  }
+  lua_unlock(L);
+  return status;
+}
+
+/* }====================================================== */
+
+
+/*
+** {======================================================
+** Debug information decoded on demand
+** A chunk dumped with `luac -d' keeps the line info, local names and
+** upvalue names of all its functions in one string: an int count, an
+** int offset per function (in the order they are dumped) and the
+** entries, made of ULEB128 numbers (see DumpLazyDebug in ldump.c). A
+** bad entry just leaves its function without debug information.
+** =======================================================
+*/
+
+typedef struct DebugReader {
+  const char *p;
+  const char *end;
+  int bad;
+} DebugReader;
+
+
+static size_t readuleb (DebugReader *r) {
+  size_t x = 0;
+  int shift = 0;
+  for (;;) {
+    int b;
+    if (r->p >= r->end || shift >= cast_int(8 * sizeof(size_t))) {
+      r->bad = 1;
+      return 0;
+    }
+    b = cast(unsigned char, *r->p++);
+    x |= cast(size_t, b & 0x7f) << shift;
+    if ((b & 0x80) == 0) return x;
+    shift += 7;
+  }
+}
+
+
+/* a count of items taking at least one byte each */
+static int readcount (DebugReader *r) {
+  size_t n = readuleb(r);
+  if (n > cast(size_t, r->end - r->p)) {
+    r->bad = 1;
+    return 0;
+  }
+  return cast_int(n);
+}
+
+
+static TString *readname (lua_State *L, DebugReader *r) {
+  size_t l = readuleb(r);
+  TString *ts;
+  if (r->bad || l > cast(size_t, r->end - r->p)) {
+    r->bad = 1;
+    return NULL;
+  }
+  ts = luaS_newlstr(L, r->p, l);
+  r->p += l;
+  return ts;
+}
+
+
+static void readlines (lua_State *L, Proto *f, DebugReader *r) {
+  int n = readcount(r);
+  int i, line = 0;
+  int *li;
+  if (n != 0 && n != f->sizecode)
+    r->bad = 1;
+  if (n == 0 || r->bad)
+    return;
+  li = luaM_newvector(L, n, int);
+  for (i = 0; i < n; i++) {
+    size_t z = readuleb(r);
+    int d = cast_int(z >> 1);
+    line += (z & 1) ? -d - 1 : d;
+    li[i] = line;
+  }
+  if (r->bad)
+    luaM_freearray(L, li, n, int);
+  else {
+    f->lineinfo = li;
+    f->sizelineinfo = n;
+  }
+}
+
+
+static void readlocvars (lua_State *L, Proto *f, DebugReader *r) {
+  int n = readcount(r);
+  int i;
+  LocVar *lv;
+  if (n == 0 || r->bad)
+    return;
+  lv = luaM_newvector(L, n, LocVar);
+  for (i = 0; i < n && !r->bad; i++) {
+    lv[i].varname = readname(L, r);
+    lv[i].startpc = cast_int(readuleb(r));
+    lv[i].endpc = cast_int(readuleb(r));
+  }
+  if (r->bad)
+    luaM_freearray(L, lv, n, LocVar);  /* names are left to the collector */
+  else {
+    f->locvars = lv;
+    f->sizelocvars = n;
+    for (i = 0; i < n; i++)
+      luaC_objbarrier(L, f, lv[i].varname);
+  }
+}
+
+
+static void readupvalues (lua_State *L, Proto *f, DebugReader *r) {
+  int n = readcount(r);
+  int i;
+  TString **uv;
+  if (n != 0 && n != f->nups)
+    r->bad = 1;
+  if (n == 0 || r->bad)
+    return;
+  uv = luaM_newvector(L, n, TString *);
+  for (i = 0; i < n && !r->bad; i++)
+    uv[i] = readname(L, r);
+  if (r->bad)
+    luaM_freearray(L, uv, n, TString *);
+  else {
+    f->upvalues = uv;
+    f->sizeupvalues = n;
+    for (i = 0; i < n; i++)
+      luaC_objbarrier(L, f, uv[i]);
+  }
+}
+
+
+void luaG_loaddebug (lua_State *L, Proto *f) {
+  TString *sec = f->debugsec;
+  const char *s = getstr(sec);
+  size_t len = sec->tsv.len;
+  DebugReader r;
+  int n, off;
+  f->debugsec = NULL;  /* now or never */
+  if (len < sizeof(int)) return;
+  memcpy(&n, s, sizeof(int));
+  if (f->debugidx < 0 || f->debugidx >= n ||
+      cast(size_t, n) > (len - sizeof(int)) / sizeof(int))
+    return;
+  memcpy(&off, s + sizeof(int) * (1 + f->debugidx), sizeof(int));
+  if (off < 0 || cast(size_t, off) > len) return;
+  r.p = s + off;
+  r.end = s + len;
+  r.bad = 0;
+  readlines(L, f, &r);
+  readlocvars(L, f, &r);
+  readupvalues(L, f, &r);
+}
+
+/* }====================================================== */
+
+
 /*
 ** {======================================================
 ** Symbolic Execution and code checker
@@ -404,6 +749,19 @@ static Instruction symbexec (const Proto *pt, int lastpc, int reg) {
         check(ttisstring(&pt->k[b]));
         break;
       }
+      case OP_GGETCALL: {  /* the VM runs the next one unchecked */
+        check(ttisstring(&pt->k[b]));
+        check(pc+1 < pt->sizecode);
+        check(GET_OPCODE(pt->code[pc+1]) == OP_CALL &&
+              GETARG_A(pt->code[pc+1]) == a);
+        break;
+      }
+      case OP_GETTABLE2: {
+        check(ISK(c) && ttisstring(&pt->k[INDEXK(c)]));
+        check(pc+1 < pt->sizecode);
+        check(GET_OPCODE(pt->code[pc+1]) == OP_GETTABLE);
+        break;
+      }
       case OP_SELF: {
         checkreg(pt, a+1);
         if (reg == a+1) last = pc;
@@ -413,6 +771,11 @@ static Instruction symbexec (const Proto *pt, int lastpc, int reg) {
         check(b < c);  /* at least two operands */
         break;
       }
+      case OP_ADDK: case OP_SUBK: case OP_MULK:
+      case OP_DIVK: case OP_MODK: {
+        check(ISK(c) && ttisnumber(&pt->k[INDEXK(c)]));
+        break;
+      }
       case OP_TFORLOOP: {
         check(c >= 1);  /* at least one result (control variable) */
         checkreg(pt, a+2+c);  /* space for results */
@@ -510,13 +873,15 @@ static const char *getobjname (lua_State *L, CallInfo *ci, int stackpos,
     Proto *p = ci_func(ci)->l.p;
     int pc = currentpc(L, ci);
     Instruction i;
+    luaG_needdebug(L, p);
     *name = luaF_getlocalname(p, stackpos+1, pc);
     if (*name)  /* is a local? */
       return "local";
     i = symbexec(p, pc, stackpos);  /* try symbolic execution */
     lua_assert(pc != -1);
     switch (GET_OPCODE(i)) {
-      case OP_GETGLOBAL: {
+      case OP_GETGLOBAL:
+      case OP_GGETCALL: {
         int g = GETARG_Bx(i);  /* global index */
         lua_assert(ttisstring(&p->k[g]));
         *name = svalue(&p->k[g]);
@@ -529,7 +894,8 @@ static const char *getobjname (lua_State *L, CallInfo *ci, int stackpos,
           return getobjname(L, ci, b, name);  /* get name for `b' */
         break;
       }
-      case OP_GETTABLE: {
+      case OP_GETTABLE:
+      case OP_GETTABLE2: {
         int k = GETARG_C(i);  /* key index */
         *name = kname(p, k);
         return "field";
@@ -551,12 +917,9 @@ static const char *getobjname (lua_State *L, CallInfo *ci, int stackpos,
 }
 
 
-static const char *getfuncname (lua_State *L, CallInfo *ci, const char **name) {
-  Instruction i;
-  if ((isLua(ci) && ci->tailcalls > 0) || !isLua(ci - 1))
-    return NULL;  /* calling function is not Lua (or is unknown) */
-  ci--;  /* calling function */
-  i = ci_func(ci)->l.p->code[currentpc(L, ci)];
+/* name of the function that the Lua function of `ci' is calling */
+static const char *calleename (lua_State *L, CallInfo *ci, const char **name) {
+  Instruction i = ci_func(ci)->l.p->code[currentpc(L, ci)];
   if (GET_OPCODE(i) == OP_CALL || GET_OPCODE(i) == OP_TAILCALL ||
       GET_OPCODE(i) == OP_TFORLOOP)
     return getobjname(L, ci, GETARG_A(i), name);
@@ -565,6 +928,13 @@ static const char *getfuncname (lua_State *L, CallInfo *ci, const char **name) {
 }
 
 
+static const char *getfuncname (lua_State *L, CallInfo *ci, const char **name) {
+  if ((isLua(ci) && ci->tailcalls > 0) || !isLua(ci - 1) || (ci - 1)->pcall)
+    return NULL;  /* calling function is not Lua (or is unknown) */
+  return calleename(L, ci - 1, name);
+}
+
+
 /* only ANSI way to check whether a pointer points to an array */
 static int isinstack (CallInfo *ci, const TValue *o) {
   StkId p;
@@ -18,6 +18,15 @@
 
 #define resethookcount(L)	(L->hookcount = L->basehookcount)
 
+/* bit of `hookmask' set when the instruction budget ran out (luaD_budget) */
+#define MASKBUDGET	(1 << 7)
+#define resetbudget(L) \
+	(L->budget = (L->basebudget > 0) ? L->basebudget : MAX_INT)
+
+/* debug info of `p' is still in its chunk's section: decode it */
+#define luaG_needdebug(L,p) \
+	((void)((p)->debugsec != NULL && (luaG_loaddebug(L, p), 1)))
+
 
 LUAI_FUNC void luaG_typeerror (lua_State *L, const TValue *o,
                                              const char *opname);
@@ -29,6 +38,8 @@ LUAI_FUNC int luaG_ordererror (lua_State *L, const TValue *p1,
 LUAI_FUNC void luaG_runerror (lua_State *L, const char *fmt, ...);
 LUAI_FUNC void luaG_errormsg (lua_State *L);
 LUAI_FUNC int luaG_checkcode (const Proto *pt);
+LUAI_FUNC void luaG_loaddebug (lua_State *L, Proto *f);
+LUAI_FUNC void luaG_stacksample (lua_State *L, ProfSample *s);
 LUAI_FUNC int luaG_checkopenop (Instruction i);
 LUAI_FUNC void luaG_printf(char *fmt, TValue *v);
 LUAI_FUNC void luaG_printString(char *fmt, TString *v);
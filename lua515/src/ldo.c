@@ -169,6 +169,7 @@ void luaD_reallocCI (lua_State *L, int newsize) {
 
 
 void luaD_growstack (lua_State *L, int n) {
+  luai_stat(L, stackgrows, 1);
   if (n <= L->stacksize)  /* double size is enough? */
     luaD_reallocstack(L, 2*L->stacksize);
   else
@@ -180,6 +181,7 @@ static CallInfo *growCI (lua_State *L) {
   if (L->size_ci > LUAI_MAXCALLS)  /* overflow while handling overflow? 嵌套调用层次太深了，直接报错，方便用户检查调用情况 */
     luaD_throw(L, LUA_ERRERR);
   else {
+    luai_stat(L, cigrows, 1);
     luaD_reallocCI(L, 2*L->size_ci);	/* 简单粗暴，直接扩大一倍 */
     if (L->size_ci > LUAI_MAXCALLS)
       luaG_runerror(L, "stack overflow");
@@ -226,6 +228,38 @@ void luaD_callhook (lua_State *L, int event, int line) {
   }
 }
 
+/*
+** the instruction budget of `L' ran out (lua_setbudget): start a new
+** round and ask the host; stopping yields the thread, with no values,
+** if it can, or else raises an error. Called between two instructions,
+** as the count hook (see traceexec)
+*/
+void luaD_budget (lua_State *L) {
+  int stop = 1;
+  L->hookmask &= ~MASKBUDGET;
+  resetbudget(L);
+  if (L->basebudget == 0)  /* no budget: the counter just ran long */
+    return;
+  if (L->budgetf != NULL) {
+    ptrdiff_t top = savestack(L, L->top);
+    ptrdiff_t ci_top = savestack(L, L->ci->top);
+    luaD_checkstack(L, LUA_MINSTACK);  /* ensure minimum stack size */
+    L->ci->top = L->top + LUA_MINSTACK;
+    lua_unlock(L);
+    stop = (*L->budgetf)(L, L->budgetud);
+    lua_lock(L);
+    L->ci->top = restorestack(L, ci_top);
+    L->top = restorestack(L, top);
+  }
+  if (stop) {
+    if (L->nCcalls > L->baseCcalls)  /* cannot yield? */
+      luaG_runerror(L, "instruction budget exhausted");
+    L->base = L->top;  /* as lua_yield(L, 0) */
+    L->status = LUA_YIELD;
+  }
+}
+
+
 /*
 **补齐固定形参(若实际传入的参数不够)
 **将传给固定形参的值mv到top之上且纠正top
@@ -251,7 +285,7 @@ static StkId adjust_varargs (lua_State *L, Proto *p, int actual) {
     for (i=0; i<nvar; i++)  /* put extra arguments into `arg' table */
       setobj2n(L, luaH_setnum(L, htab, i+1), L->top - nvar + i);
     /* store counter in field `n' */
-    setnvalue(luaH_setstr(L, htab, luaS_newliteral(L, "n")), cast_num(nvar));
+    setivalue(luaH_setstr(L, htab, luaS_newliteral(L, "n")), nvar);
   }
 #endif
   /* move fixed parameters to final position */
@@ -329,6 +363,7 @@ int luaD_precall (lua_State *L, StkId func, int nresults) {
     }
     ci = inc_ci(L);  /* now `enter' new function */
     ci->func = func;
+    ci->pcall = 0;
     L->base = ci->base = base;
 	/* 这里可以推导出L->base---->L->top之间的区域都是ci的私有栈空间(lua,c均如此) */
     ci->top = L->base + p->maxstacksize;
@@ -362,6 +397,7 @@ int luaD_precall (lua_State *L, StkId func, int nresults) {
 	/* 填充新的CallInfo */
     ci = inc_ci(L);  /* now `enter' new function */
     ci->func = restorestack(L, funcr);
+    ci->pcall = 0;
     L->base = ci->base = ci->func + 1;	/* C函数没有Lua函数的变参问题，所以这里无需adjust_varargs() */
 	/* "OP_CALL指令"已经将L->top指向了最后一个传入参数的上方 */
     ci->top = L->top + LUA_MINSTACK;	/* 这里和上面luaD_checkstack呼应 */
@@ -382,6 +418,15 @@ int luaD_precall (lua_State *L, StkId func, int nresults) {
   }
 }
 
+/* a pcall run by the VM returns normally: `true' goes before the results */
+static void endvmpcall (lua_State *L, CallInfo *ci) {
+  ci->pcall = 0;
+  L->nCcalls = ci->pcnCcalls;
+  L->errfunc = ci->pcerrfunc;
+  setbvalue(vmpcallfunc(ci), 1);
+}
+
+
 /* 函数调用结束后，处理实际返回值和期待返回值的匹配问题
 ** 也处理ci链的嵌套逻辑（本层ci结束往后退一层)
 **
@@ -400,6 +445,8 @@ int luaD_poscall (lua_State *L, StkId firstResult) {
   wanted = ci->nresults;
   L->base = (ci - 1)->base;  /* restore base */
   L->savedpc = (ci - 1)->savedpc;  /* restore savedpc */
+  if ((ci - 1)->pcall)  /* end of a pcall run by the VM? */
+    endvmpcall(L, ci - 1);
   
   /* move results to correct place */
   for (i = wanted; i != 0 && firstResult < L->top; i--)	/* 这个判断即处理非尾调用，又处理了尾调用 */
@@ -418,6 +465,95 @@ int luaD_poscall (lua_State *L, StkId firstResult) {
 }
 
 
+/*
+** Call the leaf C function at `func' (lua_setleaf) from a Lua function,
+** without a CallInfo of its own: the caller's one is lent to it, with
+** the base moved to the arguments, and given back once the results are
+** moved to `func' as in `luaD_poscall'. No hooks are called.
+*/
+void luaD_leafcall (lua_State *L, StkId func, int nresults) {
+  ptrdiff_t funcr = savestack(L, func);
+  ptrdiff_t base = savestack(L, L->ci->base), top = savestack(L, L->ci->top);
+  StkId res, firstResult;
+  int n, i;
+  luaD_checkstack(L, LUA_MINSTACK);
+  func = restorestack(L, funcr);
+  L->base = L->ci->base = func + 1;
+  L->ci->top = L->top + LUA_MINSTACK;
+  L->nCcalls++;  /* no yields */
+  lua_unlock(L);
+  n = (*clvalue(func)->c.f)(L);
+  lua_lock(L);
+  L->nCcalls--;
+  lua_assert(n >= 0 && L->top - n >= L->base);
+  L->base = L->ci->base = restorestack(L, base);
+  L->ci->top = restorestack(L, top);
+  res = restorestack(L, funcr);
+  firstResult = L->top - n;
+  for (i = nresults; i != 0 && firstResult < L->top; i--)
+    setobjs2s(L, res++, firstResult++);
+  while (i-- > 0)
+    setnilvalue(res++);
+  L->top = res;
+}
+
+
+/*
+** Run pcall(f, ...), at `func' in the current Lua function, with a Lua
+** function `f' as a plain Lua call (the VM restarts over `f'): no C
+** frame nor setjmp of its own. The calling frame keeps what lua_pcall
+** would have saved, for luaD_poscall and luaD_vmpcallerror to restore,
+** and the luaV_execute running it catches the errors. The pcall stays
+** at `func' during the call, so the debug interface still sees it as a
+** C function of its own (lua_getstack).
+*/
+int luaD_vmpcall (lua_State *L, StkId func, int nresults) {
+  CallInfo *ci = L->ci;
+  ci->savedpc = L->savedpc;
+  ci->pcall = 1;
+  ci->pcallowhook = L->allowhook;
+  ci->pcnCcalls = L->nCcalls;
+  ci->pcerrfunc = L->errfunc;
+  L->nCcalls++;  /* no yields across it, as for lua_pcall */
+  L->errfunc = 0;
+  return luaD_precall(L, func + 1, (nresults > 0) ? nresults - 1 : nresults);
+}
+
+
+/*
+** An error reached the luaV_execute that started at `base': finish the
+** innermost pcall that it runs in the VM as luaD_pcall would, with
+** `false' and the error object as results, and go back to its caller.
+** Returns 0 if no such pcall is running (the error goes on).
+*/
+int luaD_vmpcallerror (lua_State *L, CallInfo *base, int status) {
+  CallInfo *ci;
+  StkId func;
+  int nresults;
+  for (ci = L->ci; !ci->pcall; ci--)
+    if (ci == base) return 0;
+  func = vmpcallfunc(ci);
+  nresults = GETARG_C(*(ci->savedpc - 1)) - 1;
+  luaF_close(L, func + 1);  /* close eventual pending closures */
+  luaD_seterrorobj(L, status, func + 1);
+  L->ci = ci;
+  L->base = ci->base;
+  L->savedpc = ci->savedpc;
+  L->allowhook = ci->pcallowhook;
+  endvmpcall(L, ci);
+  setbvalue(func, 0);
+  if (nresults >= 0) {
+    while (L->top < func + nresults)
+      setnilvalue(L->top++);
+    L->top = ci->top;
+  }
+  restore_stack_limit(L);
+  if (status == LUA_ERRMEM && G(L)->memlimit != MAX_LUMEM)
+    luaC_fullgc(L);  /* collect what the call left (see lua_setmemlimit) */
+  return 1;
+}
+
+
 /*
 ** Call a function (C or Lua). The function to be called is at *func.
 ** The arguments are on the stack, right after the function.
@@ -457,8 +593,11 @@ static void resume (lua_State *L, void *ud) {
       if (luaD_poscall(L, firstArg))  /* complete it... 结束上述说的baselib.yield的调用流程 */
         L->top = L->ci->top;  /* and correct top if not multiple results,如果是 multiple results则由跟在后面的vararg或者setlist来调整L->top(他们还需要用到L->top来确定传入参数的个数呢,所以这里不能将其恢复到L->ci->top，) */
     }
-    else  /* yielded inside a hook: just continue its execution */
+    else {  /* yielded inside a hook: just continue its execution */
       L->base = L->ci->base;
+      L->top = firstArg;  /* values passed to resume are dropped */
+      L->ci->top = L->base + ci_func(ci)->l.p->maxstacksize;  /* (see lua_checkstack) */
+    }
   }
   
   luaV_execute(L, cast_int(L->ci - L->base_ci));	/* 这里的nexeccalls值得好好推导一下 */
@@ -514,6 +653,12 @@ LUA_API int lua_yield (lua_State *L, int nresults) {
   return -1;	/* note:这是一个特殊的值，用于标识从yield返回 */
 }
 
+
+/* can a C function running in `L' yield now? (not under a C call) */
+LUA_API int lua_isyieldable (lua_State *L) {
+  return L->nCcalls <= L->baseCcalls && L->ci != L->base_ci;
+}
+
 /* 
 ** old_top 指向被调用函数slot 
 */
@@ -541,6 +686,8 @@ int luaD_pcall (lua_State *L, Pfunc func, void *u,
     L->savedpc = L->ci->savedpc;
     L->allowhook = old_allowhooks;
     restore_stack_limit(L);
+    if (status == LUA_ERRMEM && G(L)->memlimit != MAX_LUMEM)
+      luaC_fullgc(L);  /* collect what the call left (see lua_setmemlimit) */
   }
   L->errfunc = old_errfunc;
   return status;
@@ -557,6 +704,7 @@ struct SParser {  /* data to `f_parser' */
   ZIO *z;			/* 底层的io句柄(C++称为对象) */
   Mbuffer buff;  	/* buffer to be used by the scanner */
   const char *name;	/* chunk name */
+  int mode;		/* LUAU_* modes for a binary chunk */
 };
 
 static void f_parser (lua_State *L, void *ud) {
@@ -566,8 +714,10 @@ static void f_parser (lua_State *L, void *ud) {
   struct SParser *p = cast(struct SParser *, ud);
   int c = luaZ_lookahead(p->z);
   luaC_checkGC(L);
-  tf = ((c == LUA_SIGNATURE[0]) ? luaU_undump : luaY_parser)(L, p->z,
-                                                             &p->buff, p->name);
+  if (c == LUA_SIGNATURE[0])
+    tf = luaU_undump(L, p->z, &p->buff, p->name, p->mode);
+  else
+    tf = luaY_parser(L, p->z, &p->buff, p->name);
   cl = luaF_newLclosure(L, tf->nups, hvalue(gt(L)));	/* 新生成的clouse的env直接来自gobal'table而不是上层函数的env */
   cl->l.p = tf;
   for (i = 0; i < tf->nups; i++)  /* initialize eventual upvalues */
@@ -577,10 +727,11 @@ static void f_parser (lua_State *L, void *ud) {
 }
 
 
-int luaD_protectedparser (lua_State *L, ZIO *z, const char *name) {
+int luaD_protectedparser (lua_State *L, ZIO *z, const char *name,
+                          int mode) {
   struct SParser p;
   int status;
-  p.z = z; p.name = name;
+  p.z = z; p.name = name; p.mode = mode;
   luaZ_initbuffer(L, &p.buff);
   status = luaD_pcall(L, f_parser, &p, savestack(L, L->top), L->errfunc);
   luaZ_freebuffer(L, &p.buff);
@@ -588,3 +739,22 @@ int luaD_protectedparser (lua_State *L, ZIO *z, const char *name) {
 }
 
 
+static void f_parsedata (lua_State *L, void *ud) {
+  struct SParser *p = cast(struct SParser *, ud);
+  luaC_checkGC(L);
+  luaY_parsedata(L, p->z, &p->buff, p->name);
+}
+
+
+/* 数据chunk: 解析出的值(而不是函数)压栈 */
+int luaD_protectedparsedata (lua_State *L, ZIO *z, const char *name) {
+  struct SParser p;
+  int status;
+  p.z = z; p.name = name; p.mode = 0;
+  luaZ_initbuffer(L, &p.buff);
+  status = luaD_pcall(L, f_parsedata, &p, savestack(L, L->top), L->errfunc);
+  luaZ_freebuffer(L, &p.buff);
+  return status;
+}
+
+
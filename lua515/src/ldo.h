@@ -30,6 +30,11 @@
 #define restoreci(L,n)		((CallInfo *)((char *)L->base_ci + (n)))
 
 
+/* register of the pcall that the Lua function of `ci' runs in the VM
+** (luaD_vmpcall); needs lopcodes.h */
+#define vmpcallfunc(ci)	((ci)->base + GETARG_A(*((ci)->savedpc - 1)))
+
+
 /* results from luaD_precall */
 #define PCRLUA		0	/* initiated a call to a Lua function */
 #define PCRC		1	/* did a call to a C function */
@@ -39,13 +44,19 @@
 /* type of protected functions, to be ran by `runprotected' */
 typedef void (*Pfunc) (lua_State *L, void *ud);
 
-LUAI_FUNC int luaD_protectedparser (lua_State *L, ZIO *z, const char *name);
+LUAI_FUNC int luaD_protectedparser (lua_State *L, ZIO *z, const char *name,
+                                    int mode);
+LUAI_FUNC int luaD_protectedparsedata (lua_State *L, ZIO *z, const char *name);
 LUAI_FUNC void luaD_callhook (lua_State *L, int event, int line);
+LUAI_FUNC void luaD_budget (lua_State *L);
 LUAI_FUNC int luaD_precall (lua_State *L, StkId func, int nresults);
 LUAI_FUNC void luaD_call (lua_State *L, StkId func, int nResults);
 LUAI_FUNC int luaD_pcall (lua_State *L, Pfunc func, void *u,
                                         ptrdiff_t oldtop, ptrdiff_t ef);
 LUAI_FUNC int luaD_poscall (lua_State *L, StkId firstResult);
+LUAI_FUNC void luaD_leafcall (lua_State *L, StkId func, int nresults);
+LUAI_FUNC int luaD_vmpcall (lua_State *L, StkId func, int nresults);
+LUAI_FUNC int luaD_vmpcallerror (lua_State *L, CallInfo *base, int status);
 LUAI_FUNC void luaD_reallocCI (lua_State *L, int newsize);
 LUAI_FUNC void luaD_reallocstack (lua_State *L, int newsize);
 LUAI_FUNC void luaD_growstack (lua_State *L, int n);
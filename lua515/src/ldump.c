@@ -11,6 +11,7 @@
 
 #include "lua.h"
 
+#include "ldebug.h"
 #include "lobject.h"
 #include "lstate.h"
 #include "lundump.h"
@@ -19,7 +20,10 @@ typedef struct {
  lua_State* L;
  lua_Writer writer;
  void* data;
- int strip;
+ int strip;				/* 0, 1 or LUAU_STRIPLAZY */
+ int image;				/* LUAC_FORMAT_IMAGE: align code and line info */
+ int noescape;				/* LUAC_FORMAT_NOESCAPE */
+ size_t pos;				/* bytes written so far */
  int status;
 } DumpState;
 
@@ -34,6 +38,14 @@ static void DumpBlock(const void* b, size_t size, DumpState* D)
   D->status=(*D->writer)(D->L,b,size,D->data);
   lua_lock(D->L);
  }
+ D->pos+=size;
+}
+
+static void DumpAlign(DumpState* D)
+{
+ static const char pad[LUAC_IMAGEALIGN]={0};
+ if (D->image && D->pos%LUAC_IMAGEALIGN!=0)
+  DumpBlock(pad,LUAC_IMAGEALIGN-D->pos%LUAC_IMAGEALIGN,D);
 }
 
 static void DumpChar(int y, DumpState* D)
@@ -55,6 +67,7 @@ static void DumpNumber(lua_Number x, DumpState* D)
 static void DumpVector(const void* b, int n, size_t size, DumpState* D)
 {
  DumpInt(n,D);
+ DumpAlign(D);
  DumpMem(b,n,size,D);
 }
 
@@ -128,37 +141,161 @@ static void DumpDebug(const Proto* f, DumpState* D)
 
 static void DumpFunction(const Proto* f, const TString* p, DumpState* D)
 {
- DumpString((f->source==p || D->strip) ? NULL : f->source,D);
+ if (f->debugsec!=NULL) luaG_loaddebug(D->L,(Proto*)f);
+ DumpString((f->source==p || D->strip==1) ? NULL : f->source,D);
  DumpInt(f->linedefined,D);
  DumpInt(f->lastlinedefined,D);
  DumpChar(f->nups,D);
  DumpChar(f->numparams,D);
  DumpChar(f->is_vararg,D);
  DumpChar(f->maxstacksize,D);
+ if (D->noescape) DumpChar(f->noescape,D);
  DumpCode(f,D);
  DumpConstants(f,D);
  DumpDebug(f,D);
 }
 
+/*
+** debug section of LUAU_STRIPLAZY, decoded by luaG_loaddebug: an int
+** count, an int offset per function in the order DumpFunction visits
+** them, then their entries. An entry is made of ULEB128 numbers: the
+** line info as zigzag deltas, the locals with their pcs, the upvalues.
+*/
+
+static int NullWriter(lua_State* L, const void* b, size_t size, void* ud)
+{
+ UNUSED(L); UNUSED(b); UNUSED(size); UNUSED(ud);
+ return 0;
+}
+
+static void DumpULEB(size_t x, DumpState* D)
+{
+ char b[(8*sizeof(size_t)+6)/7];
+ int n=0;
+ do
+ {
+  b[n]=(char)(x&0x7f);
+  x>>=7;
+  if (x!=0) b[n]|=(char)0x80;
+  n++;
+ } while (x!=0);
+ DumpBlock(b,n,D);
+}
+
+static void DumpName(const TString* s, DumpState* D)
+{
+ size_t l=(s==NULL) ? 0 : s->tsv.len;
+ DumpULEB(l,D);
+ if (l>0) DumpBlock(getstr(s),l,D);
+}
+
+static void DumpEntry(const Proto* f, DumpState* D)
+{
+ int i,line=0;
+ DumpULEB(f->sizelineinfo,D);
+ for (i=0; i<f->sizelineinfo; i++)
+ {
+  int d=f->lineinfo[i]-line;
+  DumpULEB((d>=0) ? (size_t)d<<1 : ((size_t)(-(d+1))<<1)|1,D);
+  line=f->lineinfo[i];
+ }
+ DumpULEB(f->sizelocvars,D);
+ for (i=0; i<f->sizelocvars; i++)
+ {
+  DumpName(f->locvars[i].varname,D);
+  DumpULEB(f->locvars[i].startpc,D);
+  DumpULEB(f->locvars[i].endpc,D);
+ }
+ DumpULEB(f->sizeupvalues,D);
+ for (i=0; i<f->sizeupvalues; i++) DumpName(f->upvalues[i],D);
+}
+
+/* size of the entry of f */
+static size_t EntrySize(const Proto* f, DumpState* D)
+{
+ DumpState C=*D;
+ C.writer=NullWriter;
+ C.image=0;
+ C.pos=0;
+ C.status=0;
+ DumpEntry(f,&C);
+ return C.pos;
+}
+
+/* count the functions under f and the size of their entries */
+static void CountEntries(const Proto* f, int* n, size_t* size, DumpState* D)
+{
+ int i;
+ (*n)++;
+ *size+=EntrySize(f,D);
+ for (i=0; i<f->sizep; i++) CountEntries(f->p[i],n,size,D);
+}
+
+static void DumpOffsets(const Proto* f, int* off, DumpState* D)
+{
+ int i;
+ DumpInt(*off,D);
+ *off+=(int)EntrySize(f,D);
+ for (i=0; i<f->sizep; i++) DumpOffsets(f->p[i],off,D);
+}
+
+static void DumpEntries(const Proto* f, DumpState* D)
+{
+ int i;
+ DumpEntry(f,D);
+ for (i=0; i<f->sizep; i++) DumpEntries(f->p[i],D);
+}
+
+static void DumpLazyDebug(const Proto* f, DumpState* D)
+{
+ int n=0,off;
+ size_t size=0,len;
+ CountEntries(f,&n,&size,D);
+ off=(int)(sizeof(int)*(1+n));
+ len=off+size+1;			/* include trailing '\0', as DumpString */
+ DumpVar(len,D);
+ DumpInt(n,D);
+ DumpOffsets(f,&off,D);
+ DumpEntries(f,D);
+ DumpChar(0,D);
+}
+
 static void DumpHeader(DumpState* D)
 {
  char h[LUAC_HEADERSIZE];
+ int format=LUAC_FORMAT;
  luaU_header(h);
+ if (D->image) format|=LUAC_FORMAT_IMAGE;
+ if (D->strip==LUAU_STRIPLAZY) format|=LUAC_FORMAT_LAZYDEBUG;
+ if (D->noescape) format|=LUAC_FORMAT_NOESCAPE;
+ h[sizeof(LUA_SIGNATURE)]=(char)format;
  DumpBlock(h,LUAC_HEADERSIZE,D);
 }
 
+static int HasNoEscape(const Proto* f)
+{
+ int i;
+ if (f->noescape) return 1;
+ for (i=0; i<f->sizep; i++) if (HasNoEscape(f->p[i])) return 1;
+ return 0;
+}
+
 /*
 ** dump Lua function as precompiled chunk
 */
-int luaU_dump (lua_State* L, const Proto* f, lua_Writer w, void* data, int strip)
+int luaU_dump (lua_State* L, const Proto* f, lua_Writer w, void* data, int strip, int image)
 {
  DumpState D;
  D.L=L;
  D.writer=w;
  D.data=data;
  D.strip=strip;
+ D.image=image;
+ D.noescape=HasNoEscape(f);
+ D.pos=0;
  D.status=0;
  DumpHeader(&D);
  DumpFunction(f,NULL,&D);
+ if (strip==LUAU_STRIPLAZY) DumpLazyDebug(f,&D);
  return D.status;
 }
@@ -24,6 +24,10 @@ Closure *luaF_newCclosure (lua_State *L, int nelems, Table *e) {
   Closure *c = cast(Closure *, luaM_malloc(L, sizeCclosure(nelems)));
   luaC_link(L, obj2gco(c), LUA_TFUNCTION);
   c->c.isC = 1;
+  c->c.bitop = 0;
+  c->c.leaf = 0;
+  c->c.iter = 0;
+  c->c.pcall = 0;
   c->c.env = e; // 继承环境变量，下同
   c->c.nupvalues = cast_byte(nelems);
   return c;
@@ -37,6 +41,10 @@ Closure *luaF_newLclosure (lua_State *L, int nelems, Table *e) {
   Closure *c = cast(Closure *, luaM_malloc(L, sizeLclosure(nelems)));
   luaC_link(L, obj2gco(c), LUA_TFUNCTION);
   c->l.isC = 0;
+  c->l.bitop = 0;
+  c->l.leaf = 0;
+  c->l.iter = 0;
+  c->l.pcall = 0;
   c->l.env = e;	/* 环境表 */
   c->l.nupvalues = cast_byte(nelems);
   while (nelems--) c->l.upvals[nelems] = NULL;
@@ -70,6 +78,7 @@ UpVal *luaF_findupval (lua_State *L, StkId level) {
 
   /* upval "第一次被出现" */
   uv = luaM_new(L, UpVal);  /* not found: create a new one */
+  luaM_heaptag(L, uv, LUA_TUPVAL);
   uv->tt = LUA_TUPVAL;
   uv->marked = luaC_white(g);
   uv->v = level;  /* current value lives in the stack */
@@ -130,6 +139,9 @@ Proto *luaF_newproto (lua_State *L) {
   f->sizep = 0;
   f->code = NULL;
   f->sizecode = 0;
+  f->icache = NULL;
+  f->cache = NULL;
+  f->noescape = 0;
   f->sizelineinfo = 0;
   f->sizeupvalues = 0;
   f->nups = 0;
@@ -137,6 +149,9 @@ Proto *luaF_newproto (lua_State *L) {
   f->numparams = 0;
   f->is_vararg = 0;
   f->maxstacksize = 0;
+  f->inimage = 0;
+  f->debugidx = 0;
+  f->debugsec = NULL;
   f->lineinfo = NULL;
   f->sizelocvars = 0;
   f->locvars = NULL;
@@ -148,10 +163,14 @@ Proto *luaF_newproto (lua_State *L) {
 
 
 void luaF_freeproto (lua_State *L, Proto *f) {
-  luaM_freearray(L, f->code, f->sizecode, Instruction);
+  if (!(f->inimage & PROTO_CODEIMG))
+    luaM_freearray(L, f->code, f->sizecode, Instruction);
+  if (f->icache)
+    luaM_freearray(L, f->icache, f->sizecode, ICache);
   luaM_freearray(L, f->p, f->sizep, Proto *);
   luaM_freearray(L, f->k, f->sizek, TValue);
-  luaM_freearray(L, f->lineinfo, f->sizelineinfo, int);
+  if (!(f->inimage & PROTO_LINEIMG))
+    luaM_freearray(L, f->lineinfo, f->sizelineinfo, int);
   luaM_freearray(L, f->locvars, f->sizelocvars, struct LocVar);
   luaM_freearray(L, f->upvalues, f->sizeupvalues, TString *);
   luaM_free(L, f);
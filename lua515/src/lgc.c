@@ -12,7 +12,9 @@
 */
 
 
+#include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
 /* 这个宏定义不知道有何用，哈哈 */
 #define lgc_c	
@@ -32,16 +34,23 @@
 #include "ltable.h"
 #include "ltm.h"
 
+#if defined(LUA_USE_PTHREADS)
+#include <pthread.h>
+#endif
+
 
 #define GCSTEPSIZE	1024u
 #define GCSWEEPMAX	40
 #define GCSWEEPCOST	10
 #define GCFINALIZECOST	100
+#define MINCLEARLOG	64
+#define MAXCONVERGE	16	/* passes over ephemerons before `atomic' */
+#define SWEEPBATCH	(64*1024)
 
-/* 11111000 */
-#define maskmarks	cast_byte(~(bitmask(BLACKBIT)|WHITEBITS))
+/* 01111000 */
+#define maskmarks	cast_byte(~(bitmask(BLACKBIT)|WHITEBITS|bitmask(OLDBIT)))
 
-/* 清空black.bit和white0.1.bit,重新打上current_white */
+/* 清空black.bit,white0.1.bit和old.bit,重新打上current_white */
 #define makewhite(g,x)	\
    ((x)->gch.marked = cast_byte(((x)->gch.marked & maskmarks) | luaC_white(g)))
    
@@ -49,8 +58,9 @@
 #define white2gray(x)	reset2bits((x)->gch.marked, WHITE0BIT, WHITE1BIT)
 #define black2gray(x)	resetbit((x)->gch.marked, BLACKBIT)
 
-/* changed2->gray */
-#define stringmark(s)	reset2bits((s)->tsv.marked, WHITE0BIT, WHITE1BIT)
+/* changed2->gray (strings of a shared heap are never white: not written) */
+#define stringmark(s)	{ if (iswhite(obj2gco(s))) \
+		reset2bits((s)->tsv.marked, WHITE0BIT, WHITE1BIT); }
 
 #define isfinalized(u)		testbit((u)->marked, FINALIZEDBIT)
 #define markfinalized(u)	l_setbit((u)->marked, FINALIZEDBIT)
@@ -71,8 +81,8 @@
 #define setthreshold(g)  (g->GCthreshold = (g->estimate/100) * g->gcpause)
 
 
-static void removeentry (Node *n) {
-  lua_assert(ttisnil(gval(n)));		/* tbl[k] = nil */
+static void removeentry (Node *n, const TValue *v) {
+  lua_assert(ttisnil(v));		/* tbl[k] = nil */
   if (iscollectable(gkey(n)))	/* 这个判断还是必须的 */
     setttype(gkey(n), LUA_TDEADKEY);  /* dead key; remove it */
 }
@@ -188,50 +198,170 @@ size_t luaC_separateudata (lua_State *L, int all) {
   return deadmem;
 }
 
-/* 完整的遍历表 */
+/*
+** The next function tells whether a key or value can be cleared from
+** a weak table. Non-collectable objects are never removed from weak
+** tables. Strings behave as `values', so are never removed too. for
+** other objects: if really collected, cannot keep them; for userdata
+** being finalized, keep them in keys, but not in values (http://lua-users.org/lists/lua-l/2009-03/msg00438.html)
+*/
+static int iscleared (const TValue *o, int iskey) {
+  if (!iscollectable(o)) return 0;
+  if (ttisstring(o)) {
+    stringmark(rawtsvalue(o));  /* strings are `values', so are never weak */
+    return 0;
+  }
+  return iswhite(gcvalue(o)) ||
+    (ttisuserdata(o) && (!iskey && isfinalized(uvalue(o))));
+}
+
+
+/*
+** In the atomic phase the traversal of a weak table logs the entries
+** that may be cleared (array index `i', or node -1-i), so that clearing
+** visits only them. If the log cannot grow, every node is cleared.
+*/
+static void logclear (global_State *g, Table *h, int i) {
+  if (!g->logclears) return;
+  if (g->nclearlog == g->sizeclearlog) {
+    int n = (g->sizeclearlog > 0) ? 2*g->sizeclearlog : MINCLEARLOG;
+    WeakEntry *log = (WeakEntry *)luaM_tryrealloc(g->mainthread, g->clearlog,
+                         g->sizeclearlog * sizeof(WeakEntry),
+                         n * sizeof(WeakEntry));
+    if (log == NULL) {
+      g->logclears = 2;  /* overflow */
+      return;
+    }
+    g->clearlog = log;
+    g->sizeclearlog = n;
+  }
+  g->clearlog[g->nclearlog].h = h;
+  g->clearlog[g->nclearlog++].i = i;
+}
+
+
+static void linkweak (GCObject **list, Table *h) {
+  h->gclist = *list;
+  *list = obj2gco(h);
+}
+
+
+static void traversestrong (global_State *g, Table *h) {
+  int i = h->sizearray;
+  while (i--)
+    markvalue(g, &h->array[i]);
+  i = sizenode(h);
+  while (i--) {
+    Node *n = gnode(h, i);
+    TValue *v = gnval(h, i);
+    lua_assert(ttype(gkey(n)) != LUA_TDEADKEY || ttisnil(v));
+  	/* val为nil则标记key为LUA_TDEADKEY */
+    if (ttisnil(v))	
+      removeentry(n, v);  /* remove empty entries */
+    else {
+      lua_assert(!ttisnil(gkey(n)));	/* 判断下是否出现了lua[nil]=val */
+      markvalue(g, gkey(n));
+      markvalue(g, v);
+    }
+  }
+}
+
+
+static void traverseweakvalue (global_State *g, Table *h) {
+  int i = h->sizearray;
+  while (i--) {
+    if (iscleared(&h->array[i], 0))
+      logclear(g, h, i);
+  }
+  i = sizenode(h);
+  while (i--) {
+    Node *n = gnode(h, i);
+    TValue *v = gnval(h, i);
+    if (ttisnil(v))
+      removeentry(n, v);
+    else {
+      markvalue(g, gkey(n));
+      if (iscleared(v, 0))
+        logclear(g, h, -1-i);
+    }
+  }
+}
+
+
+/*
+** an ephemeron (weak keys, strong values) marks a value only once its
+** key is marked; returns whether it marked any value
+*/
+static int traverseephemeron (global_State *g, Table *h) {
+  int marked = 0;
+  int i = h->sizearray;
+  while (i--)  /* integer keys are never collected */
+    markvalue(g, &h->array[i]);
+  i = sizenode(h);
+  while (i--) {
+    Node *n = gnode(h, i);
+    TValue *v = gnval(h, i);
+    if (ttisnil(v))
+      removeentry(n, v);
+    else if (iscleared(key2tval(n), 1))  /* key not marked (yet)? */
+      logclear(g, h, -1-i);
+    else if (valiswhite(v)) {
+      reallymarkobject(g, gcvalue(v));
+      marked = 1;
+    }
+  }
+  return marked;
+}
+
+
+static void traverseallweak (global_State *g, Table *h) {
+  int i = h->sizearray;
+  while (i--) {
+    if (iscleared(&h->array[i], 0))
+      logclear(g, h, i);
+  }
+  i = sizenode(h);
+  while (i--) {
+    Node *n = gnode(h, i);
+    TValue *v = gnval(h, i);
+    if (ttisnil(v))
+      removeentry(n, v);
+    else if (iscleared(key2tval(n), 1) || iscleared(v, 0))
+      logclear(g, h, -1-i);
+  }
+}
+
+
+/* 完整的遍历表; returns whether the table is weak (and stays gray) */
 static int traversetable (global_State *g, Table *h) {
-  int i;
-  int weakkey = 0;
-  int weakvalue = 0;
   const TValue *mode;
   if (h->metatable)
     markobject(g, h->metatable);
   mode = gfasttm(g, h->metatable, TM_MODE);	/* 提取可能存在的mt的TM_MODE域 */
   if (mode && ttisstring(mode)) {  /* is there a weak mode? */
-    weakkey = (strchr(svalue(mode), 'k') != NULL);
-    weakvalue = (strchr(svalue(mode), 'v') != NULL);
+    int weakkey = (strchr(svalue(mode), 'k') != NULL);
+    int weakvalue = (strchr(svalue(mode), 'v') != NULL);
     if (weakkey || weakvalue) {  /* is really weak? 重新标记weak'bit位，并放入专用的weak链表中 */
       h->marked &= ~(KEYWEAK | VALUEWEAK);  /* clear bits */
       h->marked |= cast_byte((weakkey << KEYWEAKBIT) |
                              (weakvalue << VALUEWEAKBIT));
-      h->gclist = g->weak;  /* must be cleared after GC, ... */
-      g->weak = obj2gco(h);  /* ... so put in the appropriate list */
-    }
-  }
-  
-  /* key和val都是弱引用，则无需扫描表，直接返回 */
-  if (weakkey && weakvalue) return 1;
-  
-  if (!weakvalue) {
-    i = h->sizearray;
-    while (i--)
-      markvalue(g, &h->array[i]);
-  }
-  i = sizenode(h);
-  while (i--) {
-    Node *n = gnode(h, i);
-    lua_assert(ttype(gkey(n)) != LUA_TDEADKEY || ttisnil(gval(n)));
-  
-  	/* val为nil则标记key为LUA_TDEADKEY */
-    if (ttisnil(gval(n)))	
-      removeentry(n);  /* remove empty entries */
-    else {
-      lua_assert(!ttisnil(gkey(n)));	/* 判断下是否出现了lua[nil]=val */
-      if (!weakkey) markvalue(g, gkey(n));
-      if (!weakvalue) markvalue(g, gval(n));
+      if (!weakkey) {
+        traverseweakvalue(g, h);
+        linkweak(&g->weak, h);
+      }
+      else if (!weakvalue) {
+        traverseephemeron(g, h);
+        linkweak(&g->ephemeron, h);
+      }
+      else {
+        traverseallweak(g, h);
+        linkweak(&g->allweak, h);
+      }
+      return 1;
     }
   }
-  return weakkey || weakvalue;
+  traversestrong(g, h);
+  return 0;
 }
 
 
@@ -241,7 +371,10 @@ static int traversetable (global_State *g, Table *h) {
 */
 static void traverseproto (global_State *g, Proto *f) {
   int i;
+  if (f->cache && iswhite(obj2gco(f->cache)))
+    f->cache = NULL;  /* the cache does not keep its closure alive */
   if (f->source) stringmark(f->source);
+  if (f->debugsec) stringmark(f->debugsec);
   for (i=0; i<f->sizek; i++)  /* mark literals */
     markvalue(g, &f->k[i]);
   for (i=0; i<f->sizeupvalues; i++) {  /* mark upvalue names */
@@ -277,6 +410,13 @@ static void traverseclosure (global_State *g, Closure *cl) {
 }
 
 
+/*
+** not with LUA_USE_LOCK: C functions and the host read their stacks
+** without the lock (lua_type, lua_tonumber...), so a collector running
+** on another OS thread must not move them; stacks are freed with
+** their thread instead
+*/
+#if !defined(LUA_USE_LOCK)
 static void checkstacksizes (lua_State *L, StkId max) {
   int ci_used = cast_int(L->ci - L->base_ci);  /* number of `ci' in use */
   int s_used = cast_int(max - L->stack);  /* part of stack in use */
@@ -290,6 +430,7 @@ static void checkstacksizes (lua_State *L, StkId max) {
     luaD_reallocstack(L, L->stacksize/2);  /* still big enough... */
   condhardstacktests(luaD_reallocstack(L, s_used));
 }
+#endif
 
 
 static void traversestack (global_State *g, lua_State *l) {
@@ -305,7 +446,9 @@ static void traversestack (global_State *g, lua_State *l) {
     markvalue(g, o);
   for (; o <= lim; o++)
     setnilvalue(o);
+#if !defined(LUA_USE_LOCK)
   checkstacksizes(l, lim);
+#endif
 }
 
 
@@ -324,7 +467,7 @@ static l_mem propagatemark (global_State *g) {
       if (traversetable(g, h))  /* table is weak? 如果是弱表，则会被放入g->weak中等待后面atomic扫描，故而这里black2gray */
         black2gray(o);  /* keep it gray */
       return sizeof(Table) + sizeof(TValue) * h->sizearray +
-                             sizeof(Node) * sizenode(h);
+                             NODESIZE * sizenode(h);
     }
     case LUA_TFUNCTION: {
       Closure *cl = gco2cl(o);
@@ -366,24 +509,6 @@ static size_t propagateall (global_State *g) {
 }
 
 
-/*
-** The next function tells whether a key or value can be cleared from
-** a weak table. Non-collectable objects are never removed from weak
-** tables. Strings behave as `values', so are never removed too. for
-** other objects: if really collected, cannot keep them; for userdata
-** being finalized, keep them in keys, but not in values (http://lua-users.org/lists/lua-l/2009-03/msg00438.html)
-*/
-static int iscleared (const TValue *o, int iskey) {
-  if (!iscollectable(o)) return 0;
-  if (ttisstring(o)) {
-    stringmark(rawtsvalue(o));  /* strings are `values', so are never weak */
-    return 0;
-  }
-  return iswhite(gcvalue(o)) ||
-    (ttisuserdata(o) && (!iskey && isfinalized(uvalue(o))));
-}
-
-
 /*
 ** clear collected entries from weaktables
 ** 专用函数(weaktable)
@@ -404,10 +529,11 @@ static void cleartable (GCObject *l) {
     i = sizenode(h);
     while (i--) {
       Node *n = gnode(h, i); 
-      if (!ttisnil(gval(n)) &&  /* non-empty entry? */
-          (iscleared(key2tval(n), 1) || iscleared(gval(n), 0))) {
-        setnilvalue(gval(n));  /* remove value ... */
-        removeentry(n);  /* remove entry from table */
+      TValue *v = gnval(h, i);
+      if (!ttisnil(v) &&  /* non-empty entry? */
+          (iscleared(key2tval(n), 1) || iscleared(v, 0))) {
+        setnilvalue(v);  /* remove value ... */
+        removeentry(n, v);  /* remove entry from table */
       }
     }
     l = h->gclist;
@@ -415,6 +541,40 @@ static void cleartable (GCObject *l) {
 }
 
 
+static void clearentry (Table *h, int i) {
+  if (i >= 0) {
+    TValue *o = &h->array[i];
+    if (iscleared(o, 0))  /* value was collected? */
+      setnilvalue(o);  /* remove value */
+  }
+  else {
+    Node *n = gnode(h, -1-i);
+    TValue *v = gnval(h, -1-i);
+    if (!ttisnil(v) &&  /* non-empty entry? */
+        (iscleared(key2tval(n), 1) || iscleared(v, 0))) {
+      setnilvalue(v);  /* remove value ... */
+      removeentry(n, v);  /* remove entry from table */
+    }
+  }
+}
+
+
+/* remove collected objects from weak tables */
+static void clearweak (global_State *g) {
+  if (g->logclears == 2) {  /* log overflowed: visit every entry */
+    cleartable(g->weak);
+    cleartable(g->ephemeron);
+    cleartable(g->allweak);
+  }
+  else {
+    int i;
+    for (i = 0; i < g->nclearlog; i++)
+      clearentry(g->clearlog[i].h, g->clearlog[i].i);
+  }
+  g->logclears = 0;  /* (`nclearlog' is kept for `checkSizes') */
+}
+
+
 static void freeobj (lua_State *L, GCObject *o) {
   switch (o->gch.tt) {
     case LUA_TPROTO: luaF_freeproto(L, gco2p(o)); break;
@@ -432,7 +592,15 @@ static void freeobj (lua_State *L, GCObject *o) {
       break;
     }
     case LUA_TUSERDATA: {
-      luaM_freemem(L, o, sizeudata(gco2u(o)));
+      Udata *u = rawgco2u(o);
+      global_State *g = G(L);
+      if (u->uv.fin != NULL && u->uv.finsafe && g->deferfree)
+        luaM_defer(L, o, sizeudata(&u->uv), u->uv.fin);  /* to the sweeper */
+      else {
+        if (u->uv.fin != NULL)  /* a plain C call, no `luaD_call' */
+          (*u->uv.fin)(u + 1, u->uv.len, g->frealloc, g->ud);
+        luaM_freemem(L, o, sizeudata(&u->uv));
+      }
       break;
     }
     default: lua_assert(0);
@@ -441,21 +609,33 @@ static void freeobj (lua_State *L, GCObject *o) {
 
 
 
-#define sweepwholelist(L,p)	sweeplist(L,p,MAX_LUMEM)
+#define sweepwholelist(L,p)	sweeplist(L,p,MAX_LUMEM,0)
 
-/* 清扫list上的垃圾obj, 非垃圾则切换到currentwhite */
-static GCObject **sweeplist (lua_State *L, GCObject **p, lu_mem count) {
+/*
+** 清扫list上的垃圾obj, 非垃圾则切换到currentwhite.
+** In generational mode survivors keep their colors and become old; with
+** `stopold' the sweep stops at the first old object, as new objects are
+** always linked at the head of the list (everything after it is old too)
+*/
+static GCObject **sweeplist (lua_State *L, GCObject **p, lu_mem count,
+                             int stopold) {
   GCObject *curr;
   global_State *g = G(L);
   int deadmask = otherwhite(g);	/* 保留currentwhite的 bit[7,2]位的数据，将bit[1,0]翻转 */
+  int gen = isgenerational(g);
   while ((curr = *p) != NULL && count-- > 0) {
+    if (stopold && isold(curr))
+      break;  /* the rest of the list is the old generation */
     if (curr->gch.tt == LUA_TTHREAD)  /* sweep open upvalues of each thread */
       sweepwholelist(L, &gco2th(curr)->openupval);
 	
 	/* gch.marked ^ WHITEBITS ->bit[7,2]不变，bit[1,0]翻转 */
     if ((curr->gch.marked ^ WHITEBITS) & deadmask) {  /* not dead? */
       lua_assert(!isdead(g, curr) || testbit(curr->gch.marked, FIXEDBIT));
-      makewhite(g, curr);  /* make it white (for next cycle) */
+      if (gen)
+        l_setbit(curr->gch.marked, OLDBIT);  /* survived: now it is old */
+      else
+        makewhite(g, curr);  /* make it white (for next cycle) */
       p = &curr->gch.next;
     }
     else {  /* must erase `curr' */
@@ -472,9 +652,15 @@ static GCObject **sweeplist (lua_State *L, GCObject **p, lu_mem count) {
 
 static void checkSizes (lua_State *L) {
   global_State *g = G(L);
+  /* check size of the log of weak entries */
+  if (g->nclearlog < g->sizeclearlog/4 && g->sizeclearlog > MINCLEARLOG) {
+    int n = g->sizeclearlog/2;
+    luaM_reallocvector(L, g->clearlog, g->sizeclearlog, n, WeakEntry);
+    g->sizeclearlog = n;
+  }
   /* check size of string hash */
   if (g->strt.nuse < cast(lu_int32, g->strt.size/4) &&
-      g->strt.size > MINSTRTABSIZE*2)
+      g->strt.size > MINSTRTABSIZE*2 && g->strt.oldhash == NULL)
     luaS_resize(L, g->strt.size/2);  /* table is too big */
   /* check size of buffer */
   if (luaZ_sizebuffer(&g->buff) > LUA_MINBUFFER*2) {  /* buffer too big? */
@@ -484,6 +670,148 @@ static void checkSizes (lua_State *L) {
 }
 
 
+/*
+** background sweep (lua_gc LUA_GCBGSWEEP): each sweep step gathers the
+** blocks it frees in `g->deferred' (see `luaM_realloc_') and hands them
+** to a thread that gives them back to the allocator, which must then
+** accept frees from another thread. Blocks smaller than a FreeBlock
+** are freed at once. Userdata with a thread-safe native finalizer go
+** the same way, and the thread runs the finalizer before the free.
+*/
+#if defined(LUA_USE_PTHREADS)
+
+typedef struct Sweeper {
+  pthread_t th;
+  pthread_mutex_t mu;
+  pthread_cond_t cv;
+  global_State *g;
+  FreeBlock *queue;  /* blocks to free */
+  FreeBlock *queuetail;
+  int busy;  /* freeing a taken queue */
+  int stop;
+} Sweeper;
+
+
+static void *sweeperthread (void *ud) {
+  Sweeper *s = (Sweeper *)ud;
+  pthread_mutex_lock(&s->mu);
+  for (;;) {
+    FreeBlock *b = s->queue;
+    if (b != NULL) {
+      lua_Alloc f = s->g->frealloc;
+      void *fud = s->g->ud;
+      s->queue = s->queuetail = NULL;
+      s->busy = 1;
+      pthread_mutex_unlock(&s->mu);
+      while (b != NULL) {
+        FreeBlock *next = b->next;
+        if (b->fin != NULL)  /* a userdata (see `freeobj') */
+          (*b->fin)(cast(Udata *, b) + 1, b->size - sizeof(Udata), f, fud);
+        (*f)(fud, b, b->size, 0);
+        b = next;
+      }
+      pthread_mutex_lock(&s->mu);
+      s->busy = 0;
+      pthread_cond_broadcast(&s->cv);
+    }
+    else if (s->stop)
+      break;
+    else
+      pthread_cond_wait(&s->cv, &s->mu);
+  }
+  pthread_mutex_unlock(&s->mu);
+  return NULL;
+}
+
+
+/* give the blocks of the last sweep steps to the sweeper */
+static void handoff (global_State *g) {
+  Sweeper *s = g->sweeper;
+  if (g->deferred == NULL) return;
+  pthread_mutex_lock(&s->mu);
+  if (s->queue == NULL) s->queue = g->deferred;
+  else s->queuetail->next = g->deferred;
+  s->queuetail = g->deferredtail;
+  pthread_cond_signal(&s->cv);
+  pthread_mutex_unlock(&s->mu);
+  g->deferred = g->deferredtail = NULL;
+  g->deferredbytes = 0;
+}
+
+/* blocks go to the sweeper in batches of SWEEPBATCH bytes at least */
+#define startsweep(g)	((g)->deferfree = ((g)->sweeper != NULL))
+#define endsweep(g,last)	{ if ((g)->deferfree) { (g)->deferfree = 0; \
+  if ((last) || (g)->deferredbytes >= SWEEPBATCH) handoff(g); } }
+
+
+/* wait until the sweeper has freed every block swept so far */
+void luaC_syncsweep (lua_State *L) {
+  Sweeper *s = G(L)->sweeper;
+  if (s == NULL) return;
+  handoff(G(L));
+  pthread_mutex_lock(&s->mu);
+  while (s->queue != NULL || s->busy)
+    pthread_cond_wait(&s->cv, &s->mu);
+  pthread_mutex_unlock(&s->mu);
+}
+
+
+int luaC_bgsweep (lua_State *L, int on) {
+  global_State *g = G(L);
+  Sweeper *s = g->sweeper;
+  int res = (s != NULL);
+  if (on && s == NULL) {
+    s = luaM_new(L, Sweeper);
+    s->g = g;
+    s->queue = s->queuetail = NULL;
+    s->busy = s->stop = 0;
+    if (pthread_mutex_init(&s->mu, NULL) != 0) {
+      luaM_free(L, s);
+      return res;
+    }
+    if (pthread_cond_init(&s->cv, NULL) != 0) {
+      pthread_mutex_destroy(&s->mu);
+      luaM_free(L, s);
+      return res;
+    }
+    if (pthread_create(&s->th, NULL, sweeperthread, s) != 0) {
+      pthread_cond_destroy(&s->cv);
+      pthread_mutex_destroy(&s->mu);
+      luaM_free(L, s);
+      return res;
+    }
+    g->sweeper = s;
+  }
+  else if (!on && s != NULL) {
+    handoff(g);
+    pthread_mutex_lock(&s->mu);
+    s->stop = 1;  /* the thread frees its queue before stopping */
+    pthread_cond_signal(&s->cv);
+    pthread_mutex_unlock(&s->mu);
+    pthread_join(s->th, NULL);
+    pthread_cond_destroy(&s->cv);
+    pthread_mutex_destroy(&s->mu);
+    g->sweeper = NULL;
+    luaM_free(L, s);
+  }
+  return res;
+}
+
+#else
+
+#define startsweep(g)	((void)0)
+#define endsweep(g,last)	((void)0)
+
+void luaC_syncsweep (lua_State *L) { UNUSED(L); }
+
+int luaC_bgsweep (lua_State *L, int on) {
+  UNUSED(L); UNUSED(on);
+  return 0;  /* no threads: sweeping stays on the collector */
+}
+
+#endif
+
+
 static void GCTM (lua_State *L) {
   global_State *g = G(L);
   GCObject *o = g->tmudata->gch.next;  /* get first element */
@@ -528,10 +856,13 @@ void luaC_freeall (lua_State *L) {
 
   /* 抛弃了初始化时的 FIXEDBIT 标志位 */
   g->currentwhite = WHITEBITS | bitmask(SFIXEDBIT);  /* mask to collect all elements */
+  g->gckind = KGC_NORMAL;
   
   sweepwholelist(L, &g->rootgc);
   for (i = 0; i < g->strt.size; i++)  /* free all string lists */
     sweepwholelist(L, &g->strt.hash[i]);
+  for (i = 0; i < g->strt.oldsize; i++)  /* (including a pending resize) */
+    sweepwholelist(L, &g->strt.oldhash[i]);
 }
 
 /* 扫描共用的mt */
@@ -542,12 +873,37 @@ static void markmt (global_State *g) {
 }
 
 
+static void marksample (global_State *g, ProfSample *s) {
+  int j;
+  for (j = 0; j < s->depth; j++)
+    if (s->f[j].p) markobject(g, s->f[j].p);
+}
+
+
+/*
+** keep the functions sampled by the profilers (see lua_profsample and
+** the heap profiler in lmem.c)
+*/
+static void markprofile (global_State *g) {
+  Profile *pr = &g->prof;
+  HeapProfile *hp = &g->heap;
+  int i;
+  for (i = 0; i < pr->n; i++)  /* slots [0, n) are in use */
+    marksample(g, &pr->buf[i]);
+  for (i = 0; i < hp->nsites; i++)
+    marksample(g, &hp->sites[i].stack);
+  if (hp->pend != NULL)
+    marksample(g, &hp->pendstack);
+}
+
+
 /* mark root set */
 static void markroot (lua_State *L) {
   global_State *g = G(L);
   g->gray = NULL;
   g->grayagain = NULL;
-  g->weak = NULL;
+  g->weak = g->ephemeron = g->allweak = NULL;
+  g->gcconverge = 0;
   /* tmudata没有置空，有个印象 */
 
   /* GC扫描的起始点 */
@@ -571,45 +927,184 @@ static void remarkupvals (global_State *g) {
 }
 
 
+/* move the tables of a weak list back to `gray' */
+static void remarkweak (global_State *g, GCObject **list) {
+  GCObject *l = *list;
+  while (l != NULL) {
+    Table *h = gco2h(l);
+    l = h->gclist;
+    linkweak(&g->gray, h);
+  }
+  *list = NULL;
+}
+
+
+/*
+** one pass over the ephemerons, marking the values of keys marked since
+** the last one; returns whether anything was marked
+*/
+static int convergepass (global_State *g) {
+  int marked = 0;
+  GCObject *l;
+  for (l = g->ephemeron; l != NULL; l = gco2h(l)->gclist)
+    marked |= traverseephemeron(g, gco2h(l));
+  return marked;
+}
+
+
+/*
+** in `atomic' the log holds every ephemeron entry whose key was not
+** marked, so the passes only look at them (unless the log overflowed)
+*/
+static void convergeephemerons (global_State *g) {
+  int marked;
+  propagateall(g);
+  do {
+    int i;
+    if (g->logclears != 1) {
+      marked = convergepass(g);
+      propagateall(g);
+      continue;
+    }
+    marked = 0;
+    for (i = 0; i < g->nclearlog; i++) {
+      Table *h = g->clearlog[i].h;
+      if (g->clearlog[i].i < 0 && !testbit(h->marked, VALUEWEAKBIT) &&
+          testbit(h->marked, KEYWEAKBIT)) {  /* node of an ephemeron? */
+        Node *n = gnode(h, -1-g->clearlog[i].i);
+        TValue *v = gnval(h, -1-g->clearlog[i].i);
+        if (!ttisnil(v) && !iscleared(key2tval(n), 1) && valiswhite(v)) {
+          reallymarkobject(g, gcvalue(v));
+          marked = 1;
+        }
+      }
+    }
+    propagateall(g);
+  } while (marked);
+}
+
+
 static void atomic (lua_State *L) {
   global_State *g = G(L);
   size_t udsize;  /* total size of userdata to be finalized(最终确定) */
+  g->nclearlog = 0;
+  g->logclears = 1;  /* weak tables traversed from now on log their entries */
   /* remark occasional（偶然，临时） upvalues of (maybe) dead threads */
   remarkupvals(g);
   /* traverse objects cautch by write barrier and by 'remarkupvals' */
   propagateall(g);
   /* remark weak tables */
-  g->gray = g->weak;
-  g->weak = NULL;
+  remarkweak(g, &g->weak);
+  remarkweak(g, &g->ephemeron);
+  remarkweak(g, &g->allweak);
   lua_assert(!iswhite(obj2gco(g->mainthread)));		// g->mainthread不可能是白色，这里强制判断
   markobject(g, L);  /* mark running thread */
   markmt(g);  /* mark basic metatables (again) */
+  markprofile(g);
   propagateall(g);
   /* remark gray again */
   g->gray = g->grayagain;
   g->grayagain = NULL;
-  propagateall(g);
+  convergeephemerons(g);
 
   /* 下面三行函数的调用有前后顺序 */
   udsize = luaC_separateudata(L, 0);  /* separate(分离) userdata to be finalized */
   marktmu(g);  /* mark `preserved' userdata */
   udsize += propagateall(g);  /* remark, to propagate `preserveness' */
+  convergeephemerons(g);  /* (keys kept for finalization keep values) */
   
-  cleartable(g->weak);  /* remove collected objects from weak tables */
+  clearweak(g);  /* remove collected objects from weak tables */
+  g->gcconverge = 0;
   
   /* flip current white 保留[7,2]，翻转[1,0]*/
   g->currentwhite = cast_byte(otherwhite(g));
   
   g->sweepstrgc = 0;
   g->sweepgc = &g->rootgc;
+  if (isgenerational(g))  /* young userdata are linked after the main thread */
+    sweeplist(L, &g->mainthread->next, MAX_LUMEM, 1);
   g->gcstate = GCSsweepstring;
   g->estimate = g->totalbytes - udsize;  /* first estimate */
 }
 
+/*
+** collector statistics (lua_gcstats): a pause is timed from `gcbegin'
+** to `gcend'; the clock is read again only when `gcstate' changes and
+** before the atomic phase
+*/
+#if defined(LUA_USE_POSIX)
+static double gcclock (void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+#else
+#define gcclock()	((double)clock() / CLOCKS_PER_SEC)
+#endif
+
+
+static int gcphase (global_State *g) {
+  switch (g->gcstate) {
+    case GCSsweepstring: return LUA_GCPSWEEPSTRING;
+    case GCSsweep: return LUA_GCPSWEEP;
+    case GCSfinalize: return LUA_GCPFINALIZE;
+    default: return LUA_GCPPROPAGATE;  /* (markroot counts as propagate) */
+  }
+}
+
+
+static void chargephase (global_State *g, int phase) {
+  GCTimer *t = &g->gctimer;
+  double now = gcclock();
+  if (t->phase >= 0)
+    g->gcstats.phasetime[t->phase] += now - t->phasestart;
+  t->phasestart = now;
+  t->phase = phase;
+  t->state = g->gcstate;
+}
+
+
+static void gcbegin (global_State *g) {
+  GCTimer *t = &g->gctimer;
+  t->start = t->phasestart = gcclock();
+  t->phase = gcphase(g);
+  t->state = g->gcstate;
+}
+
+
+/* `step': 1 for a step, 0 for a full collection, -1 for idle time */
+static void gcend (global_State *g, int step) {
+  lua_GCStats *st = &g->gcstats;
+  double pause;
+  chargephase(g, -1);
+  pause = g->gctimer.phasestart - g->gctimer.start;
+  if (step >= 0 && pause > st->maxpause) st->maxpause = pause;
+  if (step > 0) {
+    double us = pause * 1e6;
+    int i = 0;
+    while (i < LUA_GCHISTSIZE - 1 && us >= (double)(1u << i)) i++;
+    st->hist[i]++;
+    st->steps++;
+  }
+}
+
+
+static void endcycle (global_State *g) {
+  lua_GCStats *st = &g->gcstats;
+  st->cycles++;
+  st->cyclealloc = st->allocated - g->gctimer.allocmark;
+  st->cyclefreed = st->freed - g->gctimer.freemark;
+  g->gctimer.allocmark = st->allocated;
+  g->gctimer.freemark = st->freed;
+}
+
+
 /* 走一小步gc */
 static l_mem singlestep (lua_State *L) {
   global_State *g = G(L);
   /*lua_checkmemory(L);*/
+  if (g->gcstate != g->gctimer.state)
+    chargephase(g, gcphase(g));
   switch (g->gcstate) {
     case GCSpause: {
       markroot(L);  /* start a new collection */
@@ -618,15 +1113,25 @@ static l_mem singlestep (lua_State *L) {
     case GCSpropagate: {
       if (g->gray)
         return propagatemark(g);
+      else if (g->ephemeron != NULL && g->gcconverge < MAXCONVERGE &&
+               (g->gcconverge++, convergepass(g)))
+        return GCSTEPSIZE;  /* converge before `atomic', a pass per step */
       else {  /* no more `gray' objects */
+        chargephase(g, LUA_GCPATOMIC);
         atomic(L);  /* finish mark phase */
         return 0;
       }
     }
     case GCSsweepstring: {
       lu_mem old = g->totalbytes;
-      sweepwholelist(L, &g->strt.hash[g->sweepstrgc++]);
-      if (g->sweepstrgc >= g->strt.size)  /* nothing more to sweep? */
+      startsweep(g);
+      /* buckets of a pending resize come first */
+      if (g->sweepstrgc < g->strt.oldsize)
+        sweepwholelist(L, &g->strt.oldhash[g->sweepstrgc++]);
+      else
+        sweepwholelist(L, &g->strt.hash[g->sweepstrgc++ - g->strt.oldsize]);
+      endsweep(g, 0);
+      if (g->sweepstrgc >= g->strt.oldsize + g->strt.size)  /* nothing more to sweep? */
         g->gcstate = GCSsweep;  /* end sweep-string phase */
       lua_assert(old >= g->totalbytes);
       g->estimate -= old - g->totalbytes;
@@ -634,13 +1139,17 @@ static l_mem singlestep (lua_State *L) {
     }
     case GCSsweep: {
       lu_mem old = g->totalbytes;
-      g->sweepgc = sweeplist(L, g->sweepgc, GCSWEEPMAX);
-      if (*g->sweepgc == NULL) {  /* nothing more to sweep? */
-        checkSizes(L);
-        g->gcstate = GCSfinalize;  /* end sweep phase */
-      }
+      startsweep(g);
+      g->sweepgc = sweeplist(L, g->sweepgc, GCSWEEPMAX, isgenerational(g));
       lua_assert(old >= g->totalbytes);
       g->estimate -= old - g->totalbytes;
+      if (*g->sweepgc == NULL ||  /* nothing more to sweep? */
+          (isgenerational(g) && isold(*g->sweepgc))) {
+        endsweep(g, 1);
+        checkSizes(L);  /* (a shrinking string table is freed later) */
+        g->gcstate = GCSfinalize;  /* end sweep phase */
+      }
+      else endsweep(g, 0);
       return GCSWEEPMAX*GCSWEEPCOST;
     }
     case GCSfinalize: {
@@ -653,6 +1162,7 @@ static l_mem singlestep (lua_State *L) {
       else {
         g->gcstate = GCSpause;  /* end collection */
         g->gcdept = 0;
+        endcycle(g);
         return 0;
       }
     }
@@ -661,9 +1171,62 @@ static l_mem singlestep (lua_State *L) {
 }
 
 
-void luaC_step (lua_State *L) {
+/*
+** a minor collection runs a whole cycle at once: the marking only
+** traverses young objects and the old ones caught by the barriers (the
+** gray lists are kept between cycles), and the sweep stops at the old
+** generation. When the heap has grown too much since the last major
+** collection, the next collection is a major (full) one.
+*/
+static void fullgc (lua_State *L);
+
+static void generationalstep (lua_State *L) {
+  global_State *g = G(L);
+  lua_assert(g->gcstate == GCSpropagate);
+  if (g->gcmajorbase == 0)  /* signal for a major collection? */
+    fullgc(L);
+  else {
+    do singlestep(L); while (g->gcstate != GCSpause);
+    g->gcstate = GCSpropagate;  /* skip restart: keep the remembered set */
+    if (g->totalbytes > (g->gcmajorbase / 100) * g->gcmajorinc)
+      g->gcmajorbase = 0;  /* next collection will be a major one */
+    setthreshold(g);
+  }
+}
+
+
+/*
+** work until the end of the cycle (returns 1) or until `deadline'; the
+** clock is read after every GCSTEPSIZE units of work
+*/
+static int timedwork (lua_State *L, double deadline) {
+  global_State *g = G(L);
+  l_mem work = 0;
+  for (;;) {
+    work += singlestep(L);
+    if (g->gcstate == GCSpause)
+      return 1;
+    if (work >= cast(l_mem, GCSTEPSIZE)) {
+      work = 0;
+      if (gcclock() >= deadline)
+        return 0;
+    }
+  }
+}
+
+
+static void incrementalstep (lua_State *L) {
   global_State *g = G(L);
   l_mem lim = (GCSTEPSIZE/100) * g->gcstepmul;
+  if (g->gcbudget > 0 &&  /* budgeted steps, unless the heap grew too much */
+      g->totalbytes <= (g->estimate/100) * g->gcgrowth) {
+    if (timedwork(L, g->gctimer.start + g->gcbudget * 1e-6))
+      setthreshold(g);
+    else
+      g->GCthreshold = g->totalbytes + GCSTEPSIZE;
+    g->gcdept = 0;
+    return;
+  }
   if (lim == 0)
     lim = (MAX_LUMEM-1)/2;  /* no limit */
   g->gcdept += g->totalbytes - g->GCthreshold;
@@ -688,16 +1251,489 @@ void luaC_step (lua_State *L) {
 }
 
 
-void luaC_fullgc (lua_State *L) {
+/*
+** idle time given by the host (LUA_GCIDLE): advance the current cycle
+** for up to `us' microseconds; in pause, start a cycle once the heap
+** is halfway to the next threshold. Generational collections cannot
+** be split: idle time runs a whole one. Returns 1 if a cycle ended.
+*/
+int luaC_idle (lua_State *L, int us) {
+  global_State *g = G(L);
+  int res = 0;
+  if (g->GCthreshold == MAX_LUMEM ||  /* collector stopped? */
+      ((g->gcstate == GCSpause || isgenerational(g)) &&
+       2*g->totalbytes < g->estimate + g->GCthreshold))
+    return 0;  /* nothing worth doing */
+  gcbegin(g);
+  if (isgenerational(g)) {
+    generationalstep(L);
+    res = 1;
+  }
+  else if (timedwork(L, g->gctimer.start + us * 1e-6)) {
+    setthreshold(g);
+    res = 1;
+  }
+  gcend(g, -1);
+  luaC_clampthreshold(L);
+  return res;
+}
+
+
+/*
+** {======================================================
+** Memory limits (lua_setmemlimit, lua_setmemsoft): allocations past the
+** hard limit fail with LUA_ERRMEM (see luaM_realloc_).  The collector
+** cannot run inside an allocation, so it acts at its steps instead,
+** which the thresholds bring forward: once the heap is within 1/8 of
+** the hard limit a step is a full collection, and the soft-limit hook
+** runs once each time the heap passes the soft limit (again once it
+** was 1/8 below).  A protected call that fails with LUA_ERRMEM under a
+** limit ends with a full collection too (see luaD_pcall).
+** =======================================================
+*/
+
+#define nearlimit(l)	((l) - (l)/8)
+
+
+/* a step must come before the heap gets to a limit */
+void luaC_clampthreshold (lua_State *L) {
+  global_State *g = G(L);
+  if (g->GCthreshold > g->memnear)
+    g->GCthreshold = g->memnear;
+  if (g->memsoftarmed && g->GCthreshold > g->memsoft)
+    g->GCthreshold = g->memsoft;
+}
+
+
+/* limits changed: start over */
+void luaC_setmemlimits (lua_State *L) {
   global_State *g = G(L);
-  if (g->gcstate <= GCSpropagate) {	/* 跳过mark阶段 */
+  g->memnear = nearlimit(g->memlimit);
+  g->memsoftarmed = (g->memsofthook != NULL && g->totalbytes < g->memsoft);
+  if (g->GCthreshold != MAX_LUMEM)  /* collector not stopped? */
+    luaC_clampthreshold(L);
+}
+
+
+/* returns 1 if it did a full collection */
+static int memlimits (lua_State *L) {
+  global_State *g = G(L);
+  int collected = 0;
+  if (g->totalbytes >= g->memnear) {  /* emergency collection */
+    luaC_fullgc(L);
+    collected = 1;
+    if (g->totalbytes >= nearlimit(g->memlimit)) {  /* still near? */
+      /* the next one waits for half of the room left */
+      lu_mem room = (g->totalbytes < g->memlimit) ?
+                    g->memlimit - g->totalbytes : 0;
+      g->memnear = g->totalbytes + room/2;
+    }
+  }
+  else if (g->totalbytes < nearlimit(g->memlimit))
+    g->memnear = nearlimit(g->memlimit);
+  if (g->totalbytes < nearlimit(g->memsoft))  /* well below it again? */
+    g->memsoftarmed = (g->memsofthook != NULL);
+  else if (g->memsoftarmed) {
+    g->memsoftarmed = 0;
+    (*g->memsofthook)(L, g->memsoftud, g->totalbytes);
+  }
+  return collected;
+}
+
+/* }====================================================== */
+
+
+void luaC_step (lua_State *L) {
+  global_State *g = G(L);
+  if (!memlimits(L)) {
+    gcbegin(g);
+    luaS_rehash(L, STRREHASHSTEP);  /* move along a pending string-table resize */
+    if (isgenerational(g))
+      generationalstep(L);
+    else
+      incrementalstep(L);
+    gcend(g, 1);
+  }
+  luaC_clampthreshold(L);
+}
+
+
+#if defined(LUA_USE_PTHREADS)
+/*
+** parallel mark of full collections (see LUAI_MARKTHREADS). Workers
+** drain the gray objects left by `markroot' from private stacks and
+** hand half of a big stack to a shared pool when another worker is
+** idle; marking ends when every worker is idle and the pool is empty.
+** A worker claims a white object by clearing its white bits with a
+** CAS, so each object is traversed once and only its owner writes its
+** mark. Workers do not allocate nor touch thread stacks (traversing a
+** stack may shrink it), nor look names up in tables another worker may
+** be traversing: threads, weak tables and tables whose metatable has no
+** cached weak mode are kept gray, linked to per-worker lists and given
+** back to the collector after the join.
+*/
+
+#define MAXMARKTHREADS	32
+#define MARKSHARE	64	/* stack size worth sharing with idle workers */
+#define MARKCHUNK	256	/* objects taken from the pool at once */
+
+#define atomicor(b,m)	__atomic_fetch_or(&(b), cast_byte(m), __ATOMIC_RELAXED)
+#define atomicand(b,m)	__atomic_fetch_and(&(b), cast_byte(m), __ATOMIC_RELAXED)
+#define pgray2black(o)	atomicor((o)->gch.marked, bitmask(BLACKBIT))
+#define pblack2gray(o)	atomicand((o)->gch.marked, ~bitmask(BLACKBIT))
+
+
+static GCObject **gclistof (GCObject *o) {
+  switch (o->gch.tt) {
+    case LUA_TTABLE: return &gco2h(o)->gclist;
+    case LUA_TFUNCTION: return &gco2cl(o)->c.gclist;
+    case LUA_TTHREAD: return &gco2th(o)->gclist;
+    case LUA_TPROTO: return &gco2p(o)->gclist;
+    default: lua_assert(0); return NULL;
+  }
+}
+
+
+typedef struct MarkPool {
+  pthread_mutex_t mu;
+  pthread_cond_t cv;
+  GCObject **objs;  /* shared gray objects */
+  int n, size;
+  int nworkers;
+  int idle;  /* workers waiting for work */
+  int done;
+  GCObject *overflow;  /* objects a worker had no room for */
+} MarkPool;
+
+
+typedef struct MarkWorker {
+  global_State *g;
+  MarkPool *pool;
+  GCObject **stack;  /* private gray objects */
+  int n, size;
+  GCObject *weak;  /* weak tables traversed */
+  GCObject *left;  /* gray objects left to the collector */
+} MarkWorker;
+
+
+static int growmarkstack (MarkWorker *w, int need) {
+  int size = w->size;
+  GCObject **s;
+  while (size < need) size = (size == 0) ? MARKCHUNK : 2*size;
+  s = (GCObject **)realloc(w->stack, size * sizeof(GCObject *));
+  if (s == NULL) return 0;
+  w->stack = s;
+  w->size = size;
+  return 1;
+}
+
+
+static void pushgray (MarkWorker *w, GCObject *o) {
+  if (w->n == w->size && !growmarkstack(w, w->n + 1)) {
+    MarkPool *p = w->pool;  /* no memory: leave it to the collector */
+    pthread_mutex_lock(&p->mu);
+    *gclistof(o) = p->overflow;
+    p->overflow = o;
+    pthread_mutex_unlock(&p->mu);
+    return;
+  }
+  w->stack[w->n++] = o;
+}
+
+
+static void pmarkobject (MarkWorker *w, GCObject *o) {
+  lu_byte m = __atomic_load_n(&o->gch.marked, __ATOMIC_RELAXED);
+  do {
+    if (!(m & WHITEBITS)) return;  /* already claimed */
+  } while (!__atomic_compare_exchange_n(&o->gch.marked, &m,
+               cast_byte(m & ~WHITEBITS), 1,
+               __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+  switch (o->gch.tt) {
+    case LUA_TSTRING: return;
+    case LUA_TUSERDATA: {
+      Table *mt = gco2u(o)->metatable;
+      pgray2black(o);
+      if (mt) pmarkobject(w, obj2gco(mt));
+      pmarkobject(w, obj2gco(gco2u(o)->env));
+      return;
+    }
+    case LUA_TUPVAL: {
+      UpVal *uv = gco2uv(o);
+      if (iscollectable(uv->v)) pmarkobject(w, gcvalue(uv->v));
+      if (uv->v == &uv->u.value)  /* closed? */
+        pgray2black(o);
+      return;
+    }
+    default: pushgray(w, o);
+  }
+}
+
+#define pmarkvalue(w,o) { checkconsistency(o); \
+  if (iscollectable(o)) pmarkobject(w, gcvalue(o)); }
+
+
+/*
+** the weak mode of a metatable, read only from its tag-method cache
+** (see luaT_gettm), which the stopped mutator cannot change: looking the
+** name up would read nodes that another worker traversing `mt' may be
+** clearing (removeentry). 0 when the cache does not tell; then `*mode'
+** is unset
+*/
+static int weakmode (Table *mt, const TValue **mode) {
+  *mode = NULL;
+  if (mt == NULL || (mt->flags & (1u<<TM_MODE))) return 1;
+  if (!(mt->flags & TMCACHED)) return 0;
+  *mode = mt->tmcache[TM_MODE];
+  return 1;
+}
+
+
+static void ptraversetable (MarkWorker *w, Table *h, const TValue *mode) {
+  int i;
+  int weakkey = 0;
+  int weakvalue = 0;
+  if (h->metatable)
+    pmarkobject(w, obj2gco(h->metatable));
+  if (mode && ttisstring(mode)) {
+    weakkey = (strchr(svalue(mode), 'k') != NULL);
+    weakvalue = (strchr(svalue(mode), 'v') != NULL);
+    if (weakkey || weakvalue) {
+      atomicand(h->marked, ~(KEYWEAK | VALUEWEAK | bitmask(BLACKBIT)));
+      atomicor(h->marked, (weakkey << KEYWEAKBIT) |
+                          (weakvalue << VALUEWEAKBIT));
+      h->gclist = w->weak;
+      w->weak = obj2gco(h);
+    }
+  }
+  if (!weakvalue) {
+    i = h->sizearray;
+    while (i--)
+      pmarkvalue(w, &h->array[i]);
+  }
+  if (weakkey) return;  /* ephemerons are left to the collector */
+  i = sizenode(h);
+  while (i--) {
+    Node *n = gnode(h, i);
+    TValue *v = gnval(h, i);
+    if (ttisnil(v))
+      removeentry(n, v);
+    else {
+      pmarkvalue(w, gkey(n));
+      if (!weakvalue) pmarkvalue(w, v);
+    }
+  }
+}
+
+
+static void ptraverseproto (MarkWorker *w, Proto *f) {
+  int i;
+  if (f->cache && (__atomic_load_n(&f->cache->c.marked, __ATOMIC_RELAXED) &
+                   WHITEBITS))
+    f->cache = NULL;
+  if (f->source) pmarkobject(w, obj2gco(f->source));
+  if (f->debugsec) pmarkobject(w, obj2gco(f->debugsec));
+  for (i=0; i<f->sizek; i++)
+    pmarkvalue(w, &f->k[i]);
+  for (i=0; i<f->sizeupvalues; i++) {
+    if (f->upvalues[i])
+      pmarkobject(w, obj2gco(f->upvalues[i]));
+  }
+  for (i=0; i<f->sizep; i++) {
+    if (f->p[i])
+      pmarkobject(w, obj2gco(f->p[i]));
+  }
+  for (i=0; i<f->sizelocvars; i++) {
+    if (f->locvars[i].varname)
+      pmarkobject(w, obj2gco(f->locvars[i].varname));
+  }
+}
+
+
+static void ptraverseclosure (MarkWorker *w, Closure *cl) {
+  int i;
+  pmarkobject(w, obj2gco(cl->c.env));
+  if (cl->c.isC) {
+    for (i=0; i<cl->c.nupvalues; i++)
+      pmarkvalue(w, &cl->c.upvalue[i]);
+  }
+  else {
+    pmarkobject(w, obj2gco(cl->l.p));
+    for (i=0; i<cl->l.nupvalues; i++)
+      pmarkobject(w, obj2gco(cl->l.upvals[i]));
+  }
+}
+
+
+static void ptraverse (MarkWorker *w, GCObject *o) {
+  const TValue *mode;
+  switch (o->gch.tt) {
+    case LUA_TTABLE: {
+      if (!weakmode(gco2h(o)->metatable, &mode))
+        break;  /* weak mode unknown: stays gray */
+      pgray2black(o);
+      ptraversetable(w, gco2h(o), mode);
+      return;
+    }
+    case LUA_TFUNCTION: pgray2black(o); ptraverseclosure(w, gco2cl(o)); return;
+    case LUA_TPROTO: pgray2black(o); ptraverseproto(w, gco2p(o)); return;
+    case LUA_TTHREAD: break;  /* stays gray */
+    default: lua_assert(0); return;
+  }
+  *gclistof(o) = w->left;
+  w->left = o;
+}
+
+
+/* move half of a big private stack to the pool if someone is idle */
+static void sharework (MarkWorker *w) {
+  MarkPool *p = w->pool;
+  int k = w->n / 2;
+  pthread_mutex_lock(&p->mu);
+  if (p->idle > 0 && p->n + k <= p->size) {
+    memcpy(p->objs + p->n, w->stack, k * sizeof(GCObject *));
+    memmove(w->stack, w->stack + k, (w->n - k) * sizeof(GCObject *));
+    p->n += k;
+    w->n -= k;
+    pthread_cond_broadcast(&p->cv);
+  }
+  pthread_mutex_unlock(&p->mu);
+}
+
+
+/* take a chunk of the pool; 0 when marking is over */
+static int takework (MarkWorker *w) {
+  MarkPool *p = w->pool;
+  pthread_mutex_lock(&p->mu);
+  for (;;) {
+    if (p->n > 0) {
+      int k = (p->n < MARKCHUNK) ? p->n : MARKCHUNK;
+      if (w->size < k && !growmarkstack(w, k))
+        k = w->size;  /* workers start with room for MARKCHUNK */
+      p->n -= k;
+      memcpy(w->stack, p->objs + p->n, k * sizeof(GCObject *));
+      w->n = k;
+      pthread_mutex_unlock(&p->mu);
+      return 1;
+    }
+    if (p->done) break;
+    /* atomic: busy workers peek at `idle' without the mutex */
+    if (__atomic_add_fetch(&p->idle, 1, __ATOMIC_RELAXED) == p->nworkers) {
+      p->done = 1;
+      pthread_cond_broadcast(&p->cv);
+      break;
+    }
+    pthread_cond_wait(&p->cv, &p->mu);
+    __atomic_sub_fetch(&p->idle, 1, __ATOMIC_RELAXED);
+  }
+  pthread_mutex_unlock(&p->mu);
+  return 0;
+}
+
+
+static void *markworker (void *ud) {
+  MarkWorker *w = (MarkWorker *)ud;
+  MarkPool *p = w->pool;
+  do {
+    while (w->n > 0) {
+      ptraverse(w, w->stack[--w->n]);
+      if (w->n >= MARKSHARE && __atomic_load_n(&p->idle, __ATOMIC_RELAXED))
+        sharework(w);
+    }
+  } while (takework(w));
+  return NULL;
+}
+
+
+/*
+** drain `g->gray' with `n' threads (the caller is one of them); on any
+** failure the gray objects are simply left to the serial collector
+*/
+static void parallelmark (global_State *g, int n) {
+  MarkPool p;
+  MarkWorker w[MAXMARKTHREADS];
+  pthread_t th[MAXMARKTHREADS];
+  GCObject *o;
+  int i, started;
+  for (i = 0; i < n; i++) {
+    w[i].g = g;
+    w[i].pool = &p;
+    w[i].stack = NULL;
+    w[i].n = w[i].size = 0;
+    w[i].weak = w[i].left = NULL;
+    if (!growmarkstack(&w[i], MARKCHUNK)) break;
+  }
+  n = i;  /* workers with a stack */
+  p.size = 0;
+  for (o = g->gray; o; o = *gclistof(o)) p.size++;
+  p.size = (p.size + MARKSHARE * n) * 2;  /* room for every share */
+  p.objs = (n > 0) ? (GCObject **)malloc(p.size * sizeof(GCObject *)) : NULL;
+  if (p.objs == NULL) goto freestacks;
+  if (pthread_mutex_init(&p.mu, NULL) != 0) goto freeobjs;
+  if (pthread_cond_init(&p.cv, NULL) != 0) goto freemutex;
+  p.n = 0;
+  for (o = g->gray; o; o = *gclistof(o)) p.objs[p.n++] = o;
+  g->gray = NULL;
+  p.idle = p.done = 0;
+  p.overflow = NULL;
+  p.nworkers = n;
+  for (started = 1; started < n; started++) {
+    if (pthread_create(&th[started], NULL, markworker, &w[started]) != 0)
+      break;
+  }
+  if (started < n) {  /* could not start them all: wait for fewer */
+    pthread_mutex_lock(&p.mu);
+    p.nworkers = started;
+    pthread_mutex_unlock(&p.mu);
+  }
+  markworker(&w[0]);
+  for (i = 1; i < started; i++)
+    pthread_join(th[i], NULL);
+  /* give back what workers left gray, weak tables and overflow */
+  lua_assert(p.n == 0);
+  for (i = 0; i < n; i++) {
+    while ((o = w[i].left) != NULL) {
+      w[i].left = *gclistof(o);
+      *gclistof(o) = g->gray;
+      g->gray = o;
+    }
+    while ((o = w[i].weak) != NULL) {
+      Table *h = gco2h(o);
+      w[i].weak = h->gclist;
+      if (!testbit(h->marked, KEYWEAKBIT)) linkweak(&g->weak, h);
+      else if (!testbit(h->marked, VALUEWEAKBIT)) linkweak(&g->ephemeron, h);
+      else linkweak(&g->allweak, h);
+    }
+  }
+  while ((o = p.overflow) != NULL) {
+    p.overflow = *gclistof(o);
+    *gclistof(o) = g->gray;
+    g->gray = o;
+  }
+  pthread_cond_destroy(&p.cv);
+ freemutex:
+  pthread_mutex_destroy(&p.mu);
+ freeobjs:
+  free(p.objs);
+ freestacks:
+  for (i = 0; i < n; i++)
+    free(w[i].stack);
+}
+#endif
+
+
+static void fullgc (lua_State *L) {
+  global_State *g = G(L);
+  int gckind = g->gckind;
+  g->gckind = KGC_NORMAL;  /* sweep turns every object back to white (young) */
+  /* in generational mode old objects must be swept too */
+  if (g->gcstate <= GCSpropagate || gckind == KGC_GEN) {	/* 跳过mark阶段 */
     /* reset sweep marks to sweep all elements (returning them to white) */
     g->sweepstrgc = 0;
     g->sweepgc = &g->rootgc;
     /* reset other collector lists */
     g->gray = NULL;
     g->grayagain = NULL;
-    g->weak = NULL;
+    g->weak = g->ephemeron = g->allweak = NULL;
     g->gcstate = GCSsweepstring;
   }
   lua_assert(g->gcstate != GCSpause && g->gcstate != GCSpropagate);
@@ -706,21 +1742,73 @@ void luaC_fullgc (lua_State *L) {
     lua_assert(g->gcstate == GCSsweepstring || g->gcstate == GCSsweep);
     singlestep(L);
   }
+  g->gckind = gckind;  /* in generational mode this is a major collection */
   markroot(L);
+#if defined(LUA_USE_PTHREADS)
+  if (g->gcmarkthreads > 1 && g->totalbytes >= LUAI_PARMARKMIN)
+    parallelmark(g, (g->gcmarkthreads < MAXMARKTHREADS) ?
+                    g->gcmarkthreads : MAXMARKTHREADS);
+#endif
   while (g->gcstate != GCSpause) {
     singlestep(L);
   }
+  if (isgenerational(g)) {
+    g->gcstate = GCSpropagate;  /* generational mode stays in propagate */
+    g->gcmajorbase = g->totalbytes;
+  }
   setthreshold(g);
 }
 
 
+void luaC_fullgc (lua_State *L) {
+  global_State *g = G(L);
+  gcbegin(g);
+  fullgc(L);
+  gcend(g, 0);
+  luaC_clampthreshold(L);
+}
+
+
+/*
+** switch the collector between incremental (KGC_NORMAL) and
+** generational (KGC_GEN) modes
+*/
+void luaC_changemode (lua_State *L, int mode) {
+  global_State *g = G(L);
+  if (mode == g->gckind) return;  /* nothing to change */
+  gcbegin(g);
+  if (mode == KGC_GEN) {
+    /* start a new cycle, which will be the first generational one */
+    while (g->gcstate != GCSpropagate)
+      singlestep(L);
+    g->gcmajorbase = g->totalbytes;
+    g->gckind = KGC_GEN;
+  }
+  else {
+    /* sweep all objects back to white; as white has not changed,
+       nothing extra will be collected */
+    g->gckind = KGC_NORMAL;
+    g->sweepstrgc = 0;
+    g->sweepgc = &g->rootgc;
+    g->gray = NULL;
+    g->grayagain = NULL;
+    g->weak = g->ephemeron = g->allweak = NULL;
+    g->gcstate = GCSsweepstring;
+    while (g->gcstate != GCSfinalize)
+      singlestep(L);
+  }
+  gcend(g, 0);
+}
+
+
 void luaC_barrierf (lua_State *L, GCObject *o, GCObject *v) {
   global_State *g = G(L);
   lua_assert(isblack(o) && iswhite(v) && !isdead(g, v) && !isdead(g, o));
-  lua_assert(g->gcstate != GCSfinalize && g->gcstate != GCSpause);
+  lua_assert(isgenerational(g) ||
+             (g->gcstate != GCSfinalize && g->gcstate != GCSpause));
   lua_assert(ttype(&o->gch) != LUA_TTABLE);		// table 调用下面函数
   /* must keep invariant? */
-  if (g->gcstate == GCSpropagate)
+  if (keepinvariant(g))
     reallymarkobject(g, v);  /* restore invariant */
   else  /* don't mind */
     makewhite(g, o);  /* mark as white just to avoid other barriers */
@@ -731,8 +1819,9 @@ void luaC_barrierback (lua_State *L, Table *t) {
   global_State *g = G(L);
   GCObject *o = obj2gco(t);
   lua_assert(isblack(o) && !isdead(g, o));
-  lua_assert(g->gcstate != GCSfinalize && g->gcstate != GCSpause);	/* 为何不能是 GCSfinalize ？ */
-  black2gray(o);  /* make table gray (again) */
+  lua_assert(isgenerational(g) ||	/* 为何不能是 GCSfinalize ？ */
+             (g->gcstate != GCSfinalize && g->gcstate != GCSpause));
+  black2gray(o);  /* in generational mode `grayagain' is the remembered set */  /* make table gray (again) */
   t->gclist = g->grayagain;
   g->grayagain = o;
 }
@@ -746,6 +1835,7 @@ void luaC_link (lua_State *L, GCObject *o, lu_byte tt) {
   
   o->gch.marked = luaC_white(g);	/* 挂上来时的marked都被标记为luaC_white */
   o->gch.tt = tt;
+  luaM_heaptag(L, o, tt);
 }
 
 
@@ -754,9 +1844,10 @@ void luaC_linkupval (lua_State *L, UpVal *uv) {
   GCObject *o = obj2gco(uv);
   o->gch.next = g->rootgc;  /* link upvalue into `rootgc' list */
   g->rootgc = o;
+  resetbit(o->gch.marked, OLDBIT);  /* it is in the young part of the list now */
   if (isgray(o)) { 
   	/* upval是对已知对象的引用，不是新数据，这里需要barrier(https://shankusu2017.github.io/lua/%E4%BA%91%E9%A3%8E%E7%9A%84Blog-Lua%20GC%20%E7%9A%84%E6%BA%90%E7%A0%81%E5%89%96%E6%9E%901/) */
-    if (g->gcstate == GCSpropagate) {
+    if (keepinvariant(g)) {
       gray2black(o);  /* closed upvalues need barrier */
       luaC_barrier(L, uv, uv->v);
     }
@@ -21,6 +21,22 @@
 #define GCSfinalize	4		// 处理带有mt且mt有gc的所有userData的阶段？ */
 
 
+/*
+** kinds of collection (`gckind')
+*/
+#define KGC_NORMAL	0		/* incremental */
+#define KGC_GEN		1		/* generational: minor collections + occasional major ones */
+
+#define isgenerational(g)	((g)->gckind == KGC_GEN)
+
+/*
+** the invariant `black objects never point to white ones' must hold
+** while propagating and, in generational mode, all the time (old
+** objects stay black between minor collections)
+*/
+#define keepinvariant(g)	(isgenerational(g) || (g)->gcstate == GCSpropagate)
+
+
 /*
 ** some userful bit tricks
 */
@@ -57,6 +73,7 @@
 ** bit 4 - for tables: has weak values
 ** bit 5 - object is fixed (should not be collected)
 ** bit 6 - object is "super" fixed (only the main thread)
+** bit 7 - object is old (survived a generational collection)
 */
 
 
@@ -69,6 +86,7 @@
 #define VALUEWEAKBIT	4		/* 拥有弱val */
 #define FIXEDBIT	5			/* 保留数据，不能被GC,eg:语言关键字 */
 #define SFIXEDBIT	6			/* 保留数据，only used for mainThread */
+#define OLDBIT		7			/* 分代模式下存活过一轮的老对象 */
 #define WHITEBITS	bit2mask(WHITE0BIT, WHITE1BIT)
 
 /* 是任何一种白色吗？ bit[1,0]任一bit为1即可 */
@@ -79,6 +97,9 @@
 /* 是灰色吗？ 不是黑，同时也不是任何一种白，bit.idx[2,1,0]均为0 */
 #define isgray(x)	(!isblack(x) && !iswhite(x))	
 
+/* 是老对象吗？(仅分代模式) */
+#define isold(x)	testbit((x)->gch.marked, OLDBIT)
+
 /* 保留 bit[7,2]位的数据，将bit[1,0]翻转 */
 #define otherwhite(g)	(g->currentwhite ^ WHITEBITS)
 
@@ -105,6 +126,9 @@
 /* 当前white的bits[1,0]值 */
 #define luaC_white(g)	cast(lu_byte, (g)->currentwhite & WHITEBITS)	
 
+/* marks of the objects of a shared heap: black and fixed, never white */
+#define SHAREDMARKS	cast_byte(bitmask(BLACKBIT) | bitmask(FIXEDBIT))
+
 
 #define luaC_checkGC(L) { \
   condhardstacktests(luaD_reallocstack(L, L->stacksize - EXTRA_STACK - 1)); \
@@ -131,6 +155,12 @@ LUAI_FUNC void luaC_callGCTM (lua_State *L);
 LUAI_FUNC void luaC_freeall (lua_State *L);
 LUAI_FUNC void luaC_step (lua_State *L);
 LUAI_FUNC void luaC_fullgc (lua_State *L);
+LUAI_FUNC void luaC_changemode (lua_State *L, int mode);
+LUAI_FUNC int luaC_idle (lua_State *L, int us);
+LUAI_FUNC void luaC_clampthreshold (lua_State *L);
+LUAI_FUNC void luaC_setmemlimits (lua_State *L);
+LUAI_FUNC int luaC_bgsweep (lua_State *L, int on);
+LUAI_FUNC void luaC_syncsweep (lua_State *L);
 LUAI_FUNC void luaC_link (lua_State *L, GCObject *o, lu_byte tt);
 LUAI_FUNC void luaC_linkupval (lua_State *L, UpVal *uv);
 LUAI_FUNC void luaC_barrierf (lua_State *L, GCObject *o, GCObject *v);
@@ -23,6 +23,9 @@ static const luaL_Reg lualibs[] = {
   {LUA_STRLIBNAME, luaopen_string},
   {LUA_MATHLIBNAME, luaopen_math},
   {LUA_DBLIBNAME, luaopen_debug},
+  {LUA_CHANLIBNAME, luaopen_chan},
+  {LUA_BITLIBNAME, luaopen_bit},
+  {LUA_ARRAYLIBNAME, luaopen_array},
   {NULL, NULL}
 };
 
@@ -18,14 +18,51 @@
 #include "lauxlib.h"
 #include "lualib.h"
 
+#if defined(LUA_USE_POSIX)
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#endif
+
+#if defined(LUA_USE_EPOLL)
+#include <sys/epoll.h>
+#elif defined(LUA_USE_KQUEUE)
+#include <sys/types.h>
+#include <sys/event.h>
+#endif
+
+#if defined(LUA_USE_PTHREADS)
+#include <pthread.h>
+#endif
+
 
 
 #define IO_INPUT	1
 #define IO_OUTPUT	2
 
+/* default count of io.readlines, also the most it preallocates */
+#define IO_READLINES	1024
+
 
 static const char *const fnames[] = {"input", "output"};
 
+
+/*
+** Payload of a file handle.  'f' must stay the first field: the rest of
+** the library (and other C code) sees the handle as a 'FILE **'.
+*/
+typedef struct LStream {
+  FILE *f;  /* NULL for a closed file */
+  char *vbuf;  /* buffer given to setvbuf, owned by the handle */
+  size_t vsize;
+  char *abuf;  /* bytes read ahead by `aread', owned by the handle */
+  size_t asize;
+  size_t astart, aend;  /* what is left of them */
+  int async;  /* descriptor made non-blocking by `aread' or `awrite' */
+} LStream;
+
 /* 
 ** RETURNS: 成功：true
 **          失败：nil, filename, errdesc
@@ -82,6 +119,37 @@ static FILE *tofile (lua_State *L) {
 
 
 
+/*
+** native finalizers of file handles (see lua_setfinalizer): they close
+** what `__close' would, with no call into Lua and possibly on the
+** background sweeper. Standard files are never closed.
+*/
+static void closestream (LStream *p, int popen, lua_Alloc allocf, void *ud) {
+  if (p->f == stdin || p->f == stdout || p->f == stderr)
+    return;
+  if (p->f != NULL) {
+    if (popen) (void)lua_pclose(NULL, p->f);
+    else fclose(p->f);
+  }
+  if (p->vbuf != NULL)
+    allocf(ud, p->vbuf, p->vsize, 0);
+  if (p->abuf != NULL)
+    allocf(ud, p->abuf, p->asize, 0);
+}
+
+
+static void io_fin (void *p, size_t sz, lua_Alloc allocf, void *ud) {
+  (void)sz;
+  closestream((LStream *)p, 0, allocf, ud);
+}
+
+
+static void io_pfin (void *p, size_t sz, lua_Alloc allocf, void *ud) {
+  (void)sz;
+  closestream((LStream *)p, 1, allocf, ud);
+}
+
+
 /*
 ** When creating file handles, always creates a `closed' file handle
 ** before opening the actual file; so, if there is a memory error, the
@@ -90,17 +158,51 @@ static FILE *tofile (lua_State *L) {
 ** 构建一个空负载的userData，初始化其metatable后，返回
 */
 static FILE **newfile (lua_State *L) {
-  FILE **pf = (FILE **)lua_newuserdata(L, sizeof(FILE *));
+  LStream *p = (LStream *)lua_newuserdata(L, sizeof(LStream));
+  FILE **pf = &p->f;
   *pf = NULL;  /* file handle is currently `closed' */
+  p->vbuf = NULL;
+  p->vsize = 0;
+  p->abuf = NULL;
+  p->asize = p->astart = p->aend = 0;
+  p->async = 0;
 
   /* 这里对打开的文件句柄做统一的metatable处理 */
   luaL_getmetatable(L, LUA_FILEHANDLE);	
   lua_setmetatable(L, -2);
+  lua_setfinalizer(L, -1, io_fin, LUA_FINTHREADSAFE);
   
   return pf;
 }
 
 
+/*
+** frees the setvbuf buffer of a handle; the stream must not use it anymore.
+** (Standard files are never closed, so their buffer lives until exit.)
+*/
+static void freevbuf (lua_State *L, LStream *p) {
+  if (p->vbuf != NULL) {
+    void *ud;
+    lua_Alloc allocf = lua_getallocf(L, &ud);
+    allocf(ud, p->vbuf, p->vsize, 0);
+    p->vbuf = NULL;
+    p->vsize = 0;
+  }
+}
+
+
+/* frees the read-ahead of `aread' */
+static void freeabuf (lua_State *L, LStream *p) {
+  if (p->abuf != NULL) {
+    void *ud;
+    lua_Alloc allocf = lua_getallocf(L, &ud);
+    allocf(ud, p->abuf, p->asize, 0);
+    p->abuf = NULL;
+    p->asize = p->astart = p->aend = 0;
+  }
+}
+
+
 /*
 ** function to (not) close the standard files stdin, stdout, and stderr
 */
@@ -118,6 +220,8 @@ static int io_pclose (lua_State *L) {
   FILE **p = tofilep(L);
   int ok = lua_pclose(L, *p);
   *p = NULL;
+  freevbuf(L, (LStream *)p);
+  freeabuf(L, (LStream *)p);
   return pushresult(L, ok, NULL);
 }
 
@@ -129,6 +233,8 @@ static int io_fclose (lua_State *L) {
   FILE **p = tofilep(L);
   int ok = (fclose(*p) == 0);
   *p = NULL;
+  freevbuf(L, (LStream *)p);
+  freeabuf(L, (LStream *)p);
   return pushresult(L, ok, NULL);
 }
 
@@ -151,11 +257,18 @@ static int io_close (lua_State *L) {
 }
 
 
-static int io_gc (lua_State *L) {
-  FILE *f = *tofilep(L);
-  /* ignore closed files */
-  if (f != NULL)
-    aux_close(L);
+/*
+** __clone (see lua_clonestate): standard files are shared by all copies;
+** any other file stays with the original, so its copy is closed
+*/
+static int io_clone (lua_State *L) {
+  LStream *p = (LStream *)luaL_checkudata(L, 1, LUA_FILEHANDLE);
+  if (p->f != stdin && p->f != stdout && p->f != stderr)
+    p->f = NULL;
+  p->vbuf = NULL;  /* the buffers belong to the original */
+  p->vsize = 0;
+  p->abuf = NULL;
+  p->asize = p->astart = p->aend = 0;
   return 0;
 }
 
@@ -187,6 +300,7 @@ static int io_popen (lua_State *L) {
   const char *filename = luaL_checkstring(L, 1);
   const char *mode = luaL_optstring(L, 2, "r");
   FILE **pf = newfile(L);
+  lua_setfinalizer(L, -1, io_pfin, LUA_FINTHREADSAFE);
   *pf = lua_popen(L, filename, mode);
   return (*pf == NULL) ? pushresult(L, 0, filename) : 1;
 }
@@ -347,11 +461,45 @@ static int read_line (lua_State *L, FILE *f) {
 }
 
 
+/*
+** number of bytes left to read in a regular file, 0 when it is unknown
+*/
+#if defined(LUA_USE_POSIX)
+static size_t filerest (FILE *f) {
+  struct stat st;
+  long pos;
+  if (fstat(fileno(f), &st) != 0 || !S_ISREG(st.st_mode))
+    return 0;
+  pos = ftell(f);
+  if (pos < 0 || (off_t)pos >= st.st_size)
+    return 0;
+  return (size_t)(st.st_size - pos);
+}
+#else
+#define filerest(f)	((void)(f), (size_t)0)
+#endif
+
+
 static int read_chars (lua_State *L, FILE *f, size_t n) {
   size_t rlen;  /* how much to read */
   size_t nr;  /* number of chars actually read */
+  size_t rest = filerest(f);
   luaL_Buffer b;
   luaL_buffinit(L, &b);
+  if (rest > LUAL_BUFFERSIZE && n > LUAL_BUFFERSIZE) {
+    /* size known upfront: read it with a single fread */
+    size_t bl = (rest < n) ? rest : n;
+    char *p = (char *)lua_newuserdata(L, bl);
+    nr = fread(p, sizeof(char), bl, f);
+    lua_pushlstring(L, p, nr);
+    lua_remove(L, -2);  /* remove block */
+    luaL_addvalue(&b);
+    n -= nr;
+    if (n == 0 || nr < bl) {  /* nothing else to read? */
+      luaL_pushresult(&b);
+      return 1;
+    }
+  }
   rlen = LUAL_BUFFERSIZE;  /* try to read that much each time */
   do {
     char *p = luaL_prepbuffer(&b);
@@ -412,6 +560,30 @@ static int g_read (lua_State *L, FILE *f, int first) {
 }
 
 
+/*
+** reads up to 'n' lines into a new table; nil at end of file
+*/
+static int g_readlines (lua_State *L, FILE *f, int narg) {
+  int n = luaL_optint(L, narg, IO_READLINES);
+  int i;
+  luaL_argcheck(L, n > 0, narg, "positive count expected");
+  clearerr(f);
+  lua_createtable(L, (n < IO_READLINES) ? n : IO_READLINES, 0);
+  for (i = 1; i <= n; i++) {
+    if (!read_line(L, f)) {
+      lua_pop(L, 1);  /* remove empty result */
+      break;
+    }
+    lua_rawseti(L, -2, i);
+  }
+  if (ferror(f))
+    return pushresult(L, 0, NULL);
+  if (i == 1)
+    lua_pushnil(L);  /* end of file */
+  return 1;
+}
+
+
 static int io_read (lua_State *L) {
   return g_read(L, getiofile(L, IO_INPUT), 1);
 }
@@ -422,6 +594,22 @@ static int f_read (lua_State *L) {
 }
 
 
+/* io.readlines ([file,] [n]) */
+static int io_readlines (lua_State *L) {
+  if (lua_type(L, 1) == LUA_TUSERDATA)
+    return g_readlines(L, tofile(L), 2);
+  else {
+    int narg = lua_isnone(L, 2) ? 1 : 2;  /* io.readlines(n) is allowed */
+    return g_readlines(L, getiofile(L, IO_INPUT), narg);
+  }
+}
+
+
+static int f_readlines (lua_State *L) {
+  return g_readlines(L, tofile(L), 2);
+}
+
+
 static int io_readline (lua_State *L) {
   FILE *f = *(FILE **)lua_touserdata(L, lua_upvalueindex(1));
   int sucess;
@@ -444,21 +632,71 @@ static int io_readline (lua_State *L) {
 /* }====================================================== */
 
 
+/*
+** writes `n' as LUA_NUMBER_FMT does, into `buff' (LUAI_MAXNUMBER2STR
+** bytes); returns the length. Integers that "%.14g" prints in full (no
+** exponent) and that fit a long skip printf.
+*/
+#define FMT_MAXINT	((sizeof(long) >= 8) ? 1e14 : 1e9)
+
+static size_t fmtnumber (char *buff, lua_Number n) {
+#if defined(LUA_NUMBER_DOUBLE)
+  if (n > -FMT_MAXINT && n < FMT_MAXINT && n == (lua_Number)(long)n &&
+      (n != 0 || 1/n > 0)) {  /* not -0, which prints as "-0" */
+    char digits[16];
+    unsigned long u = (n < 0) ? (unsigned long)-(long)n : (unsigned long)n;
+    size_t i = 0, len = 0;
+    do {
+      digits[i++] = (char)('0' + u % 10);
+      u /= 10;
+    } while (u != 0);
+    if (n < 0) buff[len++] = '-';
+    while (i > 0) buff[len++] = digits[--i];
+    buff[len] = '\0';
+    return len;
+  }
+#endif
+  lua_number2str(buff, n);
+  return strlen(buff);
+}
+
+
+/*
+** Pieces of a write go through one stack buffer, so a call makes one
+** fwrite (and takes the stream lock once) unless it is long. Arguments
+** are checked first: a bad one writes nothing.
+*/
 static int g_write (lua_State *L, FILE *f, int arg) {
   int nargs = lua_gettop(L) - 1;
   int status = 1;
+  int i;
+  char buff[LUAL_BUFFERSIZE];
+  size_t nb = 0;
+  for (i = 0; i < nargs; i++)
+    if (lua_type(L, arg + i) != LUA_TNUMBER)
+      luaL_checkstring(L, arg + i);
   for (; nargs--; arg++) {
+    char nbuff[LUAI_MAXNUMBER2STR];
+    size_t l;
+    const char *s;
     if (lua_type(L, arg) == LUA_TNUMBER) {
-      /* optimization: could be done exactly as for strings */
-      status = status &&
-          fprintf(f, LUA_NUMBER_FMT, lua_tonumber(L, arg)) > 0;
+      l = fmtnumber(nbuff, lua_tonumber(L, arg));
+      s = nbuff;
     }
-    else {
-      size_t l;
-      const char *s = luaL_checklstring(L, arg, &l);
+    else
+      s = lua_tolstring(L, arg, &l);
+    if (nb + l > sizeof(buff)) {  /* does not fit? */
+      status = status && (fwrite(buff, sizeof(char), nb, f) == nb);
+      nb = 0;
+    }
+    if (l >= sizeof(buff))  /* long piece: write it in place */
       status = status && (fwrite(s, sizeof(char), l, f) == l);
+    else {
+      memcpy(buff + nb, s, l);
+      nb += l;
     }
   }
+  status = status && (fwrite(buff, sizeof(char), nb, f) == nb);
   return pushresult(L, status, NULL);
 }
 
@@ -493,60 +731,1710 @@ static int f_setvbuf (lua_State *L) {
   static const int mode[] = {_IONBF, _IOFBF, _IOLBF};
   static const char *const modenames[] = {"no", "full", "line", NULL};
   FILE *f = tofile(L);
+  LStream *p = (LStream *)tofilep(L);
   int op = luaL_checkoption(L, 2, NULL, modenames);
   lua_Integer sz = luaL_optinteger(L, 3, LUAL_BUFFERSIZE);
-  int res = setvbuf(f, NULL, mode[op], sz);
+  char *buf = NULL;
+  void *ud;
+  lua_Alloc allocf = lua_getallocf(L, &ud);
+  int res;
+  luaL_argcheck(L, sz > 0, 3, "positive size expected");
+  /* with a NULL buffer the C library is free to ignore 'sz' (glibc does),
+     so the handle supplies a buffer of its own */
+  if (mode[op] != _IONBF) {
+    buf = (char *)allocf(ud, NULL, 0, (size_t)sz);
+    if (buf == NULL)
+      luaL_error(L, "not enough memory");
+  }
+  res = setvbuf(f, buf, mode[op], (size_t)sz);
+  if (res == 0) {
+    freevbuf(L, p);  /* stream is done with the old buffer */
+    p->vbuf = buf;
+    p->vsize = (buf != NULL) ? (size_t)sz : 0;
+  }
+  else if (buf != NULL)
+    allocf(ud, buf, (size_t)sz, 0);
   return pushresult(L, res == 0, NULL);
 }
 
 
 
-static int io_flush (lua_State *L) {
-  return pushresult(L, fflush(getiofile(L, IO_OUTPUT)) == 0, NULL);
+/*
+** {======================================================
+** MAPPED FILES
+** A mapping is read-only and lives until it is collected: slices of it
+** (see lauxlib.c) keep it alive, so there is no `close' to leave them
+** dangling.
+** =======================================================
+*/
+
+typedef struct LMap {
+  char *p;  /* mapped bytes; NULL if the mapping failed */
+  size_t len;
+} LMap;
+
+
+static char mm_empty[1] = "";  /* an empty file has nothing to map */
+
+
+#if defined(LUA_USE_POSIX)
+
+#include <sys/mman.h>
+
+static char *mm_map (lua_State *L, const char *path, size_t *len) {
+  struct stat st;
+  void *p = MAP_FAILED;
+  int fd = open(path, O_RDONLY);
+  if (fd >= 0 && fstat(fd, &st) == 0) {
+    *len = (size_t)st.st_size;
+    p = (*len == 0) ? mm_empty : mmap(NULL, *len, PROT_READ, MAP_SHARED, fd, 0);
+  }
+  if (p == MAP_FAILED)
+    lua_pushfstring(L, "%s: %s", path, strerror(errno));
+  if (fd >= 0)
+    close(fd);  /* the mapping does not need it */
+  return (p == MAP_FAILED) ? NULL : (char *)p;
 }
 
 
-static int f_flush (lua_State *L) {
-  return pushresult(L, fflush(tofile(L)) == 0, NULL);
+static void mm_unmap (char *p, size_t len) {
+  munmap(p, len);
 }
 
 
-static const luaL_Reg iolib[] = {
-  {"close", io_close},
-  {"flush", io_flush},
-  {"input", io_input},
-  {"lines", io_lines},
-  {"open", io_open},
-  {"output", io_output},
-  {"popen", io_popen},
-  {"read", io_read},
-  {"tmpfile", io_tmpfile},
-  {"type", io_type},
-  {"write", io_write},
-  {NULL, NULL}
-};
+static int mm_madvise (char *p, size_t len, int advice) {
+  static const int advices[] = {POSIX_MADV_NORMAL, POSIX_MADV_SEQUENTIAL,
+    POSIX_MADV_RANDOM, POSIX_MADV_WILLNEED, POSIX_MADV_DONTNEED};
+  size_t page = (size_t)sysconf(_SC_PAGESIZE);
+  size_t skew = (size_t)p % page;  /* must start at a page */
+  errno = posix_madvise(p - skew, len + skew, advices[advice]);
+  return (errno == 0);
+}
 
+#elif defined(LUA_WIN)
+
+#include <windows.h>
+
+static char *mm_map (lua_State *L, const char *path, size_t *len) {
+  char *p = NULL;
+  LARGE_INTEGER sz;
+  HANDLE m = NULL;
+  HANDLE h = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL,
+                         OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+  if (h != INVALID_HANDLE_VALUE && GetFileSizeEx(h, &sz)) {
+    *len = (size_t)sz.QuadPart;
+    if (*len == 0)
+      p = mm_empty;
+    else if ((m = CreateFileMappingA(h, NULL, PAGE_READONLY, 0, 0, NULL)))
+      p = (char *)MapViewOfFile(m, FILE_MAP_READ, 0, 0, 0);
+  }
+  if (p == NULL)
+    lua_pushfstring(L, "%s: system error %d", path, (int)GetLastError());
+  /* the view keeps the file and the mapping object alive */
+  if (m != NULL) CloseHandle(m);
+  if (h != INVALID_HANDLE_VALUE) CloseHandle(h);
+  return p;
+}
 
-static const luaL_Reg flib[] = {
-  {"close", io_close},
-  {"flush", f_flush},
-  {"lines", f_lines},
-  {"read", f_read},
-  {"seek", f_seek},
-  {"setvbuf", f_setvbuf},
-  {"write", f_write},
-  {"__gc", io_gc},
-  {"__tostring", io_tostring},
-  {NULL, NULL}
-};
 
-/* 构建一张libio库的公共元表 */
-static void createmeta (lua_State *L) {
-  luaL_newmetatable(L, LUA_FILEHANDLE);  /* create metatable for file handles */
-  lua_pushvalue(L, -1);  /* push metatable */
-  lua_setfield(L, -2, "__index");  /* metatable.__index = metatable */
-  luaL_register(L, NULL, flib);  /* file methods */
-  /* 运行完毕，栈上多了一个mt */
+static void mm_unmap (char *p, size_t len) {
+  (void)len;
+  UnmapViewOfFile(p);
+}
+
+
+#define mm_madvise(p,len,advice)	((void)(p), (void)(len), (void)(advice), 1)
+
+#else
+
+#define MM_NOTSUPPORTED	"memory-mapped files not enabled; check your Lua installation"
+
+static char *mm_map (lua_State *L, const char *path, size_t *len) {
+  (void)path; (void)len;
+  lua_pushliteral(L, MM_NOTSUPPORTED);
+  return NULL;
+}
+
+
+#define mm_unmap(p,len)	((void)(p), (void)(len))
+#define mm_madvise(p,len,advice)	((void)(p), (void)(len), (void)(advice), 1)
+
+#endif
+
+
+static LMap *tomap (lua_State *L) {
+  LMap *m = (LMap *)luaL_checkudata(L, 1, LUA_MMAPHANDLE);
+  if (m->p == NULL)
+    luaL_error(L, "attempt to use an unmapped file");
+  return m;
+}
+
+
+/* bytes [i, j] of the mapping, with string.sub's rules for i and j */
+static const char *mm_range (lua_State *L, LMap *m, int narg, size_t *l) {
+  ptrdiff_t len = (ptrdiff_t)m->len;
+  ptrdiff_t i = (ptrdiff_t)luaL_optinteger(L, narg, 1);
+  ptrdiff_t j = (ptrdiff_t)luaL_optinteger(L, narg + 1, -1);
+  if (i < 0) i += len + 1;
+  if (j < 0) j += len + 1;
+  if (i < 1) i = 1;
+  if (j > len) j = len;
+  *l = (i > j) ? 0 : (size_t)(j - i + 1);
+  return m->p + i - 1;
+}
+
+
+/* native finalizer of a mapping (see lua_setfinalizer) */
+static void mm_fin (void *p, size_t sz, lua_Alloc allocf, void *ud) {
+  LMap *m = (LMap *)p;
+  (void)sz; (void)allocf; (void)ud;
+  if (m->p != NULL && m->p != mm_empty)
+    mm_unmap(m->p, m->len);
+}
+
+
+/* io.mmap (filename) */
+static int io_mmap (lua_State *L) {
+  const char *path = luaL_checkstring(L, 1);
+  LMap *m = (LMap *)lua_newuserdata(L, sizeof(LMap));
+  m->p = NULL;  /* so that a memory error below does not unmap garbage */
+  m->len = 0;
+  luaL_getmetatable(L, LUA_MMAPHANDLE);
+  lua_setmetatable(L, -2);
+  lua_setfinalizer(L, -1, mm_fin, LUA_FINTHREADSAFE);
+  m->p = mm_map(L, path, &m->len);
+  if (m->p == NULL) {
+    lua_pushnil(L);
+    lua_insert(L, -2);  /* nil before the message */
+    return 2;
+  }
+  return 1;
+}
+
+
+static int mm_len (lua_State *L) {
+  lua_pushinteger(L, (lua_Integer)tomap(L)->len);
+  return 1;
+}
+
+
+/* m:sub (i [, j]): a copy of the bytes, as a string */
+static int mm_sub (lua_State *L) {
+  size_t l;
+  const char *s = mm_range(L, tomap(L), 2, &l);
+  lua_pushlstring(L, s, l);
+  return 1;
+}
+
+
+/* m:slice ([i [, j]]): the bytes in place, for the string functions */
+static int mm_slice (lua_State *L) {
+  size_t l;
+  const char *s = mm_range(L, tomap(L), 2, &l);
+  luaL_pushslice(L, 1, s, l);
+  return 1;
+}
+
+
+/* m:find, m:match, m:gmatch: the string function on the whole mapping */
+static int mm_forward (lua_State *L) {
+  LMap *m = tomap(L);
+  luaL_pushslice(L, 1, m->p, m->len);
+  lua_replace(L, 1);  /* the slice anchors the mapping */
+  lua_getfield(L, 1, lua_tostring(L, lua_upvalueindex(1)));
+  lua_insert(L, 1);
+  lua_call(L, lua_gettop(L) - 1, LUA_MULTRET);
+  return lua_gettop(L);
+}
+
+
+/* m:advise (how [, i [, j]]) */
+static int mm_advise (lua_State *L) {
+  static const char *const hows[] = {"normal", "sequential", "random",
+                                     "willneed", "dontneed", NULL};
+  LMap *m = tomap(L);
+  int how = luaL_checkoption(L, 2, NULL, hows);
+  size_t l;
+  char *s = (char *)mm_range(L, m, 3, &l);
+  if (l == 0)
+    l = 1;  /* still a valid address range */
+  return pushresult(L, m->p == mm_empty || mm_madvise(s, l, how), NULL);
+}
+
+
+static int mm_tostring (lua_State *L) {
+  LMap *m = (LMap *)luaL_checkudata(L, 1, LUA_MMAPHANDLE);
+  if (m->p == NULL)
+    lua_pushliteral(L, "mmap (unmapped)");
+  else
+    lua_pushfstring(L, "mmap (%p)", m->p);
+  return 1;
+}
+
+/* }====================================================== */
+
+
+/*
+** {======================================================
+** WRITERS
+** A writer collects writes to a file into the front one of two
+** buffers; a full front buffer is handed to a background thread (with
+** LUA_USE_PTHREADS) that writes it while the next one fills. `flush'
+** is the point where everything written so far reached the system and
+** `sync' the point where it reached the disk. Under LUA_USE_POSIX the
+** writer owns a dup of the file's descriptor, so it does not depend on
+** the file handle being open; do not mix it with writes to that file.
+** =======================================================
+*/
+
+#define WRITERSIZE	(64*1024)
+
+typedef struct LWriter {
+  FILE *f;
+  int fd;  /* own descriptor, -1 when closed */
+  int closed;
+  char *buf[2];
+  int cur;  /* buffer taking the writes */
+  size_t n;  /* bytes in it */
+  size_t size;
+  int err;  /* errno of the first failed write, reported once */
+#if defined(LUA_USE_PTHREADS)
+  pthread_t th;
+  pthread_mutex_t mu;
+  pthread_cond_t cv;
+  size_t pending;  /* bytes of the other buffer still to write */
+  int stop;
+#endif
+} LWriter;
+
+
+/* writes all of [p, p+n); returns 0 or an errno */
+static int wr_out (LWriter *w, const char *p, size_t n) {
+#if defined(LUA_USE_POSIX)
+  while (n > 0) {
+    ssize_t k = write(w->fd, p, n);
+    if (k < 0) {
+      if (errno == EINTR) continue;
+      return errno;
+    }
+    p += k;
+    n -= (size_t)k;
+  }
+  return 0;
+#else
+  if (fwrite(p, sizeof(char), n, w->f) == n) return 0;
+  return (errno != 0) ? errno : -1;
+#endif
+}
+
+
+#if defined(LUA_USE_PTHREADS)
+
+static void *wr_thread (void *ud) {
+  LWriter *w = (LWriter *)ud;
+  pthread_mutex_lock(&w->mu);
+  for (;;) {
+    while (w->pending == 0 && !w->stop)
+      pthread_cond_wait(&w->cv, &w->mu);
+    if (w->pending == 0)  /* stopped and nothing left */
+      break;
+    else {
+      const char *p = w->buf[1 - w->cur];
+      size_t n = w->pending;
+      int err;
+      pthread_mutex_unlock(&w->mu);
+      err = wr_out(w, p, n);
+      pthread_mutex_lock(&w->mu);
+      if (err != 0 && w->err == 0) w->err = err;
+      w->pending = 0;
+      pthread_cond_broadcast(&w->cv);
+    }
+  }
+  pthread_mutex_unlock(&w->mu);
+  return NULL;
+}
+
+
+/* waits for the background write; call with the mutex locked */
+#define wr_idle(w) \
+  { while ((w)->pending > 0) pthread_cond_wait(&(w)->cv, &(w)->mu); }
+
+
+/* hands the front buffer to the thread */
+static void wr_swap (LWriter *w) {
+  pthread_mutex_lock(&w->mu);
+  wr_idle(w);
+  if (w->n > 0) {
+    w->pending = w->n;
+    w->cur = 1 - w->cur;
+    w->n = 0;
+    pthread_cond_broadcast(&w->cv);
+  }
+  pthread_mutex_unlock(&w->mu);
+}
+
+
+static void wr_wait (LWriter *w) {
+  pthread_mutex_lock(&w->mu);
+  wr_idle(w);
+  pthread_mutex_unlock(&w->mu);
+}
+
+
+static int wr_start (LWriter *w) {
+  w->pending = 0;
+  w->stop = 0;
+  if (pthread_mutex_init(&w->mu, NULL) != 0)
+    return 0;
+  if (pthread_cond_init(&w->cv, NULL) != 0) {
+    pthread_mutex_destroy(&w->mu);
+    return 0;
+  }
+  if (pthread_create(&w->th, NULL, wr_thread, w) != 0) {
+    pthread_cond_destroy(&w->cv);
+    pthread_mutex_destroy(&w->mu);
+    return 0;
+  }
+  return 1;
+}
+
+
+static void wr_stop (LWriter *w) {
+  pthread_mutex_lock(&w->mu);
+  w->stop = 1;
+  pthread_cond_broadcast(&w->cv);
+  pthread_mutex_unlock(&w->mu);
+  pthread_join(w->th, NULL);
+  pthread_cond_destroy(&w->cv);
+  pthread_mutex_destroy(&w->mu);
+}
+
+#else
+
+/* no threads: the front buffer is written in place */
+static void wr_swap (LWriter *w) {
+  int err = wr_out(w, w->buf[w->cur], w->n);
+  if (err != 0 && w->err == 0) w->err = err;
+  w->n = 0;
+}
+
+#define wr_wait(w)	((void)(w))
+#define wr_start(w)	((void)(w), 1)
+#define wr_stop(w)	((void)(w))
+
+#endif
+
+
+/* takes the pending error; 0 if there is none */
+static int wr_error (LWriter *w) {
+  int err;
+#if defined(LUA_USE_PTHREADS)
+  pthread_mutex_lock(&w->mu);
+#endif
+  err = w->err;
+  w->err = 0;
+#if defined(LUA_USE_PTHREADS)
+  pthread_mutex_unlock(&w->mu);
+#endif
+  return err;
+}
+
+
+static void wr_add (LWriter *w, const char *s, size_t l) {
+  if (w->n + l > w->size)
+    wr_swap(w);
+  if (l >= w->size) {  /* too long for a buffer: write it in order here */
+    int err;
+    wr_wait(w);
+    err = wr_out(w, s, l);
+    if (err != 0 && w->err == 0) w->err = err;
+  }
+  else {
+    memcpy(w->buf[w->cur] + w->n, s, l);
+    w->n += l;
+  }
+}
+
+
+/* writes out the buffers; returns 0 or an errno */
+static int wr_flush (LWriter *w) {
+  int err;
+  wr_swap(w);
+  wr_wait(w);
+  err = wr_error(w);
+#if !defined(LUA_USE_POSIX)
+  if (err == 0 && fflush(w->f) != 0) err = errno;
+#endif
+  return err;
+}
+
+
+static int wr_close (lua_State *L, LWriter *w) {
+  void *ud;
+  lua_Alloc allocf = lua_getallocf(L, &ud);
+  int err = wr_flush(w);
+  wr_stop(w);
+#if defined(LUA_USE_POSIX)
+  if (close(w->fd) != 0 && err == 0) err = errno;
+  w->fd = -1;
+#endif
+  allocf(ud, w->buf[0], w->size, 0);
+  allocf(ud, w->buf[1], w->size, 0);
+  w->closed = 1;
+  return err;
+}
+
+
+static LWriter *towriter (lua_State *L) {
+  LWriter *w = (LWriter *)luaL_checkudata(L, 1, LUA_WRITERHANDLE);
+  if (w->closed)
+    luaL_error(L, "attempt to use a closed writer");
+  return w;
+}
+
+
+/* result of pushresult for an errno (0 is success) */
+static int wr_result (lua_State *L, int err) {
+  errno = err;
+  return pushresult(L, err == 0, NULL);
+}
+
+
+/* io.writer (file [, size]) */
+static int io_writer (lua_State *L) {
+  FILE *f = tofile(L);
+  size_t size = (size_t)luaL_optinteger(L, 2, WRITERSIZE);
+  void *ud;
+  lua_Alloc allocf = lua_getallocf(L, &ud);
+  LWriter *w;
+  luaL_argcheck(L, (lua_Integer)size > 0, 2, "positive size expected");
+  w = (LWriter *)lua_newuserdata(L, sizeof(LWriter));
+  w->closed = 1;  /* until it is complete */
+  w->f = f;
+  w->cur = 0;
+  w->n = 0;
+  w->size = size;
+  w->err = 0;
+  w->buf[0] = w->buf[1] = NULL;
+  luaL_getmetatable(L, LUA_WRITERHANDLE);
+  lua_setmetatable(L, -2);
+  lua_createtable(L, 1, 0);  /* keep the file alive */
+  lua_pushvalue(L, 1);
+  lua_rawseti(L, -2, 1);
+  lua_setfenv(L, -2);
+  if (fflush(f) != 0)  /* what was written before goes first */
+    return pushresult(L, 0, NULL);
+  w->buf[0] = (char *)allocf(ud, NULL, 0, size);
+  w->buf[1] = (char *)allocf(ud, NULL, 0, size);
+  if (w->buf[0] == NULL || w->buf[1] == NULL) {
+    allocf(ud, w->buf[0], size, 0);
+    allocf(ud, w->buf[1], size, 0);
+    luaL_error(L, "not enough memory");
+  }
+#if defined(LUA_USE_POSIX)
+  w->fd = dup(fileno(f));
+  if (w->fd < 0) {
+    int en = errno;
+    allocf(ud, w->buf[0], size, 0);
+    allocf(ud, w->buf[1], size, 0);
+    return wr_result(L, en);
+  }
+#endif
+  if (!wr_start(w)) {
+    int en = errno;
+#if defined(LUA_USE_POSIX)
+    close(w->fd);
+#endif
+    allocf(ud, w->buf[0], size, 0);
+    allocf(ud, w->buf[1], size, 0);
+    return wr_result(L, en);
+  }
+  w->closed = 0;
+  return 1;
+}
+
+
+/* w:write (...): the arguments of file:write; returns w */
+static int wr_write (lua_State *L) {
+  LWriter *w = towriter(L);
+  int n = lua_gettop(L);
+  int i;
+  for (i = 2; i <= n; i++) {
+    char nbuff[LUAI_MAXNUMBER2STR];
+    size_t l;
+    const char *s;
+    if (lua_type(L, i) == LUA_TNUMBER) {
+      l = fmtnumber(nbuff, lua_tonumber(L, i));
+      s = nbuff;
+    }
+    else
+      s = luaL_checklstring(L, i, &l);
+    wr_add(w, s, l);
+  }
+  lua_settop(L, 1);
+  return 1;
+}
+
+
+static int wr_flushm (lua_State *L) {
+  return wr_result(L, wr_flush(towriter(L)));
+}
+
+
+static int wr_sync (lua_State *L) {
+  LWriter *w = towriter(L);
+  int err = wr_flush(w);
+#if defined(LUA_USE_POSIX)
+  if (err == 0 && fsync(w->fd) != 0) err = errno;
+#endif
+  return wr_result(L, err);
+}
+
+
+static int wr_closem (lua_State *L) {
+  return wr_result(L, wr_close(L, towriter(L)));
+}
+
+
+static int wr_gc (lua_State *L) {
+  LWriter *w = (LWriter *)luaL_checkudata(L, 1, LUA_WRITERHANDLE);
+  if (!w->closed)
+    wr_close(L, w);
+  return 0;
+}
+
+
+/* __clone (see lua_clonestate): the thread stays with the original */
+static int wr_clone (lua_State *L) {
+  LWriter *w = (LWriter *)luaL_checkudata(L, 1, LUA_WRITERHANDLE);
+  w->closed = 1;
+  w->f = NULL;
+  w->fd = -1;
+  w->buf[0] = w->buf[1] = NULL;
+  w->n = w->size = 0;
+  return 0;
+}
+
+
+static int wr_tostring (lua_State *L) {
+  LWriter *w = (LWriter *)luaL_checkudata(L, 1, LUA_WRITERHANDLE);
+  if (w->closed)
+    lua_pushliteral(L, "writer (closed)");
+  else
+    lua_pushfstring(L, "writer (%p)", w);
+  return 1;
+}
+
+/* }====================================================== */
+
+
+
+/*
+** {======================================================
+** TASKS
+** io.spawn makes a task of a function: a coroutine that io.run resumes
+** until every task has returned. A task that calls file:aread,
+** file:awrite, io.wait or io.sleep and cannot go on is suspended, and
+** the loop resumes it when its descriptor is ready (epoll with
+** LUA_USE_EPOLL, kqueue with LUA_USE_KQUEUE, poll otherwise) or its
+** time is up; a plain coroutine.yield lets the other tasks run. All of
+** it runs on the thread that calls io.run: a program that wants more
+** cores runs a state with a loop of its own on each. A task must not
+** be resumed by hand, and one descriptor takes one reader and one
+** writer at a time. Where a task cannot yield (under a pcall) these
+** calls block, as they do outside tasks.
+** `aread' and `awrite' leave the descriptor non-blocking, so do not mix
+** them with read and write on the same file.
+** =======================================================
+*/
+
+#define TASK_MAXFMT	8  /* formats of one `aread' */
+
+/* what a task waits for */
+#define TK_READY	0
+#define TK_SLEEP	1
+#define TK_READ		2
+#define TK_WRITE	3
+#define TK_WAIT		4
+
+/* readiness of a descriptor */
+#define PO_READ		1
+#define PO_WRITE	2
+
+/* results of a step of `aread' or `awrite' */
+#define AR_DONE		0
+#define AR_AGAIN	1
+#define AR_ERROR	2
+
+#define PO_EVENTS	64  /* events taken by one wait */
+
+#define SC_NOTSUPPORTED	"waiting tasks not enabled; check your Lua installation"
+
+
+typedef struct ReadFmt {
+  int kind;  /* 'l', 'a' or 'c' (a count) */
+  size_t n;
+} ReadFmt;
+
+
+typedef struct Task {
+  lua_State *co;  /* NULL for a free slot */
+  int op;  /* what it waits for */
+  int nargs;  /* values for the next resume */
+  int next;  /* in the ready queue or in the free list */
+  int fd;  /* descriptor it waits on, -1 if none */
+  int mode;  /* PO_READ or PO_WRITE */
+  int heap;  /* position in the timer heap, -1 if none */
+  double deadline;
+  LStream *s;  /* TK_READ and TK_WRITE: the file */
+  size_t pos;  /* TK_WRITE: bytes written */
+  int ifmt, nfmt;  /* TK_READ: next format and number of formats */
+  ReadFmt fmt[TASK_MAXFMT];
+} Task;
+
+
+typedef struct FdWait {
+  int rd, wr;  /* waiting tasks plus one, 0 if none */
+  int reg;  /* what the poller watches */
+} FdWait;
+
+
+typedef struct Sched {
+  Task *t;
+  int size;
+  int nused;  /* live tasks */
+  int freelist;
+  int head, tail, nready;  /* ready queue */
+  int cur;  /* running task, -1 if none */
+  int *heap;  /* tasks with a deadline, earliest first */
+  int nheap, sizeheap;
+  FdWait *fds;  /* by descriptor */
+  int nfds;
+  int nwait;  /* tasks waiting on descriptors */
+  int inready;  /* descriptor whose events are being handled */
+  int pfd;  /* epoll or kqueue descriptor, -1 until needed */
+#if defined(LUA_USE_POSIX) && !defined(LUA_USE_EPOLL) && \
+    !defined(LUA_USE_KQUEUE)
+  struct pollfd *pl;
+  int sizepl;
+#endif
+} Sched;
+
+
+/* grows the array `p' of `*size' elements of `esize' bytes to hold `n' */
+static void *sc_grow (lua_State *L, void *p, int *size, int n, size_t esize) {
+  if (n > *size) {
+    void *ud;
+    lua_Alloc allocf = lua_getallocf(L, &ud);
+    int ns = (*size > 0) ? *size : 16;
+    void *np;
+    while (ns < n) ns *= 2;
+    np = allocf(ud, p, (size_t)*size * esize, (size_t)ns * esize);
+    if (np == NULL)
+      luaL_error(L, "not enough memory");
+    p = np;
+    *size = ns;
+  }
+  return p;
+}
+
+
+static Sched *getsched (lua_State *L) {
+  Sched *S;
+  lua_getfield(L, LUA_REGISTRYINDEX, LUA_SCHEDULER);
+  S = (Sched *)lua_touserdata(L, -1);
+  lua_pop(L, 1);
+  return S;
+}
+
+
+static void tk_enqueue (Sched *S, int i) {
+  S->t[i].next = -1;
+  if (S->tail < 0)
+    S->head = i;
+  else
+    S->t[S->tail].next = i;
+  S->tail = i;
+  S->nready++;
+}
+
+
+static int tk_dequeue (Sched *S) {
+  int i = S->head;
+  S->head = S->t[i].next;
+  if (S->head < 0) S->tail = -1;
+  S->nready--;
+  return i;
+}
+
+
+/* its slot goes back to the free list; call with the tasks at index 2 */
+static void tk_free (lua_State *L, Sched *S, int i) {
+  S->t[i].co = NULL;
+  S->t[i].next = S->freelist;
+  S->freelist = i;
+  S->nused--;
+  lua_pushnil(L);
+  lua_rawseti(L, 2, i + 1);
+}
+
+
+/*
+** {------------------------------------------------------
+** Timers and descriptors
+** -------------------------------------------------------
+*/
+
+#if defined(LUA_USE_POSIX)
+
+/*
+** the scheduler if `L' is the running task and may yield (it is not
+** under a pcall or a metamethod, say), NULL otherwise
+*/
+static Sched *tasksched (lua_State *L) {
+  Sched *S = getsched(L);
+  return (S->cur >= 0 && S->t[S->cur].co == L && lua_isyieldable(L))
+         ? S : NULL;
+}
+
+
+/*
+** moves the top `n' values of `L' to the stack of task `i' and queues
+** it; everything on that stack goes to the task when it is resumed
+*/
+static void tk_ready (lua_State *L, Sched *S, int i, int n) {
+  Task *t = &S->t[i];
+  if (n > 0) {
+    if (!lua_checkstack(t->co, n))
+      luaL_error(L, "too many results to resume");
+    lua_xmove(L, t->co, n);
+  }
+  t->op = TK_READY;
+  t->nargs = lua_gettop(t->co);
+  tk_enqueue(S, i);
+}
+
+
+static double sc_now (void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+
+/* milliseconds for poll and friends; negative waits forever */
+static int sc_ms (double sec) {
+  if (sec < 0) return -1;
+  if (sec > 2e6) return 2000000000;
+  return (int)(sec * 1000) + (sec * 1000 > (int)(sec * 1000));
+}
+
+
+static void hp_set (Sched *S, int k, int i) {
+  S->heap[k] = i;
+  S->t[i].heap = k;
+}
+
+
+static void hp_up (Sched *S, int k) {
+  int i = S->heap[k];
+  double d = S->t[i].deadline;
+  while (k > 0) {
+    int p = (k - 1) / 2;
+    if (S->t[S->heap[p]].deadline <= d) break;
+    hp_set(S, k, S->heap[p]);
+    k = p;
+  }
+  hp_set(S, k, i);
+}
+
+
+static void hp_down (Sched *S, int k) {
+  int i = S->heap[k];
+  double d = S->t[i].deadline;
+  for (;;) {
+    int c = 2 * k + 1;
+    if (c >= S->nheap) break;
+    if (c + 1 < S->nheap &&
+        S->t[S->heap[c + 1]].deadline < S->t[S->heap[c]].deadline)
+      c++;
+    if (d <= S->t[S->heap[c]].deadline) break;
+    hp_set(S, k, S->heap[c]);
+    k = c;
+  }
+  hp_set(S, k, i);
+}
+
+
+/* room for one more timer, so `hp_insert' cannot fail */
+#define hp_reserve(L,S) \
+  ((S)->heap = (int *)sc_grow(L, (S)->heap, &(S)->sizeheap, \
+                              (S)->nheap + 1, sizeof(int)))
+
+
+static void hp_insert (Sched *S, int i) {
+  lua_assert(S->nheap < S->sizeheap);
+  hp_set(S, S->nheap++, i);
+  hp_up(S, S->nheap - 1);
+}
+
+
+static void hp_remove (Sched *S, int i) {
+  int k = S->t[i].heap;
+  S->t[i].heap = -1;
+  if (--S->nheap > k) {  /* the last one takes its place */
+    int m = S->heap[S->nheap];
+    hp_set(S, k, m);
+    hp_up(S, k);
+    hp_down(S, S->t[m].heap);
+  }
+}
+
+
+static void fd_ready (lua_State *L, Sched *S, int fd, int ev);
+
+
+#if defined(LUA_USE_EPOLL)
+
+/* makes the poller watch what the tasks wait for on `fd'; 0 or an errno */
+static int po_update (Sched *S, int fd) {
+  FdWait *w = &S->fds[fd];
+  int want = (w->rd ? PO_READ : 0) | (w->wr ? PO_WRITE : 0);
+  struct epoll_event ev;
+  int op;
+  if (want == w->reg || fd == S->inready)
+    return 0;
+  if (S->pfd < 0 && (S->pfd = epoll_create1(EPOLL_CLOEXEC)) < 0)
+    return errno;
+  memset(&ev, 0, sizeof(ev));
+  ev.events = ((want & PO_READ) ? EPOLLIN : 0) |
+              ((want & PO_WRITE) ? EPOLLOUT : 0);
+  ev.data.fd = fd;
+  op = (w->reg == 0) ? EPOLL_CTL_ADD :
+       (want == 0) ? EPOLL_CTL_DEL : EPOLL_CTL_MOD;
+  if (epoll_ctl(S->pfd, op, fd, &ev) != 0 && want != 0)
+    return errno;  /* (a closed descriptor has left the set by itself) */
+  w->reg = want;
+  return 0;
+}
+
+
+static void po_wait (lua_State *L, Sched *S, int ms) {
+  struct epoll_event ev[PO_EVENTS];
+  int n, i;
+  if (S->pfd < 0) {  /* only timers */
+    poll(NULL, 0, ms);
+    return;
+  }
+  n = epoll_wait(S->pfd, ev, PO_EVENTS, ms);
+  for (i = 0; i < n; i++) {
+    int e = ev[i].events;
+    int r = (e & (EPOLLERR | EPOLLHUP)) ? (PO_READ | PO_WRITE) :
+            ((e & EPOLLIN) ? PO_READ : 0) | ((e & EPOLLOUT) ? PO_WRITE : 0);
+    fd_ready(L, S, ev[i].data.fd, r);
+  }
+}
+
+#elif defined(LUA_USE_KQUEUE)
+
+static int po_update (Sched *S, int fd) {
+  FdWait *w = &S->fds[fd];
+  int want = (w->rd ? PO_READ : 0) | (w->wr ? PO_WRITE : 0);
+  struct kevent ch[2];
+  int n = 0;
+  if (want == w->reg || fd == S->inready)
+    return 0;
+  if (S->pfd < 0 && (S->pfd = kqueue()) < 0)
+    return errno;
+  if ((want ^ w->reg) & PO_READ)
+    EV_SET(&ch[n++], fd, EVFILT_READ,
+           (want & PO_READ) ? EV_ADD : EV_DELETE, 0, 0, NULL);
+  if ((want ^ w->reg) & PO_WRITE)
+    EV_SET(&ch[n++], fd, EVFILT_WRITE,
+           (want & PO_WRITE) ? EV_ADD : EV_DELETE, 0, 0, NULL);
+  if (kevent(S->pfd, ch, n, NULL, 0, NULL) != 0 && (want & ~w->reg))
+    return errno;
+  w->reg = want;
+  return 0;
+}
+
+
+static void po_wait (lua_State *L, Sched *S, int ms) {
+  struct kevent ev[PO_EVENTS];
+  struct timespec ts;
+  int n, i;
+  if (S->pfd < 0) {  /* only timers */
+    poll(NULL, 0, ms);
+    return;
+  }
+  ts.tv_sec = ms / 1000;
+  ts.tv_nsec = (long)(ms % 1000) * 1000000;
+  n = kevent(S->pfd, NULL, 0, ev, PO_EVENTS, (ms < 0) ? NULL : &ts);
+  for (i = 0; i < n; i++) {
+    int r = (ev[i].flags & EV_ERROR) ? (PO_READ | PO_WRITE) :
+            (ev[i].filter == EVFILT_READ) ? PO_READ : PO_WRITE;
+    fd_ready(L, S, (int)ev[i].ident, r);
+  }
+}
+
+#else
+
+/* poll takes the whole set at each wait */
+static int po_update (Sched *S, int fd) {
+  FdWait *w = &S->fds[fd];
+  w->reg = (w->rd ? PO_READ : 0) | (w->wr ? PO_WRITE : 0);
+  return 0;
+}
+
+
+static void po_wait (lua_State *L, Sched *S, int ms) {
+  int fd, n = 0, i;
+  for (fd = 0; fd < S->nfds; fd++) {
+    if (S->fds[fd].reg != 0) {
+      S->pl = (struct pollfd *)sc_grow(L, S->pl, &S->sizepl, n + 1,
+                                       sizeof(struct pollfd));
+      S->pl[n].fd = fd;
+      S->pl[n].events = ((S->fds[fd].reg & PO_READ) ? POLLIN : 0) |
+                        ((S->fds[fd].reg & PO_WRITE) ? POLLOUT : 0);
+      S->pl[n++].revents = 0;
+    }
+  }
+  if (poll(S->pl, (nfds_t)n, ms) <= 0)
+    return;
+  for (i = 0; i < n; i++) {
+    int e = S->pl[i].revents;
+    int r = (e & (POLLERR | POLLHUP | POLLNVAL)) ? (PO_READ | PO_WRITE) :
+            ((e & POLLIN) ? PO_READ : 0) | ((e & POLLOUT) ? PO_WRITE : 0);
+    if (r != 0)
+      fd_ready(L, S, S->pl[i].fd, r);
+  }
+}
+
+#endif
+
+
+/*
+** makes task `i' wait for `fd' to be ready for `mode'; 0 or an errno
+** (EPERM from epoll for a regular file, which is always ready)
+*/
+static int fd_wait (lua_State *L, Sched *S, int i, int fd, int mode) {
+  FdWait *w;
+  int *slot, err;
+  if (fd >= S->nfds) {
+    int old = S->nfds;
+    S->fds = (FdWait *)sc_grow(L, S->fds, &S->nfds, fd + 1, sizeof(FdWait));
+    memset(S->fds + old, 0, (size_t)(S->nfds - old) * sizeof(FdWait));
+  }
+  w = &S->fds[fd];
+  slot = (mode == PO_READ) ? &w->rd : &w->wr;
+  if (*slot != 0)
+    return EBUSY;  /* another task waits there */
+  *slot = i + 1;
+  if ((err = po_update(S, fd)) != 0) {
+    *slot = 0;
+    return err;
+  }
+  S->t[i].fd = fd;
+  S->t[i].mode = mode;
+  S->nwait++;
+  return 0;
+}
+
+
+static void fd_unwait (Sched *S, int i) {
+  Task *t = &S->t[i];
+  FdWait *w = &S->fds[t->fd];
+  if (t->mode == PO_READ) w->rd = 0;
+  else w->wr = 0;
+  S->nwait--;
+  po_update(S, t->fd);
+  t->fd = -1;
+}
+
+
+/* puts `aread' formats from argument `first' on into `fmt' */
+static int ar_formats (lua_State *L, int first, ReadFmt *fmt) {
+  int nargs = lua_gettop(L) - first + 1;
+  int i;
+  if (nargs <= 0) {  /* no arguments: a line */
+    fmt[0].kind = 'l';
+    return 1;
+  }
+  luaL_argcheck(L, nargs <= TASK_MAXFMT, first + TASK_MAXFMT,
+                "too many formats");
+  for (i = 0; i < nargs; i++) {
+    int n = first + i;
+    if (lua_type(L, n) == LUA_TNUMBER) {
+      fmt[i].kind = 'c';
+      fmt[i].n = (size_t)lua_tointeger(L, n);
+    }
+    else {
+      const char *p = lua_tostring(L, n);
+      luaL_argcheck(L, p && p[0] == '*', n, "invalid option");
+      if (p[1] != 'l' && p[1] != 'a')  /* no `*n' */
+        return luaL_argerror(L, n, "invalid format");
+      fmt[i].kind = p[1];
+    }
+  }
+  return nargs;
+}
+
+
+/*
+** reads what the descriptor has into the read-ahead: 1 if something
+** came, 0 at end of file, -1 if it would block and -2 on errors (errno)
+*/
+static int ar_fill (lua_State *L, LStream *s) {
+  size_t n;
+  if (s->astart > 0) {
+    memmove(s->abuf, s->abuf + s->astart, s->aend - s->astart);
+    s->aend -= s->astart;
+    s->astart = 0;
+  }
+  if (s->asize - s->aend < LUAL_BUFFERSIZE) {
+    void *ud;
+    lua_Alloc allocf = lua_getallocf(L, &ud);
+    size_t ns = (s->asize > 0) ? 2 * s->asize : 2 * LUAL_BUFFERSIZE;
+    char *nb = (char *)allocf(ud, s->abuf, s->asize, ns);
+    if (nb == NULL)
+      luaL_error(L, "not enough memory");
+    s->abuf = nb;
+    s->asize = ns;
+  }
+  clearerr(s->f);
+  /* buffered bytes of the stream first, then what the descriptor has */
+  n = fread(s->abuf + s->aend, sizeof(char), s->asize - s->aend, s->f);
+  s->aend += n;
+  if (n > 0) {
+    clearerr(s->f);
+    return 1;
+  }
+  if (feof(s->f))
+    return 0;
+  if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+    clearerr(s->f);
+    return -1;
+  }
+  return -2;
+}
+
+
+/*
+** pushes what `r' asks for if the read-ahead has it: 1 if done, 0 if it
+** needs more and -1 if it fails (at end of file)
+*/
+static int ar_take (lua_State *L, LStream *s, const ReadFmt *r, int eof) {
+  const char *p = s->abuf + s->astart;
+  size_t an = s->aend - s->astart;
+  size_t take = an;
+  if (r->kind == 'l') {
+    const char *nl = (an > 0) ? (const char *)memchr(p, '\n', an) : NULL;
+    if (nl != NULL) {
+      lua_pushlstring(L, p, (size_t)(nl - p));  /* without the `eol' */
+      s->astart += (size_t)(nl - p) + 1;
+      return 1;
+    }
+    if (!eof) return 0;
+    if (an == 0) return -1;
+  }
+  else if (r->kind == 'a') {
+    if (!eof) return 0;
+  }
+  else if (r->n == 0) {  /* test for end of file */
+    if (an == 0) return eof ? -1 : 0;
+    take = 0;
+  }
+  else if (an >= r->n)
+    take = r->n;
+  else {
+    if (!eof) return 0;
+    if (an == 0) return -1;
+  }
+  lua_pushlstring(L, p, take);
+  s->astart += take;
+  return 1;
+}
+
+
+/*
+** pushes the results of the formats from `*ifmt' on that the file has
+** now; a failed format gives nil and ends the read, like in `g_read'
+*/
+static int ar_step (lua_State *L, LStream *s, const ReadFmt *fmt, int nfmt,
+                    int *ifmt) {
+  int eof = 0;
+  while (*ifmt < nfmt) {
+    int res = ar_take(L, s, &fmt[*ifmt], eof);
+    if (res > 0)
+      (*ifmt)++;
+    else if (res < 0) {
+      lua_pushnil(L);
+      *ifmt = nfmt;
+    }
+    else {
+      switch (ar_fill(L, s)) {
+        case 0: eof = 1; break;
+        case -1: return AR_AGAIN;
+        case -2: return AR_ERROR;
+      }
+    }
+  }
+  if (s->astart == s->aend)
+    s->astart = s->aend = 0;
+  return AR_DONE;
+}
+
+
+/* writes what is left of [p, p+l) from `*pos' on */
+static int aw_step (LStream *s, const char *p, size_t l, size_t *pos) {
+  int fd = fileno(s->f);
+  while (*pos < l) {
+    ssize_t k = write(fd, p + *pos, l - *pos);
+    if (k >= 0)
+      *pos += (size_t)k;
+    else if (errno == EAGAIN || errno == EWOULDBLOCK)
+      return AR_AGAIN;
+    else if (errno != EINTR)
+      return AR_ERROR;
+  }
+  return AR_DONE;
+}
+
+
+static int as_nonblock (LStream *s) {
+  int fd = fileno(s->f);
+  int fl = fcntl(fd, F_GETFL);
+  if (fl < 0 || fcntl(fd, F_SETFL, fl | O_NONBLOCK) < 0)
+    return 0;
+  s->async = 1;
+  return 1;
+}
+
+
+/* waits, out of any task, for `fd' to be ready: 1, 0 on timeout, -1 */
+static int sc_block (int fd, int mode, int ms) {
+  struct pollfd pf;
+  int n;
+  pf.fd = fd;
+  pf.events = (mode == PO_READ) ? POLLIN : POLLOUT;
+  pf.revents = 0;
+  do n = poll(&pf, 1, ms); while (n < 0 && errno == EINTR);
+  return (n > 0) ? 1 : n;
+}
+
+
+/* the step of a task waiting on a descriptor that is ready */
+static void tk_io (lua_State *L, Sched *S, int i) {
+  Task *t = &S->t[i];
+  lua_State *co = t->co;
+  int top = lua_gettop(L);
+  int st, err;
+  switch (t->op) {
+    case TK_WAIT: {
+      if (t->heap >= 0) hp_remove(S, i);
+      lua_pushboolean(L, 1);
+      tk_ready(L, S, i, 1);
+      return;
+    }
+    case TK_READ: {
+      if (t->s->f == NULL) {  /* closed meanwhile */
+        errno = EBADF;
+        st = AR_ERROR;
+      }
+      else
+        st = ar_step(L, t->s, t->fmt, t->nfmt, &t->ifmt);
+      if (st != AR_ERROR) {
+        int n = lua_gettop(L) - top;
+        if (st == AR_DONE) {
+          tk_ready(L, S, i, n);
+          return;
+        }
+        if (n > 0) {  /* keep them with the task */
+          if (!lua_checkstack(co, n))
+            luaL_error(L, "too many results to resume");
+          lua_xmove(L, co, n);
+        }
+      }
+      break;
+    }
+    case TK_WRITE: {
+      size_t l;
+      const char *p = lua_tolstring(co, 1, &l);  /* kept by `awrite' */
+      if (t->s->f == NULL) {
+        errno = EBADF;
+        st = AR_ERROR;
+      }
+      else
+        st = aw_step(t->s, p, l, &t->pos);
+      if (st == AR_DONE) {
+        lua_settop(co, 0);
+        lua_pushboolean(L, 1);
+        tk_ready(L, S, i, 1);
+        return;
+      }
+      break;
+    }
+    default: lua_assert(0); return;
+  }
+  if (st == AR_AGAIN) {
+    err = fd_wait(L, S, i, fileno(t->s->f), t->mode);
+    if (err == 0) return;
+    errno = err;
+  }
+  lua_settop(L, top);
+  lua_settop(co, 0);  /* an error takes the place of all results */
+  tk_ready(L, S, i, pushresult(L, 0, NULL));
+}
+
+
+static void fd_ready (lua_State *L, Sched *S, int fd, int ev) {
+  int i;
+  if (fd < 0 || fd >= S->nfds) return;
+  S->inready = fd;  /* update the poller once, at the end */
+  if ((ev & PO_READ) && (i = S->fds[fd].rd) != 0) {
+    S->fds[fd].rd = 0;
+    S->nwait--;
+    S->t[i - 1].fd = -1;
+    tk_io(L, S, i - 1);
+  }
+  if ((ev & PO_WRITE) && (i = S->fds[fd].wr) != 0) {
+    S->fds[fd].wr = 0;
+    S->nwait--;
+    S->t[i - 1].fd = -1;
+    tk_io(L, S, i - 1);
+  }
+  S->inready = -1;
+  po_update(S, fd);
+}
+
+
+/* waits for the next event or timer, then wakes the tasks they concern */
+static void sc_poll (lua_State *L, Sched *S) {
+  int ms = -1;
+  double now;
+  if (S->nready > 0)
+    ms = 0;
+  else if (S->nheap > 0) {
+    double d = S->t[S->heap[0]].deadline - sc_now();
+    ms = sc_ms((d > 0) ? d : 0);
+  }
+  if (ms < 0 && S->nwait == 0)  /* (only after an error in the loop) */
+    luaL_error(L, "tasks wait for nothing");
+  po_wait(L, S, ms);
+  now = sc_now();
+  while (S->nheap > 0 && S->t[S->heap[0]].deadline <= now) {
+    int i = S->heap[0];
+    hp_remove(S, i);
+    if (S->t[i].op == TK_WAIT) {  /* timed out */
+      fd_unwait(S, i);
+      lua_pushboolean(L, 0);
+      tk_ready(L, S, i, 1);
+    }
+    else
+      tk_ready(L, S, i, 0);
+  }
+}
+
+#endif
+
+/* }------------------------------------------------------ */
+
+
+/* io.spawn (f, ...): a task that runs f(...) in the next round */
+static int io_spawn (lua_State *L) {
+  Sched *S = getsched(L);
+  int n = lua_gettop(L);
+  int i;
+  Task *t;
+  lua_State *co;
+  luaL_checktype(L, 1, LUA_TFUNCTION);
+  if (S->freelist < 0) {  /* all slots taken: get more */
+    int old = S->size;
+    S->t = (Task *)sc_grow(L, S->t, &S->size, old + 1, sizeof(Task));
+    for (i = S->size - 1; i >= old; i--) {
+      S->t[i].co = NULL;
+      S->t[i].next = S->freelist;
+      S->freelist = i;
+    }
+  }
+  i = S->freelist;
+  co = lua_newthread(L);
+  lua_insert(L, 1);
+  if (!lua_checkstack(co, n))
+    return luaL_error(L, "too many arguments");
+  lua_xmove(L, co, n);  /* the function and its arguments */
+  lua_getfield(L, LUA_REGISTRYINDEX, LUA_SCHEDULER);
+  lua_getfenv(L, -1);
+  lua_pushvalue(L, 1);
+  lua_rawseti(L, -2, i + 1);  /* tasks[i + 1] = co keeps it alive */
+  lua_pop(L, 2);
+  S->freelist = S->t[i].next;
+  S->nused++;
+  t = &S->t[i];
+  t->co = co;
+  t->op = TK_READY;
+  t->nargs = n - 1;
+  t->fd = -1;
+  t->heap = -1;
+  tk_enqueue(S, i);
+  return 1;
+}
+
+
+/* resumes task `i'; an error in it is raised by io.run */
+static void tk_run (lua_State *L, Sched *S, int i) {
+  lua_State *co = S->t[i].co;
+  int status;
+  S->cur = i;
+  status = lua_resume(co, S->t[i].nargs);
+  S->cur = -1;
+  if (status == LUA_YIELD) {
+    if (S->t[i].op == TK_READY) {  /* coroutine.yield: runs again */
+      lua_settop(co, 0);
+      S->t[i].nargs = 0;
+      tk_enqueue(S, i);
+    }
+    return;
+  }
+  if (status != 0)
+    lua_xmove(co, L, 1);  /* error message */
+  tk_free(L, S, i);
+  if (status != 0)
+    lua_error(L);
+}
+
+
+/* io.run (): runs the tasks until all of them have returned */
+static int io_run (lua_State *L) {
+  Sched *S = getsched(L);
+  if (S->cur >= 0)
+    return luaL_error(L, "io.run called from a task");
+  lua_settop(L, 0);
+  lua_getfield(L, LUA_REGISTRYINDEX, LUA_SCHEDULER);
+  lua_getfenv(L, 1);  /* tasks, at index 2 */
+  S->inready = -1;
+  luaL_checkstack(L, TASK_MAXFMT + LUA_MINSTACK, "too many formats");
+  while (S->nused > 0) {
+    int n = S->nready;  /* tasks queued meanwhile wait for the next round */
+    while (n-- > 0)
+      tk_run(L, S, tk_dequeue(S));
+    if (S->nused == 0)
+      break;
+#if defined(LUA_USE_POSIX)
+    sc_poll(L, S);
+#else
+    lua_assert(S->nready > 0);  /* nothing else can wake a task */
+#endif
+  }
+  return 0;
+}
+
+
+/* file:aread (...): file:read for tasks (no `*n') */
+static int f_aread (lua_State *L) {
+  LStream *s = (LStream *)tofilep(L);
+#if defined(LUA_USE_POSIX)
+  ReadFmt fmt[TASK_MAXFMT];
+  int nfmt, ifmt = 0, base;
+  tofile(L);
+  nfmt = ar_formats(L, 2, fmt);
+  base = lua_gettop(L);
+  luaL_checkstack(L, nfmt + LUA_MINSTACK, "too many formats");
+  if (!s->async && !as_nonblock(s))
+    return pushresult(L, 0, NULL);
+  for (;;) {
+    Sched *S;
+    int st = ar_step(L, s, fmt, nfmt, &ifmt);
+    if (st == AR_DONE)
+      return lua_gettop(L) - base;
+    if (st == AR_AGAIN) {
+      int fd = fileno(s->f);
+      int err = EPERM;
+      if ((S = tasksched(L)) != NULL &&
+          (err = fd_wait(L, S, S->cur, fd, PO_READ)) == 0) {
+        Task *t = &S->t[S->cur];
+        t->op = TK_READ;
+        t->s = s;
+        t->nfmt = nfmt;
+        t->ifmt = ifmt;
+        memcpy(t->fmt, fmt, (size_t)nfmt * sizeof(ReadFmt));
+        return lua_yield(L, lua_gettop(L) - base);  /* results so far */
+      }
+      if (err == EPERM && sc_block(fd, PO_READ, -1) >= 0)
+        continue;  /* not a task (or always ready): wait here */
+      if (err != EPERM) errno = err;
+    }
+    lua_settop(L, base);
+    return pushresult(L, 0, NULL);
+  }
+#else
+  tofile(L);
+  return g_read(L, s->f, 2);
+#endif
+}
+
+
+/* file:awrite (...): file:write for tasks */
+static int f_awrite (lua_State *L) {
+  LStream *s = (LStream *)tofilep(L);
+#if defined(LUA_USE_POSIX)
+  int nargs = lua_gettop(L) - 1;
+  size_t l, pos = 0;
+  const char *p;
+  int i;
+  tofile(L);
+  for (i = 2; i <= nargs + 1; i++)
+    if (lua_type(L, i) != LUA_TNUMBER)
+      luaL_checkstring(L, i);
+  if (nargs == 0)
+    lua_pushliteral(L, "");
+  else
+    lua_concat(L, nargs);
+  p = lua_tolstring(L, -1, &l);
+  if (!s->async) {  /* what went through the stream goes first */
+    if (fflush(s->f) != 0 || !as_nonblock(s))
+      return pushresult(L, 0, NULL);
+  }
+  for (;;) {
+    Sched *S;
+    int st = aw_step(s, p, l, &pos);
+    if (st == AR_DONE) {
+      lua_pushboolean(L, 1);
+      return 1;
+    }
+    if (st == AR_AGAIN) {
+      int fd = fileno(s->f);
+      int err = EPERM;
+      if ((S = tasksched(L)) != NULL &&
+          (err = fd_wait(L, S, S->cur, fd, PO_WRITE)) == 0) {
+        Task *t = &S->t[S->cur];
+        t->op = TK_WRITE;
+        t->s = s;
+        t->pos = pos;
+        return lua_yield(L, 1);  /* the data stays with the task */
+      }
+      if (err == EPERM && sc_block(fd, PO_WRITE, -1) >= 0)
+        continue;
+      if (err != EPERM) errno = err;
+    }
+    return pushresult(L, 0, NULL);
+  }
+#else
+  tofile(L);
+  return g_write(L, s->f, 2);
+#endif
+}
+
+
+/* io.wait (file | fd [, mode [, timeout]]): true when ready, false on timeout */
+static int io_wait (lua_State *L) {
+#if defined(LUA_USE_POSIX)
+  static const char *const modenames[] = {"r", "w", NULL};
+  int fd = (lua_type(L, 1) == LUA_TNUMBER) ? (int)lua_tointeger(L, 1)
+                                           : fileno(tofile(L));
+  int mode = luaL_checkoption(L, 2, "r", modenames) ? PO_WRITE : PO_READ;
+  double timeout = luaL_optnumber(L, 3, -1);
+  Sched *S = tasksched(L);
+  int err = EPERM, n;
+  luaL_argcheck(L, fd >= 0, 1, "invalid descriptor");
+  if (S != NULL) {
+    if (timeout >= 0) hp_reserve(L, S);
+    if ((err = fd_wait(L, S, S->cur, fd, mode)) == 0) {
+      Task *t = &S->t[S->cur];
+      t->op = TK_WAIT;
+      if (timeout >= 0) {
+        t->deadline = sc_now() + timeout;
+        hp_insert(S, S->cur);
+      }
+      return lua_yield(L, 0);
+    }
+  }
+  if (err != EPERM) {  /* (EPERM: a regular file, ready for epoll) */
+    errno = err;
+    return pushresult(L, 0, NULL);
+  }
+  n = (S != NULL) ? 1 : sc_block(fd, mode, sc_ms(timeout));
+  if (n < 0)
+    return pushresult(L, 0, NULL);
+  lua_pushboolean(L, n);
+  return 1;
+#else
+  return luaL_error(L, SC_NOTSUPPORTED);
+#endif
+}
+
+
+/* io.sleep (sec): suspends the task, or the program out of tasks */
+static int io_sleep (lua_State *L) {
+#if defined(LUA_USE_POSIX)
+  double sec = luaL_checknumber(L, 1);
+  Sched *S = tasksched(L);
+  if (S != NULL) {
+    Task *t;
+    hp_reserve(L, S);
+    t = &S->t[S->cur];
+    t->op = TK_SLEEP;
+    t->deadline = sc_now() + ((sec > 0) ? sec : 0);
+    hp_insert(S, S->cur);
+    return lua_yield(L, 0);
+  }
+  else {
+    double until = sc_now() + sec;
+    while (sec > 0) {
+      poll(NULL, 0, sc_ms(sec));
+      sec = until - sc_now();
+    }
+    return 0;
+  }
+#else
+  return luaL_error(L, SC_NOTSUPPORTED);
+#endif
+}
+
+
+static int sc_gc (lua_State *L) {
+  Sched *S = (Sched *)lua_touserdata(L, 1);
+  void *ud;
+  lua_Alloc allocf = lua_getallocf(L, &ud);
+  allocf(ud, S->t, (size_t)S->size * sizeof(Task), 0);
+  allocf(ud, S->heap, (size_t)S->sizeheap * sizeof(int), 0);
+  allocf(ud, S->fds, (size_t)S->nfds * sizeof(FdWait), 0);
+#if defined(LUA_USE_POSIX) && !defined(LUA_USE_EPOLL) && \
+    !defined(LUA_USE_KQUEUE)
+  allocf(ud, S->pl, (size_t)S->sizepl * sizeof(struct pollfd), 0);
+#endif
+#if defined(LUA_USE_POSIX)
+  if (S->pfd >= 0) close(S->pfd);
+#endif
+  return 0;
+}
+
+
+/* an empty scheduler; also __clone, as the copy of one has no tasks */
+static int sc_init (lua_State *L) {
+  Sched *S = (Sched *)lua_touserdata(L, 1);
+  memset(S, 0, sizeof(Sched));
+  S->freelist = S->head = S->tail = S->cur = -1;
+  S->inready = S->pfd = -1;
+  return 0;
+}
+
+
+static void createsched (lua_State *L) {
+  lua_newuserdata(L, sizeof(Sched));
+  lua_pushcfunction(L, sc_init);
+  lua_pushvalue(L, -2);
+  lua_call(L, 1, 0);
+  lua_createtable(L, 0, 2);
+  lua_pushcfunction(L, sc_gc);
+  lua_setfield(L, -2, "__gc");
+  lua_pushcfunction(L, sc_init);
+  lua_setfield(L, -2, "__clone");
+  lua_setmetatable(L, -2);
+  lua_newtable(L);  /* its tasks */
+  lua_setfenv(L, -2);
+  lua_setfield(L, LUA_REGISTRYINDEX, LUA_SCHEDULER);
+}
+
+/* }====================================================== */
+
+
+static int io_flush (lua_State *L) {
+  return pushresult(L, fflush(getiofile(L, IO_OUTPUT)) == 0, NULL);
+}
+
+
+static int f_flush (lua_State *L) {
+  return pushresult(L, fflush(tofile(L)) == 0, NULL);
+}
+
+
+static const luaL_Reg iolib[] = {
+  {"close", io_close},
+  {"flush", io_flush},
+  {"input", io_input},
+  {"lines", io_lines},
+  {"mmap", io_mmap},
+  {"open", io_open},
+  {"output", io_output},
+  {"popen", io_popen},
+  {"read", io_read},
+  {"readlines", io_readlines},
+  {"run", io_run},
+  {"sleep", io_sleep},
+  {"spawn", io_spawn},
+  {"tmpfile", io_tmpfile},
+  {"type", io_type},
+  {"wait", io_wait},
+  {"write", io_write},
+  {"writer", io_writer},
+  {NULL, NULL}
+};
+
+
+static const luaL_Reg flib[] = {
+  {"aread", f_aread},
+  {"awrite", f_awrite},
+  {"close", io_close},
+  {"flush", f_flush},
+  {"lines", f_lines},
+  {"read", f_read},
+  {"readlines", f_readlines},
+  {"seek", f_seek},
+  {"setvbuf", f_setvbuf},
+  {"write", f_write},
+  {"__clone", io_clone},
+  {"__tostring", io_tostring},
+  {NULL, NULL}
+};
+
+/* 构建一张libio库的公共元表 */
+static void createmeta (lua_State *L) {
+  luaL_newmetatable(L, LUA_FILEHANDLE);  /* create metatable for file handles */
+  lua_pushvalue(L, -1);  /* push metatable */
+  lua_setfield(L, -2, "__index");  /* metatable.__index = metatable */
+  luaL_register(L, NULL, flib);  /* file methods */
+  /* 运行完毕，栈上多了一个mt */
+}
+
+
+static const luaL_Reg mmlib[] = {
+  {"advise", mm_advise},
+  {"len", mm_len},
+  {"slice", mm_slice},
+  {"sub", mm_sub},
+  {"__len", mm_len},
+  {"__tostring", mm_tostring},
+  {NULL, NULL}
+};
+
+
+static const luaL_Reg wrlib[] = {
+  {"close", wr_closem},
+  {"flush", wr_flushm},
+  {"sync", wr_sync},
+  {"write", wr_write},
+  {"__clone", wr_clone},
+  {"__gc", wr_gc},
+  {"__tostring", wr_tostring},
+  {NULL, NULL}
+};
+
+
+/* metatable for mapped files; leaves the stack as it was */
+static void createmapmeta (lua_State *L) {
+  static const char *const forwards[] = {"find", "match", "gmatch", NULL};
+  int i;
+  luaL_newmetatable(L, LUA_MMAPHANDLE);
+  lua_pushvalue(L, -1);
+  lua_setfield(L, -2, "__index");
+  luaL_register(L, NULL, mmlib);
+  for (i = 0; forwards[i] != NULL; i++) {
+    lua_pushstring(L, forwards[i]);
+    lua_pushcclosure(L, mm_forward, 1);
+    lua_setfield(L, -2, forwards[i]);
+  }
+  lua_pop(L, 1);
 }
 
 /*
@@ -587,6 +2475,13 @@ static void newfenv (lua_State *L, lua_CFunction cls) {
 LUALIB_API int luaopen_io (lua_State *L) {
   // 创建libio库共用的metatable
   createmeta(L);
+  createmapmeta(L);
+  luaL_newmetatable(L, LUA_WRITERHANDLE);  /* metatable for writers */
+  lua_pushvalue(L, -1);
+  lua_setfield(L, -2, "__index");
+  luaL_register(L, NULL, wrlib);
+  lua_pop(L, 1);
+  createsched(L);
   
   // 构建一张表tbl1,用tbl1更新cur->func->c.env,弹掉tbl1
   newfenv(L, io_fclose);
@@ -34,6 +34,27 @@
 #define currIsNewline(ls)	(ls->current == '\n' || ls->current == '\r')
 
 
+/*
+** Fast paths scan the block the ZIO has read straight: `ls->current' is
+** at inblock(ls)[0] and `leftinblock(ls)' more bytes follow it there
+** (only while `ls->current' is not EOZ). A token that ends inside the
+** block is copied into `ls->buff' in one go instead of char by char;
+** one that crosses a block boundary goes through the general code.
+*/
+#define inblock(ls)	((ls)->z->p - 1)
+#define leftinblock(ls)	((ls)->z->n)
+
+#define isident(c)	(isalnum(c) || (c) == '_')
+
+/* skips the `k' bytes after `ls->current' (all in the block) and reads on */
+static void skipinblock (LexState *ls, size_t k) {
+  lua_assert(k <= leftinblock(ls));
+  ls->z->p += k;
+  ls->z->n -= k;
+  next(ls);
+}
+
+
 /* ORDER RESERVED */
 const char *const luaX_tokens [] = {
     "and", "break", "do", "else", "elseif",
@@ -46,6 +67,31 @@ const char *const luaX_tokens [] = {
 };
 
 
+/*
+** perfect hash of the reserved words: (first + last + 8*length) & 63
+** gives the index in `luaX_tokens' plus 1, or 0 for no reserved word
+*/
+static const lu_byte kwhash[64] = {
+  12,  0, 18,  0, 21,  0,  0,  0,  0, 20,  0,  0,  0,  0,  0,  0,
+  17,  0,  0,  0,  9,  0, 16,  0,  0,  0,  0,  0,  0,  1,  0, 10,
+   0,  6,  0,  3,  0,  0,  0, 11,  0,  0,  4,  0,  0,  0,  0,  0,
+   8, 15, 13,  7,  0,  2,  0,  0,  0, 19, 14,  5,  0,  0,  0,  0
+};
+
+
+/* the token of reserved word `s' (of length `l'), or 0 */
+static int reserved (const char *s, size_t l) {
+  const char *kw;
+  int i;
+  if (l < 2 || l > 8) return 0;
+  i = kwhash[(char2int(s[0]) + char2int(s[l-1]) + 8*l) & 63];
+  if (i == 0) return 0;
+  kw = luaX_tokens[i-1];
+  if (strncmp(kw, s, l) != 0 || kw[l] != '\0') return 0;
+  return i - 1 + FIRST_RESERVED;
+}
+
+
 #define save_and_next(ls) (save(ls, ls->current), next(ls))
 
 /* 将c存到ls->buff中 */
@@ -61,6 +107,22 @@ static void save (LexState *ls, int c) {
   b->buffer[b->n++] = cast(char, c);
 }
 
+/* 将s开始的l个字符一次性存到ls->buff中 */
+static void savebulk (LexState *ls, const char *s, size_t l) {
+  Mbuffer *b = ls->buff;
+  if (b->n + l > b->buffsize) {
+    size_t newsize = b->buffsize;
+    do {
+      if (newsize >= MAX_SIZET/2)
+        luaX_lexerror(ls, "lexical element too long", 0);
+      newsize *= 2;
+    } while (b->n + l > newsize);
+    luaZ_resizebuffer(ls->L, b, newsize);
+  }
+  memcpy(b->buffer + b->n, s, l);
+  b->n += l;
+}
+
 /* 构建出关键字 */
 void luaX_init (lua_State *L) {
   int i;
@@ -68,7 +130,8 @@ void luaX_init (lua_State *L) {
     TString *ts = luaS_new(L, luaX_tokens[i]);
     luaS_fix(ts);  /* reserved words are never collected */
     lua_assert(strlen(luaX_tokens[i])+1 <= TOKEN_LEN);
-    ts->tsv.reserved = cast_byte(i+1);  /* reserved word */
+    if (ts->tsv.reserved != i+1)  /* (already set in a shared heap) */
+      ts->tsv.reserved = cast_byte(i+1);  /* reserved word */
   }
 }
 
@@ -158,7 +221,7 @@ void luaX_setinput (lua_State *L, LexState *ls, ZIO *z, TString *source) {
   ls->lastline = 1;
   ls->source = source;
   /* 申请属于ls->buff的私有buff */
-  luaZ_resizebuffer(ls->L, ls->buff, LUA_MINBUFFER);  /* initialize buffer */
+  luaZ_resizebuffer(ls->L, ls->buff, LUA_LEXBUFFER);  /* initialize buffer */
   
   next(ls);  /* read first char */
 }
@@ -206,19 +269,58 @@ static void trydecpoint (LexState *ls, SemInfo *seminfo) {
 /* LUA_NUMBER 
 ** .123这种  123或者科学计数法形式(1.99714E+13)的数字
 */
+/* 最多15位的纯数字可以直接累加，不丢精度 */
+#define MAXFASTDIGITS	15
+
+/*
+** 数字整个在当前块内时一次读完: 返回0表示不在块内(什么都没读)，
+** 1表示已存入ls->buff待转换，2表示纯数字且已直接算出seminfo->r
+*/
+static int scan_numeral (LexState *ls, SemInfo *seminfo) {
+  const char *s = inblock(ls);
+  size_t n = leftinblock(ls);
+  size_t l = 1, digits;
+  while (l <= n && isdigit(char2int(s[l]))) l++;
+  digits = l;
+  while (l <= n && (isdigit(char2int(s[l])) || s[l] == '.')) l++;
+  if (l <= n && (s[l] == 'E' || s[l] == 'e')) {
+    l++;
+    if (l <= n && (s[l] == '+' || s[l] == '-')) l++;
+  }
+  while (l <= n && isident(char2int(s[l]))) l++;
+  if (l > n) return 0;  /* may go on in the next block */
+  savebulk(ls, s, l);
+  skipinblock(ls, l - 1);
+  if (digits == l && l <= MAXFASTDIGITS && luaZ_bufflen(ls->buff) == l) {
+    lua_Number r = 0;
+    size_t i;
+    for (i = 0; i < l; i++)
+      r = r * 10 + (s[i] - '0');
+    seminfo->r = r;
+    return 2;
+  }
+  return 1;
+}
+
 static void read_numeral (LexState *ls, SemInfo *seminfo) {
   lua_assert(isdigit(ls->current));	/* 属于 [0,9] 集合？*/
-  /* 读取第一部分 1.99714 */
-  do {
-    save_and_next(ls);
-  } while (isdigit(ls->current) || ls->current == '.');
+  switch (scan_numeral(ls, seminfo)) {
+    case 2: return;
+    case 1: break;
+    default: {
+      /* 读取第一部分 1.99714 */
+      do {
+        save_and_next(ls);
+      } while (isdigit(ls->current) || ls->current == '.');
 
-  /* 读取第二部分 E+ */
-  if (check_next(ls, "Ee"))  /* `E'? */
-    check_next(ls, "+-");  /* optional exponent sign */
-  /* 读取第三部分 13 */
-  while (isalnum(ls->current) || ls->current == '_')	/* 这里的_不太明白其含义 */
-    save_and_next(ls);
+      /* 读取第二部分 E+ */
+      if (check_next(ls, "Ee"))  /* `E'? */
+        check_next(ls, "+-");  /* optional exponent sign */
+      /* 读取第三部分 13 */
+      while (isalnum(ls->current) || ls->current == '_')	/* 这里的_不太明白其含义 */
+        save_and_next(ls);
+    }
+  }
   /* 主动补\0,关闭字符串 */
   save(ls, '\0');
   /* 不同国家不同的小数点 */
@@ -301,9 +403,23 @@ static void read_long_string (LexState *ls, SemInfo *seminfo, int sep) {
   }
 }
 
+/*
+** 存下ls->current以及块内其后直到del、'\\'或换行符之前的所有字符，
+** 然后停在那个字符上(块读完了则停在下一块的第一个字符上)
+*/
+static void save_string_run (LexState *ls, int del) {
+  const char *s = inblock(ls);
+  size_t n = leftinblock(ls);
+  size_t l = 1;
+  while (l <= n && s[l] != del && s[l] != '\\' && s[l] != '\n' && s[l] != '\r')
+    l++;
+  savebulk(ls, s, l);
+  skipinblock(ls, l - 1);
+}
+
 /* 读一个"字符串"或'字符串'格式的字符串 */
 static void read_string (LexState *ls, int del, SemInfo *seminfo) {
-  save_and_next(ls);
+  save_string_run(ls, del);
   while (ls->current != del) {
     switch (ls->current) {
       case EOZ:
@@ -352,7 +468,7 @@ static void read_string (LexState *ls, int del, SemInfo *seminfo) {
         continue;
       }
       default:
-        save_and_next(ls);
+        save_string_run(ls, del);
     }
   }
   save_and_next(ls);  /* skip delimiter(分隔符) */
@@ -388,8 +504,13 @@ static int llex (LexState *ls, SemInfo *seminfo) {
           }
         }
         /* else short comment */
-        while (!currIsNewline(ls) && ls->current != EOZ)
-          next(ls);
+        while (!currIsNewline(ls) && ls->current != EOZ) {
+          const char *s = inblock(ls);
+          size_t n = leftinblock(ls);
+          size_t l = 1;
+          while (l <= n && s[l] != '\n' && s[l] != '\r') l++;
+          skipinblock(ls, l - 1);  /* 块内一次跳到行尾 */
+        }
         continue;
       }
       case '[': {	/* 长字符串: [{=}[ String ]{=}] */
@@ -446,8 +567,12 @@ static int llex (LexState *ls, SemInfo *seminfo) {
       }
       default: {
         if (isspace(ls->current)) {
+          const char *s = inblock(ls);
+          size_t n = leftinblock(ls);
+          size_t l = 1;
           lua_assert(!currIsNewline(ls));	/* 换行符在前面就被解析掉了，这里不能再是换行符了,否则就重复了 */
-          next(ls);
+          while (l <= n && (s[l] == ' ' || s[l] == '\t')) l++;
+          skipinblock(ls, l - 1);
           continue;
         }
         else if (isdigit(ls->current)) {
@@ -456,20 +581,27 @@ static int llex (LexState *ls, SemInfo *seminfo) {
         }
         else if (isalpha(ls->current) || ls->current == '_') {	/* 标识符 */
           /* identifier or reserved word */
-          TString *ts;
-          do {
-            save_and_next(ls);
-          } while (isalnum(ls->current) || ls->current == '_');	/* 这里和上面的有一点差别 */
-		  
-          ts = luaX_newstring(ls, luaZ_buffer(ls->buff),
-                                  luaZ_bufflen(ls->buff));
-		  /* 关键或保留字符串 */
-          if (ts->tsv.reserved > 0)  /* reserved word? */
-            return ts->tsv.reserved - 1 + FIRST_RESERVED;
+          const char *s = inblock(ls);
+          size_t n = leftinblock(ls);
+          size_t l = 1;
+          int tk;
+          while (l <= n && isident(char2int(s[l]))) l++;
+          if (l <= n) {  /* 整个在块内，一次存下 */
+            savebulk(ls, s, l);
+            skipinblock(ls, l - 1);
+          }
           else {
-            seminfo->ts = ts;
-            return TK_NAME;
+            do {
+              save_and_next(ls);
+            } while (isalnum(ls->current) || ls->current == '_');	/* 这里和上面的有一点差别 */
           }
+		  /* 关键或保留字符串: 查完美哈希表，不必先建TString */
+          tk = reserved(luaZ_buffer(ls->buff), luaZ_bufflen(ls->buff));
+          if (tk)  /* reserved word? */
+            return tk;
+          seminfo->ts = luaX_newstring(ls, luaZ_buffer(ls->buff),
+                                           luaZ_bufflen(ls->buff));
+          return TK_NAME;
         }
         else {
           int c = ls->current;
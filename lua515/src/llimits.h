@@ -101,12 +101,36 @@ typedef lu_int32 Instruction;
 #endif
 
 
+/* number of string-table buckets migrated by each step of a resize */
+#ifndef STRREHASHSTEP
+#define STRREHASHSTEP	4
+#endif
+
+
 /* minimum size for string buffer */
 #ifndef LUA_MINBUFFER
 #define LUA_MINBUFFER	32
 #endif
 
 
+/* initial size of the lexer's token buffer (most tokens fit without growing it) */
+#ifndef LUA_LEXBUFFER
+#define LUA_LEXBUFFER	256
+#endif
+
+
+#if defined(LUA_USE_LOCK)
+LUAI_FUNC void luaE_lock (lua_State *L);
+LUAI_FUNC void luaE_unlock (lua_State *L);
+LUAI_FUNC void luaE_threadyield (lua_State *L);
+#define lua_lock(L)     luaE_lock(L)
+#define lua_unlock(L)   luaE_unlock(L)
+/* a plain (relaxed) read unless another thread waits (G needs lstate.h) */
+#define luai_threadyield(L) \
+	{ if (__atomic_load_n(&G(L)->lock.waiters, __ATOMIC_RELAXED) > 0) \
+	    luaE_threadyield(L); }
+#endif
+
 #ifndef lua_lock
 #define lua_lock(L)     ((void) 0) 
 #define lua_unlock(L)   ((void) 0)
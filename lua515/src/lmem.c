@@ -5,6 +5,7 @@
 */
 
 
+#include <math.h>
 #include <stddef.h>
 
 #define lmem_c
@@ -70,17 +71,301 @@ void *luaM_toobig (lua_State *L) {
 
 
 
+/*
+** {======================================================
+** Heap profiler: while a rate is set (LUA_GCHEAPSAMPLE), about one
+** allocation every `rate' bytes is sampled, at exponential intervals
+** as in tcmalloc, so that pprof can scale the counts back.  A sample
+** takes the stack before the block is allocated (growing the stack or
+** the CallInfo array moves them) and the type once the object is set up
+** (luaM_heaptag); blocks without a tag count as LUA_TNONE.  Frees take
+** sampled blocks off their sites.  The profiler's own memory comes
+** straight from `frealloc' and is not in `totalbytes'.
+** =======================================================
+*/
+
+#define MAXCOUNTDOWN	cast(l_mem, ~cast(lu_mem, 0) >> 1)
+
+#define rawalloc(g,b,os,ns)	((*(g)->frealloc)((g)->ud, (b), (os), (ns)))
+
+#define hashblock(b,size)	cast_int((IntPoint(b) >> 3) * 2654435761u & ((size)-1))
+
+
+/* bytes to allocate before the next sample */
+static void nextsample (HeapProfile *hp) {
+  double u, n;
+  hp->seed = hp->seed * 1103515245u + 12345u;
+  u = ((hp->seed >> 8 & 0xffffff) + 1.0) / 16777217.0;  /* in (0, 1) */
+  n = -log(u) * cast(double, hp->rate);
+  hp->countdown = (n < cast(double, MAXCOUNTDOWN)) ? cast(l_mem, n)
+                                                   : MAXCOUNTDOWN;
+}
+
+
+static unsigned int hashsite (const ProfSample *s, int tt) {
+  unsigned int h = cast(unsigned int, tt) ^ cast(unsigned int, s->depth);
+  int i;
+  for (i = 0; i < s->depth; i++)
+    h = h * 31 + IntPoint(s->f[i].p) + cast(unsigned int, s->f[i].pc);
+  return h;
+}
+
+
+static int samesite (const HeapSite *hs, const ProfSample *s, int tt) {
+  int i;
+  if (hs->tt != tt || hs->stack.depth != s->depth) return 0;
+  for (i = 0; i < s->depth; i++)
+    if (hs->stack.f[i].p != s->f[i].p || hs->stack.f[i].pc != s->f[i].pc)
+      return 0;
+  return 1;
+}
+
+
+static void sitehashinsert (HeapProfile *hp, int site) {
+  HeapSite *hs = &hp->sites[site];
+  int mask = hp->sizesitehash - 1;
+  int i = cast_int(hashsite(&hs->stack, hs->tt) & mask);
+  while (hp->sitehash[i] != 0) i = (i + 1) & mask;
+  hp->sitehash[i] = site + 1;
+}
+
+
+/* index of the site of the pending sample, or -1 if out of memory */
+static int getsite (global_State *g, HeapProfile *hp, int tt) {
+  const ProfSample *s = &hp->pendstack;
+  HeapSite *hs;
+  int i;
+  if (hp->sizesitehash > 0) {
+    int mask = hp->sizesitehash - 1;
+    for (i = cast_int(hashsite(s, tt) & mask); hp->sitehash[i] != 0;
+         i = (i + 1) & mask)
+      if (samesite(&hp->sites[hp->sitehash[i] - 1], s, tt))
+        return hp->sitehash[i] - 1;
+  }
+  if (hp->nsites == hp->sizesites) {  /* grow sites and their hash */
+    int n = (hp->sizesites > 0) ? 2 * hp->sizesites : 16;
+    int *sitehash = cast(int *, rawalloc(g, NULL, 0, 2 * n * sizeof(int)));
+    HeapSite *sites;
+    if (sitehash == NULL) return -1;
+    sites = cast(HeapSite *, rawalloc(g, hp->sites,
+        hp->sizesites * sizeof(HeapSite), n * sizeof(HeapSite)));
+    if (sites == NULL) {
+      rawalloc(g, sitehash, 2 * n * sizeof(int), 0);
+      return -1;
+    }
+    hp->sites = sites;
+    hp->sizesites = n;
+    rawalloc(g, hp->sitehash, hp->sizesitehash * sizeof(int), 0);
+    hp->sitehash = sitehash;
+    hp->sizesitehash = 2 * n;
+    for (i = 0; i < hp->sizesitehash; i++) sitehash[i] = 0;
+    for (i = 0; i < hp->nsites; i++) sitehashinsert(hp, i);
+  }
+  hs = &hp->sites[hp->nsites];
+  hs->stack.depth = s->depth;
+  for (i = 0; i < s->depth; i++) hs->stack.f[i] = s->f[i];
+  hs->tt = tt;
+  hs->inuse = hs->inusebytes = hs->allocs = hs->allocbytes = 0;
+  sitehashinsert(hp, hp->nsites);
+  return hp->nsites++;
+}
+
+
+static int addblock (global_State *g, HeapProfile *hp, void *block,
+                     size_t size, int site) {
+  int mask, i;
+  if (2 * (hp->nblocks + 1) > hp->sizeblocks) {  /* rehash into twice the size */
+    int n = (hp->sizeblocks > 0) ? 2 * hp->sizeblocks : 64;
+    HeapBlock *nb = cast(HeapBlock *, rawalloc(g, NULL, 0,
+                                               n * sizeof(HeapBlock)));
+    HeapBlock *ob = hp->blocks;
+    int on = hp->sizeblocks;
+    if (nb == NULL) return 0;
+    for (i = 0; i < n; i++) nb[i].block = NULL;
+    hp->blocks = nb;
+    hp->sizeblocks = n;
+    hp->nblocks = 0;
+    for (i = 0; i < on; i++)
+      if (ob[i].block != NULL)
+        addblock(g, hp, ob[i].block, ob[i].size, ob[i].site);
+    rawalloc(g, ob, on * sizeof(HeapBlock), 0);
+  }
+  mask = hp->sizeblocks - 1;
+  for (i = hashblock(block, hp->sizeblocks); hp->blocks[i].block != NULL;
+       i = (i + 1) & mask) ;
+  hp->blocks[i].block = block;
+  hp->blocks[i].size = size;
+  hp->blocks[i].site = site;
+  hp->nblocks++;
+  return 1;
+}
+
+
+/* give the pending sample its type and site */
+static void commitsample (global_State *g, int tt) {
+  HeapProfile *hp = &g->heap;
+  void *block = hp->pend;
+  int site;
+  hp->pend = NULL;
+  site = getsite(g, hp, tt);
+  if (site >= 0 && addblock(g, hp, block, hp->pendsize, site)) {
+    HeapSite *hs = &hp->sites[site];
+    hs->allocs++;
+    hs->allocbytes += hp->pendsize;
+    hs->inuse++;
+    hs->inusebytes += hp->pendsize;
+  }  /* else the sample is lost */
+}
+
+
+/* `block' is being freed or moved: take it off its site, if sampled */
+static void forgetblock (global_State *g, void *block) {
+  HeapProfile *hp = &g->heap;
+  int mask, i, j;
+  if (block == hp->pend) commitsample(g, LUA_TNONE);
+  if (hp->nblocks == 0) return;
+  mask = hp->sizeblocks - 1;
+  for (i = hashblock(block, hp->sizeblocks); hp->blocks[i].block != block;
+       i = (i + 1) & mask)
+    if (hp->blocks[i].block == NULL) return;  /* not sampled */
+  hp->sites[hp->blocks[i].site].inuse--;
+  hp->sites[hp->blocks[i].site].inusebytes -= hp->blocks[i].size;
+  hp->nblocks--;
+  for (j = i;;) {  /* close the gap (backward shift) */
+    int k;
+    j = (j + 1) & mask;
+    if (hp->blocks[j].block == NULL) break;
+    k = hashblock(hp->blocks[j].block, hp->sizeblocks);
+    if ((j > i) ? (k <= i || k > j) : (k <= i && k > j)) {
+      hp->blocks[i] = hp->blocks[j];
+      i = j;
+    }
+  }
+  hp->blocks[i].block = NULL;
+}
+
+
+/* take the stack for the next allocation of `L' */
+static void takesample (lua_State *L) {
+  global_State *g = G(L);
+  if (g->heap.pend != NULL) commitsample(g, LUA_TNONE);
+  luaG_stacksample(L, &g->heap.pendstack);
+  nextsample(&g->heap);
+}
+
+
+/* type of the object just allocated, if it was sampled */
+void luaM_heaptype (lua_State *L, int tt) {
+  global_State *g = G(L);
+  if (g->heap.pend != NULL) commitsample(g, tt);
+}
+
+
+/*
+** set the mean bytes between samples (0: stop the profiler and drop
+** its sites); returns the previous rate
+*/
+size_t luaM_heaprate (lua_State *L, size_t rate) {
+  global_State *g = G(L);
+  HeapProfile *hp = &g->heap;
+  size_t old = hp->rate;
+  if (rate == 0) {
+    rawalloc(g, hp->blocks, hp->sizeblocks * sizeof(HeapBlock), 0);
+    rawalloc(g, hp->sites, hp->sizesites * sizeof(HeapSite), 0);
+    rawalloc(g, hp->sitehash, hp->sizesitehash * sizeof(int), 0);
+    hp->blocks = NULL;
+    hp->sites = NULL;
+    hp->sitehash = NULL;
+    hp->sizeblocks = hp->nblocks = hp->sizesites = hp->nsites = 0;
+    hp->sizesitehash = 0;
+    hp->pend = NULL;
+    hp->rate = 0;
+    hp->countdown = MAXCOUNTDOWN;
+  }
+  else {
+    if (old == 0) hp->seed = g->seed ^ IntPoint(hp);
+    hp->rate = rate;
+    nextsample(hp);
+  }
+  return old;
+}
+
+/* }====================================================== */
+
+
+
+/*
+** reallocation that returns NULL instead of raising an error (for the
+** collector, which cannot stop halfway)
+*/
+void *luaM_tryrealloc (lua_State *L, void *block, size_t osize,
+                       size_t nsize) {
+  global_State *g = G(L);
+  void *nblock;
+  lua_assert(nsize > 0);
+  nblock = (*g->frealloc)(g->ud, block, osize, nsize);
+  if (nblock != NULL) {
+    if (g->heap.rate != 0 && block != NULL) forgetblock(g, block);
+    g->totalbytes = (g->totalbytes - osize) + nsize;
+    g->gcstats.allocated += nsize;
+    g->gcstats.freed += osize;
+  }
+  return nblock;
+}
+
+
+/*
+** frees `block' through the background sweeper (see luaC_bgsweep) while
+** a sweep step runs; `fin', if any, is the native finalizer of the
+** userdata it holds, to run right before the block is freed
+*/
+void luaM_defer (lua_State *L, void *block, size_t size, lua_Finalizer fin) {
+  global_State *g = G(L);
+  FreeBlock *b = cast(FreeBlock *, block);
+  lua_assert(g->deferfree && size >= sizeof(FreeBlock));
+  if (g->heap.rate != 0) forgetblock(g, block);
+  b->size = size;
+  b->fin = fin;
+  b->next = g->deferred;
+  if (g->deferred == NULL) g->deferredtail = b;
+  g->deferred = b;
+  g->deferredbytes += size;
+  g->totalbytes -= size;
+  g->gcstats.freed += size;
+}
+
+
 /*
 ** generic allocation routine.
 */
 void *luaM_realloc_ (lua_State *L, void *block, size_t osize, size_t nsize) {
   global_State *g = G(L);
+  int sampled = 0;
   lua_assert((osize == 0) == (block == NULL));
+  if (nsize == 0 && g->deferfree && osize >= sizeof(FreeBlock)) {
+    luaM_defer(L, block, osize, NULL);
+    return NULL;
+  }
+  if (nsize > osize && g->totalbytes - osize + nsize > g->memlimit)
+    luaD_throw(L, LUA_ERRMEM);  /* over the limit (see lua_setmemlimit) */
+  if (g->heap.rate != 0) {  /* heap profiler on */
+    if (block != NULL) forgetblock(g, block);
+    if (nsize > 0 && (g->heap.countdown -= cast(l_mem, nsize)) < 0) {
+      takesample(L);
+      sampled = 1;
+    }
+  }
   block = (*g->frealloc)(g->ud, block, osize, nsize);
   if (block == NULL && nsize > 0)
     luaD_throw(L, LUA_ERRMEM);
   lua_assert((nsize == 0) == (block == NULL));
+  if (sampled) {
+    g->heap.pend = block;
+    g->heap.pendsize = nsize;
+  }
   g->totalbytes = (g->totalbytes - osize) + nsize;
+  g->gcstats.allocated += nsize;
+  g->gcstats.freed += osize;
   return block;
 }
 
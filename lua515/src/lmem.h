@@ -37,9 +37,19 @@
 #define luaM_reallocvector(L, v,oldn,n,t) \
    ((v)=cast(t *, luaM_reallocv(L, v, oldn, n, sizeof(t))))
 
+/* tell the heap profiler the type of new object `o' (see lmem.c) */
+#define luaM_heaptag(L,o,t) \
+	((G(L)->heap.pend == cast(void *, (o))) ? luaM_heaptype(L, (t)) : (void)0)
+
 
 LUAI_FUNC void *luaM_realloc_ (lua_State *L, void *block, size_t oldsize,
                                                           size_t size);
+LUAI_FUNC void *luaM_tryrealloc (lua_State *L, void *block, size_t oldsize,
+                                 size_t size);
+LUAI_FUNC void luaM_defer (lua_State *L, void *block, size_t size,
+                           lua_Finalizer fin);
+LUAI_FUNC void luaM_heaptype (lua_State *L, int tt);
+LUAI_FUNC size_t luaM_heaprate (lua_State *L, size_t rate);
 LUAI_FUNC void *luaM_toobig (lua_State *L);
 LUAI_FUNC void *luaM_growaux_ (lua_State *L, void *block, int *size,
                                size_t size_elem, int limit,
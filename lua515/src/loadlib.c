@@ -351,21 +351,148 @@ static const char *pushnexttemplate (lua_State *L, const char *path) {
 }
 
 
-static const char *findfile (lua_State *L, const char *name,
-                                           const char *pname) {
-  const char *path;
+#if defined(LUA_USE_DIRENT)
+
+#include <dirent.h>
+#include <sys/stat.h>
+#include <time.h>
+
+/*
+** package.dircache keeps a snapshot of each directory seen: the set of
+** its entries, with its modification time at [1] and [2] (-1 if it
+** cannot be stat'ed) and its name at [3]. A snapshot is used only while
+** the directory keeps that time; one taken within a second of the last
+** change ([4] = true) is taken again when next used, as timestamps are
+** coarse. It also keeps the result of each search (key: module name,
+** '\0', path) as {file name or error message, found?, snapshots looked
+** at...}, good while all those snapshots are. Any value other than a
+** table turns the cache off
+*/
+static int dirtime (const char *dir, long *sec, long *nsec) {
+  struct stat st;
+  if (stat(dir, &st) != 0 || !S_ISDIR(st.st_mode))
+    return 0;
+  *sec = (long)st.st_mtime;
+#if defined(LUA_USE_LINUX)
+  *nsec = (long)st.st_mtim.tv_nsec;
+#else
+  *nsec = 0;
+#endif
+  return 1;
+}
+
+
+/* is the snapshot at `idx' still what its directory holds? */
+static int fresh (lua_State *L, int idx) {
+  long sec = -1, nsec = 0;
+  int ok;
+  lua_rawgeti(L, idx, 4);
+  ok = !lua_toboolean(L, -1);  /* not taken right after a change? */
+  lua_pop(L, 1);
+  if (!ok) return 0;
+  lua_rawgeti(L, idx, 3);
+  dirtime(lua_tostring(L, -1), &sec, &nsec);
+  lua_rawgeti(L, idx, 1);
+  lua_rawgeti(L, idx, 2);
+  ok = (lua_tonumber(L, -2) == sec && lua_tonumber(L, -1) == nsec);
+  lua_pop(L, 3);
+  return ok;
+}
+
+
+/* push the snapshot of directory `dir', taking a new one if needed */
+static void pushdir (lua_State *L, int cache, const char *dir) {
+  long sec = -1, nsec = 0;
+  DIR *d;
+  lua_getfield(L, cache, dir);
+  if (lua_istable(L, -1) && fresh(L, lua_gettop(L)))
+    return;
+  lua_pop(L, 1);
+  lua_newtable(L);
+  if (dirtime(dir, &sec, &nsec) && (d = opendir(dir)) != NULL) {
+    struct dirent *e;
+    while ((e = readdir(d)) != NULL) {
+      lua_pushboolean(L, 1);
+      lua_setfield(L, -2, e->d_name);
+    }
+    closedir(d);
+  }
+  lua_pushnumber(L, (lua_Number)sec);
+  lua_rawseti(L, -2, 1);
+  lua_pushnumber(L, (lua_Number)nsec);
+  lua_rawseti(L, -2, 2);
+  lua_pushstring(L, dir);
+  lua_rawseti(L, -2, 3);
+  if (sec >= 0 && (long)time(NULL) <= sec + 1) {  /* changed just now? */
+    lua_pushboolean(L, 1);
+    lua_rawseti(L, -2, 4);
+  }
+  lua_pushvalue(L, -1);
+  lua_setfield(L, cache, dir);
+}
+
+
+/* looks `filename' up in the snapshot of its directory, which is added
+   to the search result at `entry' */
+static int present (lua_State *L, int cache, int entry,
+                    const char *filename) {
+  const char *base = strrchr(filename, *LUA_DIRSEP);
+  int n = lua_objlen(L, entry);
+  int found;
+  if (base == NULL) {
+    lua_pushliteral(L, ".");
+    base = filename;
+  }
+  else {
+    /* a file at the root keeps its separator as directory name */
+    lua_pushlstring(L, filename, (base == filename) ? 1 : base - filename);
+    base++;
+  }
+  pushdir(L, cache, lua_tostring(L, -1));
+  lua_rawgeti(L, entry, n);
+  if (!lua_rawequal(L, -1, -2)) {  /* not the last one added? */
+    lua_pushvalue(L, -2);
+    lua_rawseti(L, entry, n + 1);
+  }
+  lua_getfield(L, -2, base);
+  found = lua_toboolean(L, -1);
+  lua_pop(L, 4);
+  return found && readable(filename);  /* listed; still must be readable */
+}
+
+
+/* do the snapshots a search result at `entry' looked at still hold? */
+static int validentry (lua_State *L, int cache, int entry) {
+  int i, n = lua_objlen(L, entry);
+  for (i = 3; i <= n; i++) {
+    int same;
+    lua_rawgeti(L, entry, i);
+    lua_rawgeti(L, -1, 3);
+    pushdir(L, cache, lua_tostring(L, -1));
+    same = lua_rawequal(L, -1, -3);
+    lua_pop(L, 3);
+    if (!same) return 0;
+  }
+  return 1;
+}
+
+#else
+
+#define present(L,cache,entry,filename)	readable(filename)
+
+#endif
+
+
+static const char *searchpath (lua_State *L, int cache, int entry,
+                               const char *name, const char *path) {
   name = luaL_gsub(L, name, ".", LUA_DIRSEP);
-  lua_getfield(L, LUA_ENVIRONINDEX, pname);
-  path = lua_tostring(L, -1);
-  if (path == NULL)
-    luaL_error(L, LUA_QL("package.%s") " must be a string", pname);
   lua_pushliteral(L, "");  /* error accumulator */
   while ((path = pushnexttemplate(L, path)) != NULL) {
     const char *filename;
     filename = luaL_gsub(L, lua_tostring(L, -1), LUA_PATH_MARK, name);
     lua_remove(L, -2);  /* remove path template */
-    if (readable(filename))  /* does file exist and is readable? */
-      return filename;  /* return that file name */
+    if (cache ? present(L, cache, entry, filename) : readable(filename))
+      return filename;  /* file exists and is readable: return its name */
     lua_pushfstring(L, "\n\tno file " LUA_QS, filename);
     lua_remove(L, -2);  /* remove file name */
     lua_concat(L, 2);  /* add entry to possible error message */
@@ -374,15 +501,113 @@ static const char *findfile (lua_State *L, const char *name,
 }
 
 
+/*
+** search `name' in `path', through package.dircache when there is one;
+** leaves the file name, or the error message, on the top
+*/
+static const char *findpath (lua_State *L, const char *name,
+                                           const char *path) {
+#if defined(LUA_USE_DIRENT)
+  const char *filename;
+  int cache = lua_gettop(L) + 1;
+  int entry = cache + 2;
+  lua_getfield(L, LUA_ENVIRONINDEX, "dircache");
+  if (!lua_istable(L, -1))
+    return searchpath(L, 0, 0, name, path);
+  lua_pushstring(L, name);
+  lua_pushlstring(L, "\0", 1);
+  lua_pushstring(L, path);
+  lua_concat(L, 3);  /* key of this search */
+  lua_pushvalue(L, -1);
+  lua_rawget(L, cache);
+  if (lua_istable(L, entry) && validentry(L, cache, entry)) {
+    lua_rawgeti(L, entry, 2);
+    lua_rawgeti(L, entry, 1);  /* file name or error message */
+    filename = lua_tostring(L, -1);
+    if (!lua_toboolean(L, -2))
+      return NULL;  /* missed before, and nothing changed */
+    if (readable(filename))
+      return filename;
+  }
+  lua_settop(L, entry - 1);
+  lua_createtable(L, 4, 0);  /* the result of a new search */
+  lua_pushboolean(L, 0);
+  lua_rawseti(L, entry, 1);
+  lua_pushboolean(L, 0);
+  lua_rawseti(L, entry, 2);  /* snapshots go from [3] on */
+  filename = searchpath(L, cache, entry, name, path);
+  lua_pushvalue(L, -1);
+  lua_rawseti(L, entry, 1);
+  lua_pushboolean(L, filename != NULL);
+  lua_rawseti(L, entry, 2);
+  lua_pushvalue(L, entry - 1);  /* key */
+  lua_pushvalue(L, entry);
+  lua_rawset(L, cache);
+  return filename;
+#else
+  return searchpath(L, 0, 0, name, path);
+#endif
+}
+
+
+static const char *findfile (lua_State *L, const char *name,
+                                           const char *pname) {
+  const char *path;
+  lua_getfield(L, LUA_ENVIRONINDEX, pname);
+  path = lua_tostring(L, -1);
+  if (path == NULL)
+    luaL_error(L, LUA_QL("package.%s") " must be a string", pname);
+  return findpath(L, name, path);
+}
+
+
+static int ll_searchpath (lua_State *L) {
+  const char *name = luaL_checkstring(L, 1);
+  const char *path = luaL_checkstring(L, 2);
+  if (findpath(L, name, path) != NULL)
+    return 1;
+  lua_pushnil(L);
+  lua_insert(L, -2);
+  return 2;  /* return nil + error message */
+}
+
+
 static void loaderror (lua_State *L, const char *filename) {
   luaL_error(L, "error loading module " LUA_QS " from file " LUA_QS ":\n\t%s",
                 lua_tostring(L, 1), filename, lua_tostring(L, -1));
 }
 
 
+/*
+** the optional package.manifest maps module names to file names or to
+** precompiled chunks (from string.dump), skipping the package.path search
+*/
+static int loadmanifest (lua_State *L, const char *name) {
+  size_t l;
+  const char *s;
+  lua_getfield(L, LUA_ENVIRONINDEX, "manifest");
+  if (!lua_istable(L, -1))
+    return 0;
+  lua_getfield(L, -1, name);
+  if (!lua_isstring(L, -1))
+    return 0;
+  s = lua_tolstring(L, -1, &l);
+  if (*s == *LUA_SIGNATURE) {  /* binary chunk? */
+    if (luaL_loadbuffer(L, s, l, name) != 0)
+      loaderror(L, "package.manifest");
+  }
+  else if (luaL_loadfile(L, s) != 0)
+    loaderror(L, s);
+  return 1;
+}
+
+
 static int loader_Lua (lua_State *L) {
   const char *filename;
   const char *name = luaL_checkstring(L, 1);
+  if (loadmanifest(L, name))
+    return 1;  /* library loaded from the manifest */
+  lua_settop(L, 1);
   filename = findfile(L, name, "path");
   if (filename == NULL) return 1;  /* library not found in this path */
   if (luaL_loadfile(L, filename) != 0)
@@ -646,6 +871,9 @@ LUALIB_API int luaopen_package (lua_State *L) {
 #endif
   lua_pushvalue(L, -1);
   lua_replace(L, LUA_ENVIRONINDEX);
+  /* `searchpath' uses the cache in the environment set just above */
+  lua_pushcfunction(L, ll_searchpath);
+  lua_setfield(L, -2, "searchpath");
   /* create `loaders' table */
   lua_createtable(L, sizeof(loaders)/sizeof(loaders[0]) - 1, 0);
   /* fill it with pre-defined loaders */
@@ -666,6 +894,11 @@ LUALIB_API int luaopen_package (lua_State *L) {
   /* set field `preload' */
   lua_newtable(L);
   lua_setfield(L, -2, "preload");
+#if defined(LUA_USE_DIRENT)
+  /* set field `dircache' */
+  lua_newtable(L);
+  lua_setfield(L, -2, "dircache");
+#endif
   lua_pushvalue(L, LUA_GLOBALSINDEX);
   luaL_register(L, NULL, ll_funcs);  /* open lib into global table */
   lua_pop(L, 1);
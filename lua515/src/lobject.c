@@ -26,6 +26,8 @@
 
 const TValue luaO_nilobject_ = {{NULL}, LUA_TNIL};
 
+const lu_byte luaO_ashift[] = {0, 0, 0, 1, 1, 2, 2, 2, 3};
+
 
 /*
 ** converts an integer to a "floating point byte", represented as
@@ -29,6 +29,12 @@
 #define LUA_TUPVAL	(LAST_TAG+2)
 #define LUA_TDEADKEY	(LAST_TAG+3)	/* 表中val为nil的key则为DEADKEY */
 
+/*
+** with LUAI_INTSUBTYPE, a number whose value is an `int' (but not -0)
+** may be kept as one: same type LUA_TNUMBER, a variant bit in `tt'
+*/
+#define LUA_TNUMINT	(LUA_TNUMBER | (1 << 4))
+
 
 /*
 ** Union of all collectable objects
@@ -60,6 +66,7 @@ typedef union {
   GCObject 	 *gc;
   void 		 *p;	// light userdata 需C自己管理生命周期
   lua_Number n;		// double 可以准确的表示一定范围内(很大)的int
+  int i;		/* LUA_TNUMINT */
   int 		 b;		/* bool */
 } Value;
 
@@ -86,6 +93,7 @@ typedef struct lua_TValue {
 #define ttistable(o)	(ttype(o) == LUA_TTABLE)
 #define ttisfunction(o)	(ttype(o) == LUA_TFUNCTION)
 #define ttisuserdata(o)	(ttype(o) == LUA_TUSERDATA)
+#define ttisarray(o)	(ttisuserdata(o) && uvalue(o)->akind)
 #define ttisthread(o)	(ttype(o) == LUA_TTHREAD)
 
 /* Macros to access values */
@@ -94,11 +102,26 @@ typedef struct lua_TValue {
 **
 ** !!!!注意这里返回的类型，非gc类型直接返回数值，gc类型，返回对象地址
 */
+#if defined(LUAI_INTSUBTYPE)
+#define ttype(o)	((o)->tt & 0x0F)
+#define ttisint(o)	((o)->tt == LUA_TNUMINT)
+#define ttisint2(o1,o2)	((((o1)->tt ^ LUA_TNUMINT) | ((o2)->tt ^ LUA_TNUMINT)) == 0)
+#define ttisflt(o)	((o)->tt == LUA_TNUMBER)
+#define ivalue(o)	check_exp(ttisint(o), (o)->value.i)
+#define nvalue(o)	check_exp(ttisnumber(o), \
+	ttisint(o) ? cast_num((o)->value.i) : (o)->value.n)
+#else
 #define ttype(o)	((o)->tt)
+#define ttisint(o)	0
+#define ttisint2(o1,o2)	0
+#define ttisflt(o)	ttisnumber(o)
+#define ivalue(o)	cast_int(nvalue(o))
+#define nvalue(o)	check_exp(ttisnumber(o), (o)->value.n)
+#endif
+#define fltvalue(o)	check_exp(ttisflt(o), (o)->value.n)
 #define gcvalue(o)	check_exp(iscollectable(o), (o)->value.gc)
 #define pvalue(o)	check_exp(ttislightuserdata(o), (o)->value.p)
 #define bvalue(o)	check_exp(ttisboolean(o), (o)->value.b)
-#define nvalue(o)	check_exp(ttisnumber(o), (o)->value.n)
 
 #define rawtsvalue(o)	check_exp(ttisstring(o), &(o)->value.gc->ts)
 #define tsvalue(o)	(&rawtsvalue(o)->tsv)
@@ -133,6 +156,22 @@ typedef struct lua_TValue {
 #define setnvalue(obj,x) \
   { TValue *i_o=(obj); i_o->value.n=(x); i_o->tt=LUA_TNUMBER; }
 
+#if defined(LUAI_INTSUBTYPE)
+#define setivalue(obj,x) \
+  { TValue *i_o=(obj); i_o->value.i=(x); i_o->tt=LUA_TNUMINT; }
+
+/* number `x', as an int when it is one */
+#define setnumvalue(obj,x) \
+  { TValue *i_o=(obj); lua_Number i_n=(x); int i_i; \
+    lua_number2int(i_i, i_n); \
+    if (luai_numeq(cast_num(i_i), i_n) && (i_i != 0 || 1/i_n > 0)) \
+      { i_o->value.i=i_i; i_o->tt=LUA_TNUMINT; } \
+    else { i_o->value.n=i_n; i_o->tt=LUA_TNUMBER; } }
+#else
+#define setivalue(obj,x)	setnvalue(obj, cast_num(x))
+#define setnumvalue(obj,x)	setnvalue(obj,x)
+#endif
+
 #define setpvalue(obj,x) \
   { TValue *i_o=(obj); i_o->value.p=(x); i_o->tt=LUA_TLIGHTUSERDATA; }
 
@@ -197,7 +236,7 @@ typedef struct lua_TValue {
 #define setobj2n	setobj
 #define setsvalue2n	setsvalue
 /* 设置TValue的type */
-#define setttype(obj, tt) (ttype(obj) = (tt))
+#define setttype(obj, t) ((obj)->tt = (t))
 
 
 #define iscollectable(o)	(ttype(o) >= LUA_TSTRING)
@@ -228,13 +267,32 @@ typedef union Udata {
   L_Umaxalign dummy;  /* ensures maximum alignment for `local' udata */
   struct {
     CommonHeader;
+    lu_byte finsafe;  /* `fin' may run on the background sweeper */
+    lu_byte akind;  /* element type of a typed array (LUA_AINT8...); 0 if
+                       the userdata is not one */
     struct Table *metatable;
     struct Table *env;
     size_t len;					/* 负载(load)数据长度 */
+    lua_Finalizer fin;  /* native finalizer (see lua_setfinalizer) */
   } uv;
 } Udata;
 
 
+/*
+** Inline cache of a table access with a constant string key
+** (OP_GETGLOBAL, OP_GETTABLE, OP_SELF). Entries are only hints: the VM
+** checks the cached node against the live table before using it, so a
+** `resize'/`rehash' or a change of the metatable simply makes them miss.
+*/
+typedef struct ICache {
+  struct Table *mt;  /* metatable whose `__index' table holds the field;
+                        NULL if the field lives in the indexed table itself */
+  struct Table *h;  /* that `__index' table */
+  int slot;  /* node index of the field */
+  int mslot;  /* node index of `__index' in `mt' */
+} ICache;
+
+
 /*
 ** Function Prototypes
 ** 下面域的排序经过了整理（相关的放在一起），原始代码则是类型相同的放一起(节省MEM考虑)
@@ -248,6 +306,9 @@ typedef struct Proto {
   
   Instruction *code;	/* 指向存放指令数组的指针 */
   int sizecode;
+  ICache *icache;  /* one entry per instruction (created on first use) */
+  union Closure *cache;  /* last closure made of it (weak, see OP_CLOSURE) */
+  lu_byte noescape;  /* its closures are only called (see lparser.c) */
 
   int *lineinfo;  		/* map from opcodes to source lines,   lineinfo[code.idx]->code.fileLine */
   int sizelineinfo;
@@ -275,9 +336,19 @@ typedef struct Proto {
   ** 实际调用时传给不定参数...的实参在L->func---->L->base之间,数量在OP_VARARG指令中已给出计算公式
   */
   lu_byte maxstacksize;	
+  lu_byte inimage;  /* PROTO_CODEIMG | PROTO_LINEIMG | PROTO_SHARED */
+  int debugidx;  /* entry of this function in `debugsec' */
+  TString *debugsec;  /* debug info not decoded yet (luac -d), or NULL */
 } Proto;
 
 
+/* arrays of a Proto that point into a chunk image (see lua_loadimage) */
+#define PROTO_CODEIMG	1
+#define PROTO_LINEIMG	2
+/* read-only prototype of a shared heap (see lua_freeze) */
+#define PROTO_SHARED	4
+
+
 /* masks for new-style vararg */
 #define VARARG_HASARG		1	/* 兼容旧版本的函数形参...转为名为arg表的格式？ */
 #define VARARG_ISVARARG		2	/* 是变参函数 */
@@ -313,10 +384,13 @@ typedef struct UpVal {
 ** Closures
 ** env：环境变量(全局环境？）的指针
 ** isC: 1：C函数， 0：Lua函数
+** bitop: the bit operation the VM runs in place of a C function (0: none)
+** leaf: 1 + the arguments of a leaf C function (lua_setleaf); 0 if none
 */
 
 #define ClosureHeader \
-	CommonHeader; lu_byte isC; lu_byte nupvalues; GCObject *gclist; \
+	CommonHeader; lu_byte isC; lu_byte nupvalues; lu_byte bitop; \
+	lu_byte leaf; lu_byte iter; lu_byte pcall; GCObject *gclist; \
 	struct Table *env
 
 typedef struct CClosure {
@@ -347,6 +421,26 @@ typedef union Closure {
 ** Tables
 */
 
+#if defined(LUA_USE_LINEARHASH)
+
+/*
+** open addressing: `node' holds only the keys (value and type tag), so
+** a probe walks one contiguous array; the values live apart in `nodeval'
+*/
+typedef union TKey {
+  struct {
+    TValuefields;
+  } nk;
+  TValue tvk;
+} TKey;
+
+
+typedef struct Node {
+  TKey 	 i_key;
+} Node;
+
+#else
+
 typedef union TKey {
   struct {
     TValuefields;		/* 这里不能简单的用TValue替代，因为TValue已经是最顶层的Value表现形式了。不能再和XXX混合形成更高层次的Value */
@@ -361,16 +455,25 @@ typedef struct Node {
   TKey 	 i_key;
 } Node;
 
+#endif
+
 
 typedef struct Table {
   CommonHeader;
+  lu_byte 		lsizenode;  	/* log2 of size of `node' array */
+  unsigned int 	flags;  		/* 1<<p means tagmethod(p) is not present */ 
   struct Table 	*metatable;
-  lu_byte 		flags;  		/* 1<<p means tagmethod(p) is not present */ 
+  const TValue 	**tmcache;  	/* tag methods of a metatable (see luaT_gettm) */
   Node 			*node;
-  lu_byte 		lsizenode;  	/* log2 of size of `node' array */
+#if defined(LUA_USE_LINEARHASH)
+  TValue 		*nodeval;  		/* values of the hash part, same index as `node' */
+  int 			nodefree;  		/* free keys that may still be filled before a rehash */
+#else
   Node 			*lastfree; 		/* any free position is before this position */
+#endif
   TValue 		*array;  		/* array part */
   int 			sizearray;  	/* size of `array' array */
+  int 			border;  		/* last border found by `luaH_getn' (a hint) */
   GCObject 		*gclist;		/* gc过程中用到，比如当前自己在gray链表中，则指向下一个gray'obj */
 } Table;
 
@@ -391,6 +494,9 @@ typedef struct Table {
 
 LUAI_DATA const TValue luaO_nilobject_;
 
+/* log2 of the element size of each kind of typed array */
+LUAI_DATA const lu_byte luaO_ashift[];
+
 #define ceillog2(x)	(luaO_log2((x)-1) + 1)
 
 LUAI_FUNC int luaO_log2 (unsigned int x);
@@ -52,6 +52,13 @@ const char *const luaP_opnames[NUM_OPCODES+1] = {
   "CLOSE",
   "CLOSURE",
   "VARARG",
+  "ADDK",
+  "SUBK",
+  "MULK",
+  "DIVK",
+  "MODK",
+  "GGETCALL",
+  "GETTABLE2",
   NULL
 };
 
@@ -99,10 +106,17 @@ const lu_byte luaP_opmodes[NUM_OPCODES] = {
  ,opmode(0, 0, OpArgU, OpArgN, iABC)		/* OP_RETURN */
  ,opmode(0, 1, OpArgR, OpArgN, iAsBx)		/* OP_FORLOOP */
  ,opmode(0, 1, OpArgR, OpArgN, iAsBx)		/* OP_FORPREP */
- ,opmode(1, 0, OpArgN, OpArgU, iABC)		/* OP_TFORLOOP */
+ ,opmode(1, 0, OpArgU, OpArgU, iABC)		/* OP_TFORLOOP */
  ,opmode(0, 0, OpArgU, OpArgU, iABC)		/* OP_SETLIST */
  ,opmode(0, 0, OpArgN, OpArgN, iABC)		/* OP_CLOSE */
  ,opmode(0, 1, OpArgU, OpArgN, iABx)		/* OP_CLOSURE */
  ,opmode(0, 1, OpArgU, OpArgN, iABC)		/* OP_VARARG */
+ ,opmode(0, 1, OpArgR, OpArgK, iABC)		/* OP_ADDK */
+ ,opmode(0, 1, OpArgR, OpArgK, iABC)		/* OP_SUBK */
+ ,opmode(0, 1, OpArgR, OpArgK, iABC)		/* OP_MULK */
+ ,opmode(0, 1, OpArgR, OpArgK, iABC)		/* OP_DIVK */
+ ,opmode(0, 1, OpArgR, OpArgK, iABC)		/* OP_MODK */
+ ,opmode(0, 1, OpArgK, OpArgN, iABx)		/* OP_GGETCALL */
+ ,opmode(0, 1, OpArgR, OpArgK, iABC)		/* OP_GETTABLE2 */
 };
 
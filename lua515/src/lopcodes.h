@@ -219,18 +219,29 @@ OP_FORLOOP,/*	A sBx	R(A)+=R(A+2);
 						if R(A) <?= R(A+1) then { pc+=sBx; R(A+3)=R(A) }*/
 OP_FORPREP,/*	A sBx	R(A)-=R(A+2); pc+=sBx				*/
 
-OP_TFORLOOP,/*	A C	R(A+3), ... ,R(A+2+C) := R(A)(R(A+1), R(A+2)); 
+OP_TFORLOOP,/*	A B C	R(A+3), ... ,R(A+2+C) := R(A)(R(A+1), R(A+2)); 
                         if R(A+3) ~= nil then R(A+2)=R(A+3) else pc++	*/ 
 OP_SETLIST,/*	A B C	R(A)[(C-1)*FPF+i] := R(A+i), 1 <= i <= B	*/
 
 OP_CLOSE,/*		A 		close all variables in the stack up to (>=) R(A)*/
 OP_CLOSURE,/*	A Bx	R(A) := closure(KPROTO[Bx], R(A), ... ,R(A+n))	*/
 
-OP_VARARG/*		A B		R(A), R(A+1), ..., R(A+B-1) = vararg		*/
+OP_VARARG,/*		A B		R(A), R(A+1), ..., R(A+B-1) = vararg		*/
+
+/* 右操作数为数值常量的算术指令(见lcode.c的codearith) ORDER OP */
+OP_ADDK,/*		A B C	R(A) := R(B) + Kst(C)				*/
+OP_SUBK,/*		A B C	R(A) := R(B) - Kst(C)				*/
+OP_MULK,/*		A B C	R(A) := R(B) * Kst(C)				*/
+OP_DIVK,/*		A B C	R(A) := R(B) / Kst(C)				*/
+OP_MODK,/*		A B C	R(A) := R(B) % Kst(C)				*/
+
+/* 超级指令:执行自身后直接执行紧随的指令,省去一次分派(见lcode.c的luaK_fuse) */
+OP_GGETCALL,/*	A Bx	R(A) := Gbl[Kst(Bx)]; then the OP_CALL at pc+1	*/
+OP_GETTABLE2/*	A B C	R(A) := R(B)[Kst(C)]; then the OP_GETTABLE at pc+1 */
 } OpCode;
 
 
-#define NUM_OPCODES	(cast(int, OP_VARARG) + 1)
+#define NUM_OPCODES	(cast(int, OP_GETTABLE2) + 1)
 
 
 
@@ -251,6 +262,19 @@ OP_VARARG/*		A B		R(A), R(A+1), ..., R(A+B-1) = vararg		*/
   (*) For comparisons, A specifies what condition the test should accept
       (true or false).
 
+  (*) In OP_ADDK ... OP_MODK, C is an RK index (ISK(C) is true) of a
+      number constant, so only R(B) has to be type checked.
+
+  (*) OP_GGETCALL is always followed by an OP_CALL on the same register
+      and OP_GETTABLE2 by an OP_GETTABLE; both keys are string constants.
+      The second instruction stays a valid instruction on its own.
+
+  (*) In OP_TFORLOOP, B == 1 says that the last of the C results,
+      R(A+2+C), is `(for position)', not a loop variable: when R(A) is
+      `next' or the `ipairs' iterator (lua_setiter) and R(A+1) a table,
+      the VM steps through the table itself and keeps there where `next'
+      stopped. Chunks compiled with B == 0 always call R(A).
+
   (*) All `skips' (pc++) assume that next instruction is a jump
 ===========================================================================*/
 
@@ -208,7 +208,21 @@ static int os_setlocale (lua_State *L) {
      "numeric", "time", NULL};
   const char *l = luaL_optstring(L, 1, NULL);
   int op = luaL_checkoption(L, 2, "all", catnames);
-  lua_pushstring(L, setlocale(cat[op], l));
+  const char *r = setlocale(cat[op], l);
+  if (l != NULL && r != NULL) {  /* changed: the compiled patterns are stale */
+    lua_getfield(L, LUA_REGISTRYINDEX, LUA_PATCACHE);
+    if (lua_istable(L, -1)) {
+      lua_pushnil(L);
+      while (lua_next(L, -2)) {
+        lua_pop(L, 1);
+        lua_pushvalue(L, -1);
+        lua_pushnil(L);
+        lua_rawset(L, -4);
+      }
+    }
+    lua_pop(L, 1);
+  }
+  lua_pushstring(L, r);
   return 1;
 }
 
@@ -213,6 +213,7 @@ static void new_localvar (LexState *ls, TString *name, int n) {
   /* 设置actvar 到 Proto.nlocvars 的映射 */
   /* 这里仅设置了变量的name, 尚未设置startpc,endpc */
   fs->actvar[fs->nactvar+n] = cast(unsigned short, registerlocalvar(ls, name));
+  fs->noescape[fs->nactvar+n] = 0;
   //printf("......... %d->%d", fs->nactvar+n, fs->actvar[fs->nactvar+n]);
 }
 
@@ -296,6 +297,42 @@ static int indexupvalue (FuncState *fs, TString *name, expdesc *v) {
   return f->nups++;
 }
 
+/*
+** A function expression whose closure OP_CLOSURE may reuse (see
+** LUAI_CLOSURECACHE): the value of a local (`local f = function' or
+** `local function f') that is only ever called, so that no one can
+** compare it, keep it or setfenv it from outside; and it captures a
+** local of the enclosing function, so that only the same activation
+** gets the closure back, once the local holding it is out of scope.
+** Any other use of the local (captured, assigned, indexed, passed)
+** clears the flag.
+*/
+static void noescape (FuncState *fs, int v, int pc) {
+  Instruction *code = &fs->f->code[pc];
+  Proto *p = fs->f->p[GETARG_Bx(*code)];
+  int j;
+  lua_assert(GET_OPCODE(*code) == OP_CLOSURE);
+  fs->noescape[v] = 0;
+  for (j = 1; j <= p->nups; j++) {
+    if (GET_OPCODE(code[j]) == OP_MOVE) {
+      p->noescape = 1;
+      fs->noescape[v] = GETARG_Bx(*code) + 1;
+      return;
+    }
+  }
+}
+
+
+static void escapevar (FuncState *fs, int v) {
+  int i = fs->noescape[v];
+  if (i > 0) {
+    fs->noescape[v] = 0;
+    if (i <= fs->np)  /* else `local function' still in its body */
+      fs->f->p[i-1]->noescape = 0;
+  }
+}
+
+
 /* 尝试在当前fs中匹配激活状态的locvar */
 static int searchvar (FuncState *fs, TString *n) {
   int i;
@@ -359,8 +396,13 @@ static int singlevaraux (FuncState *fs, TString *n, expdesc *var, int base) {
     int v = searchvar(fs, n);  /* look up at current level */
     if (v >= 0) {
       init_exp(var, VLOCAL, v);
-      if (!base)
+      if (v == fs->f->numparams && (fs->f->is_vararg & VARARG_HASARG) &&
+          fs->argstate == 0)
+        fs->argstate = 1;  /* the implicit `arg' parameter is used */
+      if (!base) {
         markupval(fs, v);  /* local will be used as an upval */
+        escapevar(fs, v);
+      }
       return VLOCAL;
     }
     else {  /* not found at current level; try upper one */
@@ -532,6 +574,7 @@ static void open_func (LexState *ls, FuncState *fs) {
   fs->np = 0;
   fs->nlocvars = 0;
   fs->nactvar = 0;
+  fs->argstate = 0;
   fs->bl = NULL;	/* 这里是NULL */
   f->source = ls->source;
   f->maxstacksize = 2;  /* registers 0/1 are always valid */
@@ -556,12 +599,19 @@ static void close_func (LexState *ls) {
   /* 关闭还处于激活状态的actvar(设置endpc) */
   removevars(ls, 0);
 
+  /* only build the `arg' table of a vararg function that reads `arg' */
+  if (fs->argstate == 1)
+    f->is_vararg |= VARARG_NEEDSARG;
+
   /* 自动补一个 OP_RETURN 指令 */
   luaK_ret(fs, 0, 0);  /* final return */
+  if (G(L)->optimize)
+    luaK_optimize(fs);
 
   /* 释放多余的mem */
   luaM_reallocvector(L, f->code, f->sizecode, fs->pc, Instruction);
   f->sizecode = fs->pc;
+  luaK_fuse(f);  /* superinstructions */
   
   luaM_reallocvector(L, f->lineinfo, f->sizelineinfo, fs->pc, int);
   f->sizelineinfo = fs->pc;
@@ -826,7 +876,7 @@ static void parlist (LexState *ls) {
 #if defined(LUA_COMPAT_VARARG)
           /* use `arg' as default name */
           new_localvarliteral(ls, "arg", nparams++);
-          f->is_vararg = VARARG_HASARG | VARARG_NEEDSARG;
+          f->is_vararg = VARARG_HASARG;  /* NEEDSARG only if used */
 #endif
           f->is_vararg |= VARARG_ISVARARG;
           break;
@@ -1027,6 +1077,9 @@ static void prefixexp (LexState *ls, expdesc *v) {
       ** 读取下一个Token
       */
       singlevar(ls, v); 
+      if (v->k == VLOCAL && ls->t.token != '(' && ls->t.token != '{' &&
+          ls->t.token != TK_STRING)
+        escapevar(ls->fs, v->u.s.info);  /* not the callee of a call */
       return;
     }
     default: {
@@ -1119,7 +1172,7 @@ static void simpleexp (LexState *ls, expdesc *v) {
 	  /* 在非变参函数内使用"变参"，明显是个错误 */
       check_condition(ls, fs->f->is_vararg,
                       "cannot use " LUA_QL("...") " outside a vararg function");
-      fs->f->is_vararg &= ~VARARG_NEEDSARG;  /* don't need 'arg' */
+      fs->argstate = 2;  /* don't need 'arg' */
       init_exp(v, VVARARG, luaK_codeABC(fs, OP_VARARG, 0, 1, 0));	/* 这里B=0，表示期待一个参数和funcall仅返回一个参数是一样的 */
       break;
     }
@@ -1539,6 +1592,9 @@ static void forbody (LexState *ls, int base, int line, int nvars, int isnum) {
   
   checknext(ls, TK_DO);
 
+  if (!isnum)
+    luaK_nil(fs, base + 2 + nvars, 1);  /* no `(for position)' yet */
+
   /* 准备指令 R(A)-=R(A+2); pc+=sBx */
   prep = isnum ? luaK_codeAsBx(fs, OP_FORPREP, base, NO_JUMP) : luaK_jump(fs);
   
@@ -1558,7 +1614,7 @@ static void forbody (LexState *ls, int base, int line, int nvars, int isnum) {
   /* 查看OP_FORLOOP 指令可知，在body中修改NAME对循环的控制逻辑无影响
   */
   endfor = (isnum) ? luaK_codeAsBx(fs, OP_FORLOOP, base, NO_JUMP) :
-                     luaK_codeABC(fs, OP_TFORLOOP, base, 0, nvars);
+                     luaK_codeABC(fs, OP_TFORLOOP, base, 1, nvars);
 
   /* 更新lineinfo域 */					 
   luaK_fixline(fs, line);  /* pretend that `OP_FOR' starts the loop */
@@ -1627,6 +1683,8 @@ static void forlist (LexState *ls, TString *indexname) {
   /* 循环读取用户自定义的其它locvar */
   while (testnext(ls, ','))
     new_localvar(ls, str_checkname(ls), nvars++);
+  /* where `next' stopped, when the VM runs it in place (OP_TFORLOOP) */
+  new_localvarliteral(ls, "(for position)", nvars++);
   
   checknext(ls, TK_IN);
   line = ls->linenumber;
@@ -1716,10 +1774,13 @@ static void localfunc (LexState *ls) {
   luaK_reserveregs(fs, 1);
   /* 更新fs->nactvar, 更新上述actvar的startpc */
   adjustlocalvars(ls, 1);
+  fs->noescape[fs->nactvar - 1] = fs->np + 1;  /* cleared if the body uses it */
 
 
 /* step.2 处理local函数的定义业务 */
   body(ls, &b, 0, ls->linenumber);
+  if (fs->noescape[fs->nactvar - 1])
+    noescape(fs, fs->nactvar - 1, b.u.s.info);
 
 /* step.3 实现 local function funName body 中的业务逻辑：将函数定义赋值给funName */
   luaK_storevar(fs, &v, &b);
@@ -1737,6 +1798,7 @@ static void localstat (LexState *ls) {
   /* stat -> LOCAL NAME {`,' NAME} [`=' explist1] */
   int nvars = 0;
   int nexps;
+  int fpc = -1;  /* OP_CLOSURE of `local f = function ... end' */
   expdesc e;
   
   do {	
@@ -1767,8 +1829,13 @@ static void localstat (LexState *ls) {
   **    再回过头看 luaK_nil 函数，知道为什么有 fs->pc == 0那个条件判断了吧(有一点点理解作者的用意了吧！！)
   **
   */
+  if (nvars == 1 && nexps == 1 && e.k == VRELOCABLE &&
+      GET_OPCODE(getcode(ls->fs, &e)) == OP_CLOSURE)
+    fpc = e.u.s.info;
   adjust_assign(ls, nvars, nexps, &e);
   adjustlocalvars(ls, nvars);
+  if (fpc >= 0)
+    noescape(ls->fs, ls->fs->nactvar - 1, fpc);
 }
 
 
@@ -1776,6 +1843,8 @@ static int funcname (LexState *ls, expdesc *v) {
   /* funcname -> NAME {field} [`:' NAME] */
   int needself = 0;
   singlevar(ls, v);
+  if (v->k == VLOCAL)
+    escapevar(ls->fs, v->u.s.info);  /* assigned or indexed */
   while (ls->t.token == '.')
     field(ls, v);
   if (ls->t.token == ':') {
@@ -1932,3 +2001,162 @@ static void chunk (LexState *ls) {
 }
 
 /* }====================================================================== */
+
+
+/*
+** {======================================================================
+** Data chunks: `[return] value [;]', where a value is nil, a boolean, a
+** number (maybe negated), a string or a constructor of values. Tables
+** are built while parsing and no code is generated, so there is no
+** Proto to run once and no limit on constants. The fields of an open
+** constructor wait on the stack as key/value pairs (a nil key marks a
+** list item) until `}' gives their exact counts for luaH_new.
+** =======================================================================
+*/
+
+
+static void datavalue (LexState *ls);
+
+
+/* 把[from, to)中的list项依次存为t[*n+1], t[*n+2], ... */
+static void dataflush (lua_State *L, Table *t, StkId from, StkId to, int *n) {
+  for (; from < to; from += 2) {
+    if (ttisnil(from))
+      setobj2t(L, luaH_setnum(L, t, ++*n), from + 1);
+  }
+}
+
+
+static void dataconstructor (LexState *ls) {
+  lua_State *L = ls->L;
+  int line = ls->linenumber;
+  ptrdiff_t first = savestack(L, L->top);
+  int na = 0, nh = 0, n = 0, pending = 0;
+  StkId e, flushed, top;
+  Table *t;
+  checknext(ls, '{');
+  do {
+    if (ls->t.token == '}') break;
+    switch (ls->t.token) {
+      case TK_NAME: {  /* NAME = value */
+        luaX_lookahead(ls);
+        if (ls->lookahead.token != '=')  /* a variable: not data */
+          luaX_lexerror(ls, luaO_pushfstring(L, "unexpected symbol near "
+                        LUA_QS, getstr(ls->t.seminfo.ts)), 0);
+        setsvalue2s(L, L->top, str_checkname(ls));
+        incr_top(L);
+        luaX_next(ls);  /* skip `=' */
+        datavalue(ls);
+        nh++;
+        break;
+      }
+      case '[': {  /* [value] = value */
+        StkId k;
+        luaX_next(ls);
+        datavalue(ls);
+        k = L->top - 1;
+        if (ttisnil(k))
+          luaX_syntaxerror(ls, "table index is nil");
+        else if (ttisnumber(k) && luai_numisnan(nvalue(k)))
+          luaX_syntaxerror(ls, "table index is NaN");
+        checknext(ls, ']');
+        checknext(ls, '=');
+        datavalue(ls);
+        nh++;
+        break;
+      }
+      default: {  /* value */
+        setnilvalue(L->top);
+        incr_top(L);
+        datavalue(ls);
+        check_condition(ls, na < MAX_INT, "too many items in a constructor");
+        na++;
+        break;
+      }
+    }
+  } while (testnext(ls, ',') || testnext(ls, ';'));
+  check_match(ls, '}', '{', line);
+  t = luaH_new(L, na, nh);
+  sethvalue(L, L->top, t);
+  incr_top(L);
+  /*
+  ** store in the order the code of `constructor' would: a field is set
+  ** when it is read, list items in batches of LFIELDS_PER_FLUSH once
+  ** the field after a full batch is read, and at the end
+  */
+  top = L->top - 1;
+  flushed = restorestack(L, first);
+  for (e = flushed; e < top; e += 2) {
+    if (pending == LFIELDS_PER_FLUSH) {
+      dataflush(L, t, flushed, e, &n);
+      flushed = e;
+      pending = 0;
+    }
+    if (ttisnil(e))
+      pending++;
+    else
+      setobj2t(L, luaH_set(L, t, e), e + 1);
+  }
+  dataflush(L, t, flushed, top, &n);
+  e = restorestack(L, first);
+  setobj2s(L, e, top);  /* the table replaces its fields */
+  L->top = e + 1;
+  luaC_checkGC(L);
+}
+
+
+static void datavalue (LexState *ls) {
+  lua_State *L = ls->L;
+  switch (ls->t.token) {
+    case TK_NIL: setnilvalue(L->top); break;
+    case TK_TRUE: setbvalue(L->top, 1); break;
+    case TK_FALSE: setbvalue(L->top, 0); break;
+    case TK_NUMBER: setnumvalue(L->top, ls->t.seminfo.r); break;
+    case TK_STRING: setsvalue2s(L, L->top, ls->t.seminfo.ts); break;
+    case '-': {
+      luaX_next(ls);
+      check(ls, TK_NUMBER);
+      setnumvalue(L->top, luai_numunm(ls->t.seminfo.r));
+      break;
+    }
+    case '{': {
+      enterlevel(ls);
+      dataconstructor(ls);
+      leavelevel(ls);
+      return;
+    }
+    default: {
+      luaX_syntaxerror(ls, "unexpected symbol");
+      return;
+    }
+  }
+  incr_top(L);
+  luaX_next(ls);
+}
+
+
+/* 解析一个数据chunk，把它的值压栈 */
+void luaY_parsedata (lua_State *L, ZIO *z, Mbuffer *buff, const char *name) {
+  struct LexState lexstate;
+  struct FuncState funcstate;	/* 只用到h: 锚住token里的字符串 */
+  funcstate.h = luaH_new(L, 0, 0);
+  sethvalue2s(L, L->top, funcstate.h);
+  incr_top(L);
+  setsvalue2s(L, L->top, luaS_new(L, name));
+  incr_top(L);
+  lexstate.buff = buff;
+  luaX_setinput(L, &lexstate, z, rawtsvalue(L->top - 1));
+  funcstate.prev = NULL;
+  funcstate.ls = &lexstate;
+  funcstate.L = L;
+  lexstate.fs = &funcstate;
+  luaX_next(&lexstate);  /* read first token */
+  testnext(&lexstate, TK_RETURN);
+  datavalue(&lexstate);
+  testnext(&lexstate, ';');
+  check(&lexstate, TK_EOS);
+  setobj2s(L, L->top - 3, L->top - 1);  /* the value replaces the anchors */
+  L->top -= 2;
+}
+
+/* }====================================================================== */
@@ -281,18 +281,27 @@ typedef struct FuncState {
   ** 当前激活的var的idx到f.locvars的映射 
   */
   unsigned short actvar[LUAI_MAXVARS];
+
+  /* per active var: 1 + index in `p' of the function it holds while it
+     is only called (see noescape in lparser.c), else 0 */
+  int noescape[LUAI_MAXVARS];
   
   /* number of active local variables：当前激活中的locvar数量
   ** 对于上面的nlocvars第二次声明local时，nactvar:从1->3,因为离开第一个块后，块所属的locvar被释放了（变量的声明周期也结束了）
   */
   lu_byte nactvar;  					
 
+  /* 变参函数体对`arg'的使用: 0 未用, 1 用到了`arg', 2 用到了`...'(不再需要`arg') */
+  lu_byte argstate;
+
   upvaldesc upvalues[LUAI_MAXUPVALUES];  /* upvalues */
 } FuncState;
 
 
 LUAI_FUNC Proto *luaY_parser (lua_State *L, ZIO *z, Mbuffer *buff,
                                             const char *name);
+LUAI_FUNC void luaY_parsedata (lua_State *L, ZIO *z, Mbuffer *buff,
+                                             const char *name);
 
 
 #endif
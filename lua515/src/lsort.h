@@ -0,0 +1,166 @@
+/*
+** $Id: lsort.h $
+** Introsort of a sequence, shared by `luaH_sortarray' and table.sort
+** See Copyright Notice in lua.h
+*/
+
+/*
+** This file is a template, included by each sort after it defines
+**   SORT_CTX		type of the first argument of every function
+**   SORT_NAME(n)	name given to function `n' (ltable.c and ltablib.c
+**			are compiled together in etc/all.c)
+**   sortlt(c,i,j)	whether element `i' is less than element `j'
+**   sortswap(c,i,j)	exchanges elements `i' and `j'
+** It defines SORT_NAME(insertion)(c, l, n), sorting by insertion the `n'
+** elements from index `l', and SORT_NAME(sort)(c, l, n), and undefines
+** the names above; so it has no include guard. Elements are only
+** compared and swapped: if `sortlt' raises an error, the sequence is
+** still a permutation of its elements.
+*/
+
+/* below this size a range is sorted by insertion */
+#ifndef SORT_INSERTION
+#define SORT_INSERTION	16
+#endif
+
+#define sort2(c,i,j)	{ if (sortlt(c, j, i)) sortswap(c, i, j); }
+
+
+static void SORT_NAME(insertion) (SORT_CTX c, int l, int n) {
+  int i, j;
+  for (i = l + 1; i < l + n; i++)
+    for (j = i; j > l && sortlt(c, j, j-1); j--)
+      sortswap(c, j, j-1);
+}
+
+
+/*
+** insertion sort that gives up after moving `SORT_INSERTION' elements;
+** returns whether the range is sorted
+*/
+static int SORT_NAME(partial) (SORT_CTX c, int l, int n) {
+  int i, j, moves = 0;
+  for (i = l + 1; i < l + n; i++) {
+    for (j = i; j > l && sortlt(c, j, j-1); j--)
+      sortswap(c, j, j-1);
+    moves += i - j;
+    if (moves > SORT_INSERTION) return i == l + n - 1;
+  }
+  return 1;
+}
+
+
+/* heap of the `n' elements from `l', rooted at element l+k */
+static void SORT_NAME(siftdown) (SORT_CTX c, int l, int k, int n) {
+  for (;;) {
+    int ch = 2*k + 1;
+    if (ch >= n) break;
+    if (ch + 1 < n && sortlt(c, l+ch, l+ch+1)) ch++;
+    if (!sortlt(c, l+k, l+ch)) break;
+    sortswap(c, l+k, l+ch);
+    k = ch;
+  }
+}
+
+
+static void SORT_NAME(heap) (SORT_CTX c, int l, int n) {
+  int i;
+  for (i = n/2 - 1; i >= 0; i--)
+    SORT_NAME(siftdown)(c, l, i, n);
+  for (i = n - 1; i > 0; i--) {
+    sortswap(c, l, l+i);
+    SORT_NAME(siftdown)(c, l, 0, i);
+  }
+}
+
+
+/*
+** moves the pivot (median of 3, or of 3 medians of 3 for large ranges)
+** to element `l', then partitions around it; elements equal to the
+** pivot stop both scans, so they split evenly. Returns the final offset
+** of the pivot; `*swaps' tells whether any element had to move.
+*/
+static int SORT_NAME(partition) (SORT_CTX c, int l, int n, int *swaps) {
+  int i = l, j = l + n, h = l + n/2, u = l + n - 1;
+  if (n > 128) {
+    sort2(c, l, h); sort2(c, h, u); sort2(c, l, h);
+    sort2(c, l+1, h-1); sort2(c, h-1, u-1); sort2(c, l+1, h-1);
+    sort2(c, l+2, h+1); sort2(c, h+1, u-2); sort2(c, l+2, h+1);
+    sort2(c, h-1, h); sort2(c, h, h+1); sort2(c, h-1, h);
+    sortswap(c, l, h);
+  }
+  else {
+    sort2(c, h, l); sort2(c, l, u); sort2(c, h, l);
+  }
+  *swaps = 0;
+  for (;;) {
+    while (++i <= u && sortlt(c, i, l)) ;
+    while (--j > l && sortlt(c, l, j)) ;
+    if (i >= j) break;
+    sortswap(c, i, j);
+    *swaps = 1;
+  }
+  sortswap(c, l, j);
+  return j - l;
+}
+
+
+/* swaps a few elements of a range some pattern made a bad partition of */
+static void SORT_NAME(breakpatterns) (SORT_CTX c, int l, int n) {
+  int q = n/4, u = l + n - 1;
+  sortswap(c, l, l+q);
+  sortswap(c, u, u-q);
+  if (n > 128) {
+    sortswap(c, l+1, l+q+1); sortswap(c, l+2, l+q+2);
+    sortswap(c, u-1, u-q-1); sortswap(c, u-2, u-q-2);
+  }
+}
+
+
+/*
+** pattern-defeating quicksort: after `bad' partitions leaving less than
+** 1/8 of the range on one side it switches to heapsort, so it is
+** O(n log n) in the worst case, and a partition that moved nothing
+** tries to finish both sides by insertion (sorted input is linear)
+*/
+static void SORT_NAME(pdq) (SORT_CTX c, int l, int n, int bad) {
+  while (n > SORT_INSERTION) {
+    int swaps;
+    int p = SORT_NAME(partition)(c, l, n, &swaps);
+    int nl = p, nr = n - p - 1;
+    if (nl < n/8 || nr < n/8) {  /* unbalanced? */
+      if (--bad == 0) {
+        SORT_NAME(heap)(c, l, n);
+        return;
+      }
+      if (nl >= SORT_INSERTION) SORT_NAME(breakpatterns)(c, l, nl);
+      if (nr >= SORT_INSERTION) SORT_NAME(breakpatterns)(c, l + p + 1, nr);
+    }
+    else if (!swaps && SORT_NAME(partial)(c, l, nl) &&
+             SORT_NAME(partial)(c, l + p + 1, nr))
+      return;
+    if (nl < nr) {  /* recurse into the smaller side */
+      SORT_NAME(pdq)(c, l, nl, bad);
+      l += p + 1; n = nr;
+    }
+    else {
+      SORT_NAME(pdq)(c, l + p + 1, nr, bad);
+      n = nl;
+    }
+  }
+  SORT_NAME(insertion)(c, l, n);
+}
+
+
+static void SORT_NAME(sort) (SORT_CTX c, int l, int n) {
+  int bad;
+  for (bad = 1; (n >> bad) > 0; bad++) ;  /* log2(n) */
+  SORT_NAME(pdq)(c, l, n, bad);
+}
+
+
+#undef sort2
+#undef SORT_CTX
+#undef SORT_NAME
+#undef sortlt
+#undef sortswap
@@ -6,12 +6,20 @@
 
 
 #include <stddef.h>
+#include <string.h>
 
 #define lstate_c
 #define LUA_CORE
 
 #include "lua.h"
 
+#if defined(LUA_USE_PTHREADS)
+#include <pthread.h>
+#endif
+#if defined(LUA_USE_LOCK)
+#include <sched.h>
+#endif
+
 #include "ldebug.h"
 #include "ldo.h"
 #include "lfunc.h"
@@ -38,17 +46,10 @@ typedef struct LG {
 } LG;
   
 
-/* 初始化调用栈，数据栈 */
-static void stack_init (lua_State *L1, lua_State *L) {
-  /* initialize CallInfo array */
-  L1->base_ci = luaM_newvector(L, BASIC_CI_SIZE, CallInfo);
+/* 重置调用栈，数据栈(数组已分配) */
+static void stack_reset (lua_State *L1) {
   L1->ci = L1->base_ci;
-  L1->size_ci = BASIC_CI_SIZE;
   L1->end_ci = L1->base_ci + L1->size_ci - 1;
-  
-  /* initialize stack array */
-  L1->stack = luaM_newvector(L, BASIC_STACK_SIZE + EXTRA_STACK, TValue);
-  L1->stacksize = BASIC_STACK_SIZE + EXTRA_STACK;
   L1->top = L1->stack;
   L1->stack_last = L1->stack+(L1->stacksize - EXTRA_STACK)-1;
   
@@ -57,6 +58,19 @@ static void stack_init (lua_State *L1, lua_State *L) {
   setnilvalue(L1->top++);  /* 当前被调函数为nil `function' entry for this `ci' */
   L1->base = L1->ci->base = L1->top;
   L1->ci->top = L1->top + LUA_MINSTACK;	/* 给调用栈预留出 LUA_MINSTACK 个slot空间 */
+  L1->ci->pcall = 0;
+}
+
+/* 初始化调用栈，数据栈 */
+static void stack_init (lua_State *L1, lua_State *L, int size) {
+  /* initialize CallInfo array */
+  L1->base_ci = luaM_newvector(L, BASIC_CI_SIZE, CallInfo);
+  L1->size_ci = BASIC_CI_SIZE;
+  
+  /* initialize stack array */
+  L1->stack = luaM_newvector(L, size + EXTRA_STACK, TValue);
+  L1->stacksize = size + EXTRA_STACK;
+  stack_reset(L1);
 }
 
 /* 释放调用栈，数据栈 */
@@ -66,23 +80,179 @@ static void freestack (lua_State *L, lua_State *L1) {
 }
 
 
+/* inline cache for the prototypes of a shared heap (see lvm.c) */
+static ICache *newicshared (lua_State *L) {
+  int i;
+  ICache *ic = luaM_newvector(L, ICSHAREDSIZE, ICache);
+  for (i = 0; i < ICSHAREDSIZE; i++) {
+    ic[i].mt = ic[i].h = NULL;
+    ic[i].slot = ic[i].mslot = 0;
+  }
+  return ic;
+}
+
+
 /*
 ** open parts that may cause memory-allocation errors
 */
 static void f_luaopen (lua_State *L, void *ud) {
   global_State *g = G(L);
   UNUSED(ud);
-  stack_init(L, L);  /* init stack */
+  stack_init(L, L, BASIC_STACK_SIZE);  /* init stack */
   sethvalue(L, gt(L), luaH_new(L, 0, 2));  /* table of globals, 初始化全局表 */
   sethvalue(L, registry(L), luaH_new(L, 0, 2));  /* registry */
   luaS_resize(L, MINSTRTABSIZE);  /* initial size of string table */
   luaT_init(L);
   luaX_init(L);
-  luaS_fix(luaS_newliteral(L, MEMERRMSG));
+  {
+    TString *memerr = luaS_newliteral(L, MEMERRMSG);
+    luaS_fix(memerr);
+  }
+  if (g->shared != NULL)
+    g->icshared = newicshared(L);
   g->GCthreshold = 4*g->totalbytes;
 }
 
 
+#if !defined(luai_makeseed)
+#include <time.h>
+#define luai_makeseed()		cast(unsigned int, time(NULL))
+#endif
+
+
+/*
+** a seed for string hashes, mixing the time with some addresses that
+** vary between runs when address-space randomization is on
+*/
+#define addbuff(b,p,e) \
+  { size_t t = cast(size_t, e); memcpy((b) + (p), &t, sizeof(t)); (p) += sizeof(t); }
+
+static unsigned int makeseed (lua_State *L) {
+  char buff[4 * sizeof(size_t)];
+  unsigned int h = luai_makeseed();
+  int p = 0;
+  addbuff(buff, p, L);  /* heap variable */
+  addbuff(buff, p, &h);  /* local variable */
+  addbuff(buff, p, luaO_nilobject);  /* global variable */
+  addbuff(buff, p, &lua_newstate);  /* public function */
+  lua_assert(p == sizeof(buff));
+  return luaS_hash(buff, p, h);
+}
+
+
+/*
+** {======================================================
+** Shared heaps: objects frozen by `lua_freeze'
+** =======================================================
+*/
+
+#if defined(LUA_USE_PTHREADS)
+static pthread_mutex_t heaplock = PTHREAD_MUTEX_INITIALIZER;
+#define lockheaps()	pthread_mutex_lock(&heaplock)
+#define unlockheaps()	pthread_mutex_unlock(&heaplock)
+#else
+#define lockheaps()	((void)0)
+#define unlockheaps()	((void)0)
+#endif
+
+/* the heap belongs to no state: its blocks go back to `frealloc' */
+#define heapfree(h,b,s)	((void)(*(h)->frealloc)((h)->ud, (b), (s), 0))
+#define heapfreearray(h,b,n,t)	heapfree(h, b, cast(size_t, n)*sizeof(t))
+
+
+/* memory of a prototype that owns all its arrays and has no cache */
+static lu_mem protosize (const Proto *f) {
+  return sizeof(Proto) + f->sizecode*sizeof(Instruction) +
+         f->sizep*sizeof(Proto *) + f->sizek*sizeof(TValue) +
+         f->sizelineinfo*sizeof(int) + f->sizelocvars*sizeof(LocVar) +
+         f->sizeupvalues*sizeof(TString *);
+}
+
+
+static void freeheap (lua_Heap *h) {
+  lua_Alloc frealloc = h->frealloc;
+  void *ud = h->ud;
+  GCObject *o, *next;
+  int i;
+  for (o = h->protos; o != NULL; o = next) {  /* as `luaF_freeproto' */
+    Proto *f = gco2p(o);
+    next = o->gch.next;
+    heapfreearray(h, f->code, f->sizecode, Instruction);
+    heapfreearray(h, f->p, f->sizep, Proto *);
+    heapfreearray(h, f->k, f->sizek, TValue);
+    heapfreearray(h, f->lineinfo, f->sizelineinfo, int);
+    heapfreearray(h, f->locvars, f->sizelocvars, struct LocVar);
+    heapfreearray(h, f->upvalues, f->sizeupvalues, TString *);
+    heapfree(h, f, sizeof(Proto));
+  }
+  for (i = 0; i < h->strt.size; i++) {
+    for (o = h->strt.hash[i]; o != NULL; o = next) {
+      next = o->gch.next;
+      heapfree(h, o, sizestring(gco2ts(o)));
+    }
+  }
+  heapfreearray(h, h->strt.hash, h->strt.size, GCObject *);
+  heapfreearray(h, h->fn, h->nfn, Proto *);
+  (*frealloc)(ud, h, sizeof(lua_Heap), 0);
+}
+
+
+LUA_API void lua_releaseheap (lua_Heap *h) {
+  int last;
+  lockheaps();
+  last = (--h->nref == 0);
+  unlockheaps();
+  if (last)
+    freeheap(h);
+}
+
+
+/*
+** gives `f' and the functions inside it their own copies of the arrays
+** of an image, decodes their debug info and drops their inline caches:
+** once shared, nothing may write into them
+*/
+static void ownproto (lua_State *L, Proto *f) {
+  int i;
+  luaG_needdebug(L, f);
+  if (f->inimage & PROTO_CODEIMG) {
+    Instruction *code = luaM_newvector(L, f->sizecode, Instruction);
+    memcpy(code, f->code, f->sizecode*sizeof(Instruction));
+    f->code = code;
+    f->inimage &= ~PROTO_CODEIMG;
+  }
+  if (f->inimage & PROTO_LINEIMG) {
+    int *lineinfo = luaM_newvector(L, f->sizelineinfo, int);
+    memcpy(lineinfo, f->lineinfo, f->sizelineinfo*sizeof(int));
+    f->lineinfo = lineinfo;
+    f->inimage &= ~PROTO_LINEIMG;
+  }
+  if (f->icache) {
+    luaM_freearray(L, f->icache, f->sizecode, ICache);
+    f->icache = NULL;
+  }
+  for (i = 0; i < f->sizep; i++)
+    ownproto(L, f->p[i]);
+}
+
+
+/* flags `f' and the functions inside it as shared; returns their size */
+static lu_mem shareproto (Proto *f) {
+  lu_mem size;
+  int i;
+  if (f->inimage & PROTO_SHARED) return 0;  /* already seen */
+  f->inimage |= PROTO_SHARED;
+  f->marked = SHAREDMARKS;
+  f->cache = NULL;  /* each state makes its own closures */
+  size = protosize(f);
+  for (i = 0; i < f->sizep; i++)
+    size += shareproto(f->p[i]);
+  return size;
+}
+
+/* }====================================================== */
+
+
 static void preinit_state (lua_State *L, global_State *g) {
   G(L) = g;
   L->stack = NULL;
@@ -93,6 +263,10 @@ static void preinit_state (lua_State *L, global_State *g) {
   L->basehookcount = 0;
   L->allowhook = 1;
   resethookcount(L);
+  L->basebudget = 0;
+  resetbudget(L);
+  L->budgetf = NULL;
+  L->budgetud = NULL;
   L->openupval = NULL;
   L->size_ci = 0;
   L->nCcalls = L->baseCcalls = 0;
@@ -106,34 +280,71 @@ static void preinit_state (lua_State *L, global_State *g) {
 
 static void close_state (lua_State *L) {
   global_State *g = G(L);
+  lua_Heap *h = g->shared;
   luaF_close(L, L->stack);  /* close all upvalues for this thread */
+  luaM_heaprate(L, 0);  /* heap profiler off */
+  luaC_bgsweep(L, 0);  /* frees what the sweeper still holds */
   luaC_freeall(L);  /* collect all objects */
   lua_assert(g->rootgc == obj2gco(L));
   lua_assert(g->strt.nuse == 0);
   luaM_freearray(L, G(L)->strt.hash, G(L)->strt.size, TString *);
+  luaM_freearray(L, g->strt.oldhash, g->strt.oldsize, TString *);
+  luaM_freearray(L, g->clearlog, g->sizeclearlog, WeakEntry);
+  luaM_freearray(L, g->prof.buf, g->prof.size, ProfSample);
+  if (g->icshared)
+    luaM_freearray(L, g->icshared, ICSHAREDSIZE, ICache);
   luaZ_freebuffer(L, &g->buff);
+  luaE_freecache(L);
   freestack(L, L);
   lua_assert(g->totalbytes == sizeof(LG));
+#if defined(LUA_USE_LOCK)
+  pthread_mutex_destroy(&g->lock.m);
+#endif
   (*g->frealloc)(g->ud, fromstate(L), state_size(LG), 0);
+  if (h != NULL)
+    lua_releaseheap(h);
 }
 
 /* L1->env尚未赋值，也未初始化，是一个随机值 */
 lua_State *luaE_newthread (lua_State *L) {
-  lua_State *L1 = tostate(luaM_malloc(L, state_size(lua_State)));
+  global_State *g = G(L);
+  lua_State *L1 = g->freethreads;
+  if (L1 != NULL) {  /* reuse a dead coroutine and its stacks */
+    CallInfo *ci = L1->base_ci;
+    StkId stack = L1->stack;
+    int size_ci = L1->size_ci;
+    int stacksize = L1->stacksize;
+    g->freethreads = cast(lua_State *, L1->next);
+    g->nfreethreads--;
+    luaC_link(L, obj2gco(L1), LUA_TTHREAD);
+    preinit_state(L1, g);
+    L1->base_ci = ci;
+    L1->size_ci = size_ci;
+    L1->stack = stack;
+    L1->stacksize = stacksize;
+    stack_reset(L1);
+  }
+  else {
+    L1 = tostate(luaM_malloc(L, state_size(lua_State)));
   
-  /* 挂到rootgc链表，初始化marked */
-  luaC_link(L, obj2gco(L1), LUA_TTHREAD);
+    /* 挂到rootgc链表，初始化marked */
+    luaC_link(L, obj2gco(L1), LUA_TTHREAD);
   
-  preinit_state(L1, G(L));
-  stack_init(L1, L);  /* init stack */
+    preinit_state(L1, g);
+    stack_init(L1, L, LUAI_THREADSTACK);  /* init stack */
+  }
   
   setobj2n(L, gt(L1), gt(L));  /* share table of globals */
 
   /* 继承debug设置 */
-  L1->hookmask = L->hookmask;
+  L1->hookmask = L->hookmask & ~MASKBUDGET;
   L1->basehookcount = L->basehookcount;
   L1->hook = L->hook;
   resethookcount(L1);
+  L1->basebudget = L->basebudget;
+  resetbudget(L1);
+  L1->budgetf = L->budgetf;
+  L1->budgetud = L->budgetud;
   
   /* 
   ** 暂无任何对象引用刚被构建出来的L1,所以L1只能是white，其它颜色则是非法的
@@ -144,16 +355,43 @@ lua_State *luaE_newthread (lua_State *L) {
 }
 
 
+/*
+** a dead coroutine goes to the cache of its state unless the cache is
+** full or its stacks grew too much to be worth keeping
+*/
 void luaE_freethread (lua_State *L, lua_State *L1) {
+  global_State *g = G(L);
   luaF_close(L1, L1->stack);  /* close all upvalues for this thread */
   lua_assert(L1->openupval == NULL);
   luai_userstatefree(L1);
+  if (g->nfreethreads < LUAI_THREADCACHE &&
+      L1->stacksize <= 4*BASIC_STACK_SIZE && L1->size_ci <= 4*BASIC_CI_SIZE) {
+    L1->next = obj2gco(g->freethreads);
+    g->freethreads = L1;
+    g->nfreethreads++;
+    return;
+  }
   freestack(L, L1);
   luaM_freemem(L, fromstate(L1), state_size(lua_State));
 }
 
 
-LUA_API lua_State *lua_newstate (lua_Alloc f, void *ud) {
+/* frees the coroutines kept for reuse */
+void luaE_freecache (lua_State *L) {
+  global_State *g = G(L);
+  while (g->freethreads != NULL) {
+    lua_State *L1 = g->freethreads;
+    g->freethreads = cast(lua_State *, L1->next);
+    freestack(L, L1);
+    luaM_freemem(L, fromstate(L1), state_size(lua_State));
+  }
+  g->nfreethreads = 0;
+}
+
+
+/* `like' (a state being cloned, or NULL) gives the string hashes */
+static lua_State *newstate (lua_Alloc f, void *ud, lua_Heap *h,
+                            const global_State *like) {
   int i;
   lua_State *L;
   global_State *g;
@@ -180,22 +418,85 @@ LUA_API lua_State *lua_newstate (lua_Alloc f, void *ud) {
   g->strt.size = 0;
   g->strt.nuse = 0;
   g->strt.hash = NULL;
+  g->seed = makeseed(L);
+#if defined(LUAI_HASHFULL)
+  g->hashfull = 1;
+#else
+  g->hashfull = 0;
+#endif
+#if defined(LUAI_OPTIMIZE)
+  g->optimize = 1;
+#else
+  g->optimize = 0;
+#endif
+  if (like != NULL) {
+    g->seed = like->seed;
+    g->hashfull = like->hashfull;
+  }
+  g->shared = h;
+  g->icshared = NULL;
+  if (h != NULL) {  /* hashes must agree with the shared strings */
+    g->seed = h->seed;
+    g->hashfull = h->hashfull;
+    lockheaps();
+    h->nref++;
+    unlockheaps();
+  }
+  g->strt.oldhash = NULL;
+  g->strt.oldsize = 0;
+  g->strt.rehashpos = 0;
+  g->prof.buf = NULL;
+  g->freethreads = NULL;
+  g->nfreethreads = 0;
+#if defined(LUA_USE_LOCK)
+  pthread_mutex_init(&g->lock.m, NULL);
+  g->lock.waiters = 0;
+#endif
+  g->prof.size = g->prof.next = g->prof.n = 0;
+  g->heap.blocks = NULL;
+  g->heap.sites = NULL;
+  g->heap.sitehash = NULL;
+  g->heap.sizeblocks = g->heap.sizesites = g->heap.sizesitehash = 0;
+  luaM_heaprate(L, 0);  /* profiler off */
+  g->memlimit = g->memsoft = MAX_LUMEM;  /* no memory limits */
+  g->memsofthook = NULL;
+  g->memsoftud = NULL;
+  luaC_setmemlimits(L);
   setnilvalue(registry(L));
   luaZ_initbuffer(L, &g->buff);
   g->panic = NULL;
   
   g->gcstate = GCSpause;
+  g->gckind = KGC_NORMAL;
   g->rootgc = obj2gco(L);	/* 这里rootgc->mainthread,后续讲gc时会再次提到 */
   g->sweepstrgc = 0;
   g->sweepgc = &g->rootgc;
   g->gray = NULL;
   g->grayagain = NULL;
-  g->weak = NULL;
+  g->weak = g->ephemeron = g->allweak = NULL;
+  g->clearlog = NULL;
+  g->nclearlog = g->sizeclearlog = 0;
+  g->logclears = g->gcconverge = 0;
   g->tmudata = NULL;
   
   g->totalbytes = sizeof(LG);
   g->gcpause = LUAI_GCPAUSE;
   g->gcstepmul = LUAI_GCMUL;
+  g->gcmajorinc = LUAI_GCMAJOR;
+  g->gcmarkthreads = LUAI_MARKTHREADS;
+  g->gcbudget = LUAI_GCBUDGET;
+  g->gcgrowth = LUAI_GCGROWTH;
+  g->sweeper = NULL;
+  g->deferred = g->deferredtail = NULL;
+  g->deferredbytes = 0;
+  g->deferfree = 0;
+  memset(&g->gcstats, 0, sizeof(g->gcstats));
+#if defined(LUAI_STATS)
+  memset(&g->stats, 0, sizeof(g->stats));
+#endif
+  g->gctimer.phase = -1;
+  g->gctimer.allocmark = g->gctimer.freemark = 0;
+  g->gcmajorbase = 0;
   g->gcdept = 0;
   for (i=0; i<NUM_TAGS; i++) g->mt[i] = NULL;
   if (luaD_rawrunprotected(L, f_luaopen, NULL) != 0) {
@@ -209,6 +510,11 @@ LUA_API lua_State *lua_newstate (lua_Alloc f, void *ud) {
 }
 
 
+LUA_API lua_State *lua_newstate (lua_Alloc f, void *ud) {
+  return newstate(f, ud, NULL, NULL);
+}
+
+
 static void callallgcTM (lua_State *L, void *ud) {
   UNUSED(ud);
   luaC_callGCTM(L);  /* call GC metamethods for all udata */
@@ -232,7 +538,519 @@ LUA_API void lua_close (lua_State *L) {
   } while (luaD_rawrunprotected(L, callallgcTM, NULL) != 0);
   lua_assert(G(L)->tmudata == NULL);
   luai_userstateclose(L);
+  lua_unlock(L);  /* the lock goes with the state */
   
   close_state(L);
 }
 
+
+#if defined(LUA_USE_LOCK)
+/*
+** {======================================================
+** Lock of a state run by several OS threads
+** =======================================================
+*/
+
+/*
+** an uncontended lock costs one trylock; only threads that must block
+** announce themselves, so that `luaE_threadyield' knows to step aside
+*/
+void luaE_lock (lua_State *L) {
+  StateLock *l = &G(L)->lock;
+  if (pthread_mutex_trylock(&l->m) != 0) {
+    __sync_fetch_and_add(&l->waiters, 1);
+    pthread_mutex_lock(&l->m);
+    __sync_fetch_and_sub(&l->waiters, 1);
+  }
+}
+
+
+void luaE_unlock (lua_State *L) {
+  pthread_mutex_unlock(&G(L)->lock.m);
+}
+
+
+/* called by the VM at backward jumps when another thread waits */
+void luaE_threadyield (lua_State *L) {
+  pthread_mutex_unlock(&G(L)->lock.m);
+  sched_yield();  /* let a waiter take it */
+  luaE_lock(L);
+}
+
+/* }====================================================== */
+#endif
+
+
+
+LUA_API lua_State *lua_newsharedstate (lua_Heap *h, lua_Alloc f, void *ud) {
+  return newstate(f, ud, h, NULL);
+}
+
+
+/*
+** moves every string of `L' and the prototypes of the `n' Lua functions
+** on its stack into a new heap, pops the functions and attaches `L' to
+** the heap. Returns NULL (and leaves `L' as it is) if a value is not a
+** Lua function, `L' already uses a heap or there is no memory for one.
+*/
+LUA_API lua_Heap *lua_freeze (lua_State *L, int n) {
+  global_State *g = G(L);
+  int gckind = g->gckind;
+  lu_mem moved = 0;
+  GCObject **hash;
+  GCObject **p;
+  lua_Heap *h;
+  Proto **fn = NULL;
+  int i;
+  lua_lock(L);
+  api_check(L, n >= 0 && n <= L->top - L->base);
+  for (i = 1; i <= n; i++) {
+    if (!isLfunction(L->top - i)) break;
+  }
+  if (i <= n || g->shared != NULL) {
+    lua_unlock(L);
+    return NULL;
+  }
+  for (i = 1; i <= n; i++)
+    ownproto(L, clvalue(L->top - i)->l.p);
+  luaC_changemode(L, KGC_NORMAL);  /* no remembered set may keep them */
+  luaC_fullgc(L);  /* only live objects go to the heap */
+  lua_assert(g->gcstate == GCSpause);
+  luaS_rehash(L, g->strt.oldsize);  /* finish a pending resize */
+  if (g->icshared == NULL)
+    g->icshared = newicshared(L);
+  hash = luaM_newvector(L, MINSTRTABSIZE, GCObject *);
+  h = cast(lua_Heap *, (*g->frealloc)(g->ud, NULL, 0, sizeof(lua_Heap)));
+  if (h != NULL && n > 0) {
+    fn = cast(Proto **, (*g->frealloc)(g->ud, NULL, 0, n*sizeof(Proto *)));
+    if (fn == NULL) {
+      (*g->frealloc)(g->ud, h, sizeof(lua_Heap), 0);
+      h = NULL;
+    }
+  }
+  if (h == NULL) {
+    luaM_freearray(L, hash, MINSTRTABSIZE, GCObject *);
+    luaC_changemode(L, gckind);
+    lua_unlock(L);
+    return NULL;
+  }
+  /* nothing below allocates: the objects change owner at once */
+  h->fn = fn;
+  h->nfn = n;
+  for (i = 0; i < n; i++) {
+    fn[i] = clvalue(L->top - n + i)->l.p;
+    moved += shareproto(fn[i]);
+  }
+  h->protos = NULL;
+  for (p = &g->rootgc; *p != NULL; ) {  /* unlink the shared prototypes */
+    GCObject *o = *p;
+    if (o->gch.tt == LUA_TPROTO && (gco2p(o)->inimage & PROTO_SHARED)) {
+      *p = o->gch.next;
+      o->gch.next = h->protos;
+      h->protos = o;
+    }
+    else
+      p = &o->gch.next;
+  }
+  h->strt = g->strt;  /* take the whole string table */
+  for (i = 0; i < h->strt.size; i++) {
+    GCObject *o;
+    for (o = h->strt.hash[i]; o != NULL; o = o->gch.next) {
+      o->gch.marked = SHAREDMARKS;
+      moved += sizestring(gco2ts(o));
+    }
+  }
+  moved += h->strt.size*sizeof(GCObject *);
+  for (i = 0; i < MINSTRTABSIZE; i++) hash[i] = NULL;
+  g->strt.hash = hash;
+  g->strt.size = MINSTRTABSIZE;
+  g->strt.nuse = 0;
+  lua_assert(g->totalbytes > moved);
+  g->totalbytes -= moved;
+  h->totalbytes = moved + sizeof(lua_Heap) + n*sizeof(Proto *);
+  h->seed = g->seed;
+  h->hashfull = g->hashfull;
+  h->nref = 2;  /* `L' and the caller */
+  h->frealloc = g->frealloc;
+  h->ud = g->ud;
+  g->shared = h;
+  L->top -= n;
+  luaC_changemode(L, gckind);
+  lua_unlock(L);
+  return h;
+}
+
+
+/*
+** {======================================================
+** Cloning a state: `lua_clonestate'
+** =======================================================
+*/
+
+typedef struct CloneState {
+  const global_State *from;  /* only read: it may be cloned by many at once */
+  lua_State *L;  /* the clone */
+  Table *map;  /* object of `from' (as a light userdata) -> its copy */
+  Table *todo;  /* objects whose copies are still empty (and a flag) */
+  int ntodo;
+  Table *hooks;  /* copies of userdata whose metatable has `__clone' */
+  int nhooks;
+} CloneState;
+
+
+static GCObject *copyobj (CloneState *C, GCObject *o);
+
+
+static void copyvalue (CloneState *C, TValue *dst, const TValue *src) {
+  if (iscollectable(src)) {
+    dst->value.gc = copyobj(C, gcvalue(src));
+    dst->tt = src->tt;
+  }
+  else
+    setobj(C->L, dst, src);
+}
+
+
+#define copytable(C,t) \
+	((t) != NULL ? gco2h(copyobj(C, obj2gco(t))) : NULL)
+
+
+static void remember (CloneState *C, void *o, GCObject *n) {
+  TValue key;
+  TValue *v;
+  setpvalue(&key, o);
+  v = luaH_set(C->L, C->map, &key);
+  v->value.gc = n;
+  v->tt = n->gch.tt;
+}
+
+
+/* long strings (chunk sources, mostly) are looked up in `map', so
+   they are compared with `luaS_newlstr' only once */
+#define LONGSTR		64
+
+static TString *copystr (CloneState *C, TString *ts) {
+  TString *nts;
+  if (ts == NULL || ts->tsv.marked == SHAREDMARKS)
+    return ts;
+  if (ts->tsv.len > LONGSTR) {
+    TValue key;
+    const TValue *v;
+    setpvalue(&key, ts);
+    v = luaH_get(C->map, &key);
+    if (!ttisnil(v)) return rawtsvalue(v);
+  }
+  nts = luaS_newlstr(C->L, getstr(ts), ts->tsv.len);
+  if (ts->tsv.len > LONGSTR)
+    remember(C, ts, obj2gco(nts));
+  return nts;
+}
+
+
+static void pushtodo (CloneState *C, GCObject *o, int flag) {
+  setpvalue(luaH_setnum(C->L, C->todo, ++C->ntodo), o);
+  setbvalue(luaH_setnum(C->L, C->todo, ++C->ntodo), flag);
+}
+
+
+static Proto *copyproto (CloneState *C, Proto *f) {
+  lua_State *L = C->L;
+  Proto *nf;
+  TValue key;
+  const TValue *v;
+  int i;
+  if (f->inimage & PROTO_SHARED) return f;
+  setpvalue(&key, f);
+  v = luaH_get(C->map, &key);
+  if (!ttisnil(v)) return gco2p(gcvalue(v));
+  nf = luaF_newproto(L);
+  remember(C, f, obj2gco(nf));
+  nf->source = copystr(C, f->source);
+  nf->linedefined = f->linedefined;
+  nf->lastlinedefined = f->lastlinedefined;
+  nf->nups = f->nups;
+  nf->numparams = f->numparams;
+  nf->is_vararg = f->is_vararg;
+  nf->maxstacksize = f->maxstacksize;
+  nf->code = luaM_newvector(L, f->sizecode, Instruction);  /* owned, */
+  nf->sizecode = f->sizecode;  /* even if `f' runs from an image */
+  memcpy(nf->code, f->code, f->sizecode*sizeof(Instruction));
+  nf->lineinfo = luaM_newvector(L, f->sizelineinfo, int);
+  nf->sizelineinfo = f->sizelineinfo;
+  memcpy(nf->lineinfo, f->lineinfo, f->sizelineinfo*sizeof(int));
+  nf->k = luaM_newvector(L, f->sizek, TValue);
+  for (i = 0; i < f->sizek; i++) setnilvalue(&nf->k[i]);
+  nf->sizek = f->sizek;
+  for (i = 0; i < f->sizek; i++)  /* numbers and strings */
+    copyvalue(C, &nf->k[i], &f->k[i]);
+  nf->p = luaM_newvector(L, f->sizep, Proto *);
+  for (i = 0; i < f->sizep; i++) nf->p[i] = NULL;
+  nf->sizep = f->sizep;
+  for (i = 0; i < f->sizep; i++)
+    nf->p[i] = copyproto(C, f->p[i]);
+  nf->locvars = luaM_newvector(L, f->sizelocvars, LocVar);
+  for (i = 0; i < f->sizelocvars; i++) nf->locvars[i].varname = NULL;
+  nf->sizelocvars = f->sizelocvars;
+  for (i = 0; i < f->sizelocvars; i++) {
+    nf->locvars[i].varname = copystr(C, f->locvars[i].varname);
+    nf->locvars[i].startpc = f->locvars[i].startpc;
+    nf->locvars[i].endpc = f->locvars[i].endpc;
+  }
+  nf->upvalues = luaM_newvector(L, f->sizeupvalues, TString *);
+  for (i = 0; i < f->sizeupvalues; i++) nf->upvalues[i] = NULL;
+  nf->sizeupvalues = f->sizeupvalues;
+  for (i = 0; i < f->sizeupvalues; i++)
+    nf->upvalues[i] = copystr(C, f->upvalues[i]);
+  nf->debugidx = f->debugidx;
+  nf->debugsec = copystr(C, f->debugsec);
+  return nf;
+}
+
+
+/*
+** the copy of `o' in the clone; new copies are empty shells (filled by
+** `fillobj' from the work list), so deep structures need no recursion
+*/
+static GCObject *copyobj (CloneState *C, GCObject *o) {
+  lua_State *L = C->L;
+  GCObject *n;
+  TValue key;
+  const TValue *v;
+  int flag = 0;
+  if (o->gch.marked == SHAREDMARKS)
+    return o;  /* frozen: the clone uses the same heap */
+  if (o->gch.tt == LUA_TSTRING)
+    return obj2gco(copystr(C, rawgco2ts(o)));
+  setpvalue(&key, o);
+  v = luaH_get(C->map, &key);
+  if (!ttisnil(v)) return gcvalue(v);
+  switch (o->gch.tt) {
+    case LUA_TTABLE: {
+      Table *t = gco2h(o);
+      Table *nt = luaH_copylayout(L, t);
+      flag = (nt != NULL);  /* same layout: translate in place */
+      if (nt == NULL)
+        nt = luaH_new(L, t->sizearray, sizenode(t));
+      n = obj2gco(nt);
+      break;
+    }
+    case LUA_TFUNCTION: {
+      Closure *cl = gco2cl(o);
+      if (cl->c.isC) {
+        Closure *ncl = luaF_newCclosure(L, cl->c.nupvalues, NULL);
+        ncl->c.f = cl->c.f;
+        ncl->c.bitop = cl->c.bitop;
+        ncl->c.leaf = cl->c.leaf;
+        ncl->c.iter = cl->c.iter;
+        ncl->c.pcall = cl->c.pcall;
+        n = obj2gco(ncl);
+      }
+      else {
+        Closure *ncl = luaF_newLclosure(L, cl->l.nupvalues, NULL);
+        int i;
+        for (i = 0; i < cl->l.nupvalues; i++) ncl->l.upvals[i] = NULL;
+        ncl->l.p = copyproto(C, cl->l.p);
+        n = obj2gco(ncl);
+      }
+      break;
+    }
+    case LUA_TUSERDATA: {
+      Udata *u = rawgco2u(o);
+      Udata *nu = luaS_newudata(L, u->uv.len, NULL);
+      memcpy(nu + 1, u + 1, u->uv.len);
+      nu->uv.akind = u->uv.akind;
+      n = obj2gco(nu);
+      break;
+    }
+    case LUA_TUPVAL: {
+      n = obj2gco(luaF_newupval(L));
+      break;
+    }
+    case LUA_TTHREAD: {
+      if (o == obj2gco(C->from->mainthread))
+        return obj2gco(G(L)->mainthread);
+      luaG_runerror(L, "cannot clone a coroutine");
+    }
+    default: lua_assert(0); return NULL;
+  }
+  remember(C, o, n);
+  pushtodo(C, o, flag);
+  return n;
+}
+
+
+/* does `mt' have a field `name' (without creating the string)? */
+static int hasfield (const Table *mt, const char *name, size_t l) {
+  int i;
+  for (i = 0; i < sizenode(mt); i++) {
+    const TValue *k = key2tval(gnode(mt, i));
+    if (ttisstring(k) && tsvalue(k)->len == l &&
+        memcmp(svalue(k), name, l) == 0)
+      return !ttisnil(gnval(mt, i));
+  }
+  return 0;
+}
+
+
+static void fillobj (CloneState *C, GCObject *o, GCObject *n, int flag) {
+  lua_State *L = C->L;
+  int i;
+  switch (o->gch.tt) {
+    case LUA_TTABLE: {
+      Table *t = gco2h(o), *nt = gco2h(n);
+      nt->metatable = copytable(C, t->metatable);
+      nt->flags = t->flags & ~TMCACHED;
+      if (t->tmcache != NULL)
+        luaT_newcache(L, nt);
+      if (flag) {  /* a copy of the layout: translate the objects */
+        for (i = 0; i < t->sizearray; i++) {
+          if (iscollectable(&t->array[i]))
+            copyvalue(C, &nt->array[i], &t->array[i]);
+        }
+        for (i = 0; i < sizenode(t); i++) {
+          TValue *k = key2tval(gnode(nt, i));
+          if (ttisstring(k))  /* same hash: the node stays valid */
+            k->value.gc = obj2gco(copystr(C, rawtsvalue(k)));
+          if (iscollectable(gnval(t, i)))
+            copyvalue(C, gnval(nt, i), gnval(t, i));
+        }
+      }
+      else {  /* keys hashed by address: insert them again */
+        for (i = 0; i < t->sizearray; i++) {
+          if (!ttisnil(&t->array[i]))
+            copyvalue(C, luaH_setnum(L, nt, i + 1), &t->array[i]);
+        }
+        for (i = 0; i < sizenode(t); i++) {
+          if (!ttisnil(gnval(t, i))) {
+            TValue k;
+            copyvalue(C, &k, key2tval(gnode(t, i)));
+            copyvalue(C, luaH_set(L, nt, &k), gnval(t, i));
+          }
+        }
+      }
+      break;
+    }
+    case LUA_TFUNCTION: {
+      Closure *cl = gco2cl(o), *ncl = gco2cl(n);
+      if (cl->c.isC) {
+        ncl->c.env = copytable(C, cl->c.env);
+        for (i = 0; i < cl->c.nupvalues; i++)
+          copyvalue(C, &ncl->c.upvalue[i], &cl->c.upvalue[i]);
+      }
+      else {
+        ncl->l.env = copytable(C, cl->l.env);
+        for (i = 0; i < cl->l.nupvalues; i++)
+          ncl->l.upvals[i] = gco2uv(copyobj(C, obj2gco(cl->l.upvals[i])));
+      }
+      break;
+    }
+    case LUA_TUSERDATA: {
+      Udata *u = rawgco2u(o), *nu = rawgco2u(n);
+      Table *mt = u->uv.metatable;
+      nu->uv.metatable = copytable(C, mt);
+      nu->uv.env = copytable(C, u->uv.env);
+      if (mt != NULL && (u->uv.fin != NULL ||
+                         !ttisnil(luaH_getstr(mt, C->from->tmname[TM_GC])))) {
+        /* the copy shares what the original owns: not finalized (and
+           without the native finalizer) unless a `__clone' metamethod
+           makes it its own */
+        l_setbit(nu->uv.marked, FINALIZEDBIT);
+        if (!testbit(u->uv.marked, FINALIZEDBIT) &&
+            hasfield(mt, "__clone", sizeof("__clone") - 1))
+          setuvalue(L, luaH_setnum(L, C->hooks, ++C->nhooks), nu);
+      }
+      break;
+    }
+    case LUA_TUPVAL: {  /* an open upvalue gets its current value */
+      copyvalue(C, gco2uv(n)->v, gco2uv(o)->v);
+      break;
+    }
+    default: lua_assert(0);
+  }
+}
+
+
+static void f_clone (lua_State *L, void *ud) {
+  CloneState *C = cast(CloneState *, ud);
+  const global_State *from = C->from;
+  global_State *g = G(L);
+  GCObject *o;
+  int i, n = 0;
+  C->hooks = luaH_new(L, 0, 0);
+  sethvalue(L, L->top, C->hooks);  /* anchor it while hooks run */
+  incr_top(L);
+  for (o = from->rootgc; o != NULL; o = o->gch.next) n++;
+  C->map = luaH_new(L, 0, n);  /* no rehash while it fills */
+  C->todo = luaH_new(L, 2*n, 0);
+  if (g->strt.size < from->strt.size)
+    luaS_resize(L, from->strt.size);
+  sethvalue(L, gt(L), copytable(C, hvalue(gt(from->mainthread))));
+  sethvalue(L, registry(L), copytable(C, hvalue(&from->l_registry)));
+  for (i = 0; i < NUM_TAGS; i++)
+    g->mt[i] = copytable(C, from->mt[i]);
+  while (C->ntodo > 0) {
+    int flag = bvalue(luaH_getnum(C->todo, C->ntodo));
+    GCObject *o = cast(GCObject *, pvalue(luaH_getnum(C->todo, C->ntodo - 1)));
+    TValue key;
+    C->ntodo -= 2;
+    setpvalue(&key, o);
+    fillobj(C, o, gcvalue(luaH_get(C->map, &key)), flag);
+  }
+  for (i = 1; i <= C->nhooks; i++) {  /* now the clone may run code */
+    Udata *u = rawuvalue(luaH_getnum(C->hooks, i));
+    const TValue *tm = luaH_getstr(u->uv.metatable,
+                                   luaS_newliteral(L, "__clone"));
+    setobj2s(L, L->top, tm);
+    setuvalue(L, L->top + 1, u);
+    L->top += 2;
+    luaD_call(L, L->top - 2, 0);
+    resetbit(u->uv.marked, FINALIZEDBIT);  /* owns its resources now */
+  }
+  L->top--;
+}
+
+
+/*
+** a new state with a copy of everything `L' reaches from its globals,
+** registry and basic metatables, filled in bulk (tables keep their
+** layout). It uses the shared heap of `L', if any. Userdata are copied
+** byte by byte; a copy whose original has `__gc' is not finalized
+** unless its `__clone' metamethod, called with the copy, makes it own
+** its resources. Returns NULL if out of memory, if `L' reaches a
+** coroutine or if a `__clone' fails. `L' must not run meanwhile, but
+** several threads may clone it at once.
+*/
+LUA_API lua_State *lua_clonestate (lua_State *L, lua_Alloc f, void *ud) {
+  global_State *from = G(L);
+  lua_State *L1 = newstate(f, ud, from->shared, from);
+  global_State *g;
+  CloneState C;
+  if (L1 == NULL) return NULL;
+  g = G(L1);
+  g->panic = from->panic;
+  g->gcpause = from->gcpause;
+  g->gcstepmul = from->gcstepmul;
+  g->gcmajorinc = from->gcmajorinc;
+  g->gcmarkthreads = from->gcmarkthreads;
+  g->gcbudget = from->gcbudget;
+  g->gcgrowth = from->gcgrowth;
+  g->optimize = from->optimize;
+  C.from = from;
+  C.L = L1;
+  C.ntodo = C.nhooks = 0;
+  g->GCthreshold = MAX_LUMEM;  /* nothing to collect while copying */
+  lua_lock(L1);  /* `__clone' hooks run Lua code in it */
+  if (luaD_rawrunprotected(L1, f_clone, &C) != 0) {
+    lua_unlock(L1);
+    lua_close(L1);
+    return NULL;
+  }
+  g->estimate = g->totalbytes;
+  g->GCthreshold = (g->estimate/100) * g->gcpause;
+  if (from->gckind == KGC_GEN)
+    luaC_changemode(L1, KGC_GEN);
+  lua_unlock(L1);
+  return L1;
+}
+
+/* }====================================================== */
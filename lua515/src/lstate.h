@@ -9,6 +9,10 @@
 
 #include "lua.h"
 
+#if defined(LUA_USE_LOCK)
+#include <pthread.h>
+#endif
+
 #include "lobject.h"
 #include "ltm.h"
 #include "lzio.h"
@@ -39,9 +43,132 @@ typedef struct stringtable {
   GCObject **hash;
   lu_int32 nuse;  	/* number of elements 表中元素总数 */
   int size;			/* 哈希桶的高度 */
+  GCObject **oldhash;	/* buckets still to be migrated by a resize (or NULL) */
+  int oldsize;
+  int rehashpos;	/* first bucket of `oldhash' not yet migrated */
 } stringtable;
 
 
+/*
+** frozen strings and prototypes of a template state (see lua_freeze).
+** They are black and fixed and sit on the lists of no state, so no
+** collector marks, sweeps or frees them; attached states only read them.
+*/
+struct lua_Heap {
+  stringtable strt;  /* all strings of the template (no resize pending) */
+  GCObject *protos;  /* all shared prototypes, linked by `next' */
+  Proto **fn;  /* prototypes of the functions given to lua_freeze */
+  int nfn;
+  unsigned int seed;  /* hash mode of the strings */
+  lu_byte hashfull;
+  int nref;  /* attached states, plus the reference of the owner */
+  lu_mem totalbytes;  /* memory of the heap */
+  lua_Alloc frealloc;  /* allocator of the template */
+  void *ud;
+};
+
+
+/* entries of the inline cache that shared prototypes use (per state) */
+#define ICSHAREDSIZE	256
+
+
+/*
+** ring of stack samples of the sampling profiler (see lua_profsample)
+*/
+typedef struct ProfFrame {
+  Proto *p;  /* NULL for a C function */
+  int pc;
+} ProfFrame;
+
+typedef struct ProfSample {
+  int depth;  /* frames in use, innermost first */
+  ProfFrame f[LUAI_PROFDEPTH];
+} ProfSample;
+
+typedef struct Profile {
+  ProfSample *buf;
+  int size;  /* number of samples in `buf' (0: profiler off) */
+  int next;  /* slot for the next sample */
+  int n;  /* samples in the ring (at most `size') */
+} Profile;
+
+
+/*
+** sampled allocations of the heap profiler (see lmem.c): a site is a
+** stack, as in a ProfSample, plus the type of what was allocated there
+*/
+typedef struct HeapSite {
+  ProfSample stack;
+  int tt;  /* type of the objects (LUA_TNONE: vectors, stacks, buffers) */
+  size_t inuse, inusebytes;  /* sampled blocks still live */
+  size_t allocs, allocbytes;  /* all sampled blocks */
+} HeapSite;
+
+typedef struct HeapBlock {
+  void *block;  /* NULL: empty slot */
+  size_t size;
+  int site;
+} HeapBlock;
+
+typedef struct HeapProfile {
+  l_mem countdown;  /* bytes to allocate before the next sample */
+  size_t rate;  /* mean bytes between samples (0: profiler off) */
+  unsigned int seed;
+  HeapBlock *blocks;  /* live sampled blocks, by address */
+  int sizeblocks, nblocks;
+  HeapSite *sites;
+  int sizesites, nsites;
+  int *sitehash;  /* 1 + index of a site, by stack and type (0: empty) */
+  int sizesitehash;
+  void *pend;  /* block sampled but not yet given a type (see luaM_heaptag) */
+  size_t pendsize;
+  ProfSample pendstack;
+} HeapProfile;
+
+
+/*
+** an entry of a weak table that may be cleared: array index `i', or
+** node -1-i
+*/
+typedef struct WeakEntry {
+  struct Table *h;
+  int i;
+} WeakEntry;
+
+
+/*
+** clock of the collector: the phase being timed and since when
+*/
+typedef struct GCTimer {
+  double start;  /* beginning of the current pause */
+  double phasestart;
+  int phase;  /* LUA_GCP* phase being timed (-1: none) */
+  lu_byte state;  /* `gcstate' when the phase was last charged */
+  size_t allocmark, freemark;  /* counters at the start of the cycle */
+} GCTimer;
+
+
+/*
+** a block freed by a sweep step and left to the background sweeper
+*/
+typedef struct FreeBlock {
+  struct FreeBlock *next;
+  size_t size;
+  lua_Finalizer fin;  /* native finalizer of a userdata, run first */
+} FreeBlock;
+
+
+#if defined(LUA_USE_LOCK)
+/*
+** lock of a state shared by OS threads (see LUA_USE_LOCK)
+*/
+typedef struct StateLock {
+  pthread_mutex_t m;
+  volatile int waiters;  /* threads blocked in `luaE_lock' */
+} StateLock;
+#endif
+
+
 /*
 ** informations about a call
 ** 对照lstate.c的stack_init函数看
@@ -75,6 +202,12 @@ typedef struct CallInfo {
   */
   int nresults;  	
   int tailcalls;  	/* number of tail calls lost under this entry */
+  /* a Lua function waiting in OP_CALL on a pcall that the VM runs itself
+  ** (luaD_vmpcall): what the call saved, to be restored when it ends */
+  lu_byte pcall;
+  lu_byte pcallowhook;
+  unsigned short pcnCcalls;
+  ptrdiff_t pcerrfunc;
 } CallInfo;
 
 
@@ -93,24 +226,60 @@ typedef struct global_State {
   void *ud;         	/* auxiliary data to `frealloc' */
 
   stringtable strt;  	/* hash table for strings */
+  unsigned int seed;  	/* randomized seed for full-content hashes */
+  lu_byte hashfull;  	/* string hash mode is LUA_HASHFULL? */
+  lu_byte optimize;  	/* run luaK_optimize on new functions? */
+  Profile prof;  	/* samples of the sampling profiler */
+  HeapProfile heap;  	/* sites of the heap profiler */
+  struct lua_Heap *shared;  /* frozen objects used in place, or NULL */
+  ICache *icshared;  /* inline cache of the shared prototypes */
   
   lu_byte gcstate;  	/* state of garbage collector */
   lu_byte currentwhite;	/* atomic() 原子扫描完毕时，切换此值 */
+  lu_byte gckind;  		/* kind of collection: KGC_NORMAL or KGC_GEN */
   
   GCObject *rootgc;  	/* list of all collectable objects */
   GCObject *gray;  		/* list of gray objects */
   GCObject *grayagain;  /* list of objects to be traversed atomically */
-  GCObject *weak;  		/* list of weak tables (to be cleared)，propagate阶段处理的weak-table被放入此链表(gc过程中weak-attribute还可能发生变化的)，等待最后atomic处理， */
+  GCObject *ephemeron;  	/* list of tables with weak keys only */
+  GCObject *allweak;  	/* list of tables with weak keys and values */
+  WeakEntry *clearlog;  /* entries of weak tables to be cleared */
+  int nclearlog;
+  int sizeclearlog;
+  lu_byte logclears;  	/* 1: weak traversals log entries; 2: log overflowed */
+  lu_byte gcconverge;  	/* passes over ephemerons in this cycle */
+  GCObject *weak;  		/* list of weak-value tables (to be cleared)，propagate阶段处理的weak-table被放入此链表(gc过程中weak-attribute还可能发生变化的)，等待最后atomic处理， */
   GCObject *tmudata;  	/* last element of list of userdata to be GC */
   int 		sweepstrgc; /* position of sweep in `strt' */
   GCObject **sweepgc;  	/* position of sweep in `rootgc' */
   
   lu_mem totalbytes;  	/* number of bytes currently allocated */
   lu_mem GCthreshold;	/* 临界点（开始扫描的临界点？） */
+  lu_mem memlimit;  	/* allocations past it fail (MAX_LUMEM: no limit) */
+  lu_mem memnear;  	/* a step from here on is a full collection */
+  lu_mem memsoft;  	/* soft limit (MAX_LUMEM: none) */
+  lua_MemHook memsofthook;  /* called when the heap passes `memsoft'... */
+  void *memsoftud;
+  lu_byte memsoftarmed;  /* ...once, until it is below again */
   lu_mem estimate;  	/* an estimate(估计) of number of bytes actually in use */
   lu_mem gcdept; 		/* how much GC is `behind schedule' */
   int gcpause;  		/* size of pause between successive GCs */
   int gcstepmul;  		/* GC `granularity/步伐速度' */
+  int gcmajorinc;  		/* heap growth (%) that triggers a major collection */
+  lu_mem gcmajorbase;  	/* heap size after last major collection (0: do a major next) */
+  int gcmarkthreads;  	/* threads marking in full collections */
+  int gcbudget;  		/* time budget of a step (us; 0: no budget) */
+  int gcgrowth;  		/* heap growth (%) that overrides the budget */
+  struct Sweeper *sweeper;  /* thread freeing swept blocks (NULL: none) */
+  FreeBlock *deferred;  	/* blocks freed by the running sweep step... */
+  FreeBlock *deferredtail;  /* ...and the last of them */
+  lu_mem deferredbytes;
+  lu_byte deferfree;  	/* sweep step running with a sweeper */
+  lua_GCStats gcstats;
+  GCTimer gctimer;
+#if defined(LUAI_STATS)
+  lua_Stats stats;  	/* hot-path counters (lua_stats) */
+#endif
   
   lua_CFunction panic;  /* to be called in unprotected errors */
   
@@ -124,9 +293,23 @@ typedef struct global_State {
   TString 		*tmname[TM_N];  /* array with tag-method names */
   
   Mbuffer buff;  /* temporary buffer for string concatentation(级联) */
+
+  struct lua_State *freethreads;  /* dead coroutines kept for reuse, linked by `next' */
+  int nfreethreads;
+#if defined(LUA_USE_LOCK)
+  StateLock lock;
+#endif
 } global_State;
 
 
+/* adds `n' to counter `f' of lua_Stats (LUAI_STATS builds only) */
+#if defined(LUAI_STATS)
+#define luai_stat(L,f,n)	(G(L)->stats.f += (n))
+#else
+#define luai_stat(L,f,n)	((void)0)
+#endif
+
+
 /*
 ** `per thread' state
 */
@@ -182,6 +365,11 @@ struct lua_State {
   int basehookcount;	/* 参考debug.sethook,虚拟机执行N个pc后调用指定的钩子函数 */
   int hookcount;		/* 当前还需要执行N个pc才能触发上面提到的钩子函数 */
   lua_Hook hook;		/*  调试用的hook函数句柄, 参考 debug.sethook           */
+  /* instruction budget (lua_setbudget) */
+  int budget;		/* calls and backward jumps left in this round */
+  int basebudget;	/* length of a round (0: no budget) */
+  lua_Budget budgetf;
+  void *budgetud;
 };
 
 
@@ -222,6 +410,7 @@ union GCObject {
 
 LUAI_FUNC lua_State *luaE_newthread (lua_State *L);
 LUAI_FUNC void luaE_freethread (lua_State *L, lua_State *L1);
+LUAI_FUNC void luaE_freecache (lua_State *L);
 
 #endif
 
@@ -12,38 +12,64 @@
 
 #include "lua.h"
 
+#include "lgc.h"
 #include "lmem.h"
 #include "lobject.h"
 #include "lstate.h"
 #include "lstring.h"
+#include "ltable.h"
 
 
-/* 闭散列（拉链法，哈希桶  )          https://blog.csdn.net/Boring_Wednesday/article/details/80316884 */
+/*
+** 闭散列（拉链法，哈希桶  )          https://blog.csdn.net/Boring_Wednesday/article/details/80316884
+** The new bucket array replaces the old one at once, but the strings
+** are moved incrementally (see `luaS_rehash'); meanwhile lookups must
+** check both arrays.
+*/
 void luaS_resize (lua_State *L, int newsize) {
   GCObject **newhash;
   stringtable *tb;
   int i;
   if (G(L)->gcstate == GCSsweepstring)
     return;  /* cannot resize during GC traverse */
-  newhash = luaM_newvector(L, newsize, GCObject *);
   tb = &G(L)->strt;
+  if (tb->oldhash != NULL)  /* previous resize still pending? */
+    luaS_rehash(L, tb->oldsize);  /* finish it */
+  newhash = luaM_newvector(L, newsize, GCObject *);
   for (i=0; i<newsize; i++) newhash[i] = NULL;
-  /* rehash */
-  for (i=0; i<tb->size; i++) {
-    GCObject *p = tb->hash[i];
+  if (tb->size > 0) {
+    tb->oldhash = tb->hash;
+    tb->oldsize = tb->size;
+    tb->rehashpos = 0;
+  }
+  tb->size = newsize;
+  tb->hash = newhash;
+}
+
+
+/* move at most `n' buckets of a pending resize into the new array */
+void luaS_rehash (lua_State *L, int n) {
+  stringtable *tb = &G(L)->strt;
+  if (tb->oldhash == NULL || G(L)->gcstate == GCSsweepstring)
+    return;  /* nothing to do (or cannot move strings now) */
+  while (n-- > 0 && tb->rehashpos < tb->oldsize) {
+    GCObject *p = tb->oldhash[tb->rehashpos];
+    tb->oldhash[tb->rehashpos++] = NULL;
     while (p) {  /* for each node in the list */
       GCObject *next = p->gch.next;  /* save next */
       unsigned int h = gco2ts(p)->hash;
-      int h1 = lmod(h, newsize);  /* new position */
-      lua_assert(cast_int(h%newsize) == lmod(h, newsize));
-      p->gch.next = newhash[h1];  /* chain it */
-      newhash[h1] = p;
+      int h1 = lmod(h, tb->size);  /* new position */
+      lua_assert(cast_int(h%tb->size) == lmod(h, tb->size));
+      p->gch.next = tb->hash[h1];  /* chain it */
+      tb->hash[h1] = p;
       p = next;
     }
   }
-  luaM_freearray(L, tb->hash, tb->size, TString *);
-  tb->size = newsize;
-  tb->hash = newhash;
+  if (tb->rehashpos >= tb->oldsize) {  /* all buckets moved? */
+    luaM_freearray(L, tb->oldhash, tb->oldsize, TString *);
+    tb->oldhash = NULL;
+    tb->oldsize = 0;
+  }
 }
 
 /* 不像lua5.3,此版本不区分长/短字符串 
@@ -57,6 +83,7 @@ static TString *newlstr (lua_State *L, const char *str, size_t l,
   if (l+1 > (MAX_SIZET - sizeof(TString))/sizeof(char))	/* 太长了，亲 */
     luaM_toobig(L);
   ts = cast(TString *, luaM_malloc(L, (l+1)*sizeof(char)+sizeof(TString)));
+  luaM_heaptag(L, ts, LUA_TSTRING);
   ts->tsv.len = l;
   ts->tsv.hash = h;
   ts->tsv.marked = luaC_white(G(L));
@@ -73,29 +100,146 @@ static TString *newlstr (lua_State *L, const char *str, size_t l,
   /* 这里装载因子为1 */
   if (tb->nuse > cast(lu_int32, tb->size) && tb->size <= MAX_INT/2)
     luaS_resize(L, tb->size*2);  /* too crowded(拥挤) */
+  else
+    luaS_rehash(L, STRREHASHSTEP);  /* move along a pending resize */
   return ts;
 }
 
 
+static GCObject *findstr (GCObject *o, const char *str, size_t l) {
+  for (; o != NULL; o = o->gch.next) {
+    TString *ts = rawgco2ts(o);
+    if (ts->tsv.len == l && (memcmp(str, getstr(ts), l) == 0))
+      return o;
+  }
+  return NULL;
+}
+
+
+/*
+** {======================================================
+** Full-content hash: four independent 32-bit lanes over 16-byte blocks
+** (so compilers can vectorize the main loop), followed by the usual
+** byte-wise step for the tail and a final avalanche
+** =======================================================
+*/
+
+#define HPRIME1		0x9E3779B1u
+#define HPRIME2		0x85EBCA77u
+#define HPRIME3		0xC2B2AE3Du
+
+#define rotl32(x,n)	(((x) << (n)) | ((x) >> (32 - (n))))
+
+#define hround(acc,p) \
+  { lu_int32 k_; memcpy(&k_, (p), sizeof(k_)); \
+    acc += k_ * HPRIME2; acc = rotl32(acc, 13); acc *= HPRIME1; }
+
+
+unsigned int luaS_hash (const char *str, size_t l, unsigned int seed) {
+  lu_int32 h = cast(lu_int32, seed) ^ cast(lu_int32, l);
+  if (l >= 16) {
+    lu_int32 a = h + HPRIME1 + HPRIME2;
+    lu_int32 b = h + HPRIME2;
+    lu_int32 c = h;
+    lu_int32 d = h - HPRIME1;
+    for (; l >= 16; str += 16, l -= 16) {
+      hround(a, str);
+      hround(b, str + 4);
+      hround(c, str + 8);
+      hround(d, str + 12);
+    }
+    h = rotl32(a, 1) + rotl32(b, 7) + rotl32(c, 12) + rotl32(d, 18);
+  }
+  for (; l > 0; str++, l--)  /* tail */
+    h = h ^ ((h<<5)+(h>>2)+cast(unsigned char, *str));
+  h ^= h >> 15;
+  h *= HPRIME2;
+  h ^= h >> 13;
+  h *= HPRIME3;
+  h ^= h >> 16;
+  return cast(unsigned int, h);
+}
+
+
+static unsigned int strhash (global_State *g, const char *str, size_t l) {
+  if (g->hashfull)
+    return luaS_hash(str, l, g->seed);
+  else {
+    unsigned int h = cast(unsigned int, l);  /* seed */
+    size_t step = (l>>5)+1;  /* if string is too long, don't hash all its chars, save cpu cycle */
+    size_t l1;
+    /* hash完全独立于str自身 */
+    for (l1=l; l1>=step; l1-=step)  /* compute hash */
+      h = h ^ ((h<<5)+(h>>2)+cast(unsigned char, str[l1-1]));
+    return h;
+  }
+}
+
+
+/*
+** change the hash mode of the state: every string gets a new hash, so
+** the string table and all tables must be rehashed. The collection
+** first frees all dead objects, whose keys may point to freed strings.
+** A state attached to a shared heap keeps the mode of the heap.
+*/
+void luaS_sethashmode (lua_State *L, int full) {
+  global_State *g = G(L);
+  stringtable *tb = &g->strt;
+  GCObject **newhash;
+  GCObject *o;
+  int i;
+  if (g->hashfull == full || g->shared != NULL) return;
+  luaC_fullgc(L);
+  luaS_rehash(L, tb->oldsize);  /* finish a pending resize */
+  newhash = luaM_newvector(L, tb->size, GCObject *);
+  for (i=0; i<tb->size; i++) newhash[i] = NULL;
+  g->hashfull = cast_byte(full);
+  for (i=0; i<tb->size; i++) {
+    GCObject *p = tb->hash[i];
+    while (p) {
+      GCObject *next = p->gch.next;
+      TString *ts = rawgco2ts(p);
+      int h1;
+      ts->tsv.hash = strhash(g, getstr(ts), ts->tsv.len);
+      h1 = lmod(ts->tsv.hash, tb->size);
+      p->gch.next = newhash[h1];
+      newhash[h1] = p;
+      p = next;
+    }
+  }
+  luaM_freearray(L, tb->hash, tb->size, TString *);
+  tb->hash = newhash;
+  for (o = g->rootgc; o != NULL; o = o->gch.next) {
+    if (o->gch.tt == LUA_TTABLE)  /* reinsert all keys */
+      luaH_resizearray(L, gco2h(o), gco2h(o)->sizearray);
+  }
+}
+
+/* }====================================================== */
+
+
 TString *luaS_newlstr (lua_State *L, const char *str, size_t l) {
   GCObject *o;
-  unsigned int h = cast(unsigned int, l);  /* seed */
-  size_t step = (l>>5)+1;  /* if string is too long, don't hash all its chars, save cpu cycle */
-  size_t l1;
-  /* hash完全独立于str自身 */
-  for (l1=l; l1>=step; l1-=step)  /* compute hash */
-    h = h ^ ((h<<5)+(h>>2)+cast(unsigned char, str[l1-1]));
-  for (o = G(L)->strt.hash[lmod(h, G(L)->strt.size)];	/* luaS_resize()已在此函数前被调用(f_luaopen()中)否则size==0，segamentFault  */
-       o != NULL;
-       o = o->gch.next) {
-    TString *ts = rawgco2ts(o);
-    if (ts->tsv.len == l && (memcmp(str, getstr(ts), l) == 0)) {
-      /* string may be dead */
-      if (isdead(G(L), o)) 	/* 能复用则复用，避免了重复构造 */
-	  	changewhite(o);	
-      return ts;
+  unsigned int h = strhash(G(L), str, l);
+  if (G(L)->shared != NULL) {  /* frozen strings first: never dead */
+    stringtable *st = &G(L)->shared->strt;
+    o = findstr(st->hash[lmod(h, st->size)], str, l);
+    if (o != NULL) {
+      luai_stat(L, strhits, 1);
+      return rawgco2ts(o);
     }
   }
+  o = findstr(G(L)->strt.hash[lmod(h, G(L)->strt.size)], str, l);	/* luaS_resize()已在此函数前被调用(f_luaopen()中)否则size==0，segamentFault  */
+  if (o == NULL && G(L)->strt.oldhash != NULL)  /* resize pending? */
+    o = findstr(G(L)->strt.oldhash[lmod(h, G(L)->strt.oldsize)], str, l);
+  if (o != NULL) {
+    /* string may be dead */
+    if (isdead(G(L), o)) 	/* 能复用则复用，避免了重复构造 */
+      changewhite(o);	
+    luai_stat(L, strhits, 1);
+    return rawgco2ts(o);
+  }
+  luai_stat(L, strmisses, 1);
   return newlstr(L, str, l, h);  /* not found */
 }
 
@@ -105,11 +249,15 @@ Udata *luaS_newudata (lua_State *L, size_t s, Table *e) {
   if (s > MAX_SIZET - sizeof(Udata))	/* 尺寸过大 */
     luaM_toobig(L);
   u = cast(Udata *, luaM_malloc(L, sizeof(Udata) + s));
+  luaM_heaptag(L, u, LUA_TUSERDATA);
   u->uv.marked = luaC_white(G(L));  /* is not finalized */
   u->uv.tt = LUA_TUSERDATA;
   u->uv.len = s;
   u->uv.metatable = NULL;	/* 初始时meta为空 */
   u->uv.env = e;	/* 暂不知用处 */
+  u->uv.fin = NULL;
+  u->uv.finsafe = 0;
+  u->uv.akind = 0;
   /* chain it on udata list (after main thread) */
   u->uv.next = G(L)->mainthread->next;
   G(L)->mainthread->next = obj2gco(u);	/* 将udata挂在了mainthread的后面,mainthread同时也在rootgc链表上，所以udata也还是在rootgc上 */
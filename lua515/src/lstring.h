@@ -22,9 +22,13 @@
 #define luaS_newliteral(L, s)	(luaS_newlstr(L, "" s, \
                                  (sizeof(s)/sizeof(char))-1))
 /* fix:固定，打上fix的gc标签 */
-#define luaS_fix(s)	l_setbit((s)->tsv.marked, FIXEDBIT)
+#define luaS_fix(s)	{ if (!testbit((s)->tsv.marked, FIXEDBIT)) \
+			    l_setbit((s)->tsv.marked, FIXEDBIT); }
 /* 调整哈希桶的高 */
 LUAI_FUNC void luaS_resize (lua_State *L, int newsize);
+LUAI_FUNC void luaS_rehash (lua_State *L, int n);
+LUAI_FUNC unsigned int luaS_hash (const char *str, size_t l, unsigned int seed);
+LUAI_FUNC void luaS_sethashmode (lua_State *L, int full);
 LUAI_FUNC Udata *luaS_newudata (lua_State *L, size_t s, Table *e);
 LUAI_FUNC TString *luaS_newlstr (lua_State *L, const char *str, size_t l);
 
@@ -6,6 +6,7 @@
 
 
 #include <ctype.h>
+#include <limits.h>
 #include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -24,10 +25,254 @@
 #define uchar(c)        ((unsigned char)(c))
 
 
+/*
+** {======================================================
+** String slices: a userdata pointing into a parent string, which is
+** kept alive as entry 1 of the userdata's environment (slices of a
+** slice share that table). The functions below take a slice wherever
+** they take a subject string, and a slice subject gives slices instead
+** of new strings for `sub' and the captures of `find', `match' and
+** `gmatch'. Slices are not strings for the rest of Lua: `tostring'
+** interns one, e.g. to use it as a table key.
+** =======================================================
+*/
+
+#define SLICE		LUAL_SLICE
+
+typedef luaL_Slice Slice;
+
+#define toslice		luaL_toslice
+#define pushslice	luaL_pushslice
+
+
+/* subject of a string function: a string (or number) or a slice */
+static const char *checkstr (lua_State *L, int arg, size_t *l) {
+  Slice *sl = toslice(L, arg);
+  if (sl == NULL)
+    return luaL_checklstring(L, arg, l);
+  *l = sl->l;
+  return sl->s;
+}
+
+
+/* patterns and formats must end in a '\0': intern a slice in place */
+static const char *checkzstr (lua_State *L, int arg, size_t *l) {
+  Slice *sl = toslice(L, arg);
+  if (sl != NULL) {
+    lua_pushlstring(L, sl->s, sl->l);
+    lua_replace(L, arg);
+  }
+  return luaL_checklstring(L, arg, l);
+}
+
+
+
+static int slice_tostring (lua_State *L) {
+  Slice *sl = (Slice *)luaL_checkudata(L, 1, SLICE);
+  lua_pushlstring(L, sl->s, sl->l);
+  return 1;
+}
+
+
+static int slice_len (lua_State *L) {
+  Slice *sl = (Slice *)luaL_checkudata(L, 1, SLICE);
+  lua_pushinteger(L, sl->l);
+  return 1;
+}
+
+
+/* byte order (not the locale order of `<' on strings) */
+static int slice_cmp (lua_State *L) {
+  Slice *a = (Slice *)luaL_checkudata(L, 1, SLICE);
+  Slice *b = (Slice *)luaL_checkudata(L, 2, SLICE);
+  int r = memcmp(a->s, b->s, (a->l < b->l) ? a->l : b->l);
+  if (r != 0) return r;
+  return (a->l < b->l) ? -1 : (a->l > b->l);
+}
+
+
+static int slice_eq (lua_State *L) {
+  lua_pushboolean(L, slice_cmp(L) == 0);
+  return 1;
+}
+
+
+static int slice_lt (lua_State *L) {
+  lua_pushboolean(L, slice_cmp(L) < 0);
+  return 1;
+}
+
+
+static int slice_le (lua_State *L) {
+  lua_pushboolean(L, slice_cmp(L) <= 0);
+  return 1;
+}
+
+
+static int slice_concat (lua_State *L) {
+  size_t l1, l2;
+  const char *s1 = checkstr(L, 1, &l1);
+  const char *s2 = checkstr(L, 2, &l2);
+  luaL_Buffer b;
+  luaL_buffinit(L, &b);
+  luaL_addlstring(&b, s1, l1);
+  luaL_addlstring(&b, s2, l2);
+  luaL_pushresult(&b);
+  return 1;
+}
+
+
+static const luaL_Reg slicemeta[] = {
+  {"__concat", slice_concat},
+  {"__eq", slice_eq},
+  {"__le", slice_le},
+  {"__len", slice_len},
+  {"__lt", slice_lt},
+  {"__tostring", slice_tostring},
+  {NULL, NULL}
+};
+
+/* }====================================================== */
+
+
+/*
+** {======================================================
+** String buffers: a growable block, taken from the state's allocator,
+** that `append' fills in place (no intermediate strings, unlike
+** `s = s .. x' in a loop); `reset' empties it but keeps the block.
+** =======================================================
+*/
+
+#define STRBUFFER	"STRBUFFER"
+
+typedef struct StrBuffer {
+  char *b;
+  size_t n;  /* bytes in use */
+  size_t size;  /* size of `b' */
+} StrBuffer;
+
+
+#define checkbuffer(L)	((StrBuffer *)luaL_checkudata(L, 1, STRBUFFER))
+
+
+/* make room for `need' more bytes */
+static void growbuffer (lua_State *L, StrBuffer *sb, size_t need) {
+  void *ud;
+  lua_Alloc f = lua_getallocf(L, &ud);
+  size_t size = (sb->size > 0) ? sb->size : LUAL_BUFFERSIZE;
+  char *nb;
+  if (need > (((size_t)~0) >> 1) - sb->n)
+    luaL_error(L, "buffer too large");
+  while (size - sb->n < need)
+    size *= 2;
+  nb = (char *)(*f)(ud, sb->b, sb->size, size);
+  if (nb == NULL)
+    luaL_error(L, "not enough memory");
+  sb->b = nb;
+  sb->size = size;
+}
+
+
+/* string.buffer ([size]) */
+static int buf_new (lua_State *L) {
+  lua_Integer size = luaL_optinteger(L, 1, 0);
+  StrBuffer *sb;
+  luaL_argcheck(L, size >= 0, 1, "size must be non-negative");
+  sb = (StrBuffer *)lua_newuserdata(L, sizeof(StrBuffer));
+  sb->b = NULL;
+  sb->n = sb->size = 0;
+  luaL_getmetatable(L, STRBUFFER);
+  lua_setmetatable(L, -2);
+  if (size > 0) growbuffer(L, sb, (size_t)size);
+  return 1;
+}
+
+
+/* buf:append (...) -> buf */
+static int buf_append (lua_State *L) {
+  StrBuffer *sb = checkbuffer(L);
+  int i, top = lua_gettop(L);
+  for (i = 2; i <= top; i++) {
+    size_t l;
+    const char *s = checkstr(L, i, &l);
+    if (sb->size - sb->n < l)
+      growbuffer(L, sb, l);
+    memcpy(sb->b + sb->n, s, l);
+    sb->n += l;
+  }
+  lua_settop(L, 1);
+  return 1;
+}
+
+
+static int buf_tostring (lua_State *L) {
+  StrBuffer *sb = checkbuffer(L);
+  lua_pushlstring(L, (sb->b != NULL) ? sb->b : "", sb->n);
+  return 1;
+}
+
+
+/* buf:reset () -> buf */
+static int buf_reset (lua_State *L) {
+  StrBuffer *sb = checkbuffer(L);
+  sb->n = 0;
+  lua_settop(L, 1);
+  return 1;
+}
+
+
+static int buf_len (lua_State *L) {
+  lua_pushinteger(L, checkbuffer(L)->n);
+  return 1;
+}
+
+
+static int buf_gc (lua_State *L) {
+  StrBuffer *sb = checkbuffer(L);
+  void *ud;
+  lua_Alloc f = lua_getallocf(L, &ud);
+  (*f)(ud, sb->b, sb->size, 0);
+  sb->b = NULL;
+  sb->n = sb->size = 0;
+  return 0;
+}
+
+
+/* __clone (see lua_clonestate): the copy gets bytes of its own */
+static int buf_clone (lua_State *L) {
+  StrBuffer *sb = checkbuffer(L);
+  const char *b = sb->b;
+  size_t n = sb->n;
+  sb->b = NULL;  /* the old bytes belong to the original */
+  sb->n = sb->size = 0;
+  if (n > 0) {
+    growbuffer(L, sb, n);
+    memcpy(sb->b, b, n);
+    sb->n = n;
+  }
+  return 0;
+}
+
+
+static const luaL_Reg bufmeta[] = {
+  {"__clone", buf_clone},
+  {"__gc", buf_gc},
+  {"__len", buf_len},
+  {"__tostring", buf_tostring},
+  {"append", buf_append},
+  {"len", buf_len},
+  {"reset", buf_reset},
+  {"tostring", buf_tostring},
+  {NULL, NULL}
+};
+
+/* }====================================================== */
+
+
 /* define string.len */
 static int str_len (lua_State *L) {
   size_t l;
-  luaL_checklstring(L, 1, &l);
+  checkstr(L, 1, &l);
   lua_pushinteger(L, l);
   return 1;
 }
@@ -39,17 +284,37 @@ static ptrdiff_t posrelat (ptrdiff_t pos, size_t len) {
   return (pos >= 0) ? pos : 0;
 }
 
-/* string.sub 生成子字符串top-1=sub, top++ */
-static int str_sub (lua_State *L) {
-  size_t l;
-  const char *s = luaL_checklstring(L, 1, &l);
-  ptrdiff_t start = posrelat(luaL_checkinteger(L, 2), l);
-  ptrdiff_t end = posrelat(luaL_optinteger(L, 3, -1), l);
+/* push s[start..end] of the subject at index 1, as a slice if `slice' */
+static void pushsub (lua_State *L, const char *s, size_t l,
+                     ptrdiff_t start, ptrdiff_t end, int slice) {
+  start = posrelat(start, l);
+  end = posrelat(end, l);
   if (start < 1) start = 1;
   if (end > (ptrdiff_t)l) end = (ptrdiff_t)l;
-  if (start <= end)
+  if (start > end)  /* empty? */
+    start = end + 1;
+  if (slice)
+    pushslice(L, 1, s+start-1, end-start+1);
+  else
     lua_pushlstring(L, s+start-1, end-start+1);
-  else lua_pushliteral(L, "");
+}
+
+
+/* string.sub 生成子字符串top-1=sub, top++ */
+static int str_sub (lua_State *L) {
+  size_t l;
+  const char *s = checkstr(L, 1, &l);
+  pushsub(L, s, l, luaL_checkinteger(L, 2), luaL_optinteger(L, 3, -1),
+          toslice(L, 1) != NULL);
+  return 1;
+}
+
+
+/* string.slice (s [, i [, j]]) */
+static int str_slice (lua_State *L) {
+  size_t l;
+  const char *s = checkstr(L, 1, &l);
+  pushsub(L, s, l, luaL_optinteger(L, 2, 1), luaL_optinteger(L, 3, -1), 1);
   return 1;
 }
 
@@ -57,7 +322,7 @@ static int str_sub (lua_State *L) {
 static int str_reverse (lua_State *L) {
   size_t l;
   luaL_Buffer b;
-  const char *s = luaL_checklstring(L, 1, &l);
+  const char *s = checkstr(L, 1, &l);
   luaL_buffinit(L, &b);
   /* 反向读入数据，将其存到站或buf中 */
   while (l--) luaL_addchar(&b, s[l]);
@@ -71,7 +336,7 @@ static int str_lower (lua_State *L) {
   size_t l;
   size_t i;
   luaL_Buffer b;
-  const char *s = luaL_checklstring(L, 1, &l);
+  const char *s = checkstr(L, 1, &l);
   luaL_buffinit(L, &b);
   for (i=0; i<l; i++)
     luaL_addchar(&b, tolower(uchar(s[i])));
@@ -84,7 +349,7 @@ static int str_upper (lua_State *L) {
   size_t l;
   size_t i;
   luaL_Buffer b;
-  const char *s = luaL_checklstring(L, 1, &l);
+  const char *s = checkstr(L, 1, &l);
   luaL_buffinit(L, &b);
   for (i=0; i<l; i++)
     luaL_addchar(&b, toupper(uchar(s[i])));
@@ -95,8 +360,21 @@ static int str_upper (lua_State *L) {
 static int str_rep (lua_State *L) {
   size_t l;
   luaL_Buffer b;
-  const char *s = luaL_checklstring(L, 1, &l);
+  const char *s = checkstr(L, 1, &l);
   int n = luaL_checkint(L, 2);
+  if (n > 0 && l > 0 && l * n > LUAL_BUFFERSIZE) {  /* long result? */
+    size_t total, done;
+    char *p;
+    if ((size_t)n > ((size_t)~0 >> 1) / l)
+      return luaL_error(L, "resulting string too large");
+    total = l * n;
+    p = (char *)lua_newuserdata(L, total);
+    memcpy(p, s, l);
+    for (done = l; done < total; done *= 2)  /* double the copied part */
+      memcpy(p + done, p, (done <= total - done) ? done : total - done);
+    lua_pushlstring(L, p, total);
+    return 1;
+  }
   luaL_buffinit(L, &b);
   while (n-- > 0)
     luaL_addlstring(&b, s, l);
@@ -107,7 +385,7 @@ static int str_rep (lua_State *L) {
 
 static int str_byte (lua_State *L) {
   size_t l;
-  const char *s = luaL_checklstring(L, 1, &l);
+  const char *s = checkstr(L, 1, &l);
   ptrdiff_t posi = posrelat(luaL_optinteger(L, 2, 1), l);
   ptrdiff_t pose = posrelat(luaL_optinteger(L, 3, posi), l);
   int n, i;
@@ -169,10 +447,45 @@ static int str_dump (lua_State *L) {
 #define CAP_UNFINISHED	(-1)
 #define CAP_POSITION	(-2)
 
+
+/*
+** compiled pattern (see getpattern): the literal prefix to scan for and
+** the 256-bit sets of the `[...]' and `%x' items, found by the offset
+** of the item in the pattern
+*/
+typedef struct CSet {
+  unsigned short end;  /* offset of the end of the item (see classend) */
+  short stop;  /* the only byte not in the set, CS_FULL if none, or -1 */
+  unsigned char bits[(UCHAR_MAX + 1) / CHAR_BIT];
+} CSet;
+
+#define CS_FULL		(UCHAR_MAX + 1)
+
+typedef struct CPattern {
+  int used;  /* used since the last eviction scan? */
+  size_t npre;  /* length of the literal prefix (0 if anchored) */
+  int nset;
+  /* followed by `CSet sets[nset]' and `unsigned char item[len + 1]':
+     1 + the index in `sets' of the item at each offset, or 0 */
+} CPattern;
+
+#define cpsets(cp)	((CSet *)((cp) + 1))
+#define cpitem(cp)	((unsigned char *)(cpsets(cp) + (cp)->nset))
+
+#define testset(cs,c)	((cs)->bits[uchar(c) / CHAR_BIT] & \
+                         (1 << (uchar(c) % CHAR_BIT)))
+
+/* longest pattern that is compiled */
+#define MAXCPAT		255
+
+
 typedef struct MatchState {
   const char *src_init;  /* init of source string */
   const char *src_end;  /* end (`\0') of source string */
+  const char *p_init;  /* pattern `cp' was compiled from */
+  const CPattern *cp;  /* (or NULL) */
   lua_State *L;
+  int parent;  /* index of the subject if captures are slices, or 0 */
   int level;  /* total number of captures (finished or unfinished) */
   struct {
     const char *init;
@@ -277,6 +590,19 @@ static int singlematch (int c, const char *p, const char *ep) {
 }
 
 
+/* precomputed set of the item at `p', or NULL */
+static const CSet *getcset (MatchState *ms, const char *p) {
+  int i;
+  if (ms->cp == NULL) return NULL;
+  i = cpitem(ms->cp)[p - ms->p_init];
+  return (i != 0) ? &cpsets(ms->cp)[i - 1] : NULL;
+}
+
+
+#define itemmatch(cs,c,p,ep) \
+	((cs) ? testset(cs, c) != 0 : singlematch(uchar(c), p, ep))
+
+
 static const char *match (MatchState *ms, const char *s, const char *p);
 
 
@@ -303,8 +629,17 @@ static const char *matchbalance (MatchState *ms, const char *s,
 static const char *max_expand (MatchState *ms, const char *s,
                                  const char *p, const char *ep) {
   ptrdiff_t i = 0;  /* counts maximum expand for item */
-  while ((s+i)<ms->src_end && singlematch(uchar(*(s+i)), p, ep))
-    i++;
+  const CSet *cs = getcset(ms, p);
+  if (cs && cs->stop == CS_FULL)  /* `.*' and the like */
+    i = ms->src_end - s;
+  else if (cs && cs->stop >= 0) {  /* [^c]*: the run ends at the next `c' */
+    const char *e = (const char *)memchr(s, cs->stop, ms->src_end - s);
+    i = ((e != NULL) ? e : ms->src_end) - s;
+  }
+  else {
+    while ((s+i)<ms->src_end && itemmatch(cs, *(s+i), p, ep))
+      i++;
+  }
   /* keeps trying to match with the maximum repetitions */
   while (i>=0) {
     const char *res = match(ms, (s+i), ep+1);
@@ -317,11 +652,12 @@ static const char *max_expand (MatchState *ms, const char *s,
 
 static const char *min_expand (MatchState *ms, const char *s,
                                  const char *p, const char *ep) {
+  const CSet *cs = getcset(ms, p);
   for (;;) {
     const char *res = match(ms, s, ep+1);
     if (res != NULL)
       return res;
-    else if (s<ms->src_end && singlematch(uchar(*s), p, ep))
+    else if (s<ms->src_end && itemmatch(cs, *s, p, ep))
       s++;  /* try with one more repetition */
     else return NULL;
   }
@@ -392,7 +728,8 @@ static const char *match (MatchState *ms, const char *s, const char *p) {
           ep = classend(ms, p);  /* points to what is next */
           previous = (s == ms->src_init) ? '\0' : *(s-1);
           if (matchbracketclass(uchar(previous), p, ep-1) ||
-             !matchbracketclass(uchar(*s), p, ep-1)) return NULL;
+             !matchbracketclass((s < ms->src_end) ? uchar(*s) : '\0',
+                                p, ep-1)) return NULL;  /* (a slice has no '\0') */
           p=ep; goto init;  /* else return match(ms, s, ep); */
         }
         default: {
@@ -414,8 +751,10 @@ static const char *match (MatchState *ms, const char *s, const char *p) {
       else goto dflt;
     }
     default: dflt: {  /* it is a pattern item */
-      const char *ep = classend(ms, p);  /* points to what is next */
-      int m = s<ms->src_end && singlematch(uchar(*s), p, ep);
+      const CSet *cs = getcset(ms, p);
+      const char *ep = cs ? ms->p_init + cs->end
+                          : classend(ms, p);  /* points to what is next */
+      int m = s<ms->src_end && itemmatch(cs, *s, p, ep);
       switch (*ep) {
         case '?': {  /* optional */
           const char *res;
@@ -443,33 +782,240 @@ static const char *match (MatchState *ms, const char *s, const char *p) {
 
 
 
+/*
+** {======================================================
+** Compiled patterns, cached by pattern string in the table that is
+** upvalue 1 of the library functions (and LUA_PATCACHE in the registry).
+** The cache holds at most LUA_PATCACHESIZE patterns; when full, a clock
+** scan drops one not used since the previous scan. Sets of `%x' items
+** depend on the locale, so os.setlocale empties the cache.
+** =======================================================
+*/
+
+/* like `classend', but NULL for a malformed item (left to `match') */
+static const char *cclassend (const char *p) {
+  switch (*p++) {
+    case L_ESC: return (*p == '\0') ? NULL : p+1;
+    case '[': {
+      if (*p == '^') p++;
+      do {  /* look for a `]' */
+        if (*p == '\0') return NULL;
+        if (*(p++) == L_ESC && *p != '\0') p++;
+      } while (*p != ']');
+      return p+1;
+    }
+    default: return p;
+  }
+}
+
+
+/*
+** walk the items of `pat' as `match' does and count the sets (fill them
+** too when `cp' is not NULL). A set is only used where `match' finds an
+** item at the same offset, so stopping early is always safe.
+*/
+static int compilesets (const char *pat, CPattern *cp) {
+  const char *p = pat;
+  int n = 0;
+  if (*p == '^') p++;
+  while (*p != '\0') {
+    const char *ep;
+    if (*p == '(' || *p == ')') { p++; continue; }
+    if (*p == L_ESC) {
+      if (p[1] == 'b') {  /* %bxy */
+        if (p[2] == '\0' || p[3] == '\0') break;
+        p += 4; continue;
+      }
+      if (p[1] == 'f') {  /* %f[set]: no repetition follows */
+        if ((ep = cclassend(p + 2)) == NULL) break;
+        p = ep; continue;
+      }
+      if (isdigit(uchar(p[1]))) { p += 2; continue; }
+    }
+    if ((ep = cclassend(p)) == NULL) break;
+    if (*p == '[' || *p == L_ESC || *p == '.') {
+      if (cp) {
+        CSet *cs = &cpsets(cp)[n];
+        int c, nout = 0;
+        cs->end = (unsigned short)(ep - pat);
+        cs->stop = CS_FULL;
+        memset(cs->bits, 0, sizeof(cs->bits));
+        for (c = 0; c <= UCHAR_MAX; c++) {
+          if (singlematch(c, p, ep))
+            cs->bits[c / CHAR_BIT] |= 1 << (c % CHAR_BIT);
+          else
+            cs->stop = (nout++ == 0) ? (short)c : -1;
+        }
+        cpitem(cp)[p - pat] = (unsigned char)(n + 1);
+      }
+      n++;
+    }
+    p = ep;
+    if (*p == '*' || *p == '+' || *p == '-' || *p == '?') p++;
+  }
+  return n;
+}
+
+
+/* length of the run of plain characters that starts every match */
+static size_t literalprefix (const char *p) {
+  size_t n = 0;
+  if (*p == '^') return 0;  /* anchored: nothing to scan for */
+  while (p[n] != '\0' && strchr(SPECIALS ")", p[n]) == NULL &&
+         (p[n+1] == '\0' || strchr("*+-?", p[n+1]) == NULL))
+    n++;
+  return n;
+}
+
+
+/* make room in the cache at index `cache' */
+static void evictpattern (lua_State *L, int cache) {
+  int pass;
+  for (pass = 0; pass < 2; pass++) {  /* (all may be used in the 1st pass) */
+    lua_pushnil(L);
+    while (lua_next(L, cache)) {
+      CPattern *cp = (CPattern *)lua_touserdata(L, -1);
+      lua_pop(L, 1);  /* keep the key */
+      if (cp == NULL) continue;  /* the count */
+      if (!cp->used) {
+        lua_pushnil(L);
+        lua_rawset(L, cache);
+        return;
+      }
+      cp->used = 0;
+    }
+  }
+}
+
+
+static CPattern *compilepattern (lua_State *L, int arg, const char *p,
+                                 size_t l) {
+  int cache = lua_upvalueindex(1);
+  int n, nset = compilesets(p, NULL);
+  CPattern *cp;
+  lua_rawgeti(L, cache, 1);
+  n = lua_tointeger(L, -1);
+  lua_pop(L, 1);
+  if (n >= LUA_PATCACHESIZE) {
+    evictpattern(L, cache);
+    n--;
+  }
+  cp = (CPattern *)lua_newuserdata(L, sizeof(CPattern) +
+                                      nset * sizeof(CSet) + l + 1);
+  cp->npre = literalprefix(p);
+  cp->nset = nset;
+  memset(cpitem(cp), 0, l + 1);
+  compilesets(p, cp);
+  lua_pushvalue(L, arg);
+  lua_pushvalue(L, -2);
+  lua_rawset(L, cache);
+  lua_pushinteger(L, n + 1);
+  lua_rawseti(L, cache, 1);
+  return cp;
+}
+
+
+/*
+** the compiled form of the pattern at `arg' (NULL for patterns longer
+** than MAXCPAT); leaves it (or nil) on the stack to keep it alive
+*/
+static const CPattern *getpattern (lua_State *L, int arg) {
+  size_t l;
+  const char *p = lua_tolstring(L, arg, &l);
+  CPattern *cp;
+  lua_pushvalue(L, arg);
+  lua_rawget(L, lua_upvalueindex(1));
+  cp = (CPattern *)lua_touserdata(L, -1);
+  if (cp == NULL && l <= MAXCPAT) {
+    lua_pop(L, 1);
+    cp = compilepattern(L, arg, p, l);
+  }
+  if (cp) cp->used = 1;
+  return cp;
+}
+
+
+/* first position from `s' where a match can start, or NULL if none */
+static const char *nextcandidate (MatchState *ms, const char *s) {
+  size_t n = (ms->cp) ? ms->cp->npre : 0;
+  const char *pre = ms->p_init;
+  if (n == 0) return s;
+  while ((size_t)(ms->src_end - s) >= n) {
+    s = (const char *)memchr(s, *pre, (ms->src_end - s) - n + 1);
+    if (s == NULL) return NULL;
+    if (memcmp(s + 1, pre + 1, n - 1) == 0) return s;
+    s++;
+  }
+  return NULL;
+}
+
+/* }====================================================== */
+
+
+/* Horspool search of `p' (l >= 2) in the `n' chars at `s' */
+static const char *horspool (const char *s, size_t n,
+                             const char *p, size_t l) {
+  size_t skip[UCHAR_MAX + 1];
+  size_t i;
+  for (i = 0; i <= UCHAR_MAX; i++)
+    skip[i] = l;
+  for (i = 0; i < l - 1; i++)
+    skip[uchar(p[i])] = l - 1 - i;
+  for (i = 0; i + l <= n; i += skip[uchar(s[i + l - 1])]) {
+    if (s[i + l - 1] == p[l - 1] && memcmp(s + i, p, l - 1) == 0)
+      return s + i;
+  }
+  return NULL;
+}
+
+
+/* false hits of the 1st char (one per 32 bytes or more) before Horspool */
+#define MAXMISSES	16
+
+/*
+** `memchr' (vectorised by the C library) finds candidates for the 1st
+** char; when that char is too common, the rest goes to `horspool'
+*/
 static const char *lmemfind (const char *s1, size_t l1,
                                const char *s2, size_t l2) {
   if (l2 == 0) return s1;  /* empty strings are everywhere */
   else if (l2 > l1) return NULL;  /* avoids a negative `l1' */
   else {
     const char *init;  /* to search for a `*s2' inside `s1' */
+    const char *start = s1;
+    size_t misses = 0;
     l2--;  /* 1st char will be checked by `memchr' */
     l1 = l1-l2;  /* `s2' cannot be found after that */
     while (l1 > 0 && (init = (const char *)memchr(s1, *s2, l1)) != NULL) {
       init++;   /* 1st char is already checked */
-      if (memcmp(init, s2+1, l2) == 0)
+      if ((l2 == 0 || init[l2-1] == s2[l2]) && memcmp(init, s2+1, l2) == 0)
         return init-1;
       else {  /* correct `l1' and `s1' to try again */
         l1 -= init-s1;
         s1 = init;
       }
+      if (++misses > MAXMISSES && l2 >= 3 &&
+          (size_t)(s1 - start) < misses * 32)  /* too many false hits? */
+        return horspool(s1, l1 + l2, s2, l2 + 1);
     }
     return NULL;  /* not found */
   }
 }
 
 
+static void push_substr (MatchState *ms, const char *s, size_t l) {
+  if (ms->parent)
+    pushslice(ms->L, ms->parent, s, l);
+  else
+    lua_pushlstring(ms->L, s, l);
+}
+
+
 static void push_onecapture (MatchState *ms, int i, const char *s,
                                                     const char *e) {
   if (i >= ms->level) {
     if (i == 0)  /* ms->level == 0, too */
-      lua_pushlstring(ms->L, s, e - s);  /* add whole match */
+      push_substr(ms, s, e - s);  /* add whole match */
     else
       luaL_error(ms->L, "invalid capture index");
   }
@@ -479,7 +1025,7 @@ static void push_onecapture (MatchState *ms, int i, const char *s,
     if (l == CAP_POSITION)
       lua_pushinteger(ms->L, ms->capture[i].init - ms->src_init + 1);
     else
-      lua_pushlstring(ms->L, ms->capture[i].init, l);
+      push_substr(ms, ms->capture[i].init, l);
   }
 }
 
@@ -487,7 +1033,7 @@ static void push_onecapture (MatchState *ms, int i, const char *s,
 static int push_captures (MatchState *ms, const char *s, const char *e) {
   int i;
   int nlevels = (ms->level == 0 && s) ? 1 : ms->level;
-  luaL_checkstack(ms->L, nlevels, "too many captures");
+  luaL_checkstack(ms->L, nlevels + 2, "too many captures");  /* (pushslice) */
   for (i = 0; i < nlevels; i++)
     push_onecapture(ms, i, s, e);
   return nlevels;  /* number of strings pushed */
@@ -496,8 +1042,8 @@ static int push_captures (MatchState *ms, const char *s, const char *e) {
 
 static int str_find_aux (lua_State *L, int find) {
   size_t l1, l2;
-  const char *s = luaL_checklstring(L, 1, &l1);
-  const char *p = luaL_checklstring(L, 2, &l2);
+  const char *s = checkstr(L, 1, &l1);
+  const char *p = checkzstr(L, 2, &l2);
   ptrdiff_t init = posrelat(luaL_optinteger(L, 3, 1), l1) - 1;
   if (init < 0) init = 0;
   else if ((size_t)(init) > l1) init = (ptrdiff_t)l1;
@@ -513,13 +1059,18 @@ static int str_find_aux (lua_State *L, int find) {
   }
   else {
     MatchState ms;
-    int anchor = (*p == '^') ? (p++, 1) : 0;
     const char *s1=s+init;
+    int anchor;
     ms.L = L;
+    ms.parent = (toslice(L, 1) != NULL);  /* index 1 or 0 */
     ms.src_init = s;
     ms.src_end = s+l1;
+    ms.p_init = p;
+    ms.cp = getpattern(L, 2);
+    anchor = (*p == '^') ? (p++, 1) : 0;
     do {
       const char *res;
+      if ((s1 = nextcandidate(&ms, s1)) == NULL) break;
       ms.level = 0;
       if ((res=match(&ms, s1, p)) != NULL) {
         if (find) {
@@ -550,16 +1101,20 @@ static int str_match (lua_State *L) {
 static int gmatch_aux (lua_State *L) {
   MatchState ms;
   size_t ls;
-  const char *s = lua_tolstring(L, lua_upvalueindex(1), &ls);
+  const char *s = checkstr(L, lua_upvalueindex(1), &ls);
   const char *p = lua_tostring(L, lua_upvalueindex(2));
   const char *src;
   ms.L = L;
+  ms.parent = toslice(L, lua_upvalueindex(1)) ? lua_upvalueindex(1) : 0;
   ms.src_init = s;
   ms.src_end = s+ls;
+  ms.p_init = p;
+  ms.cp = (const CPattern *)lua_touserdata(L, lua_upvalueindex(4));
   for (src = s + (size_t)lua_tointeger(L, lua_upvalueindex(3));
        src <= ms.src_end;
        src++) {
     const char *e;
+    if ((src = nextcandidate(&ms, src)) == NULL) break;
     ms.level = 0;
     if ((e = match(&ms, src, p)) != NULL) {
       lua_Integer newstart = e-s;
@@ -574,11 +1129,13 @@ static int gmatch_aux (lua_State *L) {
 
 
 static int gmatch (lua_State *L) {
-  luaL_checkstring(L, 1);
-  luaL_checkstring(L, 2);
+  size_t l;
+  checkstr(L, 1, &l);
+  checkzstr(L, 2, NULL);
   lua_settop(L, 2);
   lua_pushinteger(L, 0);
-  lua_pushcclosure(L, gmatch_aux, 3);
+  getpattern(L, 2);
+  lua_pushcclosure(L, gmatch_aux, 4);
   return 1;
 }
 
@@ -645,23 +1202,33 @@ static void add_value (MatchState *ms, luaL_Buffer *b, const char *s,
 
 static int str_gsub (lua_State *L) {
   size_t srcl;
-  const char *src = luaL_checklstring(L, 1, &srcl);
-  const char *p = luaL_checkstring(L, 2);
-  int  tr = lua_type(L, 3);
+  const char *src = checkstr(L, 1, &srcl);
+  const char *p = checkzstr(L, 2, NULL);
+  int  tr;
   int max_s = luaL_optint(L, 4, srcl+1);
   int anchor = (*p == '^') ? (p++, 1) : 0;
   int n = 0;
   MatchState ms;
   luaL_Buffer b;
+  if (toslice(L, 3))  /* a slice replacement is used as a string */
+    checkzstr(L, 3, NULL);
+  tr = lua_type(L, 3);
   luaL_argcheck(L, tr == LUA_TNUMBER || tr == LUA_TSTRING ||
                    tr == LUA_TFUNCTION || tr == LUA_TTABLE, 3,
                       "string/function/table expected");
+  ms.p_init = lua_tostring(L, 2);
+  ms.cp = getpattern(L, 2);
   luaL_buffinit(L, &b);
   ms.L = L;
+  ms.parent = 0;  /* the captures go into a new string */
   ms.src_init = src;
   ms.src_end = src+srcl;
   while (n < max_s) {
     const char *e;
+    const char *c = nextcandidate(&ms, src);
+    if (c == NULL) break;  /* no more matches: copy the rest */
+    luaL_addlstring(&b, src, c - src);
+    src = c;
     ms.level = 0;
     e = match(&ms, src, p);
     if (e) {
@@ -697,7 +1264,7 @@ static int str_gsub (lua_State *L) {
 
 static void addquoted (lua_State *L, luaL_Buffer *b, int arg) {
   size_t l;
-  const char *s = luaL_checklstring(L, arg, &l);
+  const char *s = checkstr(L, arg, &l);
   luaL_addchar(b, '"');
   while (l--) {
     switch (*s) {
@@ -759,7 +1326,7 @@ static int str_format (lua_State *L) {
   int top = lua_gettop(L);
   int arg = 1;
   size_t sfl;
-  const char *strfrmt = luaL_checklstring(L, arg, &sfl);
+  const char *strfrmt = checkzstr(L, arg, &sfl);
   const char *strfrmt_end = strfrmt+sfl;
   luaL_Buffer b;
   luaL_buffinit(L, &b);
@@ -800,7 +1367,7 @@ static int str_format (lua_State *L) {
         }
         case 's': {
           size_t l;
-          const char *s = luaL_checklstring(L, arg, &l);
+          const char *s = checkzstr(L, arg, &l);
           if (!strchr(form, '.') && l >= 100) {
             /* no precision and string is too long to be formatted;
                keep original string */
@@ -827,6 +1394,7 @@ static int str_format (lua_State *L) {
 
 
 static const luaL_Reg strlib[] = {
+  {"buffer", buf_new},
   {"byte", str_byte},
   {"char", str_char},
   {"dump", str_dump},
@@ -840,6 +1408,7 @@ static const luaL_Reg strlib[] = {
   {"match", str_match},
   {"rep", str_rep},
   {"reverse", str_reverse},
+  {"slice", str_slice},
   {"sub", str_sub},
   {"upper", str_upper},
   {NULL, NULL}
@@ -847,7 +1416,7 @@ static const luaL_Reg strlib[] = {
 
 
 static void createmetatable (lua_State *L) {
-  /* create tbl1 for type(string).mt }
+  /* create tbl1 for type(string).mt } */
   lua_createtable(L, 0, 1);  /* create metatable for strings */
   lua_pushliteral(L, "");  /* dummy string */
   lua_pushvalue(L, -2);
@@ -862,16 +1431,39 @@ static void createmetatable (lua_State *L) {
 }
 
 
+static void createslicemeta (lua_State *L) {
+  luaL_newmetatable(L, SLICE);
+  luaL_register(L, NULL, slicemeta);
+  lua_pushvalue(L, -2);  /* string library... */
+  lua_setfield(L, -2, "__index");  /* ...gives the methods of slices */
+  lua_pop(L, 1);  /* pop metatable */
+}
+
+
+static void createbuffermeta (lua_State *L) {
+  luaL_newmetatable(L, STRBUFFER);
+  luaL_register(L, NULL, bufmeta);
+  lua_pushvalue(L, -1);
+  lua_setfield(L, -2, "__index");  /* methods are in the metatable */
+  lua_pop(L, 1);  /* pop metatable */
+}
+
+
 /*
 ** Open string library
 */
 LUALIB_API int luaopen_string (lua_State *L) {
-  luaL_register(L, LUA_STRLIBNAME, strlib);
+  lua_newtable(L);  /* cache of compiled patterns */
+  lua_pushvalue(L, -1);
+  lua_setfield(L, LUA_REGISTRYINDEX, LUA_PATCACHE);
+  luaI_openlib(L, LUA_STRLIBNAME, strlib, 1);
 #if defined(LUA_COMPAT_GFIND)
   lua_getfield(L, -1, "gmatch");
   lua_setfield(L, -2, "gfind");
 #endif
   createmetatable(L);
+  createslicemeta(L);
+  createbuffermeta(L);
   return 1;
 }
 
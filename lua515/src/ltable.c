@@ -16,6 +16,15 @@
 ** in its main position (i.e. the `original' position that its hash gives
 ** to it), then the colliding(碰撞的) element is in its own main position.
 ** Hence even when the load factor reaches 100%, performance remains good.
+**
+** With LUA_USE_LINEARHASH the hash part is an open addressing table
+** instead: a key missing at its main position is looked for in the
+** following slots (wrapping around) up to the first free key. Keys
+** and values are kept in two arrays, so a probe only touches keys.
+** Keys are never removed, only their values are set to nil, so probe
+** sequences have no holes; such an entry is reused by the next new key
+** that goes through it, and dropped by the next rehash. The load
+** factor is kept under 3/4 so that a miss stops early.
 */
 
 
@@ -46,6 +55,7 @@
 #include "lobject.h"
 #include "lstate.h"
 #include "ltable.h"
+#include "lvm.h"
 
 
 /*
@@ -85,11 +95,42 @@
 
 #define dummynode		(&dummynode_)
 
+#if defined(LUA_USE_LINEARHASH)
+
+static const Node dummynode_ = {
+  {{{NULL}, LUA_TNIL}}  /* key */
+};
+
+#define dummyval		(&dummyval_)
+
+static const TValue dummyval_ = {{NULL}, LUA_TNIL};
+
+/* number of keys a hash part of `size' nodes takes before a rehash */
+#define nodecap(size)	((size) - ((size)+3)/4)
+
+/* value of node `n' */
+#define nodevalue(t,n)	gnval(t, cast_int((n) - (t)->node))
+
+/*
+** next node where a key not found at `n' may be: the following slot,
+** unless `n' is free (end of the probe sequence)
+*/
+#define chainnext(t,n) \
+	(ttisnil(gkey(n)) ? NULL : \
+	 gnode(t, lmod(cast_int((n) - (t)->node) + 1, sizenode(t))))
+
+#else
+
 static const Node dummynode_ = {
   {{NULL}, LUA_TNIL},  /* value */
   {{{NULL}, LUA_TNIL, NULL}}  /* key */
 };
 
+#define nodevalue(t,n)	gval(n)
+#define chainnext(t,n)	gnext(n)
+
+#endif
+
 
 /*
 ** hash for lua_Numbers
@@ -131,7 +172,9 @@ static Node *mainposition (const Table *t, const TValue *key) {
 ** the array part of the table, -1 otherwise.
 */
 static int arrayindex (const TValue *key) {
-  if (ttisnumber(key)) {
+  if (ttisint(key))
+    return ivalue(key);
+  else if (ttisnumber(key)) {
     lua_Number n = nvalue(key);
     int k;
     lua_number2int(k, n);
@@ -180,7 +223,7 @@ static int findindex (lua_State *L, Table *t, StkId key) {
         /* hash elements are numbered after array ones */
         return i + t->sizearray;
       }
-      else n = gnext(n);
+      else n = chainnext(t, n);
     } while (n);
     luaG_runerror(L, "invalid key to " LUA_QL("next"));  /* key not found */
     return 0;  /* to avoid warnings */
@@ -188,29 +231,45 @@ static int findindex (lua_State *L, Table *t, StkId key) {
 }
 
 
-int luaH_next (lua_State *L, Table *t, StkId key) {
-  int i = findindex(L, t, key);  /* find original element */
+/*
+** luaH_next for the generic `for' (see OP_TFORLOOP): `pos', if not 0,
+** is what the previous call returned, and saves `findindex' when `key'
+** is still the key found there. Returns the position after the element
+** found, or 0 when there are no more elements.
+*/
+int luaH_nextpos (lua_State *L, Table *t, StkId key, int pos) {
+  int i = pos - 1;
+  if (!(0 <= i && !ttisnil(key) &&
+        (i < t->sizearray ? arrayindex(key) == i+1 :
+         i - t->sizearray < sizenode(t) &&
+         luaO_rawequalObj(key2tval(gnode(t, i - t->sizearray)), key))))
+    i = findindex(L, t, key);  /* find original element */
   /* 这里先来个i++,配合着上面的findindex，就形成了如果传入的是nil，则从数组第一个slot开始查找
   ** 如果传入的是前面找到的oldKey，则在oldKey的下一个slot开始匹配,符合next函数定义
   */
   for (i++; i < t->sizearray; i++) {  /* try first array part */
     if (!ttisnil(&t->array[i])) {  /* a non-nil value? */
-      setnvalue(key, cast_num(i+1));	/* c下表从0开始，lua从1开始，所以这里要补1 */
+      setivalue(key, i+1);	/* c下表从0开始，lua从1开始，所以这里要补1 */
       setobj2s(L, key+1, &t->array[i]);
-      return 1;
+      return i+1;
     }
   }
   for (i -= t->sizearray; i < sizenode(t); i++) {  /* then hash part */
-    if (!ttisnil(gval(gnode(t, i)))) {  /* a non-nil value? */
+    if (!ttisnil(gnval(t, i))) {  /* a non-nil value? */
       setobj2s(L, key, key2tval(gnode(t, i)));
-      setobj2s(L, key+1, gval(gnode(t, i)));
-      return 1;
+      setobj2s(L, key+1, gnval(t, i));
+      return i+1 + t->sizearray;
     }
   }
   return 0;  /* no more elements */
 }
 
 
+int luaH_next (lua_State *L, Table *t, StkId key) {
+  return luaH_nextpos(L, t, key, 0) != 0;
+}
+
+
 /*
 ** {=============================================================
 ** Rehash
@@ -288,7 +347,7 @@ static int numusehash (const Table *t, int *nums, int *pnasize) {
   int i = sizenode(t);
   while (i--) {
     Node *n = &t->node[i];
-    if (!ttisnil(gval(n))) {	/* 这里没有判断gkey而是gval!!! */
+    if (!ttisnil(gnval(t, i))) {	/* 这里没有判断gkey而是gval!!! */
       ause += countint(key2tval(n), nums);
       totaluse++;
     }
@@ -306,6 +365,38 @@ static void setarrayvector (lua_State *L, Table *t, int size) {
   t->sizearray = size;
 }
 
+#if defined(LUA_USE_LINEARHASH)
+
+/* keys and values share one block: `size' keys, then `size' values */
+static void setnodevector (lua_State *L, Table *t, int size) {
+  int lsize;
+  if (size == 0) {  /* no elements to hash part? */
+    t->node = cast(Node *, dummynode);  /* use common `dummynode' */
+    t->nodeval = cast(TValue *, dummyval);
+    lsize = 0;
+    t->nodefree = 0;  /* first new key rehashes */
+  }
+  else {
+    int i;
+    lsize = ceillog2(size);
+    if (nodecap(twoto(lsize)) < size)
+      lsize++;  /* keep the load factor under 3/4 */
+    if (lsize > MAXBITS)
+      luaG_runerror(L, "table overflow");
+    size = twoto(lsize);
+    t->node = cast(Node *, luaM_reallocv(L, NULL, 0, size, NODESIZE));
+    t->nodeval = cast(TValue *, t->node + size);
+    for (i=0; i<size; i++) {
+      setnilvalue(gkey(gnode(t, i)));
+      setnilvalue(gnval(t, i));
+    }
+    t->nodefree = nodecap(size);
+  }
+  t->lsizenode = cast_byte(lsize);
+}
+
+#else
+
 /* 按照新的node区大小size，申请新内存且将其全部set-nil */
 static void setnodevector (lua_State *L, Table *t, int size) {
   int lsize;
@@ -331,6 +422,8 @@ static void setnodevector (lua_State *L, Table *t, int size) {
   t->lastfree = gnode(t, size);  /* all positions are free */
 }
 
+#endif
+
 /* nasize:调整后的数组大小
 ** nhsize:调整后node部分的元素个数 
 */
@@ -339,6 +432,10 @@ static void resize (lua_State *L, Table *t, int nasize, int nhsize) {
   int oldasize = t->sizearray;
   int oldhsize = t->lsizenode;
   Node *nold = t->node;  /* save old hash ... */
+#if defined(LUA_USE_LINEARHASH)
+  TValue *vold = t->nodeval;
+#endif
+  t->flags &= ~TMCACHED;  /* `tmcache' points into the old nodes */
   if (nasize > oldasize)  /* array part must grow? */
     setarrayvector(L, t, nasize);
   /* create new hash part with appropriate size 
@@ -358,16 +455,25 @@ static void resize (lua_State *L, Table *t, int nasize, int nhsize) {
   /* re-insert elements from hash part */
   for (i = twoto(oldhsize) - 1; i >= 0; i--) {
     Node *old = nold+i;
-    if (!ttisnil(gval(old)))	/* 这里没拿gkey判断!!       */
-      setobjt2t(L, luaH_set(L, t, key2tval(old)), gval(old));
+#if defined(LUA_USE_LINEARHASH)
+    TValue *v = vold+i;
+#else
+    TValue *v = gval(old);
+#endif
+    if (!ttisnil(v))	/* 这里没拿gkey判断!!       */
+      setobjt2t(L, luaH_set(L, t, key2tval(old)), v);
   }
   if (nold != dummynode)
-    luaM_freearray(L, nold, twoto(oldhsize), Node);  /* free old array */
+    luaM_freemem(L, nold, twoto(oldhsize) * NODESIZE);  /* free old array */
 }
 
 /* 供lvm调用，一次到位申请对应的array区域的内存 */
 void luaH_resizearray (lua_State *L, Table *t, int nasize) {
+#if defined(LUA_USE_LINEARHASH)
+  int nsize = (t->node == dummynode) ? 0 : nodecap(sizenode(t));
+#else
   int nsize = (t->node == dummynode) ? 0 : sizenode(t);
+#endif
   resize(L, t, nasize, nsize);
 }
 
@@ -386,6 +492,8 @@ static void rehash (lua_State *L, Table *t, const TValue *ek) {
   totaluse++;
   /* compute new size for array part */
   na = computesizes(nums, &nasize);	/* 计算下最优解下的nasize，以及即将落在array中的数量(na) */
+  luai_stat(L, rehashes, 1);
+  luai_stat(L, rehashslots, nasize + (totaluse - na));
   /* resize the table to new computed sizes */
   resize(L, t, nasize, totaluse - na);
 }
@@ -401,27 +509,151 @@ Table *luaH_new (lua_State *L, int narray, int nhash) {
   Table *t = luaM_new(L, Table);
   luaC_link(L, obj2gco(t), LUA_TTABLE);
   t->metatable = NULL;
-  t->flags = cast_byte(~0);	/* 新表，tag'method都不存在 */
+  t->flags = ~TMCACHED;	/* 新表，tag'method都不存在 */
+  t->tmcache = NULL;
   /* temporary values (kept only if some malloc fails) */
   t->array = NULL;
   t->sizearray = 0;
+  t->border = 0;
   /* n的0次幂==1，这里不能简单的t->node==NULL */
   t->lsizenode = 0;
   t->node = cast(Node *, dummynode);
+#if defined(LUA_USE_LINEARHASH)
+  t->nodeval = cast(TValue *, dummyval);
+#endif
   setarrayvector(L, t, narray);
   setnodevector(L, t, nhash);
   return t;
 }
 
 
+/*
+** a new table with the layout of `t': same sizes and a verbatim copy of
+** its array and hash parts, so nothing is hashed again. Collectable keys
+** and values still point to the objects of the state of `t': the caller
+** must translate them. Returns NULL if a live key of `t' is hashed by
+** its address (its node would be elsewhere in the new table); keys of
+** empty entries become dead keys that match no object.
+*/
+Table *luaH_copylayout (lua_State *L, const Table *t) {
+  int size = sizenode(t);
+  Table *nt;
+  int i;
+  if (t->node != dummynode) {
+    for (i = 0; i < size; i++) {
+      const TValue *k = key2tval(gnode(t, i));
+      if (iscollectable(k) && !ttisstring(k) && ttype(k) != LUA_TDEADKEY &&
+          !ttisnil(gnval(t, i)))
+        return NULL;
+    }
+  }
+  nt = luaH_new(L, 0, 0);
+  if (t->sizearray > 0) {
+    nt->array = luaM_newvector(L, t->sizearray, TValue);
+    nt->sizearray = t->sizearray;
+    memcpy(nt->array, t->array, t->sizearray*sizeof(TValue));
+  }
+  nt->border = t->border;
+  if (t->node == dummynode) return nt;
+#if defined(LUA_USE_LINEARHASH)
+  nt->node = cast(Node *, luaM_reallocv(L, NULL, 0, size, NODESIZE));
+  nt->nodeval = cast(TValue *, nt->node + size);
+  nt->lsizenode = t->lsizenode;
+  memcpy(nt->node, t->node, size*NODESIZE);
+  nt->nodefree = t->nodefree;
+#else
+  nt->node = luaM_newvector(L, size, Node);
+  nt->lsizenode = t->lsizenode;
+  memcpy(nt->node, t->node, size*sizeof(Node));
+  for (i = 0; i < size; i++) {  /* chains keep their shape */
+    Node *next = gnext(gnode(t, i));
+    if (next != NULL)
+      gnext(gnode(nt, i)) = nt->node + (next - t->node);
+  }
+  nt->lastfree = nt->node + (t->lastfree - t->node);
+#endif
+  for (i = 0; i < size; i++) {
+    TValue *k = key2tval(gnode(nt, i));
+    if (iscollectable(k) && ttisnil(gnval(nt, i))) {
+      setttype(k, LUA_TDEADKEY);
+      k->value.gc = NULL;
+    }
+  }
+  return nt;
+}
+
+
 void luaH_free (lua_State *L, Table *t) {
   if (t->node != dummynode)
-    luaM_freearray(L, t->node, sizenode(t), Node);
+    luaM_freemem(L, t->node, sizenode(t) * NODESIZE);
   luaM_freearray(L, t->array, t->sizearray, TValue);
+  if (t->tmcache != NULL)
+    luaM_freearray(L, t->tmcache, TM_N, const TValue *);
   luaM_free(L, t);
 }
 
 
+/*
+** remove all entries of `t' but keep its array and node vectors, so
+** the table can be refilled without allocating
+*/
+void luaH_clear (Table *t) {
+  int i;
+  t->border = 0;
+  for (i=0; i<t->sizearray; i++)
+    setnilvalue(&t->array[i]);
+  if (t->node != dummynode) {
+    int size = sizenode(t);
+#if defined(LUA_USE_LINEARHASH)
+    for (i=0; i<size; i++) {
+      setnilvalue(gkey(gnode(t, i)));
+      setnilvalue(gnval(t, i));
+    }
+    t->nodefree = nodecap(size);
+#else
+    for (i=0; i<size; i++) {
+      Node *n = gnode(t, i);
+      gnext(n) = NULL;
+      setnilvalue(gkey(n));
+      setnilvalue(gval(n));
+    }
+    t->lastfree = gnode(t, size);  /* all positions are free */
+#endif
+  }
+}
+
+
+#if defined(LUA_USE_LINEARHASH)
+
+/*
+** inserts a new key into a hash table: it takes the first node of its
+** probe sequence whose value is nil, be it a free key or an entry set
+** to nil since the last rehash; a free key is only taken while the
+** load factor allows it.
+*/
+static TValue *newkey (lua_State *L, Table *t, const TValue *key) {
+  Node *n = mainposition(t, key);
+  for (;;) {
+    if (ttisnil(gkey(n))) {  /* free key: end of the probe sequence */
+      if (t->nodefree == 0) {  /* table is full? */
+        rehash(L, t, key);  /* grow table */
+        return luaH_set(L, t, key);  /* re-insert key into grown table */
+      }
+      t->nodefree--;
+      break;
+    }
+    if (ttisnil(nodevalue(t, n)))  /* removed entry? */
+      break;  /* reuse it */
+    n = chainnext(t, n);
+  }
+  gkey(n)->value = key->value; gkey(n)->tt = key->tt;
+  luaC_barriert(L, t, key);
+  return nodevalue(t, n);
+}
+
+#else
+
+
 static Node *getfreepos (Table *t) {
   while (t->lastfree-- > t->node) {
     if (ttisnil(gkey(t->lastfree)))
@@ -473,6 +705,8 @@ static TValue *newkey (lua_State *L, Table *t, const TValue *key) {
   return gval(mp);
 }
 
+#endif
+
 
 /*
 ** search function for integers
@@ -480,7 +714,7 @@ static TValue *newkey (lua_State *L, Table *t, const TValue *key) {
 const TValue *luaH_getnum (Table *t, int key) {
   /* (1 <= key && key <= t->sizearray) */
   /* 如果key为负数，按照C的int->uint规则，转换的结果将是一个巨大的数，故而下面判断为false */
-  if (cast(unsigned int, key-1) < cast(unsigned int, t->sizearray))
+  if (cast(unsigned int, key) - 1 < cast(unsigned int, t->sizearray))
     return &t->array[key-1];
   else {
     lua_Number nk = cast_num(key);
@@ -490,9 +724,9 @@ const TValue *luaH_getnum (Table *t, int key) {
 	   ** 所以这里必须要有个ttisnumber的判断 
 	   */
       if (ttisnumber(gkey(n)) && luai_numeq(nvalue(gkey(n)), nk))
-        return gval(n);  /* that's it */
+        return nodevalue(t, n);  /* that's it */
       else /* 如果key已存在于tbl，则必然在mp'link上，故而这里可以遍历列表来查找，下同 */
-	  	n = gnext(n);
+	  	n = chainnext(t, n);
     } while (n);
     return luaO_nilobject;
   }
@@ -510,9 +744,9 @@ const TValue *luaH_getstr (Table *t, TString *key) {
   	** 则是复用该node
   	*/
     if (ttisstring(gkey(n)) && rawtsvalue(gkey(n)) == key)
-      return gval(n);  /* that's it */
+      return nodevalue(t, n);  /* that's it */
     else 
-		n = gnext(n);	
+		n = chainnext(t, n);	
   } while (n);
   return luaO_nilobject;
 }
@@ -527,7 +761,10 @@ const TValue *luaH_get (Table *t, const TValue *key) {
     case LUA_TSTRING: return luaH_getstr(t, rawtsvalue(key));
     case LUA_TNUMBER: {
       int k;
-      lua_Number n = nvalue(key);
+      lua_Number n;
+      if (ttisint(key))
+        return luaH_getnum(t, ivalue(key));
+      n = nvalue(key);
       lua_number2int(k, n);
       if (luai_numeq(cast_num(k), nvalue(key))) /* index is int? */
         return luaH_getnum(t, k);  /* use specialized version */
@@ -537,8 +774,8 @@ const TValue *luaH_get (Table *t, const TValue *key) {
       Node *n = mainposition(t, key);
       do {  /* check whether `key' is somewhere in the chain */
         if (luaO_rawequalObj(key2tval(n), key))		/* 这里必须rawequlObj进行type==type的判断，以忽略掉deadKey的Node,以及union带来的影响 */
-          return gval(n);  /* that's it */
-        else n = gnext(n);
+          return nodevalue(t, n);  /* that's it */
+        else n = chainnext(t, n);
       } while (n);
       return luaO_nilobject;
     }
@@ -566,7 +803,7 @@ TValue *luaH_setnum (lua_State *L, Table *t, int key) {
     return cast(TValue *, p);
   else {
     TValue k;
-    setnvalue(&k, cast_num(key));
+    setivalue(&k, key);
     return newkey(L, t, &k);
   }
 }
@@ -611,27 +848,136 @@ static int unbound_search (Table *t, unsigned int j) {
 /*
 ** Try to find a boundary in table `t'. A `boundary' is an integer index
 ** such that t[i] is non-nil and t[i+1] is nil (and 0 if t[1] is nil).
+**
+** `t->border' keeps the last boundary found. Writes do not maintain it:
+** it is checked here, which costs two probes, and when a sequence grew
+** or shrank by one element since (`t[#t+1] = v', `t[#t] = nil') the
+** neighbour of the hint is the new boundary. Only a failed check pays
+** for a search.
 */
 int luaH_getn (Table *t) {
   unsigned int j = t->sizearray;
+  unsigned int b = cast(unsigned int, t->border);
   if (j > 0 && ttisnil(&t->array[j - 1])) {
     /* there is a boundary in the array part: (binary) search for it */
     unsigned int i = 0;
+    if (b < j) {
+      if (b > 0 && ttisnil(&t->array[b - 1])) {  /* shrunk? */
+        if (b == 1 || !ttisnil(&t->array[b - 2]))
+          return t->border = b - 1;
+      }
+      else if (ttisnil(&t->array[b]))
+        return b;  /* hint is still a boundary */
+      else if (ttisnil(&t->array[b + 1]))  /* b+1 < j, as t[j] is nil */
+        return t->border = b + 1;
+    }
     while (j - i > 1) {
       unsigned int m = (i+j)/2;
       if (ttisnil(&t->array[m - 1])) j = m;
       else i = m;
     }
-    return i;
+    return t->border = i;
   }
   /* else must find a boundary in hash part */
   else if (t->node == dummynode)  /* hash part is empty? */
     return j;  /* that is easy... */
-  else return unbound_search(t, j);
+  else {
+    if (b >= j && b < cast(unsigned int, MAX_INT) - 1 &&
+        (b == j || !ttisnil(luaH_getnum(t, b)))) {
+      if (ttisnil(luaH_getnum(t, b + 1)))
+        return b;  /* hint is still a boundary */
+      if (ttisnil(luaH_getnum(t, b + 2)))
+        return t->border = b + 1;
+    }
+    return t->border = unbound_search(t, j);
+  }
 }
 
 
 
+/*
+** {=============================================================
+** Sorting the array part in place
+** ==============================================================
+*/
+
+/* the elements are all numbers (no NaN) or all strings */
+#define arraylt(L,a,b) \
+	(ttisnumber(a) ? luai_numlt(nvalue(a), nvalue(b)) : \
+	 (rawtsvalue(a) != rawtsvalue(b) && luaV_lessthan(L, a, b)))
+
+typedef struct SortArray {
+  lua_State *L;
+  TValue *a;
+} SortArray;
+
+#define SORT_CTX	SortArray *
+#define SORT_NAME(n)	array##n
+#define sortlt(s,i,j)	arraylt((s)->L, &(s)->a[i], &(s)->a[j])
+#define sortswap(s,i,j) \
+	{ TValue t_ = (s)->a[i]; (s)->a[i] = (s)->a[j]; (s)->a[j] = t_; }
+
+#include "lsort.h"
+
+
+/* stable: merges sorted runs through `buff', of n/2 elements */
+static void mergesort (SortArray *s, int l, int n, TValue *buff) {
+  TValue *a = s->a + l;
+  int m = n/2, i, j, k;
+  if (n <= SORT_INSERTION) {
+    arrayinsertion(s, l, n);
+    return;
+  }
+  mergesort(s, l, m, buff);
+  mergesort(s, l + m, n - m, buff);
+  if (!arraylt(s->L, &a[m], &a[m-1]))
+    return;  /* runs already in order */
+  memcpy(buff, a, m * sizeof(TValue));
+  for (i = 0, j = m, k = 0; i < m && j < n; k++) {
+    if (arraylt(s->L, &a[j], &buff[i])) a[k] = a[j++];
+    else a[k] = buff[i++];
+  }
+  while (i < m) a[k++] = buff[i++];
+}
+
+
+/*
+** sorts t[1..n] with `<' when those are all in the array part and all
+** numbers (none NaN) or all strings; returns 0, doing nothing, otherwise.
+** No metamethod can run and nothing can fail but the allocation of the
+** buffer of a stable sort, which happens before any element moves.
+*/
+int luaH_sortarray (lua_State *L, Table *t, int n, int stable) {
+  TValue *a = t->array;
+  SortArray s;
+  int i;
+  if (n > t->sizearray) return 0;
+  if (n < 2) return 1;
+  if (ttisnumber(&a[0])) {
+    for (i = 0; i < n; i++)
+      if (!ttisnumber(&a[i]) || luai_numisnan(nvalue(&a[i]))) return 0;
+  }
+  else if (ttisstring(&a[0])) {
+    for (i = 1; i < n; i++)
+      if (!ttisstring(&a[i])) return 0;
+  }
+  else return 0;
+  s.L = L;
+  s.a = a;
+  if (stable) {
+    TValue *buff = luaM_newvector(L, n/2, TValue);
+    mergesort(&s, 0, n, buff);
+    luaM_freearray(L, buff, n/2, TValue);
+  }
+  else
+    arraysort(&s, 0, n);
+  return 1;
+}
+
+/* }============================================================= */
+
+
+
 #if defined(LUA_DEBUG)
 
 Node *luaH_mainposition (const Table *t, const TValue *key) {
@@ -12,11 +12,26 @@
 
 #define gnode(t,i)	(&(t)->node[i])
 #define gkey(n)		(&(n)->i_key.nk)
-#define gval(n)		(&(n)->i_val)
-#define gnext(n)	((n)->i_key.nk.next)
 
 #define key2tval(n)	(&(n)->i_key.tvk)
 
+/*
+** gnval(t,i):     value of node `i' of `t'
+** nodeslot(t,v):  index of the node whose value is `v'
+** NODESIZE:       bytes of hash part per node
+*/
+#if defined(LUA_USE_LINEARHASH)
+#define gnval(t,i)	(&(t)->nodeval[i])
+#define nodeslot(t,v)	cast_int((v) - (t)->nodeval)
+#define NODESIZE	(sizeof(Node) + sizeof(TValue))
+#else
+#define gval(n)		(&(n)->i_val)
+#define gnext(n)	((n)->i_key.nk.next)
+#define gnval(t,i)	gval(gnode(t, i))
+#define nodeslot(t,v)	cast_int(cast(const Node *, (v)) - (t)->node)
+#define NODESIZE	sizeof(Node)
+#endif
+
 /* 带着函数的返回值类型，看函数实现，哈哈 */
 LUAI_FUNC const TValue *luaH_getnum (Table *t, int key);
 LUAI_FUNC TValue *luaH_setnum (lua_State *L, Table *t, int key);
@@ -26,9 +41,13 @@ LUAI_FUNC const TValue *luaH_get (Table *t, const TValue *key);
 LUAI_FUNC TValue *luaH_set (lua_State *L, Table *t, const TValue *key);
 LUAI_FUNC Table *luaH_new (lua_State *L, int narray, int lnhash);
 LUAI_FUNC void luaH_resizearray (lua_State *L, Table *t, int nasize);
+LUAI_FUNC Table *luaH_copylayout (lua_State *L, const Table *t);
 LUAI_FUNC void luaH_free (lua_State *L, Table *t);
+LUAI_FUNC void luaH_clear (Table *t);
 LUAI_FUNC int luaH_next (lua_State *L, Table *t, StkId key);
+LUAI_FUNC int luaH_nextpos (lua_State *L, Table *t, StkId key, int pos);
 LUAI_FUNC int luaH_getn (Table *t);
+LUAI_FUNC int luaH_sortarray (lua_State *L, Table *t, int n, int stable);
 
 
 #if defined(LUA_DEBUG)
@@ -152,6 +152,8 @@ static int tconcat (lua_State *L) {
   luaL_checktype(L, 1, LUA_TTABLE);
   i = luaL_optint(L, 3, 1);
   last = luaL_opt(L, luaL_checkint, 4, luaL_getn(L, 1));
+  if (i <= last && lua_concatarray(L, 1, sep, lsep, i, last))
+    return 1;  /* all in the array part: done in one go */
   luaL_buffinit(L, &b);
   for (; i < last; i++) {
     addfield(L, &b, i);
@@ -170,6 +172,12 @@ static int tconcat (lua_State *L) {
 ** Quicksort
 ** (based on `Algorithms in MODULA-3', Robert Sedgewick;
 **  Addison-Wesley, 1993.)
+** made an introsort, the one of `luaH_sortarray' (lsort.h): ranges of
+** up to `SORT_INSERTION' elements are sorted by insertion, and after
+** too many bad partitions heapsort takes over, so the worst case is
+** O(n log n). Without a comparator, sequences of numbers or of strings
+** are sorted in place inside the table (`lua_sortarray'), with no stack
+** traffic at all.
 */
 
 
@@ -193,92 +201,137 @@ static int sort_comp (lua_State *L, int a, int b) {
     return lua_lessthan(L, a, b);
 }
 
-static void auxsort (lua_State *L, int l, int u) {
-  while (l < u) {  /* for tail recursion */
-    int i, j;
-    /* sort elements a[l], a[(l+u)/2] and a[u] */
-    lua_rawgeti(L, 1, l);
-    lua_rawgeti(L, 1, u);
-    if (sort_comp(L, -1, -2))  /* a[u] < a[l]? */
-      set2(L, l, u);  /* swap a[l] - a[u] */
-    else
-      lua_pop(L, 2);
-    if (u-l == 1) break;  /* only 2 elements */
-    i = (l+u)/2;
-    lua_rawgeti(L, 1, i);
-    lua_rawgeti(L, 1, l);
-    if (sort_comp(L, -2, -1))  /* a[i]<a[l]? */
-      set2(L, i, l);
-    else {
-      lua_pop(L, 1);  /* remove a[l] */
-      lua_rawgeti(L, 1, u);
-      if (sort_comp(L, -1, -2))  /* a[u]<a[i]? */
-        set2(L, i, u);
-      else
-        lua_pop(L, 2);
-    }
-    if (u-l == 2) break;  /* only 3 elements */
-    lua_rawgeti(L, 1, i);  /* Pivot */
-    lua_pushvalue(L, -1);
-    lua_rawgeti(L, 1, u-1);
-    set2(L, i, u-1);
-    /* a[l] <= P == a[u-1] <= a[u], only need to sort from l+1 to u-2 */
-    i = l; j = u-1;
-    for (;;) {  /* invariant: a[l..i] <= P <= a[j..u] */
-      /* repeat ++i until a[i] >= P */
-      while (lua_rawgeti(L, 1, ++i), sort_comp(L, -1, -2)) {
-        if (i>u) luaL_error(L, "invalid order function for sorting");
-        lua_pop(L, 1);  /* remove a[i] */
-      }
-      /* repeat --j until a[j] <= P */
-      while (lua_rawgeti(L, 1, --j), sort_comp(L, -3, -1)) {
-        if (j<l) luaL_error(L, "invalid order function for sorting");
-        lua_pop(L, 1);  /* remove a[j] */
-      }
-      if (j<i) {
-        lua_pop(L, 3);  /* pop pivot, a[i], a[j] */
-        break;
-      }
-      set2(L, i, j);
-    }
-    lua_rawgeti(L, 1, u-1);
-    lua_rawgeti(L, 1, i);
-    set2(L, u-1, i);  /* swap pivot (a[u-1]) with a[i] */
-    /* a[l..i-1] <= a[i] == P <= a[i+1..u] */
-    /* adjust so that smaller half is in [j..i] and larger one in [l..u] */
-    if (i-l < u-i) {
-      j=l; i=i-1; l=i+2;
+/* a[i] < a[j]? */
+static int lessthan (lua_State *L, int i, int j) {
+  int res;
+  lua_rawgeti(L, 1, i);
+  lua_rawgeti(L, 1, j);
+  res = sort_comp(L, -2, -1);
+  lua_pop(L, 2);
+  return res;
+}
+
+static void swap (lua_State *L, int i, int j) {
+  lua_rawgeti(L, 1, i);
+  lua_rawgeti(L, 1, j);
+  set2(L, i, j);
+}
+
+#define SORT_CTX	lua_State *
+#define SORT_NAME(n)	aux##n
+#define sortlt(L,i,j)	lessthan(L, i, j)
+#define sortswap(L,i,j)	swap(L, i, j)
+
+#include "lsort.h"
+
+
+/*
+** stable merge sort of a[l..u]; runs are merged into the table at index
+** 3 and copied back, so nothing is lost if the order function fails
+*/
+static void auxmerge (lua_State *L, int l, int u) {
+  int m = l + (u-l+1)/2 - 1;  /* a[l..m] and a[m+1..u] */
+  int i = l, j = m+1, k = 1;
+  if (u-l < SORT_INSERTION) {
+    auxinsertion(L, l, u-l+1);
+    return;
+  }
+  auxmerge(L, l, m);
+  auxmerge(L, m+1, u);
+  if (!lessthan(L, m+1, m))
+    return;  /* runs already in order */
+  lua_rawgeti(L, 1, i);
+  lua_rawgeti(L, 1, j);
+  for (;;) {  /* stack: a[i], a[j] */
+    if (sort_comp(L, -1, -2)) {  /* a[j] < a[i]? */
+      lua_rawseti(L, 3, k++);
+      if (++j > u) break;
+      lua_rawgeti(L, 1, j);
     }
-    else {
-      j=i+1; i=u; u=j-2;
+    else {  /* equal elements are taken from the left run */
+      lua_pushvalue(L, -2);
+      lua_rawseti(L, 3, k++);
+      lua_remove(L, -2);
+      if (++i > m) break;
+      lua_rawgeti(L, 1, i);
+      lua_insert(L, -2);
     }
-    auxsort(L, j, i);  /* call recursively the smaller one */
-  }  /* repeat the routine for the larger one */
+  }
+  lua_pop(L, 1);
+  while (i <= m) {  /* rest of the left run; the right one is in place */
+    lua_rawgeti(L, 1, i++);
+    lua_rawseti(L, 3, k++);
+  }
+  for (i = 1; i < k; i++) {
+    lua_rawgeti(L, 3, i);
+    lua_rawseti(L, 1, l+i-1);
+  }
 }
 
-static int sort (lua_State *L) {
+static int checksort (lua_State *L) {
   int n = aux_getn(L, 1);
   luaL_checkstack(L, 40, "");  /* assume array is smaller than 2^40 */
   if (!lua_isnoneornil(L, 2))  /* is there a 2nd argument? */
     luaL_checktype(L, 2, LUA_TFUNCTION);
   lua_settop(L, 2);  /* make sure there is two arguments */
-  auxsort(L, 1, n);
+  return n;
+}
+
+static int sort (lua_State *L) {
+  int n = checksort(L);
+  if (!lua_isnil(L, 2) || !lua_sortarray(L, 1, n, 0))
+    auxsort(L, 1, n);
+  return 0;
+}
+
+/* table.stablesort(t [, comp]): as `sort', keeping equal elements in order */
+static int stablesort (lua_State *L) {
+  int n = checksort(L);
+  if (!lua_isnil(L, 2) || !lua_sortarray(L, 1, n, 1)) {
+    lua_createtable(L, n, 0);  /* room to merge runs */
+    auxmerge(L, 1, n);
+  }
   return 0;
 }
 
 /* }====================================================== */
 
 
+/*
+** table.new(narray, nhash): a table with preallocated room for `narray'
+** array items and `nhash' other fields
+*/
+static int tnew (lua_State *L) {
+  int narray = luaL_optint(L, 1, 0);
+  int nhash = luaL_optint(L, 2, 0);
+  luaL_argcheck(L, narray >= 0, 1, "negative size");
+  luaL_argcheck(L, nhash >= 0, 2, "negative size");
+  lua_createtable(L, narray, nhash);
+  return 1;
+}
+
+
+/* table.clear(t): remove all entries of `t', keeping its memory */
+static int tclear (lua_State *L) {
+  luaL_checktype(L, 1, LUA_TTABLE);
+  lua_cleartable(L, 1);
+  return 0;
+}
+
+
 static const luaL_Reg tab_funcs[] = {
+  {"clear", tclear},
   {"concat", tconcat},
   {"foreach", foreach},
   {"foreachi", foreachi},
   {"getn", getn},
   {"maxn", maxn},
   {"insert", tinsert},
+  {"new", tnew},
   {"remove", tremove},
   {"setn", setn},
   {"sort", sort},
+  {"stablesort", stablesort},
   {NULL, NULL}
 };
 
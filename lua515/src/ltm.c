@@ -12,6 +12,7 @@
 
 #include "lua.h"
 
+#include "lmem.h"
 #include "lobject.h"
 #include "lstate.h"
 #include "lstring.h"
@@ -43,23 +44,62 @@ void luaT_init (lua_State *L) {
 }
 
 
+/*
+** Metatables (tables given to `lua_setmetatable') get a `tmcache': the
+** first lookup of one of their tag methods looks up all of them, sets
+** the `flags' bits of the absent ones and keeps pointers to the values
+** of the others, so that later lookups hash no names at all. Any store
+** into the table clears `flags' (see luaH_set), and so the cache; so
+** does moving the nodes (`resize'). A pointed value set to nil by a
+** collection or `luaH_clear' reads as an absent tag method.
+*/
+
+void luaT_newcache (lua_State *L, Table *events) {
+  if (events->tmcache == NULL) {
+    events->tmcache = luaM_newvector(L, TM_N, const TValue *);
+    events->flags &= ~TMCACHED;
+  }
+}
+
+
+static void filltmcache (Table *events, TString **names) {
+  unsigned int flags = TMCACHED;
+  int e;
+  for (e = 0; e < TM_N; e++) {
+    const TValue *tm = luaH_getstr(events, names[e]);
+    events->tmcache[e] = tm;
+    if (ttisnil(tm)) flags |= 1u<<e;
+  }
+  events->flags = flags;
+}
+
+
 /*
 ** function to be used with macro "fasttm": optimized for absence of
 ** tag methods
 */
-const TValue *luaT_gettm (Table *events, TMS event, TString *ename) {
-  const TValue *tm = luaH_getstr(events, ename);
-  lua_assert(event <= TM_EQ);
-  if (ttisnil(tm)) {  /* no tag method? */
-    events->flags |= cast_byte(1u<<event);  /* cache this fact */
-    return NULL;
+const TValue *luaT_gettm (Table *events, TMS event, TString **names) {
+  const TValue *tm;
+  if (!(events->flags & TMCACHED)) {
+    if (events->tmcache != NULL)
+      filltmcache(events, names);
+    else {
+      tm = luaH_getstr(events, names[event]);
+      if (ttisnil(tm)) {  /* no tag method? */
+        events->flags |= 1u<<event;  /* cache this fact */
+        return NULL;
+      }
+      return tm;
+    }
   }
-  else return tm;
+  tm = events->tmcache[event];
+  return ttisnil(tm) ? NULL : tm;
 }
 
 
 const TValue *luaT_gettmbyobj (lua_State *L, const TValue *o, TMS event) {
   Table *mt;
+  const TValue *tm;
   switch (ttype(o)) {
     case LUA_TTABLE:
       mt = hvalue(o)->metatable;
@@ -70,6 +110,7 @@ const TValue *luaT_gettmbyobj (lua_State *L, const TValue *o, TMS event) {
     default:
       mt = G(L)->mt[ttype(o)];
   }
-  return (mt ? luaH_getstr(mt, G(L)->tmname[event]) : luaO_nilobject);
+  tm = fasttm(L, mt, event);
+  return (tm ? tm : luaO_nilobject);
 }
 
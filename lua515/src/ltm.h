@@ -38,15 +38,20 @@ typedef enum {
 
 
 
+/* bit of `flags' telling that `tmcache' holds the table's tag methods */
+#define TMCACHED	(1u<<TM_N)
+
 #define gfasttm(g,et,e) ((et) == NULL ? NULL : \
-  ((et)->flags & (1u<<(e))) ? NULL : luaT_gettm(et, e, (g)->tmname[e]))
+  ((et)->flags & (1u<<(e))) ? NULL : luaT_gettm(et, e, (g)->tmname))
 
 #define fasttm(l,et,e)	gfasttm(G(l), et, e)
 
 LUAI_DATA const char *const luaT_typenames[];
 
 
-LUAI_FUNC const TValue *luaT_gettm (Table *events, TMS event, TString *ename);
+LUAI_FUNC const TValue *luaT_gettm (Table *events, TMS event,
+                                    TString **names);
+LUAI_FUNC void luaT_newcache (lua_State *L, Table *events);
 LUAI_FUNC const TValue *luaT_gettmbyobj (lua_State *L, const TValue *o,
                                                        TMS event);
 LUAI_FUNC void luaT_init (lua_State *L);
@@ -27,6 +27,9 @@
 /* mark for precompiled code (`<esc>Lua') */
 #define	LUA_SIGNATURE	"\033Lua"
 
+/* format byte (after signature and version) of an image for lua_loadimage */
+#define LUA_IMAGEFORMAT	1
+
 /* option for multiple returns in `lua_pcall' and `lua_call' 
 */
 #define LUA_MULTRET	(-1)
@@ -65,6 +68,8 @@
 
 
 typedef struct lua_State lua_State;
+
+typedef struct lua_Heap lua_Heap;
 // 被Lua虚拟机执行的C函数原型要求
 typedef int (*lua_CFunction) (lua_State *L);
 
@@ -85,6 +90,28 @@ typedef int (*lua_Writer) (lua_State *L, const void* p, size_t sz, void* ud);
 typedef void * (*lua_Alloc) (void *ud, void *ptr, size_t osize, size_t nsize);
 
 
+/*
+** native finalizer of a userdata (see lua_setfinalizer): gets the
+** block and its size right before the block is freed, and the
+** allocator of the state for what the block owns
+*/
+typedef void (*lua_Finalizer) (void *p, size_t sz, lua_Alloc f, void *ud);
+
+
+/*
+** soft memory limit callback (see lua_setmemsoft): gets the bytes in
+** use when the heap passes the limit
+*/
+typedef void (*lua_MemHook) (lua_State *L, void *ud, size_t used);
+
+
+/*
+** instruction budget callback (see lua_setbudget): nonzero stops the
+** thread
+*/
+typedef int (*lua_Budget) (lua_State *L, void *ud);
+
+
 /*
 ** basic types
 */
@@ -139,6 +166,22 @@ LUA_API lua_State *(lua_newthread) (lua_State *L);
 
 LUA_API lua_CFunction (lua_atpanic) (lua_State *L, lua_CFunction panicf);
 
+/*
+** shared heaps: `lua_freeze' moves the strings and the prototypes of a
+** template state (and the `n' functions on its stack) into a read-only
+** heap; states created by `lua_newsharedstate' use them in place and
+** `lua_loadshared' pushes a new closure of function `i' (1 .. n). The
+** last of the states and the caller's reference (`lua_releaseheap') to
+** go frees the heap, with the allocator of the template.
+*/
+LUA_API lua_Heap  *(lua_freeze) (lua_State *L, int n);
+LUA_API lua_State *(lua_newsharedstate) (lua_Heap *h, lua_Alloc f, void *ud);
+LUA_API void       (lua_releaseheap) (lua_Heap *h);
+LUA_API int        (lua_loadshared) (lua_State *L, int i);
+
+/* a new state with a copy of everything `L' reaches, or NULL */
+LUA_API lua_State *(lua_clonestate) (lua_State *L, lua_Alloc f, void *ud);
+
 
 /*
 ** basic stack manipulation
@@ -220,6 +263,10 @@ LUA_API void  (lua_getfield) (lua_State *L, int idx, const char *k);
 LUA_API void  (lua_rawget) (lua_State *L, int idx);
 LUA_API void  (lua_rawgeti) (lua_State *L, int idx, int n);
 LUA_API void  (lua_createtable) (lua_State *L, int narr, int nrec);
+LUA_API void  (lua_cleartable) (lua_State *L, int idx);
+LUA_API int   (lua_sortarray) (lua_State *L, int idx, int n, int stable);
+LUA_API int   (lua_concatarray) (lua_State *L, int idx, const char *sep,
+                                 size_t lsep, int i, int j);
 LUA_API void *(lua_newuserdata) (lua_State *L, size_t sz);
 /* 尝试提取指定元素objindex的mt/env到栈顶,top++ */
 LUA_API int   (lua_getmetatable) (lua_State *L, int objindex);
@@ -245,6 +292,12 @@ LUA_API int   (lua_pcall) (lua_State *L, int nargs, int nresults, int errfunc);
 LUA_API int   (lua_cpcall) (lua_State *L, lua_CFunction func, void *ud);
 LUA_API int   (lua_load) (lua_State *L, lua_Reader reader, void *dt,
                                         const char *chunkname);
+LUA_API int   (lua_loadtrusted) (lua_State *L, lua_Reader reader, void *dt,
+                                 const char *chunkname);
+LUA_API int   (lua_loadimage) (lua_State *L, const char *image, size_t size,
+                               const char *chunkname);
+LUA_API int   (lua_loaddata) (lua_State *L, lua_Reader reader, void *dt,
+                              const char *chunkname);
 
 LUA_API int (lua_dump) (lua_State *L, lua_Writer writer, void *data);
 
@@ -254,6 +307,7 @@ LUA_API int (lua_dump) (lua_State *L, lua_Writer writer, void *data);
 */
 LUA_API int  (lua_yield) (lua_State *L, int nresults);
 LUA_API int  (lua_resume) (lua_State *L, int narg);
+LUA_API int  (lua_isyieldable) (lua_State *L);
 LUA_API int  (lua_status) (lua_State *L);
 
 /*
@@ -268,9 +322,59 @@ LUA_API int  (lua_status) (lua_State *L);
 #define LUA_GCSTEP		5
 #define LUA_GCSETPAUSE		6
 #define LUA_GCSETSTEPMUL	7
+#define LUA_GCGEN		8
+#define LUA_GCINC		9
+#define LUA_GCMARKTHREADS	10
+#define LUA_GCBGSWEEP		11
+#define LUA_GCSETBUDGET		12
+#define LUA_GCSETGROWTH		13
+#define LUA_GCIDLE		14
+#define LUA_GCHEAPSAMPLE	15
 
 LUA_API int (lua_gc) (lua_State *L, int what, int data);
 
+LUA_API size_t (lua_setmemlimit) (lua_State *L, size_t limit);
+LUA_API size_t (lua_setmemsoft) (lua_State *L, size_t limit, lua_MemHook f,
+                                 void *ud);
+
+
+/*
+** garbage-collector statistics
+*/
+#define LUA_GCPPROPAGATE	0
+#define LUA_GCPATOMIC		1
+#define LUA_GCPSWEEPSTRING	2
+#define LUA_GCPSWEEP		3
+#define LUA_GCPFINALIZE		4
+#define LUA_GCPHASES		5
+
+#define LUA_GCHISTSIZE		16
+
+typedef struct lua_GCStats {
+  double phasetime[LUA_GCPHASES];  /* seconds spent in each phase */
+  double maxpause;  /* longest collector pause (a step or a full collection) */
+  size_t steps;  /* collector steps taken while allocating */
+  size_t cycles;  /* finished cycles */
+  size_t allocated, freed;  /* bytes since the state was created */
+  size_t cyclealloc, cyclefreed;  /* bytes during the last finished cycle */
+  size_t hist[LUA_GCHISTSIZE];  /* steps under 2^i microseconds (last: the rest) */
+} lua_GCStats;
+
+LUA_API void (lua_gcstats) (lua_State *L, lua_GCStats *st);
+
+
+/* hot-path counters, kept by a build with LUAI_STATS (luaconf.h) */
+typedef struct lua_Stats {
+  size_t strhits, strmisses;  /* luaS_newlstr: strings found / created */
+  size_t rehashes;  /* table rehashes... */
+  size_t rehashslots;  /* ...and the slots (array + hash) they sized for */
+  size_t stackgrows, cigrows;  /* growths of the stack / CallInfo array */
+  size_t indexmeta, newindexmeta;  /* gets / sets that went to __index / __newindex */
+  size_t concats, concatbytes;  /* strings made by concatenation, and their bytes */
+} lua_Stats;
+
+LUA_API int (lua_stats) (lua_State *L, lua_Stats *st, int reset);
+
 
 /*
 ** miscellaneous(各式各样的) functions
@@ -285,6 +389,61 @@ LUA_API void  (lua_concat) (lua_State *L, int n);
 LUA_API lua_Alloc (lua_getallocf) (lua_State *L, void **ud);
 LUA_API void lua_setallocf (lua_State *L, lua_Alloc f, void *ud);
 
+/* native finalizers */
+#define LUA_FINTHREADSAFE	1	/* may run on the background sweeper */
+
+LUA_API void (lua_setfinalizer) (lua_State *L, int idx, lua_Finalizer f,
+                                 int flags);
+
+/* string hash modes */
+#define LUA_HASHSAMPLE	0	/* sample the bytes of long strings */
+#define LUA_HASHFULL	1	/* hash all bytes, with a per-state seed */
+
+LUA_API int (lua_hashmode) (lua_State *L, int mode);
+
+LUA_API int (lua_optimize) (lua_State *L, int on);
+
+/* bit operations on 32 bits (lua_bitop) */
+#define LUA_OPTOBIT	1	/* unary */
+#define LUA_OPBNOT	2
+#define LUA_OPBSWAP	3
+#define LUA_OPBAND	4	/* any number of operands */
+#define LUA_OPBOR	5
+#define LUA_OPBXOR	6
+#define LUA_OPLSHIFT	7	/* binary */
+#define LUA_OPRSHIFT	8
+#define LUA_OPARSHIFT	9
+#define LUA_OPROL	10
+#define LUA_OPROR	11
+
+LUA_API void (lua_bitop) (lua_State *L, int op, int n);
+LUA_API void (lua_setbitop) (lua_State *L, int idx, int op);
+
+/* leaf C functions: called from Lua without a frame of their own */
+LUA_API void (lua_setleaf) (lua_State *L, int idx, int nargs);
+
+/* iterators that the generic `for' runs in place (lua_setiter) */
+#define LUA_ITERNEXT	1	/* next(t, k) */
+#define LUA_ITERIPAIRS	2	/* the iterator returned by ipairs(t) */
+
+LUA_API void (lua_setiter) (lua_State *L, int idx, int kind);
+
+/* pcall run by the VM itself when called from Lua (lua_setpcall) */
+LUA_API void (lua_setpcall) (lua_State *L, int idx);
+
+/* typed arrays: userdata of packed numbers that the VM indexes itself */
+#define LUA_AINT8	1
+#define LUA_AUINT8	2
+#define LUA_AINT16	3
+#define LUA_AUINT16	4
+#define LUA_AINT32	5
+#define LUA_AUINT32	6
+#define LUA_AFLOAT32	7
+#define LUA_AFLOAT64	8
+
+LUA_API void *(lua_newarray) (lua_State *L, int kind, size_t n);
+LUA_API void *(lua_toarray) (lua_State *L, int idx, int *kind, size_t *n);
+
 
 
 /* 
@@ -303,6 +462,9 @@ LUA_API void lua_setallocf (lua_State *L, lua_Alloc f, void *ud);
 /* 用指定的c函数构建一个closure到栈顶 */
 #define lua_pushcfunction(L,f)	lua_pushcclosure(L, (f), 0)
 
+#define lua_pushleaf(L,f,n) \
+	(lua_pushcfunction(L, (f)), lua_setleaf(L, -1, (n)))
+
 #define lua_strlen(L,i)		lua_objlen(L, (i))
 
 #define lua_isfunction(L,n)	(lua_type(L, (n)) == LUA_TFUNCTION)
@@ -390,6 +552,27 @@ LUA_API lua_Hook lua_gethook (lua_State *L);
 LUA_API int lua_gethookmask (lua_State *L);
 LUA_API int lua_gethookcount (lua_State *L);
 
+LUA_API int lua_setbudget (lua_State *L, int budget, lua_Budget f, void *ud);
+LUA_API int lua_getbudget (lua_State *L);
+
+LUA_API void lua_profbuffer (lua_State *L, int size);
+LUA_API void lua_profsample (lua_State *L);
+LUA_API int lua_profsamples (lua_State *L);
+LUA_API int lua_profframe (lua_State *L, int sample, int level,
+                           lua_Debug *ar);
+
+/* a site of the heap profiler (see LUA_GCHEAPSAMPLE) */
+typedef struct lua_HeapSite {
+  int type;  /* of the objects allocated there (LUA_TNONE: other blocks) */
+  int depth;  /* frames of its stack (see lua_heapframe) */
+  size_t inuse, inusebytes;  /* sampled blocks still live */
+  size_t allocs, allocbytes;  /* all sampled blocks */
+} lua_HeapSite;
+
+LUA_API int lua_heapsite (lua_State *L, int site, lua_HeapSite *hs);
+LUA_API int lua_heapframe (lua_State *L, int site, int level,
+                           lua_Debug *ar);
+
 
 struct lua_Debug {
   int event;
@@ -38,11 +38,15 @@
 #define LUA_USE_POSIX
 #define LUA_USE_DLOPEN		/* needs an extra library: -ldl */
 #define LUA_USE_READLINE	/* needs some extra libraries */
+#define LUA_USE_PTHREADS	/* needs an extra library: -lpthread */
+#define LUA_USE_EPOLL
 #endif
 
 #if defined(LUA_USE_MACOSX)
 #define LUA_USE_POSIX
 #define LUA_DL_DYLD		/* does not need extra library */
+#define LUA_USE_PTHREADS	/* does not need extra library */
+#define LUA_USE_KQUEUE
 #endif
 
 
@@ -57,9 +61,29 @@
 #define LUA_USE_ISATTY
 #define LUA_USE_POPEN
 #define LUA_USE_ULONGJMP
+#define LUA_USE_DIRENT
 #endif
 
 
+/*
+@@ LUA_USE_LOCK lets several OS threads run threads (coroutines) of one
+@* state at once, each thread in its own lua_State from lua_newthread.
+** CHANGE it (define it) if your host shares a state between threads.
+** It needs LUA_USE_PTHREADS. The state has one lock, taken by every API
+** call; Lua code holds it and gives it up in C functions and, when
+** another thread waits for it, at backward jumps (see luai_threadyield).
+** The stacks of threads never shrink in this build (see lgc.c).
+*/
+/* #define LUA_USE_LOCK */
+
+
+/*
+@@ LUA_USE_EPOLL and LUA_USE_KQUEUE pick the poller of the tasks of the
+@* io library (io.spawn and io.run); with neither, LUA_USE_POSIX uses
+@* poll, which is slower with many descriptors.
+*/
+
+
 /*
 @@ LUA_PATH and LUA_CPATH are the names of the environment variables that
 @* Lua check to set its paths.
@@ -316,6 +340,39 @@
 #define LUAI_GCMUL	200 /* GC runs 'twice the speed' of memory allocation */
 
 
+/*
+@@ LUAI_GCMAJOR defines the default growth of the heap, as a percentage
+@* of its size after the last major collection, that triggers a new
+@* major collection in generational mode.
+** CHANGE it if you want the generational collector to do full
+** collections more or less often.
+*/
+#define LUAI_GCMAJOR	200  /* 200% (wait heap to double before next major) */
+
+
+/*
+@@ LUAI_GCBUDGET is the default time budget of a collector step, in
+@* microseconds (0: steps do GCSTEPSIZE*stepmul units of work instead).
+@@ LUAI_GCGROWTH is the heap growth, as a percentage of the estimate of
+@* live data, past which budgeted steps fall back to work units.
+** CHANGE them (or use LUA_GCSETBUDGET) if your host has a latency
+** target; LUA_GCIDLE also gives the collector idle time.
+*/
+#define LUAI_GCBUDGET	0
+#define LUAI_GCGROWTH	400  /* 400% (heap four times the live data) */
+
+
+/*
+@@ LUAI_MARKTHREADS is the default number of threads that mark the heap
+@* in full collections (lua_gc with LUA_GCMARKTHREADS changes it).
+@@ LUAI_PARMARKMIN is the smallest heap (in bytes) marked in parallel.
+** CHANGE them if your host has cores to spare for the collector; with
+** 1 (or without LUA_USE_PTHREADS) marking stays on the calling thread.
+*/
+#define LUAI_MARKTHREADS	1
+#define LUAI_PARMARKMIN		(16*1024*1024)
+
+
 
 /*
 @@ LUA_COMPAT_GETN controls compatibility with old getn behavior.
@@ -385,6 +442,30 @@
 #endif
 
 
+/*
+@@ LUA_USE_JUMPTABLE makes the interpreter dispatch opcodes through a
+@* table of label addresses (computed gotos) instead of a 'switch'.
+** CHANGE it (undefine it) if your compiler has problems with the
+** "labels as values" extension or if you want to measure the plain
+** 'switch' dispatch. It is only available with GCC and compatible
+** compilers (such as Clang); other compilers always use the 'switch'.
+*/
+#if defined(__GNUC__) && !defined(LUA_ANSI)
+#define LUA_USE_JUMPTABLE
+#endif
+
+
+/*
+@@ LUA_USE_LINEARHASH lays out the hash part of tables for linear probing:
+@* keys in one array and values in another, instead of the chained
+@* nodes with their `next' pointers.
+** CHANGE it (define it) to try it on workloads heavy in string keys;
+** a lookup then scans neighbouring keys instead of following a chain
+** through scattered nodes, at the price of a lower load factor (3/4).
+*/
+/* #define LUA_USE_LINEARHASH */
+
+
 /*
 @@ LUAI_BITSINT defines the number of bits in an int.
 ** CHANGE here if Lua cannot automatically detect the number of bits of
@@ -449,6 +530,23 @@
 #define LUAI_MAXCSTACK	8000
 
 
+/*
+@@ LUAI_THREADSTACK is the initial stack size of coroutines.
+** CHANGE it to trade memory per coroutine for fewer stack reallocations.
+** (the main thread starts with 2*LUA_MINSTACK; this must be at least
+** LUA_MINSTACK+2, the room given to the first C call)
+*/
+#define LUAI_THREADSTACK	(LUA_MINSTACK + 8)
+
+
+/*
+@@ LUAI_THREADCACHE is the number of dead coroutines each state keeps,
+@* with their stacks, to build new ones without allocating.
+** CHANGE it to 0 to free coroutines at once.
+*/
+#define LUAI_THREADCACHE	32
+
+
 
 /*
 ** {==================================================================
@@ -485,11 +583,45 @@
 #define LUAI_MAXUPVALUES	60
 
 
+/*
+@@ LUAI_PROFDEPTH is the number of frames kept by each sample of the
+@* sampling profiler (`lua_profsample'); deeper frames are dropped.
+*/
+#define LUAI_PROFDEPTH		32
+
+
 /*
 @@ LUAL_BUFFERSIZE is the buffer size used by the lauxlib buffer system.
 */
 #define LUAL_BUFFERSIZE		BUFSIZ
 
+
+/*
+@@ LUAL_CHUNKCACHE is how many compiled files `luaL_loadfile' keeps for
+@* the whole process, shared by all states (0 turns the cache off).
+** It tells a changed file by its stat data, so it needs LUA_USE_POSIX;
+** with LUA_USE_PTHREADS it can be used by states on several threads.
+*/
+#define LUAL_CHUNKCACHE		256
+
+
+/*
+@@ LUAL_IMAGEMIN is the smallest image (luac -i) that `luaL_loadfile'
+@* maps to use in place; smaller ones are read as usual.
+*/
+#define LUAL_IMAGEMIN		4096
+
+
+/*
+@@ LUAL_POOLMAX is the largest block served by the size classes of the
+@* pool allocator (`luaL_newpoolstate'); larger blocks go to malloc.
+@@ LUAL_POOLSLAB is the size of each slab the pool carves blocks from.
+** CHANGE them if your objects are larger or you want less slack. Both
+** must be multiples of 8.
+*/
+#define LUAL_POOLMAX		256
+#define LUAL_POOLSLAB		8192
+
 /* }================================================================== */
 
 
@@ -604,7 +736,8 @@ union luai_Cast { double l_d; long l_l; };
 ** or if want/don't to use _longjmp/_setjmp instead of regular
 ** longjmp/setjmp. By default, Lua handles errors with exceptions when
 ** compiling as C++ code, with _longjmp/_setjmp when asked to use them,
-** and with longjmp/setjmp otherwise.
+** and with longjmp/setjmp otherwise. A pcall of a Lua function from Lua
+** code sets no handler of its own (see luaD_vmpcall).
 */
 #if defined(__cplusplus)
 /* C++ exceptions */
@@ -636,6 +769,13 @@ union luai_Cast { double l_d; long l_l; };
 #define LUA_MAXCAPTURES		32
 
 
+/*
+@@ LUA_PATCACHESIZE is the number of compiled patterns the string
+@* library keeps per state (see getpattern in lstrlib.c).
+*/
+#define LUA_PATCACHESIZE	64
+
+
 /*
 @@ lua_tmpnam is the function that the OS library uses to create a
 @* temporary name.
@@ -731,6 +871,68 @@ union luai_Cast { double l_d; long l_l; };
 #define luai_userstateyield(L,n)	((void)L)
 
 
+/*
+@@ LUAI_HASHFULL makes new states hash the whole contents of every
+@* string with a per-state random seed, instead of sampling the bytes
+@* of long strings. Each state can still change it with `lua_hashmode'.
+** CHANGE it (define it) if your long strings share long prefixes or
+** come from untrusted clients (hash flooding).
+@@ luai_makeseed gives the random part of the seed of each state.
+** CHANGE it (define it) if you have a better source of randomness than
+** `time' (the default in lstate.c).
+*/
+/* #define LUAI_HASHFULL */
+/* #define luai_makeseed()	... */
+
+
+/*
+@@ LUAI_OPTIMIZE makes new states run the optimizing pass of the
+@* compiler (see luaK_optimize in lcode.c) on every chunk they load
+@* from source. Each state can still change it with `lua_optimize'.
+** CHANGE it (define it) if you do not need the exact code of the
+** plain compiler (the pass keeps the debug information consistent,
+** but values of dead temporaries are gone).
+*/
+/* #define LUAI_OPTIMIZE */
+
+
+/*
+@@ LUAI_INTSUBTYPE keeps numbers with an `int' value as ints (see
+@* LUA_TNUMINT in lobject.h): arithmetic on them stays in ints while
+@* the result fits, and numeric `for' loops and array indexing skip the
+@* conversions. Scripts see no difference, as every int is exactly a
+@* lua_Number.
+** CHANGE it (define it) if lua_Number is a double and your scripts do
+** mostly integer work.
+*/
+/* #define LUAI_INTSUBTYPE */
+
+
+/*
+@@ LUAI_CLOSURECACHE lets a function expression give back the closure
+@* it made last time when that one has the same upvalues and environment
+@* (see OP_CLOSURE in lvm.c), for the expressions the parser proves do
+@* not escape: a local helper that is only called, declared in a loop
+@* and capturing locals of its function, then allocates nothing. Other
+@* closures (callbacks passed to `table.sort' or `gsub') are new each
+@* time, as Lua 5.1 wants; test/closures.lua checks that.
+** CHANGE it (undefine it) if you want the reuse out even where only
+** the debug library could tell (debug.getlocal, debug.getinfo "f").
+*/
+#define LUAI_CLOSURECACHE
+
+
+/*
+@@ LUAI_STATS keeps counters of the hot paths in each state (see
+@* lua_Stats in lua.h): string interning hits and misses, table
+@* rehashes, stack and CallInfo growth, __index/__newindex fallbacks and
+@* concatenation. Read them with `lua_stats' or `debug.stats'.
+** CHANGE it (define it) to find out where the time of a slow build
+** goes; each count is an add to a field of the global state.
+*/
+/* #define LUAI_STATS */
+
+
 /*
 @@ LUA_INTFRMLEN is the length modifier for integer conversions
 @* in 'string.format'.
@@ -14,6 +14,24 @@
 /* Key to file-handle type */
 #define LUA_FILEHANDLE		"FILE*"
 
+/* Key to mapped-file type */
+#define LUA_MMAPHANDLE		"MMAP*"
+
+/* Key to file-writer type */
+#define LUA_WRITERHANDLE	"WRITER*"
+
+/* Key to the cache of compiled patterns of the string library */
+#define LUA_PATCACHE		"_PATCACHE"
+
+/* Key to the task scheduler of the io library */
+#define LUA_SCHEDULER		"_SCHEDULER"
+
+/* Key to channel-handle type */
+#define LUA_CHANHANDLE		"CHANNEL*"
+
+/* Key to the metatable of typed arrays */
+#define LUA_ARRAYHANDLE		"ARRAY*"
+
 
 #define LUA_COLIBNAME	"coroutine"
 LUALIB_API int (luaopen_base) (lua_State *L);
@@ -39,6 +57,15 @@ LUALIB_API int (luaopen_debug) (lua_State *L);
 #define LUA_LOADLIBNAME	"package"
 LUALIB_API int (luaopen_package) (lua_State *L);
 
+#define LUA_CHANLIBNAME	"chan"
+LUALIB_API int (luaopen_chan) (lua_State *L);
+
+#define LUA_BITLIBNAME	"bit"
+LUALIB_API int (luaopen_bit) (lua_State *L);
+
+#define LUA_ARRAYLIBNAME	"array"
+LUALIB_API int (luaopen_array) (lua_State *L);
+
 
 /* open all previous libraries */
 LUALIB_API void (luaL_openlibs) (lua_State *L); 
@@ -11,6 +11,7 @@
 
 #include "lua.h"
 
+#include "lcode.h"
 #include "ldebug.h"
 #include "ldo.h"
 #include "lfunc.h"
@@ -25,6 +26,11 @@ typedef struct {
  ZIO* Z;
  Mbuffer* b;
  const char* name;
+ int mode;				/* LUAU_* */
+ int image;				/* LUAC_FORMAT_IMAGE chunk */
+ int lazy;				/* LUAC_FORMAT_LAZYDEBUG chunk */
+ int noescape;				/* LUAC_FORMAT_NOESCAPE chunk */
+ size_t pos;				/* bytes read so far */
 } LoadState;
 
 #ifdef LUAC_TRUST_BINARIES
@@ -49,6 +55,24 @@ static void LoadBlock(LoadState* S, void* b, size_t size)
 {
  size_t r=luaZ_read(S->Z,b,size);
  IF (r!=0, "unexpected end");
+ S->pos+=size;
+}
+
+static void LoadAlign(LoadState* S)
+{
+ char pad[LUAC_IMAGEALIGN];
+ if (S->image && S->pos%LUAC_IMAGEALIGN!=0)
+  LoadBlock(S,pad,LUAC_IMAGEALIGN-S->pos%LUAC_IMAGEALIGN);
+}
+
+/* an aligned array of an image, used in place; NULL to copy it instead */
+static void* LoadInPlace(LoadState* S, size_t size)
+{
+ const char* p;
+ if (!S->image || !(S->mode & LUAU_INPLACE) || size==0) return NULL;
+ p=luaZ_inplace(S->Z,size,LUAC_IMAGEALIGN);
+ if (p!=NULL) S->pos+=size;
+ return (void*)p;
 }
 
 static int LoadChar(LoadState* S)
@@ -90,6 +114,14 @@ static TString* LoadString(LoadState* S)
 static void LoadCode(LoadState* S, Proto* f)
 {
  int n=LoadInt(S);
+ LoadAlign(S);
+ f->code=(Instruction*)LoadInPlace(S,n*sizeof(Instruction));
+ if (f->code!=NULL)
+ {
+  f->inimage|=PROTO_CODEIMG;
+  f->sizecode=n;
+  return;
+ }
  f->code=luaM_newvector(S->L,n,Instruction);
  f->sizecode=n;
  LoadVector(S,f->code,n,sizeof(Instruction));
@@ -117,7 +149,7 @@ static void LoadConstants(LoadState* S, Proto* f)
    	setbvalue(o,LoadChar(S)!=0);
 	break;
    case LUA_TNUMBER:
-	setnvalue(o,LoadNumber(S));
+	setnumvalue(o,LoadNumber(S));
 	break;
    case LUA_TSTRING:
 	setsvalue2n(S->L,o,LoadString(S));
@@ -138,9 +170,19 @@ static void LoadDebug(LoadState* S, Proto* f)
 {
  int i,n;
  n=LoadInt(S);
- f->lineinfo=luaM_newvector(S->L,n,int);
- f->sizelineinfo=n;
- LoadVector(S,f->lineinfo,n,sizeof(int));
+ LoadAlign(S);
+ f->lineinfo=(int*)LoadInPlace(S,n*sizeof(int));
+ if (f->lineinfo!=NULL)
+ {
+  f->inimage|=PROTO_LINEIMG;
+  f->sizelineinfo=n;
+ }
+ else
+ {
+  f->lineinfo=luaM_newvector(S->L,n,int);
+  f->sizelineinfo=n;
+  LoadVector(S,f->lineinfo,n,sizeof(int));
+ }
  n=LoadInt(S);
  f->locvars=luaM_newvector(S->L,n,LocVar);
  f->sizelocvars=n;
@@ -171,30 +213,60 @@ static Proto* LoadFunction(LoadState* S, TString* p)
  f->numparams=LoadByte(S);
  f->is_vararg=LoadByte(S);
  f->maxstacksize=LoadByte(S);
+ if (S->noescape) f->noescape=LoadByte(S);
  LoadCode(S,f);
  LoadConstants(S,f);
  LoadDebug(S,f);
- IF (!luaG_checkcode(f), "bad code");
+ IF (!(S->mode & LUAU_TRUSTED) && !luaG_checkcode(f), "bad code");
+ if (!(f->inimage & PROTO_CODEIMG))
+  luaK_fuse(f);				/* code of an image is read-only */
  S->L->top--;
  S->L->nCcalls--;
  return f;
 }
 
+/* give f and the functions under it the debug section, in dump order */
+static void SetDebugSection(Proto* f, TString* sec, int* idx)
+{
+ int i;
+ f->debugsec=sec;
+ f->debugidx=(*idx)++;
+ for (i=0; i<f->sizep; i++) SetDebugSection(f->p[i],sec,idx);
+}
+
+static void LoadLazyDebug(LoadState* S, Proto* f)
+{
+ TString* sec;
+ int idx=0;
+ setptvalue2s(S->L,S->L->top,f); incr_top(S->L);
+ sec=LoadString(S);
+ if (sec!=NULL) SetDebugSection(f,sec,&idx);
+ S->L->top--;
+}
+
 static void LoadHeader(LoadState* S)
 {
  char h[LUAC_HEADERSIZE];
  char s[LUAC_HEADERSIZE];
+ int format;
  luaU_header(h);
  LoadBlock(S,s,LUAC_HEADERSIZE);
+ format=(unsigned char)s[sizeof(LUA_SIGNATURE)];
+ S->image=(format & LUAC_FORMAT_IMAGE)!=0;
+ S->lazy=(format & LUAC_FORMAT_LAZYDEBUG)!=0;
+ S->noescape=(format & LUAC_FORMAT_NOESCAPE)!=0;
+ if ((format & ~(LUAC_FORMAT_IMAGE|LUAC_FORMAT_LAZYDEBUG|LUAC_FORMAT_NOESCAPE))==0)
+  s[sizeof(LUA_SIGNATURE)]=(char)LUAC_FORMAT;
  IF (memcmp(h,s,LUAC_HEADERSIZE)!=0, "bad header");
 }
 
 /*
 ** load precompiled chunk
 */
-Proto* luaU_undump (lua_State* L, ZIO* Z, Mbuffer* buff, const char* name)
+Proto* luaU_undump (lua_State* L, ZIO* Z, Mbuffer* buff, const char* name, int mode)
 {
  LoadState S;
+ Proto* f;
  if (*name=='@' || *name=='=')
   S.name=name+1;
  else if (*name==LUA_SIGNATURE[0])
@@ -204,8 +276,15 @@ Proto* luaU_undump (lua_State* L, ZIO* Z, Mbuffer* buff, const char* name)
  S.L=L;
  S.Z=Z;
  S.b=buff;
+ S.mode=mode;
+ S.image=0;
+ S.lazy=0;
+ S.noescape=0;
+ S.pos=0;
  LoadHeader(&S);
- return LoadFunction(&S,luaS_newliteral(L,"=?"));
+ f=LoadFunction(&S,luaS_newliteral(L,"=?"));
+ if (S.lazy) LoadLazyDebug(&S,f);
+ return f;
 }
 
 /*
@@ -11,13 +11,13 @@
 #include "lzio.h"
 
 /* load one chunk; from lundump.c */
-LUAI_FUNC Proto* luaU_undump (lua_State* L, ZIO* Z, Mbuffer* buff, const char* name);
+LUAI_FUNC Proto* luaU_undump (lua_State* L, ZIO* Z, Mbuffer* buff, const char* name, int mode);
 
 /* make header; from lundump.c */
 LUAI_FUNC void luaU_header (char* h);
 
 /* dump one chunk; from ldump.c */
-LUAI_FUNC int luaU_dump (lua_State* L, const Proto* f, lua_Writer w, void* data, int strip);
+LUAI_FUNC int luaU_dump (lua_State* L, const Proto* f, lua_Writer w, void* data, int strip, int image);
 
 #ifdef luac_c
 /* print one chunk; from print.c */
@@ -30,6 +30,27 @@ LUAI_FUNC void luaU_print (const Proto* f, int full);
 /* for header of binary files -- this is the official format */
 #define LUAC_FORMAT		0
 
+/* the same, with code and line info aligned to be used in place */
+#define LUAC_FORMAT_IMAGE	LUA_IMAGEFORMAT
+
+/* flag of the format byte: debug information in a section at the end */
+#define LUAC_FORMAT_LAZYDEBUG	2
+
+/* flag of the format byte: a function has a `noescape' byte after
+   maxstacksize (only set when one of them is set, so that other chunks
+   keep the official format) */
+#define LUAC_FORMAT_NOESCAPE	4
+
+/* alignment (from the start of the chunk) of those arrays in an image */
+#define LUAC_IMAGEALIGN		8
+
+/* modes of luaU_undump */
+#define LUAU_TRUSTED	1	/* made by lua_dump here: skip luaG_checkcode */
+#define LUAU_INPLACE	2	/* the chunk is one block that outlives it */
+
+/* strip level of luaU_dump: keep the source, move the rest to the section */
+#define LUAU_STRIPLAZY	2
+
 /* size of header of binary files */
 #define LUAC_HEADERSIZE		12
 
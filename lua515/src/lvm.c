@@ -27,6 +27,12 @@
 #include "lvm.h"
 
 
+#if defined(LUA_USE_JUMPTABLE) && defined(__GNUC__) && !defined(__clang__)
+/* keep one indirect jump per opcode handler (see ljumptab.h) */
+#pragma GCC optimize ("no-crossjumping")
+#endif
+
+
 
 /* limit for table tag-method chains (to avoid loops) */
 #define MAXTAGLOOP	100
@@ -68,12 +74,16 @@ static void traceexec (lua_State *L, const Instruction *pc) {
   if (mask & LUA_MASKLINE) {	/* LUA_MASKLINE不是说执行到了某一行，具体的意思看下面的代码 */
     Proto *p = ci_func(L->ci)->l.p;
     int npc = pcRel(pc, p);
-    int newline = getline(p, npc);
+    int newline;
+    luaG_needdebug(L, p);
+    newline = getline(p, npc);
     /* call linehook when enter a new function, when jump back (loop),
        or when enter a new line */
     if (npc == 0 || pc <= oldpc || newline != getline(p, pcRel(oldpc, p)))
       luaD_callhook(L, LUA_HOOKLINE, newline);
   }
+  if ((mask & MASKBUDGET) && L->status != LUA_YIELD)
+    luaD_budget(L);
 }
 
 /* 调用元方法，将结果返回给res */
@@ -105,6 +115,82 @@ static void callTM (lua_State *L, const TValue *f, const TValue *p1,
 }
 
 
+/* a number wrapped around to 32 bits; fractions are dropped (floor) */
+static LUAI_UINT32 tobits (const TValue *o) {
+  lua_Number n;
+  if (ttisint(o))
+    return cast(LUAI_UINT32, ivalue(o));
+  n = nvalue(o);
+  if (n >= -2147483648.0 && n < 2147483648.0) {
+    int i = cast_int(n);
+    return cast(LUAI_UINT32, i - (cast_num(i) > n));
+  }
+  n = fmod(floor(n), 4294967296.0);
+  if (n != n)  /* nan or inf? */
+    return 0;
+  return cast(LUAI_UINT32, n < 0 ? n + 4294967296.0 : n);
+}
+
+
+/*
+** Typed arrays (lua_newarray)
+*/
+
+/* element `key' of typed array `a'; NULL if `key' is not an index of it */
+static void *arrayslot (const TValue *a, const TValue *key) {
+  Udata *u = rawuvalue(a);
+  int shift = luaO_ashift[u->uv.akind];
+  size_t i;
+  if (ttisint(key))
+    i = cast(size_t, ivalue(key)) - 1;
+  else if (ttisnumber(key)) {
+    lua_Number n = nvalue(key);
+    int k;
+    lua_number2int(k, n);
+    if (!luai_numeq(cast_num(k), n)) return NULL;
+    i = cast(size_t, k) - 1;
+  }
+  else return NULL;
+  if (i >= u->uv.len >> shift) return NULL;
+  return cast(char *, u + 1) + (i << shift);
+}
+
+
+static int arrayget (const TValue *a, const TValue *key, StkId val) {
+  void *p = arrayslot(a, key);
+  if (p == NULL) return 0;
+  switch (uvalue(a)->akind) {
+    case LUA_AINT8: setivalue(val, *cast(signed char *, p)); break;
+    case LUA_AUINT8: setivalue(val, *cast(unsigned char *, p)); break;
+    case LUA_AINT16: setivalue(val, *cast(short *, p)); break;
+    case LUA_AUINT16: setivalue(val, *cast(unsigned short *, p)); break;
+    case LUA_AINT32: setivalue(val, *cast(int *, p)); break;
+    case LUA_AUINT32: setnumvalue(val, cast_num(*cast(unsigned int *, p))); break;
+    case LUA_AFLOAT32: setnumvalue(val, cast_num(*cast(float *, p))); break;
+    default: setnumvalue(val, cast_num(*cast(double *, p))); break;
+  }
+  return 1;
+}
+
+
+/* integer elements wrap around like the bit library; floats are rounded */
+static int arrayset (const TValue *a, const TValue *key, const TValue *v) {
+  void *p;
+  if (!ttisnumber(v) || (p = arrayslot(a, key)) == NULL) return 0;
+  switch (uvalue(a)->akind) {
+    case LUA_AINT8: case LUA_AUINT8:
+      *cast(unsigned char *, p) = cast(unsigned char, tobits(v)); break;
+    case LUA_AINT16: case LUA_AUINT16:
+      *cast(unsigned short *, p) = cast(unsigned short, tobits(v)); break;
+    case LUA_AINT32: case LUA_AUINT32:
+      *cast(unsigned int *, p) = cast(unsigned int, tobits(v)); break;
+    case LUA_AFLOAT32: *cast(float *, p) = cast(float, nvalue(v)); break;
+    default: *cast(double *, p) = cast(double, nvalue(v)); break;
+  }
+  return 1;
+}
+
+
 void luaV_gettable (lua_State *L, const TValue *t, TValue *key, StkId val) {
   int loop;
   for (loop = 0; loop < MAXTAGLOOP; loop++) {
@@ -119,8 +205,11 @@ void luaV_gettable (lua_State *L, const TValue *t, TValue *key, StkId val) {
       }
       /* else will try the tag method */
     }
+    else if (ttisarray(t) && arrayget(t, key, val))
+      return;
     else if (ttisnil(tm = luaT_gettmbyobj(L, t, TM_INDEX)))
       luaG_typeerror(L, t, "index");
+    luai_stat(L, indexmeta, 1);
     if (ttisfunction(tm)) {
       callTMres(L, val, tm, t, key);
       return;
@@ -148,8 +237,11 @@ void luaV_settable (lua_State *L, const TValue *t, TValue *key, StkId val) {
       }
       /* else will try the tag method */
     }
+    else if (ttisarray(t) && arrayset(t, key, val))
+      return;
     else if (ttisnil(tm = luaT_gettmbyobj(L, t, TM_NEWINDEX)))
       luaG_typeerror(L, t, "index");
+    luai_stat(L, newindexmeta, 1);
     if (ttisfunction(tm)) {
       callTM(L, tm, t, key, val);
       return;
@@ -161,6 +253,103 @@ void luaV_settable (lua_State *L, const TValue *t, TValue *key, StkId val) {
   luaG_runerror(L, "loop in settable");
 }
 
+/*
+** {======================================================
+** Inline caches for constant string keys
+** =======================================================
+*/
+
+static ICache *newicache (lua_State *L, Proto *p) {
+  int n;
+  ICache *ic = luaM_newvector(L, p->sizecode, ICache);
+  for (n = 0; n < p->sizecode; n++) {
+    ic[n].mt = ic[n].h = NULL;
+    ic[n].slot = ic[n].mslot = 0;
+  }
+  p->icache = ic;
+  return ic;
+}
+
+
+/* value of `key' if it is still at node `slot' of `h', NULL otherwise */
+static const TValue *icfield (const Table *h, int slot, const TString *key) {
+  if (slot < sizenode(h)) {
+    const Node *n = gnode(h, slot);
+    if (ttisstring(gkey(n)) && rawtsvalue(gkey(n)) == key)
+      return gnval(h, slot);
+  }
+  return NULL;
+}
+
+
+/*
+** same as `luaV_gettable(L, t, key, val)' for a string constant `key';
+** a hit avoids hashing `key' in the `__index' table and looking up the
+** `__index' metamethod
+*/
+static void gettablestr (lua_State *L, ICache *ic, const TValue *t,
+                         TValue *key, StkId val) {
+  if (ttistable(t)) {
+    Table *h = hvalue(t);
+    Table *mt = h->metatable;
+    TString *ks = rawtsvalue(key);
+    const TValue *res;
+    if (ic->mt == NULL) {  /* cached field of `h' itself? */
+      res = icfield(h, ic->slot, ks);
+      if (res != NULL && !ttisnil(res)) {
+        setobj2s(L, val, res);
+        return;
+      }
+    }
+    res = luaH_getstr(h, ks);
+    if (!ttisnil(res)) {
+      ic->mt = NULL;
+      ic->slot = nodeslot(h, res);
+      setobj2s(L, val, res);
+      return;
+    }
+    if (mt == NULL) {  /* no metatable: result is nil */
+      setnilvalue(val);
+      return;
+    }
+    if (mt == ic->mt) {  /* cached field of `mt.__index'? */
+      const TValue *tm = icfield(mt, ic->mslot, G(L)->tmname[TM_INDEX]);
+      if (tm != NULL && ttistable(tm) && hvalue(tm) == ic->h) {
+        res = icfield(ic->h, ic->slot, ks);
+        if (res != NULL && !ttisnil(res)) {
+          luai_stat(L, indexmeta, 1);
+          setobj2s(L, val, res);
+          return;
+        }
+      }
+    }
+    {  /* miss: look up `__index' and refill the cache */
+      const TValue *tm = fasttm(L, mt, TM_INDEX);
+      if (tm == NULL) {  /* no `__index': result is nil */
+        setnilvalue(val);
+        return;
+      }
+      if (ttistable(tm)) {
+        Table *idx = hvalue(tm);
+        res = luaH_getstr(idx, ks);
+        if (!ttisnil(res)) {
+          ic->mt = mt;
+          ic->mslot = nodeslot(mt, tm);
+          ic->h = idx;
+          ic->slot = nodeslot(idx, res);
+          luai_stat(L, indexmeta, 1);
+          setobj2s(L, val, res);
+          return;
+        }
+      }
+    }
+  }
+  luaV_gettable(L, t, key, val);  /* any other case */
+}
+
+/* }====================================================== */
+
+
 /* 同上callTM，针对tblA+tblB这种两个操作数的，尝试调用特定元方法 */
 static int call_binTM (lua_State *L, const TValue *p1, const TValue *p2,
                        StkId res, TMS event) {
@@ -224,7 +413,9 @@ static int l_strcmp (const TString *ls, const TString *rs) {
 /* 比较指令 */
 int luaV_lessthan (lua_State *L, const TValue *l, const TValue *r) {
   int res;
-  if (ttype(l) != ttype(r))
+  if (ttisint(l) && ttisint(r))
+    return ivalue(l) < ivalue(r);
+  else if (ttype(l) != ttype(r))
     return luaG_ordererror(L, l, r);
   else if (ttisnumber(l))
     return luai_numlt(nvalue(l), nvalue(r));
@@ -238,7 +429,9 @@ int luaV_lessthan (lua_State *L, const TValue *l, const TValue *r) {
 
 static int lessequal (lua_State *L, const TValue *l, const TValue *r) {
   int res;
-  if (ttype(l) != ttype(r))
+  if (ttisint(l) && ttisint(r))
+    return ivalue(l) <= ivalue(r);
+  else if (ttype(l) != ttype(r))
     return luaG_ordererror(L, l, r);
   else if (ttisnumber(l))
     return luai_numle(nvalue(l), nvalue(r));
@@ -307,6 +500,8 @@ void luaV_concat (lua_State *L, int total, int last) {
         tl += l;
       }
       setsvalue2s(L, top-n, luaS_newlstr(L, buffer, tl));
+      luai_stat(L, concats, 1);
+      luai_stat(L, concatbytes, tl);
     }
     total -= n-1;  /* got `n' strings to create 1 new */
     last -= n-1;
@@ -314,6 +509,78 @@ void luaV_concat (lua_State *L, int total, int last) {
 }
 
 
+/*
+** writes number `n' at `s' as `lua_number2str' would; returns its length.
+** integers in the range of an int skip `sprintf' (except -0)
+*/
+static size_t number2buff (char *s, lua_Number n) {
+  int k;
+  lua_number2int(k, n);
+  if (luai_numeq(cast_num(k), n) && (k != 0 || luai_numlt(0, 1/n))) {
+    char digits[LUAI_BITSINT/3 + 2];
+    unsigned int u = (k < 0) ? 0u - cast(unsigned int, k) : cast(unsigned int, k);
+    int p = sizeof(digits);
+    size_t l;
+    do {
+      digits[--p] = cast(char, '0' + u % 10);
+    } while ((u /= 10) != 0);
+    if (k < 0) digits[--p] = '-';
+    l = sizeof(digits) - p;
+    memcpy(s, digits + p, l);
+    return l;
+  }
+  lua_number2str(s, n);
+  return strlen(s);
+}
+
+
+/*
+** concatenation of t[i..j] with `sep' between them, for `table.concat':
+** when they all are strings or numbers in the array part of `t', they
+** are copied into one buffer sized on a first pass, and the result is
+** made with a single `luaS_newlstr'. Returns NULL, having done nothing,
+** when some element is not there or is of another type.
+*/
+TString *luaV_concatarray (lua_State *L, Table *t, const char *sep,
+                           size_t lsep, int i, int j) {
+  size_t tl = 0;
+  char *buffer;
+  int k;
+  if (i < 1 || j > t->sizearray) return NULL;
+  for (k = i-1; k < j; k++) {  /* collect total length */
+    const TValue *o = &t->array[k];
+    size_t l;
+    if (ttisstring(o)) l = tsvalue(o)->len;
+    else if (ttisnumber(o)) l = LUAI_MAXNUMBER2STR;
+    else return NULL;
+    if (l >= MAX_SIZET - tl) luaG_runerror(L, "string length overflow");
+    tl += l;
+  }
+  if (lsep > 0) {
+    if (cast(size_t, j-i) >= (MAX_SIZET - tl) / lsep)
+      luaG_runerror(L, "string length overflow");
+    tl += cast(size_t, j-i) * lsep;
+  }
+  buffer = luaZ_openspace(L, &G(L)->buff, tl);
+  tl = 0;
+  for (k = i-1; k < j; k++) {
+    const TValue *o = &t->array[k];
+    if (k >= i && lsep > 0) {
+      memcpy(buffer+tl, sep, lsep);
+      tl += lsep;
+    }
+    if (ttisstring(o)) {
+      memcpy(buffer+tl, svalue(o), tsvalue(o)->len);
+      tl += tsvalue(o)->len;
+    }
+    else
+      tl += number2buff(buffer+tl, nvalue(o));
+  }
+  luai_stat(L, concats, 1);
+  luai_stat(L, concatbytes, tl);
+  return luaS_newlstr(L, buffer, tl);
+}
+
 static void Arith (lua_State *L, StkId ra, const TValue *rb,
                    const TValue *rc, TMS op) {
   TValue tempb, tempc;
@@ -337,12 +604,158 @@ static void Arith (lua_State *L, StkId ra, const TValue *rb,
 }
 
 
+#if defined(LUAI_INTSUBTYPE)
+/*
+** can a numeric `for' count in ints? Its index goes from init-step to
+** at most limit+step
+*/
+#define intfor(init,limit,step) \
+	((step) >= 0 ? (init) >= INT_MIN + (step) && (limit) <= INT_MAX - (step) \
+	             : (init) <= INT_MAX + (step) && (limit) >= INT_MIN - (step))
+
+
+/*
+** `a op b' for two ints; 0 (and `ra' untouched) when the result is not
+** an int (overflow, fraction or -0), for the lua_Number path to take it
+*/
+static int intarith (TValue *ra, int a, int b, TMS op) {
+  int r;
+  switch (op) {
+    case TM_ADD: {
+      r = cast_int(cast(unsigned int, a) + cast(unsigned int, b));
+      if (((r ^ a) & (r ^ b)) < 0) return 0;
+      break;
+    }
+    case TM_SUB: {
+      r = cast_int(cast(unsigned int, a) - cast(unsigned int, b));
+      if (((a ^ b) & (r ^ a)) < 0) return 0;
+      break;
+    }
+    case TM_MUL: {
+      lua_Number n;
+      if (-46340 <= a && a <= 46340 && -46340 <= b && b <= 46340)
+        r = a * b;
+      else {  /* exact as a lua_Number when it fits an int */
+        n = cast_num(a) * cast_num(b);
+        if (n < -2147483648.0 || n > 2147483647.0) return 0;
+        r = cast_int(n);
+      }
+      if (r == 0 && (a | b) < 0) return 0;  /* -0 */
+      break;
+    }
+    case TM_DIV: {
+      if (b == 0 || (b == -1 && a == INT_MIN) || a % b != 0 || (a == 0 && b < 0))
+        return 0;
+      r = a / b;
+      break;
+    }
+    case TM_MOD: {
+      if (b == 0) return 0;
+      if (b == -1) r = 0;  /* INT_MIN % -1 may trap */
+      else {
+        r = a % b;
+        if (r != 0 && (r ^ b) < 0) r += b;  /* a - floor(a/b)*b */
+      }
+      break;
+    }
+    case TM_UNM: {
+      if (a == 0 || a == INT_MIN) return 0;  /* -0 or overflow */
+      r = -a;
+      break;
+    }
+    default: return 0;
+  }
+  setivalue(ra, r);
+  return 1;
+}
+#else
+#define intfor(init,limit,step)	0
+#define intarith(ra,a,b,op)	0
+#endif
+
+
+/*
+** bit operation `op' on the `n' numbers at `a' (lua_bitop); the result
+** is the signed value of its 32 bits
+*/
+int luaV_bitop (int op, const TValue *a, int n) {
+  LUAI_UINT32 x = tobits(a), s;
+  switch (op) {
+    case LUA_OPTOBIT: break;
+    case LUA_OPBNOT: x = ~x; break;
+    case LUA_OPBSWAP:
+      x = (x >> 24) | ((x >> 8) & 0xff00) | ((x & 0xff00) << 8) | (x << 24);
+      break;
+    case LUA_OPBAND: while (--n > 0) x &= tobits(++a); break;
+    case LUA_OPBOR: while (--n > 0) x |= tobits(++a); break;
+    case LUA_OPBXOR: while (--n > 0) x ^= tobits(++a); break;
+    default: {
+      lua_assert(LUA_OPLSHIFT <= op && op <= LUA_OPROR && n >= 2);
+      s = tobits(a + 1) & 31;
+      switch (op) {
+        case LUA_OPLSHIFT: x <<= s; break;
+        case LUA_OPRSHIFT: x >>= s; break;
+        case LUA_OPARSHIFT: x = (x & 0x80000000) ? ~(~x >> s) : x >> s; break;
+        case LUA_OPROL: x = (x << s) | (x >> ((32 - s) & 31)); break;
+        case LUA_OPROR: x = (x >> s) | (x << ((32 - s) & 31)); break;
+      }
+    }
+  }
+  return cast_int(x);
+}
+
+
+/*
+** run in place the bit operation that the C function at `ra' stands for
+** (lua_setbitop) if its `n' arguments are numbers; otherwise the
+** function is called, to convert them or raise the error
+*/
+static int bitcall (StkId ra, int n) {
+  int op = clvalue(ra)->c.bitop, i;
+  if (op < LUA_OPBAND)
+    n = 1;
+  else if (op >= LUA_OPLSHIFT) {
+    if (n < 2) return 0;
+    n = 2;
+  }
+  for (i = 1; i <= n; i++)
+    if (!ttisnumber(ra + i)) return 0;
+  setivalue(ra, luaV_bitop(op, ra + 1, n));
+  return 1;
+}
+
+
+#if defined(LUAI_CLOSURECACHE)
+/*
+** the last closure made of `p' if the pseudo-instructions at `pc' would
+** give a new one the same upvalues (and `cl' the same environment); an
+** upvalue still open on the slot of an OP_MOVE is that slot's upvalue,
+** so no search of `openupval' is needed. Only functions the parser
+** marked `noescape' cache a closure: the old one is then out of reach,
+** so no one can tell it from a new one
+*/
+static Closure *getcached (Proto *p, LClosure *cl, StkId base,
+                           const Instruction *pc) {
+  Closure *c = p->cache;
+  int j;
+  if (c == NULL || c->l.env != cl->env) return NULL;
+  for (j = 0; j < p->nups; j++, pc++) {
+    UpVal *uv = c->l.upvals[j];
+    if (GET_OPCODE(*pc) == OP_GETUPVAL ? uv != cl->upvals[GETARG_B(*pc)]
+                                       : uv->v != base + GETARG_B(*pc))
+      return NULL;
+  }
+  return c;
+}
+#endif
+
+
 
 /*
 ** some macros for common tasks in `luaV_execute'
 */
 
-#define runtime_check(L, c)	{ if (!(c)) break; }
+#define runtime_check(L, c)	{ if (!(c)) vmbreak; }
 
 /* 提取指令中A,B,C的值 */
 #define RA(i)	(base+GETARG_A(i))
@@ -354,9 +767,41 @@ static void Arith (lua_State *L, StkId ra, const TValue *rb,
 #define RKC(i)	check_exp(getCMode(GET_OPCODE(i)) == OpArgK, \
 	ISK(GETARG_C(i)) ? k+INDEXK(GETARG_C(i)) : base+GETARG_C(i))
 #define KBx(i)	check_exp(getBMode(GET_OPCODE(i)) == OpArgK, k+GETARG_Bx(i))
+#define KC(i)	check_exp(ISK(GETARG_C(i)) && ttisnumber(k+INDEXK(GETARG_C(i))), \
+	k+INDEXK(GETARG_C(i)))
+
+
+/*
+** inline cache of the current instruction; a shared prototype is read
+** only, so it uses the small table of the state, indexed by address
+*/
+#define icache(L,p,pc) \
+	((p)->icache ? (p)->icache + pcRel(pc, p) : \
+	 ((p)->inimage & PROTO_SHARED) ? G(L)->icshared + \
+	   cast(size_t, pc) / sizeof(Instruction) % ICSHAREDSIZE : \
+	 newicache(L, p) + pcRel(pc, p))
+
 
+/*
+** only backward jumps yield the state lock: another thread may then move
+** this stack (luaD_reallocstack from its collector), so `base' is
+** reloaded and nothing computed from the old one may be used after it
+*/
+#define dojump(L,pc,i)	{ \
+    int j_ = (i); \
+    (pc) += j_; \
+    if (j_ < 0) { \
+      budgetstep(L); \
+      L->savedpc = pc; luai_threadyield(L); base = L->base; \
+    } \
+  }
 
-#define dojump(L,pc,i)	{(pc) += (i); luai_threadyield(L);}
+/*
+** one step of the instruction budget (lua_setbudget), at calls and
+** backward jumps: when it runs out, the next fetch goes to traceexec
+*/
+#define budgetstep(L) \
+  { if (--L->budget == 0) L->hookmask |= MASKBUDGET; }
 
 /* x可能触发新的frame，这里保存和恢复“部分现场”配合下面的execute一起看 
 ** pc:为何要存档呢？这是一个局部变量，且是相对frame有效，若切换execute则pc作为上一个execute的局部变量保存起来了，
@@ -365,11 +810,90 @@ static void Arith (lua_State *L, StkId ra, const TValue *rb,
 */
 #define Protect(x)	{ L->savedpc = pc; {x;}; base = L->base; }
 
+/*
+** is the call at `ra' a pcall of a Lua function that the VM can run
+** itself (luaD_vmpcall)? Not under hooks, nor at the C stack limit
+*/
+#define isvmpcall(L,ra) \
+  (ttisfunction(ra) && clvalue(ra)->c.pcall && L->top > (ra) + 1 && \
+   ttisfunction((ra) + 1) && !clvalue((ra) + 1)->c.isC && \
+   L->hookmask == 0 && L->nCcalls + 1 < LUAI_MAXCCALLS)
+
+
+/*
+** fetch the next instruction into `i', run the hooks and set `ra'
+*/
+#define vmfetch() { \
+    i = *pc++;	/* 等效：*(pc++) */ \
+    /* 运行钩子逻辑 */ \
+    if ((L->hookmask & (LUA_MASKLINE | LUA_MASKCOUNT | MASKBUDGET)) && \
+        (--L->hookcount == 0 || L->hookmask & (LUA_MASKLINE | MASKBUDGET))) { \
+      traceexec(L, pc); \
+      if (L->status == LUA_YIELD) {  /* did hook yield? */ \
+        L->savedpc = pc - 1; \
+        return 0; \
+      } \
+      base = L->base; \
+    } \
+    /* warning!! several(某些) calls may realloc the stack and invalidate `ra' */ \
+    ra = RA(i); \
+    lua_assert(base == L->base && L->base == L->ci->base); \
+    lua_assert(base <= L->top && L->top <= L->stack + L->stacksize); \
+    /* luaG_checkopenop的用途对照上面L->top的注释看就明白了 */ \
+    lua_assert(L->top == L->ci->top || luaG_checkopenop(i)); \
+  }
+
+/*
+** opcode dispatch; `ljumptab.h' redefines these for computed gotos
+*/
+#define vmdispatch(o)	switch (o)
+#define vmcase(l)	case l:
+#define vmbreak		continue
+
+
+/*
+** superinstructions (see luaK_fuse): after its own work the head of a
+** fused pair runs the next instruction through label `l', without the
+** dispatch and without the count hook. Line hooks must see every
+** instruction, so with them on the head acts as the plain opcode.
+*/
+#define vmfuse(l) { \
+    if (L->hookmask & LUA_MASKLINE) vmbreak; \
+    i = *pc++; \
+    ra = RA(i); \
+    goto l; \
+  }
+
+
 /* 这个宏有意思哈 */ 
 #define arith_op(op,tm) { \
         TValue *rb = RKB(i); \
         TValue *rc = RKC(i); \
-        if (ttisnumber(rb) && ttisnumber(rc)) { \
+        if (ttisflt(rb) && ttisflt(rc)) { \
+          lua_Number nb = fltvalue(rb), nc = fltvalue(rc); \
+          setnvalue(ra, op(nb, nc)); \
+        } \
+        else if (ttisint2(rb, rc) && \
+                 intarith(ra, ivalue(rb), ivalue(rc), tm)) {} \
+        else if (ttisnumber(rb) && ttisnumber(rc)) { \
+          lua_Number nb = nvalue(rb), nc = nvalue(rc); \
+          setnvalue(ra, op(nb, nc)); \
+        } \
+        else \
+          Protect(Arith(L, ra, rb, rc, tm)); \
+      }
+
+/* R(B) op number-constant: the constant needs no type check */
+#define arith_opk(op,tm) { \
+        TValue *rb = RB(i); \
+        TValue *rc = KC(i); \
+        if (ttisflt(rb)) { \
+          lua_Number nb = fltvalue(rb), nc = nvalue(rc); \
+          setnvalue(ra, op(nb, nc)); \
+        } \
+        else if (ttisint2(rb, rc) && \
+                 intarith(ra, ivalue(rb), ivalue(rc), tm)) {} \
+        else if (ttisnumber(rb)) { \
           lua_Number nb = nvalue(rb), nc = nvalue(rc); \
           setnvalue(ra, op(nb, nc)); \
         } \
@@ -386,11 +910,16 @@ static void Arith (lua_State *L, StkId ra, const TValue *rb,
 ** 某次Lua调用结束，--nexeccalls，如果nexeccalls==0，表示当前lua调用链结束了，需要跳出luaV_execute函数
 ** 大于0表示本Lua调用结束后，上一层必然还是Lua函数，需要进入reentry点
 */
-void luaV_execute (lua_State *L, int nexeccalls) {
+static int execute (lua_State *L, int nexeccalls, int protect) {
   LClosure *cl;
   StkId base;
   TValue *k;
   const Instruction *pc;
+  Instruction i;
+  StkId ra;
+#if defined(LUA_USE_JUMPTABLE)
+#include "ljumptab.h"
+#endif
   
  reentry:  /* entry point for new (callInfo,frame) */
   lua_assert(isLua(L->ci));	/* C函数frame的执行不在这里，亲! */
@@ -409,142 +938,184 @@ void luaV_execute (lua_State *L, int nexeccalls) {
   
   /* main loop of interpreter */
   for (;;) {
-    const Instruction i = *pc++;	/* 等效：*(pc++) */
-    StkId ra;
-   /* 运行钩子逻辑 */
-    if ((L->hookmask & (LUA_MASKLINE | LUA_MASKCOUNT)) &&
-        (--L->hookcount == 0 || L->hookmask & LUA_MASKLINE)) {
-      traceexec(L, pc);
-      if (L->status == LUA_YIELD) {  /* did hook yield? */
-        L->savedpc = pc - 1;
-        return;
-      }
-      base = L->base;
-    }
-    /* warning!! several(某些) calls may realloc the stack and invalidate `ra' */
-    ra = RA(i);
-    lua_assert(base == L->base && L->base == L->ci->base);
-    lua_assert(base <= L->top && L->top <= L->stack + L->stacksize);
-
-	/* luaG_checkopenop的用途对照上面L->top的注释看就明白了 */
-    lua_assert(L->top == L->ci->top || luaG_checkopenop(i));
-    switch (GET_OPCODE(i)) {
-      case OP_MOVE: {
+    vmfetch();
+    vmdispatch(GET_OPCODE(i)) {
+      vmcase(OP_MOVE) {
         setobjs2s(L, ra, RB(i));
-        continue;
+        vmbreak;
       }
-      case OP_LOADK: {
+      vmcase(OP_LOADK) {
         setobj2s(L, ra, KBx(i));
-        continue;
+        vmbreak;
       }
-      case OP_LOADBOOL: {
+      vmcase(OP_LOADBOOL) {
         setbvalue(ra, GETARG_B(i));
         if (GETARG_C(i)) pc++;  /* skip next instruction (if C) */
-        continue;
+        vmbreak;
       }
-      case OP_LOADNIL: {
+      vmcase(OP_LOADNIL) {
         TValue *rb = RB(i);
         do {
           setnilvalue(rb--);
         } while (rb >= ra);
-        continue;
+        vmbreak;
       }
-      case OP_GETUPVAL: {
+      vmcase(OP_GETUPVAL) {
         int b = GETARG_B(i);
         setobj2s(L, ra, cl->upvals[b]->v);
-        continue;
+        vmbreak;
       }
-      case OP_GETGLOBAL: {
+      vmcase(OP_GETGLOBAL) {
         TValue g;
         TValue *rb = KBx(i);
         sethvalue(L, &g, cl->env);
         lua_assert(ttisstring(rb));	/* 全局变量名类型必须是TString */
-        Protect(luaV_gettable(L, &g, rb, ra));
-        continue;
+        Protect(gettablestr(L, icache(L, cl->p, pc), &g, rb, ra));
+        vmbreak;
       }
-      case OP_GETTABLE: {
-        Protect(luaV_gettable(L, RB(i), RKC(i), ra));
-        continue;
+      vmcase(OP_GETTABLE) l_gettable: {
+        TValue *rc = RKC(i);
+        if (ttisint(rc) && ttistable(RB(i)) &&
+            cast(unsigned int, ivalue(rc)) - 1 <
+              cast(unsigned int, hvalue(RB(i))->sizearray) &&
+            !ttisnil(&hvalue(RB(i))->array[ivalue(rc) - 1]))
+          setobj2s(L, ra, &hvalue(RB(i))->array[ivalue(rc) - 1])
+        else if (ISK(GETARG_C(i)) && ttisstring(rc))
+          Protect(gettablestr(L, icache(L, cl->p, pc), RB(i), rc, ra))
+        else
+          Protect(luaV_gettable(L, RB(i), rc, ra));
+        vmbreak;
       }
-      case OP_SETGLOBAL: {
+      vmcase(OP_GGETCALL) {
+        TValue g;
+        sethvalue(L, &g, cl->env);
+        lua_assert(ttisstring(KBx(i)));
+        Protect(gettablestr(L, icache(L, cl->p, pc), &g, KBx(i), ra));
+        lua_assert(GET_OPCODE(*pc) == OP_CALL);
+        vmfuse(l_call);
+      }
+      vmcase(OP_GETTABLE2) {
+        TValue *rc = RKC(i);
+        lua_assert(ISK(GETARG_C(i)) && ttisstring(rc));
+        Protect(gettablestr(L, icache(L, cl->p, pc), RB(i), rc, ra));
+        lua_assert(GET_OPCODE(*pc) == OP_GETTABLE);
+        vmfuse(l_gettable);
+      }
+      vmcase(OP_SETGLOBAL) {
         TValue g;
         sethvalue(L, &g, cl->env);
         lua_assert(ttisstring(KBx(i)));
         Protect(luaV_settable(L, &g, KBx(i), ra));
-        continue;
+        vmbreak;
       }
-      case OP_SETUPVAL: {
+      vmcase(OP_SETUPVAL) {
         UpVal *uv = cl->upvals[GETARG_B(i)];
         setobj(L, uv->v, ra);
         luaC_barrier(L, uv, ra);
-        continue;
+        vmbreak;
       }
-      case OP_SETTABLE: {
-        Protect(luaV_settable(L, ra, RKB(i), RKC(i)));
-        continue;
+      vmcase(OP_SETTABLE) {
+        TValue *rb = RKB(i);
+        if (ttisint(rb) && ttistable(ra) &&
+            cast(unsigned int, ivalue(rb)) - 1 <
+              cast(unsigned int, hvalue(ra)->sizearray) &&
+            !ttisnil(&hvalue(ra)->array[ivalue(rb) - 1])) {
+          TValue *rc = RKC(i);  /* an existing slot: no `__newindex' */
+          setobj2t(L, &hvalue(ra)->array[ivalue(rb) - 1], rc);
+          luaC_barriert(L, hvalue(ra), rc);
+        }
+        else
+          Protect(luaV_settable(L, ra, rb, RKC(i)));
+        vmbreak;
       }
-      case OP_NEWTABLE: {
+      vmcase(OP_NEWTABLE) {
         int b = GETARG_B(i);
         int c = GETARG_C(i);
+        L->savedpc = pc;  /* for the heap profiler */
         sethvalue(L, ra, luaH_new(L, luaO_fb2int(b), luaO_fb2int(c)));
         Protect(luaC_checkGC(L));
-        continue;
+        vmbreak;
       }
-      case OP_SELF: {
+      vmcase(OP_SELF) {
         StkId rb = RB(i);	/* 拿到self.sub中的self指代的表 */
+        TValue *rc = RKC(i);
         setobjs2s(L, ra+1, rb);	/* 将上述表self存起来 */
-        Protect(luaV_gettable(L, rb, RKC(i), ra)); /* 计算self.sub的值 */
-        continue;
+        if (ISK(GETARG_C(i)) && ttisstring(rc))
+          Protect(gettablestr(L, icache(L, cl->p, pc), rb, rc, ra))
+        else
+          Protect(luaV_gettable(L, rb, rc, ra)); /* 计算self.sub的值 */
+        vmbreak;
       }
-      case OP_ADD: {
+      vmcase(OP_ADD) {
         arith_op(luai_numadd, TM_ADD);
-        continue;
+        vmbreak;
       }
-      case OP_SUB: {
+      vmcase(OP_SUB) {
         arith_op(luai_numsub, TM_SUB);
-        continue;
+        vmbreak;
       }
-      case OP_MUL: {
+      vmcase(OP_MUL) {
         arith_op(luai_nummul, TM_MUL);
-        continue;
+        vmbreak;
       }
-      case OP_DIV: {
+      vmcase(OP_DIV) {
         arith_op(luai_numdiv, TM_DIV);
-        continue;
+        vmbreak;
       }
-      case OP_MOD: {
+      vmcase(OP_MOD) {
         arith_op(luai_nummod, TM_MOD);
-        continue;
+        vmbreak;
       }
-      case OP_POW: {
+      vmcase(OP_POW) {
         arith_op(luai_numpow, TM_POW);
-        continue;
+        vmbreak;
+      }
+      vmcase(OP_ADDK) {
+        arith_opk(luai_numadd, TM_ADD);
+        vmbreak;
       }
-      case OP_UNM: {
+      vmcase(OP_SUBK) {
+        arith_opk(luai_numsub, TM_SUB);
+        vmbreak;
+      }
+      vmcase(OP_MULK) {
+        arith_opk(luai_nummul, TM_MUL);
+        vmbreak;
+      }
+      vmcase(OP_DIVK) {
+        arith_opk(luai_numdiv, TM_DIV);
+        vmbreak;
+      }
+      vmcase(OP_MODK) {
+        arith_opk(luai_nummod, TM_MOD);
+        vmbreak;
+      }
+      vmcase(OP_UNM) {
         TValue *rb = RB(i);
-        if (ttisnumber(rb)) {
+        if (ttisint(rb) && intarith(ra, ivalue(rb), 0, TM_UNM)) {}
+        else if (ttisnumber(rb)) {
           lua_Number nb = nvalue(rb);
           setnvalue(ra, luai_numunm(nb));
         }
         else {
           Protect(Arith(L, ra, rb, rb, TM_UNM));
         }
-        continue;
+        vmbreak;
       }
-      case OP_NOT: {
+      vmcase(OP_NOT) {
         int res = l_isfalse(RB(i));  /* next assignment may change this value */
         setbvalue(ra, res);
-        continue;
+        vmbreak;
       }
-      case OP_LEN: {
+      vmcase(OP_LEN) {
         const TValue *rb = RB(i);
         switch (ttype(rb)) {
           case LUA_TTABLE: {
-            setnvalue(ra, cast_num(luaH_getn(hvalue(rb))));
+            setivalue(ra, luaH_getn(hvalue(rb)));
             break;
           }
           case LUA_TSTRING: {
-            setnvalue(ra, cast_num(tsvalue(rb)->len));
+            setnumvalue(ra, cast_num(tsvalue(rb)->len));
             break;
           }
           default: {  /* try metamethod */
@@ -554,22 +1125,22 @@ void luaV_execute (lua_State *L, int nexeccalls) {
             )
           }
         }
-        continue;
+        vmbreak;
       }
-      case OP_CONCAT: {
+      vmcase(OP_CONCAT) {
         int b = GETARG_B(i);
         int c = GETARG_C(i);
 		/* */
         Protect(luaV_concat(L, c-b+1, c); luaC_checkGC(L));
         setobjs2s(L, RA(i), base+b);
-        continue;
+        vmbreak;
       }
-      case OP_JMP: {
+      vmcase(OP_JMP) {
         dojump(L, pc, GETARG_sBx(i));
-        continue;
+        vmbreak;
       }
 	  	/* KEYCODE 重点，难点，代表性的指令 */
-      case OP_EQ: {
+      vmcase(OP_EQ) {
         TValue *rb = RKB(i);
         TValue *rc = RKC(i);
         Protect(
@@ -577,42 +1148,51 @@ void luaV_execute (lua_State *L, int nexeccalls) {
             dojump(L, pc, GETARG_sBx(*pc));
         )
         pc++;
-        continue;
+        vmbreak;
       }
-      case OP_LT: {
+      vmcase(OP_LT) {
         Protect(
           if (luaV_lessthan(L, RKB(i), RKC(i)) == GETARG_A(i))
             dojump(L, pc, GETARG_sBx(*pc));
         )
         pc++;
-        continue;
+        vmbreak;
       }
-      case OP_LE: {	
+      vmcase(OP_LE) {	
         Protect(
           if (lessequal(L, RKB(i), RKC(i)) == GETARG_A(i))
             dojump(L, pc, GETARG_sBx(*pc));
         )
         pc++;
-        continue;
+        vmbreak;
       }
-      case OP_TEST: {
+      vmcase(OP_TEST) {
         if (l_isfalse(ra) != GETARG_C(i))
           dojump(L, pc, GETARG_sBx(*pc));
         pc++;
-        continue;
+        vmbreak;
       }
-      case OP_TESTSET: {
+      vmcase(OP_TESTSET) {
         TValue *rb = RB(i);
         if (l_isfalse(rb) != GETARG_C(i)) {
           setobjs2s(L, ra, rb);
           dojump(L, pc, GETARG_sBx(*pc));
         }
         pc++;
-        continue;
+        vmbreak;
       }
-      case OP_CALL: {	/* R(A), ... ,R(A+C-2) := R(A)(R(A+1), ... ,R(A+B-1)) */
+      vmcase(OP_CALL) l_call: {	/* R(A), ... ,R(A+C-2) := R(A)(R(A+1), ... ,R(A+B-1)) */
 	    int b = GETARG_B(i);			/* 传入参数个数，          B:0：...  1：0个，2：1个，3：2个依次类推 */
         int nresults = GETARG_C(i) - 1;	/* 期待的返回值个数 C:0(...), 1:(期待返回0个)，2:(期待返回1个) */
+        budgetstep(L);
+        if (b > 1 && ttisfunction(ra) && clvalue(ra)->c.bitop &&
+            !(L->hookmask & LUA_MASKCALL) && bitcall(ra, b - 1)) {
+          if (nresults < 0)
+            L->top = ra + 1;
+          else
+            while (--nresults > 0) setnilvalue(ra + nresults);
+          vmbreak;
+        }
         
         /* 注解99: 当传入的参数数量明确时，设置L->top告知被调用函数确切的传入参数数量,
         ** 不明确时，OP_VARARG(fun(...))/	RETURN.B(funA(funB())等指令中已确定了top的位置，这里不能也不用再更改设置(否则L->top!=实际传入的参数位置)
@@ -623,6 +1203,23 @@ void luaV_execute (lua_State *L, int nexeccalls) {
 			L->top = ra+b;  /* else previous instruction set top */
 		
         L->savedpc = pc;	/* 记下原本接下来要执行的下一条指令，等待new'frame运行结束后，继续运行本frame */
+        if (isvmpcall(L, ra)) {
+          if (!protect) {  /* no handler yet: come back with one */
+            if (b != 0) L->top = L->ci->top;
+            L->savedpc = pc - 1;  /* to run this OP_CALL again */
+            return nexeccalls;
+          }
+          luaD_vmpcall(L, ra, nresults);
+          nexeccalls++;
+          goto reentry;  /* run `f' */
+        }
+        if (b != 0 && ttisfunction(ra) && clvalue(ra)->c.leaf == b &&
+            !(L->hookmask & (LUA_MASKCALL | LUA_MASKRET))) {
+          Protect(luaD_leafcall(L, ra, nresults));
+          if (nresults >= 0)
+            L->top = L->ci->top;
+          vmbreak;
+        }
         switch (luaD_precall(L, ra, nresults)) {
           case PCRLUA: {
             nexeccalls++;
@@ -644,16 +1241,17 @@ void luaV_execute (lua_State *L, int nexeccalls) {
             base = L->base;	/* 调用过程中stack可能变化而移动，故而重新获取最新的(L->ci->base==L->base)的base，下同 */
 			/* 子函数(frame)为c,luaD_precall的返回意味着子函数(frame)已运行完毕，相关参数也调整完毕
 			** 这里接着运行母函数(frame)的紧跟着OP_CALL后面的下一条指令 */
-            continue;	
+            vmbreak;	
           }
           default: {
-            return;  /* yield,交出lua的执行权 */
+            return 0;  /* yield,交出lua的执行权 */
           }
         } 
       }
-      case OP_TAILCALL: {
+      vmcase(OP_TAILCALL) {
 	  	/* A B C return R(A)(R(A+1), ... ,R(A+B-1)) */
         int b = GETARG_B(i);
+        budgetstep(L);
         if (b != 0) {
 			L->top = ra+b;  /* else previous instruction set top */
         } else {
@@ -661,19 +1259,41 @@ void luaV_execute (lua_State *L, int nexeccalls) {
         }
         L->savedpc = pc;
         lua_assert(GETARG_C(i) - 1 == LUA_MULTRET);	/* 尾调用的定义中：必须返回其调用返回的所有值，所以这里C必须为0 */
+        if (isvmpcall(L, ra)) {  /* not a tail call: OP_RETURN comes next */
+          if (!protect) {
+            if (b != 0) L->top = L->ci->top;
+            L->savedpc = pc - 1;
+            return nexeccalls;
+          }
+          luaD_vmpcall(L, ra, LUA_MULTRET);
+          nexeccalls++;
+          goto reentry;
+        }
         switch (luaD_precall(L, ra, LUA_MULTRET)) {
           case PCRLUA: {	/* 画图，代码不难，看懂它们 */
             /* tail call: put new frame in place of previous one */
             CallInfo *ci = L->ci - 1;  /* previous frame */
-            int aux;
+            int aux, live;
             StkId func = ci->func;
             StkId pfunc = (ci+1)->func;  /* previous function index */
             if (L->openupval) luaF_close(L, ci->base);
             L->base = ci->base = ci->func + ((ci+1)->base - pfunc);
 
 			/* ！！！！移动后func指向的地址不变，但值改变了（由母函数变成了被尾调用的子函数) */
-            for (aux = 0; pfunc+aux < L->top; aux++)  /* move frame down */
+            /* only the function, varargs, parameters and `arg' hold values
+               (a call hook may have set others); the rest of the new frame
+               is nil and is cleared in place */
+            if (L->hookmask & LUA_MASKCALL)
+              live = cast_int(L->top - pfunc);
+            else {
+              Proto *np = clvalue(pfunc)->l.p;
+              live = cast_int((ci+1)->base - pfunc) + np->numparams +
+                     (np->is_vararg & VARARG_HASARG);
+            }
+            for (aux = 0; aux < live; aux++)  /* move frame down */
               setobjs2s(L, func+aux, pfunc+aux);
+            for (; pfunc+aux < L->top; aux++)
+              setnilvalue(func+aux);
 			
             ci->top = L->top = func+aux;  /* correct top */
             lua_assert(L->top == L->base + clvalue(func)->l.p->maxstacksize);
@@ -684,14 +1304,14 @@ void luaV_execute (lua_State *L, int nexeccalls) {
           }
           case PCRC: {  /* it was a C function (`precall' called it) */
             base = L->base;	/* restore base */
-            continue;
+            vmbreak;
           }
           default: {
-            return;  /* yield */
+            return 0;  /* yield */
           }
         }
       }
-      case OP_RETURN: {
+      vmcase(OP_RETURN) {
 	  	/* return R(A), ... ,R(A+B-2) */
         int b = GETARG_B(i);	/* 0：返回所有值，1：返回0个值，2：返回1个值 ... */
         if (b != 0) /* b==0其它的指令argvar等已处理好top,eg:(return ...)或者return(a, fun()) */
@@ -703,28 +1323,40 @@ void luaV_execute (lua_State *L, int nexeccalls) {
 		/* lua调用结束，返回值已经按照移动到指定的位置(本fun的addr)，且L->top指向了最后一个返回值的位置(可以用来计算返回值的个数)
 		   这里直接return，将CPU交换到母C函数 */
         if (--nexeccalls == 0)  /* was previous function running `here'? Lua层面的调用结束了，结束lua的execute的执行，返回到C */
-          return;  /* no: return */
+          return 0;  /* no: return */
         else {  /* yes: continue its execution */
           if (b) /* 同上注解100，请往上翻阅 */
 		  	L->top = L->ci->top;	/*  */
           lua_assert(isLua(L->ci)); /* return后，lua连续调用链还没结束，那么上一层必然是个lua函数 */
-          lua_assert(GET_OPCODE(*((L->ci)->savedpc - 1)) == OP_CALL);	/* 上一个指令必然是call */
+          lua_assert(GET_OPCODE(*((L->ci)->savedpc - 1)) == OP_CALL ||
+                     GET_OPCODE(*((L->ci)->savedpc - 1)) == OP_TAILCALL);	/* 上一个指令必然是call(或VM运行的pcall) */
           goto reentry;	/* 切回到母lua的execute的frame */
         }
       }
-      case OP_FORLOOP: {	/* 先看 OP_FORPREP 指令 */
-        lua_Number step = nvalue(ra+2);
-        lua_Number idx = luai_numadd(nvalue(ra), step); /* increment index */
-        lua_Number limit = nvalue(ra+1);
-        if (luai_numlt(0, step) ? luai_numle(idx, limit)
-                                : luai_numle(limit, idx)) {
-          dojump(L, pc, GETARG_sBx(i));  /* jump back */
-          setnvalue(ra, idx);  /* update internal index... */
-          setnvalue(ra+3, idx);  /* ...and external index 这个idx才是暴露给for循环里面的i(for i = 0; 10; 1) */ 
+      vmcase(OP_FORLOOP) {	/* 先看 OP_FORPREP 指令 */
+        if (ttisint(ra)) {  /* FORPREP made all three ints, with no overflow */
+          int step = ivalue(ra+2);
+          int idx = ivalue(ra) + step;
+          if (step > 0 ? idx <= ivalue(ra+1) : ivalue(ra+1) <= idx) {
+            setivalue(ra, idx);
+            setivalue(ra+3, idx);
+            dojump(L, pc, GETARG_sBx(i));  /* last: it may move the stack */
+          }
         }
-        continue;
+        else {
+          lua_Number step = nvalue(ra+2);
+          lua_Number idx = luai_numadd(nvalue(ra), step); /* increment index */
+          lua_Number limit = nvalue(ra+1);
+          if (luai_numlt(0, step) ? luai_numle(idx, limit)
+                                  : luai_numle(limit, idx)) {
+            setnvalue(ra, idx);  /* update internal index... */
+            setnvalue(ra+3, idx);  /* ...and external index 这个idx才是暴露给for循环里面的i(for i = 0; 10; 1) */ 
+            dojump(L, pc, GETARG_sBx(i));  /* jump back */
+          }
+        }
+        vmbreak;
       }
-      case OP_FORPREP: {
+      vmcase(OP_FORPREP) {
         const TValue *init = ra;
         const TValue *plimit = ra+1;
         const TValue *pstep = ra+2;
@@ -735,16 +1367,58 @@ void luaV_execute (lua_State *L, int nexeccalls) {
           luaG_runerror(L, LUA_QL("for") " limit must be a number");
         else if (!tonumber(pstep, ra+2))
           luaG_runerror(L, LUA_QL("for") " step must be a number");
-        setnvalue(ra, luai_numsub(nvalue(ra), nvalue(pstep)));	/* 这里提前-=step */
+        if (ttisint(init) && ttisint(plimit) && ttisint(pstep) &&
+            intfor(ivalue(init), ivalue(plimit), ivalue(pstep)))
+          setivalue(ra, ivalue(init) - ivalue(pstep))
+        else {
+          setnvalue(ra, luai_numsub(nvalue(ra), nvalue(pstep)));	/* 这里提前-=step */
+          if (ttisint(plimit)) setnvalue(ra+1, nvalue(plimit));
+          if (ttisint(pstep)) setnvalue(ra+2, nvalue(pstep));
+        }
         dojump(L, pc, GETARG_sBx(i));	/* 跳到cond判断那里 */
-        continue;
+        vmbreak;
       }
-      case OP_TFORLOOP: {
+      vmcase(OP_TFORLOOP) {
 	  	/* 编译模块保证了ra+3是个有意义的参数 
 	  	** next函数会吃掉传入的参数，所以这里CP了一份
 	    */
 	    /* 结合 http://shankusu.me/lua/ANo-FrillsIntroductiontoLua51VMInstructions/ 文档来看，更容易理解 */
         StkId cb = ra + 3;  /* call base */
+        if (GETARG_B(i) && ttisfunction(ra) && clvalue(ra)->c.iter &&
+            ttistable(ra+1) && !(L->hookmask & LUA_MASKCALL)) {
+          int c = GETARG_C(i);
+          int more, k = 0;
+          if (clvalue(ra)->c.iter == LUA_ITERNEXT) {
+            StkId pos = ra + 2 + c;  /* `(for position)' */
+            if (ttisnumber(pos)) lua_number2int(k, nvalue(pos));
+            setobjs2s(L, cb, ra+2);
+            Protect(more = luaH_nextpos(L, hvalue(ra+1), cb, k));
+            ra = RA(i);
+            cb = ra + 3;
+            setivalue(ra + 2 + c, more);
+          }
+          else if (ttisnumber(ra+2)) {  /* ipairs */
+            const TValue *v;
+            lua_number2int(k, nvalue(ra+2));
+            v = luaH_getnum(hvalue(ra+1), ++k);
+            more = !ttisnil(v);
+            if (more) {
+              setivalue(cb, k);
+              if (c > 2) setobj2s(L, cb+1, v);
+            }
+          }
+          else goto calliter;
+          if (more) {
+            int j;
+            for (j = 2; j < c - 1; j++)  /* loop variables after `k, v' */
+              setnilvalue(cb + j);
+            setobjs2s(L, cb-1, cb);  /* save control variable */
+            dojump(L, pc, GETARG_sBx(*pc));  /* jump back */
+          }
+          pc++;
+          vmbreak;
+        }
+      calliter:
         setobjs2s(L, cb+2, ra+2);
         setobjs2s(L, cb+1, ra+1);
         setobjs2s(L, cb, ra);
@@ -757,9 +1431,9 @@ void luaV_execute (lua_State *L, int nexeccalls) {
           dojump(L, pc, GETARG_sBx(*pc));  /* jump back */
         }
         pc++;
-        continue;
+        vmbreak;
       }
-      case OP_SETLIST: {	/* local t = {...} 本指令之前可能会有一条vararg或local t2={fun(...)}产生的OP_CALL，所以结合vararg来理解本block的代码 */
+      vmcase(OP_SETLIST) {	/* local t = {...} 本指令之前可能会有一条vararg或local t2={fun(...)}产生的OP_CALL，所以结合vararg来理解本block的代码 */
 	  	/* A B C	R(A)[(C-1)*FPF+i] := R(A+i), 1 <= i <= B */
         int n = GETARG_B(i);
         int c = GETARG_C(i);
@@ -780,20 +1454,29 @@ void luaV_execute (lua_State *L, int nexeccalls) {
           setobj2t(L, luaH_setnum(L, h, last--), val);
           luaC_barriert(L, h, val);
         }
-        continue;
+        vmbreak;
       }
-      case OP_CLOSE: {
+      vmcase(OP_CLOSE) {
 	  	/* close all variables in the stack up to (>=) R(A) 编译模块如何确定参数A？*/
         luaF_close(L, ra);
-        continue;
+        vmbreak;
       }
-      case OP_CLOSURE: {
+      vmcase(OP_CLOSURE) {
 	  	/* A Bx	R(A) := closure(KPROTO[Bx], R(A), ... ,R(A+n)) */
         Proto *p;
         Closure *ncl;
         int nup, j;
         p = cl->p->p[GETARG_Bx(i)];	/* 找到对应的proto */
         nup = p->nups;
+#if defined(LUAI_CLOSURECACHE)
+        ncl = getcached(p, cl, base, pc);
+        if (ncl != NULL) {  /* reuse it */
+          pc += nup;
+          setclvalue(L, ra, ncl);
+          vmbreak;
+        }
+#endif
+        L->savedpc = pc;  /* for the heap profiler */
         ncl = luaF_newLclosure(L, nup, cl->env);
         ncl->l.p = p;
 		/* 结合 singlevaraux, pushclosure,函数一起看 */
@@ -806,10 +1489,16 @@ void luaV_execute (lua_State *L, int nexeccalls) {
           }
         }
         setclvalue(L, ra, ncl);
+#if defined(LUAI_CLOSURECACHE)
+        if (p->noescape && !(p->inimage & PROTO_SHARED)) {
+          p->cache = ncl;
+          luaC_objbarrier(L, p, ncl);
+        }
+#endif
         Protect(luaC_checkGC(L));
-        continue;
+        vmbreak;
       }
-      case OP_VARARG: {
+      vmcase(OP_VARARG) {
 	  	/* A B	R(A), R(A+1), ..., R(A+B-1) = vararg */
         int b = GETARG_B(i) - 1;
         int j;
@@ -840,9 +1529,35 @@ void luaV_execute (lua_State *L, int nexeccalls) {
             setnilvalue(ra + j);	/* local a, b = ... 本函数实际上只收到了一个不定参数，那么不足的部分(b)就要补nil值了 */
           }
         }
-        continue;
+        vmbreak;
       }
     }
   }
 }
 
+
+static void f_execute (lua_State *L, void *ud) {
+  int *nexeccalls = cast(int *, ud);
+  *nexeccalls = execute(L, *nexeccalls, 1);
+}
+
+
+/*
+** Run the Lua function(s) of `L->ci'. `execute' returns a nonzero
+** `nexeccalls' when it meets the first pcall that it can run in the VM
+** (luaD_vmpcall); from there on it runs with a handler of its own, set
+** once, which finishes the pcall of an error (luaD_vmpcallerror) and
+** goes on, or passes the error on if no such pcall is running here.
+*/
+void luaV_execute (lua_State *L, int nexeccalls) {
+  ptrdiff_t base = saveci(L, L->ci);
+  int n = nexeccalls - cast_int(L->ci - L->base_ci);  /* frames below */
+  nexeccalls = execute(L, nexeccalls, 0);
+  while (nexeccalls != 0) {
+    int status = luaD_rawrunprotected(L, f_execute, &nexeccalls);
+    if (status == 0) break;
+    if (!luaD_vmpcallerror(L, restoreci(L, base), status))
+      luaD_throw(L, status);
+    nexeccalls = n + cast_int(L->ci - L->base_ci);
+  }
+}
@@ -32,5 +32,8 @@ LUAI_FUNC void luaV_settable (lua_State *L, const TValue *t, TValue *key,
                                             StkId val);
 LUAI_FUNC void luaV_execute (lua_State *L, int nexeccalls);
 LUAI_FUNC void luaV_concat (lua_State *L, int total, int last);
+LUAI_FUNC int luaV_bitop (int op, const TValue *a, int n);
+LUAI_FUNC TString *luaV_concatarray (lua_State *L, Table *t, const char *sep,
+                                    size_t lsep, int i, int j);
 
 #endif
@@ -71,6 +71,18 @@ size_t luaZ_read (ZIO *z, void *b, size_t n) {
   return 0;
 }
 
+/* ------------------------------------------------------------------------ */
+/* the next n bytes in place if the current block holds them at an address
+   aligned to `align'; NULL otherwise (nothing is read then) */
+const char *luaZ_inplace (ZIO *z, size_t n, size_t align) {
+  const char *p = z->p;
+  if (z->n < n || (size_t)p % align != 0)
+    return NULL;
+  z->n -= n;
+  z->p += n;
+  return p;
+}
+
 /* ------------------------------------------------------------------------ */
 char *luaZ_openspace (lua_State *L, Mbuffer *buff, size_t n) {
   if (n > buff->buffsize) {
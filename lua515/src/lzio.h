@@ -52,6 +52,7 @@ LUAI_FUNC char *luaZ_openspace (lua_State *L, Mbuffer *buff, size_t n);
 LUAI_FUNC void luaZ_init (lua_State *L, ZIO *z, lua_Reader reader,
                                         void *data);
 LUAI_FUNC size_t luaZ_read (ZIO* z, void* b, size_t n);	/* read next n bytes */
+LUAI_FUNC const char *luaZ_inplace (ZIO *z, size_t n, size_t align);
 LUAI_FUNC int luaZ_lookahead (ZIO *z);
 
 
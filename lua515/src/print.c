@@ -113,9 +113,11 @@ static void PrintCode(const Proto* f)
     break;
    case OP_GETGLOBAL:
    case OP_SETGLOBAL:
+   case OP_GGETCALL:
     printf("\t; %s",svalue(&f->k[bx]));
     break;
    case OP_GETTABLE:
+   case OP_GETTABLE2:
    case OP_SELF:
     if (ISK(c)) { printf("\t; "); PrintConstant(f,INDEXK(c)); }
     break;
@@ -125,6 +127,11 @@ static void PrintCode(const Proto* f)
    case OP_MUL:
    case OP_DIV:
    case OP_POW:
+   case OP_ADDK:
+   case OP_SUBK:
+   case OP_MULK:
+   case OP_DIVK:
+   case OP_MODK:
    case OP_EQ:
    case OP_LT:
    case OP_LE:
@@ -260,9 +267,11 @@ LUAI_FUNC void PrintOneCode(Instruction i) {
 	   break;
 	  case OP_GETGLOBAL:
 	  case OP_SETGLOBAL:
+	  case OP_GGETCALL:
 	   printf("\t; OP_GETGLOBAL/OP_SETGLOBAL");
 	   break;
 	  case OP_GETTABLE:
+	  case OP_GETTABLE2:
 	  case OP_SELF:
     	printf("\t; OP_GETTABLE/OP_SELF");
 	   break;
@@ -272,6 +281,11 @@ LUAI_FUNC void PrintOneCode(Instruction i) {
 	  case OP_MUL:
 	  case OP_DIV:
 	  case OP_POW:
+	  case OP_ADDK:
+	  case OP_SUBK:
+	  case OP_MULK:
+	  case OP_DIVK:
+	  case OP_MODK:
 	  case OP_EQ:
 	  case OP_LT:
 	  case OP_LE:
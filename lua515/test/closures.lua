@@ -0,0 +1,43 @@
+-- every evaluation of a function expression gives a new function, as
+-- far as a program without the debug library can tell: LUAI_CLOSURECACHE
+-- (luaconf.h) reuses only closures that never escape
+
+local function mk() return function () return x end end
+
+-- identity: distinct values, distinct keys
+local f, g = mk(), mk()
+assert(f ~= g, "two evaluations gave one closure")
+local t = {}
+for i = 1, 10 do t[mk()] = i end
+local n = 0
+for _ in pairs(t) do n = n + 1 end
+assert(n == 10, "closures collapsed into one key")
+
+-- the same, for an expression evaluated in a loop with upvalues
+local up = 0
+local seen = {}
+for i = 1, 5 do
+  local h = function () return up end
+  assert(not seen[h], "loop gave back an old closure")
+  seen[h] = true
+end
+
+-- setfenv on one instance leaves the other alone
+setfenv(f, {x = 1})
+setfenv(g, {x = 2})
+assert(f() == 1 and g() == 2, "setfenv changed another instance")
+
+-- a local helper that is only called (so it may be reused): a setfenv
+-- from inside it must not reach the next round's helper
+local s, envs = 0, {}
+for i = 1, 3 do
+  local add = function (v)
+    envs[i] = getfenv(1)
+    setfenv(1, {})
+    s = s + v
+  end
+  add(i)
+end
+assert(s == 6 and envs[1] == getfenv() and envs[2] == getfenv() and
+       envs[3] == getfenv(), "setfenv reached a later evaluation")
+print(f(), g())
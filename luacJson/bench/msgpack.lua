@@ -0,0 +1,50 @@
+-- JSON against MessagePack on the same values: size and speed
+-- usage: lua msgpack.lua [scale]
+--
+-- Each value is encoded and decoded with cjson.encode/decode and with
+-- cjson.msgpack_encode/msgpack_decode. MB/s is measured on the size of
+-- the JSON text for both formats, so the columns compare the time taken
+-- per value.
+
+local cjson = require "cjson"
+
+local scale = tonumber(arg and arg[1]) or 1
+local clock = os.clock
+
+local function build(n, f)
+  local t = {}
+  for i = 1, n do t[i] = f(i) end
+  return t
+end
+
+local values = {
+  -- small records, as in service traffic
+  { "records", build(5000, function (i)
+      return { id = i, name = "user" .. i, score = i * 0.25, active = i % 3 == 0,
+               tags = { "a", "b" } }
+    end) },
+  -- integers: text conversion against fixed width
+  { "ints", build(50000, function (i) return i * 7919 % 1000003 end) },
+  -- doubles: shortest round-trip text against 9 bytes
+  { "doubles", build(20000, function (i) return i / 7 end) },
+  -- long strings: escaping against a length prefix
+  { "strings", build(200, function (i) return ("lorem \"ipsum\"\n"):rep(100) end) },
+}
+
+print(string.format("%-8s %9s %9s %10s %10s %10s %10s", "value", "json KB",
+                    "mp KB", "json enc", "mp enc", "json dec", "mp dec"))
+for _, v in ipairs(values) do
+  local name, value = v[1], v[2]
+  local json, mp = cjson.encode(value), cjson.msgpack_encode(value)
+  local n = math.max(1, math.floor(5000 * scale * 1024 / #json))
+  local function rate(f, arg)
+    local t0 = clock()
+    for i = 1, n do f(arg) end
+    return #json * n / 1048576 / (clock() - t0)
+  end
+  assert(cjson.encode(cjson.msgpack_decode(mp)) == cjson.encode(cjson.decode(json)))
+  print(string.format("%-8s %9.1f %9.1f %10.1f %10.1f %10.1f %10.1f", name,
+                      #json / 1024, #mp / 1024,
+                      rate(cjson.encode, value), rate(cjson.msgpack_encode, value),
+                      rate(cjson.decode, json), rate(cjson.msgpack_decode, mp)))
+end
@@ -0,0 +1,47 @@
+-- throughput of number encoding and decoding in lua_cjson.c / fpconv.c
+-- usage: lua numbers.lua [scale]
+--
+-- Run it against two builds of the module to compare them (set
+-- package.cpath, or LUA_CPATH, to pick one). Each payload is an array of
+-- 10000 numbers; "shortest" encodes with encode_number_precision(0).
+
+local cjson = require "cjson"
+
+local scale = tonumber(arg and arg[1]) or 1
+local clock = os.clock
+
+local function array(pick)
+  local t = {}
+  for i = 1, 10000 do t[i] = pick(i) end
+  return t
+end
+
+math.randomseed(1)
+local payloads = {
+  -- ids and counters
+  { "integers", array(function (i) return math.floor(math.random() * 1e9) end) },
+  -- prices and the like, a couple of decimals
+  { "decimals", array(function (i) return math.floor(math.random() * 1e6) / 100 end) },
+  -- full 53-bit mantissas over a wide range
+  { "doubles", array(function (i) return (math.random() - 0.5) * 10 ^ math.random(-20, 20) end) },
+}
+
+print(string.format("%-10s %-9s %8s %10s %10s", "payload", "precision", "KB",
+                    "enc MB/s", "dec MB/s"))
+for _, precision in ipairs({ 14, 0 }) do
+  cjson.encode_number_precision(precision)
+  for _, p in ipairs(payloads) do
+    local name, value = p[1], p[2]
+    local json = cjson.encode(value)
+    local n = math.max(1, math.floor(500 * scale * 1024 / #json))
+    local t0 = clock()
+    for i = 1, n do cjson.encode(value) end
+    local te = clock() - t0
+    t0 = clock()
+    for i = 1, n do cjson.decode(json) end
+    local td = clock() - t0
+    print(string.format("%-10s %-9s %8.1f %10.1f %10.1f", name,
+                        precision == 0 and "shortest" or precision, #json / 1024,
+                        #json * n / 1048576 / te, #json * n / 1048576 / td))
+  end
+end
@@ -0,0 +1,56 @@
+-- throughput of string encoding and decoding in lua_cjson.c
+-- usage: lua strings.lua [scale]
+--
+-- Run it against two builds of the module to compare them (set
+-- package.cpath, or LUA_CPATH, to pick one). Each payload is encoded
+-- and decoded repeatedly; MB/s is the size of the JSON text.
+
+local cjson = require "cjson"
+
+local scale = tonumber(arg and arg[1]) or 1
+local clock = os.clock
+
+local function text(n, pick)
+  local t = {}
+  for i = 1, n do t[i] = pick(i) end
+  return table.concat(t)
+end
+
+local words = { "lorem", "ipsum", "dolor", "sit", "amet", "consectetur",
+                "adipiscing", "elit", "sed", "do", "eiusmod", "tempor" }
+
+local payloads = {
+  -- plain text fields, few escapes
+  { "prose", { body = text(800, function (i) return words[i % #words + 1] .. " " end) } },
+  -- multi-KB field with newlines and quotes now and then
+  { "markup", { html = text(400, function (i)
+      return '<p class="x">' .. words[i % #words + 1] .. "</p>\n" end) } },
+  -- UTF-8 passes through untouched
+  { "utf8", { s = ("h\195\169llo w\195\182rld \228\184\173\230\150\135 "):rep(500) } },
+  -- many short strings: the per-call overhead
+  { "short", (function ()
+      local t = {}
+      for i = 1, 2000 do t[i] = { k = words[i % #words + 1], id = "id" .. i } end
+      return t
+    end)() },
+  -- worst case: an escape every few bytes
+  { "escapes", { s = ("a\tb\"c\\d/"):rep(1000) } },
+}
+
+print(string.format("%-8s %8s %10s %10s %10s", "payload", "KB", "enc MB/s",
+                    "dec MB/s", "check"))
+for _, p in ipairs(payloads) do
+  local name, value = p[1], p[2]
+  local json = cjson.encode(value)
+  local n = math.max(1, math.floor(2000 * scale * 1024 / #json))
+  local t0 = clock()
+  for i = 1, n do cjson.encode(value) end
+  local te = clock() - t0
+  t0 = clock()
+  for i = 1, n do cjson.decode(json) end
+  local td = clock() - t0
+  local ok = cjson.encode(cjson.decode(json)) == json
+  print(string.format("%-8s %8.1f %10.1f %10.1f %10s", name, #json / 1024,
+                      #json * n / 1048576 / te, #json * n / 1048576 / td,
+                      ok and "ok" or "MISMATCH"))
+end
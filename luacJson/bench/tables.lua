@@ -0,0 +1,45 @@
+-- decoding cost of large arrays and objects, with and without the
+-- structural pre-scan of decode_presize
+-- usage: lua tables.lua [scale]
+--
+-- With decode_presize(true) each table is created at its final size;
+-- without it the tables grow one rehash at a time.
+
+local cjson = require "cjson"
+
+local scale = tonumber(arg and arg[1]) or 1
+local clock = os.clock
+
+local function build(n, f)
+  local t = {}
+  for i = 1, n do f(t, i) end
+  return cjson.encode(t)
+end
+
+local payloads = {
+  -- one long array of numbers
+  { "array", build(100000, function (t, i) t[i] = i end) },
+  -- one object with many members
+  { "object", build(50000, function (t, i) t["key" .. i] = i end) },
+  -- many small records: the rehashes of each small table
+  { "records", build(10000, function (t, i)
+      t[i] = { id = i, name = "n" .. i, tags = { "a", "b", "c" }, ok = true }
+    end) },
+  -- long strings: the pre-scan is pure overhead here
+  { "strings", build(200, function (t, i) t[i] = ("lorem ipsum "):rep(400) end) },
+}
+
+print(string.format("%-8s %8s %12s %12s", "payload", "KB", "off MB/s", "presize MB/s"))
+for _, p in ipairs(payloads) do
+  local name, json = p[1], p[2]
+  local n = math.max(1, math.floor(20000 * scale * 1024 / #json))
+  local rate = {}
+  for i, on in ipairs({ false, true }) do
+    cjson.decode_presize(on)
+    local t0 = clock()
+    for j = 1, n do cjson.decode(json) end
+    rate[i] = #json * n / 1048576 / (clock() - t0)
+  end
+  print(string.format("%-8s %8.1f %12.1f %12.1f", name, #json / 1024, rate[1], rate[2]))
+end
+cjson.decode_presize(false)
@@ -0,0 +1,110 @@
+/* Encode/decode throughput of separate Lua states on several OS threads.
+ *
+ * Every thread runs its own lua_State with cjson linked in, so the only
+ * thing they could contend on is the module itself. Aggregate MB/s
+ * should grow with the thread count up to the number of cores.
+ *
+ * Build (from luacJson/bench, with lua515/src built first):
+ *   cc -O2 -I../../lua515/src -o threads threads.c ../lua_cjson.c \
+ *      ../strbuf.c ../fpconv.c ../../lua515/src/liblua.a -lpthread -lm
+ * Usage: ./threads [max_threads [rounds]]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <sys/time.h>
+
+#include <lua.h>
+#include <lauxlib.h>
+#include <lualib.h>
+
+#include "../lua_cjson.h"
+
+/* Returns the bytes of JSON encoded and decoded in `rounds' rounds */
+static const char *workload =
+    "local cjson, rounds = require 'cjson', ...\n"
+    "local t = {}\n"
+    "for i = 1, 200 do\n"
+    "  t[i] = { id = i, name = 'item' .. i, price = i / 7,\n"
+    "           tags = { 'a', 'b', 'c' }, ok = i % 2 == 0 }\n"
+    "end\n"
+    "local s = cjson.encode(t)\n"
+    "for r = 1, rounds do cjson.decode(cjson.encode(t)) end\n"
+    "return 2 * rounds * #s\n";
+
+typedef struct {
+    int rounds;
+    double bytes;
+    const char *error;
+} job_t;
+
+static void *run(void *arg)
+{
+    job_t *job = arg;
+    lua_State *L = luaL_newstate();
+
+    luaL_openlibs(L);
+    lua_getglobal(L, "package");
+    lua_getfield(L, -1, "preload");
+    lua_pushcfunction(L, luaopen_cjson);
+    lua_setfield(L, -2, "cjson");
+    lua_pop(L, 2);
+
+    if (luaL_loadstring(L, workload) ||
+        (lua_pushinteger(L, job->rounds), lua_pcall(L, 1, 1, 0))) {
+        job->error = "workload failed";
+        fprintf(stderr, "%s\n", lua_tostring(L, -1));
+    } else {
+        job->bytes = lua_tonumber(L, -1);
+    }
+    lua_close(L);
+
+    return NULL;
+}
+
+static double now(void)
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+int main(int argc, char **argv)
+{
+    int max = argc > 1 ? atoi(argv[1]) : 8;
+    int rounds = argc > 2 ? atoi(argv[2]) : 500;
+    pthread_t *tid = malloc(max * sizeof(*tid));
+    job_t *job = malloc(max * sizeof(*job));
+    int n, i;
+
+    if (!tid || !job || max < 1)
+        return 1;
+
+    printf("%8s %10s %12s %14s\n", "threads", "wall(s)", "MB/s", "MB/s/thread");
+    for (n = 1; n <= max; n *= 2) {
+        double t0 = now(), total = 0, wall;
+
+        for (i = 0; i < n; i++) {
+            job[i].rounds = rounds;
+            job[i].bytes = 0;
+            job[i].error = NULL;
+            pthread_create(&tid[i], NULL, run, &job[i]);
+        }
+        for (i = 0; i < n; i++) {
+            pthread_join(tid[i], NULL);
+            if (job[i].error)
+                return 1;
+            total += job[i].bytes;
+        }
+        wall = now() - t0;
+
+        printf("%8d %10.2f %12.1f %14.1f\n", n, wall, total / 1048576 / wall,
+               total / 1048576 / wall / n);
+    }
+
+    free(tid);
+    free(job);
+    return 0;
+}
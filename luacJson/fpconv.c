@@ -26,12 +26,19 @@
  * with locale support will break when the decimal separator is a comma.
  *
  * fpconv_* will around these issues with a translation buffer if required.
+ *
+ * Most numbers never get there: fpconv_g_fmt() and fpconv_strtod() first
+ * try fast paths of their own, which do not depend on the locale (see
+ * FAST PATHS below). The C library is the fallback for the rest.
  */
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <assert.h>
 #include <string.h>
+#include <math.h>
+#include <float.h>
 
 #include "fpconv.h"
 
@@ -63,7 +70,10 @@ static void fpconv_update_locale()
         abort();
     }
 
-    locale_decimal_point = buf[1];
+    /* Store only a change: states opening cjson on other threads may
+     * be reading it */
+    if (locale_decimal_point != buf[1])
+        locale_decimal_point = buf[1];
 }
 
 /* Check for a valid number character: [-+0-9a-yA-Y.]
@@ -102,6 +112,757 @@ static int strtod_buffer_size(const char *s)
     return p - s;
 }
 
+/* ===== FAST PATHS =====
+ *
+ * Formatting: a whole number below 2^53 is printed as an integer. Other
+ * doubles get their digits from Grisu2 (Florian Loitsch, "Printing
+ * Floating-Point Numbers Quickly and Accurately with Integers", 2010):
+ * the shortest digits that read back as the same double, one digit more
+ * in rare cases. With a precision of p <= 14 those digits are also what
+ * "%.<p>g" prints whenever there are at most p of them: an ulp is far
+ * smaller than the gap between p-digit decimals (subnormals excepted).
+ * Otherwise snprintf() does the rounding.
+ *
+ * Parsing: a JSON number with at most 19 significant digits is exact
+ * with Clinger's fast path (w * 10^q for small w and q) or with the
+ * Eisel-Lemire algorithm (Lemire, "Number Parsing at a Gigabyte per
+ * Second", 2021), which falls back to strtod() where the 64-bit
+ * product leaves the rounding in doubt.
+ */
+
+/* 10^k ~= f * 2^e for k = -348, -340, ..., 340: f rounded to nearest */
+static const uint64_t cached_pow_f[] = {
+    UINT64_C(0xfa8fd5a0081c0288), UINT64_C(0xbaaee17fa23ebf76), UINT64_C(0x8b16fb203055ac76),
+    UINT64_C(0xcf42894a5dce35ea), UINT64_C(0x9a6bb0aa55653b2d), UINT64_C(0xe61acf033d1a45df),
+    UINT64_C(0xab70fe17c79ac6ca), UINT64_C(0xff77b1fcbebcdc4f), UINT64_C(0xbe5691ef416bd60c),
+    UINT64_C(0x8dd01fad907ffc3c), UINT64_C(0xd3515c2831559a83), UINT64_C(0x9d71ac8fada6c9b5),
+    UINT64_C(0xea9c227723ee8bcb), UINT64_C(0xaecc49914078536d), UINT64_C(0x823c12795db6ce57),
+    UINT64_C(0xc21094364dfb5637), UINT64_C(0x9096ea6f3848984f), UINT64_C(0xd77485cb25823ac7),
+    UINT64_C(0xa086cfcd97bf97f4), UINT64_C(0xef340a98172aace5), UINT64_C(0xb23867fb2a35b28e),
+    UINT64_C(0x84c8d4dfd2c63f3b), UINT64_C(0xc5dd44271ad3cdba), UINT64_C(0x936b9fcebb25c996),
+    UINT64_C(0xdbac6c247d62a584), UINT64_C(0xa3ab66580d5fdaf6), UINT64_C(0xf3e2f893dec3f126),
+    UINT64_C(0xb5b5ada8aaff80b8), UINT64_C(0x87625f056c7c4a8b), UINT64_C(0xc9bcff6034c13053),
+    UINT64_C(0x964e858c91ba2655), UINT64_C(0xdff9772470297ebd), UINT64_C(0xa6dfbd9fb8e5b88f),
+    UINT64_C(0xf8a95fcf88747d94), UINT64_C(0xb94470938fa89bcf), UINT64_C(0x8a08f0f8bf0f156b),
+    UINT64_C(0xcdb02555653131b6), UINT64_C(0x993fe2c6d07b7fac), UINT64_C(0xe45c10c42a2b3b06),
+    UINT64_C(0xaa242499697392d3), UINT64_C(0xfd87b5f28300ca0e), UINT64_C(0xbce5086492111aeb),
+    UINT64_C(0x8cbccc096f5088cc), UINT64_C(0xd1b71758e219652c), UINT64_C(0x9c40000000000000),
+    UINT64_C(0xe8d4a51000000000), UINT64_C(0xad78ebc5ac620000), UINT64_C(0x813f3978f8940984),
+    UINT64_C(0xc097ce7bc90715b3), UINT64_C(0x8f7e32ce7bea5c70), UINT64_C(0xd5d238a4abe98068),
+    UINT64_C(0x9f4f2726179a2245), UINT64_C(0xed63a231d4c4fb27), UINT64_C(0xb0de65388cc8ada8),
+    UINT64_C(0x83c7088e1aab65db), UINT64_C(0xc45d1df942711d9a), UINT64_C(0x924d692ca61be758),
+    UINT64_C(0xda01ee641a708dea), UINT64_C(0xa26da3999aef774a), UINT64_C(0xf209787bb47d6b85),
+    UINT64_C(0xb454e4a179dd1877), UINT64_C(0x865b86925b9bc5c2), UINT64_C(0xc83553c5c8965d3d),
+    UINT64_C(0x952ab45cfa97a0b3), UINT64_C(0xde469fbd99a05fe3), UINT64_C(0xa59bc234db398c25),
+    UINT64_C(0xf6c69a72a3989f5c), UINT64_C(0xb7dcbf5354e9bece), UINT64_C(0x88fcf317f22241e2),
+    UINT64_C(0xcc20ce9bd35c78a5), UINT64_C(0x98165af37b2153df), UINT64_C(0xe2a0b5dc971f303a),
+    UINT64_C(0xa8d9d1535ce3b396), UINT64_C(0xfb9b7cd9a4a7443c), UINT64_C(0xbb764c4ca7a44410),
+    UINT64_C(0x8bab8eefb6409c1a), UINT64_C(0xd01fef10a657842c), UINT64_C(0x9b10a4e5e9913129),
+    UINT64_C(0xe7109bfba19c0c9d), UINT64_C(0xac2820d9623bf429), UINT64_C(0x80444b5e7aa7cf85),
+    UINT64_C(0xbf21e44003acdd2d), UINT64_C(0x8e679c2f5e44ff8f), UINT64_C(0xd433179d9c8cb841),
+    UINT64_C(0x9e19db92b4e31ba9), UINT64_C(0xeb96bf6ebadf77d9), UINT64_C(0xaf87023b9bf0ee6b),
+};
+
+static const int16_t cached_pow_e[] = {
+    -1220, -1193, -1166, -1140, -1113, -1087, -1060, -1034, -1007, -980,
+    -954, -927, -901, -874, -847, -821, -794, -768, -741, -715,
+    -688, -661, -635, -608, -582, -555, -529, -502, -475, -449,
+    -422, -396, -369, -343, -316, -289, -263, -236, -210, -183,
+    -157, -130, -103, -77, -50, -24, 3, 30, 56, 83,
+    109, 136, 162, 189, 216, 242, 269, 295, 322, 348,
+    375, 402, 428, 455, 481, 508, 534, 561, 588, 614,
+    641, 667, 694, 720, 747, 774, 800, 827, 853, 880,
+    907, 933, 960, 986, 1013, 1039, 1066,
+};
+
+/* High 64 bits of 10^e, e = -348 .. 347, normalized to [2^127, 2^128) and
+ * rounded down */
+static const uint64_t pow10_hi[] = {
+    UINT64_C(0xfa8fd5a0081c0288), UINT64_C(0x9c99e58405118195), UINT64_C(0xc3c05ee50655e1fa),
+    UINT64_C(0xf4b0769e47eb5a78), UINT64_C(0x98ee4a22ecf3188b), UINT64_C(0xbf29dcaba82fdeae),
+    UINT64_C(0xeef453d6923bd65a), UINT64_C(0x9558b4661b6565f8), UINT64_C(0xbaaee17fa23ebf76),
+    UINT64_C(0xe95a99df8ace6f53), UINT64_C(0x91d8a02bb6c10594), UINT64_C(0xb64ec836a47146f9),
+    UINT64_C(0xe3e27a444d8d98b7), UINT64_C(0x8e6d8c6ab0787f72), UINT64_C(0xb208ef855c969f4f),
+    UINT64_C(0xde8b2b66b3bc4723), UINT64_C(0x8b16fb203055ac76), UINT64_C(0xaddcb9e83c6b1793),
+    UINT64_C(0xd953e8624b85dd78), UINT64_C(0x87d4713d6f33aa6b), UINT64_C(0xa9c98d8ccb009506),
+    UINT64_C(0xd43bf0effdc0ba48), UINT64_C(0x84a57695fe98746d), UINT64_C(0xa5ced43b7e3e9188),
+    UINT64_C(0xcf42894a5dce35ea), UINT64_C(0x818995ce7aa0e1b2), UINT64_C(0xa1ebfb4219491a1f),
+    UINT64_C(0xca66fa129f9b60a6), UINT64_C(0xfd00b897478238d0), UINT64_C(0x9e20735e8cb16382),
+    UINT64_C(0xc5a890362fddbc62), UINT64_C(0xf712b443bbd52b7b), UINT64_C(0x9a6bb0aa55653b2d),
+    UINT64_C(0xc1069cd4eabe89f8), UINT64_C(0xf148440a256e2c76), UINT64_C(0x96cd2a865764dbca),
+    UINT64_C(0xbc807527ed3e12bc), UINT64_C(0xeba09271e88d976b), UINT64_C(0x93445b8731587ea3),
+    UINT64_C(0xb8157268fdae9e4c), UINT64_C(0xe61acf033d1a45df), UINT64_C(0x8fd0c16206306bab),
+    UINT64_C(0xb3c4f1ba87bc8696), UINT64_C(0xe0b62e2929aba83c), UINT64_C(0x8c71dcd9ba0b4925),
+    UINT64_C(0xaf8e5410288e1b6f), UINT64_C(0xdb71e91432b1a24a), UINT64_C(0x892731ac9faf056e),
+    UINT64_C(0xab70fe17c79ac6ca), UINT64_C(0xd64d3d9db981787d), UINT64_C(0x85f0468293f0eb4e),
+    UINT64_C(0xa76c582338ed2621), UINT64_C(0xd1476e2c07286faa), UINT64_C(0x82cca4db847945ca),
+    UINT64_C(0xa37fce126597973c), UINT64_C(0xcc5fc196fefd7d0c), UINT64_C(0xff77b1fcbebcdc4f),
+    UINT64_C(0x9faacf3df73609b1), UINT64_C(0xc795830d75038c1d), UINT64_C(0xf97ae3d0d2446f25),
+    UINT64_C(0x9becce62836ac577), UINT64_C(0xc2e801fb244576d5), UINT64_C(0xf3a20279ed56d48a),
+    UINT64_C(0x9845418c345644d6), UINT64_C(0xbe5691ef416bd60c), UINT64_C(0xedec366b11c6cb8f),
+    UINT64_C(0x94b3a202eb1c3f39), UINT64_C(0xb9e08a83a5e34f07), UINT64_C(0xe858ad248f5c22c9),
+    UINT64_C(0x91376c36d99995be), UINT64_C(0xb58547448ffffb2d), UINT64_C(0xe2e69915b3fff9f9),
+    UINT64_C(0x8dd01fad907ffc3b), UINT64_C(0xb1442798f49ffb4a), UINT64_C(0xdd95317f31c7fa1d),
+    UINT64_C(0x8a7d3eef7f1cfc52), UINT64_C(0xad1c8eab5ee43b66), UINT64_C(0xd863b256369d4a40),
+    UINT64_C(0x873e4f75e2224e68), UINT64_C(0xa90de3535aaae202), UINT64_C(0xd3515c2831559a83),
+    UINT64_C(0x8412d9991ed58091), UINT64_C(0xa5178fff668ae0b6), UINT64_C(0xce5d73ff402d98e3),
+    UINT64_C(0x80fa687f881c7f8e), UINT64_C(0xa139029f6a239f72), UINT64_C(0xc987434744ac874e),
+    UINT64_C(0xfbe9141915d7a922), UINT64_C(0x9d71ac8fada6c9b5), UINT64_C(0xc4ce17b399107c22),
+    UINT64_C(0xf6019da07f549b2b), UINT64_C(0x99c102844f94e0fb), UINT64_C(0xc0314325637a1939),
+    UINT64_C(0xf03d93eebc589f88), UINT64_C(0x96267c7535b763b5), UINT64_C(0xbbb01b9283253ca2),
+    UINT64_C(0xea9c227723ee8bcb), UINT64_C(0x92a1958a7675175f), UINT64_C(0xb749faed14125d36),
+    UINT64_C(0xe51c79a85916f484), UINT64_C(0x8f31cc0937ae58d2), UINT64_C(0xb2fe3f0b8599ef07),
+    UINT64_C(0xdfbdcece67006ac9), UINT64_C(0x8bd6a141006042bd), UINT64_C(0xaecc49914078536d),
+    UINT64_C(0xda7f5bf590966848), UINT64_C(0x888f99797a5e012d), UINT64_C(0xaab37fd7d8f58178),
+    UINT64_C(0xd5605fcdcf32e1d6), UINT64_C(0x855c3be0a17fcd26), UINT64_C(0xa6b34ad8c9dfc06f),
+    UINT64_C(0xd0601d8efc57b08b), UINT64_C(0x823c12795db6ce57), UINT64_C(0xa2cb1717b52481ed),
+    UINT64_C(0xcb7ddcdda26da268), UINT64_C(0xfe5d54150b090b02), UINT64_C(0x9efa548d26e5a6e1),
+    UINT64_C(0xc6b8e9b0709f109a), UINT64_C(0xf867241c8cc6d4c0), UINT64_C(0x9b407691d7fc44f8),
+    UINT64_C(0xc21094364dfb5636), UINT64_C(0xf294b943e17a2bc4), UINT64_C(0x979cf3ca6cec5b5a),
+    UINT64_C(0xbd8430bd08277231), UINT64_C(0xece53cec4a314ebd), UINT64_C(0x940f4613ae5ed136),
+    UINT64_C(0xb913179899f68584), UINT64_C(0xe757dd7ec07426e5), UINT64_C(0x9096ea6f3848984f),
+    UINT64_C(0xb4bca50b065abe63), UINT64_C(0xe1ebce4dc7f16dfb), UINT64_C(0x8d3360f09cf6e4bd),
+    UINT64_C(0xb080392cc4349dec), UINT64_C(0xdca04777f541c567), UINT64_C(0x89e42caaf9491b60),
+    UINT64_C(0xac5d37d5b79b6239), UINT64_C(0xd77485cb25823ac7), UINT64_C(0x86a8d39ef77164bc),
+    UINT64_C(0xa8530886b54dbdeb), UINT64_C(0xd267caa862a12d66), UINT64_C(0x8380dea93da4bc60),
+    UINT64_C(0xa46116538d0deb78), UINT64_C(0xcd795be870516656), UINT64_C(0x806bd9714632dff6),
+    UINT64_C(0xa086cfcd97bf97f3), UINT64_C(0xc8a883c0fdaf7df0), UINT64_C(0xfad2a4b13d1b5d6c),
+    UINT64_C(0x9cc3a6eec6311a63), UINT64_C(0xc3f490aa77bd60fc), UINT64_C(0xf4f1b4d515acb93b),
+    UINT64_C(0x991711052d8bf3c5), UINT64_C(0xbf5cd54678eef0b6), UINT64_C(0xef340a98172aace4),
+    UINT64_C(0x9580869f0e7aac0e), UINT64_C(0xbae0a846d2195712), UINT64_C(0xe998d258869facd7),
+    UINT64_C(0x91ff83775423cc06), UINT64_C(0xb67f6455292cbf08), UINT64_C(0xe41f3d6a7377eeca),
+    UINT64_C(0x8e938662882af53e), UINT64_C(0xb23867fb2a35b28d), UINT64_C(0xdec681f9f4c31f31),
+    UINT64_C(0x8b3c113c38f9f37e), UINT64_C(0xae0b158b4738705e), UINT64_C(0xd98ddaee19068c76),
+    UINT64_C(0x87f8a8d4cfa417c9), UINT64_C(0xa9f6d30a038d1dbc), UINT64_C(0xd47487cc8470652b),
+    UINT64_C(0x84c8d4dfd2c63f3b), UINT64_C(0xa5fb0a17c777cf09), UINT64_C(0xcf79cc9db955c2cc),
+    UINT64_C(0x81ac1fe293d599bf), UINT64_C(0xa21727db38cb002f), UINT64_C(0xca9cf1d206fdc03b),
+    UINT64_C(0xfd442e4688bd304a), UINT64_C(0x9e4a9cec15763e2e), UINT64_C(0xc5dd44271ad3cdba),
+    UINT64_C(0xf7549530e188c128), UINT64_C(0x9a94dd3e8cf578b9), UINT64_C(0xc13a148e3032d6e7),
+    UINT64_C(0xf18899b1bc3f8ca1), UINT64_C(0x96f5600f15a7b7e5), UINT64_C(0xbcb2b812db11a5de),
+    UINT64_C(0xebdf661791d60f56), UINT64_C(0x936b9fcebb25c995), UINT64_C(0xb84687c269ef3bfb),
+    UINT64_C(0xe65829b3046b0afa), UINT64_C(0x8ff71a0fe2c2e6dc), UINT64_C(0xb3f4e093db73a093),
+    UINT64_C(0xe0f218b8d25088b8), UINT64_C(0x8c974f7383725573), UINT64_C(0xafbd2350644eeacf),
+    UINT64_C(0xdbac6c247d62a583), UINT64_C(0x894bc396ce5da772), UINT64_C(0xab9eb47c81f5114f),
+    UINT64_C(0xd686619ba27255a2), UINT64_C(0x8613fd0145877585), UINT64_C(0xa798fc4196e952e7),
+    UINT64_C(0xd17f3b51fca3a7a0), UINT64_C(0x82ef85133de648c4), UINT64_C(0xa3ab66580d5fdaf5),
+    UINT64_C(0xcc963fee10b7d1b3), UINT64_C(0xffbbcfe994e5c61f), UINT64_C(0x9fd561f1fd0f9bd3),
+    UINT64_C(0xc7caba6e7c5382c8), UINT64_C(0xf9bd690a1b68637b), UINT64_C(0x9c1661a651213e2d),
+    UINT64_C(0xc31bfa0fe5698db8), UINT64_C(0xf3e2f893dec3f126), UINT64_C(0x986ddb5c6b3a76b7),
+    UINT64_C(0xbe89523386091465), UINT64_C(0xee2ba6c0678b597f), UINT64_C(0x94db483840b717ef),
+    UINT64_C(0xba121a4650e4ddeb), UINT64_C(0xe896a0d7e51e1566), UINT64_C(0x915e2486ef32cd60),
+    UINT64_C(0xb5b5ada8aaff80b8), UINT64_C(0xe3231912d5bf60e6), UINT64_C(0x8df5efabc5979c8f),
+    UINT64_C(0xb1736b96b6fd83b3), UINT64_C(0xddd0467c64bce4a0), UINT64_C(0x8aa22c0dbef60ee4),
+    UINT64_C(0xad4ab7112eb3929d), UINT64_C(0xd89d64d57a607744), UINT64_C(0x87625f056c7c4a8b),
+    UINT64_C(0xa93af6c6c79b5d2d), UINT64_C(0xd389b47879823479), UINT64_C(0x843610cb4bf160cb),
+    UINT64_C(0xa54394fe1eedb8fe), UINT64_C(0xce947a3da6a9273e), UINT64_C(0x811ccc668829b887),
+    UINT64_C(0xa163ff802a3426a8), UINT64_C(0xc9bcff6034c13052), UINT64_C(0xfc2c3f3841f17c67),
+    UINT64_C(0x9d9ba7832936edc0), UINT64_C(0xc5029163f384a931), UINT64_C(0xf64335bcf065d37d),
+    UINT64_C(0x99ea0196163fa42e), UINT64_C(0xc06481fb9bcf8d39), UINT64_C(0xf07da27a82c37088),
+    UINT64_C(0x964e858c91ba2655), UINT64_C(0xbbe226efb628afea), UINT64_C(0xeadab0aba3b2dbe5),
+    UINT64_C(0x92c8ae6b464fc96f), UINT64_C(0xb77ada0617e3bbcb), UINT64_C(0xe55990879ddcaabd),
+    UINT64_C(0x8f57fa54c2a9eab6), UINT64_C(0xb32df8e9f3546564), UINT64_C(0xdff9772470297ebd),
+    UINT64_C(0x8bfbea76c619ef36), UINT64_C(0xaefae51477a06b03), UINT64_C(0xdab99e59958885c4),
+    UINT64_C(0x88b402f7fd75539b), UINT64_C(0xaae103b5fcd2a881), UINT64_C(0xd59944a37c0752a2),
+    UINT64_C(0x857fcae62d8493a5), UINT64_C(0xa6dfbd9fb8e5b88e), UINT64_C(0xd097ad07a71f26b2),
+    UINT64_C(0x825ecc24c873782f), UINT64_C(0xa2f67f2dfa90563b), UINT64_C(0xcbb41ef979346bca),
+    UINT64_C(0xfea126b7d78186bc), UINT64_C(0x9f24b832e6b0f436), UINT64_C(0xc6ede63fa05d3143),
+    UINT64_C(0xf8a95fcf88747d94), UINT64_C(0x9b69dbe1b548ce7c), UINT64_C(0xc24452da229b021b),
+    UINT64_C(0xf2d56790ab41c2a2), UINT64_C(0x97c560ba6b0919a5), UINT64_C(0xbdb6b8e905cb600f),
+    UINT64_C(0xed246723473e3813), UINT64_C(0x9436c0760c86e30b), UINT64_C(0xb94470938fa89bce),
+    UINT64_C(0xe7958cb87392c2c2), UINT64_C(0x90bd77f3483bb9b9), UINT64_C(0xb4ecd5f01a4aa828),
+    UINT64_C(0xe2280b6c20dd5232), UINT64_C(0x8d590723948a535f), UINT64_C(0xb0af48ec79ace837),
+    UINT64_C(0xdcdb1b2798182244), UINT64_C(0x8a08f0f8bf0f156b), UINT64_C(0xac8b2d36eed2dac5),
+    UINT64_C(0xd7adf884aa879177), UINT64_C(0x86ccbb52ea94baea), UINT64_C(0xa87fea27a539e9a5),
+    UINT64_C(0xd29fe4b18e88640e), UINT64_C(0x83a3eeeef9153e89), UINT64_C(0xa48ceaaab75a8e2b),
+    UINT64_C(0xcdb02555653131b6), UINT64_C(0x808e17555f3ebf11), UINT64_C(0xa0b19d2ab70e6ed6),
+    UINT64_C(0xc8de047564d20a8b), UINT64_C(0xfb158592be068d2e), UINT64_C(0x9ced737bb6c4183d),
+    UINT64_C(0xc428d05aa4751e4c), UINT64_C(0xf53304714d9265df), UINT64_C(0x993fe2c6d07b7fab),
+    UINT64_C(0xbf8fdb78849a5f96), UINT64_C(0xef73d256a5c0f77c), UINT64_C(0x95a8637627989aad),
+    UINT64_C(0xbb127c53b17ec159), UINT64_C(0xe9d71b689dde71af), UINT64_C(0x9226712162ab070d),
+    UINT64_C(0xb6b00d69bb55c8d1), UINT64_C(0xe45c10c42a2b3b05), UINT64_C(0x8eb98a7a9a5b04e3),
+    UINT64_C(0xb267ed1940f1c61c), UINT64_C(0xdf01e85f912e37a3), UINT64_C(0x8b61313bbabce2c6),
+    UINT64_C(0xae397d8aa96c1b77), UINT64_C(0xd9c7dced53c72255), UINT64_C(0x881cea14545c7575),
+    UINT64_C(0xaa242499697392d2), UINT64_C(0xd4ad2dbfc3d07787), UINT64_C(0x84ec3c97da624ab4),
+    UINT64_C(0xa6274bbdd0fadd61), UINT64_C(0xcfb11ead453994ba), UINT64_C(0x81ceb32c4b43fcf4),
+    UINT64_C(0xa2425ff75e14fc31), UINT64_C(0xcad2f7f5359a3b3e), UINT64_C(0xfd87b5f28300ca0d),
+    UINT64_C(0x9e74d1b791e07e48), UINT64_C(0xc612062576589dda), UINT64_C(0xf79687aed3eec551),
+    UINT64_C(0x9abe14cd44753b52), UINT64_C(0xc16d9a0095928a27), UINT64_C(0xf1c90080baf72cb1),
+    UINT64_C(0x971da05074da7bee), UINT64_C(0xbce5086492111aea), UINT64_C(0xec1e4a7db69561a5),
+    UINT64_C(0x9392ee8e921d5d07), UINT64_C(0xb877aa3236a4b449), UINT64_C(0xe69594bec44de15b),
+    UINT64_C(0x901d7cf73ab0acd9), UINT64_C(0xb424dc35095cd80f), UINT64_C(0xe12e13424bb40e13),
+    UINT64_C(0x8cbccc096f5088cb), UINT64_C(0xafebff0bcb24aafe), UINT64_C(0xdbe6fecebdedd5be),
+    UINT64_C(0x89705f4136b4a597), UINT64_C(0xabcc77118461cefc), UINT64_C(0xd6bf94d5e57a42bc),
+    UINT64_C(0x8637bd05af6c69b5), UINT64_C(0xa7c5ac471b478423), UINT64_C(0xd1b71758e219652b),
+    UINT64_C(0x83126e978d4fdf3b), UINT64_C(0xa3d70a3d70a3d70a), UINT64_C(0xcccccccccccccccc),
+    UINT64_C(0x8000000000000000), UINT64_C(0xa000000000000000), UINT64_C(0xc800000000000000),
+    UINT64_C(0xfa00000000000000), UINT64_C(0x9c40000000000000), UINT64_C(0xc350000000000000),
+    UINT64_C(0xf424000000000000), UINT64_C(0x9896800000000000), UINT64_C(0xbebc200000000000),
+    UINT64_C(0xee6b280000000000), UINT64_C(0x9502f90000000000), UINT64_C(0xba43b74000000000),
+    UINT64_C(0xe8d4a51000000000), UINT64_C(0x9184e72a00000000), UINT64_C(0xb5e620f480000000),
+    UINT64_C(0xe35fa931a0000000), UINT64_C(0x8e1bc9bf04000000), UINT64_C(0xb1a2bc2ec5000000),
+    UINT64_C(0xde0b6b3a76400000), UINT64_C(0x8ac7230489e80000), UINT64_C(0xad78ebc5ac620000),
+    UINT64_C(0xd8d726b7177a8000), UINT64_C(0x878678326eac9000), UINT64_C(0xa968163f0a57b400),
+    UINT64_C(0xd3c21bcecceda100), UINT64_C(0x84595161401484a0), UINT64_C(0xa56fa5b99019a5c8),
+    UINT64_C(0xcecb8f27f4200f3a), UINT64_C(0x813f3978f8940984), UINT64_C(0xa18f07d736b90be5),
+    UINT64_C(0xc9f2c9cd04674ede), UINT64_C(0xfc6f7c4045812296), UINT64_C(0x9dc5ada82b70b59d),
+    UINT64_C(0xc5371912364ce305), UINT64_C(0xf684df56c3e01bc6), UINT64_C(0x9a130b963a6c115c),
+    UINT64_C(0xc097ce7bc90715b3), UINT64_C(0xf0bdc21abb48db20), UINT64_C(0x96769950b50d88f4),
+    UINT64_C(0xbc143fa4e250eb31), UINT64_C(0xeb194f8e1ae525fd), UINT64_C(0x92efd1b8d0cf37be),
+    UINT64_C(0xb7abc627050305ad), UINT64_C(0xe596b7b0c643c719), UINT64_C(0x8f7e32ce7bea5c6f),
+    UINT64_C(0xb35dbf821ae4f38b), UINT64_C(0xe0352f62a19e306e), UINT64_C(0x8c213d9da502de45),
+    UINT64_C(0xaf298d050e4395d6), UINT64_C(0xdaf3f04651d47b4c), UINT64_C(0x88d8762bf324cd0f),
+    UINT64_C(0xab0e93b6efee0053), UINT64_C(0xd5d238a4abe98068), UINT64_C(0x85a36366eb71f041),
+    UINT64_C(0xa70c3c40a64e6c51), UINT64_C(0xd0cf4b50cfe20765), UINT64_C(0x82818f1281ed449f),
+    UINT64_C(0xa321f2d7226895c7), UINT64_C(0xcbea6f8ceb02bb39), UINT64_C(0xfee50b7025c36a08),
+    UINT64_C(0x9f4f2726179a2245), UINT64_C(0xc722f0ef9d80aad6), UINT64_C(0xf8ebad2b84e0d58b),
+    UINT64_C(0x9b934c3b330c8577), UINT64_C(0xc2781f49ffcfa6d5), UINT64_C(0xf316271c7fc3908a),
+    UINT64_C(0x97edd871cfda3a56), UINT64_C(0xbde94e8e43d0c8ec), UINT64_C(0xed63a231d4c4fb27),
+    UINT64_C(0x945e455f24fb1cf8), UINT64_C(0xb975d6b6ee39e436), UINT64_C(0xe7d34c64a9c85d44),
+    UINT64_C(0x90e40fbeea1d3a4a), UINT64_C(0xb51d13aea4a488dd), UINT64_C(0xe264589a4dcdab14),
+    UINT64_C(0x8d7eb76070a08aec), UINT64_C(0xb0de65388cc8ada8), UINT64_C(0xdd15fe86affad912),
+    UINT64_C(0x8a2dbf142dfcc7ab), UINT64_C(0xacb92ed9397bf996), UINT64_C(0xd7e77a8f87daf7fb),
+    UINT64_C(0x86f0ac99b4e8dafd), UINT64_C(0xa8acd7c0222311bc), UINT64_C(0xd2d80db02aabd62b),
+    UINT64_C(0x83c7088e1aab65db), UINT64_C(0xa4b8cab1a1563f52), UINT64_C(0xcde6fd5e09abcf26),
+    UINT64_C(0x80b05e5ac60b6178), UINT64_C(0xa0dc75f1778e39d6), UINT64_C(0xc913936dd571c84c),
+    UINT64_C(0xfb5878494ace3a5f), UINT64_C(0x9d174b2dcec0e47b), UINT64_C(0xc45d1df942711d9a),
+    UINT64_C(0xf5746577930d6500), UINT64_C(0x9968bf6abbe85f20), UINT64_C(0xbfc2ef456ae276e8),
+    UINT64_C(0xefb3ab16c59b14a2), UINT64_C(0x95d04aee3b80ece5), UINT64_C(0xbb445da9ca61281f),
+    UINT64_C(0xea1575143cf97226), UINT64_C(0x924d692ca61be758), UINT64_C(0xb6e0c377cfa2e12e),
+    UINT64_C(0xe498f455c38b997a), UINT64_C(0x8edf98b59a373fec), UINT64_C(0xb2977ee300c50fe7),
+    UINT64_C(0xdf3d5e9bc0f653e1), UINT64_C(0x8b865b215899f46c), UINT64_C(0xae67f1e9aec07187),
+    UINT64_C(0xda01ee641a708de9), UINT64_C(0x884134fe908658b2), UINT64_C(0xaa51823e34a7eede),
+    UINT64_C(0xd4e5e2cdc1d1ea96), UINT64_C(0x850fadc09923329e), UINT64_C(0xa6539930bf6bff45),
+    UINT64_C(0xcfe87f7cef46ff16), UINT64_C(0x81f14fae158c5f6e), UINT64_C(0xa26da3999aef7749),
+    UINT64_C(0xcb090c8001ab551c), UINT64_C(0xfdcb4fa002162a63), UINT64_C(0x9e9f11c4014dda7e),
+    UINT64_C(0xc646d63501a1511d), UINT64_C(0xf7d88bc24209a565), UINT64_C(0x9ae757596946075f),
+    UINT64_C(0xc1a12d2fc3978937), UINT64_C(0xf209787bb47d6b84), UINT64_C(0x9745eb4d50ce6332),
+    UINT64_C(0xbd176620a501fbff), UINT64_C(0xec5d3fa8ce427aff), UINT64_C(0x93ba47c980e98cdf),
+    UINT64_C(0xb8a8d9bbe123f017), UINT64_C(0xe6d3102ad96cec1d), UINT64_C(0x9043ea1ac7e41392),
+    UINT64_C(0xb454e4a179dd1877), UINT64_C(0xe16a1dc9d8545e94), UINT64_C(0x8ce2529e2734bb1d),
+    UINT64_C(0xb01ae745b101e9e4), UINT64_C(0xdc21a1171d42645d), UINT64_C(0x899504ae72497eba),
+    UINT64_C(0xabfa45da0edbde69), UINT64_C(0xd6f8d7509292d603), UINT64_C(0x865b86925b9bc5c2),
+    UINT64_C(0xa7f26836f282b732), UINT64_C(0xd1ef0244af2364ff), UINT64_C(0x8335616aed761f1f),
+    UINT64_C(0xa402b9c5a8d3a6e7), UINT64_C(0xcd036837130890a1), UINT64_C(0x802221226be55a64),
+    UINT64_C(0xa02aa96b06deb0fd), UINT64_C(0xc83553c5c8965d3d), UINT64_C(0xfa42a8b73abbf48c),
+    UINT64_C(0x9c69a97284b578d7), UINT64_C(0xc38413cf25e2d70d), UINT64_C(0xf46518c2ef5b8cd1),
+    UINT64_C(0x98bf2f79d5993802), UINT64_C(0xbeeefb584aff8603), UINT64_C(0xeeaaba2e5dbf6784),
+    UINT64_C(0x952ab45cfa97a0b2), UINT64_C(0xba756174393d88df), UINT64_C(0xe912b9d1478ceb17),
+    UINT64_C(0x91abb422ccb812ee), UINT64_C(0xb616a12b7fe617aa), UINT64_C(0xe39c49765fdf9d94),
+    UINT64_C(0x8e41ade9fbebc27d), UINT64_C(0xb1d219647ae6b31c), UINT64_C(0xde469fbd99a05fe3),
+    UINT64_C(0x8aec23d680043bee), UINT64_C(0xada72ccc20054ae9), UINT64_C(0xd910f7ff28069da4),
+    UINT64_C(0x87aa9aff79042286), UINT64_C(0xa99541bf57452b28), UINT64_C(0xd3fa922f2d1675f2),
+    UINT64_C(0x847c9b5d7c2e09b7), UINT64_C(0xa59bc234db398c25), UINT64_C(0xcf02b2c21207ef2e),
+    UINT64_C(0x8161afb94b44f57d), UINT64_C(0xa1ba1ba79e1632dc), UINT64_C(0xca28a291859bbf93),
+    UINT64_C(0xfcb2cb35e702af78), UINT64_C(0x9defbf01b061adab), UINT64_C(0xc56baec21c7a1916),
+    UINT64_C(0xf6c69a72a3989f5b), UINT64_C(0x9a3c2087a63f6399), UINT64_C(0xc0cb28a98fcf3c7f),
+    UINT64_C(0xf0fdf2d3f3c30b9f), UINT64_C(0x969eb7c47859e743), UINT64_C(0xbc4665b596706114),
+    UINT64_C(0xeb57ff22fc0c7959), UINT64_C(0x9316ff75dd87cbd8), UINT64_C(0xb7dcbf5354e9bece),
+    UINT64_C(0xe5d3ef282a242e81), UINT64_C(0x8fa475791a569d10), UINT64_C(0xb38d92d760ec4455),
+    UINT64_C(0xe070f78d3927556a), UINT64_C(0x8c469ab843b89562), UINT64_C(0xaf58416654a6babb),
+    UINT64_C(0xdb2e51bfe9d0696a), UINT64_C(0x88fcf317f22241e2), UINT64_C(0xab3c2fddeeaad25a),
+    UINT64_C(0xd60b3bd56a5586f1), UINT64_C(0x85c7056562757456), UINT64_C(0xa738c6bebb12d16c),
+    UINT64_C(0xd106f86e69d785c7), UINT64_C(0x82a45b450226b39c), UINT64_C(0xa34d721642b06084),
+    UINT64_C(0xcc20ce9bd35c78a5), UINT64_C(0xff290242c83396ce), UINT64_C(0x9f79a169bd203e41),
+    UINT64_C(0xc75809c42c684dd1), UINT64_C(0xf92e0c3537826145), UINT64_C(0x9bbcc7a142b17ccb),
+    UINT64_C(0xc2abf989935ddbfe), UINT64_C(0xf356f7ebf83552fe), UINT64_C(0x98165af37b2153de),
+    UINT64_C(0xbe1bf1b059e9a8d6), UINT64_C(0xeda2ee1c7064130c), UINT64_C(0x9485d4d1c63e8be7),
+    UINT64_C(0xb9a74a0637ce2ee1), UINT64_C(0xe8111c87c5c1ba99), UINT64_C(0x910ab1d4db9914a0),
+    UINT64_C(0xb54d5e4a127f59c8), UINT64_C(0xe2a0b5dc971f303a), UINT64_C(0x8da471a9de737e24),
+    UINT64_C(0xb10d8e1456105dad), UINT64_C(0xdd50f1996b947518), UINT64_C(0x8a5296ffe33cc92f),
+    UINT64_C(0xace73cbfdc0bfb7b), UINT64_C(0xd8210befd30efa5a), UINT64_C(0x8714a775e3e95c78),
+    UINT64_C(0xa8d9d1535ce3b396), UINT64_C(0xd31045a8341ca07c), UINT64_C(0x83ea2b892091e44d),
+    UINT64_C(0xa4e4b66b68b65d60), UINT64_C(0xce1de40642e3f4b9), UINT64_C(0x80d2ae83e9ce78f3),
+    UINT64_C(0xa1075a24e4421730), UINT64_C(0xc94930ae1d529cfc), UINT64_C(0xfb9b7cd9a4a7443c),
+    UINT64_C(0x9d412e0806e88aa5), UINT64_C(0xc491798a08a2ad4e), UINT64_C(0xf5b5d7ec8acb58a2),
+    UINT64_C(0x9991a6f3d6bf1765), UINT64_C(0xbff610b0cc6edd3f), UINT64_C(0xeff394dcff8a948e),
+    UINT64_C(0x95f83d0a1fb69cd9), UINT64_C(0xbb764c4ca7a4440f), UINT64_C(0xea53df5fd18d5513),
+    UINT64_C(0x92746b9be2f8552c), UINT64_C(0xb7118682dbb66a77), UINT64_C(0xe4d5e82392a40515),
+    UINT64_C(0x8f05b1163ba6832d), UINT64_C(0xb2c71d5bca9023f8), UINT64_C(0xdf78e4b2bd342cf6),
+    UINT64_C(0x8bab8eefb6409c1a), UINT64_C(0xae9672aba3d0c320), UINT64_C(0xda3c0f568cc4f3e8),
+    UINT64_C(0x8865899617fb1871), UINT64_C(0xaa7eebfb9df9de8d), UINT64_C(0xd51ea6fa85785631),
+    UINT64_C(0x8533285c936b35de), UINT64_C(0xa67ff273b8460356), UINT64_C(0xd01fef10a657842c),
+    UINT64_C(0x8213f56a67f6b29b), UINT64_C(0xa298f2c501f45f42), UINT64_C(0xcb3f2f7642717713),
+    UINT64_C(0xfe0efb53d30dd4d7), UINT64_C(0x9ec95d1463e8a506), UINT64_C(0xc67bb4597ce2ce48),
+    UINT64_C(0xf81aa16fdc1b81da), UINT64_C(0x9b10a4e5e9913128), UINT64_C(0xc1d4ce1f63f57d72),
+    UINT64_C(0xf24a01a73cf2dccf), UINT64_C(0x976e41088617ca01), UINT64_C(0xbd49d14aa79dbc82),
+    UINT64_C(0xec9c459d51852ba2), UINT64_C(0x93e1ab8252f33b45), UINT64_C(0xb8da1662e7b00a17),
+    UINT64_C(0xe7109bfba19c0c9d), UINT64_C(0x906a617d450187e2), UINT64_C(0xb484f9dc9641e9da),
+    UINT64_C(0xe1a63853bbd26451), UINT64_C(0x8d07e33455637eb2), UINT64_C(0xb049dc016abc5e5f),
+    UINT64_C(0xdc5c5301c56b75f7), UINT64_C(0x89b9b3e11b6329ba), UINT64_C(0xac2820d9623bf429),
+    UINT64_C(0xd732290fbacaf133), UINT64_C(0x867f59a9d4bed6c0), UINT64_C(0xa81f301449ee8c70),
+    UINT64_C(0xd226fc195c6a2f8c), UINT64_C(0x83585d8fd9c25db7), UINT64_C(0xa42e74f3d032f525),
+    UINT64_C(0xcd3a1230c43fb26f), UINT64_C(0x80444b5e7aa7cf85), UINT64_C(0xa0555e361951c366),
+    UINT64_C(0xc86ab5c39fa63440), UINT64_C(0xfa856334878fc150), UINT64_C(0x9c935e00d4b9d8d2),
+    UINT64_C(0xc3b8358109e84f07), UINT64_C(0xf4a642e14c6262c8), UINT64_C(0x98e7e9cccfbd7dbd),
+    UINT64_C(0xbf21e44003acdd2c), UINT64_C(0xeeea5d5004981478), UINT64_C(0x95527a5202df0ccb),
+    UINT64_C(0xbaa718e68396cffd), UINT64_C(0xe950df20247c83fd), UINT64_C(0x91d28b7416cdd27e),
+    UINT64_C(0xb6472e511c81471d), UINT64_C(0xe3d8f9e563a198e5), UINT64_C(0x8e679c2f5e44ff8f),
+    UINT64_C(0xb201833b35d63f73), UINT64_C(0xde81e40a034bcf4f), UINT64_C(0x8b112e86420f6191),
+    UINT64_C(0xadd57a27d29339f6), UINT64_C(0xd94ad8b1c7380874), UINT64_C(0x87cec76f1c830548),
+    UINT64_C(0xa9c2794ae3a3c69a), UINT64_C(0xd433179d9c8cb841), UINT64_C(0x849feec281d7f328),
+    UINT64_C(0xa5c7ea73224deff3), UINT64_C(0xcf39e50feae16bef), UINT64_C(0x81842f29f2cce375),
+    UINT64_C(0xa1e53af46f801c53), UINT64_C(0xca5e89b18b602368), UINT64_C(0xfcf62c1dee382c42),
+    UINT64_C(0x9e19db92b4e31ba9), UINT64_C(0xc5a05277621be293), UINT64_C(0xf70867153aa2db38),
+    UINT64_C(0x9a65406d44a5c903), UINT64_C(0xc0fe908895cf3b44), UINT64_C(0xf13e34aabb430a15),
+    UINT64_C(0x96c6e0eab509e64d), UINT64_C(0xbc789925624c5fe0), UINT64_C(0xeb96bf6ebadf77d8),
+    UINT64_C(0x933e37a534cbaae7), UINT64_C(0xb80dc58e81fe95a1), UINT64_C(0xe61136f2227e3b09),
+    UINT64_C(0x8fcac257558ee4e6), UINT64_C(0xb3bd72ed2af29e1f), UINT64_C(0xe0accfa875af45a7),
+    UINT64_C(0x8c6c01c9498d8b88), UINT64_C(0xaf87023b9bf0ee6a), UINT64_C(0xdb68c2ca82ed2a05),
+    UINT64_C(0x892179be91d43a43), UINT64_C(0xab69d82e364948d4), UINT64_C(0xd6444e39c3db9b09),
+    UINT64_C(0x85eab0e41a6940e5), UINT64_C(0xa7655d1d2103911f), UINT64_C(0xd13eb46469447567),
+};
+
+static const uint64_t pow10_u64[] = {
+    UINT64_C(1), UINT64_C(10), UINT64_C(100), UINT64_C(1000),
+    UINT64_C(10000), UINT64_C(100000), UINT64_C(1000000),
+    UINT64_C(10000000), UINT64_C(100000000), UINT64_C(1000000000),
+    UINT64_C(10000000000), UINT64_C(100000000000),
+    UINT64_C(1000000000000), UINT64_C(10000000000000),
+    UINT64_C(100000000000000), UINT64_C(1000000000000000),
+    UINT64_C(10000000000000000), UINT64_C(100000000000000000),
+    UINT64_C(1000000000000000000), UINT64_C(10000000000000000000)
+};
+
+/* High 64 bits of a * b; the low ones in *lo */
+static inline uint64_t mul_u64(uint64_t a, uint64_t b, uint64_t *lo)
+{
+#if defined(__SIZEOF_INT128__)
+    unsigned __int128 p = (unsigned __int128)a * b;
+
+    *lo = (uint64_t)p;
+    return (uint64_t)(p >> 64);
+#else
+    uint64_t a_lo = a & 0xffffffff, a_hi = a >> 32;
+    uint64_t b_lo = b & 0xffffffff, b_hi = b >> 32;
+    uint64_t ll = a_lo * b_lo, lh = a_lo * b_hi;
+    uint64_t hl = a_hi * b_lo, hh = a_hi * b_hi;
+    uint64_t mid = (ll >> 32) + (lh & 0xffffffff) + (hl & 0xffffffff);
+
+    *lo = (mid << 32) | (ll & 0xffffffff);
+    return hh + (lh >> 32) + (hl >> 32) + (mid >> 32);
+#endif
+}
+
+static inline int clz_u64(uint64_t x)
+{
+#if defined(__GNUC__)
+    return __builtin_clzll(x);
+#else
+    int n = 0;
+
+    while (!(x & (UINT64_C(1) << 63))) {
+        x <<= 1;
+        n++;
+    }
+    return n;
+#endif
+}
+
+static inline uint64_t double_bits(double d)
+{
+    uint64_t u;
+
+    memcpy(&u, &d, sizeof(u));
+    return u;
+}
+
+static inline double bits_double(uint64_t u)
+{
+    double d;
+
+    memcpy(&d, &u, sizeof(d));
+    return d;
+}
+
+/* --- Grisu2 --- */
+
+#define DP_SIGNIFICAND_MASK     UINT64_C(0x000fffffffffffff)
+#define DP_HIDDEN_BIT           UINT64_C(0x0010000000000000)
+#define DP_EXPONENT_BIAS        1075    /* 1023 + 52 */
+
+typedef struct {
+    uint64_t f;
+    int e;
+} diy_fp_t;
+
+static inline diy_fp_t diy_fp(uint64_t f, int e)
+{
+    diy_fp_t r;
+
+    r.f = f;
+    r.e = e;
+    return r;
+}
+
+/* Product rounded to 64 bits */
+static inline diy_fp_t diy_fp_mul(diy_fp_t x, diy_fp_t y)
+{
+    uint64_t lo;
+    uint64_t hi = mul_u64(x.f, y.f, &lo);
+
+    return diy_fp(hi + (lo >> 63), x.e + y.e + 64);
+}
+
+static inline diy_fp_t diy_fp_normalize(diy_fp_t x)
+{
+    int s = clz_u64(x.f);
+
+    return diy_fp(x.f << s, x.e - s);
+}
+
+/* The boundaries m- and m+ of v, normalized to the exponent of m+ */
+static void diy_fp_boundaries(diy_fp_t v, diy_fp_t *mi, diy_fp_t *pl)
+{
+    diy_fp_t p = diy_fp_normalize(diy_fp((v.f << 1) + 1, v.e - 1));
+    diy_fp_t m = (v.f == DP_HIDDEN_BIT) ? diy_fp((v.f << 2) - 1, v.e - 2)
+                                        : diy_fp((v.f << 1) - 1, v.e - 1);
+
+    m.f <<= m.e - p.e;
+    m.e = p.e;
+    *mi = m;
+    *pl = p;
+}
+
+/* Cached power c = 10^-k such that the product with a number of binary
+ * exponent e has its exponent in [-60, -32] */
+static diy_fp_t cached_power(int e, int *k)
+{
+    double dk = (-61 - e) * 0.30102999566398114 + 347;
+    int ik = (int)dk;
+    int index;
+
+    if (dk - ik > 0.0)
+        ik++;
+    index = (ik >> 3) + 1;
+    *k = -(-348 + index * 8);
+    return diy_fp(cached_pow_f[index], cached_pow_e[index]);
+}
+
+static inline void grisu_round(char *buffer, int len, uint64_t delta,
+                               uint64_t rest, uint64_t ten_kappa, uint64_t wp_w)
+{
+    while (rest < wp_w && delta - rest >= ten_kappa &&
+           (rest + ten_kappa < wp_w || wp_w - rest > rest + ten_kappa - wp_w)) {
+        buffer[len - 1]--;
+        rest += ten_kappa;
+    }
+}
+
+static inline int count_digits_u32(uint32_t n)
+{
+    int d = 1;
+
+    while (n >= 10) {
+        n /= 10;
+        d++;
+    }
+    return d;
+}
+
+static int grisu_digits(diy_fp_t w, diy_fp_t mp, uint64_t delta,
+                        char *buffer, int *k)
+{
+    diy_fp_t one = diy_fp(UINT64_C(1) << -mp.e, mp.e);
+    uint64_t wp_w = mp.f - w.f;
+    uint32_t p1 = (uint32_t)(mp.f >> -one.e);
+    uint64_t p2 = mp.f & (one.f - 1);
+    int kappa = count_digits_u32(p1);
+    int len = 0;
+
+    while (kappa > 0) {
+        uint32_t div = (uint32_t)pow10_u64[kappa - 1];
+        uint32_t d = p1 / div;
+        uint64_t rest;
+
+        p1 %= div;
+        if (d || len)
+            buffer[len++] = (char)('0' + d);
+        kappa--;
+        rest = ((uint64_t)p1 << -one.e) + p2;
+        if (rest <= delta) {
+            *k += kappa;
+            grisu_round(buffer, len, delta, rest, pow10_u64[kappa] << -one.e, wp_w);
+            return len;
+        }
+    }
+
+    while (1) {
+        int d;
+
+        p2 *= 10;
+        delta *= 10;
+        d = (int)(p2 >> -one.e);
+        if (d || len)
+            buffer[len++] = (char)('0' + d);
+        p2 &= one.f - 1;
+        kappa--;
+        if (p2 < delta) {
+            *k += kappa;
+            grisu_round(buffer, len, delta, p2, one.f,
+                        -kappa < 20 ? wp_w * pow10_u64[-kappa] : 0);
+            return len;
+        }
+    }
+}
+
+/* Digits of a finite v > 0: v ~= digits * 10^*k. Returns their count */
+static int grisu2(double v, char *buffer, int *k)
+{
+    uint64_t u = double_bits(v);
+    int biased = (int)((u >> 52) & 0x7ff);
+    uint64_t f = u & DP_SIGNIFICAND_MASK;
+    diy_fp_t d, w, mi, pl, c, wm, wp;
+    int len;
+
+    d = biased ? diy_fp(f + DP_HIDDEN_BIT, biased - DP_EXPONENT_BIAS)
+               : diy_fp(f, 1 - DP_EXPONENT_BIAS);
+    diy_fp_boundaries(d, &mi, &pl);
+    c = cached_power(pl.e, k);
+    w = diy_fp_mul(diy_fp_normalize(d), c);
+    wp = diy_fp_mul(pl, c);
+    wm = diy_fp_mul(mi, c);
+    wm.f++;
+    wp.f--;
+    len = grisu_digits(w, wp, wp.f - wm.f, buffer, k);
+
+    /* No trailing zeros */
+    while (len > 1 && buffer[len - 1] == '0') {
+        len--;
+        (*k)++;
+    }
+    return len;
+}
+
+/* Lay out digits (value digits * 10^k) the way "%.<precision>g" does */
+static int format_digits(char *str, int neg, const char *digits, int len,
+                         int k, int precision)
+{
+    char *p = str;
+    int x = len + k - 1;        /* exponent of the first digit */
+    int i;
+
+    if (neg)
+        *p++ = '-';
+
+    if (x < -4 || x >= precision) {
+        *p++ = digits[0];
+        if (len > 1) {
+            *p++ = '.';
+            memcpy(p, digits + 1, len - 1);
+            p += len - 1;
+        }
+        *p++ = 'e';
+        if (x < 0) {
+            *p++ = '-';
+            x = -x;
+        } else {
+            *p++ = '+';
+        }
+        if (x >= 100) {
+            *p++ = (char)('0' + x / 100);
+            x %= 100;
+        }
+        *p++ = (char)('0' + x / 10);
+        *p++ = (char)('0' + x % 10);
+    } else if (x < 0) {
+        *p++ = '0';
+        *p++ = '.';
+        for (i = x + 1; i < 0; i++)
+            *p++ = '0';
+        memcpy(p, digits, len);
+        p += len;
+    } else if (len <= x + 1) {
+        memcpy(p, digits, len);
+        p += len;
+        for (i = len; i <= x; i++)
+            *p++ = '0';
+    } else {
+        memcpy(p, digits, x + 1);
+        p += x + 1;
+        *p++ = '.';
+        memcpy(p, digits + x + 1, len - x - 1);
+        p += len - x - 1;
+    }
+
+    *p = 0;
+    return (int)(p - str);
+}
+
+/* Whole numbers, exactly as an integer. Returns 0 if num is not one */
+static int format_integer(char *str, double num)
+{
+    char buf[20];
+    char *p = str;
+    uint64_t n;
+    int len = 0;
+
+    if (!(num > -9007199254740992.0 && num < 9007199254740992.0))
+        return 0;
+    n = (uint64_t)(num < 0 ? -num : num);
+    if ((double)n != (num < 0 ? -num : num))
+        return 0;
+
+    if (signbit(num))
+        *p++ = '-';     /* "-0" as well, as printf() */
+    do {
+        buf[len++] = (char)('0' + n % 10);
+        n /= 10;
+    } while (n);
+    while (len)
+        *p++ = buf[--len];
+    *p = 0;
+
+    return (int)(p - str);
+}
+
+/* 0 if the slow path has to do it */
+static int fast_g_fmt(char *str, double num, int precision)
+{
+    char digits[24];
+    int len, k;
+    int neg = signbit(num) != 0;
+    double v = neg ? -num : num;
+
+    if (!isfinite(num))
+        return 0;
+
+    if (num == 0 || (v < 1e15 && (precision == 0 || v < pow10_u64[precision]))) {
+        len = format_integer(str, num);
+        if (len)
+            return len;
+    }
+
+    if (precision > 0 && v < DBL_MIN)
+        return 0;       /* subnormal: %g may need more than the digits */
+
+    len = grisu2(v, digits, &k);
+    if (precision == 0)
+        return format_digits(str, neg, digits, len, k, 17);
+    if (len <= precision)
+        return format_digits(str, neg, digits, len, k, precision);
+
+    return 0;
+}
+
+/* --- Eisel-Lemire --- */
+
+#define POW10_MIN       -348
+#define POW10_MAX       347
+
+/* 0 if w * 10^q needs the slow path */
+static int eisel_lemire(uint64_t w, int q, int neg, double *out)
+{
+    uint64_t hi, lo, mantissa, exp2;
+    int clz, msb;
+
+    if (w == 0) {
+        *out = neg ? -0.0 : 0.0;
+        return 1;
+    }
+    if (q < POW10_MIN || q > POW10_MAX)
+        return 0;
+
+    clz = clz_u64(w);
+    w <<= clz;
+    exp2 = (uint64_t)(((217706 * q) >> 16) + 64 + 1023) - clz;
+
+    hi = mul_u64(w, pow10_hi[q - POW10_MIN], &lo);
+    if ((hi & 0x1ff) == 0x1ff && lo + w < w)
+        return 0;       /* the low 64 bits of 10^q could change it */
+
+    msb = (int)(hi >> 63);
+    mantissa = hi >> (msb + 9);
+    exp2 -= 1 ^ msb;
+
+    if (lo == 0 && (hi & 0x1ff) == 0 && (mantissa & 3) == 1)
+        return 0;       /* halfway between two doubles */
+
+    mantissa += mantissa & 1;
+    mantissa >>= 1;
+    if (mantissa >> 53) {
+        mantissa >>= 1;
+        exp2++;
+    }
+    if (exp2 - 1 >= 0x7ff - 1)
+        return 0;       /* subnormal, or overflow */
+
+    *out = bits_double((exp2 << 52) | (mantissa & DP_SIGNIFICAND_MASK) |
+                       ((uint64_t)neg << 63));
+    return 1;
+}
+
+/* A JSON number: -?digits(.digits)?([eE][-+]?digits)?; a leading '+' too.
+ * 0 if the slow path has to do it (hex, inf/nan, 20+ digits, ...) */
+static int fast_strtod(const char *nptr, char **endptr, double *out)
+{
+    const char *p = nptr;
+    uint64_t w = 0;
+    int neg = 0, digits = 0, any = 0, q = 0;
+
+    if (*p == '-' || *p == '+')
+        neg = *p++ == '-';
+    if (*p == '0' && (p[1] | 0x20) == 'x')
+        return 0;
+
+    for (; '0' <= *p && *p <= '9'; p++, any = 1) {
+        if (digits < 19) {
+            w = w * 10 + (*p - '0');
+            digits += w != 0;
+        } else if (*p != '0') {
+            return 0;
+        } else {
+            q++;
+        }
+    }
+    if (*p == '.') {
+        p++;
+        for (; '0' <= *p && *p <= '9'; p++, any = 1) {
+            if (digits < 19) {
+                w = w * 10 + (*p - '0');
+                digits += w != 0;
+                q--;
+            } else if (*p != '0') {
+                return 0;
+            }
+        }
+    }
+    if (!any)
+        return 0;
+    if ((*p | 0x20) == 'e') {
+        const char *e = p + 1;
+        int eneg = 0, x = 0;
+
+        if (*e == '-' || *e == '+')
+            eneg = *e++ == '-';
+        if ('0' <= *e && *e <= '9') {
+            for (; '0' <= *e && *e <= '9'; e++) {
+                if (x < 100000)
+                    x = x * 10 + (*e - '0');
+            }
+            q += eneg ? -x : x;
+            p = e;
+        }
+    }
+    *endptr = (char *)p;
+
+#if defined(FLT_EVAL_METHOD) && FLT_EVAL_METHOD == 0
+    /* Clinger: both w and 10^|q| are exact doubles, one rounding */
+    if (w <= (UINT64_C(1) << 53) && -22 <= q && q <= 22) {
+        static const double pow10_dbl[] = {
+            1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+            1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+        };
+        double d = (double)w;
+
+        d = q < 0 ? d / pow10_dbl[-q] : d * pow10_dbl[q];
+        *out = neg ? -d : d;
+        return 1;
+    }
+#endif
+
+    return eisel_lemire(w, q, neg, out);
+}
+
 /* Similar to strtod()<string->double>, but must be passed the current locale's decimal point
  * character. Guaranteed to be called at the start of any valid number in a string 
  * 仔细读这个函数，仔细读，没有想象中的那么难，不懂就查手册
@@ -113,6 +874,9 @@ double fpconv_strtod(const char *nptr, char **endptr)
     int buflen;
     double value;
 
+    if (fast_strtod(nptr, endptr, &value))
+        return value;
+
     /* System strtod() is fine when decimal point is '.' */
     if (locale_decimal_point == '.')
         return strtod(nptr, endptr);
@@ -159,7 +923,7 @@ static void set_number_format(char *fmt, int precision)
 {
     int d1, d2, i;
 
-    assert(1 <= precision && precision <= 14);
+    assert(1 <= precision && precision <= 17);
 
     /* Create printf format (%.14g) from precision */
     d1 = precision / 10;
@@ -175,7 +939,8 @@ static void set_number_format(char *fmt, int precision)
     fmt[i] = 0;
 }
 
-/* Assumes there is always at least 32 characters available in the target buffer */
+/* Assumes there is always at least 32 characters available in the target buffer
+ * precision 0: the shortest digits that read back as num ("%.17g" at worst) */
 int fpconv_g_fmt(char *str, double num, int precision)
 {
     char buf[FPCONV_G_FMT_BUFSIZE];
@@ -183,7 +948,11 @@ int fpconv_g_fmt(char *str, double num, int precision)
     int len;
     char *b;
 
-    set_number_format(fmt, precision);
+    len = fast_g_fmt(str, num, precision);
+    if (len)
+        return len;
+
+    set_number_format(fmt, precision ? precision : 17);
 
     /* Pass through when decimal point character is dot. */
     if (locale_decimal_point == '.')
@@ -37,9 +37,12 @@
  */
 
 #include <assert.h>
+#include <errno.h>
+#include <stdio.h>
 #include <string.h>
 #include <math.h>
 #include <limits.h>
+#include <stdint.h>
 #include <lua.h>
 #include <lauxlib.h>
 
@@ -55,6 +58,26 @@
 #define CJSON_VERSION   "2.1devel"
 #endif
 
+/* encode_to(): bytes passed to the writer at a time (roughly: output is
+ * cut between values, once this much is buffered) */
+#ifndef JSON_ENCODE_CHUNK
+#define JSON_ENCODE_CHUNK   8192
+#endif
+
+#define JSON_BUFFER_MT      "cjson.buffer"
+
+/* File handles of the io library, as taken by encode_to() */
+#if LUA_VERSION_NUM >= 502
+typedef luaL_Stream json_file_t;
+#define json_file_fp(f)     ((f)->closef ? (f)->f : NULL)
+#else
+#ifndef LUA_FILEHANDLE
+#define LUA_FILEHANDLE      "FILE*"
+#endif
+typedef FILE *json_file_t;
+#define json_file_fp(f)     (*(f))
+#endif
+
 /* Workaround for Solaris platforms missing isinf() */
 #if !defined(isinf) && (defined(USE_INTERNAL_ISINF) || defined(MISSING_ISINF))
 #define isinf(x) (!isnan(x) && isnan((x) - (x)))
@@ -69,6 +92,7 @@
 #define DEFAULT_DECODE_INVALID_NUMBERS 1
 #define DEFAULT_ENCODE_KEEP_BUFFER 1
 #define DEFAULT_ENCODE_NUMBER_PRECISION 14
+#define DEFAULT_DECODE_PRESIZE 0
 
 #ifdef DISABLE_INVALID_NUMBERS
 #undef DEFAULT_DECODE_INVALID_NUMBERS
@@ -124,14 +148,25 @@ static const char *json_token_type_name[] = {
     NULL
 };
 
+/* Output of encode() / encode_to() / encode_append() while it is being
+ * encoded. Only set while C code runs: cleared around the writer callback.
+ * encode() with encode_keep_buffer needs none */
+typedef struct {
+    strbuf_t *buf;
+    int owned;          /* buf is private to the call: freed on error */
+    int start;          /* encode_append(): length before, restored on error */
+    int writer;         /* encode_to(): stack index of the callback or file */
+    FILE *fp;           /* encode_to() into a file: the FILE* of the writer */
+    size_t written;     /* encode_to(): bytes passed on so far */
+} json_output_t;
+
+/* The options of a module instance (cjson, cjson.new()), an upvalue of its
+ * functions. Only the cjson.* configuration functions write it: encoding
+ * and decoding read it and write to the json_scratch_t instead */
 typedef struct {
     json_token_type_t ch2token[256];
     char escape2char[256];  /* Decoding */
 
-    /* encode_buf is only allocated and used when
-     * encode_keep_buffer is set */
-    strbuf_t encode_buf;
-
     int encode_sparse_convert;
     int encode_sparse_ratio;        /* ratio 比率 */
     int encode_sparse_safe;
@@ -139,22 +174,81 @@ typedef struct {
     int encode_invalid_numbers;     /* 2 => Encode as "null" */
     int encode_number_precision;
 
-    int encode_keep_buffer;         /* ==1:使用结构体自身的encode_buf,反之，使用外部的 */
+    int encode_keep_buffer;         /* ==1:使用json_scratch_t的encode_buf,反之，使用外部的 */
 
     int decode_invalid_numbers;     /* 是否处理某些特定的非法数字eg:Inf, NaN, hex */
     int decode_max_depth;
+    int decode_presize;             /* 解码前先预扫描一遍，用于预设table的大小 */
 } json_config_t;
 
+/* Scratch space of one lua_State, shared by its module instances: a
+ * userdata in the registry and the second upvalue of the functions.
+ * States on different threads have their own, so nothing the encoder or
+ * decoder writes is shared between them.
+ *
+ * Every strbuf of the module allocates through alloc, the lua_Alloc of
+ * the state, and running out of memory raises a Lua error on l, the
+ * thread that last entered the module. The scratch is only collected by
+ * lua_close(), after all finalizers have run, so buffers owned by other
+ * userdata (cjson.buffer(), decoders, lazy documents) may point to it */
+typedef struct {
+    strbuf_allocator_t alloc;
+    lua_State *l;
+
+    strbuf_t encode_buf;            /* encode_keep_buffer */
+    strbuf_t decode_buf;            /* json_parse_t.tmp of cjson.decode() */
+    int decode_busy;                /* decode_buf in use (a decode from a __gc
+                                     * in a decode gets its own) */
+    json_output_t *output;          /* encode_to()/encode_append() in progress */
+} json_scratch_t;
+
+/* A decode_buf grown past this is released after the decode */
+#define JSON_SCRATCH_KEEP   (1 << 20)
+
+/* Key cache of json_decode(): the keys of the last object decoded at
+ * each depth. Records in an array mostly repeat them, in the same order:
+ * a key that matches is pushed from the anchor table (an array lookup)
+ * instead of being hashed and interned again by lua_pushlstring(), and
+ * the key count sizes the hash part of the next object at that depth */
+#define JSON_SHAPE_DEPTH    8
+#define JSON_SHAPE_KEYS     32
+
+typedef struct {
+    const char *str;    /* the interned string, kept by the anchor table */
+    int len;
+} json_key_t;
+
+typedef struct {
+    int nkeys[JSON_SHAPE_DEPTH];
+    json_key_t key[JSON_SHAPE_DEPTH][JSON_SHAPE_KEYS];
+} json_shapes_t;
+
 typedef struct {
     /* 指向原始的被解码的buf,所以这里用了const修饰 */
     const char *data;   /* 被解析的字符串地址的head地址 */
     const char *ptr;    /* 当前解析到了那里 */
+    const char *end;    /* 结尾的'\0' */
 
     /* 解码器自己申请的一片MEM */
     strbuf_t   *tmp;    /* Temporary storage for strings */
 
     json_config_t *cfg; /* 对应的配置 */
     int current_depth;  /* 当前的嵌套深度 */
+
+    /* decode_presize: element counts of the arrays/objects, in the order
+     * they open (see json_prescan()). NULL when not in use */
+    strbuf_t   *sizes;
+    int         next_size;
+
+    /* Key cache, NULL when not in use. anchors: stack index of the table
+     * holding the cached keys, at [depth * JSON_SHAPE_KEYS + i + 1] */
+    json_shapes_t *shapes;
+    int         anchors;
+
+    /* cjson.lazy(): the tape being built (see LAZY DOCUMENTS), or NULL */
+    strbuf_t   *tape;
+
+    json_scratch_t *scratch;    /* owner of tmp, if tmp is its decode_buf */
 } json_parse_t;
 
 
@@ -218,6 +312,122 @@ static const char *char2escape[256] = {
     NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL,
 };
 
+/* ===== BLOCK SCANS =====
+ *
+ * Strings are copied in runs of bytes that need no work, found 16 at a
+ * time with SSE2 or NEON, and a byte at a time elsewhere or at the tail.
+ * The callers go byte by byte and only try a block scan after
+ * JSON_SCAN_HEAD plain bytes in a row: when escapes are dense the runs
+ * are short and a block load (and memcpy) costs more than it saves.
+ * Both scans are bounded by a length, so they never read past the data.
+ */
+
+#define JSON_SCAN_HEAD  8
+
+#if defined(__SSE2__) && defined(__GNUC__)
+#include <emmintrin.h>
+#define JSON_SCAN_SSE2
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+#include <arm_neon.h>
+#define JSON_SCAN_NEON
+#endif
+
+/* Length of the run of s that decodes as is: up to '"', '\\' or '\0' */
+static size_t json_string_run(const char *s, size_t len)
+{
+    size_t i = 0;
+
+#if defined(JSON_SCAN_SSE2)
+    const __m128i quote = _mm_set1_epi8('"');
+    const __m128i bslash = _mm_set1_epi8('\\');
+    const __m128i zero = _mm_setzero_si128();
+
+    for (; i + 16 <= len; i += 16) {
+        __m128i x = _mm_loadu_si128((const __m128i *)(s + i));
+        __m128i m = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(x, quote),
+                                              _mm_cmpeq_epi8(x, bslash)),
+                                 _mm_cmpeq_epi8(x, zero));
+        int mask = _mm_movemask_epi8(m);
+
+        if (mask)
+            return i + __builtin_ctz(mask);
+    }
+#elif defined(JSON_SCAN_NEON)
+    const uint8x16_t quote = vdupq_n_u8('"');
+    const uint8x16_t bslash = vdupq_n_u8('\\');
+
+    for (; i + 16 <= len; i += 16) {
+        uint8x16_t x = vld1q_u8((const uint8_t *)(s + i));
+        uint8x16_t m = vorrq_u8(vorrq_u8(vceqq_u8(x, quote), vceqq_u8(x, bslash)),
+                                vceqzq_u8(x));
+
+        if (vmaxvq_u8(m))
+            break;      /* the byte loop finds it */
+    }
+#endif
+
+    for (; i < len; i++) {
+        char ch = s[i];
+
+        if (ch == '"' || ch == '\\' || ch == '\0')
+            break;
+    }
+
+    return i;
+}
+
+/* Length of the run of s that encodes as is: up to a char2escape[] byte,
+ * i.e. a control character, '"', '/', '\\' or DEL */
+static size_t json_escape_run(const char *s, size_t len)
+{
+    size_t i = 0;
+
+#if defined(JSON_SCAN_SSE2)
+    const __m128i ctrl = _mm_set1_epi8(0x1f);
+    const __m128i quote = _mm_set1_epi8('"');
+    const __m128i slash = _mm_set1_epi8('/');
+    const __m128i bslash = _mm_set1_epi8('\\');
+    const __m128i del = _mm_set1_epi8(0x7f);
+
+    for (; i + 16 <= len; i += 16) {
+        __m128i x = _mm_loadu_si128((const __m128i *)(s + i));
+        __m128i m = _mm_cmpeq_epi8(_mm_min_epu8(x, ctrl), x);  /* x <= 0x1f */
+        int mask;
+
+        m = _mm_or_si128(m, _mm_cmpeq_epi8(x, quote));
+        m = _mm_or_si128(m, _mm_cmpeq_epi8(x, slash));
+        m = _mm_or_si128(m, _mm_cmpeq_epi8(x, bslash));
+        m = _mm_or_si128(m, _mm_cmpeq_epi8(x, del));
+        mask = _mm_movemask_epi8(m);
+        if (mask)
+            return i + __builtin_ctz(mask);
+    }
+#elif defined(JSON_SCAN_NEON)
+    const uint8x16_t ctrl = vdupq_n_u8(0x1f);
+    const uint8x16_t quote = vdupq_n_u8('"');
+    const uint8x16_t slash = vdupq_n_u8('/');
+    const uint8x16_t bslash = vdupq_n_u8('\\');
+    const uint8x16_t del = vdupq_n_u8(0x7f);
+
+    for (; i + 16 <= len; i += 16) {
+        uint8x16_t x = vld1q_u8((const uint8_t *)(s + i));
+        uint8x16_t m = vcleq_u8(x, ctrl);
+
+        m = vorrq_u8(m, vceqq_u8(x, quote));
+        m = vorrq_u8(m, vceqq_u8(x, slash));
+        m = vorrq_u8(m, vceqq_u8(x, bslash));
+        m = vorrq_u8(m, vceqq_u8(x, del));
+        if (vmaxvq_u8(m))
+            break;      /* the byte loop finds it */
+    }
+#endif
+
+    while (i < len && !char2escape[(unsigned char)s[i]])
+        i++;
+
+    return i;
+}
+
 /* ===== CONFIGURATION ===== */
 
 static json_config_t *json_fetch_config(lua_State *l)
@@ -231,6 +441,19 @@ static json_config_t *json_fetch_config(lua_State *l)
     return cfg;
 }
 
+/* Records l as the thread to raise allocation errors on */
+static json_scratch_t *json_enter_scratch(lua_State *l,
+                                          json_scratch_t *scratch)
+{
+    scratch->l = l;
+    return scratch;
+}
+
+static json_scratch_t *json_fetch_scratch(lua_State *l)
+{
+    return json_enter_scratch(l, lua_touserdata(l, lua_upvalueindex(2)));
+}
+
 /* Ensure the correct number of arguments have been provided：luaL_argcheck
  * 
  * Pad with nil to allow other functions to simply check arg[i]
@@ -344,27 +567,26 @@ static int json_cfg_encode_number_precision(lua_State *l)
 {
     json_config_t *cfg = json_arg_init(l, 1);
 
-    return json_integer_option(l, 1, &cfg->encode_number_precision, 1, 14);
+    return json_integer_option(l, 1, &cfg->encode_number_precision, 0, 14);
+}
+
+/* Configures the structural pre-scan sizing decoded tables */
+static int json_cfg_decode_presize(lua_State *l)
+{
+    json_config_t *cfg = json_arg_init(l, 1);
+
+    json_enum_option(l, 1, &cfg->decode_presize, NULL, 1);
+
+    return 1;
 }
 
 /* Configures JSON encoding buffer persistence */
 static int json_cfg_encode_keep_buffer(lua_State *l)
 {
     json_config_t *cfg = json_arg_init(l, 1);
-    int old_value;
-
-    old_value = cfg->encode_keep_buffer;
 
     json_enum_option(l, 1, &cfg->encode_keep_buffer, NULL, 1);
 
-    /* Init / free the buffer if the setting has changed */
-    if (old_value ^ cfg->encode_keep_buffer) {
-        if (cfg->encode_keep_buffer)
-            strbuf_init(&cfg->encode_buf, 0);
-        else
-            strbuf_free(&cfg->encode_buf);
-    }
-
     return 1;
 }
 
@@ -403,32 +625,83 @@ static int json_cfg_decode_invalid_numbers(lua_State *l)
     return 1;
 }
 
-static int json_destroy_config(lua_State *l)
+static int json_destroy_scratch(lua_State *l)
 {
-    json_config_t *cfg;
+    json_scratch_t *scratch = lua_touserdata(l, 1);
 
-    cfg = lua_touserdata(l, 1);
-    if (cfg)
-        strbuf_free(&cfg->encode_buf);
-    cfg = NULL;
+    strbuf_free(&scratch->encode_buf);
+    strbuf_free(&scratch->decode_buf);
 
     return 0;
 }
 
-static void json_create_config(lua_State *l)
+/* Before an error: frees or rolls back the output in progress */
+static void json_output_drop(json_scratch_t *scratch)
 {
-    json_config_t *cfg;
-    int i;
+    json_output_t *out = scratch->output;
 
-    cfg = lua_newuserdata(l, sizeof(*cfg));
+    if (!out)
+        return;
+
+    scratch->output = NULL;
+    if (out->owned)
+        strbuf_free(out->buf);
+    else
+        out->buf->length = out->start;
+}
+
+/* strbuf_allocator_t.fail: drops the output in progress, then raises the
+ * error. The buffer that could not grow is still intact. The private
+ * buffers of a decode leak and decode_busy stays set: later decodes get
+ * their own decode_buf */
+static void json_scratch_fail(void *ud, const char *msg)
+{
+    json_scratch_t *scratch = ud;
+
+    json_output_drop(scratch);
+    luaL_error(scratch->l, "%s", msg);
+}
+
+/* Pushes the scratch space of the state, created on first use */
+static void json_push_scratch(lua_State *l)
+{
+    static const char key = 0;
+    json_scratch_t *scratch;
+
+    lua_pushlightuserdata(l, (void *)&key);
+    lua_rawget(l, LUA_REGISTRYINDEX);
+    if (lua_touserdata(l, -1))
+        return;
+    lua_pop(l, 1);
+
+    scratch = lua_newuserdata(l, sizeof(*scratch));
+    scratch->alloc.alloc = lua_getallocf(l, &scratch->alloc.ud);
+    scratch->alloc.fail = json_scratch_fail;
+    scratch->alloc.fail_ud = scratch;
+    scratch->l = l;
+    scratch->decode_busy = 0;
+    scratch->output = NULL;
+    strbuf_init_alloc(&scratch->encode_buf, 0, &scratch->alloc);
+    strbuf_init_alloc(&scratch->decode_buf, 0, &scratch->alloc);
 
     /* Create GC method to clean up strbuf */
     lua_newtable(l);
-    lua_pushcfunction(l, json_destroy_config);
+    lua_pushcfunction(l, json_destroy_scratch);
     lua_setfield(l, -2, "__gc");
-
     lua_setmetatable(l, -2);
 
+    lua_pushlightuserdata(l, (void *)&key);
+    lua_pushvalue(l, -2);
+    lua_rawset(l, LUA_REGISTRYINDEX);
+}
+
+static void json_create_config(lua_State *l)
+{
+    json_config_t *cfg;
+    int i;
+
+    cfg = lua_newuserdata(l, sizeof(*cfg));
+
     cfg->encode_sparse_convert = DEFAULT_SPARSE_CONVERT;
     cfg->encode_sparse_ratio = DEFAULT_SPARSE_RATIO;
     cfg->encode_sparse_safe = DEFAULT_SPARSE_SAFE;
@@ -438,10 +711,7 @@ static void json_create_config(lua_State *l)
     cfg->decode_invalid_numbers = DEFAULT_DECODE_INVALID_NUMBERS;
     cfg->encode_keep_buffer = DEFAULT_ENCODE_KEEP_BUFFER;
     cfg->encode_number_precision = DEFAULT_ENCODE_NUMBER_PRECISION;
-
-#if DEFAULT_ENCODE_KEEP_BUFFER > 0
-    strbuf_init(&cfg->encode_buf, 0);
-#endif
+    cfg->decode_presize = DEFAULT_DECODE_PRESIZE;
 
     /* Decoding init */
 
@@ -503,11 +773,50 @@ static void json_create_config(lua_State *l)
 
 /* ===== ENCODING ===== */
 
-static void json_encode_exception(lua_State *l, json_config_t *cfg, strbuf_t *json, int lindex,
-                                  const char *reason)
+/* Before an error: releases the output buffer unless someone owns it */
+static void json_encode_release(lua_State *l)
+{
+    json_output_drop(json_fetch_scratch(l));
+}
+
+/* Passes the encode_to() output so far on to the writer */
+static void json_output_flush(lua_State *l)
+{
+    json_scratch_t *scratch = json_fetch_scratch(l);
+    json_output_t *out = scratch->output;
+    int len;
+    const char *data = strbuf_string(out->buf, &len);
+    int err;
+
+    if (!len)
+        return;
+
+    if (out->fp) {
+        if (fwrite(data, 1, len, out->fp) != (size_t)len) {
+            err = errno;
+            json_encode_release(l);
+            luaL_error(l, "Cannot write JSON: %s", strerror(err));
+        }
+    } else {
+        /* The callback may encode too: no output of ours meanwhile */
+        lua_pushvalue(l, out->writer);
+        lua_pushlstring(l, data, len);
+        scratch->output = NULL;
+        err = lua_pcall(l, 1, 0, 0);
+        scratch->output = out;
+        if (err) {
+            json_encode_release(l);
+            lua_error(l);
+        }
+    }
+
+    out->written += len;
+    strbuf_reset(out->buf);
+}
+
+static void json_encode_exception(lua_State *l, int lindex, const char *reason)
 {
-    if (!cfg->encode_keep_buffer)
-        strbuf_free(json);
+    json_encode_release(l);
     luaL_error(l, "Cannot serialise %s: %s",
                   lua_typename(l, lua_type(l, lindex)), reason);
 }
@@ -521,7 +830,8 @@ static void json_encode_exception(lua_State *l, json_config_t *cfg, strbuf_t *js
 static void json_append_string(lua_State *l, strbuf_t *json, int index)
 {
     const char *escstr;
-    int i;
+    size_t i, run;
+    int plain;
     const char *str;
     size_t len;
 
@@ -534,12 +844,23 @@ static void json_append_string(lua_State *l, strbuf_t *json, int index)
     strbuf_ensure_empty_length(json, len * 6 + 2);
 
     strbuf_append_char_unsafe(json, '\"');
+    plain = 0;
     for (i = 0; i < len; i++) {
         escstr = char2escape[(unsigned char)str[i]];
-        if (escstr)
+        if (escstr) {
             strbuf_append_string(json, escstr);
-        else
-            strbuf_append_char_unsafe(json, str[i]);
+            plain = 0;
+            continue;
+        }
+        strbuf_append_char_unsafe(json, str[i]);
+
+        /* A run of bytes needing no escape: copy the rest of it in one go */
+        if (++plain == JSON_SCAN_HEAD) {
+            run = json_escape_run(str + i + 1, len - i - 1);
+            strbuf_append_mem_unsafe(json, str + i + 1, run);
+            i += run;
+            plain = 0;
+        }
     }
     strbuf_append_char_unsafe(json, '\"');
 }
@@ -548,7 +869,7 @@ static void json_append_string(lua_State *l, strbuf_t *json, int index)
  * -1   object (not a pure array)
  * >=0  elements in array
  */
-static int lua_array_length(lua_State *l, json_config_t *cfg, strbuf_t *json)
+static int lua_array_length(lua_State *l, json_config_t *cfg)
 {
     double k;
     int max;
@@ -582,7 +903,7 @@ static int lua_array_length(lua_State *l, json_config_t *cfg, strbuf_t *json)
         max > items * cfg->encode_sparse_ratio &&
         max > cfg->encode_sparse_safe) {
         if (!cfg->encode_sparse_convert)
-            json_encode_exception(l, cfg, json, -1, "excessively sparse array");
+            json_encode_exception(l, -1, "excessively sparse array");
 
         return -1;
     }
@@ -591,7 +912,7 @@ static int lua_array_length(lua_State *l, json_config_t *cfg, strbuf_t *json)
 }
 
 static void json_check_encode_depth(lua_State *l, json_config_t *cfg,
-                                    int current_depth, strbuf_t *json)
+                                    int current_depth)
 {
     /* Ensure there are enough slots free to traverse a table (key,
      * value) and push a string for a potential error message.
@@ -606,8 +927,7 @@ static void json_check_encode_depth(lua_State *l, json_config_t *cfg,
     if (current_depth <= cfg->encode_max_depth && lua_checkstack(l, 3))
         return;
 
-    if (!cfg->encode_keep_buffer)
-        strbuf_free(json);
+    json_encode_release(l);
 
     luaL_error(l, "Cannot serialise, excessive nesting (%d)",
                current_depth);
@@ -664,7 +984,7 @@ static void json_append_number(lua_State *l, json_config_t *cfg,
     if (cfg->encode_invalid_numbers == 0) {
         /* Prevent encoding invalid numbers */
         if (isinf(num) || isnan(num))
-            json_encode_exception(l, cfg, json, lindex,
+            json_encode_exception(l, lindex,
                                   "must not be NaN or Infinity");
     } else if (cfg->encode_invalid_numbers == 1) {
         /* Encode NaN/Infinity separately to ensure Javascript compatible
@@ -727,7 +1047,7 @@ static void json_append_object(lua_State *l, json_config_t *cfg,
             json_append_string(l, json, -2);
             strbuf_append_char(json, ':');
         } else {
-            json_encode_exception(l, cfg, json, -2,
+            json_encode_exception(l, -2,
                                   "table key must be a number or string");
             /* never returns */
         }
@@ -747,6 +1067,15 @@ static void json_append_data(lua_State *l, json_config_t *cfg,
 {
     int len;
 
+    /* encode_to(): pass full chunks on between values.
+     * 2 slots: writer, chunk */
+    if (strbuf_length(json) >= JSON_ENCODE_CHUNK) {
+        json_output_t *out = json_fetch_scratch(l)->output;
+
+        if (out && out->writer && lua_checkstack(l, 2))
+            json_output_flush(l);
+    }
+
     switch (lua_type(l, -1)) {
     case LUA_TSTRING:
         json_append_string(l, json, -1);
@@ -762,8 +1091,8 @@ static void json_append_data(lua_State *l, json_config_t *cfg,
         break;
     case LUA_TTABLE:
         current_depth++;
-        json_check_encode_depth(l, cfg, current_depth, json);
-        len = lua_array_length(l, cfg, json);
+        json_check_encode_depth(l, cfg, current_depth);
+        len = lua_array_length(l, cfg);
         if (len > 0)	/* 这是一个连续的数组[1,2,3...N] */
             json_append_array(l, cfg, current_depth, json, len);
         else	/* 除开上面的其它情况 */
@@ -777,41 +1106,210 @@ static void json_append_data(lua_State *l, json_config_t *cfg,
             strbuf_append_mem(json, "null", 4);
             break;
         }
+        /* fall through */
     default:
         /* Remaining types (LUA_TFUNCTION, LUA_TUSERDATA, LUA_TTHREAD,
          * and LUA_TLIGHTUSERDATA) cannot be serialised */
-        json_encode_exception(l, cfg, json, -1, "type not supported");
+        json_encode_exception(l, -1, "type not supported");
         /* never returns */
     }
 }
 
-static int json_encode(lua_State *l)
+typedef void (*json_append_f)(lua_State *l, json_config_t *cfg,
+                              int current_depth, strbuf_t *json);
+
+/* cjson.encode() and cjson.msgpack_encode(): append encodes the value
+ * into the output buffer, returned as a string */
+static int json_encode_with(lua_State *l, json_append_f append)
 {
     json_config_t *cfg = json_fetch_config(l);
+    json_scratch_t *scratch = json_fetch_scratch(l);
     strbuf_t local_encode_buf;
     strbuf_t *encode_buf;
+    json_output_t out;
     char *json;
     int len;
 
     luaL_argcheck(l, lua_gettop(l) == 1, 1, "expected 1 argument");
 
+    /* Also forgets the output of a call aborted by a Lua error */
+    scratch->output = NULL;
     if (!cfg->encode_keep_buffer) {
         /* Use private buffer */
         encode_buf = &local_encode_buf;
-        strbuf_init(encode_buf, 0);
+        strbuf_init_alloc(encode_buf, 0, &scratch->alloc);
+        out.buf = encode_buf;
+        out.owned = 1;
+        out.start = 0;
+        out.writer = 0;
+        out.fp = NULL;
+        out.written = 0;
+        scratch->output = &out;
     } else {
         /* Reuse existing buffer */
-        encode_buf = &cfg->encode_buf;
+        encode_buf = &scratch->encode_buf;
         strbuf_reset(encode_buf);
     }
 
-    json_append_data(l, cfg, 0, encode_buf);
+    append(l, cfg, 0, encode_buf);
     json = strbuf_string(encode_buf, &len);
 
     lua_pushlstring(l, json, len);
 
-    if (!cfg->encode_keep_buffer)
+    if (!cfg->encode_keep_buffer) {
+        scratch->output = NULL;
         strbuf_free(encode_buf);
+    }
+
+    return 1;
+}
+
+static int json_encode(lua_State *l)
+{
+    return json_encode_with(l, json_append_data);
+}
+
+/* cjson.encode_to(writer, value): encodes value in chunks of about
+ * JSON_ENCODE_CHUNK bytes, each passed to writer(chunk) or written to
+ * writer when it is a file. Returns the number of bytes written */
+static int json_encode_to(lua_State *l)
+{
+    json_config_t *cfg = json_fetch_config(l);
+    json_scratch_t *scratch = json_fetch_scratch(l);
+    json_output_t out;
+    strbuf_t buf;
+
+    luaL_argcheck(l, lua_gettop(l) == 2, 2, "expected 2 arguments");
+
+    out.fp = NULL;
+    if (!lua_isfunction(l, 1)) {
+        json_file_t *f = luaL_checkudata(l, 1, LUA_FILEHANDLE);
+
+        out.fp = json_file_fp(f);
+        if (!out.fp)
+            luaL_error(l, "attempt to use a closed file");
+    }
+
+    scratch->output = NULL;
+    strbuf_init_alloc(&buf, JSON_ENCODE_CHUNK + JSON_ENCODE_CHUNK / 2,
+                      &scratch->alloc);
+    out.buf = &buf;
+    out.owned = 1;
+    out.start = 0;
+    out.writer = 1;
+    out.written = 0;
+    scratch->output = &out;
+
+    json_append_data(l, cfg, 0, &buf);
+    json_output_flush(l);
+
+    scratch->output = NULL;
+    strbuf_free(&buf);
+
+    lua_pushnumber(l, (lua_Number)out.written);
+    return 1;
+}
+
+/* cjson.encode_append(buffer, value): appends the encoding of value to
+ * a cjson.buffer(). Returns the buffer */
+static int json_encode_append(lua_State *l)
+{
+    json_config_t *cfg = json_fetch_config(l);
+    json_scratch_t *scratch = json_fetch_scratch(l);
+    json_output_t out;
+
+    luaL_argcheck(l, lua_gettop(l) == 2, 2, "expected 2 arguments");
+
+    out.buf = luaL_checkudata(l, 1, JSON_BUFFER_MT);
+    out.owned = 0;
+    out.start = strbuf_length(out.buf);
+    out.writer = 0;
+    out.fp = NULL;
+    out.written = 0;
+    scratch->output = &out;
+
+    json_append_data(l, cfg, 0, out.buf);
+
+    scratch->output = NULL;
+
+    lua_pop(l, 1);
+    return 1;
+}
+
+/* ===== OUTPUT BUFFERS =====
+ *
+ * cjson.buffer() returns an empty string buffer for encode_append().
+ * buf:tostring() (or tostring(buf)) returns the contents, buf:len() (or
+ * #buf) their length and buf:reset() empties it, keeping the memory. */
+
+static int json_buffer_tostring(lua_State *l)
+{
+    strbuf_t *buf = luaL_checkudata(l, 1, JSON_BUFFER_MT);
+    int len;
+    const char *data = strbuf_string(buf, &len);
+
+    lua_pushlstring(l, data, len);
+    return 1;
+}
+
+static int json_buffer_len(lua_State *l)
+{
+    strbuf_t *buf = luaL_checkudata(l, 1, JSON_BUFFER_MT);
+
+    lua_pushinteger(l, strbuf_length(buf));
+    return 1;
+}
+
+static int json_buffer_reset(lua_State *l)
+{
+    strbuf_t *buf = luaL_checkudata(l, 1, JSON_BUFFER_MT);
+
+    strbuf_reset(buf);
+    lua_settop(l, 1);
+    return 1;
+}
+
+static int json_buffer_gc(lua_State *l)
+{
+    strbuf_t *buf = luaL_checkudata(l, 1, JSON_BUFFER_MT);
+
+    strbuf_free(buf);
+    return 0;
+}
+
+static int json_buffer_new(lua_State *l)
+{
+    static const luaL_Reg methods[] = {
+        { "tostring", json_buffer_tostring },
+        { "len", json_buffer_len },
+        { "reset", json_buffer_reset },
+        { NULL, NULL }
+    };
+    json_scratch_t *scratch = json_fetch_scratch(l);
+    int size = (int)luaL_optinteger(l, 1, 0);
+    strbuf_t *buf;
+    const luaL_Reg *reg;
+
+    luaL_argcheck(l, size >= 0, 1, "expected a size >= 0");
+
+    buf = lua_newuserdata(l, sizeof(*buf));
+    strbuf_init_alloc(buf, size, &scratch->alloc);
+
+    if (luaL_newmetatable(l, JSON_BUFFER_MT)) {
+        lua_newtable(l);
+        for (reg = methods; reg->name; reg++) {
+            lua_pushcfunction(l, reg->func);
+            lua_setfield(l, -2, reg->name);
+        }
+        lua_setfield(l, -2, "__index");
+        lua_pushcfunction(l, json_buffer_tostring);
+        lua_setfield(l, -2, "__tostring");
+        lua_pushcfunction(l, json_buffer_len);
+        lua_setfield(l, -2, "__len");
+        lua_pushcfunction(l, json_buffer_gc);
+        lua_setfield(l, -2, "__gc");
+    }
+    lua_setmetatable(l, -2);
 
     return 1;
 }
@@ -974,6 +1472,8 @@ static void json_next_string_token(json_parse_t *json, json_token_t *token)
 {
     char *escape2char = json->cfg->escape2char;
     char ch;
+    size_t run;
+    int plain = 0;
 
     /* Caller must ensure a string is next */
     assert(*json->ptr == '"');
@@ -988,6 +1488,15 @@ static void json_next_string_token(json_parse_t *json, json_token_t *token)
     strbuf_reset(json->tmp);
 
     while ((ch = *json->ptr) != '"') {
+        /* A run of plain characters: copy the rest of it in one go */
+        if (plain == JSON_SCAN_HEAD) {
+            run = json_string_run(json->ptr, json->end - json->ptr);
+            strbuf_append_mem_unsafe(json->tmp, json->ptr, run);
+            json->ptr += run;
+            plain = 0;
+            continue;
+        }
+
         if (!ch) {
             /* Premature end of the string */
             json_set_token_error(token, json, "unexpected end of string");
@@ -1016,11 +1525,13 @@ static void json_next_string_token(json_parse_t *json, json_token_t *token)
 
             /* Skip '\' */
             json->ptr++;
+            plain = -1;
         }
 
         /* Append normal character or translated single character
          * Unicode escapes are handled above */
         strbuf_append_char_unsafe(json->tmp, ch);
+        plain++;
         
         json->ptr++;
     }
@@ -1095,6 +1606,10 @@ static void json_next_number_token(json_parse_t *json, json_token_t *token)
     if (*endptr == '.' || *endptr == 'e' || *endptr == 'E') {   /* 是个浮点数 */
         token->type = T_NUMBER;
         token->value.number = fpconv_strtod(json->ptr, &endptr);
+    } else if (token->value.integer == 0 && *json->ptr == '-') {
+        /* "-0": as a double, so that -0.0 survives encode and decode */
+        token->type = T_NUMBER;
+        token->value.number = -0.0;
     } else {
         token->type = T_INTEGER;
     }
@@ -1192,27 +1707,130 @@ static void json_next_token(json_parse_t *json, json_token_t *token)
     json_set_token_error(token, json, "invalid token");
 }
 
+/* Structural pre-scan for decode_presize: one pass over the input that
+ * counts the elements of every array and the members of every object, so
+ * json_new_table() can create them at their final size instead of growing
+ * them one rehash at a time. Strings are skipped with the block scans,
+ * other bytes are classified with ch2token[].
+ *
+ * The counts are ints in json->sizes, in the order the containers open,
+ * which is the order json_parse_*_context() meets them. The open
+ * containers (index, commas so far) are stacked in json->tmp, unused
+ * until the parse proper. Malformed input only makes the counts wrong:
+ * they are hints, the parse that follows reports the error. */
+static void json_prescan(json_parse_t *json)
+{
+    const json_token_type_t *ch2token = json->cfg->ch2token;
+    const char *p = json->data;
+    const char *end = json->end;
+    strbuf_t *stack = json->tmp;
+    int frame[2];
+    int cur = -1, count = 0, empty = 0, n = 0;
+
+    json->sizes = strbuf_new_alloc(0, json->tmp->allocator);
+    json->next_size = 0;
+    strbuf_reset(stack);
+
+    for (; p < end; p++) {
+        switch (ch2token[(unsigned char)*p]) {
+        case T_WHITESPACE:
+            break;
+        case T_ARR_BEGIN:
+        case T_OBJ_BEGIN:
+            frame[0] = cur;
+            frame[1] = count;
+            strbuf_append_mem(stack, (const char *)frame, sizeof(frame));
+            strbuf_append_mem(json->sizes, (const char *)&count, sizeof(count));
+            cur = n++;
+            count = 0;
+            empty = 1;
+            break;
+        case T_ARR_END:
+        case T_OBJ_END:
+            if (cur < 0)
+                goto done;
+            ((int *)json->sizes->buf)[cur] = empty ? 0 : count + 1;
+            stack->length -= sizeof(frame);
+            memcpy(frame, stack->buf + stack->length, sizeof(frame));
+            cur = frame[0];
+            count = frame[1];
+            empty = 0;
+            break;
+        case T_COMMA:
+            count++;
+            break;
+        default:    /* a value, or the ':' after a key */
+            empty = 0;
+            if (*p != '"')
+                break;
+            for (p++; p < end; p++) {
+                p += json_string_run(p, end - p);
+                if (p >= end || *p == '"')
+                    break;
+                if (*p == '\\')
+                    p++;
+            }
+        }
+    }
+
+done:
+    /* Containers left open count what they had */
+    while (cur >= 0) {
+        ((int *)json->sizes->buf)[cur] = empty ? 0 : count + 1;
+        stack->length -= sizeof(frame);
+        memcpy(frame, stack->buf + stack->length, sizeof(frame));
+        cur = frame[0];
+        count = frame[1];
+        empty = 0;
+    }
+    strbuf_reset(stack);
+}
+
+/* Frees the memory of a parse that is about to throw */
+static void json_parse_release(json_parse_t *json)
+{
+    if (json->tmp->dynamic)     /* else it belongs to the scratch, a decoder, ... */
+        strbuf_free(json->tmp);
+    if (json->scratch)
+        json->scratch->decode_busy = 0;
+    if (json->sizes)
+        strbuf_free(json->sizes);
+    if (json->tape)
+        strbuf_free(json->tape);
+}
+
 /* This function does not return.
  * DO NOT CALL WITH DYNAMIC MEMORY ALLOCATED.
- * The only supported exception is the temporary parser string
- * json->tmp struct.
+ * The only supported exceptions are the temporary parser string
+ * json->tmp struct, the json->sizes of the pre-scan and the json->tape
+ * of cjson.lazy(): see json_parse_release().
  * json and token should exist on the stack somewhere.
  * luaL_error() will long_jmp and release the stack */
-static void json_throw_parse_error(lua_State *l, json_parse_t *json,
-                                   const char *exp, json_token_t *token)
+/* Raise a parse error found at character offset + token->index. Unlike
+ * luaL_error() it adds no "chunk:line:" prefix, which would depend on
+ * the caller: cjson.decode() and the decoders raise the same message
+ * wherever they are called from. */
+static void json_raise_parse_error(lua_State *l, const char *exp,
+                                   json_token_t *token, int offset)
 {
     const char *found;
 
-    strbuf_free(json->tmp);
-
     if (token->type == T_ERROR)
         found = token->value.string;
     else
         found = json_token_type_name[token->type];
 
     /* Note: token->index is 0 based, display starting from 1 */
-    luaL_error(l, "Expected %s but found %s at character %d",
-               exp, found, token->index + 1);
+    lua_pushfstring(l, "Expected %s but found %s at character %d",
+                    exp, found, offset + token->index + 1);
+    lua_error(l);
+}
+
+static void json_throw_parse_error(lua_State *l, json_parse_t *json,
+                                   const char *exp, json_token_t *token)
+{
+    json_parse_release(json);
+    json_raise_parse_error(l, exp, token, 0);
 }
 
 static inline void json_decode_ascend(json_parse_t *json)
@@ -1232,19 +1850,68 @@ static void json_decode_descend(lua_State *l, json_parse_t *json, int slots)
         return;
     }
 
-    strbuf_free(json->tmp);
+    json_parse_release(json);
     luaL_error(l, "Found too many nested data structures (%d) at character %d",
         json->current_depth, json->ptr - json->data);
 }
 
+/* New table for the next array/object, sized by the pre-scan if any,
+ * else by the hint */
+static void json_new_table(lua_State *l, json_parse_t *json, int array,
+                           int n)
+{
+    if (json->sizes && json->next_size < (int)(strbuf_length(json->sizes) / sizeof(int))) {
+        n = ((int *)json->sizes->buf)[json->next_size++];
+        if (n < 0)
+            n = 0;
+    }
+
+    if (array)
+        lua_createtable(l, n, 0);
+    else
+        lua_createtable(l, 0, n);
+}
+
+/* Pushes key i of the object being decoded at depth, through the cache */
+static void json_push_key(lua_State *l, json_parse_t *json, int depth, int i,
+                          json_token_t *token)
+{
+    json_key_t *key;
+    const char *str;
+    size_t len;
+
+    if (!json->shapes || depth >= JSON_SHAPE_DEPTH || i >= JSON_SHAPE_KEYS) {
+        lua_pushlstring(l, token->value.string, token->string_len);
+        return;
+    }
+
+    key = &json->shapes->key[depth][i];
+    if (i < json->shapes->nkeys[depth] && key->len == token->string_len &&
+        !memcmp(key->str, token->value.string, key->len)) {
+        lua_rawgeti(l, json->anchors, depth * JSON_SHAPE_KEYS + i + 1);
+        return;
+    }
+
+    lua_pushlstring(l, token->value.string, token->string_len);
+    lua_pushvalue(l, -1);
+    lua_rawseti(l, json->anchors, depth * JSON_SHAPE_KEYS + i + 1);
+    str = lua_tolstring(l, -1, &len);
+    key->str = str;
+    key->len = (int)len;
+}
+
 static void json_parse_object_context(lua_State *l, json_parse_t *json)
 {
     json_token_t token;
+    int depth, i, hint = 0;
 
     /* 3 slots required: table, key, value */
     json_decode_descend(l, json, 3);
 
-    lua_newtable(l);
+    depth = json->current_depth - 1;
+    if (json->shapes && depth < JSON_SHAPE_DEPTH)
+        hint = json->shapes->nkeys[depth];
+    json_new_table(l, json, 0, hint);
 
     json_next_token(json, &token);
 
@@ -1254,12 +1921,12 @@ static void json_parse_object_context(lua_State *l, json_parse_t *json)
         return;
     }
 
-    while (1) {
+    for (i = 0; ; i++) {
         if (token.type != T_STRING) /* 看到了么，key仅支持string！ tbl={1,2,"a",}这种顺序的除外 */
             json_throw_parse_error(l, json, "object key string", &token);
 
         /* Push key */
-        lua_pushlstring(l, token.value.string, token.string_len);
+        json_push_key(l, json, depth, i, &token);
 
         json_next_token(json, &token);  /* {"chatId":26110007,} 读出一个分号(:)的token*/
         if (token.type != T_COLON)
@@ -1275,6 +1942,9 @@ static void json_parse_object_context(lua_State *l, json_parse_t *json)
         json_next_token(json, &token);
 
         if (token.type == T_OBJ_END) {
+            if (json->shapes && depth < JSON_SHAPE_DEPTH)
+                json->shapes->nkeys[depth] = i < JSON_SHAPE_KEYS ?
+                                             i + 1 : JSON_SHAPE_KEYS;
             json_decode_ascend(json);
             return;
         }
@@ -1296,7 +1966,7 @@ static void json_parse_array_context(lua_State *l, json_parse_t *json)
      * .., table, value */
     json_decode_descend(l, json, 2);
 
-    lua_newtable(l);
+    json_new_table(l, json, 1, 0);
 
     json_next_token(json, &token);
 
@@ -1361,6 +2031,7 @@ static int json_decode(lua_State *l)
 {
     json_parse_t json;
     json_token_t token;
+    json_shapes_t shapes;
     size_t json_len;
 
     luaL_argcheck(l, lua_gettop(l) == 1, 1, "expected 1 argument");
@@ -1369,6 +2040,7 @@ static int json_decode(lua_State *l)
     json.data   = luaL_checklstring(l, 1, &json_len); /* 传入参数必须是个字符串 */
     json.current_depth = 0;
     json.ptr    = json.data;
+    json.end    = json.data + json_len;
 
     /* Detect Unicode other than UTF-8 (see RFC 4627, Sec 3)   检测utf-8之外的编码
      *
@@ -1381,7 +2053,32 @@ static int json_decode(lua_State *l)
     /* Ensure the temporary buffer can hold the entire string.
      * This means we no longer need to do length checks since the decoded
      * string must be smaller than the entire json string */
-    json.tmp = strbuf_new(json_len);
+    json.scratch = json_fetch_scratch(l);
+    if (!json.scratch->decode_busy) {
+        json.scratch->decode_busy = 1;
+        json.tmp = &json.scratch->decode_buf;
+        strbuf_reset(json.tmp);
+        strbuf_ensure_empty_length(json.tmp, json_len);
+    } else {
+        json.tmp = strbuf_new_alloc(json_len, &json.scratch->alloc);
+        json.scratch = NULL;
+    }
+
+    json.sizes = NULL;
+    json.tape = NULL;
+    if (json.cfg->decode_presize)
+        json_prescan(&json);
+
+    /* Key cache, unless the document is a lone scalar */
+    json.shapes = NULL;
+    while (json.cfg->ch2token[(unsigned char)*json.ptr] == T_WHITESPACE)
+        json.ptr++;
+    if (*json.ptr == '[' || *json.ptr == '{') {
+        memset(shapes.nkeys, 0, sizeof(shapes.nkeys));
+        json.shapes = &shapes;
+        lua_newtable(l);
+        json.anchors = lua_gettop(l);
+    }
 
     json_next_token(&json, &token);
     json_process_value(l, &json, &token);
@@ -1392,7 +2089,1336 @@ static int json_decode(lua_State *l)
     if (token.type != T_END)
         json_throw_parse_error(l, &json, "the end", &token);
 
-    strbuf_free(json.tmp);
+    if (!json.scratch) {
+        strbuf_free(json.tmp);
+    } else {
+        if (json.tmp->size > JSON_SCRATCH_KEEP) {
+            strbuf_free(json.tmp);
+            strbuf_init_alloc(json.tmp, 0, &json.scratch->alloc);
+        }
+        json.scratch->decode_busy = 0;
+    }
+    if (json.sizes)
+        strbuf_free(json.sizes);
+
+    return 1;
+}
+
+
+/* ===== STREAMING DECODER =====
+ *
+ * cjson.decoder([callback]) returns a decoder to be fed a document in
+ * chunks: dec:feed(chunk) parses what it can and dec:finish([chunk])
+ * marks the end of the input. The input may hold any number of top
+ * level values ("1 2 {}", or one per line). Without a callback feed()
+ * and finish() return a table with the top level values completed so
+ * far. With a callback no tree is built: it is called as
+ * callback(event, value) with the events "object_begin", "object_end",
+ * "array_begin", "array_end", "key" and "value" (scalars only).
+ *
+ * The tokens come from json_next_token() over the unconsumed input.
+ * A token that may go on in the next chunk (a number up to the end,
+ * an error close to the end, e.g. a cut string or "tru") is left for
+ * the next feed(). The nesting lives in an explicit stack of frames,
+ * so the parser can stop between any two tokens; the tables being
+ * built are kept in the environment of the decoder between calls.
+ * After an error (or an error in the callback) the decoder is dead.
+ */
+
+#define JSON_DECODER_MT         "cjson.decoder"
+
+/* An error this close to the end of the input may be a cut token.
+ * Longest: a surrogate pair escape (\uXXXX\uXXXX) */
+#define JSON_DECODER_LOOKAHEAD  12
+
+#if LUA_VERSION_NUM >= 502
+#define json_getenv(l, i)       lua_getuservalue(l, i)
+#define json_setenv(l, i)       lua_setuservalue(l, i)
+#else
+#define json_getenv(l, i)       lua_getfenv(l, i)
+#define json_setenv(l, i)       lua_setfenv(l, i)
+#endif
+
+typedef enum {
+    DEC_FIRST,              /* after '{' or '[': first key/value, or end */
+    DEC_KEY,                /* object key string */
+    DEC_COLON,
+    DEC_VALUE,
+    DEC_NEXT                /* comma, or end */
+} json_decoder_state_t;
+
+typedef struct {
+    json_token_type_t type; /* T_OBJ_BEGIN or T_ARR_BEGIN */
+    json_decoder_state_t state;
+    int index;              /* array elements so far */
+} json_frame_t;
+
+typedef struct {
+    json_config_t *cfg;
+    json_scratch_t *scratch;    /* allocator of the buffers */
+    strbuf_t input;         /* unconsumed input, '\0' terminated */
+    strbuf_t tmp;           /* json_parse_t.tmp */
+    int consumed;           /* bytes of the document dropped from input */
+
+    json_frame_t *frame;
+    int depth;
+    int frame_size;
+    int saved;              /* levels kept in the environment */
+
+    int events;             /* callback mode */
+    int wait_quote;         /* a cut string is pending */
+    int failed;
+} json_decoder_t;
+
+/* One run of the parser. The stack holds the decoder, the environment,
+ * the result table (or the callback) and then two slots per level: the
+ * table being built and its pending key. */
+typedef struct {
+    lua_State *l;
+    json_decoder_t *dec;
+    json_parse_t json;
+    int env;
+    int out;                /* result table, or callback */
+    int base;               /* slot of level 1 */
+    int nout;
+} json_run_t;
+
+static void json_decoder_error(json_run_t *r, const char *exp,
+                               json_token_t *token)
+{
+    json_raise_parse_error(r->l, exp, token, r->dec->consumed);
+}
+
+static void json_decoder_emit(json_run_t *r, const char *event)
+{
+    lua_State *l = r->l;
+
+    /* event value */
+    lua_pushvalue(l, r->out);
+    lua_insert(l, -2);
+    lua_pushstring(l, event);
+    lua_insert(l, -2);
+    lua_call(l, 2, 0);
+}
+
+/* A value is on the top of the stack: store it in its parent */
+static void json_decoder_complete(json_run_t *r)
+{
+    lua_State *l = r->l;
+    json_decoder_t *dec = r->dec;
+    json_frame_t *f;
+    int slot;
+
+    if (dec->depth == 0) {
+        if (dec->events)
+            lua_pop(l, 1);
+        else
+            lua_rawseti(l, r->out, ++r->nout);
+        return;
+    }
+
+    f = &dec->frame[dec->depth - 1];
+    f->state = DEC_NEXT;
+    if (dec->events) {
+        lua_pop(l, 1);
+        return;
+    }
+
+    slot = r->base + 2 * (dec->depth - 1);
+    if (f->type == T_ARR_BEGIN) {
+        lua_rawseti(l, slot, ++f->index);
+    } else {
+        lua_pushvalue(l, slot + 1);
+        lua_insert(l, -2);
+        lua_rawset(l, slot);
+        lua_pushnil(l);
+        lua_replace(l, slot + 1);
+    }
+}
+
+static void json_decoder_open(json_run_t *r, json_token_t *token)
+{
+    lua_State *l = r->l;
+    json_decoder_t *dec = r->dec;
+    json_frame_t *f;
+
+    if (dec->depth >= dec->cfg->decode_max_depth || !lua_checkstack(l, 4)) {
+        luaL_error(l, "Found too many nested data structures (%d) at character %d",
+                   dec->depth + 1, dec->consumed + token->index + 1);
+    }
+
+    if (dec->depth == dec->frame_size) {
+        int size = dec->frame_size ? 2 * dec->frame_size : 8;
+        json_frame_t *frame = realloc(dec->frame, size * sizeof(*frame));
+
+        if (!frame)
+            luaL_error(l, "Out of memory");
+        dec->frame = frame;
+        dec->frame_size = size;
+    }
+
+    f = &dec->frame[dec->depth++];
+    f->type = token->type;
+    f->state = DEC_FIRST;
+    f->index = 0;
+
+    if (dec->events) {
+        lua_pushnil(l);
+        json_decoder_emit(r, token->type == T_OBJ_BEGIN ?
+                             "object_begin" : "array_begin");
+    } else {
+        lua_newtable(l);
+        lua_pushnil(l);
+    }
+}
+
+static void json_decoder_close(json_run_t *r)
+{
+    lua_State *l = r->l;
+    json_decoder_t *dec = r->dec;
+    json_token_type_t type = dec->frame[--dec->depth].type;
+
+    if (dec->events) {
+        lua_pushnil(l);
+        json_decoder_emit(r, type == T_OBJ_BEGIN ? "object_end" : "array_end");
+        if (dec->depth > 0)
+            dec->frame[dec->depth - 1].state = DEC_NEXT;
+        return;
+    }
+
+    lua_pop(l, 1);      /* no pending key: the table is left on top */
+    json_decoder_complete(r);
+}
+
+static void json_decoder_value(json_run_t *r, json_token_t *token)
+{
+    lua_State *l = r->l;
+
+    switch (token->type) {
+    case T_STRING:
+        lua_pushlstring(l, token->value.string, token->string_len);
+        break;
+    case T_NUMBER:
+        lua_pushnumber(l, token->value.number);
+        break;
+    case T_INTEGER:
+        lua_pushinteger(l, token->value.integer);
+        break;
+    case T_BOOLEAN:
+        lua_pushboolean(l, token->value.boolean);
+        break;
+    case T_NULL:
+        lua_pushlightuserdata(l, NULL);
+        break;
+    case T_OBJ_BEGIN:
+    case T_ARR_BEGIN:
+        json_decoder_open(r, token);
+        return;
+    default:
+        json_decoder_error(r, "value", token);
+    }
+
+    if (r->dec->events) {
+        lua_pushvalue(l, -1);
+        json_decoder_emit(r, "value");
+    }
+    json_decoder_complete(r);
+}
+
+static void json_decoder_key(json_run_t *r, json_token_t *token)
+{
+    lua_State *l = r->l;
+    json_decoder_t *dec = r->dec;
+
+    if (token->type != T_STRING)
+        json_decoder_error(r, "object key string", token);
+
+    lua_pushlstring(l, token->value.string, token->string_len);
+    if (dec->events)
+        json_decoder_emit(r, "key");
+    else
+        lua_replace(l, r->base + 2 * (dec->depth - 1) + 1);
+    dec->frame[dec->depth - 1].state = DEC_COLON;
+}
+
+static void json_decoder_token(json_run_t *r, json_token_t *token)
+{
+    json_decoder_t *dec = r->dec;
+    json_frame_t *f;
+    json_token_type_t end;
+
+    if (dec->depth == 0) {
+        json_decoder_value(r, token);
+        return;
+    }
+
+    f = &dec->frame[dec->depth - 1];
+    end = f->type == T_OBJ_BEGIN ? T_OBJ_END : T_ARR_END;
+    switch (f->state) {
+    case DEC_FIRST:
+        if (token->type == end)
+            json_decoder_close(r);
+        else if (f->type == T_OBJ_BEGIN)
+            json_decoder_key(r, token);
+        else
+            json_decoder_value(r, token);
+        break;
+    case DEC_KEY:
+        json_decoder_key(r, token);
+        break;
+    case DEC_COLON:
+        if (token->type != T_COLON)
+            json_decoder_error(r, "colon", token);
+        f->state = DEC_VALUE;
+        break;
+    case DEC_VALUE:
+        json_decoder_value(r, token);
+        break;
+    case DEC_NEXT:
+        if (token->type == end)
+            json_decoder_close(r);
+        else if (token->type == T_COMMA)
+            f->state = f->type == T_OBJ_BEGIN ? DEC_KEY : DEC_VALUE;
+        else
+            json_decoder_error(r, f->type == T_OBJ_BEGIN ?
+                               "comma or object end" : "comma or array end",
+                               token);
+        break;
+    }
+}
+
+static int json_is_number_char(int ch)
+{
+    return ('0' <= ch && ch <= '9') || ('a' <= (ch | 0x20) && (ch | 0x20) <= 'z') ||
+           ch == '.' || ch == '+' || ch == '-';
+}
+
+/* May the token just read go on in the next chunk? */
+static int json_decoder_cut(json_run_t *r, json_token_t *token)
+{
+    const char *end = r->json.data + r->dec->input.length;
+    const char *p;
+
+    switch (token->type) {
+    case T_END:
+        return 1;
+    case T_ERROR:
+        return end - (r->json.data + token->index) < JSON_DECODER_LOOKAHEAD;
+    case T_NUMBER:
+    case T_INTEGER:
+        for (p = r->json.ptr; p < end && json_is_number_char(*p); p++)
+            ;
+        return p == end;
+    default:
+        return 0;
+    }
+}
+
+static void json_decoder_run(lua_State *l, json_decoder_t *dec, int final)
+{
+    json_run_t r;
+    json_token_t token;
+    const char *start;
+    int d, length;
+    size_t chunk_len;
+    const char *chunk = luaL_optlstring(l, 2, "", &chunk_len);
+
+    if (dec->failed)
+        luaL_error(l, "JSON decoder failed on an earlier error");
+
+    strbuf_append_mem(&dec->input, chunk, (int)chunk_len);
+    strbuf_ensure_null(&dec->input);
+    if (dec->wait_quote) {
+        if (!final && !memchr(chunk, '"', chunk_len)) {
+            if (!dec->events)
+                lua_newtable(l);
+            return;
+        }
+        dec->wait_quote = 0;
+    }
+    dec->failed = 1;        /* until this run is over */
+
+    lua_settop(l, 1);
+    json_getenv(l, 1);
+    r.l = l;
+    r.dec = dec;
+    r.env = 2;
+    r.out = 3;
+    r.nout = 0;
+    if (dec->events)
+        lua_getfield(l, r.env, "callback");
+    else
+        lua_newtable(l);
+    r.base = 4;
+    if (!dec->events) {
+        luaL_checkstack(l, 2 * dec->depth + 4, "JSON decoder nesting");
+        for (d = 1; d <= dec->depth; d++) {
+            lua_rawgeti(l, r.env, 2 * d - 1);
+            lua_rawgeti(l, r.env, 2 * d);
+        }
+    }
+
+    r.json.cfg = dec->cfg;
+    r.json.data = strbuf_string(&dec->input, &length);
+    r.json.ptr = r.json.data;
+    r.json.end = r.json.data + length;
+    r.json.tmp = &dec->tmp;
+    r.json.current_depth = 0;
+    r.json.sizes = NULL;
+    r.json.shapes = NULL;
+    r.json.tape = NULL;
+    r.json.scratch = NULL;
+
+    /* As in json_decode(): a decoded string is no longer than the input */
+    strbuf_reset(&dec->tmp);
+    strbuf_ensure_empty_length(&dec->tmp, length);
+
+    while (1) {
+        start = r.json.ptr;
+        json_next_token(&r.json, &token);
+
+        if (token.type == T_END && r.json.ptr != r.json.data + length)
+            json_set_token_error(&token, &r.json, "invalid token");   /* '\0' */
+
+        if (!final && json_decoder_cut(&r, &token)) {
+            if (token.type != T_END) {
+                r.json.ptr = start;
+                while (dec->cfg->ch2token[(unsigned char)*start] == T_WHITESPACE)
+                    start++;
+                dec->wait_quote = *start == '"';
+            }
+            break;
+        }
+
+        if (token.type == T_END && dec->depth == 0)
+            break;
+
+        json_decoder_token(&r, &token);
+    }
+
+    /* Keep the levels still open for the next run */
+    if (!dec->events) {
+        for (d = dec->depth; d >= 1; d--) {
+            lua_rawseti(l, r.env, 2 * d);
+            lua_rawseti(l, r.env, 2 * d - 1);
+        }
+        for (d = dec->depth + 1; d <= dec->saved; d++) {
+            lua_pushnil(l);
+            lua_rawseti(l, r.env, 2 * d - 1);
+            lua_pushnil(l);
+            lua_rawseti(l, r.env, 2 * d);
+        }
+        dec->saved = dec->depth;
+    }
+
+    /* Drop the consumed input */
+    d = r.json.ptr - r.json.data;
+    memmove(dec->input.buf, r.json.ptr, length - d);
+    dec->input.length = length - d;
+    strbuf_ensure_null(&dec->input);
+    dec->consumed += d;
+    if (final)
+        dec->consumed = 0;
+
+    dec->failed = 0;
+    lua_settop(l, 3);
+    if (dec->events)
+        lua_pop(l, 1);
+}
+
+static json_decoder_t *json_check_decoder(lua_State *l)
+{
+    json_decoder_t *dec = luaL_checkudata(l, 1, JSON_DECODER_MT);
+
+    json_enter_scratch(l, dec->scratch);
+    return dec;
+}
+
+static int json_decoder_feed(lua_State *l)
+{
+    json_decoder_t *dec = json_check_decoder(l);
+
+    luaL_checkstring(l, 2);
+    json_decoder_run(l, dec, 0);
+
+    return !dec->events;
+}
+
+static int json_decoder_finish(lua_State *l)
+{
+    json_decoder_t *dec = json_check_decoder(l);
+
+    json_decoder_run(l, dec, 1);
+
+    return !dec->events;
+}
+
+static int json_decoder_gc(lua_State *l)
+{
+    json_decoder_t *dec = json_check_decoder(l);
+
+    strbuf_free(&dec->input);
+    strbuf_free(&dec->tmp);
+    free(dec->frame);
+    dec->frame = NULL;
+
+    return 0;
+}
+
+static int json_decoder_new(lua_State *l)
+{
+    static const luaL_Reg methods[] = {
+        { "feed", json_decoder_feed },
+        { "finish", json_decoder_finish },
+        { NULL, NULL }
+    };
+    json_config_t *cfg = json_fetch_config(l);
+    json_decoder_t *dec;
+    const luaL_Reg *reg;
+    int events;
+
+    luaL_argcheck(l, lua_gettop(l) <= 1, 2, "found too many arguments");
+    events = !lua_isnoneornil(l, 1);
+    if (events)
+        luaL_checktype(l, 1, LUA_TFUNCTION);
+
+    dec = lua_newuserdata(l, sizeof(*dec));
+    dec->cfg = cfg;
+    dec->scratch = json_fetch_scratch(l);
+    dec->consumed = 0;
+    dec->frame = NULL;
+    dec->depth = 0;
+    dec->frame_size = 0;
+    dec->saved = 0;
+    dec->events = events;
+    dec->wait_quote = 0;
+    dec->failed = 0;
+    dec->input.buf = dec->tmp.buf = NULL;     /* for __gc */
+    dec->input.dynamic = dec->tmp.dynamic = 0;
+
+    if (luaL_newmetatable(l, JSON_DECODER_MT)) {
+        lua_newtable(l);
+        for (reg = methods; reg->name; reg++) {
+            lua_pushcfunction(l, reg->func);
+            lua_setfield(l, -2, reg->name);
+        }
+        lua_setfield(l, -2, "__index");
+        lua_pushcfunction(l, json_decoder_gc);
+        lua_setfield(l, -2, "__gc");
+    }
+    lua_setmetatable(l, -2);
+    strbuf_init_alloc(&dec->input, 0, &dec->scratch->alloc);
+    strbuf_init_alloc(&dec->tmp, 0, &dec->scratch->alloc);
+
+    /* Environment: config userdata (keeps cfg alive), callback, levels */
+    lua_newtable(l);
+    lua_pushvalue(l, lua_upvalueindex(1));
+    lua_setfield(l, -2, "config");
+    if (dec->events) {
+        lua_pushvalue(l, 1);
+        lua_setfield(l, -2, "callback");
+    }
+    json_setenv(l, -2);
+
+    return 1;
+}
+
+/* ===== LAZY DOCUMENTS =====
+ *
+ * cjson.lazy(str) checks the whole document like cjson.decode() but
+ * builds no tables: it records a tape, one entry per value (object keys
+ * included) in document order, and returns a proxy for the top level
+ * array or object (a top level scalar is returned as is). Indexing a
+ * proxy looks the key (string) or the position (1-based number) up on
+ * the tape and decodes only what it finds: scalars as cjson.decode()
+ * would, arrays and objects as further proxies. #proxy is the number of
+ * elements or members.
+ *
+ * Calling a proxy decodes in full: proxy() the whole value, proxy(path)
+ * the value at path, e.g. "a.b[3].c" (names after '.', 1-based
+ * positions in [], nil when missing).
+ *
+ * Lookups walk the tape: a member lookup compares every key of the
+ * object (the last of duplicate keys wins, as in cjson.decode()), an
+ * element lookup skips its predecessors from the last position looked
+ * up. The tape is 3 ints per value; the proxies keep the input string
+ * alive. */
+
+#define JSON_LAZY_MT            "cjson.lazy"
+#define JSON_LAZY_DOC_MT        "cjson.lazydoc"
+
+typedef struct {
+    int pos;            /* offset of the value (or key) in the input */
+    int next;           /* entry after the value and all it contains */
+    int count;          /* array elements / object members */
+} json_entry_t;
+
+typedef struct {
+    json_config_t *cfg;
+    const char *data;   /* the input, kept in the environment */
+    size_t len;
+    json_entry_t *tape; /* the contents of tape_buf */
+    int entries;
+    strbuf_t tape_buf;
+    strbuf_t tmp;       /* json_parse_t.tmp of the lookups */
+    json_scratch_t *scratch;    /* allocator of the buffers */
+} json_lazy_t;
+
+typedef struct {
+    json_lazy_t *doc;
+    int entry;
+    int cursor;         /* arrays: last position looked up ... */
+    int cursor_entry;   /* ... and its entry */
+} json_node_t;
+
+static int json_tape_append(json_parse_t *json, int pos)
+{
+    json_entry_t e;
+    int n = strbuf_length(json->tape) / sizeof(e);
+
+    e.pos = pos;
+    e.next = n + 1;
+    e.count = 0;
+    strbuf_append_mem(json->tape, (const char *)&e, sizeof(e));
+
+    return n;
+}
+
+/* Records the value starting with token, checking it as
+ * json_process_value() would */
+static void json_tape_value(lua_State *l, json_parse_t *json,
+                            json_token_t *token)
+{
+    json_entry_t *tape;
+    int entry = json_tape_append(json, token->index);
+    int count = 0;
+    json_token_type_t end = token->type == T_OBJ_BEGIN ? T_OBJ_END : T_ARR_END;
+
+    switch (token->type) {
+    case T_STRING:
+    case T_NUMBER:
+    case T_INTEGER:
+    case T_BOOLEAN:
+    case T_NULL:
+        return;
+    case T_OBJ_BEGIN:
+    case T_ARR_BEGIN:
+        break;
+    default:
+        json_throw_parse_error(l, json, "value", token);
+    }
+
+    json_decode_descend(l, json, 1);
+    json_next_token(json, token);
+
+    if (token->type != end) {
+        while (1) {
+            if (end == T_OBJ_END) {
+                if (token->type != T_STRING)
+                    json_throw_parse_error(l, json, "object key string", token);
+                json_tape_append(json, token->index);
+                json_next_token(json, token);
+                if (token->type != T_COLON)
+                    json_throw_parse_error(l, json, "colon", token);
+                json_next_token(json, token);
+            }
+            json_tape_value(l, json, token);
+            count++;
+
+            json_next_token(json, token);
+            if (token->type == end)
+                break;
+            if (token->type != T_COMMA)
+                json_throw_parse_error(l, json, end == T_OBJ_END ?
+                                       "comma or object end" :
+                                       "comma or array end", token);
+            json_next_token(json, token);
+        }
+    }
+
+    json_decode_ascend(json);
+
+    tape = (json_entry_t *)json->tape->buf;
+    tape[entry].next = strbuf_length(json->tape) / sizeof(*tape);
+    tape[entry].count = count;
+}
+
+/* A parser over the lazy document, positioned at entry */
+static void json_lazy_parser(json_lazy_t *doc, int entry, json_parse_t *json)
+{
+    json_entry_t *e = &doc->tape[entry];
+    size_t end = e->next < doc->entries ? (size_t)doc->tape[e->next].pos
+                                        : doc->len;
+
+    /* A decoded string is no longer than the input it comes from */
+    strbuf_reset(&doc->tmp);
+    strbuf_ensure_empty_length(&doc->tmp, (int)(end - e->pos));
+
+    json->cfg = doc->cfg;
+    json->data = doc->data;
+    json->ptr = doc->data + e->pos;
+    json->end = doc->data + doc->len;
+    json->tmp = &doc->tmp;
+    json->current_depth = 0;
+    json->sizes = NULL;
+    json->shapes = NULL;
+    json->tape = NULL;
+    json->scratch = NULL;
+}
+
+static int json_entry_is_container(json_lazy_t *doc, int entry)
+{
+    char ch = doc->data[doc->tape[entry].pos];
+
+    return ch == '{' || ch == '[';
+}
+
+/* Pushes a proxy for entry; env: the environment of the document */
+static void json_lazy_push_node(lua_State *l, json_lazy_t *doc, int entry,
+                                int env)
+{
+    json_node_t *node = lua_newuserdata(l, sizeof(*node));
+
+    node->doc = doc;
+    node->entry = entry;
+    node->cursor = 1;
+    node->cursor_entry = entry + 1;
+
+    luaL_getmetatable(l, JSON_LAZY_MT);
+    lua_setmetatable(l, -2);
+    lua_pushvalue(l, env);
+    json_setenv(l, -2);
+}
+
+/* Pushes the value of entry: decoded in full, or a proxy for an array or
+ * object unless full */
+static void json_lazy_push(lua_State *l, json_lazy_t *doc, int entry,
+                           int env, int full)
+{
+    json_parse_t json;
+    json_token_t token;
+
+    if (!full && json_entry_is_container(doc, entry)) {
+        json_lazy_push_node(l, doc, entry, env);
+        return;
+    }
+
+    json_lazy_parser(doc, entry, &json);
+    json_next_token(&json, &token);
+    json_process_value(l, &json, &token);
+}
+
+/* Entry of member key of object entry, or -1 */
+static int json_lazy_member(json_lazy_t *doc, int entry, const char *key,
+                            size_t len)
+{
+    json_entry_t *tape = doc->tape;
+    json_parse_t json;
+    json_token_t token;
+    int found = -1;
+    int i, e;
+
+    if (doc->data[tape[entry].pos] != '{')
+        return -1;
+
+    for (i = 0, e = entry + 1; i < tape[entry].count; i++) {
+        json_lazy_parser(doc, e, &json);
+        json_next_token(&json, &token);
+        if ((size_t)token.string_len == len &&
+            !memcmp(token.value.string, key, len))
+            found = e + 1;
+        e = tape[e + 1].next;
+    }
+
+    return found;
+}
+
+/* Entry of element k (1-based) of array entry, or -1 */
+static int json_lazy_element(json_lazy_t *doc, int entry, int k,
+                             int *cursor, int *cursor_entry)
+{
+    json_entry_t *tape = doc->tape;
+    int i = 1, e = entry + 1;
+
+    if (doc->data[tape[entry].pos] != '[' || k < 1 || k > tape[entry].count)
+        return -1;
+
+    if (cursor && *cursor <= k) {
+        i = *cursor;
+        e = *cursor_entry;
+    }
+    for (; i < k; i++)
+        e = tape[e].next;
+
+    if (cursor) {
+        *cursor = i;
+        *cursor_entry = e;
+    }
+    return e;
+}
+
+/* Entry at path below entry, or -1 */
+static int json_lazy_path(lua_State *l, json_lazy_t *doc, int entry,
+                          const char *path)
+{
+    const char *p = path;
+    const char *name;
+    char *end;
+    long k;
+
+    while (*p && entry >= 0) {
+        if (*p == '[') {
+            k = strtol(p + 1, &end, 10);
+            if (end == p + 1 || *end != ']')
+                luaL_error(l, "bad path '%s' at character %d", path,
+                           (int)(p - path) + 1);
+            entry = json_lazy_element(doc, entry, k > INT_MAX ? -1 : (int)k,
+                                      NULL, NULL);
+            p = end + 1;
+            continue;
+        }
+        if (*p == '.')
+            p++;
+        name = p;
+        while (*p && *p != '.' && *p != '[')
+            p++;
+        entry = json_lazy_member(doc, entry, name, p - name);
+    }
+
+    return entry;
+}
+
+static json_node_t *json_check_node(lua_State *l)
+{
+    json_node_t *node = luaL_checkudata(l, 1, JSON_LAZY_MT);
+
+    json_enter_scratch(l, node->doc->scratch);
+    return node;
+}
+
+static int json_node_index(lua_State *l)
+{
+    json_node_t *node = json_check_node(l);
+    json_lazy_t *doc = node->doc;
+    const char *key;
+    size_t len;
+    int entry = -1;
+
+    if (lua_type(l, 2) == LUA_TSTRING) {
+        key = lua_tolstring(l, 2, &len);
+        entry = json_lazy_member(doc, node->entry, key, len);
+    } else if (lua_type(l, 2) == LUA_TNUMBER) {
+        lua_Number k = lua_tonumber(l, 2);
+
+        if (k == floor(k) && k >= 1 && k <= INT_MAX)
+            entry = json_lazy_element(doc, node->entry, (int)k,
+                                      &node->cursor, &node->cursor_entry);
+    }
+
+    if (entry < 0)
+        return 0;
+
+    json_getenv(l, 1);
+    json_lazy_push(l, doc, entry, lua_gettop(l), 0);
+    return 1;
+}
+
+static int json_node_len(lua_State *l)
+{
+    json_node_t *node = json_check_node(l);
+
+    lua_pushinteger(l, node->doc->tape[node->entry].count);
+    return 1;
+}
+
+static int json_node_call(lua_State *l)
+{
+    json_node_t *node = json_check_node(l);
+    int entry = node->entry;
+
+    if (!lua_isnoneornil(l, 2))
+        entry = json_lazy_path(l, node->doc, entry, luaL_checkstring(l, 2));
+    if (entry < 0)
+        return 0;
+
+    json_lazy_push(l, node->doc, entry, 0, 1);
+    return 1;
+}
+
+static int json_lazy_doc_gc(lua_State *l)
+{
+    json_lazy_t *doc = luaL_checkudata(l, 1, JSON_LAZY_DOC_MT);
+
+    strbuf_free(&doc->tape_buf);
+    doc->tape = NULL;
+    strbuf_free(&doc->tmp);
+
+    return 0;
+}
+
+static int json_lazy_new(lua_State *l)
+{
+    static const luaL_Reg node_methods[] = {
+        { "__index", json_node_index },
+        { "__len", json_node_len },
+        { "__call", json_node_call },
+        { NULL, NULL }
+    };
+    json_parse_t json;
+    json_token_t token;
+    json_lazy_t *doc;
+    const luaL_Reg *reg;
+    size_t json_len;
+
+    luaL_argcheck(l, lua_gettop(l) == 1, 1, "expected 1 argument");
+
+    json.cfg = json_fetch_config(l);
+    json.data = luaL_checklstring(l, 1, &json_len);
+    json.current_depth = 0;
+    json.ptr = json.data;
+    json.end = json.data + json_len;
+    json.sizes = NULL;
+    json.shapes = NULL;
+    json.scratch = NULL;
+
+    /* As in json_decode() */
+    if (json_len >= 2 && (!json.data[0] || !json.data[1]))
+        luaL_error(l, "JSON parser does not support UTF-16 or UTF-32");
+
+    if (luaL_newmetatable(l, JSON_LAZY_MT)) {
+        for (reg = node_methods; reg->name; reg++) {
+            lua_pushcfunction(l, reg->func);
+            lua_setfield(l, -2, reg->name);
+        }
+    }
+    lua_pop(l, 1);
+
+    doc = lua_newuserdata(l, sizeof(*doc));
+    doc->cfg = json.cfg;
+    doc->data = json.data;
+    doc->len = json_len;
+    doc->tape = NULL;
+    doc->entries = 0;
+    doc->scratch = json_fetch_scratch(l);
+    doc->tape_buf.buf = doc->tmp.buf = NULL;    /* for __gc */
+    doc->tape_buf.dynamic = doc->tmp.dynamic = 0;
+    if (luaL_newmetatable(l, JSON_LAZY_DOC_MT)) {
+        lua_pushcfunction(l, json_lazy_doc_gc);
+        lua_setfield(l, -2, "__gc");
+    }
+    lua_setmetatable(l, -2);
+    strbuf_init_alloc(&doc->tape_buf, 0, &doc->scratch->alloc);
+    strbuf_init_alloc(&doc->tmp, 0, &doc->scratch->alloc);
+
+    /* Environment of the proxies: input, config, document */
+    lua_createtable(l, 3, 0);
+    lua_pushvalue(l, 1);
+    lua_rawseti(l, -2, 1);
+    lua_pushvalue(l, lua_upvalueindex(1));
+    lua_rawseti(l, -2, 2);
+    lua_pushvalue(l, -2);
+    lua_rawseti(l, -2, 3);
+
+    json.tmp = strbuf_new_alloc(json_len, &doc->scratch->alloc);
+    json.tape = &doc->tape_buf;
+
+    json_next_token(&json, &token);
+    json_tape_value(l, &json, &token);
+
+    json_next_token(&json, &token);
+    if (token.type != T_END)
+        json_throw_parse_error(l, &json, "the end", &token);
+
+    strbuf_free(json.tmp);
+    doc->tape = (json_entry_t *)doc->tape_buf.buf;
+    doc->entries = strbuf_length(&doc->tape_buf) / sizeof(json_entry_t);
+
+    json_lazy_push(l, doc, 0, lua_gettop(l), 0);
+    return 1;
+}
+
+
+/* ===== MESSAGEPACK =====
+ *
+ * cjson.msgpack_encode(value) and cjson.msgpack_decode(string) read and
+ * write MessagePack with the rules of encode()/decode(): arrays are told
+ * from maps by lua_array_length() (and the sparse array options), the
+ * depth limits and encode_keep_buffer apply, nil and cjson.null encode to
+ * nil and nil decodes to cjson.null.
+ *
+ * Unlike JSON, integral numbers are sent as integers, map keys keep
+ * their type and NaN/Infinity are plain doubles. Lua strings are bytes:
+ * they encode to the str family, str and bin both decode to strings.
+ * Decoded strings are pushed straight from the input, there is nothing
+ * to unescape. */
+
+#define MP_NIL      0xc0
+#define MP_FALSE    0xc2
+#define MP_TRUE     0xc3
+#define MP_FLOAT64  0xcb
+#define MP_UINT8    0xcc        /* .. 0xcf: uint16, 32, 64 */
+#define MP_INT8     0xd0        /* .. 0xd3: int16, 32, 64 */
+
+/* Stores v big endian in the bytes bytes at p */
+static void mp_put(unsigned char *p, uint64_t v, int bytes)
+{
+    while (bytes--) {
+        p[bytes] = (unsigned char)v;
+        v >>= 8;
+    }
+}
+
+static uint64_t mp_get(const unsigned char *p, int bytes)
+{
+    uint64_t v = 0;
+
+    while (bytes--)
+        v = v << 8 | *p++;
+    return v;
+}
+
+/* Type byte and size of a str, array or map: the fix form when n fits
+ * in fix_max, else code8 (if there is one: strings), code16, code16 + 1 */
+static void mp_append_header(strbuf_t *buf, unsigned int n, int fix,
+                             unsigned int fix_max, int code8, int code16)
+{
+    unsigned char *p;
+
+    strbuf_ensure_empty_length(buf, 5);
+    p = (unsigned char *)strbuf_empty_ptr(buf);
+    if (n <= fix_max) {
+        p[0] = (unsigned char)(fix | n);
+        strbuf_extend_length(buf, 1);
+    } else if (code8 && n <= 0xff) {
+        p[0] = code8;
+        p[1] = n;
+        strbuf_extend_length(buf, 2);
+    } else if (n <= 0xffff) {
+        p[0] = code16;
+        mp_put(p + 1, n, 2);
+        strbuf_extend_length(buf, 3);
+    } else {
+        p[0] = code16 + 1;
+        mp_put(p + 1, n, 4);
+        strbuf_extend_length(buf, 5);
+    }
+}
+
+static void mp_append_number(lua_State *l, strbuf_t *buf, int lindex)
+{
+    double num = lua_tonumber(l, lindex);
+    unsigned char *p;
+    uint64_t u;
+    int64_t i;
+    int size;
+
+    strbuf_ensure_empty_length(buf, 9);
+    p = (unsigned char *)strbuf_empty_ptr(buf);
+
+    /* Integral values in int64 / uint64 range, but not -0.0 */
+    if (floor(num) == num && num >= -9223372036854775808.0 &&
+        num < 18446744073709551616.0 && (num != 0 || !signbit(num))) {
+        if (num >= 0) {
+            u = (uint64_t)num;
+            if (u < 0x80) {
+                p[0] = (unsigned char)u;            /* positive fixint */
+                strbuf_extend_length(buf, 1);
+                return;
+            }
+            size = u <= 0xff ? 0 : u <= 0xffff ? 1 : u <= 0xffffffff ? 2 : 3;
+            p[0] = MP_UINT8 + size;
+        } else {
+            i = (int64_t)num;
+            if (i >= -32) {
+                p[0] = (unsigned char)i;            /* negative fixint */
+                strbuf_extend_length(buf, 1);
+                return;
+            }
+            size = i >= -0x80 ? 0 : i >= -0x8000 ? 1 : i >= -0x80000000LL ? 2 : 3;
+            p[0] = MP_INT8 + size;
+            u = (uint64_t)i;
+        }
+        mp_put(p + 1, u, 1 << size);
+        strbuf_extend_length(buf, 1 + (1 << size));
+        return;
+    }
+
+    p[0] = MP_FLOAT64;
+    memcpy(&u, &num, sizeof(u));
+    mp_put(p + 1, u, 8);
+    strbuf_extend_length(buf, 9);
+}
+
+static void mp_append_data(lua_State *l, json_config_t *cfg,
+                           int current_depth, strbuf_t *buf);
+
+static void mp_append_string(lua_State *l, strbuf_t *buf, int lindex)
+{
+    size_t len;
+    const char *str = lua_tolstring(l, lindex, &len);
+
+    if (len > 0xffffffffU)
+        json_encode_exception(l, lindex, "string too long");
+    mp_append_header(buf, (unsigned int)len, 0xa0, 0x1f, 0xd9, 0xda);
+    strbuf_append_mem(buf, str, (int)len);
+}
+
+/* Table on top of the stack */
+static void mp_append_table(lua_State *l, json_config_t *cfg,
+                            int current_depth, strbuf_t *buf)
+{
+    int len = lua_array_length(l, cfg);
+    unsigned int n = 0;
+    int i, start, end, shift;
+
+    if (len > 0) {
+        mp_append_header(buf, len, 0x90, 0xf, 0, 0xdc);
+        for (i = 1; i <= len; i++) {
+            lua_rawgeti(l, -1, i);
+            mp_append_data(l, cfg, current_depth, buf);
+            lua_pop(l, 1);
+        }
+        return;
+    }
+
+    /* The size comes first. Assume a fixmap and count the pairs on the
+     * way; a bigger map moves its pairs up for the longer header */
+    start = strbuf_length(buf);
+    strbuf_append_char(buf, 0);
+    lua_pushnil(l);
+    while (lua_next(l, -2) != 0) {
+        /* table, key, value */
+        if (lua_type(l, -2) == LUA_TSTRING) {
+            mp_append_string(l, buf, -2);
+        } else {
+            lua_pushvalue(l, -2);
+            mp_append_data(l, cfg, current_depth, buf);
+            lua_pop(l, 1);
+        }
+        mp_append_data(l, cfg, current_depth, buf);
+        lua_pop(l, 1);
+        n++;
+    }
+
+    if (n <= 0xf) {
+        buf->buf[start] = (char)(0x80 | n);
+        return;
+    }
+    end = strbuf_length(buf);
+    shift = n <= 0xffff ? 2 : 4;
+    strbuf_ensure_empty_length(buf, shift);
+    memmove(buf->buf + start + 1 + shift, buf->buf + start + 1,
+            end - start - 1);
+    buf->length = start;
+    mp_append_header(buf, n, 0x80, 0xf, 0, 0xde);
+    buf->length = end + shift;
+}
+
+/* Serialise Lua data into MessagePack, as json_append_data() */
+static void mp_append_data(lua_State *l, json_config_t *cfg,
+                           int current_depth, strbuf_t *buf)
+{
+    switch (lua_type(l, -1)) {
+    case LUA_TSTRING:
+        mp_append_string(l, buf, -1);
+        break;
+    case LUA_TNUMBER:
+        mp_append_number(l, buf, -1);
+        break;
+    case LUA_TBOOLEAN:
+        strbuf_append_char(buf, lua_toboolean(l, -1) ? MP_TRUE : MP_FALSE);
+        break;
+    case LUA_TTABLE:
+        current_depth++;
+        json_check_encode_depth(l, cfg, current_depth);
+        mp_append_table(l, cfg, current_depth, buf);
+        break;
+    case LUA_TNIL:
+        strbuf_append_char(buf, MP_NIL);
+        break;
+    case LUA_TLIGHTUSERDATA:
+        if (lua_touserdata(l, -1) == NULL) {
+            strbuf_append_char(buf, MP_NIL);
+            break;
+        }
+        /* fall through */
+    default:
+        json_encode_exception(l, -1, "type not supported");
+        /* never returns */
+    }
+}
+
+static int mp_encode(lua_State *l)
+{
+    return json_encode_with(l, mp_append_data);
+}
+
+typedef struct {
+    json_config_t *cfg;
+    const unsigned char *data;
+    const unsigned char *ptr;
+    const unsigned char *end;
+    int current_depth;
+} mp_parse_t;
+
+static void mp_throw_error(lua_State *l, mp_parse_t *mp, const char *what)
+{
+    luaL_error(l, "Expected MessagePack but found %s at byte %d", what,
+               (int)(mp->ptr - mp->data) + 1);
+}
+
+/* Returns the next n bytes of the input */
+static const unsigned char *mp_take(lua_State *l, mp_parse_t *mp, size_t n)
+{
+    const unsigned char *p = mp->ptr;
+
+    if ((size_t)(mp->end - p) < n)
+        mp_throw_error(l, mp, "truncated data");
+    mp->ptr += n;
+    return p;
+}
+
+static void mp_push_integer(lua_State *l, int64_t i)
+{
+#if LUA_VERSION_NUM >= 503
+    lua_pushinteger(l, (lua_Integer)i);
+#else
+    lua_pushnumber(l, (lua_Number)i);
+#endif
+}
+
+static void mp_process_value(lua_State *l, mp_parse_t *mp);
+
+/* Array or map of n items: 2 slots for the items */
+static void mp_process_container(lua_State *l, mp_parse_t *mp,
+                                 uint32_t n, int map)
+{
+    uint32_t i;
+
+    mp->current_depth++;
+    if (mp->current_depth > mp->cfg->decode_max_depth ||
+        !lua_checkstack(l, 2)) {
+        luaL_error(l, "Found too many nested data structures (%d) at byte %d",
+                   mp->current_depth, (int)(mp->ptr - mp->data) + 1);
+    }
+    /* Each item takes a byte at least: bounds the table size up front */
+    if ((size_t)(mp->end - mp->ptr) < (size_t)n << map)
+        mp_throw_error(l, mp, "truncated data");
+
+    if (map) {
+        lua_createtable(l, 0, n);
+        for (i = 0; i < n; i++) {
+            mp_process_value(l, mp);
+            mp_process_value(l, mp);
+            lua_rawset(l, -3);
+        }
+    } else {
+        lua_createtable(l, n, 0);
+        for (i = 1; i <= n; i++) {
+            mp_process_value(l, mp);
+            lua_rawseti(l, -2, i);
+        }
+    }
+    mp->current_depth--;
+}
+
+static void mp_process_value(lua_State *l, mp_parse_t *mp)
+{
+    const unsigned char *p = mp_take(l, mp, 1);
+    int c = *p;
+    uint64_t u;
+    uint32_t n;
+    double d;
+    float f;
+    int w;
+
+    if (c <= 0x7f) {                /* positive fixint */
+        mp_push_integer(l, c);
+        return;
+    }
+    if (c >= 0xe0) {                /* negative fixint */
+        mp_push_integer(l, c - 0x100);
+        return;
+    }
+    if (c >= 0xa0 && c <= 0xbf) {   /* fixstr */
+        n = c & 0x1f;
+        lua_pushlstring(l, (const char *)mp_take(l, mp, n), n);
+        return;
+    }
+    if (c <= 0x9f) {                /* fixmap, fixarray */
+        mp_process_container(l, mp, c & 0x0f, c <= 0x8f);
+        return;
+    }
+
+    switch (c) {
+    case MP_NIL:
+        lua_pushlightuserdata(l, NULL);
+        return;
+    case MP_FALSE:
+    case MP_TRUE:
+        lua_pushboolean(l, c == MP_TRUE);
+        return;
+    case 0xc4: case 0xc5: case 0xc6:    /* bin 8, 16, 32 */
+    case 0xd9: case 0xda: case 0xdb:    /* str 8, 16, 32 */
+        w = 1 << (c >= 0xd9 ? c - 0xd9 : c - 0xc4);
+        n = (uint32_t)mp_get(mp_take(l, mp, w), w);
+        lua_pushlstring(l, (const char *)mp_take(l, mp, n), n);
+        return;
+    case 0xca:
+        u = mp_get(mp_take(l, mp, 4), 4);
+        n = (uint32_t)u;
+        memcpy(&f, &n, sizeof(f));
+        lua_pushnumber(l, f);
+        return;
+    case MP_FLOAT64:
+        u = mp_get(mp_take(l, mp, 8), 8);
+        memcpy(&d, &u, sizeof(d));
+        lua_pushnumber(l, d);
+        return;
+    case 0xcc: case 0xcd: case 0xce: case 0xcf:
+        w = 1 << (c - MP_UINT8);
+        u = mp_get(mp_take(l, mp, w), w);
+        if (u > INT64_MAX)
+            lua_pushnumber(l, (lua_Number)u);
+        else
+            mp_push_integer(l, (int64_t)u);
+        return;
+    case 0xd0: case 0xd1: case 0xd2: case 0xd3:
+        w = 1 << (c - MP_INT8);
+        u = mp_get(mp_take(l, mp, w), w);
+        if (w < 8 && u >> (8 * w - 1))  /* sign extend */
+            u |= ~(uint64_t)0 << 8 * w;
+        mp_push_integer(l, (int64_t)u);
+        return;
+    case 0xdc: case 0xdd:               /* array 16, 32 */
+    case 0xde: case 0xdf:               /* map 16, 32 */
+        w = 2 << (c & 1);
+        n = (uint32_t)mp_get(mp_take(l, mp, w), w);
+        mp_process_container(l, mp, n, c >= 0xde);
+        return;
+    }
+
+    mp->ptr--;
+    mp_throw_error(l, mp, c == 0xc1 ? "the reserved type 0xc1" :
+                          "an extension type");
+}
+
+static int mp_decode(lua_State *l)
+{
+    mp_parse_t mp;
+    size_t len;
+
+    luaL_argcheck(l, lua_gettop(l) == 1, 1, "expected 1 argument");
+
+    mp.cfg = json_fetch_config(l);
+    mp.data = (const unsigned char *)luaL_checklstring(l, 1, &len);
+    mp.ptr = mp.data;
+    mp.end = mp.data + len;
+    mp.current_depth = 0;
+
+    mp_process_value(l, &mp);
+    if (mp.ptr != mp.end)
+        mp_throw_error(l, &mp, "trailing data");
 
     return 1;
 }
@@ -1455,6 +3481,13 @@ static int lua_cjson_new(lua_State *l)
     luaL_Reg reg[] = {
         { "encode", json_encode },
         { "decode", json_decode },
+        { "decoder", json_decoder_new },
+        { "lazy", json_lazy_new },
+        { "encode_to", json_encode_to },
+        { "encode_append", json_encode_append },
+        { "buffer", json_buffer_new },
+        { "msgpack_encode", mp_encode },
+        { "msgpack_decode", mp_decode },
         { "encode_sparse_array", json_cfg_encode_sparse_array },
         { "encode_max_depth", json_cfg_encode_max_depth },
         { "decode_max_depth", json_cfg_decode_max_depth },
@@ -1462,6 +3495,7 @@ static int lua_cjson_new(lua_State *l)
         { "encode_keep_buffer", json_cfg_encode_keep_buffer },
         { "encode_invalid_numbers", json_cfg_encode_invalid_numbers },
         { "decode_invalid_numbers", json_cfg_decode_invalid_numbers },
+        { "decode_presize", json_cfg_decode_presize },
         { "new", lua_cjson_new },
         { NULL, NULL }
     };
@@ -1472,9 +3506,11 @@ static int lua_cjson_new(lua_State *l)
     /* cjson module table */
     lua_newtable(l);
 
-    /* Register functions with config data as upvalue */
+    /* Register functions with config data and the scratch space as
+     * upvalues */
     json_create_config(l);
-    luaL_setfuncs(l, reg, 1);
+    json_push_scratch(l);
+    luaL_setfuncs(l, reg, 2);
 
     /* Set cjson.null */
     lua_pushlightuserdata(l, NULL);
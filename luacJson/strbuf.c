@@ -26,6 +26,7 @@
 #include <stdlib.h>
 #include <stdarg.h>
 #include <string.h>
+#include <limits.h>
 
 #include "strbuf.h"
 
@@ -42,7 +43,34 @@ static void die(const char *fmt, ...)
     exit(-1);
 }
 
+static void *strbuf_alloc(strbuf_t *s, void *ptr, size_t osize, size_t nsize)
+{
+    strbuf_allocator_t *a = s->allocator;
+
+    if (a)
+        return a->alloc(a->ud, ptr, osize, nsize);
+
+    if (nsize == 0) {
+        free(ptr);
+        return NULL;
+    }
+    return realloc(ptr, nsize);
+}
+
+/* Does not return */
+static void strbuf_out_of_memory(strbuf_allocator_t *a)
+{
+    if (a && a->fail)
+        a->fail(a->fail_ud, "Out of memory");
+    die("Out of memory");
+}
+
 void strbuf_init(strbuf_t *s, int len)
+{
+    strbuf_init_alloc(s, len, NULL);
+}
+
+void strbuf_init_alloc(strbuf_t *s, int len, strbuf_allocator_t *a)
 {
     int size;
 
@@ -58,23 +86,32 @@ void strbuf_init(strbuf_t *s, int len)
     s->dynamic = 0;
     s->reallocs = 0;
     s->debug = 0;
+    s->allocator = a;
 
-    s->buf = malloc(size);
-    if (!s->buf)
-        die("Out of memory");
+    s->buf = strbuf_alloc(s, NULL, 0, size);
+    if (!s->buf) {
+        s->size = 0;    /* strbuf_free() still works */
+        strbuf_out_of_memory(a);
+    }
 
     strbuf_ensure_null(s);
 }
 
 strbuf_t *strbuf_new(int len)
+{
+    return strbuf_new_alloc(len, NULL);
+}
+
+strbuf_t *strbuf_new_alloc(int len, strbuf_allocator_t *a)
 {
     strbuf_t *s;
 
-    s = malloc(sizeof(strbuf_t));
+    s = a ? a->alloc(a->ud, NULL, 0, sizeof(strbuf_t))
+          : malloc(sizeof(strbuf_t));
     if (!s)
-        die("Out of memory");
+        strbuf_out_of_memory(a);
 
-    strbuf_init(s, len);
+    strbuf_init_alloc(s, len, a);
 
     /* Dynamic strbuf allocation / deallocation */
     s->dynamic = 1;
@@ -108,11 +145,11 @@ void strbuf_free(strbuf_t *s)
 
     /* 这里代码有先后顺序，要注意了哦 */
     if (s->buf) {
-        free(s->buf);
+        strbuf_alloc(s, s->buf, s->size, 0);
         s->buf = NULL;
     }
     if (s->dynamic)
-        free(s);
+        strbuf_alloc(s, s, sizeof(strbuf_t), 0);
 }
 
 /** 
@@ -130,8 +167,9 @@ char *strbuf_free_to_string(strbuf_t *s, int *len)
     if (len)
         *len = s->length;
 
+    /* buf 要交给同一个分配器释放 (osize 取 s->size) */
     if (s->dynamic)
-        free(s);
+        strbuf_alloc(s, s, sizeof(strbuf_t), 0);
 
     return buf;
 }
@@ -153,14 +191,19 @@ static int calculate_new_size(strbuf_t *s, int len)
     if (s->size > reqsize)
         return reqsize;
 
-    newsize = s->size;
+    newsize = s->size > 0 ? s->size : STRBUF_DEFAULT_SIZE;
     if (s->increment < 0) {
-        /* Exponential sizing */
-        while (newsize < reqsize)
+        /* Exponential sizing, up to reqsize when that overflows */
+        while (newsize < reqsize) {
+            if (newsize > INT_MAX / -s->increment)
+                return reqsize;
             newsize *= -s->increment;
-    } else {    /* 这里不能保证newsize>=len哦 */
+        }
+    } else {
         /* Linear sizing */
-        newsize = ((newsize + s->increment - 1) / s->increment) * s->increment;
+        newsize = ((reqsize + s->increment - 1) / s->increment) * s->increment;
+        if (newsize < reqsize)
+            return reqsize;
     }
 
     return newsize;
@@ -172,6 +215,7 @@ static int calculate_new_size(strbuf_t *s, int len)
 void strbuf_resize(strbuf_t *s, int len)
 {
     int newsize;
+    char *buf;
 
     newsize = calculate_new_size(s, len);
 
@@ -180,10 +224,11 @@ void strbuf_resize(strbuf_t *s, int len)
                 (long)s, s->size, newsize);
     }
 
+    buf = strbuf_alloc(s, s->buf, s->buf ? s->size : 0, newsize);
+    if (!buf)
+        strbuf_out_of_memory(s->allocator);     /* s is unchanged */
+    s->buf = buf;
     s->size = newsize;
-    s->buf = realloc(s->buf, s->size);
-    if (!s->buf)
-        die("Out of memory");
     s->reallocs++;
 }
 
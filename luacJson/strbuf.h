@@ -25,6 +25,19 @@
 #include <stdlib.h>
 #include <stdarg.h>
 
+/* Where the memory of a strbuf comes from.
+ * alloc: same contract as lua_Alloc (nsize 0 frees), so a lua_State's
+ *        allocator can be used as is.
+ * fail:  called when alloc fails, must not return (e.g. raises a Lua
+ *        error). The buffer being grown is left as it was.
+ * A strbuf without one uses realloc()/free() and exits on failure. */
+typedef struct {
+    void *(*alloc)(void *ud, void *ptr, size_t osize, size_t nsize);
+    void *ud;
+    void (*fail)(void *fail_ud, const char *msg);
+    void *fail_ud;
+} strbuf_allocator_t;
+
 /* Size: Total bytes allocated to *buf
  * Length: String length, excluding optional NULL terminator.
  * Increment: Allocation increments when resizing the string buffer.
@@ -43,6 +56,8 @@ typedef struct {
     int dynamic;        /* 本结构体是否是alloc申请而来，buf指向的MEM一定是alloc的，无须判断 */
     int reallocs;       /* 动态分配MEM的次数，用于优化inc_step? */
     int debug;          /* 是否被设置了调试开关 */
+
+    strbuf_allocator_t *allocator;  /* NULL: realloc()/free() */
 } strbuf_t;
 
 #ifndef STRBUF_DEFAULT_SIZE
@@ -56,6 +71,8 @@ typedef struct {
 /* Initialise */
 extern strbuf_t *strbuf_new(int len);
 extern void strbuf_init(strbuf_t *s, int len);
+extern strbuf_t *strbuf_new_alloc(int len, strbuf_allocator_t *a);
+extern void strbuf_init_alloc(strbuf_t *s, int len, strbuf_allocator_t *a);
 extern void strbuf_set_increment(strbuf_t *s, int increment);
 
 /* Release */
@@ -0,0 +1,58 @@
+-- listing a directory with sizes: lfs.dir + lfs.attributes against
+-- lfs.scandir
+-- usage: lua scandir.lua path [repeat]
+
+local lfs = require "lfs"
+
+local path = assert(arg and arg[1], "usage: lua scandir.lua path [repeat]")
+local rep = tonumber(arg[2]) or 5
+local clock = os.clock
+
+local function dir_attributes()
+  local n, bytes = 0, 0
+  for name in lfs.dir(path) do
+    local a = lfs.attributes(path .. "/" .. name)
+    if a and a.mode == "file" then bytes = bytes + a.size end
+    n = n + 1
+  end
+  return n, bytes
+end
+
+local function dir_size()
+  local n, bytes = 0, 0
+  for name in lfs.dir(path) do
+    if lfs.attributes(path .. "/" .. name, "mode") == "file" then
+      bytes = bytes + lfs.attributes(path .. "/" .. name, "size")
+    end
+    n = n + 1
+  end
+  return n, bytes
+end
+
+local function scandir(attrs)
+  return function ()
+    local n, bytes = 0, 0
+    for b in lfs.scandir(path, attrs) do
+      local mode, size = b.mode, b.size
+      for i = 1, b.n do
+        if mode[i] == "file" and size then bytes = bytes + size[i] end
+      end
+      n = n + b.n
+    end
+    return n, bytes
+  end
+end
+
+local cases = {
+  { "dir+attributes", dir_attributes },
+  { "dir+attributes(k)", dir_size },
+  { "scandir mode,size", scandir { "mode", "size", batch = 1000 } },
+  { "scandir mode", scandir { "mode", batch = 1000 } },
+}
+
+print(string.format("%-20s %10s %12s", "method", "entries", "entries/s"))
+for _, c in ipairs(cases) do
+  local t0, n = clock()
+  for i = 1, rep do n = c[2]() end
+  print(string.format("%-20s %10d %12.0f", c[1], n, n * rep / (clock() - t0)))
+end
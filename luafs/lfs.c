@@ -13,10 +13,15 @@
 **   lfs.lock_dir (path)
 **   lfs.mkdir (path)
 **   lfs.rmdir (path)
+**   lfs.scandir (path [, options])
 **   lfs.setmode (filepath, mode)
+**   lfs.stat (filepath [, st])
+**   lfs.lstat (filepath [, st])
 **   lfs.symlinkattributes (filepath [, attributename])
 **   lfs.touch (filepath [, atime [, mtime]])
 **   lfs.unlock (fh)
+**   lfs.walk (root [, options])
+**   lfs.watch (path [, mask])
 */
 
 #ifndef LFS_DO_NOT_USE_LARGE_FILE
@@ -61,6 +66,25 @@
   #include <utime.h>
   #include <sys/param.h> /* for MAXPATHLEN */
   #define LFS_MAXPATHLEN MAXPATHLEN
+  #ifndef LFS_NO_THREADS
+    #include <pthread.h>
+    #include <fnmatch.h>
+    #define LFS_HAVE_WALK /* lfs.walk */
+  #endif
+  #ifndef LFS_NO_WATCH /* lfs.watch */
+    #if defined(__linux__)
+      #include <sys/inotify.h>
+      #include <poll.h>
+      #define LFS_WATCH_INOTIFY
+      #define LFS_HAVE_WATCH
+    #elif defined(__APPLE__) || defined(__FreeBSD__) || defined(__NetBSD__) || \
+          defined(__OpenBSD__) || defined(__DragonFly__)
+      #include <sys/event.h>
+      #include <poll.h>
+      #define LFS_WATCH_KQUEUE
+      #define LFS_HAVE_WATCH
+    #endif
+  #endif
 #endif
 
 #include <lua.h>
@@ -811,6 +835,25 @@ struct _stat_members members[] = {
         { NULL, NULL }
 };
 
+#define NMEMBERS (sizeof(members) / sizeof(members[0]) - 1)
+
+/*
+** The member names, shared by attributes, symlinkattributes and stat
+** objects as upvalue 1: names[i] is the name of members[i-1] and
+** names[name] is i. Pushing a cached key needs no hashing of a C string.
+*/
+static void push_member_names (lua_State *L) {
+        int i;
+        lua_createtable (L, NMEMBERS, NMEMBERS);
+        for (i = 0; members[i].name; i++) {
+                lua_pushstring (L, members[i].name);
+                lua_pushvalue (L, -1);
+                lua_rawseti (L, -3, i + 1);
+                lua_pushinteger (L, i + 1);
+                lua_rawset (L, -3);
+        }
+}
+
 /*
 ** Get file or symbolic link information
 ** arg.1: fileName
@@ -831,27 +874,26 @@ static int _file_info_ (lua_State *L, int (*st)(const char*, STAT_STRUCT*))
 
         /* 具体进行stat的某项操作eg: push_st_gid() */
         if (lua_isstring (L, 2)) {  
-                const char *member = lua_tostring (L, 2);
-                for (i = 0; members[i].name; i++) {
-                        if (strcmp(members[i].name, member) == 0) {
-                                /* push member value and return */
-                                members[i].push (L, &info);
-                                return 1;
-                        }
+                lua_pushvalue (L, 2);
+                lua_rawget (L, lua_upvalueindex (1));
+                if (lua_type (L, -1) == LUA_TNUMBER) {
+                        /* push member value and return */
+                        members[lua_tointeger (L, -1) - 1].push (L, &info);
+                        return 1;
                 }
                 /* member not found */
-                return luaL_error(L, "invalid attribute name '%s'", member);
+                return luaL_error(L, "invalid attribute name '%s'", lua_tostring (L, 2));
         }
 
         /* creates a table if none is given, removes extra arguments */
         lua_settop(L, 2);
         if (!lua_istable (L, 2)) {
-                lua_newtable (L);
+                lua_createtable (L, 0, NMEMBERS + 1);   /* +1: target */
         }
 
         /* stores all members in table on top of the stack */
         for (i = 0; members[i].name; i++) {
-                lua_pushstring (L, members[i].name);
+                lua_rawgeti (L, lua_upvalueindex (1), i + 1);
                 members[i].push (L, &info);
                 lua_rawset (L, -3);
         }
@@ -934,6 +976,1180 @@ static int link_info (lua_State *L)
 }
 
 
+/*
+** Stat objects: lfs.stat (path [, st]) and lfs.lstat (path [, st])
+** return a userdata holding the stat result, read as st.size, st.mode
+** ... (the names of lfs.attributes). Fields are only converted when
+** read, and passing an earlier st refills it instead of allocating.
+** On failure they return nil and a message, as lfs.attributes.
+*/
+#define STAT_METATABLE "stat metatable"
+
+static int stat_index (lua_State *L) {
+        STAT_STRUCT *info = (STAT_STRUCT *)luaL_checkudata (L, 1, STAT_METATABLE);
+        lua_settop (L, 2);
+        lua_rawget (L, lua_upvalueindex (1));
+        if (lua_type (L, -1) != LUA_TNUMBER)
+                return 0;
+        members[lua_tointeger (L, -1) - 1].push (L, info);
+        return 1;
+}
+
+static int _stat_ (lua_State *L, int (*st)(const char*, STAT_STRUCT*))
+{
+        const char *file = luaL_checkstring (L, 1);
+        STAT_STRUCT *info = NULL;
+
+        /* reuse st if it is one */
+        if (lua_getmetatable (L, 2)) {
+                luaL_getmetatable (L, STAT_METATABLE);
+                if (lua_rawequal (L, -1, -2))
+                        info = (STAT_STRUCT *)lua_touserdata (L, 2);
+                lua_pop (L, 2);
+        }
+        lua_settop (L, 2);
+        if (!info) {
+                info = (STAT_STRUCT *)lua_newuserdata (L, sizeof(STAT_STRUCT));
+                luaL_getmetatable (L, STAT_METATABLE);
+                lua_setmetatable (L, -2);
+        }
+
+        if (st(file, info)) {
+                lua_pushnil(L);
+                lua_pushfstring(L, "cannot obtain information from file '%s': %s", file, strerror(errno));
+                return 2;
+        }
+        return 1;
+}
+
+static int file_stat (lua_State *L)
+{
+    return _stat_ (L, STAT_FUNC);
+}
+
+static int link_stat (lua_State *L)
+{
+    return _stat_ (L, LSTAT_FUNC);
+}
+
+
+/*
+** Creates stat metatable, with the member names on top of the stack.
+*/
+static int stat_create_meta (lua_State *L) {
+        luaL_newmetatable (L, STAT_METATABLE);
+        lua_pushvalue (L, -2);
+        lua_pushcclosure (L, stat_index, 1);
+        lua_setfield (L, -2, "__index");
+        lua_pop (L, 1);
+        return 0;
+}
+
+
+/*
+** Batched directory scan: lfs.scandir (path [, options])
+**   for b in lfs.scandir (path, {"mode", "size", batch = 1000}) do
+**     for i = 1, b.n do print (b.name[i], b.mode[i], b.size[i]) end
+**   end
+** The array part of options names the attributes wanted (as in
+** lfs.attributes), batch is the most entries per step (SCANDIR_BATCH)
+** and symlinks = true describes links themselves (as symlinkattributes).
+** Each step returns one table of columns, not a table per entry.
+** Only the attributes asked for are pushed; "mode" alone comes from
+** d_type without a stat, the others from fstatat() relative to the
+** directory. Entries that cannot be stat'ed (eg: removed meanwhile)
+** have false attributes.
+*/
+#define SCANDIR_METATABLE "scandir metatable"
+#define SCANDIR_BATCH 256
+
+#if !defined(_WIN32) && defined(AT_SYMLINK_NOFOLLOW)
+#define LFS_HAVE_FSTATAT
+#endif
+#if !defined(_WIN32) && defined(DT_UNKNOWN) && defined(DTTOIF)
+#define LFS_HAVE_D_TYPE
+#endif
+
+typedef struct scan_data {
+        dir_data dir;           /* 必须在最前: dir_close() 可直接使用 */
+        int batch;
+        int symlinks;
+        int nattrs;
+        int mode;               /* attrs 中 "mode" 的位置, -1: 没有 */
+        int stat;               /* 有除 mode 外的属性, 每个条目都要 stat */
+        unsigned char attrs[NMEMBERS];
+#ifndef LFS_HAVE_FSTATAT
+        char path[LFS_MAXPATHLEN];
+#endif
+} scan_data;
+
+
+/* 取条目 name 的属性, 成功返回 0 */
+static int scan_stat (scan_data *s, const char *name, STAT_STRUCT *info) {
+#ifdef LFS_HAVE_FSTATAT
+        return fstatat (dirfd (s->dir.dir), name, info,
+                        s->symlinks ? AT_SYMLINK_NOFOLLOW : 0);
+#else
+        char file[LFS_MAXPATHLEN];
+        if (strlen (s->path) + strlen (name) + 2 > sizeof(file)) {
+                errno = ENAMETOOLONG;
+                return -1;
+        }
+        sprintf (file, "%s/%s", s->path, name);
+        return s->symlinks ? LSTAT_FUNC (file, info) : STAT_FUNC (file, info);
+#endif
+}
+
+
+/*
+** Returns the next batch, nil at the end of the directory
+*/
+static int scan_iter (lua_State *L) {
+#ifdef _WIN32
+        struct _finddata_t c_file;
+#else
+        struct dirent *entry;
+#endif
+        scan_data *s = (scan_data *)luaL_checkudata (L, 1, SCANDIR_METATABLE);
+        STAT_STRUCT info;
+        const char *name, *mode;
+        int n, i, ok;
+
+        luaL_argcheck (L, s->dir.closed == 0, 1, "closed directory");
+        lua_settop (L, 1);
+        luaL_checkstack (L, s->nattrs + 3, "too many attributes");
+
+        /* 各列先放在栈上: 2 是 name, 3.. 是各属性 */
+        for (i = 0; i <= s->nattrs; i++)
+                lua_createtable (L, s->batch, 0);
+
+        for (n = 0; n < s->batch; ) {
+#ifdef _WIN32
+                if (s->dir.hFile == 0L) { /* first entry */
+                        if ((s->dir.hFile = _findfirst (s->dir.pattern, &c_file)) == -1L) {
+                                s->dir.closed = 1;
+                                return luaL_error (L, "cannot open %s: %s", s->path, strerror (errno));
+                        }
+                } else if (_findnext (s->dir.hFile, &c_file) == -1L) {
+                        break;
+                }
+                name = c_file.name;
+                mode = NULL;
+#else
+                if ((entry = readdir (s->dir.dir)) == NULL)
+                        break;
+                name = entry->d_name;
+                mode = NULL;
+#ifdef LFS_HAVE_D_TYPE
+                /* a link gives the type of its target, unless symlinks */
+                if (entry->d_type != DT_UNKNOWN &&
+                    (entry->d_type != DT_LNK || s->symlinks))
+                        mode = mode2string (DTTOIF (entry->d_type));
+#endif
+#endif
+                n++;
+                lua_pushstring (L, name);
+                lua_rawseti (L, 2, n);
+                if (s->nattrs == 0)
+                        continue;
+
+                ok = 0;
+                if (s->stat || !mode)
+                        ok = scan_stat (s, name, &info) == 0;
+                for (i = 0; i < s->nattrs; i++) {
+                        if (i == s->mode && mode)
+                                lua_pushstring (L, mode);
+                        else if (ok)
+                                members[s->attrs[i]].push (L, &info);
+                        else
+                                lua_pushboolean (L, 0);
+                        lua_rawseti (L, 3 + i, n);
+                }
+        }
+
+        if (n == 0) {
+                /* no more entries => close directory */
+                lua_settop (L, 1);
+                return dir_close (L);
+        }
+
+        lua_createtable (L, 0, s->nattrs + 2);
+        lua_pushinteger (L, n);
+        lua_setfield (L, -2, "n");
+        lua_pushvalue (L, 2);
+        lua_setfield (L, -2, "name");
+        for (i = 0; i < s->nattrs; i++) {
+                lua_pushvalue (L, 3 + i);
+                lua_setfield (L, -2, members[s->attrs[i]].name);
+        }
+        return 1;
+}
+
+
+/*
+** Factory of batched directory iterators
+*/
+static int scan_iter_factory (lua_State *L) {
+        const char *path = luaL_checkstring (L, 1);
+        scan_data *s;
+        const char *attr;
+        int i, j, n = 0;
+
+        if (!lua_isnoneornil (L, 2)) {
+                luaL_checktype (L, 2, LUA_TTABLE);
+                n = (int)lua_objlen (L, 2);
+                luaL_argcheck (L, n <= (int)NMEMBERS, 2, "too many attributes");
+        }
+        lua_settop (L, 2);
+
+        lua_pushcfunction (L, scan_iter);
+        s = (scan_data *) lua_newuserdata (L, sizeof(scan_data));
+        s->dir.closed = 1;      /* until opened */
+#ifdef _WIN32
+        s->dir.hFile = 0L;
+#else
+        s->dir.dir = NULL;
+#endif
+        luaL_getmetatable (L, SCANDIR_METATABLE);
+        lua_setmetatable (L, -2);
+
+        s->batch = SCANDIR_BATCH;
+        s->symlinks = 0;
+        s->nattrs = n;
+        s->mode = -1;
+        s->stat = 0;
+        for (i = 0; i < n; i++) {
+                lua_rawgeti (L, 2, i + 1);
+                attr = lua_tostring (L, -1);
+                if (!attr)
+                        return luaL_argerror (L, 2, "attribute names must be strings");
+                for (j = 0; members[j].name; j++)
+                        if (strcmp (members[j].name, attr) == 0)
+                                break;
+                if (!members[j].name)
+                        return luaL_error (L, "invalid attribute name '%s'", attr);
+                s->attrs[i] = (unsigned char)j;
+                if (members[j].push == push_st_mode)
+                        s->mode = i;
+                else
+                        s->stat = 1;
+                lua_pop (L, 1);
+        }
+        if (lua_istable (L, 2)) {
+                lua_getfield (L, 2, "batch");
+                s->batch = (int)luaL_optinteger (L, -1, SCANDIR_BATCH);
+                luaL_argcheck (L, s->batch >= 1, 2, "batch must be at least 1");
+                lua_getfield (L, 2, "symlinks");
+                s->symlinks = lua_toboolean (L, -1);
+                lua_pop (L, 2);
+        }
+
+#ifndef LFS_HAVE_FSTATAT
+        if (strlen (path) > sizeof(s->path) - 1)
+                return luaL_error (L, "path too long: %s", path);
+        strcpy (s->path, path);
+#endif
+#ifdef _WIN32
+        if (strlen (path) > MAX_PATH-2)
+                return luaL_error (L, "path too long: %s", path);
+        sprintf (s->dir.pattern, "%s/*", path);
+#else
+        s->dir.dir = opendir (path);
+        if (s->dir.dir == NULL)
+                return luaL_error (L, "cannot open %s: %s", path, strerror (errno));
+#endif
+        s->dir.closed = 0;
+        return 2;
+}
+
+
+/*
+** Creates scandir metatable.
+*/
+static int scan_create_meta (lua_State *L) {
+        luaL_newmetatable (L, SCANDIR_METATABLE);
+
+        /* Method table */
+        lua_newtable (L);
+        lua_pushcfunction (L, scan_iter);
+        lua_setfield (L, -2, "next");
+        lua_pushcfunction (L, dir_close);
+        lua_setfield (L, -2, "close");
+
+        /* Metamethods */
+        lua_setfield (L, -2, "__index");
+        lua_pushcfunction (L, dir_close);
+        lua_setfield (L, -2, "__gc");
+        return 1;
+}
+
+
+/*
+** Parallel recursive walk: lfs.walk (root [, options])
+**   for path, mode in lfs.walk (root, {glob = "*.log", newer = t}) do ... end
+** Worker threads read the directories under root concurrently and pass
+** the entries that pass the filters back in chunks through a bounded
+** queue; no Lua runs on the workers. Each worker keeps its own deque of
+** directories to read: it takes the newest one itself (depth first,
+** warm caches) while idle workers steal the oldest ones (big subtrees).
+** Options:
+**   threads  number of workers (default: the online CPUs)
+**   glob     fnmatch() pattern the entry name must match
+**   newer    only entries modified after this time
+**   older    only entries modified before this time
+**   dirs     also return directories (they are always descended into)
+**   queue    chunks of WALK_CHUNK entries buffered at most (default 16)
+** Symbolic links are returned as "link" and not followed. Directories
+** that cannot be read are skipped. Entries come in no particular order.
+** Needs pthreads (link with -lpthread); define LFS_NO_THREADS to build
+** without lfs.walk.
+*/
+#ifdef LFS_HAVE_WALK
+
+#define WALK_METATABLE "walk metatable"
+
+#define WALK_CHUNK      256
+#define WALK_QUEUE      16
+#define WALK_MAXTHREADS 64
+
+/* Entries on their way to the calling state */
+typedef struct walk_chunk {
+        int n;
+        const char *mode[WALK_CHUNK];   /* mode2string() */
+        int off[WALK_CHUNK];            /* of the path in buf */
+        int used, size;
+        char *buf;
+} walk_chunk;
+
+/* Directories still to read, owned by one worker */
+typedef struct walk_deque {
+        pthread_mutex_t lock;
+        char **dirs;
+        int head, tail, size;           /* dirs[head..tail) */
+} walk_deque;
+
+/* Shared by the workers and the iterator, freed by the iterator */
+typedef struct walk_state {
+        int nthreads;
+        pthread_t *threads;
+        walk_deque *deques;
+
+        int started;                    /* threads created */
+
+        /* filters */
+        char *glob;
+        int has_newer, has_older;
+        time_t newer, older;
+        int dirs;
+
+        /* lock: queued, pending, idle, cancel */
+        pthread_mutex_t lock;
+        pthread_cond_t work;
+        int queued;                     /* directories in the deques */
+        int pending;                    /* queued or being read */
+        int idle;
+        int cancel;
+        int error;                      /* errno of a failed allocation */
+
+        /* rlock: the result queue, running */
+        pthread_mutex_t rlock;
+        pthread_cond_t not_empty, not_full;
+        walk_chunk **results;
+        int rhead, rcount, rsize;
+        int running;                    /* workers not finished */
+} walk_state;
+
+typedef struct walk_data {
+        walk_state *w;
+        walk_chunk *cur;                /* being returned */
+        int pos;
+} walk_data;
+
+typedef struct walk_worker {
+        walk_state *w;
+        int id;
+        walk_chunk *out;
+} walk_worker;
+
+
+static void walk_fail (walk_state *w, int err) {
+        pthread_mutex_lock (&w->lock);
+        if (!w->error)
+                w->error = err;
+        w->cancel = 1;
+        pthread_cond_broadcast (&w->work);
+        pthread_mutex_unlock (&w->lock);
+        pthread_mutex_lock (&w->rlock);
+        pthread_cond_broadcast (&w->not_full);
+        pthread_mutex_unlock (&w->rlock);
+}
+
+static int walk_cancelled (walk_state *w) {
+        int cancel;
+        pthread_mutex_lock (&w->lock);
+        cancel = w->cancel;
+        pthread_mutex_unlock (&w->lock);
+        return cancel;
+}
+
+/* Takes dir (a malloc()ed path) into the deque of worker id */
+static int walk_push_dir (walk_state *w, int id, char *dir) {
+        walk_deque *q = &w->deques[id];
+
+        pthread_mutex_lock (&q->lock);
+        if (q->tail == q->size) {
+                if (q->head > 0) {      /* slide down first */
+                        memmove (q->dirs, q->dirs + q->head,
+                                 (q->tail - q->head) * sizeof(char *));
+                        q->tail -= q->head;
+                        q->head = 0;
+                }
+                if (q->tail == q->size) {
+                        int size = q->size ? 2 * q->size : 64;
+                        char **dirs = realloc (q->dirs, size * sizeof(char *));
+                        if (!dirs) {
+                                pthread_mutex_unlock (&q->lock);
+                                free (dir);
+                                walk_fail (w, ENOMEM);
+                                return 0;
+                        }
+                        q->dirs = dirs;
+                        q->size = size;
+                }
+        }
+        q->dirs[q->tail++] = dir;
+        pthread_mutex_unlock (&q->lock);
+
+        pthread_mutex_lock (&w->lock);
+        w->queued++;
+        w->pending++;
+        if (w->idle)
+                pthread_cond_signal (&w->work);
+        pthread_mutex_unlock (&w->lock);
+        return 1;
+}
+
+/* The newest directory of worker id, else the oldest of another one */
+static char *walk_take_dir (walk_state *w, int id) {
+        char *dir = NULL;
+        int i;
+
+        for (i = 0; i < w->nthreads && !dir; i++) {
+                walk_deque *q = &w->deques[(id + i) % w->nthreads];
+                pthread_mutex_lock (&q->lock);
+                if (q->head < q->tail)
+                        dir = i == 0 ? q->dirs[--q->tail] : q->dirs[q->head++];
+                pthread_mutex_unlock (&q->lock);
+        }
+        if (dir) {
+                pthread_mutex_lock (&w->lock);
+                w->queued--;
+                pthread_mutex_unlock (&w->lock);
+        }
+        return dir;
+}
+
+/* Hands the chunk of a worker over to the iterator */
+static void walk_publish (walk_worker *ww) {
+        walk_state *w = ww->w;
+        walk_chunk *c = ww->out;
+
+        if (!c || c->n == 0)
+                return;
+        ww->out = NULL;
+
+        pthread_mutex_lock (&w->rlock);
+        while (w->rcount == w->rsize && !walk_cancelled (w))
+                pthread_cond_wait (&w->not_full, &w->rlock);
+        if (w->rcount < w->rsize) {
+                w->results[(w->rhead + w->rcount++) % w->rsize] = c;
+                c = NULL;
+                pthread_cond_signal (&w->not_empty);
+        }
+        pthread_mutex_unlock (&w->rlock);
+
+        if (c) {                        /* cancelled */
+                free (c->buf);
+                free (c);
+        }
+}
+
+static int walk_append (walk_worker *ww, const char *path, int len,
+                        const char *mode) {
+        walk_chunk *c = ww->out;
+
+        if (c && c->n == WALK_CHUNK) {
+                walk_publish (ww);
+                c = NULL;
+        }
+        if (!c) {
+                c = ww->out = calloc (1, sizeof(walk_chunk));
+                if (!c) {
+                        walk_fail (ww->w, ENOMEM);
+                        return 0;
+                }
+        }
+        if (c->used + len + 1 > c->size) {
+                int size = c->size ? 2 * c->size : 16384;
+                char *buf;
+                while (size < c->used + len + 1)
+                        size *= 2;
+                buf = realloc (c->buf, size);
+                if (!buf) {
+                        walk_fail (ww->w, ENOMEM);
+                        return 0;
+                }
+                c->buf = buf;
+                c->size = size;
+        }
+        memcpy (c->buf + c->used, path, len + 1);
+        c->off[c->n] = c->used;
+        c->mode[c->n++] = mode;
+        c->used += len + 1;
+        return 1;
+}
+
+/* Reads one directory: queues its subdirectories, returns its entries */
+static void walk_read_dir (walk_worker *ww, char *dir) {
+        walk_state *w = ww->w;
+        size_t dlen = strlen (dir);
+        struct dirent *entry;
+        STAT_STRUCT info;
+        DIR *d = opendir (dir);
+
+        if (!d)
+                return;                 /* unreadable: skipped */
+
+        while ((entry = readdir (d)) != NULL) {
+                const char *name = entry->d_name;
+                size_t nlen = strlen (name);
+                const char *mode = NULL;
+                int isdir, stated = 0;
+                char *path;
+
+                if (name[0] == '.' && (name[1] == '\0' ||
+                    (name[1] == '.' && name[2] == '\0')))
+                        continue;
+#ifdef LFS_HAVE_D_TYPE
+                if (entry->d_type != DT_UNKNOWN)
+                        mode = mode2string (DTTOIF (entry->d_type));
+#endif
+                if (!mode || w->has_newer || w->has_older) {
+                        if (fstatat (dirfd (d), name, &info, AT_SYMLINK_NOFOLLOW))
+                                continue;       /* gone meanwhile */
+                        mode = mode2string (info.st_mode);
+                        stated = 1;
+                }
+                isdir = strcmp (mode, "directory") == 0;
+
+                path = malloc (dlen + nlen + 2);
+                if (!path) {
+                        walk_fail (w, ENOMEM);
+                        break;
+                }
+                memcpy (path, dir, dlen);
+                path[dlen] = '/';
+                memcpy (path + dlen + 1, name, nlen + 1);
+
+                if ((!isdir || w->dirs) &&
+                    (!w->glob || fnmatch (w->glob, name, 0) == 0) &&
+                    (!w->has_newer || (stated && info.st_mtime > w->newer)) &&
+                    (!w->has_older || (stated && info.st_mtime < w->older))) {
+                        if (!walk_append (ww, path, (int)(dlen + nlen + 1), mode)) {
+                                free (path);
+                                break;
+                        }
+                }
+
+                if (isdir) {
+                        if (!walk_push_dir (w, ww->id, path))
+                                break;
+                } else {
+                        free (path);
+                }
+        }
+        closedir (d);
+}
+
+static void *walk_worker_main (void *arg) {
+        walk_worker *ww = arg;
+        walk_state *w = ww->w;
+        char *dir;
+
+        for (;;) {
+                dir = walk_take_dir (w, ww->id);
+                if (dir) {
+                        if (!walk_cancelled (w))
+                                walk_read_dir (ww, dir);
+                        free (dir);
+                        pthread_mutex_lock (&w->lock);
+                        if (--w->pending == 0)
+                                pthread_cond_broadcast (&w->work);
+                        pthread_mutex_unlock (&w->lock);
+                        continue;
+                }
+
+                /* Nothing to take: pass on what we have, then wait */
+                walk_publish (ww);
+                pthread_mutex_lock (&w->lock);
+                while (w->queued == 0 && w->pending > 0 && !w->cancel) {
+                        w->idle++;
+                        pthread_cond_wait (&w->work, &w->lock);
+                        w->idle--;
+                }
+                if (w->pending == 0 || w->cancel) {
+                        pthread_mutex_unlock (&w->lock);
+                        break;
+                }
+                pthread_mutex_unlock (&w->lock);
+        }
+
+        walk_publish (ww);
+        if (ww->out) {                  /* cancelled */
+                free (ww->out->buf);
+                free (ww->out);
+        }
+
+        pthread_mutex_lock (&w->rlock);
+        if (--w->running == 0)
+                pthread_cond_broadcast (&w->not_empty);
+        pthread_mutex_unlock (&w->rlock);
+        free (ww);
+        return NULL;
+}
+
+/* Stops the workers (if still running) and frees everything */
+static void walk_destroy (walk_state *w) {
+        int i;
+
+        walk_fail (w, 0);
+        for (i = 0; i < w->started; i++)
+                pthread_join (w->threads[i], NULL);
+
+        for (i = 0; w->deques && i < w->nthreads; i++) {
+                walk_deque *q = &w->deques[i];
+                while (q->head < q->tail)
+                        free (q->dirs[q->head++]);
+                free (q->dirs);
+                pthread_mutex_destroy (&q->lock);
+        }
+        while (w->results && w->rcount > 0) {
+                walk_chunk *c = w->results[w->rhead];
+                w->rhead = (w->rhead + 1) % w->rsize;
+                w->rcount--;
+                free (c->buf);
+                free (c);
+        }
+        pthread_mutex_destroy (&w->lock);
+        pthread_cond_destroy (&w->work);
+        pthread_mutex_destroy (&w->rlock);
+        pthread_cond_destroy (&w->not_empty);
+        pthread_cond_destroy (&w->not_full);
+        free (w->results);
+        free (w->deques);
+        free (w->threads);
+        free (w->glob);
+        free (w);
+}
+
+/* The next chunk, NULL once the walk is over */
+static walk_chunk *walk_next_chunk (walk_state *w) {
+        walk_chunk *c = NULL;
+
+        pthread_mutex_lock (&w->rlock);
+        while (w->rcount == 0 && w->running > 0)
+                pthread_cond_wait (&w->not_empty, &w->rlock);
+        if (w->rcount > 0) {
+                c = w->results[w->rhead];
+                w->rhead = (w->rhead + 1) % w->rsize;
+                w->rcount--;
+                pthread_cond_signal (&w->not_full);
+        }
+        pthread_mutex_unlock (&w->rlock);
+        return c;
+}
+
+static int walk_close (lua_State *L) {
+        walk_data *wd = (walk_data *)lua_touserdata (L, 1);
+
+        if (wd->cur) {
+                free (wd->cur->buf);
+                free (wd->cur);
+                wd->cur = NULL;
+        }
+        if (wd->w) {
+                walk_destroy (wd->w);
+                wd->w = NULL;
+        }
+        return 0;
+}
+
+/*
+** Returns the next path and its mode, nil at the end of the walk
+*/
+static int walk_iter (lua_State *L) {
+        walk_data *wd = (walk_data *)luaL_checkudata (L, 1, WALK_METATABLE);
+        walk_chunk *c;
+        int err;
+
+        luaL_argcheck (L, wd->w != NULL, 1, "closed walk");
+        if (!wd->cur || wd->pos == wd->cur->n) {
+                if (wd->cur) {
+                        free (wd->cur->buf);
+                        free (wd->cur);
+                }
+                wd->cur = walk_next_chunk (wd->w);
+                wd->pos = 0;
+                if (!wd->cur) {
+                        err = wd->w->error;
+                        walk_close (L);
+                        if (err)
+                                return luaL_error (L, "walk failed: %s", strerror (err));
+                        return 0;
+                }
+        }
+        c = wd->cur;
+        lua_pushstring (L, c->buf + c->off[wd->pos]);
+        lua_pushstring (L, c->mode[wd->pos]);
+        wd->pos++;
+        return 2;
+}
+
+static void walk_opt_time (lua_State *L, const char *field, time_t *t, int *set) {
+        lua_getfield (L, 2, field);
+        if (!lua_isnil (L, -1)) {
+                *t = (time_t)luaL_checknumber (L, -1);
+                *set = 1;
+        }
+        lua_pop (L, 1);
+}
+
+/*
+** Factory of walks
+*/
+static int walk_factory (lua_State *L) {
+        const char *root = luaL_checkstring (L, 1);
+        long ncpu = sysconf (_SC_NPROCESSORS_ONLN);
+        int nthreads = ncpu > 0 ? (int)ncpu : 1;
+        int queue = WALK_QUEUE;
+        STAT_STRUCT info;
+        walk_data *wd;
+        walk_state *w;
+        size_t len;
+        char *dir;
+        int i;
+
+        if (STAT_FUNC (root, &info))
+                return luaL_error (L, "cannot open %s: %s", root, strerror (errno));
+        if (!S_ISDIR (info.st_mode))
+                return luaL_error (L, "cannot open %s: %s", root, strerror (ENOTDIR));
+        if (!lua_isnoneornil (L, 2))
+                luaL_checktype (L, 2, LUA_TTABLE);
+        lua_settop (L, 2);
+
+        wd = (walk_data *) lua_newuserdata (L, sizeof(walk_data));
+        wd->w = NULL;
+        wd->cur = NULL;
+        wd->pos = 0;
+        luaL_getmetatable (L, WALK_METATABLE);
+        lua_setmetatable (L, -2);
+
+        /* From here on errors leave w to __gc */
+        w = calloc (1, sizeof(walk_state));
+        if (!w)
+                return luaL_error (L, "not enough memory");
+        pthread_mutex_init (&w->lock, NULL);
+        pthread_cond_init (&w->work, NULL);
+        pthread_mutex_init (&w->rlock, NULL);
+        pthread_cond_init (&w->not_empty, NULL);
+        pthread_cond_init (&w->not_full, NULL);
+        wd->w = w;
+
+        if (lua_istable (L, 2)) {
+                lua_getfield (L, 2, "threads");
+                nthreads = (int)luaL_optinteger (L, -1, nthreads);
+                lua_getfield (L, 2, "queue");
+                queue = (int)luaL_optinteger (L, -1, queue);
+                lua_getfield (L, 2, "dirs");
+                w->dirs = lua_toboolean (L, -1);
+                lua_getfield (L, 2, "glob");
+                if (!lua_isnil (L, -1)) {
+                        const char *glob = lua_tolstring (L, -1, &len);
+                        if (!glob)
+                                return luaL_argerror (L, 2, "glob must be a string");
+                        w->glob = malloc (len + 1);
+                        if (!w->glob)
+                                return luaL_error (L, "not enough memory");
+                        memcpy (w->glob, glob, len + 1);
+                }
+                lua_pop (L, 4);
+                walk_opt_time (L, "newer", &w->newer, &w->has_newer);
+                walk_opt_time (L, "older", &w->older, &w->has_older);
+        }
+        if (nthreads < 1)
+                nthreads = 1;
+        if (nthreads > WALK_MAXTHREADS)
+                nthreads = WALK_MAXTHREADS;
+        if (queue < 1)
+                queue = 1;
+
+        w->threads = calloc (nthreads, sizeof(pthread_t));
+        w->deques = calloc (nthreads, sizeof(walk_deque));
+        w->results = calloc (queue, sizeof(walk_chunk *));
+        if (!w->threads || !w->deques || !w->results)
+                return luaL_error (L, "not enough memory");
+        w->nthreads = nthreads;
+        w->rsize = queue;
+        for (i = 0; i < nthreads; i++)
+                pthread_mutex_init (&w->deques[i].lock, NULL);
+
+        /* The root, without trailing '/' (but "/" itself) */
+        len = strlen (root);
+        while (len > 1 && root[len - 1] == '/')
+                len--;
+        dir = malloc (len + 1);
+        if (!dir)
+                return luaL_error (L, "not enough memory");
+        memcpy (dir, root, len);
+        dir[len] = '\0';
+        if (!walk_push_dir (w, 0, dir))
+                return luaL_error (L, "not enough memory");
+
+        w->running = nthreads;
+        for (i = 0; i < nthreads; i++) {
+                walk_worker *ww = malloc (sizeof(walk_worker));
+                if (!ww)
+                        break;
+                ww->w = w;
+                ww->id = i;
+                ww->out = NULL;
+                if (pthread_create (&w->threads[i], NULL, walk_worker_main, ww)) {
+                        free (ww);
+                        break;
+                }
+                w->started++;
+        }
+        if (w->started < nthreads) {
+                /* deques of the missing workers stay empty: others steal */
+                pthread_mutex_lock (&w->rlock);
+                w->running -= nthreads - w->started;
+                if (w->running == 0)
+                        pthread_cond_broadcast (&w->not_empty);
+                pthread_mutex_unlock (&w->rlock);
+                if (w->started == 0)
+                        return luaL_error (L, "cannot start walk threads");
+        }
+
+        lua_pushcfunction (L, walk_iter);
+        lua_insert (L, -2);
+        return 2;
+}
+
+
+
+/*
+** Creates walk metatable.
+*/
+static int walk_create_meta (lua_State *L) {
+        luaL_newmetatable (L, WALK_METATABLE);
+
+        /* Method table */
+        lua_newtable (L);
+        lua_pushcfunction (L, walk_iter);
+        lua_setfield (L, -2, "next");
+        lua_pushcfunction (L, walk_close);
+        lua_setfield (L, -2, "close");
+
+        /* Metamethods */
+        lua_setfield (L, -2, "__index");
+        lua_pushcfunction (L, walk_close);
+        lua_setfield (L, -2, "__gc");
+        return 1;
+}
+
+#endif /* LFS_HAVE_WALK */
+
+
+#ifdef LFS_HAVE_WATCH
+/*
+** Change notification: lfs.watch (path [, mask])
+**   local w = lfs.watch ("conf", {"modify", "create", "delete"})
+**   for _, ev in ipairs (w:read_events (64, 1.5)) do ... end
+** mask lists the changes of interest: "modify", "attrib", "create",
+** "delete", "move" (default: all). w:read_events ([max [, timeout]])
+** returns an array of at most max (default WATCH_MAX) events, waiting
+** up to timeout seconds for the first one (default 0: does not block).
+** Each event has name (the entry of a watched directory, if known) and
+** a true field per change: modify, attrib, create, delete, moved_from,
+** moved_to, self (the watched path itself went away or moved) and
+** overflow (events were lost: rescan). w:fd () is the descriptor to
+** give to select/poll, it is readable when events are pending. Nothing
+** is polled meanwhile: on Linux this is inotify, on the BSDs and macOS
+** kqueue (changes of the watched path itself only, no names).
+*/
+#define WATCH_METATABLE "watch metatable"
+#define WATCH_MAX 64
+
+enum {
+        WATCH_MODIFY = 1, WATCH_ATTRIB = 2, WATCH_CREATE = 4,
+        WATCH_DELETE = 8, WATCH_MOVE = 16
+};
+
+static const char *const watch_names[] = {
+        "modify", "attrib", "create", "delete", "move", NULL
+};
+
+typedef struct watch_data {
+        int fd;                 /* -1 once closed */
+#ifdef LFS_WATCH_INOTIFY
+        int pos, len;           /* of unread events in buf */
+        char buf[4096] __attribute__ ((aligned (__alignof__ (struct inotify_event))));
+#else
+        int file;               /* the watched path, open for kevent() */
+#endif
+} watch_data;
+
+
+static watch_data *check_watch (lua_State *L) {
+        watch_data *w = (watch_data *)luaL_checkudata (L, 1, WATCH_METATABLE);
+        luaL_argcheck (L, w->fd >= 0, 1, "closed watch");
+        return w;
+}
+
+/* Sets field name of the event table on top of the stack */
+static void watch_flag (lua_State *L, const char *name) {
+        lua_pushboolean (L, 1);
+        lua_setfield (L, -2, name);
+}
+
+#ifdef LFS_WATCH_INOTIFY
+static uint32_t watch_mask (int mask) {
+        return (mask & WATCH_MODIFY ? IN_MODIFY : 0) |
+               (mask & WATCH_ATTRIB ? IN_ATTRIB : 0) |
+               (mask & WATCH_CREATE ? IN_CREATE : 0) |
+               (mask & WATCH_DELETE ? IN_DELETE | IN_DELETE_SELF : 0) |
+               (mask & WATCH_MOVE ? IN_MOVED_FROM | IN_MOVED_TO | IN_MOVE_SELF : 0);
+}
+
+/* Pushes the next event, 0 when there are none for now */
+static int watch_next (lua_State *L, watch_data *w) {
+        struct inotify_event *ev;
+        ssize_t len;
+
+        for (;;) {
+                if (w->pos == w->len) {
+                        len = read (w->fd, w->buf, sizeof(w->buf));
+                        if (len <= 0) {
+                                if (len < 0 && errno != EAGAIN && errno != EINTR)
+                                        luaL_error (L, "cannot read events: %s", strerror (errno));
+                                return 0;
+                        }
+                        w->pos = 0;
+                        w->len = (int)len;
+                }
+                ev = (struct inotify_event *)(w->buf + w->pos);
+                w->pos += sizeof(struct inotify_event) + ev->len;
+                if (ev->mask & IN_IGNORED)  /* the watch went away with its path */
+                        continue;
+                break;
+        }
+
+        lua_createtable (L, 0, 3);
+        if (ev->len && ev->name[0]) {
+                lua_pushstring (L, ev->name);
+                lua_setfield (L, -2, "name");
+        }
+        if (ev->mask & IN_MODIFY) watch_flag (L, "modify");
+        if (ev->mask & IN_ATTRIB) watch_flag (L, "attrib");
+        if (ev->mask & IN_CREATE) watch_flag (L, "create");
+        if (ev->mask & (IN_DELETE | IN_DELETE_SELF)) watch_flag (L, "delete");
+        if (ev->mask & IN_MOVED_FROM) watch_flag (L, "moved_from");
+        if (ev->mask & IN_MOVED_TO) watch_flag (L, "moved_to");
+        if (ev->mask & (IN_DELETE_SELF | IN_MOVE_SELF)) watch_flag (L, "self");
+        if (ev->mask & IN_Q_OVERFLOW) watch_flag (L, "overflow");
+        if (ev->mask & IN_ISDIR) watch_flag (L, "directory");
+        return 1;
+}
+
+static int watch_open (watch_data *w, const char *path, int mask) {
+        w->pos = w->len = 0;
+        w->fd = inotify_init1 (IN_NONBLOCK | IN_CLOEXEC);
+        if (w->fd < 0)
+                return -1;
+        if (inotify_add_watch (w->fd, path, watch_mask (mask)) < 0) {
+                int err = errno;
+                close (w->fd);
+                w->fd = -1;
+                errno = err;
+                return -1;
+        }
+        return 0;
+}
+
+#else /* LFS_WATCH_KQUEUE */
+static u_int watch_mask (int mask) {
+        return (mask & WATCH_MODIFY ? NOTE_WRITE | NOTE_EXTEND : 0) |
+               (mask & WATCH_ATTRIB ? NOTE_ATTRIB : 0) |
+               (mask & WATCH_CREATE ? NOTE_WRITE : 0) |
+               (mask & WATCH_DELETE ? NOTE_DELETE | NOTE_WRITE : 0) |
+               (mask & WATCH_MOVE ? NOTE_RENAME | NOTE_WRITE : 0);
+}
+
+static int watch_next (lua_State *L, watch_data *w) {
+        struct kevent ev;
+        struct timespec zero = { 0, 0 };
+        int n = kevent (w->fd, NULL, 0, &ev, 1, &zero);
+
+        if (n < 0 && errno != EINTR)
+                luaL_error (L, "cannot read events: %s", strerror (errno));
+        if (n <= 0)
+                return 0;
+
+        lua_createtable (L, 0, 3);
+        if (ev.fflags & (NOTE_WRITE | NOTE_EXTEND)) watch_flag (L, "modify");
+        if (ev.fflags & NOTE_ATTRIB) watch_flag (L, "attrib");
+        if (ev.fflags & NOTE_DELETE) watch_flag (L, "delete");
+        if (ev.fflags & NOTE_RENAME) watch_flag (L, "moved_from");
+        if (ev.fflags & (NOTE_DELETE | NOTE_RENAME)) watch_flag (L, "self");
+        return 1;
+}
+
+static int watch_open (watch_data *w, const char *path, int mask) {
+        struct kevent ev;
+        int err;
+
+#ifdef O_EVTONLY
+        w->file = open (path, O_EVTONLY);
+#else
+        w->file = open (path, O_RDONLY);
+#endif
+        if (w->file < 0)
+                return -1;
+        w->fd = kqueue ();
+        if (w->fd >= 0) {
+                EV_SET (&ev, w->file, EVFILT_VNODE, EV_ADD | EV_CLEAR,
+                        watch_mask (mask), 0, NULL);
+                if (kevent (w->fd, &ev, 1, NULL, 0, NULL) == 0)
+                        return 0;
+        }
+        err = errno;
+        if (w->fd >= 0)
+                close (w->fd);
+        close (w->file);
+        w->fd = -1;
+        errno = err;
+        return -1;
+}
+#endif
+
+
+/*
+** Returns the pending events, waiting up to timeout for the first
+*/
+static int watch_read_events (lua_State *L) {
+        watch_data *w = check_watch (L);
+        int max = (int)luaL_optinteger (L, 2, WATCH_MAX);
+        lua_Number timeout = luaL_optnumber (L, 3, 0);
+        struct pollfd p;
+        int n = 0;
+
+        luaL_argcheck (L, max >= 1, 2, "max must be at least 1");
+        lua_settop (L, 1);
+        lua_createtable (L, max < WATCH_MAX ? max : WATCH_MAX, 0);
+        while (n < max && watch_next (L, w))
+                lua_rawseti (L, 2, ++n);
+
+        if (n == 0 && timeout > 0) {
+                p.fd = w->fd;
+                p.events = POLLIN;
+                if (poll (&p, 1, timeout < 2e6 ? (int)(timeout * 1000) : 2000000000) > 0)
+                        while (n < max && watch_next (L, w))
+                                lua_rawseti (L, 2, ++n);
+        }
+        return 1;
+}
+
+static int watch_fd (lua_State *L) {
+        lua_pushinteger (L, check_watch (L)->fd);
+        return 1;
+}
+
+static int watch_close (lua_State *L) {
+        watch_data *w = (watch_data *)lua_touserdata (L, 1);
+        if (w->fd >= 0) {
+                close (w->fd);
+#ifdef LFS_WATCH_KQUEUE
+                close (w->file);
+#endif
+                w->fd = -1;
+        }
+        return 0;
+}
+
+/*
+** Factory of watches
+*/
+static int watch_factory (lua_State *L) {
+        const char *path = luaL_checkstring (L, 1);
+        int i, n, mask = 0;
+        watch_data *w;
+
+        if (lua_isnoneornil (L, 2)) {
+                mask = WATCH_MODIFY | WATCH_ATTRIB | WATCH_CREATE |
+                       WATCH_DELETE | WATCH_MOVE;
+        } else {
+                luaL_checktype (L, 2, LUA_TTABLE);
+                n = (int)lua_objlen (L, 2);
+                for (i = 1; i <= n; i++) {
+                        const char *name;
+                        int j;
+                        lua_rawgeti (L, 2, i);
+                        name = lua_tostring (L, -1);
+                        for (j = 0; name && watch_names[j]; j++)
+                                if (strcmp (watch_names[j], name) == 0)
+                                        break;
+                        if (!name || !watch_names[j])
+                                return luaL_error (L, "invalid event name '%s'",
+                                                   name ? name : luaL_typename (L, -1));
+                        mask |= 1 << j;
+                        lua_pop (L, 1);
+                }
+        }
+
+        w = (watch_data *) lua_newuserdata (L, sizeof(watch_data));
+        w->fd = -1;
+        luaL_getmetatable (L, WATCH_METATABLE);
+        lua_setmetatable (L, -2);
+        if (watch_open (w, path, mask))
+                return pusherror (L, path);
+        return 1;
+}
+
+/*
+** Creates watch metatable.
+*/
+static int watch_create_meta (lua_State *L) {
+        luaL_newmetatable (L, WATCH_METATABLE);
+
+        /* Method table */
+        lua_newtable (L);
+        lua_pushcfunction (L, watch_read_events);
+        lua_setfield (L, -2, "read_events");
+        lua_pushcfunction (L, watch_fd);
+        lua_setfield (L, -2, "fd");
+        lua_pushcfunction (L, watch_close);
+        lua_setfield (L, -2, "close");
+
+        /* Metamethods */
+        lua_setfield (L, -2, "__index");
+        lua_pushcfunction (L, watch_close);
+        lua_setfield (L, -2, "__gc");
+        return 1;
+}
+
+#endif /* LFS_HAVE_WATCH */
+
+
 /*
 ** Assumes the table is on top of the stack.
 ** 补充一些版权，描述，版本等信息
@@ -948,7 +2164,6 @@ static void set_info (lua_State *L) {
 }
 
 static const struct luaL_Reg fslib[] = {
-        {"attributes", file_info},
         {"chdir", change_dir},
         {"currentdir", get_dir},
         {"dir", dir_iter_factory},
@@ -956,18 +2171,41 @@ static const struct luaL_Reg fslib[] = {
         {"lock", file_lock},
         {"mkdir", make_dir},
         {"rmdir", remove_dir},
-        {"symlinkattributes", link_info},
+        {"scandir", scan_iter_factory},
         {"setmode", lfs_f_setmode},
+        {"stat", file_stat},
+        {"lstat", link_stat},
         {"touch", file_utime},
         {"unlock", file_unlock},
         {"lock_dir", lfs_lock_dir},
+#ifdef LFS_HAVE_WALK
+        {"walk", walk_factory},
+#endif
+#ifdef LFS_HAVE_WATCH
+        {"watch", watch_factory},
+#endif
         {NULL, NULL},
 };
 
 int luaopen_lfs (lua_State *L) {
 		dir_create_meta (L);
     lock_create_meta (L);
+    scan_create_meta (L);
+#ifdef LFS_HAVE_WALK
+    walk_create_meta (L);
+#endif
+#ifdef LFS_HAVE_WATCH
+    watch_create_meta (L);
+#endif
     luaL_newlib (L, fslib);
+    /* attributes and symlinkattributes: closures over the member names */
+    push_member_names (L);
+    stat_create_meta (L);
+    lua_pushvalue (L, -1);
+    lua_pushcclosure (L, file_info, 1);
+    lua_setfield (L, -3, "attributes");
+    lua_pushcclosure (L, link_info, 1);
+    lua_setfield (L, -2, "symlinkattributes");
     lua_pushvalue(L, -1);
     lua_setglobal(L, LFS_LIBNAME);
     set_info (L);